@@ -29,12 +29,30 @@
 #include "debugwriter.h"
 #include "graphics.h"
 #include "audio.h"
+#include "input.h"
 #include "boost-hash.h"
+#include "textcache.h"
+#include "texpool.h"
+#include "gl-util.h"
+#include "preloader.h"
+#include "workerpool.h"
+#include "memstats.h"
+#include "startuptimer.h"
 
 #include <ruby/ruby.h>
+#include <ruby/version.h>
+#if RUBY_API_VERSION_MAJOR >= 2
+#include <ruby/thread.h>
+#endif
 
+#include <boost/functional/hash.hpp>
+
+#include <algorithm>
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <vector>
 #include <zlib.h>
 
 #include <SDL_filesystem.h>
@@ -46,12 +64,15 @@ extern const char module_rpg3[];
 static void mriBindingExecute();
 static void mriBindingTerminate();
 static void mriBindingReset();
+static void mriBindingUnlocked(void (*func)(void *), void *data);
 
 ScriptBinding scriptBindingImpl =
 {
 	mriBindingExecute,
 	mriBindingTerminate,
-	mriBindingReset
+	mriBindingReset,
+	gcIdle,
+	mriBindingUnlocked
 };
 
 ScriptBinding *scriptBinding = &scriptBindingImpl;
@@ -63,6 +84,7 @@ void bitmapBindingInit();
 void spriteBindingInit();
 void viewportBindingInit();
 void planeBindingInit();
+void particleSystemBindingInit();
 void windowBindingInit();
 void tilemapBindingInit();
 void windowVXBindingInit();
@@ -73,6 +95,9 @@ void audioBindingInit();
 void graphicsBindingInit();
 
 void fileIntBindingInit();
+void fileIntBindingFlush();
+
+void rpgCacheBindingInit();
 
 RB_METHOD(mriPrint);
 RB_METHOD(mriP);
@@ -80,6 +105,13 @@ RB_METHOD(mkxpDataDirectory);
 RB_METHOD(mkxpPuts);
 RB_METHOD(mkxpRawKeyStates);
 RB_METHOD(mkxpMouseInWindow);
+RB_METHOD(mkxpTextCacheStats);
+RB_METHOD(mkxpRenderStats);
+RB_METHOD(mkxpEventStats);
+RB_METHOD(mkxpMemoryStats);
+RB_METHOD(mkxpPreload);
+RB_METHOD(mkxpPreloadSE);
+RB_METHOD(mkxpAudioStats);
 
 RB_METHOD(mriRgssMain);
 RB_METHOD(mriRgssStop);
@@ -94,6 +126,7 @@ static void mriBindingInit()
 	spriteBindingInit();
 	viewportBindingInit();
 	planeBindingInit();
+	particleSystemBindingInit();
 
 	if (rgssVer == 1)
 	{
@@ -132,7 +165,10 @@ static void mriBindingInit()
 	}
 
 	if (rgssVer == 1)
+	{
 		rb_eval_string(module_rpg1);
+		rpgCacheBindingInit();
+	}
 	else if (rgssVer == 2)
 		rb_eval_string(module_rpg2);
 	else if (rgssVer == 3)
@@ -145,6 +181,13 @@ static void mriBindingInit()
 	_rb_define_module_function(mod, "puts", mkxpPuts);
 	_rb_define_module_function(mod, "raw_key_states", mkxpRawKeyStates);
 	_rb_define_module_function(mod, "mouse_in_window", mkxpMouseInWindow);
+	_rb_define_module_function(mod, "text_cache_stats", mkxpTextCacheStats);
+	_rb_define_module_function(mod, "render_stats", mkxpRenderStats);
+	_rb_define_module_function(mod, "event_stats", mkxpEventStats);
+	_rb_define_module_function(mod, "memory_stats", mkxpMemoryStats);
+	_rb_define_module_function(mod, "preload", mkxpPreload);
+	_rb_define_module_function(mod, "preload_se", mkxpPreloadSE);
+	_rb_define_module_function(mod, "audio_stats", mkxpAudioStats);
 
 	/* Load global constants */
 	rb_gv_set("MKXP", Qtrue);
@@ -239,6 +282,158 @@ RB_METHOD(mkxpMouseInWindow)
 	return rb_bool_new(EventThread::mouseState.inWindow);
 }
 
+static void hashSetInt(VALUE hash, const char *key, unsigned int value)
+{
+	rb_hash_aset(hash, ID2SYM(rb_intern(key)), UINT2NUM(value));
+}
+
+RB_METHOD(mkxpTextCacheStats)
+{
+	RB_UNUSED_PARAM;
+
+	TextCache &cache = shState->textCache();
+	VALUE hash = rb_hash_new();
+
+	hashSetInt(hash, "hits", cache.hits());
+	hashSetInt(hash, "misses", cache.misses());
+	hashSetInt(hash, "bytes", cache.memSize());
+	hashSetInt(hash, "entries", cache.entryCount());
+
+	return hash;
+}
+
+/* Counts of the last frame, plus the current TexPool memory */
+RB_METHOD(mkxpRenderStats)
+{
+	RB_UNUSED_PARAM;
+
+	const GLCallCounts counts = shState->graphics().glCalls();
+	TexPool &pool = shState->texPool();
+	VALUE hash = rb_hash_new();
+
+	hashSetInt(hash, "draws", counts.draws);
+	hashSetInt(hash, "quads", counts.quads);
+	hashSetInt(hash, "texture_binds", counts.textureBinds);
+	hashSetInt(hash, "program_binds", counts.programBinds);
+	hashSetInt(hash, "fbo_binds", counts.fboBinds);
+	hashSetInt(hash, "uniforms", counts.uniformUploads);
+	hashSetInt(hash, "texture_bytes", counts.texBytes);
+	hashSetInt(hash, "buffer_bytes", counts.bufferBytes);
+	hashSetInt(hash, "pool_hits", counts.poolHits);
+	hashSetInt(hash, "pool_misses", counts.poolMisses);
+	hashSetInt(hash, "pool_evictions", counts.poolEvictions);
+	hashSetInt(hash, "pool_bytes", pool.memSize());
+	hashSetInt(hash, "live_bytes", pool.liveMemSize());
+
+	return hash;
+}
+
+/* Per second rates of the event thread */
+RB_METHOD(mkxpEventStats)
+{
+	RB_UNUSED_PARAM;
+
+	const EventThread::EventStats stats = shState->eThread().eventStats();
+	VALUE hash = rb_hash_new();
+
+	hashSetInt(hash, "wakeups", stats.wakeups);
+	hashSetInt(hash, "events", stats.events);
+	hashSetInt(hash, "coalesced", stats.coalesced);
+
+	return hash;
+}
+
+/* [current, peak] per subsystem; 'reset' restarts
+ * peak tracking from the current values */
+RB_METHOD(mkxpMemoryStats)
+{
+	RB_UNUSED_PARAM;
+
+	bool reset = false;
+	rb_get_args(argc, argv, "|b", &reset RB_ARG_END);
+
+	sampleRubyHeap();
+
+	VALUE hash = rb_hash_new();
+
+	for (int i = 0; i < MemStats::SubsystemCount; ++i)
+	{
+		MemStats::Subsystem s = (MemStats::Subsystem) i;
+		VALUE pair = rb_ary_new3(2, LL2NUM(MemStats::current(s)),
+		                            LL2NUM(MemStats::peak(s)));
+
+		rb_hash_aset(hash, ID2SYM(rb_intern(MemStats::name(i))), pair);
+	}
+
+	if (reset)
+		MemStats::resetPeaks();
+
+	return hash;
+}
+
+/* Accepts any number of paths or arrays of paths */
+RB_METHOD(mkxpPreload)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE paths = rb_ary_new4(argc, argv);
+	paths = rb_funcall(paths, rb_intern("flatten"), 0);
+
+	for (long i = 0; i < RARRAY_LEN(paths); ++i)
+	{
+		VALUE path = rb_ary_entry(paths, i);
+		SafeStringValue(path);
+
+		shState->preloader().enqueue(RSTRING_PTR(path));
+	}
+
+	return Qnil;
+}
+
+/* Accepts any number of SE names or arrays of them,
+ * as they would be passed to Audio.se_play */
+RB_METHOD(mkxpPreloadSE)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE paths = rb_ary_new4(argc, argv);
+	paths = rb_funcall(paths, rb_intern("flatten"), 0);
+
+	for (long i = 0; i < RARRAY_LEN(paths); ++i)
+	{
+		VALUE path = rb_ary_entry(paths, i);
+		SafeStringValue(path);
+
+		shState->audio().sePreload(RSTRING_PTR(path));
+	}
+
+	return Qnil;
+}
+
+static VALUE streamStats(Audio::StreamType type)
+{
+	Audio &audio = shState->audio();
+	VALUE hash = rb_hash_new();
+
+	hashSetInt(hash, "underruns", audio.streamUnderruns(type));
+	hashSetInt(hash, "buffers", audio.streamBufferCount(type));
+
+	return hash;
+}
+
+RB_METHOD(mkxpAudioStats)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE hash = rb_hash_new();
+
+	rb_hash_aset(hash, ID2SYM(rb_intern("bgm")), streamStats(Audio::BGM));
+	rb_hash_aset(hash, ID2SYM(rb_intern("bgs")), streamStats(Audio::BGS));
+	rb_hash_aset(hash, ID2SYM(rb_intern("me")), streamStats(Audio::ME));
+
+	return hash;
+}
+
 static VALUE rgssMainCb(VALUE block)
 {
 	rb_funcall2(block, rb_intern("call"), 0, 0);
@@ -374,6 +569,330 @@ struct BacktraceData
 
 #define SCRIPT_SECTION_FMT (rgssVer >= 3 ? "{%04ld}" : "Section%03ld")
 
+/* Inflates one compressed script section in a single pass,
+ * growing the output as needed instead of retrying */
+struct ScriptDecodeJob : WorkerJob
+{
+	const unsigned char *src;
+	size_t srcLen;
+	bool active;
+
+	std::string decoded;
+	bool ok;
+
+	ScriptDecodeJob()
+	    : src(0),
+	      srcLen(0),
+	      active(false),
+	      ok(false)
+	{}
+
+	void run()
+	{
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+
+		if (inflateInit(&zs) != Z_OK)
+			return;
+
+		zs.next_in = const_cast<Bytef*>(src);
+		zs.avail_in = srcLen;
+
+		/* Script source usually deflates to about a quarter */
+		decoded.resize(std::max<size_t>(srcLen * 4, 0x1000));
+
+		int result;
+
+		do
+		{
+			if (zs.total_out == decoded.size())
+				decoded.resize(decoded.size() * 2);
+
+			zs.next_out = reinterpret_cast<Bytef*>(&decoded[zs.total_out]);
+			zs.avail_out = decoded.size() - zs.total_out;
+
+			result = inflate(&zs, Z_NO_FLUSH);
+		}
+		while (result == Z_OK);
+
+		decoded.resize(zs.total_out);
+		inflateEnd(&zs);
+
+		ok = (result == Z_STREAM_END);
+	}
+};
+
+#define SCRIPT_CACHE_MAGIC "MKXPBC01"
+
+/* Persists the compiled instruction sequences of the script
+ * sections, so that later starts don't have to parse them again.
+ * Sections are keyed by a hash of their compressed source and
+ * their file name; the whole file is discarded when the Ruby
+ * build differs. Only sections used in a run are written back */
+struct ScriptCache
+{
+	struct Entry
+	{
+		std::string binary;
+		bool used;
+	};
+
+	std::string cacheFile;
+	BoostHash<size_t, Entry> entries;
+	bool modified;
+
+	VALUE iseqClass;
+
+	ScriptCache(const std::string &cacheFile)
+	    : cacheFile(cacheFile),
+	      modified(false),
+	      iseqClass(Qnil)
+	{
+		if (cacheFile.empty())
+			return;
+
+		/* Binary instruction sequences need Ruby 2.3+ */
+		if (!rb_const_defined(rb_cObject, rb_intern("RubyVM")))
+			return;
+
+		VALUE vm = rb_const_get(rb_cObject, rb_intern("RubyVM"));
+		VALUE klass = rb_const_get(vm, rb_intern("InstructionSequence"));
+
+		if (!rb_respond_to(klass, rb_intern("load_from_binary")))
+			return;
+
+		iseqClass = klass;
+		readFile();
+	}
+
+	bool enabled() const
+	{
+		return iseqClass != Qnil;
+	}
+
+	static size_t key(VALUE compressed, VALUE fname)
+	{
+		const char *data = RSTRING_PTR(compressed);
+		size_t seed = boost::hash_range(data, data + RSTRING_LEN(compressed));
+		boost::hash_combine(seed, std::string(RSTRING_PTR(fname), RSTRING_LEN(fname)));
+
+		return seed;
+	}
+
+	static VALUE loadHelper(VALUE arg)
+	{
+		VALUE *args = reinterpret_cast<VALUE*>(arg);
+		return rb_funcall(args[0], rb_intern("load_from_binary"), 1, args[1]);
+	}
+
+	static VALUE compileHelper(VALUE arg)
+	{
+		VALUE *args = reinterpret_cast<VALUE*>(arg);
+		VALUE iseq = rb_funcall(args[0], rb_intern("compile"), 3,
+		                        args[1], args[2], args[2]);
+
+		return rb_ary_new3(2, iseq, rb_funcall(iseq, rb_intern("to_binary"), 0));
+	}
+
+	/* Returns the instruction sequence of the script 'string',
+	 * or Qnil if it can't be had, in which case the script has
+	 * to be evaluated from source (that's also how syntax
+	 * errors get reported) */
+	VALUE iseqFor(size_t key, VALUE string, VALUE fname)
+	{
+		if (!enabled())
+			return Qnil;
+
+		int state;
+
+		if (entries.contains(key))
+		{
+			Entry &entry = entries[key];
+			VALUE args[] = { iseqClass, rb_str_new(entry.binary.data(), entry.binary.size()) };
+			VALUE iseq = rb_protect(loadHelper, (VALUE) args, &state);
+
+			if (!state)
+			{
+				entry.used = true;
+				return iseq;
+			}
+
+			/* Stale or damaged, compile it anew */
+			rb_set_errinfo(Qnil);
+			entries.remove(key);
+			modified = true;
+		}
+
+		VALUE args[] = { iseqClass, string, fname };
+		VALUE result = rb_protect(compileHelper, (VALUE) args, &state);
+
+		if (state)
+		{
+			rb_set_errinfo(Qnil);
+			return Qnil;
+		}
+
+		VALUE binary = rb_ary_entry(result, 1);
+
+		Entry entry;
+		entry.binary.assign(RSTRING_PTR(binary), RSTRING_LEN(binary));
+		entry.used = true;
+		entries.insert(key, entry);
+		modified = true;
+
+		return rb_ary_entry(result, 0);
+	}
+
+	static bool read(FILE *f, void *dst, size_t size)
+	{
+		return fread(dst, 1, size, f) == size;
+	}
+
+	void readFile()
+	{
+		FILE *f = fopen(cacheFile.c_str(), "rb");
+
+		if (!f)
+			return;
+
+		char magic[sizeof(SCRIPT_CACHE_MAGIC)-1];
+		uint32_t descLen, count;
+		std::string desc;
+
+		bool ok = read(f, magic, sizeof(magic))
+		       && !memcmp(magic, SCRIPT_CACHE_MAGIC, sizeof(magic))
+		       && read(f, &descLen, sizeof(descLen));
+
+		if (ok)
+		{
+			desc.resize(descLen);
+			ok = (descLen == 0 || read(f, &desc[0], descLen))
+			  && desc == ruby_description
+			  && read(f, &count, sizeof(count));
+		}
+
+		for (uint32_t i = 0; ok && i < count; ++i)
+		{
+			uint64_t key;
+			uint32_t size;
+
+			if (!read(f, &key, sizeof(key)) || !read(f, &size, sizeof(size)) || size == 0)
+				break;
+
+			Entry entry;
+			entry.binary.resize(size);
+			entry.used = false;
+
+			if (!read(f, &entry.binary[0], size))
+				break;
+
+			entries.insert(key, entry);
+		}
+
+		fclose(f);
+	}
+
+	/* Writes the cache file if any section was compiled
+	 * or went unused during this run */
+	void save()
+	{
+		if (!enabled())
+			return;
+
+		uint32_t count = 0;
+		BoostHash<size_t, Entry>::const_iterator iter;
+
+		for (iter = entries.cbegin(); iter != entries.cend(); ++iter)
+		{
+			if (iter->second.used)
+				++count;
+			else
+				modified = true;
+		}
+
+		if (!modified)
+			return;
+
+		std::string tmpFile = cacheFile + ".tmp";
+		FILE *f = fopen(tmpFile.c_str(), "wb");
+
+		if (!f)
+		{
+			Debug() << "Failed to write script cache" << cacheFile;
+			return;
+		}
+
+		uint32_t descLen = strlen(ruby_description);
+
+		bool ok = fwrite(SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC)-1, 1, f) == 1
+		       && fwrite(&descLen, sizeof(descLen), 1, f) == 1
+		       && fwrite(ruby_description, 1, descLen, f) == descLen
+		       && fwrite(&count, sizeof(count), 1, f) == 1;
+
+		for (iter = entries.cbegin(); ok && iter != entries.cend(); ++iter)
+		{
+			const Entry &entry = iter->second;
+
+			if (!entry.used)
+				continue;
+
+			uint64_t key = iter->first;
+			uint32_t size = entry.binary.size();
+
+			ok = fwrite(&key, sizeof(key), 1, f) == 1
+			  && fwrite(&size, sizeof(size), 1, f) == 1
+			  && fwrite(entry.binary.data(), 1, size, f) == size;
+		}
+
+		fclose(f);
+
+		/* Replace the old file only once the new one is complete,
+		 * so an interrupted write can't leave a truncated cache */
+		if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+		{
+			Debug() << "Failed to write script cache" << cacheFile;
+			remove(tmpFile.c_str());
+		}
+
+		modified = false;
+	}
+};
+
+/* Like the path cache, keyed by the game's identity */
+static std::string scriptCacheFile(const Config &conf)
+{
+	const std::string &dir = conf.customDataPath.empty() ?
+	        conf.commonDataPath : conf.customDataPath;
+
+	if (!conf.scriptCache || dir.empty())
+		return std::string();
+
+	size_t gameHash = boost::hash<std::string>()(conf.gameFolder + "/" + conf.execName);
+
+	char name[64];
+	snprintf(name, sizeof(name), "scriptcache-%08x.bin", (unsigned) gameHash);
+
+	return dir + name;
+}
+
+/* Ruby visible file name of script section 'i' */
+static std::string sectionFileName(const Config &conf, long i, const char *scriptName)
+{
+	char buf[512];
+
+	if (conf.useScriptNames)
+		snprintf(buf, sizeof(buf), "%03ld:%s", i, scriptName);
+	else
+		snprintf(buf, sizeof(buf), SCRIPT_SECTION_FMT, i);
+
+	return buf;
+}
+
+static VALUE iseqEvalHelper(VALUE iseq)
+{
+	return rb_funcall(iseq, rb_intern("eval"), 0);
+}
+
 static void runRMXPScripts(BacktraceData &btData)
 {
 	const Config &conf = shState->rtData().config;
@@ -397,6 +916,7 @@ static void runRMXPScripts(BacktraceData &btData)
 	 * still go wrong */
 	try
 	{
+		StartupPhase phase("Script load");
 		scriptArray = kernelLoadDataInt(scriptPack.c_str(), false);
 	}
 	catch (const Exception &e)
@@ -415,54 +935,101 @@ static void runRMXPScripts(BacktraceData &btData)
 
 	long scriptCount = RARRAY_LEN(scriptArray);
 
-	std::string decodeBuffer;
-	decodeBuffer.resize(0x1000);
-
-	for (long i = 0; i < scriptCount; ++i)
 	{
-		VALUE script = rb_ary_entry(scriptArray, i);
+		StartupPhase phase("Script decode");
 
-		if (!RB_TYPE_P(script, RUBY_T_ARRAY))
-			continue;
+		/* Sections are inflated on the worker pool, then
+		 * stored in order as they complete */
+		std::vector<ScriptDecodeJob> jobs(scriptCount);
+		WorkerPool &pool = shState->workerPool();
 
-		VALUE scriptName   = rb_ary_entry(script, 1);
-		VALUE scriptString = rb_ary_entry(script, 2);
+		for (long i = 0; i < scriptCount; ++i)
+		{
+			VALUE script = rb_ary_entry(scriptArray, i);
+
+			if (!RB_TYPE_P(script, RUBY_T_ARRAY))
+				continue;
 
-		int result = Z_OK;
-		unsigned long bufferLen;
+			VALUE scriptString = rb_ary_entry(script, 2);
 
-		while (true)
+			jobs[i].src = reinterpret_cast<const unsigned char*>(RSTRING_PTR(scriptString));
+			jobs[i].srcLen = RSTRING_LEN(scriptString);
+			jobs[i].active = true;
+
+			if (pool.enabled())
+				pool.submit(jobs[i]);
+		}
+
+		for (long i = 0; i < scriptCount; ++i)
 		{
-			unsigned char *bufferPtr =
-			        reinterpret_cast<unsigned char*>(const_cast<char*>(decodeBuffer.c_str()));
-			const unsigned char *sourcePtr =
-			        reinterpret_cast<const unsigned char*>(RSTRING_PTR(scriptString));
+			ScriptDecodeJob &job = jobs[i];
 
-			bufferLen = decodeBuffer.length();
+			if (!job.active)
+				continue;
 
-			result = uncompress(bufferPtr, &bufferLen,
-			                    sourcePtr, RSTRING_LEN(scriptString));
+			if (pool.enabled())
+				pool.wait(job);
+			else
+				job.run();
+
+			VALUE script = rb_ary_entry(scriptArray, i);
+
+			if (!job.ok)
+			{
+				static char buffer[256];
+				snprintf(buffer, sizeof(buffer), "Error decoding script %ld: '%s'",
+				         i, RSTRING_PTR(rb_ary_entry(script, 1)));
 
-			bufferPtr[bufferLen] = '\0';
+				showMsg(buffer);
+
+				/* Sections still queued must not outlive 'jobs' */
+				for (long j = i + 1; j < scriptCount; ++j)
+					if (jobs[j].active && pool.enabled())
+						pool.wait(jobs[j]);
 
-			if (result != Z_BUF_ERROR)
 				break;
+			}
+
+			rb_ary_store(script, 3, rb_str_new(job.decoded.data(), job.decoded.size()));
 
-			decodeBuffer.resize(decodeBuffer.size()*2);
+			std::string().swap(job.decoded);
 		}
+	}
+
+	{
+		StartupPhase phase("Script compile");
+
+		/* Compile (or load from the cache) all sections up front,
+		 * so that the cache is written before the game enters its
+		 * main loop, which it may never return from */
+		ScriptCache scriptCache(scriptCacheFile(conf));
+		VALUE iseqs = rb_ary_new2(scriptCount);
 
-		if (result != Z_OK)
+		for (long i = 0; scriptCache.enabled() && i < scriptCount; ++i)
 		{
-			static char buffer[256];
-			snprintf(buffer, sizeof(buffer), "Error decoding script %ld: '%s'",
-			         i, RSTRING_PTR(scriptName));
+			VALUE script = rb_ary_entry(scriptArray, i);
 
-			showMsg(buffer);
+			if (!RB_TYPE_P(script, RUBY_T_ARRAY))
+				continue;
 
-			break;
+			VALUE scriptDecoded = rb_ary_entry(script, 3);
+
+			/* Decoding stopped at an error */
+			if (NIL_P(scriptDecoded))
+				break;
+
+			const std::string name =
+			        sectionFileName(conf, i, RSTRING_PTR(rb_ary_entry(script, 1)));
+
+			VALUE fname = newStringUTF8(name.c_str(), name.size());
+			VALUE string = newStringUTF8(RSTRING_PTR(scriptDecoded),
+			                             RSTRING_LEN(scriptDecoded));
+
+			size_t key = ScriptCache::key(rb_ary_entry(script, 2), fname);
+			rb_ary_store(iseqs, i, scriptCache.iseqFor(key, string, fname));
 		}
 
-		rb_ary_store(script, 3, rb_str_new_cstr(decodeBuffer.c_str()));
+		scriptCache.save();
 	}
 
 	/* Execute preloaded scripts */
@@ -479,25 +1046,27 @@ static void runRMXPScripts(BacktraceData &btData)
 		for (long i = 0; i < scriptCount; ++i)
 		{
 			VALUE script = rb_ary_entry(scriptArray, i);
-			VALUE scriptDecoded = rb_ary_entry(script, 3);
-			VALUE string = newStringUTF8(RSTRING_PTR(scriptDecoded),
-			                             RSTRING_LEN(scriptDecoded));
-
-			VALUE fname;
 			const char *scriptName = RSTRING_PTR(rb_ary_entry(script, 1));
-			char buf[512];
-			int len;
+			const std::string name = sectionFileName(conf, i, scriptName);
 
-			if (conf.useScriptNames)
-				len = snprintf(buf, sizeof(buf), "%03ld:%s", i, scriptName);
+			btData.scriptNames.insert(name, scriptName);
+
+			VALUE iseq = rb_ary_entry(iseqs, i);
+			int state;
+
+			if (!NIL_P(iseq))
+			{
+				rb_protect(iseqEvalHelper, iseq, &state);
+			}
 			else
-				len = snprintf(buf, sizeof(buf), SCRIPT_SECTION_FMT, i);
+			{
+				VALUE scriptDecoded = rb_ary_entry(script, 3);
+				VALUE string = newStringUTF8(RSTRING_PTR(scriptDecoded),
+				                             RSTRING_LEN(scriptDecoded));
 
-			fname = newStringUTF8(buf, len);
-			btData.scriptNames.insert(buf, scriptName);
+				evalString(string, newStringUTF8(name.c_str(), name.size()), &state);
+			}
 
-			int state;
-			evalString(string, fname, &state);
 			if (state)
 				break;
 		}
@@ -508,6 +1077,8 @@ static void runRMXPScripts(BacktraceData &btData)
 
 		processReset();
 	}
+
+	RB_GC_GUARD(iseqs);
 }
 
 static void showExc(VALUE exc, const BacktraceData &btData)
@@ -571,11 +1142,15 @@ static void showExc(VALUE exc, const BacktraceData &btData)
 
 static void mriBindingExecute()
 {
-	ruby_init();
-	rb_eval_string("$KCODE='U'");
-
 	Config &conf = shState->rtData().config;
 
+	{
+		StartupPhase phase("Ruby init");
+
+		ruby_init();
+		rb_eval_string("$KCODE='U'");
+	}
+
 	if (!conf.rubyLoadpaths.empty())
 	{
 		/* Setup custom load paths */
@@ -595,6 +1170,12 @@ static void mriBindingExecute()
 	BacktraceData btData;
 
 	mriBindingInit();
+	gcSchedulerInit();
+
+	/* Input recordings play back the same only
+	 * with the same random numbers */
+	if (uint32_t seed = shState->input().randomSeed())
+		rb_funcall(rb_mKernel, rb_intern("srand"), 1, UINT2NUM(seed));
 
 	std::string &customScript = conf.customScript;
 	if (!customScript.empty())
@@ -606,6 +1187,9 @@ static void mriBindingExecute()
 	if (!NIL_P(exc) && !rb_obj_is_kind_of(exc, rb_eSystemExit))
 		showExc(exc, btData);
 
+	/* Finish writing files saved in the background */
+	fileIntBindingFlush();
+
 	ruby_cleanup(0);
 
 	shState->rtData().rqTermAck.set();
@@ -620,3 +1204,38 @@ static void mriBindingReset()
 {
 	rb_raise(getRbData()->exc[Reset], " ");
 }
+
+struct UnlockedCall
+{
+	void (*func)(void *);
+	void *data;
+	bool done;
+};
+
+static void *unlockedCall(void *data)
+{
+	UnlockedCall &call = *static_cast<UnlockedCall*>(data);
+
+	call.func(call.data);
+	call.done = true;
+
+	return 0;
+}
+
+static void mriBindingUnlocked(void (*func)(void *), void *data)
+{
+#if RUBY_API_VERSION_MAJOR >= 2
+	UnlockedCall call = { func, data, false };
+
+	/* Unlike the plain variant, this one doesn't handle pending
+	 * interrupts after taking the lock back, which could raise
+	 * (and longjmp) right out of the middle of Graphics.update.
+	 * With one pending beforehand it doesn't call at all though */
+	rb_thread_call_without_gvl2(unlockedCall, &call, 0, 0);
+
+	if (!call.done)
+		func(data);
+#else
+	func(data);
+#endif
+}
@@ -33,6 +33,7 @@
 #define BitmapType "Bitmap"
 #define SpriteType "Sprite"
 #define PlaneType "Plane"
+#define ParticleSystemType "ParticleSystem"
 #define ViewportType "Viewport"
 #define TilemapType "Tilemap"
 #define WindowType "Window"
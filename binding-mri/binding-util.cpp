@@ -22,8 +22,13 @@
 #include "binding-util.h"
 
 #include "sharedstate.h"
+#include "config.h"
 #include "exception.h"
 #include "util.h"
+#include "memstats.h"
+#include "profiler.h"
+
+#include <SDL_timer.h>
 
 #include <stdarg.h>
 #include <string.h>
@@ -64,6 +69,25 @@ RbData::~RbData()
 
 }
 
+VALUE RbData::getWrapKlass(const char *type, VALUE underKlass)
+{
+	/* Scripts only ever reopen the engine classes, so once
+	 * a constant is resolved it stays valid. The classes are
+	 * referenced by their constants and never collected */
+	for (size_t i = 0; i < wrapKlasses.size(); ++i)
+		if (wrapKlasses[i].type == type && wrapKlasses[i].underKlass == underKlass)
+			return wrapKlasses[i].klass;
+
+	WrapKlass entry;
+	entry.type = type;
+	entry.underKlass = underKlass;
+	entry.klass = rb_const_get(underKlass, rb_intern(type));
+
+	wrapKlasses.push_back(entry);
+
+	return entry.klass;
+}
+
 /* Indexed with Exception::Type */
 static const RbException excToRbExc[] =
 {
@@ -99,6 +123,169 @@ raiseDisposedAccess(VALUE self)
 	rb_raise(getRbData()->exc[RGSS], "disposed %s", buf);
 }
 
+void
+sampleRubyHeap()
+{
+	/* Each object heap page spans 16 KiB */
+	static const size_t pageSize = 16 * 1024;
+	static VALUE pagesKey = ID2SYM(rb_intern("heap_allocated_pages"));
+	static VALUE mallocKey = ID2SYM(rb_intern("malloc_increase_bytes"));
+
+	size_t bytes = rb_gc_stat(pagesKey) * pageSize + rb_gc_stat(mallocKey);
+
+	MemStats::set(MemStats::ScriptHeap, bytes);
+}
+
+/* Objects allocated since the last collection below which
+ * spending idle time on one isn't worth it */
+#define GC_IDLE_MIN_OBJECTS 10000
+
+/* Past this many (or this much malloc growth), the end of
+ * a frame is collected at even without idle time */
+#define GC_FORCE_OBJECTS 200000
+#define GC_FORCE_MALLOC (8 * 1024 * 1024)
+
+/* Minor collections after which a full one is forced,
+ * for games that never hold the screen still */
+#define GC_MAJOR_INTERVAL 64
+
+static struct
+{
+	bool active;
+
+	/* 'total_allocated_objects' after the last collection */
+	size_t allocated;
+
+	/* Running estimate of a minor collection's duration */
+	int minorUs;
+
+	int minorsSinceMajor;
+} gcState;
+
+static size_t
+gcStat(const char *key)
+{
+	return rb_gc_stat(ID2SYM(rb_intern(key)));
+}
+
+static size_t
+gcAllocated()
+{
+#if RUBY_API_VERSION_MAJOR == 2 && RUBY_API_VERSION_MINOR < 2
+	return gcStat("total_allocated_object");
+#else
+	return gcStat("total_allocated_objects");
+#endif
+}
+
+static size_t
+gcPendingObjects()
+{
+	return gcAllocated() - gcState.allocated;
+}
+
+static void
+gcRun(bool full)
+{
+	PROFILE_SCOPE(ScriptGC);
+
+	const uint64_t start = SDL_GetPerformanceCounter();
+
+	/* Explicit collections are skipped by some
+	 * versions while the collector is disabled */
+	rb_gc_enable();
+
+	if (full)
+	{
+		rb_gc_start();
+	}
+	else
+	{
+		VALUE gcModule = rb_const_get(rb_cObject, rb_intern("GC"));
+		VALUE opts = rb_hash_new();
+		rb_hash_aset(opts, ID2SYM(rb_intern("full_mark")), Qfalse);
+
+#if RUBY_API_VERSION_MAJOR >= 3
+		rb_funcallv_kw(gcModule, rb_intern("start"), 1, &opts, RB_PASS_KEYWORDS);
+#else
+		rb_funcall2(gcModule, rb_intern("start"), 1, &opts);
+#endif
+	}
+
+	rb_gc_disable();
+
+	const int us = (SDL_GetPerformanceCounter() - start)
+	             * 1000000 / SDL_GetPerformanceFrequency();
+
+	if (full)
+	{
+		gcState.minorsSinceMajor = 0;
+	}
+	else
+	{
+		++gcState.minorsSinceMajor;
+		gcState.minorUs = (gcState.minorUs * 3 + us) / 4;
+	}
+
+	gcState.allocated = gcAllocated();
+}
+
+void
+gcSchedulerInit()
+{
+	if (!shState->config().scheduledGC)
+		return;
+
+	rb_gc_disable();
+
+	gcState.active = true;
+	gcState.allocated = gcAllocated();
+	gcState.minorUs = 0;
+	gcState.minorsSinceMajor = 0;
+}
+
+void
+gcIdle(int usecs)
+{
+	if (!gcState.active)
+		return;
+
+	if (gcPendingObjects() < GC_IDLE_MIN_OBJECTS)
+		return;
+
+	if (gcState.minorUs > usecs)
+		return;
+
+	gcRun(false);
+}
+
+void
+gcFrameEnd()
+{
+	if (!gcState.active)
+		return;
+
+	if (gcPendingObjects() < GC_FORCE_OBJECTS
+	    && gcStat("malloc_increase_bytes") < GC_FORCE_MALLOC)
+		return;
+
+	gcRun(gcState.minorsSinceMajor >= GC_MAJOR_INTERVAL);
+}
+
+void
+gcCollect(bool full)
+{
+	if (!gcState.active)
+		return;
+
+	/* Nothing gained since the last (full) collection */
+	if (gcPendingObjects() < GC_IDLE_MIN_OBJECTS
+	    && (!full || gcState.minorsSinceMajor == 0))
+		return;
+
+	gcRun(full);
+}
+
 int
 rb_get_args(int argc, VALUE *argv, const char *format, ...)
 {
@@ -26,6 +26,8 @@
 
 #include "exception.h"
 
+#include <vector>
+
 enum RbException
 {
 	RGSS = 0,
@@ -51,6 +53,19 @@ struct RbData
 	/* Input module (RGSS3) */
 	VALUE buttoncodeHash;
 
+	/* Classes resolved by wrapObject, keyed by the address
+	 * of their type name and the module they live in */
+	struct WrapKlass
+	{
+		const char *type;
+		VALUE underKlass;
+		VALUE klass;
+	};
+
+	std::vector<WrapKlass> wrapKlasses;
+
+	VALUE getWrapKlass(const char *type, VALUE underKlass);
+
 	RbData();
 	~RbData();
 };
@@ -62,6 +77,31 @@ struct Exception;
 void
 raiseRbExc(const Exception &exc);
 
+/* Stores an estimate of the interpreter's heap size
+ * (object pages plus recent malloc growth) in MemStats */
+void
+sampleRubyHeap();
+
+/* Engine scheduled garbage collection ('scheduledGC' option).
+ * Automatic collection is turned off so it can't strike in the
+ * middle of a frame; minor collections are run in the time left
+ * over at the end of frames instead (gcIdle), and full ones
+ * where the screen is held still anyway (gcCollect). All of
+ * these do nothing unless the scheduler was enabled */
+void
+gcSchedulerInit();
+
+void
+gcIdle(int usecs);
+
+/* Collects anyway if too much garbage piled up
+ * since the last collection, at the end of a frame */
+void
+gcFrameEnd();
+
+void
+gcCollect(bool full);
+
 /* 2.1 has added a new field (flags) to rb_data_type_t */
 #include <ruby/version.h>
 #if RUBY_API_VERSION_MAJOR >= 2 && RUBY_API_VERSION_MINOR >= 1
@@ -157,7 +197,7 @@ setPrivateData(VALUE self, void *p)
 inline VALUE
 wrapObject(void *p, const char *type, VALUE underKlass = rb_cObject)
 {
-	VALUE klass = rb_const_get(underKlass, rb_intern(type));
+	VALUE klass = getRbData()->getWrapKlass(type, underKlass);
 	VALUE obj = rb_obj_alloc(klass);
 
 	setPrivateData(obj, p);
@@ -293,6 +333,112 @@ rb_bool_arg(VALUE arg, bool *out, int argPos = 0)
 	}
 }
 
+/* Compile time specialized counterparts of 'rb_get_args' for hot
+ * methods. Argument types are deduced from the out pointers (int,
+ * double, bool and VALUE, matching 'i', 'f', 'b' and 'o'), and the
+ * first 'Req' of them are mandatory, so no format string has to be
+ * parsed on every call. Returns the number of arguments unpacked */
+inline void
+rb_unpack_arg(VALUE arg, int *out, int argPos)
+{
+	rb_int_arg(arg, out, argPos);
+}
+
+inline void
+rb_unpack_arg(VALUE arg, double *out, int argPos)
+{
+	rb_float_arg(arg, out, argPos);
+}
+
+inline void
+rb_unpack_arg(VALUE arg, bool *out, int argPos)
+{
+	rb_bool_arg(arg, out, argPos);
+}
+
+inline void
+rb_unpack_arg(VALUE arg, VALUE *out, int)
+{
+	*out = arg;
+}
+
+inline int
+rb_unpack_argc(int argc, int req, int max)
+{
+	// FIXME print num of needed args vs provided
+	if (argc < req)
+		rb_raise(rb_eArgError, "wrong number of arguments");
+
+#ifndef NDEBUG
+	/* Same as rb_get_args, which only checks this in debug builds */
+	if (argc > max)
+		rb_raise(rb_eArgError, "wrong number of arguments");
+#endif
+
+	return argc < max ? argc : max;
+}
+
+#define RB_UNPACK_ARG(n, a) \
+	if (argc > n) \
+		rb_unpack_arg(argv[n], a, n);
+
+template<int Req, typename A>
+inline int
+rb_unpack_args(int argc, VALUE *argv, A *a)
+{
+	int count = rb_unpack_argc(argc, Req, 1);
+	RB_UNPACK_ARG(0, a)
+	return count;
+}
+
+template<int Req, typename A, typename B>
+inline int
+rb_unpack_args(int argc, VALUE *argv, A *a, B *b)
+{
+	int count = rb_unpack_argc(argc, Req, 2);
+	RB_UNPACK_ARG(0, a)
+	RB_UNPACK_ARG(1, b)
+	return count;
+}
+
+template<int Req, typename A, typename B, typename C>
+inline int
+rb_unpack_args(int argc, VALUE *argv, A *a, B *b, C *c)
+{
+	int count = rb_unpack_argc(argc, Req, 3);
+	RB_UNPACK_ARG(0, a)
+	RB_UNPACK_ARG(1, b)
+	RB_UNPACK_ARG(2, c)
+	return count;
+}
+
+template<int Req, typename A, typename B, typename C, typename D>
+inline int
+rb_unpack_args(int argc, VALUE *argv, A *a, B *b, C *c, D *d)
+{
+	int count = rb_unpack_argc(argc, Req, 4);
+	RB_UNPACK_ARG(0, a)
+	RB_UNPACK_ARG(1, b)
+	RB_UNPACK_ARG(2, c)
+	RB_UNPACK_ARG(3, d)
+	return count;
+}
+
+template<int Req, typename A, typename B, typename C, typename D, typename E>
+inline int
+rb_unpack_args(int argc, VALUE *argv, A *a, B *b, C *c, D *d, E *e)
+{
+	int count = rb_unpack_argc(argc, Req, 5);
+	RB_UNPACK_ARG(0, a)
+	RB_UNPACK_ARG(1, b)
+	RB_UNPACK_ARG(2, c)
+	RB_UNPACK_ARG(3, d)
+	RB_UNPACK_ARG(4, e)
+	return count;
+}
+
+#undef RB_UNPACK_ARG
+
 inline void
 rb_check_argc(int actual, int expected)
 {
@@ -353,6 +499,12 @@ rb_file_open_str(VALUE filename, const char *mode)
 		return self; \
 	}
 
+/* Declares 'var' as the ID of ivar 'name', interned on first use.
+ * Unlike rb_iv_get/set, the hot accessors then don't have to look
+ * up the name in the symbol table on every call */
+#define DEF_IV_ID(var, name) \
+	static const ID var = rb_intern(name)
+
 /* Object property which is copied by reference, with allowed NIL
  * FIXME: Getter assumes prop is disposable,
  * because self.disposed? is not checked in this case.
@@ -361,7 +513,8 @@ rb_file_open_str(VALUE filename, const char *mode)
     RB_METHOD(Klass##Get##PropName) \
     { \
 	RB_UNUSED_PARAM; \
-	return rb_iv_get(self, prop_iv); \
+	DEF_IV_ID(propId, prop_iv); \
+	return rb_ivar_get(self, propId); \
     } \
     RB_METHOD(Klass##Set##PropName) \
     { \
@@ -375,7 +528,8 @@ rb_file_open_str(VALUE filename, const char *mode)
 	else \
 prop = getPrivateDataCheck<PropKlass>(propObj, #PropKlass); \
 	GUARD_EXC( k->set##PropName(prop); ) \
-	rb_iv_set(self, prop_iv, propObj); \
+	DEF_IV_ID(propId, prop_iv); \
+	rb_ivar_set(self, propId, propObj); \
 	return propObj; \
     }
 
@@ -385,7 +539,8 @@ prop = getPrivateDataCheck<PropKlass>(propObj, #PropKlass); \
     { \
         RB_UNUSED_PARAM; \
         checkDisposed<Klass>(self); \
-        return rb_iv_get(self, prop_iv); \
+        DEF_IV_ID(propId, prop_iv); \
+        return rb_ivar_get(self, propId); \
     } \
     RB_METHOD(Klass##Set##PropName) \
     { \
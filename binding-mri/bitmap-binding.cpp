@@ -112,6 +112,31 @@ RB_METHOD(bitmapRect)
 	return wrapObject(r, RectType);
 }
 
+/* Same as 'rect', but returns one frozen Rect kept with the
+ * bitmap instead of allocating a new one on every call.
+ * Bitmap dimensions never change, and a disposed bitmap
+ * raises before the cached object is handed out */
+RB_METHOD(bitmapFrozenRect)
+{
+	RB_UNUSED_PARAM;
+
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	IntRect rect;
+	GUARD_EXC( rect = b->rect(); );
+
+	VALUE rectObj = rb_iv_get(self, "frozen_rect");
+
+	if (NIL_P(rectObj))
+	{
+		rectObj = wrapObject(new Rect(rect), RectType);
+		rb_obj_freeze(rectObj);
+		rb_iv_set(self, "frozen_rect", rectObj);
+	}
+
+	return rectObj;
+}
+
 RB_METHOD(bitmapBlt)
 {
 	Bitmap *b = getPrivateData<Bitmap>(self);
@@ -124,7 +149,7 @@ RB_METHOD(bitmapBlt)
 	Bitmap *src;
 	Rect *srcRect;
 
-	rb_get_args(argc, argv, "iioo|i", &x, &y, &srcObj, &srcRectObj, &opacity RB_ARG_END);
+	rb_unpack_args<4>(argc, argv, &x, &y, &srcObj, &srcRectObj, &opacity);
 
 	src = getPrivateDataCheck<Bitmap>(srcObj, BitmapType);
 	srcRect = getPrivateDataCheck<Rect>(srcRectObj, RectType);
@@ -146,7 +171,7 @@ RB_METHOD(bitmapStretchBlt)
 	Bitmap *src;
 	Rect *destRect, *srcRect;
 
-	rb_get_args(argc, argv, "ooo|i", &destRectObj, &srcObj, &srcRectObj, &opacity RB_ARG_END);
+	rb_unpack_args<3>(argc, argv, &destRectObj, &srcObj, &srcRectObj, &opacity);
 
 	src = getPrivateDataCheck<Bitmap>(srcObj, BitmapType);
 	destRect = getPrivateDataCheck<Rect>(destRectObj, RectType);
@@ -169,7 +194,7 @@ RB_METHOD(bitmapFillRect)
 		VALUE rectObj;
 		Rect *rect;
 
-		rb_get_args(argc, argv, "oo", &rectObj, &colorObj RB_ARG_END);
+		rb_unpack_args<2>(argc, argv, &rectObj, &colorObj);
 
 		rect = getPrivateDataCheck<Rect>(rectObj, RectType);
 		color = getPrivateDataCheck<Color>(colorObj, ColorType);
@@ -180,7 +205,7 @@ RB_METHOD(bitmapFillRect)
 	{
 		int x, y, width, height;
 
-		rb_get_args(argc, argv, "iiiio", &x, &y, &width, &height, &colorObj RB_ARG_END);
+		rb_unpack_args<5>(argc, argv, &x, &y, &width, &height, &colorObj);
 
 		color = getPrivateDataCheck<Color>(colorObj, ColorType);
 
@@ -207,7 +232,7 @@ RB_METHOD(bitmapGetPixel)
 
 	int x, y;
 
-	rb_get_args(argc, argv, "ii", &x, &y RB_ARG_END);
+	rb_unpack_args<2>(argc, argv, &x, &y);
 
 	Color value;
 	GUARD_EXC( value = b->getPixel(x, y); );
@@ -217,6 +242,35 @@ RB_METHOD(bitmapGetPixel)
 	return wrapObject(color, ColorType);
 }
 
+RB_METHOD(bitmapGetPixels)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	IntRect rect;
+
+	if (argc == 1)
+	{
+		VALUE rectObj;
+
+		rb_get_args(argc, argv, "o", &rectObj RB_ARG_END);
+
+		rect = getPrivateDataCheck<Rect>(rectObj, RectType)->toIntRect();
+	}
+	else
+	{
+		rb_get_args(argc, argv, "iiii", &rect.x, &rect.y, &rect.w, &rect.h RB_ARG_END);
+	}
+
+	if (rect.w <= 0 || rect.h <= 0)
+		return rb_str_new(0, 0);
+
+	VALUE data = rb_str_new(0, rect.w * rect.h * 4);
+
+	GUARD_EXC( b->getPixels(rect, (uint8_t*) RSTRING_PTR(data)); );
+
+	return data;
+}
+
 RB_METHOD(bitmapSetPixel)
 {
 	Bitmap *b = getPrivateData<Bitmap>(self);
@@ -226,7 +280,7 @@ RB_METHOD(bitmapSetPixel)
 
 	Color *color;
 
-	rb_get_args(argc, argv, "iio", &x, &y, &colorObj RB_ARG_END);
+	rb_unpack_args<3>(argc, argv, &x, &y, &colorObj);
 
 	color = getPrivateDataCheck<Color>(colorObj, ColorType);
 
@@ -235,6 +289,38 @@ RB_METHOD(bitmapSetPixel)
 	return self;
 }
 
+RB_METHOD(bitmapSetPixels)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	IntRect rect;
+	VALUE data;
+
+	if (argc == 2)
+	{
+		VALUE rectObj;
+
+		rb_get_args(argc, argv, "oS", &rectObj, &data RB_ARG_END);
+
+		rect = getPrivateDataCheck<Rect>(rectObj, RectType)->toIntRect();
+	}
+	else
+	{
+		rb_get_args(argc, argv, "iiiiS", &rect.x, &rect.y, &rect.w, &rect.h,
+		            &data RB_ARG_END);
+	}
+
+	if (rect.w <= 0 || rect.h <= 0)
+		return self;
+
+	if (RSTRING_LEN(data) < (long) rect.w * rect.h * 4)
+		rb_raise(rb_eArgError, "Pixel data too short for the rectangle");
+
+	GUARD_EXC( b->setPixels(rect, (const uint8_t*) RSTRING_PTR(data)); );
+
+	return self;
+}
+
 RB_METHOD(bitmapHueChange)
 {
 	Bitmap *b = getPrivateData<Bitmap>(self);
@@ -298,10 +384,9 @@ RB_METHOD(bitmapDrawText)
 	return self;
 }
 
-RB_METHOD(bitmapTextSize)
+static const char *
+textSizeArg(int argc, VALUE *argv)
 {
-	Bitmap *b = getPrivateData<Bitmap>(self);
-
 	const char *str;
 
 	if (rgssVer >= 2)
@@ -316,6 +401,15 @@ RB_METHOD(bitmapTextSize)
 		rb_get_args(argc, argv, "z", &str RB_ARG_END);
 	}
 
+	return str;
+}
+
+RB_METHOD(bitmapTextSize)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	const char *str = textSizeArg(argc, argv);
+
 	IntRect value;
 	GUARD_EXC( value = b->textSize(str); );
 
@@ -324,6 +418,81 @@ RB_METHOD(bitmapTextSize)
 	return wrapObject(rect, RectType);
 }
 
+/* Width component of 'text_size', without wrapping a Rect */
+RB_METHOD(bitmapTextWidth)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	const char *str = textSizeArg(argc, argv);
+
+	IntRect value;
+	GUARD_EXC( value = b->textSize(str); );
+
+	return INT2FIX(value.w);
+}
+
+/* draw_text_wrapped(rect, str, align = 0, line_height = 0);
+ * returns the number of lines drawn */
+RB_METHOD(bitmapDrawTextWrapped)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	VALUE rectObj;
+	const char *str;
+	int align = Bitmap::Left;
+	int lineHeight = 0;
+
+	if (rgssVer >= 2)
+	{
+		VALUE strObj;
+		rb_get_args(argc, argv, "oo|ii", &rectObj, &strObj, &align, &lineHeight RB_ARG_END);
+
+		str = objAsStringPtr(strObj);
+	}
+	else
+	{
+		rb_get_args(argc, argv, "oz|ii", &rectObj, &str, &align, &lineHeight RB_ARG_END);
+	}
+
+	Rect *rect = getPrivateDataCheck<Rect>(rectObj, RectType);
+
+	int lines = 0;
+	GUARD_EXC( lines = b->drawTextWrapped(rect->toIntRect(), str, align, lineHeight); );
+
+	return INT2FIX(lines);
+}
+
+/* Array of the widths of all prefixes of the string, one per
+ * character, so that text can be wrapped in a single call */
+RB_METHOD(bitmapTextPrefixWidths)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	const char *str;
+
+	if (rgssVer >= 2)
+	{
+		VALUE strObj;
+		rb_get_args(argc, argv, "o", &strObj RB_ARG_END);
+
+		str = objAsStringPtr(strObj);
+	}
+	else
+	{
+		rb_get_args(argc, argv, "z", &str RB_ARG_END);
+	}
+
+	std::vector<int> widths;
+	GUARD_EXC( b->textPrefixWidths(str, widths); );
+
+	VALUE ary = rb_ary_new2(widths.size());
+
+	for (size_t i = 0; i < widths.size(); ++i)
+		rb_ary_push(ary, INT2FIX(widths[i]));
+
+	return ary;
+}
+
 DEF_PROP_OBJ_VAL(Bitmap, Font, Font, "font")
 
 RB_METHOD(bitmapGradientFillRect)
@@ -393,11 +562,12 @@ RB_METHOD(bitmapClearRect)
 
 RB_METHOD(bitmapBlur)
 {
-	RB_UNUSED_PARAM;
-
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
-	b->blur();
+	int strength = 1;
+	rb_get_args(argc, argv, "|i", &strength RB_ARG_END);
+
+	b->blur(strength);
 
 	return Qnil;
 }
@@ -449,15 +619,21 @@ bitmapBindingInit()
 	_rb_define_method(klass, "width",       bitmapWidth);
 	_rb_define_method(klass, "height",      bitmapHeight);
 	_rb_define_method(klass, "rect",        bitmapRect);
+	_rb_define_method(klass, "frozen_rect", bitmapFrozenRect);
 	_rb_define_method(klass, "blt",         bitmapBlt);
 	_rb_define_method(klass, "stretch_blt", bitmapStretchBlt);
 	_rb_define_method(klass, "fill_rect",   bitmapFillRect);
 	_rb_define_method(klass, "clear",       bitmapClear);
 	_rb_define_method(klass, "get_pixel",   bitmapGetPixel);
+	_rb_define_method(klass, "get_pixels",  bitmapGetPixels);
 	_rb_define_method(klass, "set_pixel",   bitmapSetPixel);
+	_rb_define_method(klass, "set_pixels",  bitmapSetPixels);
 	_rb_define_method(klass, "hue_change",  bitmapHueChange);
 	_rb_define_method(klass, "draw_text",   bitmapDrawText);
 	_rb_define_method(klass, "text_size",   bitmapTextSize);
+	_rb_define_method(klass, "text_width",  bitmapTextWidth);
+	_rb_define_method(klass, "text_prefix_widths", bitmapTextPrefixWidths);
+	_rb_define_method(klass, "draw_text_wrapped", bitmapDrawTextWrapped);
 
 	if (rgssVer >= 2)
 	{
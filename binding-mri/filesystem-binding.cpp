@@ -24,9 +24,18 @@
 #include "sharedstate.h"
 #include "filesystem.h"
 #include "util.h"
+#include "workerpool.h"
+#include "packeddatacache.h"
+#include "debugwriter.h"
+#include "boost-hash.h"
 
 #include "ruby/intern.h"
 
+#include <ctype.h>
+#include <list>
+#include <stdio.h>
+#include <string>
+
 static void
 fileIntFreeInstance(void *inst)
 {
@@ -129,21 +138,179 @@ RB_METHOD(fileIntPos) {
     return LL2NUM(pos);
 }
 
+/* Raw contents of recently loaded data files, so that
+ * eg. maps revisited often don't have to be read and
+ * decrypted from the archive again. Only the bytes are
+ * kept; every load still unmarshals a fresh object graph */
+struct DataCache
+{
+	struct Node
+	{
+		std::string key;
+		std::string data;
+	};
+
+	typedef std::list<Node> NodeList;
+
+	/* Sorted by last use, most recent first */
+	NodeList lru;
+	BoostHash<std::string, NodeList::iterator> hash;
+	size_t memSize;
+
+	DataCache()
+	    : memSize(0)
+	{}
+
+	size_t maxMemSize() const
+	{
+		return shState->config().dataCacheSize;
+	}
+
+	/* Spellings that resolve to the same file
+	 * should share one entry */
+	static std::string makeKey(const char *filename)
+	{
+		std::string key(filename);
+
+		for (size_t i = 0; i < key.size(); ++i)
+			if (key[i] == '\\')
+				key[i] = '/';
+
+		while (key.compare(0, 2, "./") == 0)
+			key.erase(0, 2);
+
+		/* With the path cache, lookups ignore case */
+		if (shState->config().pathCache)
+			for (size_t i = 0; i < key.size(); ++i)
+				key[i] = tolower(key[i]);
+
+		return key;
+	}
+
+	VALUE lookup(const std::string &key)
+	{
+		if (!hash.contains(key))
+			return Qnil;
+
+		NodeList::iterator iter = hash[key];
+		lru.splice(lru.begin(), lru, iter);
+
+		return rb_str_new(iter->data.data(), iter->data.size());
+	}
+
+	void insert(const std::string &key, VALUE data)
+	{
+		const size_t bytes = RSTRING_LEN(data);
+
+		if (bytes > maxMemSize() || hash.contains(key))
+			return;
+
+		while (memSize + bytes > maxMemSize())
+			evictLast();
+
+		lru.push_front(Node());
+
+		Node &node = lru.front();
+		node.key = key;
+		node.data.assign(RSTRING_PTR(data), bytes);
+
+		hash.insert(key, lru.begin());
+		memSize += bytes;
+	}
+
+	void evictLast()
+	{
+		Node &node = lru.back();
+
+		memSize -= node.data.size();
+		hash.remove(node.key);
+		lru.pop_back();
+	}
+
+	void clear()
+	{
+		hash.clear();
+		lru.clear();
+		memSize = 0;
+	}
+};
+
+static DataCache dataCache;
+
+/* Reads the whole file into one string in a single pass, so
+ * Marshal can parse it from memory instead of pulling every
+ * byte through FileInt's Ruby level IO methods */
+static VALUE
+readDataFile(const char *filename, bool rubyExc)
+{
+	const bool useCache = dataCache.maxMemSize() > 0;
+	std::string key;
+
+	if (useCache)
+	{
+		key = DataCache::makeKey(filename);
+		VALUE data = dataCache.lookup(key);
+
+		if (!NIL_P(data))
+			return data;
+	}
+
+	SDL_RWops ops;
+
+	try
+	{
+		shState->fileSystem().openReadRaw(ops, filename);
+	}
+	catch (const Exception &e)
+	{
+		if (!rubyExc)
+			throw e;
+
+		/* Raising longjmps past the destructor */
+		std::string().swap(key);
+		raiseRbExc(e);
+	}
+
+	VALUE data;
+
+	Sint64 length = SDL_RWsize(&ops);
+
+	if (length < 0)
+	{
+		/* Size unknown, read in chunks */
+		data = rb_str_buf_new(0x10000);
+		char buf[0x10000];
+		size_t count;
+
+		while ((count = SDL_RWread(&ops, buf, 1, sizeof(buf))) > 0)
+			rb_str_buf_cat(data, buf, count);
+	}
+	else
+	{
+		data = rb_str_new(0, length);
+		size_t count = SDL_RWread(&ops, RSTRING_PTR(data), 1, length);
+		rb_str_set_len(data, count);
+	}
+
+	SDL_RWclose(&ops);
+
+	if (useCache)
+		dataCache.insert(key, data);
+
+	return data;
+}
+
 VALUE
 kernelLoadDataInt(const char *filename, bool rubyExc)
 {
-	rb_gc_start();
+	/* Don't read back a file that is still being written */
+	waitPendingSaves(0);
 
-	VALUE port = fileIntForPath(filename, rubyExc);
+	VALUE data = readDataFile(filename, rubyExc);
 
 	VALUE marsh = rb_const_get(rb_cObject, rb_intern("Marshal"));
 
-	// FIXME need to catch exceptions here with begin rescue
-	VALUE result = rb_funcall2(marsh, rb_intern("load"), 1, &port);
-
-	rb_funcall2(port, rb_intern("close"), 0, NULL);
-
-	return result;
+	return rb_funcall2(marsh, rb_intern("load"), 1, &data);
 }
 
 RB_METHOD(kernelLoadData)
@@ -156,6 +323,79 @@ RB_METHOD(kernelLoadData)
 	return kernelLoadDataInt(filename, true);
 }
 
+/* Writes a marshaled object to disk on a worker thread,
+ * via a temporary file that then replaces the target, so
+ * an interrupted save never leaves a truncated file */
+struct SaveDataJob : WorkerJob
+{
+	std::string filename;
+	std::string data;
+
+	void run()
+	{
+		const std::string tmpFile = filename + ".tmp";
+
+		FILE *f = fopen(tmpFile.c_str(), "wb");
+
+		if (!f)
+		{
+			Debug() << "save_data: Failed to open" << tmpFile;
+			return;
+		}
+
+		bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+		ok = (fclose(f) == 0) && ok;
+
+#ifdef _WIN32
+		/* rename() doesn't replace existing files here */
+		if (ok)
+			remove(filename.c_str());
+#endif
+
+		if (!ok || rename(tmpFile.c_str(), filename.c_str()) != 0)
+		{
+			Debug() << "save_data: Failed to write" << filename;
+			remove(tmpFile.c_str());
+		}
+	}
+};
+
+typedef std::list<SaveDataJob*> SaveJobList;
+
+static SaveJobList pendingSaves;
+
+/* Waits for (and frees) all pending writes to 'filename',
+ * or to any file if it is null. Finished jobs are reaped
+ * along the way */
+static void
+waitPendingSaves(const char *filename)
+{
+	WorkerPool &pool = shState->workerPool();
+
+	for (SaveJobList::iterator iter = pendingSaves.begin();
+	     iter != pendingSaves.end();)
+	{
+		SaveDataJob *job = *iter;
+
+		if (!filename || job->filename == filename)
+			pool.wait(*job);
+		else if (!pool.isDone(*job))
+		{
+			++iter;
+			continue;
+		}
+
+		delete job;
+		iter = pendingSaves.erase(iter);
+	}
+}
+
+void
+fileIntBindingFlush()
+{
+	waitPendingSaves(0);
+}
+
 RB_METHOD(kernelSaveData)
 {
 	RB_UNUSED_PARAM;
@@ -165,10 +405,35 @@ RB_METHOD(kernelSaveData)
 
 	rb_get_args(argc, argv, "oS", &obj, &filename RB_ARG_END);
 
-	VALUE file = rb_file_open_str(filename, "wb");
-
 	VALUE marsh = rb_const_get(rb_cObject, rb_intern("Marshal"));
 
+	/* The file may be read back via load_data */
+	dataCache.clear();
+	shState->packedData().invalidate(StringValueCStr(filename));
+
+	if (shState->config().asyncSave && shState->workerPool().enabled())
+	{
+		/* Serialize right away, as scripts are free to modify
+		 * 'obj' once we return; only the I/O is deferred */
+		VALUE dump = rb_funcall2(marsh, rb_intern("dump"), 1, &obj);
+
+		const char *path = StringValueCStr(filename);
+
+		/* Keep writes to the same file in order */
+		waitPendingSaves(path);
+
+		SaveDataJob *job = new SaveDataJob;
+		job->filename = path;
+		job->data.assign(RSTRING_PTR(dump), RSTRING_LEN(dump));
+
+		pendingSaves.push_back(job);
+		shState->workerPool().submit(*job);
+
+		return Qnil;
+	}
+
+	VALUE file = rb_file_open_str(filename, "wb");
+
 	VALUE v[] = { obj, file };
 	rb_funcall2(marsh, rb_intern("dump"), ARRAY_SIZE(v), v);
 
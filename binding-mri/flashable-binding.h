@@ -23,6 +23,8 @@
 #define FLASHABLEBINDING_H
 
 #include "flashable.h"
+#include "sharedstate.h"
+#include "graphics.h"
 #include "binding-util.h"
 #include "binding-types.h"
 
@@ -56,7 +58,14 @@ RB_METHOD(flashableUpdate)
 {
 	RB_UNUSED_PARAM;
 
-	Flashable *f = getPrivateData<C>(self);
+	C *c = getPrivateData<C>(self);
+
+	/* Already stepped by Graphics.update (disposed
+	 * elements still get to raise their error) */
+	if (shState->graphics().getAutoUpdateFlash() && !c->isDisposed())
+		return Qnil;
+
+	Flashable *f = c;
 
 	f->update();
 
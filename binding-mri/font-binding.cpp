@@ -136,7 +136,9 @@ RB_METHOD(FontGetName)
 {
 	RB_UNUSED_PARAM;
 
-	return rb_iv_get(self, "name");
+	DEF_IV_ID(nameId, "name");
+
+	return rb_ivar_get(self, nameId);
 }
 
 RB_METHOD(FontSetName)
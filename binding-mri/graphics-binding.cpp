@@ -21,9 +21,12 @@
 
 #include "graphics.h"
 #include "sharedstate.h"
+#include "gl-util.h"
 #include "binding-util.h"
 #include "binding-types.h"
 #include "exception.h"
+#include "profiler.h"
+#include "scenecapture.h"
 
 RB_METHOD(graphicsUpdate)
 {
@@ -31,6 +34,11 @@ RB_METHOD(graphicsUpdate)
 
 	shState->graphics().update();
 
+	gcFrameEnd();
+
+	if (Profiler::isEnabled())
+		sampleRubyHeap();
+
 	return Qnil;
 }
 
@@ -50,10 +58,14 @@ RB_METHOD(graphicsTransition)
 	int duration = 8;
 	const char *filename = "";
 	int vague = 40;
+	bool async = false;
+
+	rb_get_args(argc, argv, "|izib", &duration, &filename, &vague, &async RB_ARG_END);
 
-	rb_get_args(argc, argv, "|izi", &duration, &filename, &vague RB_ARG_END);
+	/* The frozen screen hides the pause */
+	gcCollect(true);
 
-	GUARD_EXC( shState->graphics().transition(duration, filename, vague); )
+	GUARD_EXC( shState->graphics().transition(duration, filename, vague, async); )
 
 	return Qnil;
 }
@@ -118,6 +130,8 @@ RB_METHOD(graphicsWait)
 	int duration;
 	rb_get_args(argc, argv, "i", &duration RB_ARG_END);
 
+	gcCollect(false);
+
 	shState->graphics().wait(duration);
 
 	return Qnil;
@@ -153,8 +167,11 @@ RB_METHOD(graphicsSnapToBitmap)
 {
 	RB_UNUSED_PARAM;
 
+	bool shared = false;
+	rb_get_args(argc, argv, "|b", &shared RB_ARG_END);
+
 	Bitmap *result = 0;
-	GUARD_EXC( result = shState->graphics().snapToBitmap(); );
+	GUARD_EXC( result = shState->graphics().snapToBitmap(shared); );
 
 	VALUE obj = wrapObject(result, BitmapType);
 	bitmapInitProps(result, obj);
@@ -195,12 +212,160 @@ RB_METHOD(graphicsPlayMovie)
 	return Qnil;
 }
 
+RB_METHOD(graphicsSaveScreenshot)
+{
+	RB_UNUSED_PARAM;
+
+	const char *filename;
+	rb_get_args(argc, argv, "z", &filename RB_ARG_END);
+
+	shState->graphics().saveScreenshot(filename);
+
+	return Qnil;
+}
+
+RB_METHOD(graphicsStartRecording)
+{
+	RB_UNUSED_PARAM;
+
+	const char *filename;
+	rb_get_args(argc, argv, "z", &filename RB_ARG_END);
+
+	GUARD_EXC( shState->graphics().startRecording(filename); );
+
+	return Qnil;
+}
+
+RB_METHOD(graphicsStopRecording)
+{
+	RB_UNUSED_PARAM;
+
+	shState->graphics().stopRecording();
+
+	return Qnil;
+}
+
+RB_METHOD(graphicsFrameStats)
+{
+	RB_UNUSED_PARAM;
+
+	const Graphics::FrameStats stats = shState->graphics().frameStats();
+
+	VALUE hash = rb_hash_new();
+	rb_hash_aset(hash, ID2SYM(rb_intern("min")), rb_float_new(stats.min));
+	rb_hash_aset(hash, ID2SYM(rb_intern("avg")), rb_float_new(stats.avg));
+	rb_hash_aset(hash, ID2SYM(rb_intern("p99")), rb_float_new(stats.p99));
+	rb_hash_aset(hash, ID2SYM(rb_intern("count")), INT2NUM(stats.count));
+	rb_hash_aset(hash, ID2SYM(rb_intern("gpu")),
+	             stats.gpu < 0 ? Qnil : rb_float_new(stats.gpu));
+	rb_hash_aset(hash, ID2SYM(rb_intern("skipped")), INT2NUM(stats.skipped));
+
+	return hash;
+}
+
+RB_METHOD(graphicsGLStats)
+{
+	RB_UNUSED_PARAM;
+
+	const GLCallCounts counts = shState->graphics().glCalls();
+
+	VALUE hash = rb_hash_new();
+	rb_hash_aset(hash, ID2SYM(rb_intern("draws")), UINT2NUM(counts.draws));
+	rb_hash_aset(hash, ID2SYM(rb_intern("programs")), UINT2NUM(counts.programBinds));
+	rb_hash_aset(hash, ID2SYM(rb_intern("textures")), UINT2NUM(counts.textureBinds));
+	rb_hash_aset(hash, ID2SYM(rb_intern("uniforms")), UINT2NUM(counts.uniformUploads));
+	rb_hash_aset(hash, ID2SYM(rb_intern("skipped")), UINT2NUM(counts.skipped));
+	rb_hash_aset(hash, ID2SYM(rb_intern("culled")), UINT2NUM(counts.culled));
+
+	return hash;
+}
+
+RB_METHOD(graphicsProfile)
+{
+	RB_UNUSED_PARAM;
+
+	int frames = 60;
+	rb_get_args(argc, argv, "|i", &frames RB_ARG_END);
+
+	if (!Profiler::isEnabled())
+		return Qnil;
+
+	float times[Profiler::SectionCount];
+	Profiler::averages(times, frames);
+
+	VALUE hash = rb_hash_new();
+
+	for (int i = 0; i < Profiler::SectionCount; ++i)
+		rb_hash_aset(hash, ID2SYM(rb_intern(Profiler::sectionName(i))),
+		             rb_float_new(times[i]));
+
+	return hash;
+}
+
+RB_METHOD(graphicsDumpProfile)
+{
+	RB_UNUSED_PARAM;
+
+	const char *filename;
+	rb_get_args(argc, argv, "z", &filename RB_ARG_END);
+
+	if (!Profiler::isEnabled())
+		return Qfalse;
+
+	if (!Profiler::dumpJSON(filename))
+		raiseRbExc(Exception(Exception::MKXPError,
+		                     "Unable to write profile to '%s'", filename));
+
+	return Qtrue;
+}
+
+RB_METHOD(graphicsCaptureScene)
+{
+	RB_UNUSED_PARAM;
+
+	const char *filename;
+	rb_get_args(argc, argv, "z", &filename RB_ARG_END);
+
+	if (!SceneCapture::write(filename))
+		raiseRbExc(Exception(Exception::MKXPError,
+		                     "Unable to write scene capture to '%s'", filename));
+
+	return Qnil;
+}
+
+RB_METHOD(graphicsStartTrace)
+{
+	RB_UNUSED_PARAM;
+
+	Profiler::startTrace();
+
+	return rb_bool_new(Profiler::isTracing());
+}
+
+RB_METHOD(graphicsStopTrace)
+{
+	RB_UNUSED_PARAM;
+
+	const char *filename;
+	rb_get_args(argc, argv, "z", &filename RB_ARG_END);
+
+	if (!Profiler::isTracing())
+		return Qfalse;
+
+	if (!Profiler::stopTrace(filename))
+		raiseRbExc(Exception(Exception::MKXPError,
+		                     "Unable to write trace to '%s'", filename));
+
+	return Qtrue;
+}
+
 DEF_GRA_PROP_I(FrameRate)
 DEF_GRA_PROP_I(FrameCount)
 DEF_GRA_PROP_I(Brightness)
 
 DEF_GRA_PROP_B(Fullscreen)
 DEF_GRA_PROP_B(ShowCursor)
+DEF_GRA_PROP_B(AutoUpdateFlash)
 
 #define INIT_GRA_PROP_BIND(PropName, prop_name_s) \
 { \
@@ -242,4 +407,17 @@ void graphicsBindingInit()
 
 	INIT_GRA_PROP_BIND( Fullscreen, "fullscreen"  );
 	INIT_GRA_PROP_BIND( ShowCursor, "show_cursor" );
+	INIT_GRA_PROP_BIND( AutoUpdateFlash, "auto_update_flash" );
+
+	_rb_define_module_function(module, "save_screenshot", graphicsSaveScreenshot);
+	_rb_define_module_function(module, "start_recording", graphicsStartRecording);
+	_rb_define_module_function(module, "stop_recording", graphicsStopRecording);
+
+	_rb_define_module_function(module, "frame_stats", graphicsFrameStats);
+	_rb_define_module_function(module, "gl_stats", graphicsGLStats);
+	_rb_define_module_function(module, "profile", graphicsProfile);
+	_rb_define_module_function(module, "dump_profile", graphicsDumpProfile);
+	_rb_define_module_function(module, "capture_scene", graphicsCaptureScene);
+	_rb_define_module_function(module, "start_trace", graphicsStartTrace);
+	_rb_define_module_function(module, "stop_trace", graphicsStopTrace);
 }
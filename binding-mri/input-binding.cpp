@@ -106,6 +106,46 @@ RB_METHOD(inputDir8)
 }
 
 /* Non-standard extensions */
+
+/* press_time(button) -> Float
+ * Seconds the button had been held at the last update */
+RB_METHOD(inputPressTime)
+{
+	RB_UNUSED_PARAM;
+
+	int num = getButtonArg(argc, argv);
+
+	return rb_float_new(shState->input().pressTime(num));
+}
+
+/* snapshot(ary = nil) -> [pressed, triggered, repeated, dir4, dir8]
+ * The first three are bitmasks with bit n set for button code n.
+ * If 'ary' is given, it is filled in and returned instead of
+ * allocating a new array */
+RB_METHOD(inputSnapshot)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE ary = Qnil;
+	rb_get_args(argc, argv, "|o", &ary RB_ARG_END);
+
+	if (NIL_P(ary))
+		ary = rb_ary_new2(5);
+	else
+		Check_Type(ary, T_ARRAY);
+
+	Input::Snapshot snap;
+	shState->input().snapshot(snap);
+
+	rb_ary_store(ary, 0, ULL2NUM(snap.pressed));
+	rb_ary_store(ary, 1, ULL2NUM(snap.triggered));
+	rb_ary_store(ary, 2, ULL2NUM(snap.repeated));
+	rb_ary_store(ary, 3, rb_fix_new(snap.dir4));
+	rb_ary_store(ary, 4, rb_fix_new(snap.dir8));
+
+	return ary;
+}
+
 RB_METHOD(inputMouseX)
 {
 	RB_UNUSED_PARAM;
@@ -154,7 +194,9 @@ static buttonCodes[] =
 
 	{ "MOUSELEFT",   Input::MouseLeft   },
 	{ "MOUSEMIDDLE", Input::MouseMiddle },
-	{ "MOUSERIGHT",  Input::MouseRight  }
+	{ "MOUSERIGHT",  Input::MouseRight  },
+
+	{ "FASTFORWARD", Input::FastForward }
 };
 
 static elementsN(buttonCodes);
@@ -171,6 +213,8 @@ inputBindingInit()
 	_rb_define_module_function(module, "dir4", inputDir4);
 	_rb_define_module_function(module, "dir8", inputDir8);
 
+	_rb_define_module_function(module, "press_time", inputPressTime);
+	_rb_define_module_function(module, "snapshot", inputSnapshot);
 	_rb_define_module_function(module, "mouse_x", inputMouseX);
 	_rb_define_module_function(module, "mouse_y", inputMouseY);
 
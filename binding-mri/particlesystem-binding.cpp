@@ -0,0 +1,137 @@
+/*
+** particlesystem-binding.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "particlesystem.h"
+#include "disposable-binding.h"
+#include "viewportelement-binding.h"
+#include "binding-util.h"
+#include "binding-types.h"
+
+DEF_ALLOCFUNC(ParticleSystem);
+
+RB_METHOD(particleSystemInitialize)
+{
+	ParticleSystem *p = viewportElementInitialize<ParticleSystem>(argc, argv, self);
+
+	setPrivateData(self, p);
+
+	p->initDynAttribs();
+
+	wrapProperty(self, &p->getBounds(), "bounds", RectType);
+
+	return self;
+}
+
+RB_METHOD(particleSystemEmit)
+{
+	ParticleSystem *p = getPrivateData<ParticleSystem>(self);
+
+	double x, y, vx, vy;
+	int life;
+	double opacity = 255, fade = 0;
+	VALUE colorObj = Qnil;
+
+	rb_get_args(argc, argv, "ffffi|ffo", &x, &y, &vx, &vy, &life,
+	            &opacity, &fade, &colorObj RB_ARG_END);
+
+	Color *color = 0;
+
+	if (!NIL_P(colorObj))
+		color = getPrivateDataCheck<Color>(colorObj, ColorType);
+
+	bool result = false;
+
+	GUARD_EXC( result = p->emit(x, y, vx, vy, life, opacity, fade, color); )
+
+	return rb_bool_new(result);
+}
+
+RB_METHOD(particleSystemCount)
+{
+	RB_UNUSED_PARAM;
+
+	ParticleSystem *p = getPrivateData<ParticleSystem>(self);
+
+	int result = 0;
+
+	GUARD_EXC( result = p->count(); )
+
+	return rb_fix_new(result);
+}
+
+RB_METHOD(particleSystemClear)
+{
+	RB_UNUSED_PARAM;
+
+	ParticleSystem *p = getPrivateData<ParticleSystem>(self);
+
+	GUARD_EXC( p->clear(); )
+
+	return Qnil;
+}
+
+RB_METHOD(particleSystemUpdate)
+{
+	RB_UNUSED_PARAM;
+
+	ParticleSystem *p = getPrivateData<ParticleSystem>(self);
+
+	GUARD_EXC( p->update(); )
+
+	return Qnil;
+}
+
+DEF_PROP_OBJ_REF(ParticleSystem, Bitmap, Bitmap, "bitmap")
+DEF_PROP_OBJ_VAL(ParticleSystem, Rect,   Bounds, "bounds")
+
+DEF_PROP_I(ParticleSystem, OX)
+DEF_PROP_I(ParticleSystem, OY)
+DEF_PROP_I(ParticleSystem, BlendType)
+DEF_PROP_I(ParticleSystem, Capacity)
+
+DEF_PROP_F(ParticleSystem, Gravity)
+
+
+void
+particleSystemBindingInit()
+{
+	VALUE klass = rb_define_class("ParticleSystem", rb_cObject);
+
+	rb_define_alloc_func(klass, ParticleSystemAllocate);
+
+	disposableBindingInit<ParticleSystem>     (klass);
+	viewportElementBindingInit<ParticleSystem>(klass);
+
+	_rb_define_method(klass, "initialize", particleSystemInitialize);
+	_rb_define_method(klass, "emit",       particleSystemEmit);
+	_rb_define_method(klass, "count",      particleSystemCount);
+	_rb_define_method(klass, "clear",      particleSystemClear);
+	_rb_define_method(klass, "update",     particleSystemUpdate);
+
+	INIT_PROP_BIND( ParticleSystem, Bitmap,    "bitmap"     );
+	INIT_PROP_BIND( ParticleSystem, OX,        "ox"         );
+	INIT_PROP_BIND( ParticleSystem, OY,        "oy"         );
+	INIT_PROP_BIND( ParticleSystem, BlendType, "blend_type" );
+	INIT_PROP_BIND( ParticleSystem, Capacity,  "capacity"   );
+	INIT_PROP_BIND( ParticleSystem, Gravity,   "gravity"    );
+	INIT_PROP_BIND( ParticleSystem, Bounds,    "bounds"     );
+}
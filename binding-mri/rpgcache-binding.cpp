@@ -0,0 +1,349 @@
+/*
+** rpgcache-binding.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "bitmap.h"
+#include "sharedstate.h"
+#include "config.h"
+#include "binding-util.h"
+#include "binding-types.h"
+#include "boost-hash.h"
+#include "exception.h"
+
+#include <boost/functional/hash.hpp>
+
+#include <string>
+
+/* Native replacement for the RGSS1 RPG::Cache module. Hits are
+ * served from a C++ hash without going through Ruby's method
+ * dispatch; the cached Bitmap objects themselves (and their
+ * sharing between callers) are the same as with the original */
+
+struct CacheKey
+{
+	/* Full path, or the tileset name for tiles */
+	std::string path;
+	int hue;
+	/* -1 unless this is a tile */
+	int tileId;
+
+	CacheKey(const std::string &path, int hue, int tileId = -1)
+	    : path(path), hue(hue), tileId(tileId)
+	{}
+
+	bool operator==(const CacheKey &o) const
+	{
+		return hue == o.hue && tileId == o.tileId && path == o.path;
+	}
+};
+
+static size_t hash_value(const CacheKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.path);
+	boost::hash_combine(seed, key.hue);
+	boost::hash_combine(seed, key.tileId);
+
+	return seed;
+}
+
+static struct
+{
+	/* Marked through 'root' */
+	BoostHash<CacheKey, VALUE> bitmaps;
+	VALUE root;
+
+	/* Set once scripts redefine any of the module's methods.
+	 * From then on, the methods call each other through Ruby
+	 * again, so the redefinitions are honored like before */
+	bool scripted;
+} cache;
+
+static void cacheMark(void *)
+{
+	BoostHash<CacheKey, VALUE>::const_iterator iter;
+
+	for (iter = cache.bitmaps.cbegin(); iter != cache.bitmaps.cend(); ++iter)
+		rb_gc_mark(iter->second);
+}
+
+static VALUE lookup(const CacheKey &key)
+{
+	VALUE bitmapObj = cache.bitmaps.value(key, Qnil);
+
+	if (NIL_P(bitmapObj))
+		return Qnil;
+
+	Bitmap *b = getPrivateData<Bitmap>(bitmapObj);
+
+	if (!b || b->isDisposed())
+		return Qnil;
+
+	return bitmapObj;
+}
+
+/* Runs 'func' (which may raise) and caches its result */
+static VALUE create(VALUE (*func)(VALUE), const void *args, CacheKey &key)
+{
+	int state;
+	VALUE bitmapObj = rb_protect(func, (VALUE) args, &state);
+
+	if (state)
+	{
+		/* Raising longjmps past the destructor */
+		std::string().swap(key.path);
+		rb_jump_tag(state);
+	}
+
+	cache.bitmaps[key] = bitmapObj;
+
+	return bitmapObj;
+}
+
+static VALUE newBitmap(int argc, VALUE *argv)
+{
+	VALUE klass = rb_const_get(rb_cObject, rb_intern(BitmapType));
+
+	return rb_class_new_instance(argc, argv, klass);
+}
+
+static VALUE createFromFile(VALUE data)
+{
+	const std::string &path = *reinterpret_cast<const std::string*>(data);
+	VALUE pathObj = rb_str_new(path.c_str(), path.size());
+
+	return newBitmap(1, &pathObj);
+}
+
+static VALUE createBlank(VALUE)
+{
+	VALUE size[] = { INT2FIX(32), INT2FIX(32) };
+
+	return newBitmap(2, size);
+}
+
+struct Derived
+{
+	VALUE source;
+	int hue;
+	/* Source rectangle of tiles */
+	IntRect rect;
+};
+
+static VALUE createHued(VALUE data)
+{
+	const Derived &args = *reinterpret_cast<const Derived*>(data);
+
+	VALUE bitmapObj = rb_obj_clone(args.source);
+	Bitmap *b = getPrivateData<Bitmap>(bitmapObj);
+
+	GUARD_EXC( b->hueChange(args.hue); )
+
+	return bitmapObj;
+}
+
+static VALUE createTile(VALUE data)
+{
+	const Derived &args = *reinterpret_cast<const Derived*>(data);
+
+	VALUE bitmapObj = createBlank(Qnil);
+
+	Bitmap *b = getPrivateData<Bitmap>(bitmapObj);
+	Bitmap *src = getPrivateData<Bitmap>(args.source);
+
+	GUARD_EXC( b->blt(0, 0, *src, args.rect); )
+	GUARD_EXC( b->hueChange(args.hue); )
+
+	return bitmapObj;
+}
+
+static VALUE loadBitmap(const char *folder, const char *filename, int hue)
+{
+	CacheKey key(std::string(folder) + filename, 0);
+
+	VALUE baseObj = lookup(key);
+
+	/* An empty filename gets a blank placeholder */
+	if (NIL_P(baseObj))
+		baseObj = create(*filename ? createFromFile : createBlank, &key.path, key);
+
+	if (hue == 0)
+		return baseObj;
+
+	key.hue = hue;
+
+	VALUE huedObj = lookup(key);
+
+	if (NIL_P(huedObj))
+	{
+		Derived args = { baseObj, hue, IntRect() };
+		huedObj = create(createHued, &args, key);
+	}
+
+	return huedObj;
+}
+
+RB_METHOD(rpgCacheLoadBitmap)
+{
+	RB_UNUSED_PARAM;
+
+	const char *folder;
+	const char *filename;
+	int hue = 0;
+
+	rb_get_args(argc, argv, "zz|i", &folder, &filename, &hue RB_ARG_END);
+
+	return loadBitmap(folder, filename, hue);
+}
+
+/* Goes through load_bitmap, or a script's version of it */
+static VALUE loadFromFolder(VALUE self, const char *folder,
+                            VALUE filenameObj, int hue)
+{
+	if (cache.scripted)
+	{
+		VALUE args[] = { rb_str_new_cstr(folder), filenameObj, INT2FIX(hue) };
+		return rb_funcall2(self, rb_intern("load_bitmap"), 3, args);
+	}
+
+	return loadBitmap(folder, RSTRING_PTR(filenameObj), hue);
+}
+
+#define DEF_FOLDER(name, folder) \
+	RB_METHOD(rpgCache_##name) \
+	{ \
+		RB_UNUSED_PARAM; \
+		VALUE filename; \
+		int hue = 0; \
+		rb_get_args(argc, argv, "S|i", &filename, &hue RB_ARG_END); \
+		return loadFromFolder(self, "Graphics/" folder "/", filename, hue); \
+	}
+
+DEF_FOLDER(animation,  "Animations")
+DEF_FOLDER(autotile,   "Autotiles")
+DEF_FOLDER(battleback, "Battlebacks")
+DEF_FOLDER(battler,    "Battlers")
+DEF_FOLDER(character,  "Characters")
+DEF_FOLDER(fog,        "Fogs")
+DEF_FOLDER(gameover,   "Gameovers")
+DEF_FOLDER(icon,       "Icons")
+DEF_FOLDER(panorama,   "Panoramas")
+DEF_FOLDER(picture,    "Pictures")
+DEF_FOLDER(tileset,    "Tilesets")
+DEF_FOLDER(title,      "Titles")
+DEF_FOLDER(windowskin, "Windowskins")
+
+RB_METHOD(rpgCacheTile)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE filenameObj;
+	int tileId, hue;
+
+	rb_get_args(argc, argv, "Sii", &filenameObj, &tileId, &hue RB_ARG_END);
+
+	CacheKey key(std::string(RSTRING_PTR(filenameObj)), hue, tileId);
+
+	VALUE tileObj = lookup(key);
+
+	if (!NIL_P(tileObj))
+		return tileObj;
+
+	Derived args;
+
+	if (cache.scripted)
+		args.source = rb_funcall2(self, rb_intern("tileset"), 1, &filenameObj);
+	else
+		args.source = loadBitmap("Graphics/Tilesets/", RSTRING_PTR(filenameObj), 0);
+
+	/* Rounding down like Ruby's integer division does */
+	const int index = tileId - 384;
+	const int row = index >= 0 ? index / 8 : (index - 7) / 8;
+
+	args.hue = hue;
+	args.rect = IntRect((index - row * 8) * 32, row * 32, 32, 32);
+
+	return create(createTile, &args, key);
+}
+
+RB_METHOD(rpgCacheClear)
+{
+	RB_UNUSED_PARAM;
+
+	cache.bitmaps.clear();
+	rb_iv_set(self, "@cache", rb_hash_new());
+
+	if (shState->config().scheduledGC)
+		gcCollect(true);
+	else
+		rb_gc_start();
+
+	return Qnil;
+}
+
+RB_METHOD(rpgCacheMethodAdded)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE name;
+	rb_get_args(argc, argv, "o", &name RB_ARG_END);
+
+	/* Defining this hook reports itself */
+	if (SYM2ID(name) != rb_intern("singleton_method_added"))
+		cache.scripted = true;
+
+	return Qnil;
+}
+
+void
+rpgCacheBindingInit()
+{
+	VALUE module = rb_define_module_under(rb_define_module("RPG"), "Cache");
+
+	cache.root = Data_Wrap_Struct(rb_cObject, cacheMark, 0, &cache);
+	rb_gc_register_address(&cache.root);
+
+	/* For script redefinitions of 'load_bitmap' written
+	 * against the original implementation */
+	rb_iv_set(module, "@cache", rb_hash_new());
+
+	_rb_define_module_function(module, "load_bitmap", rpgCacheLoadBitmap);
+	_rb_define_module_function(module, "tile", rpgCacheTile);
+	_rb_define_module_function(module, "clear", rpgCacheClear);
+
+	_rb_define_module_function(module, "animation",  rpgCache_animation);
+	_rb_define_module_function(module, "autotile",   rpgCache_autotile);
+	_rb_define_module_function(module, "battleback", rpgCache_battleback);
+	_rb_define_module_function(module, "battler",    rpgCache_battler);
+	_rb_define_module_function(module, "character",  rpgCache_character);
+	_rb_define_module_function(module, "fog",        rpgCache_fog);
+	_rb_define_module_function(module, "gameover",   rpgCache_gameover);
+	_rb_define_module_function(module, "icon",       rpgCache_icon);
+	_rb_define_module_function(module, "panorama",   rpgCache_panorama);
+	_rb_define_module_function(module, "picture",    rpgCache_picture);
+	_rb_define_module_function(module, "tileset",    rpgCache_tileset);
+	_rb_define_module_function(module, "title",      rpgCache_title);
+	_rb_define_module_function(module, "windowskin", rpgCache_windowskin);
+
+	/* Has to come last, as it would flag the above */
+	rb_define_class_method(module, "singleton_method_added", rpgCacheMethodAdded);
+}
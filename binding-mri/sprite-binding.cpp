@@ -94,6 +94,36 @@ RB_METHOD(spriteHeight)
 	return rb_fix_new(value);
 }
 
+/* Steps flash and wave of every sprite in the passed array
+ * in one go. Overrides of 'update' in Ruby are not called */
+RB_METHOD(spriteUpdateAll)
+{
+	VALUE ary;
+	rb_get_args(argc, argv, "o", &ary RB_ARG_END);
+
+	Check_Type(ary, T_ARRAY);
+
+	const bool autoUpdate = shState->graphics().getAutoUpdateFlash();
+
+	for (long i = 0; i < RARRAY_LEN(ary); ++i)
+	{
+		VALUE obj = rb_ary_entry(ary, i);
+
+		if (!RTEST(rb_obj_is_kind_of(obj, self)))
+			rb_raise(rb_eTypeError, "Expected %s, got %s",
+			         rb_class2name(self), rb_obj_classname(obj));
+
+		Sprite *s = getPrivateData<Sprite>(obj);
+
+		if (autoUpdate && !s->isDisposed())
+			continue;
+
+		GUARD_EXC( s->update(); )
+	}
+
+	return Qnil;
+}
+
 void
 spriteBindingInit()
 {
@@ -105,6 +135,7 @@ spriteBindingInit()
 	viewportElementBindingInit<Sprite>(klass);
 
 	_rb_define_method(klass, "initialize", spriteInitialize);
+	rb_define_class_method(klass, "update_all", spriteUpdateAll);
 
 	INIT_PROP_BIND( Sprite, Bitmap,    "bitmap"     );
 	INIT_PROP_BIND( Sprite, SrcRect,   "src_rect"   );
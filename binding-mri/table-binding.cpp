@@ -20,9 +20,13 @@
 */
 
 #include <algorithm>
+#include <string.h>
+#include <vector>
 #include "table.h"
 #include "binding-util.h"
+#include "binding-types.h"
 #include "serializable-binding.h"
+#include "util.h"
 
 static int num2TableSize(VALUE v)
 {
@@ -155,6 +159,106 @@ RB_METHOD(tableSetAt)
 	return argv[argc - 1];
 }
 
+/* fill(value, x = 0, y = 0, width = xsize, height = ysize,
+ *      z = 0, depth = zsize) */
+RB_METHOD(tableFill)
+{
+	Table *t = getPrivateData<Table>(self);
+
+	int value;
+	int x = 0, y = 0, z = 0;
+	int width = t->xSize(), height = t->ySize(), depth = t->zSize();
+
+	rb_get_args(argc, argv, "i|iiiiii", &value, &x, &y, &width, &height,
+	            &z, &depth RB_ARG_END);
+
+	if (argc == 1)
+		t->fill(value);
+	else
+		t->fill(value, x, y, width, height, z, depth);
+
+	return self;
+}
+
+/* copy_rect(src_table, src_x, src_y, width, height, dst_x, dst_y) */
+RB_METHOD(tableCopyRect)
+{
+	Table *t = getPrivateData<Table>(self);
+
+	VALUE srcObj;
+	int srcX, srcY, width, height, dstX, dstY;
+
+	rb_get_args(argc, argv, "oiiiiii", &srcObj, &srcX, &srcY,
+	            &width, &height, &dstX, &dstY RB_ARG_END);
+
+	Table *src = getPrivateDataCheck<Table>(srcObj, TableType);
+
+	t->copyRect(*src, srcX, srcY, width, height, dstX, dstY);
+
+	return self;
+}
+
+/* All values as a string of native endian
+ * 16 bit integers (String#unpack("s*")) */
+RB_METHOD(tableToPacked)
+{
+	RB_UNUSED_PARAM;
+
+	Table *t = getPrivateData<Table>(self);
+
+	const long count = (long) t->xSize() * t->ySize() * t->zSize();
+
+	return rb_str_new((const char*) t->rawData(), count * sizeof(int16_t));
+}
+
+RB_METHOD(tableFromPacked)
+{
+	Table *t = getPrivateData<Table>(self);
+
+	VALUE str;
+	rb_get_args(argc, argv, "S", &str RB_ARG_END);
+
+	const long count = (long) t->xSize() * t->ySize() * t->zSize();
+
+	if (RSTRING_LEN(str) != count * (long) sizeof(int16_t))
+		rb_raise(rb_eArgError, "packed data doesn't match table size");
+
+	/* The string isn't necessarily aligned */
+	std::vector<int16_t> values(count);
+	memcpy(dataPtr(values), RSTRING_PTR(str), count * sizeof(int16_t));
+
+	t->replaceData(dataPtr(values));
+
+	return self;
+}
+
+/* each_in_rect(x, y, width, height, z = 0) { |x, y, value| } */
+RB_METHOD(tableEachInRect)
+{
+	Table *t = getPrivateData<Table>(self);
+
+	int x, y, width, height, z = 0;
+
+	rb_get_args(argc, argv, "iiii|i", &x, &y, &width, &height, &z RB_ARG_END);
+
+	rb_need_block();
+
+	for (int j = y; j < y+height; ++j)
+		for (int i = x; i < x+width; ++i)
+		{
+			/* The block may resize the table */
+			if (i < 0 || i >= t->xSize()
+			||  j < 0 || j >= t->ySize()
+			||  z < 0 || z >= t->zSize())
+				continue;
+
+			VALUE v[] = { INT2FIX(i), INT2FIX(j), INT2FIX(t->at(i, j, z)) };
+			rb_yield_values2(ARRAY_SIZE(v), v);
+		}
+
+	return self;
+}
+
 MARSH_LOAD_FUN(Table)
 INITCOPY_FUN(Table)
 
@@ -176,5 +280,10 @@ tableBindingInit()
 	_rb_define_method(klass, "zsize", tableZSize);
 	_rb_define_method(klass, "[]", tableGetAt);
 	_rb_define_method(klass, "[]=", tableSetAt);
+	_rb_define_method(klass, "fill", tableFill);
+	_rb_define_method(klass, "copy_rect", tableCopyRect);
+	_rb_define_method(klass, "to_packed", tableToPacked);
+	_rb_define_method(klass, "from_packed", tableFromPacked);
+	_rb_define_method(klass, "each_in_rect", tableEachInRect);
 
 }
@@ -37,7 +37,9 @@ RB_METHOD(viewportElementGetViewport)
 
 	checkDisposed<C>(self);
 
-	return rb_iv_get(self, "viewport");
+	DEF_IV_ID(viewportId, "viewport");
+
+	return rb_ivar_get(self, viewportId);
 }
 
 template<class C>
@@ -29,12 +29,16 @@
 #include <mruby/compile.h>
 #include <mruby/proc.h>
 #include <mruby/dump.h>
+#include <mruby/version.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <zlib.h>
 
 #include <string>
 
+#include <boost/functional/hash.hpp>
+
 #include <SDL_messagebox.h>
 #include <SDL_rwops.h>
 #include <SDL_timer.h>
@@ -44,6 +48,9 @@
 #include "eventthread.h"
 #include "filesystem.h"
 #include "exception.h"
+#include "debugwriter.h"
+#include "input.h"
+#include "boost-hash.h"
 
 #include "binding-util.h"
 #include "binding-types.h"
@@ -57,7 +64,9 @@ ScriptBinding scriptBindingImpl =
 {
     mrbBindingExecute,
     mrbBindingTerminate,
-    mrbBindingReset
+    mrbBindingReset,
+    0,
+    0
 };
 
 ScriptBinding *scriptBinding = &scriptBindingImpl;
@@ -74,6 +83,7 @@ void fontBindingInit(mrb_state *);
 void bitmapBindingInit(mrb_state *);
 void spriteBindingInit(mrb_state *);
 void planeBindingInit(mrb_state *);
+void particleSystemBindingInit(mrb_state *);
 void viewportBindingInit(mrb_state *);
 void windowBindingInit(mrb_state *);
 void tilemapBindingInit(mrb_state *);
@@ -102,6 +112,7 @@ static void mrbBindingInit(mrb_state *mrb)
 	bitmapBindingInit(mrb);
 	spriteBindingInit(mrb);
 	planeBindingInit(mrb);
+	particleSystemBindingInit(mrb);
 	viewportBindingInit(mrb);
 	windowBindingInit(mrb);
 	tilemapBindingInit(mrb);
@@ -238,6 +249,7 @@ runMrbFile(mrb_state *mrb, const char *filename)
 	}
 
 	mrb_irep *irep = mrb_read_irep_file(mrb, f);
+	fclose(f);
 
 	if (!irep)
 	{
@@ -250,8 +262,237 @@ runMrbFile(mrb_state *mrb, const char *filename)
 
 	RProc *proc = mrb_proc_new(mrb, irep);
 	mrb_run(mrb, proc, mrb_top_self(mrb));
+}
 
-	fclose(f);
+#define SCRIPT_CACHE_MAGIC "MKXPMRB1"
+
+/* Compiled script sections (RITE binaries) persisted across runs,
+ * keyed by their compressed source and name, so that later starts
+ * skip the mruby parser and code generator altogether */
+struct ScriptCache
+{
+	struct Entry
+	{
+		std::string binary;
+		bool used;
+	};
+
+	std::string cacheFile;
+	BoostHash<size_t, Entry> entries;
+	bool modified;
+
+	ScriptCache(const std::string &cacheFile)
+	    : cacheFile(cacheFile),
+	      modified(false)
+	{
+		if (enabled())
+			readFile();
+	}
+
+	bool enabled() const
+	{
+		return !cacheFile.empty();
+	}
+
+	static size_t key(mrb_value compressed, mrb_value name)
+	{
+		const char *data = RSTRING_PTR(compressed);
+		size_t seed = boost::hash_range(data, data + RSTRING_LEN(compressed));
+		boost::hash_combine(seed, std::string(RSTRING_PTR(name), RSTRING_LEN(name)));
+
+		return seed;
+	}
+
+	/* Returns the compiled form of 'src', or null if it
+	 * can't be had, in which case the script has to be
+	 * loaded from source (that's also how syntax errors
+	 * get reported) */
+	RProc *procFor(mrb_state *mrb, mrbc_context *ctx, size_t key,
+	               const char *src, int srcLen)
+	{
+		if (!enabled())
+			return 0;
+
+		if (entries.contains(key))
+		{
+			Entry &entry = entries[key];
+			mrb_irep *irep = mrb_read_irep(mrb, (const uint8_t*) entry.binary.data());
+
+			if (irep)
+			{
+				entry.used = true;
+				return mrb_proc_new(mrb, irep);
+			}
+
+			/* Stale or damaged, compile it anew */
+			entries.remove(key);
+			modified = true;
+		}
+
+		mrb_parser_state *parser = mrb_parse_nstring(mrb, src, srcLen, ctx);
+
+		if (!parser)
+			return 0;
+
+		if (parser->nerr > 0)
+		{
+			mrb_parser_free(parser);
+			return 0;
+		}
+
+		RProc *proc = mrb_generate_code(mrb, parser);
+		mrb_parser_free(parser);
+
+		if (!proc)
+			return 0;
+
+		uint8_t *bin;
+		size_t binSize;
+
+		if (mrb_dump_irep(mrb, proc->body.irep, DUMP_DEBUG_INFO, &bin, &binSize) == MRB_DUMP_OK)
+		{
+			Entry entry;
+			entry.binary.assign((const char*) bin, binSize);
+			entry.used = true;
+			entries.insert(key, entry);
+			modified = true;
+
+			mrb_free(mrb, bin);
+		}
+
+		return proc;
+	}
+
+	static bool read(FILE *f, void *dst, size_t size)
+	{
+		return fread(dst, 1, size, f) == size;
+	}
+
+	void readFile()
+	{
+		FILE *f = fopen(cacheFile.c_str(), "rb");
+
+		if (!f)
+			return;
+
+		char magic[sizeof(SCRIPT_CACHE_MAGIC)-1];
+		uint32_t descLen, count;
+		std::string desc;
+
+		bool ok = read(f, magic, sizeof(magic))
+		       && !memcmp(magic, SCRIPT_CACHE_MAGIC, sizeof(magic))
+		       && read(f, &descLen, sizeof(descLen));
+
+		if (ok)
+		{
+			desc.resize(descLen);
+			ok = (descLen == 0 || read(f, &desc[0], descLen))
+			  && desc == MRUBY_DESCRIPTION
+			  && read(f, &count, sizeof(count));
+		}
+
+		for (uint32_t i = 0; ok && i < count; ++i)
+		{
+			uint64_t key;
+			uint32_t size;
+
+			if (!read(f, &key, sizeof(key)) || !read(f, &size, sizeof(size)) || size == 0)
+				break;
+
+			Entry entry;
+			entry.binary.resize(size);
+			entry.used = false;
+
+			if (!read(f, &entry.binary[0], size))
+				break;
+
+			entries.insert(key, entry);
+		}
+
+		fclose(f);
+	}
+
+	/* Writes the cache file if any section was compiled
+	 * or went unused during this run */
+	void save()
+	{
+		if (!enabled())
+			return;
+
+		uint32_t count = 0;
+		BoostHash<size_t, Entry>::const_iterator iter;
+
+		for (iter = entries.cbegin(); iter != entries.cend(); ++iter)
+		{
+			if (iter->second.used)
+				++count;
+			else
+				modified = true;
+		}
+
+		if (!modified)
+			return;
+
+		std::string tmpFile = cacheFile + ".tmp";
+		FILE *f = fopen(tmpFile.c_str(), "wb");
+
+		if (!f)
+		{
+			Debug() << "Failed to write script cache" << cacheFile;
+			return;
+		}
+
+		uint32_t descLen = strlen(MRUBY_DESCRIPTION);
+
+		bool ok = fwrite(SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC)-1, 1, f) == 1
+		       && fwrite(&descLen, sizeof(descLen), 1, f) == 1
+		       && fwrite(MRUBY_DESCRIPTION, 1, descLen, f) == descLen
+		       && fwrite(&count, sizeof(count), 1, f) == 1;
+
+		for (iter = entries.cbegin(); ok && iter != entries.cend(); ++iter)
+		{
+			const Entry &entry = iter->second;
+
+			if (!entry.used)
+				continue;
+
+			uint64_t key = iter->first;
+			uint32_t size = entry.binary.size();
+
+			ok = fwrite(&key, sizeof(key), 1, f) == 1
+			  && fwrite(&size, sizeof(size), 1, f) == 1
+			  && fwrite(entry.binary.data(), 1, size, f) == size;
+		}
+
+		fclose(f);
+
+		/* Replace the old file only once the new one is complete,
+		 * so an interrupted write can't leave a truncated cache */
+		if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+		{
+			Debug() << "Failed to write script cache" << cacheFile;
+			remove(tmpFile.c_str());
+		}
+
+		modified = false;
+	}
+};
+
+/* Like the path cache, keyed by the game's identity */
+static std::string scriptCacheFile(const Config &conf)
+{
+	const std::string &dir = conf.customDataPath.empty() ?
+	        conf.commonDataPath : conf.customDataPath;
+
+	if (!conf.scriptCache || dir.empty())
+		return std::string();
+
+	size_t gameHash = boost::hash<std::string>()(conf.gameFolder + "/" + conf.execName);
+
+	char name[64];
+	snprintf(name, sizeof(name), "scriptcache-mrb-%08x.bin", (unsigned) gameHash);
+
+	return dir + name;
 }
 
 static void
@@ -300,6 +541,8 @@ runRMXPScripts(mrb_state *mrb, mrbc_context *ctx)
 
 	int scriptCount = mrb_ary_len(scriptMrb, scriptArray);
 
+	ScriptCache cache(scriptCacheFile(shState->rtData().config));
+
 	std::string decodeBuffer;
 	decodeBuffer.resize(0x1000);
 
@@ -352,8 +595,14 @@ runRMXPScripts(mrb_state *mrb, mrbc_context *ctx)
 
 		int ai = mrb_gc_arena_save(mrb);
 
+		RProc *proc = cache.procFor(mrb, ctx, ScriptCache::key(scriptString, scriptName),
+		                            decodeBuffer.c_str(), bufferLen);
+
 		/* Execute code */
-		mrb_load_nstring_cxt(mrb, decodeBuffer.c_str(), bufferLen, ctx);
+		if (proc)
+			mrb_run(mrb, proc, mrb_top_self(mrb));
+		else
+			mrb_load_nstring_cxt(mrb, decodeBuffer.c_str(), bufferLen, ctx);
 
 		mrb_gc_arena_restore(mrb, ai);
 
@@ -361,6 +610,10 @@ runRMXPScripts(mrb_state *mrb, mrbc_context *ctx)
 			break;
 	}
 
+	/* Even when a script raised, everything
+	 * up to it was compiled successfully */
+	cache.save();
+
 	mrb_close(scriptMrb);
 }
 
@@ -378,18 +631,27 @@ static void mrbBindingExecute()
 
 	mrbBindingInit(mrb);
 
+	/* Input recordings play back the same only
+	 * with the same random numbers */
+	if (uint32_t seed = shState->input().randomSeed())
+		mrb_funcall(mrb, mrb_top_self(mrb), "srand", 1,
+		            mrb_fixnum_value(seed));
+
 	mrbc_context *ctx = mrbc_context_new(mrb);
 	ctx->capture_errors = 1;
 
 	const Config &conf = shState->rtData().config;
 	const std::string &customScript = conf.customScript;
-//	const std::string &mrbFile = conf.mrbFile;
-	(void) runMrbFile; // FIXME mrbFile support on ice for now
 
-	if (!customScript.empty())
+	/* Precompiled scripts (mrbc output) are run as is */
+	const size_t extPos = customScript.rfind('.');
+	const bool isMrbFile = extPos != std::string::npos
+	                    && customScript.compare(extPos, std::string::npos, ".mrb") == 0;
+
+	if (isMrbFile)
+		runMrbFile(mrb, customScript.c_str());
+	else if (!customScript.empty())
 		runCustomScript(mrb, ctx, customScript.c_str());
-//	else if (!mrbFile.empty())
-//		runMrbFile(mrb, mrbFile.c_str());
 	else
 		runRMXPScripts(mrb, ctx);
 
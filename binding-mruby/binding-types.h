@@ -33,6 +33,7 @@ DECL_TYPE(Font);
 DECL_TYPE(Bitmap);
 DECL_TYPE(Sprite);
 DECL_TYPE(Plane);
+DECL_TYPE(ParticleSystem);
 DECL_TYPE(Viewport);
 DECL_TYPE(Tilemap);
 DECL_TYPE(Window);
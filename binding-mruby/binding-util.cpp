@@ -55,6 +55,7 @@ struct
 	SYMD(default_color),
 	SYMD(default_out_color),
 	SYMD(children),
+	SYMD(bounds),
 	SYMD(_mkxp_dispose_alias)
 };
 
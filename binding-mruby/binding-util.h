@@ -56,6 +56,7 @@ enum CommonSymbol
 	CSdefault_color,
 	CSdefault_out_color,
 	CSchildren,
+	CSbounds,
 	CS_mkxp_dispose_alias,
 
 	CommonSymbolsMax
@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <vector>
+#include <algorithm>
 
 #include "../binding-util.h"
 #include "file.h"
@@ -47,6 +48,9 @@
 #define MARSHAL_MAJOR 4
 #define MARSHAL_MINOR 8
 
+/* Size of the block stream data is read / written in */
+#define MARSHAL_BUFFER_SIZE 4096
+
 #define TYPE_NIL '0'
 #define TYPE_TRUE 'T'
 #define TYPE_FALSE 'F'
@@ -143,6 +147,11 @@ struct LinkBuffer
 	}
 };
 
+/* Stream access goes through a block buffer, so that the
+ * per byte reads and writes are mostly pointer increments.
+ * Reading may fetch past the end of the dumped data; call
+ * 'finishRead()' to put the stream back behind it, and
+ * 'flush()' once everything was written */
 struct MarshalContext
 {
 	SDL_RWops *ops;
@@ -153,40 +162,118 @@ struct MarshalContext
 	LinkBuffer<mrb_sym> symbols;
 	LinkBuffer<mrb_value> objects;
 
-	int8_t readByte()
+	/* Classes resolved from their path symbol during this load;
+	 * data files instantiate the same few ones over and over */
+	BoostHash<mrb_sym, struct RClass*> classes;
+
+	/* Reading: bytes not consumed yet are 'bufPos' to 'bufEnd'.
+	 * Writing: 'bufEnd' bytes are waiting to be written */
+	char buffer[MARSHAL_BUFFER_SIZE];
+	int bufPos;
+	int bufEnd;
+
+	MarshalContext()
+	    : bufPos(0),
+	      bufEnd(0)
+	{}
+
+	void fillBuffer()
 	{
-		int8_t byte;
-		int result = SDL_RWread(ops, &byte, 1, 1);
+		bufPos = 0;
+		bufEnd = SDL_RWread(ops, buffer, 1, sizeof(buffer));
 
-		if (result < 1)
+		if (bufEnd < 1)
+		{
+			bufEnd = 0;
 			throw Exception(Exception::ArgumentError, "dump format error");
+		}
+	}
+
+	int8_t readByte()
+	{
+		if (bufPos == bufEnd)
+			fillBuffer();
 
-		return byte;
+		return buffer[bufPos++];
 	}
 
 	void readData(char *dest, int len)
 	{
-		int result = SDL_RWread(ops, dest, 1, len);
+		while (len > 0)
+		{
+			if (bufPos == bufEnd)
+			{
+				/* Large chunks bypass the buffer */
+				if (len >= MARSHAL_BUFFER_SIZE)
+				{
+					int result = SDL_RWread(ops, dest, 1, len);
 
-		if (result < len)
-			throw Exception(Exception::ArgumentError, "dump format error");
+					if (result < len)
+						throw Exception(Exception::ArgumentError, "dump format error");
+
+					return;
+				}
+
+				fillBuffer();
+			}
+
+			int count = std::min(len, bufEnd - bufPos);
+			memcpy(dest, &buffer[bufPos], count);
+
+			bufPos += count;
+			dest += count;
+			len -= count;
+		}
+	}
+
+	void finishRead()
+	{
+		if (bufPos < bufEnd)
+			SDL_RWseek(ops, bufPos - bufEnd, RW_SEEK_CUR);
+
+		bufPos = bufEnd = 0;
 	}
 
 	void writeByte(int8_t byte)
 	{
-		int result = SDL_RWwrite(ops, &byte, 1, 1);
+		if (bufEnd == MARSHAL_BUFFER_SIZE)
+			flush();
 
-		if (result < 1) // FIXME not sure what the correct error would be here
-			throw Exception(Exception::IOError, "dump writing error");
+		buffer[bufEnd++] = byte;
 	}
 
 	void writeData(const char *data, int len)
 	{
+		if (bufEnd + len > MARSHAL_BUFFER_SIZE)
+			flush();
+
+		if (len < MARSHAL_BUFFER_SIZE)
+		{
+			memcpy(&buffer[bufEnd], data, len);
+			bufEnd += len;
+
+			return;
+		}
+
 		int result = SDL_RWwrite(ops, data, 1, len);
 
 		if (result < len) // FIXME not sure what the correct error would be here
 			throw Exception(Exception::IOError, "dump writing error");
 	}
+
+	void flush()
+	{
+		if (bufEnd == 0)
+			return;
+
+		int len = bufEnd;
+		bufEnd = 0;
+
+		int result = SDL_RWwrite(ops, buffer, 1, len);
+
+		if (result < len) // FIXME not sure what the correct error would be here
+			throw Exception(Exception::IOError, "dump writing error");
+	}
 };
 
 
@@ -416,14 +503,29 @@ mrb_class_from_path(mrb_state *mrb, mrb_value path)
 	return (struct RClass*) mrb_obj_ptr(klass);
 }
 
+static struct RClass *
+read_class(MarshalContext *ctx, mrb_value &class_path)
+{
+	class_path = read_value(ctx);
+
+	if (mrb_type(class_path) != MRB_TT_SYMBOL)
+		return mrb_class_from_path(ctx->mrb, class_path);
+
+	struct RClass *&klass = ctx->classes[mrb_symbol(class_path)];
+
+	if (!klass)
+		klass = mrb_class_from_path(ctx->mrb, class_path);
+
+	return klass;
+}
+
 static mrb_value
 read_object(MarshalContext *ctx)
 {
 	mrb_state *mrb = ctx->mrb;
-	mrb_value class_path = read_value(ctx);
+	mrb_value class_path;
 
-	struct RClass *klass =
-		mrb_class_from_path(mrb, class_path);
+	struct RClass *klass = read_class(ctx, class_path);
 
 	mrb_value obj = mrb_obj_value(mrb_obj_alloc(mrb, MRB_TT_OBJECT, klass));
 
@@ -448,10 +550,9 @@ static mrb_value
 read_userdef(MarshalContext *ctx)
 {
 	mrb_state *mrb = ctx->mrb;
-	mrb_value class_path = read_value(ctx);
+	mrb_value class_path;
 
-	struct RClass *klass =
-		mrb_class_from_path(mrb, class_path);
+	struct RClass *klass = read_class(ctx, class_path);
 
 	/* Should check here if klass implements '_load()' */
 	if (!mrb_obj_respond_to(mrb, mrb_class(mrb, mrb_obj_value(klass)), mrb_intern_cstr(mrb, "_load")))
@@ -917,6 +1018,7 @@ MRB_FUNCTION(marshalDump)
 
 		writeMarshalHeader(&ctx);
 		write_value(&ctx, val);
+		ctx.flush();
 	}
 	catch (const Exception &e)
 	{
@@ -979,6 +1081,7 @@ MRB_FUNCTION(marshalLoad)
 
 		verifyMarshalHeader(&ctx);
 		val = read_value(&ctx);
+		ctx.finishRead();
 	}
 	catch (const Exception &e)
 	{
@@ -1012,6 +1115,7 @@ marshalDumpInt(mrb_state *mrb, SDL_RWops *ops, mrb_value val)
 
 	writeMarshalHeader(&ctx);
 	write_value(&ctx, val);
+	ctx.flush();
 }
 
 mrb_value
@@ -1024,6 +1128,7 @@ marshalLoadInt(mrb_state *mrb, SDL_RWops *ops)
 	verifyMarshalHeader(&ctx);
 
 	mrb_value val = read_value(&ctx);
+	ctx.finishRead();
 
 	return val;
 }
@@ -0,0 +1,131 @@
+/*
+** particlesystem-binding.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "particlesystem.h"
+#include "disposable-binding.h"
+#include "viewportelement-binding.h"
+#include "binding-util.h"
+#include "binding-types.h"
+
+DEF_TYPE(ParticleSystem);
+
+MRB_METHOD(particleSystemInitialize)
+{
+	ParticleSystem *p = viewportElementInitialize<ParticleSystem>(mrb, self);
+
+	setPrivateData(self, p, ParticleSystemType);
+
+	p->initDynAttribs();
+
+	wrapProperty(mrb, self, &p->getBounds(), CSbounds, RectType);
+
+	return self;
+}
+
+MRB_METHOD(particleSystemEmit)
+{
+	ParticleSystem *p = getPrivateData<ParticleSystem>(mrb, self);
+
+	mrb_float x, y, vx, vy;
+	mrb_int life;
+	mrb_float opacity = 255, fade = 0;
+	mrb_value colorObj = mrb_nil_value();
+
+	mrb_get_args(mrb, "ffffi|ffo", &x, &y, &vx, &vy, &life,
+	             &opacity, &fade, &colorObj);
+
+	Color *color = 0;
+
+	if (!mrb_nil_p(colorObj))
+		color = getPrivateDataCheck<Color>(mrb, colorObj, ColorType);
+
+	bool result = false;
+
+	GUARD_EXC( result = p->emit(x, y, vx, vy, life, opacity, fade, color); )
+
+	return mrb_bool_value(result);
+}
+
+MRB_METHOD(particleSystemCount)
+{
+	ParticleSystem *p = getPrivateData<ParticleSystem>(mrb, self);
+
+	int result = 0;
+
+	GUARD_EXC( result = p->count(); )
+
+	return mrb_fixnum_value(result);
+}
+
+MRB_METHOD(particleSystemClear)
+{
+	ParticleSystem *p = getPrivateData<ParticleSystem>(mrb, self);
+
+	GUARD_EXC( p->clear(); )
+
+	return mrb_nil_value();
+}
+
+MRB_METHOD(particleSystemUpdate)
+{
+	ParticleSystem *p = getPrivateData<ParticleSystem>(mrb, self);
+
+	GUARD_EXC( p->update(); )
+
+	return mrb_nil_value();
+}
+
+DEF_PROP_OBJ_REF(ParticleSystem, Bitmap, Bitmap, CSbitmap)
+DEF_PROP_OBJ_VAL(ParticleSystem, Rect,   Bounds, CSbounds)
+
+DEF_PROP_I(ParticleSystem, OX)
+DEF_PROP_I(ParticleSystem, OY)
+DEF_PROP_I(ParticleSystem, BlendType)
+DEF_PROP_I(ParticleSystem, Capacity)
+
+DEF_PROP_F(ParticleSystem, Gravity)
+
+
+void
+particleSystemBindingInit(mrb_state *mrb)
+{
+	RClass *klass = defineClass(mrb, "ParticleSystem");
+
+	disposableBindingInit<ParticleSystem>     (mrb, klass);
+	viewportElementBindingInit<ParticleSystem>(mrb, klass);
+
+	mrb_define_method(mrb, klass, "initialize", particleSystemInitialize, MRB_ARGS_OPT(1));
+	mrb_define_method(mrb, klass, "emit",       particleSystemEmit,       MRB_ARGS_ARG(5, 3));
+	mrb_define_method(mrb, klass, "count",      particleSystemCount,      MRB_ARGS_NONE());
+	mrb_define_method(mrb, klass, "clear",      particleSystemClear,      MRB_ARGS_NONE());
+	mrb_define_method(mrb, klass, "update",     particleSystemUpdate,     MRB_ARGS_NONE());
+
+	INIT_PROP_BIND( ParticleSystem, Bitmap,    "bitmap"     );
+	INIT_PROP_BIND( ParticleSystem, OX,        "ox"         );
+	INIT_PROP_BIND( ParticleSystem, OY,        "oy"         );
+	INIT_PROP_BIND( ParticleSystem, BlendType, "blend_type" );
+	INIT_PROP_BIND( ParticleSystem, Capacity,  "capacity"   );
+	INIT_PROP_BIND( ParticleSystem, Gravity,   "gravity"    );
+	INIT_PROP_BIND( ParticleSystem, Bounds,    "bounds"     );
+
+	mrb_define_method(mrb, klass, "inspect", inspectObject, MRB_ARGS_NONE());
+}
@@ -23,10 +23,991 @@
 #include "sharedstate.h"
 #include "eventthread.h"
 #include "debugwriter.h"
+#include "exception.h"
+#include "graphics.h"
+#include "config.h"
+#include "profiler.h"
+#include "scenecapture.h"
+#include "viewport.h"
+#include "bitmap.h"
+#include "sprite.h"
+#include "plane.h"
+#include "window.h"
+#include "windowvx.h"
+#include "tilemap.h"
+#include "tilemapvx.h"
+#include "table.h"
+#include "font.h"
+#include "etc.h"
+#include "gl-util.h"
+#include "gl-fun.h"
+
+#include <SDL_timer.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/* Instead of running a game, the null binding builds a few canonical
+ * scenes directly in C++ and measures how long the engine takes to
+ * render them, so performance can be compared across builds without
+ * any Ruby or game data involved. Afterwards, the Bitmap operations
+ * are measured on their own. For meaningful numbers, run it with
+ * 'fixedFramerate=-1' and 'vsync=false', or with 'headless=true'
+ * to leave out presenting the frames.
+ * With 'sceneReplay' set, a scene captured from a running game
+ * (Graphics.capture_scene) is rendered instead */
+
+/* From bitmap-bench.cpp */
+void runBitmapBenchmark();
+
+static const int warmupFrames = 60;
+static const int benchFrames = 600;
+
+static const int spriteCount = 512;
+static const int windowCount = 6;
+static const int planeCount = 3;
+
+enum SceneContents
+{
+	Sprites  = 1 << 0,
+	Tilemaps = 1 << 1,
+	Windows  = 1 << 2,
+	Planes   = 1 << 3
+};
+
+static const struct
+{
+	const char *name;
+	int contents;
+}
+benchScenes[] =
+{
+	{ "sprites",  Sprites  },
+	{ "tilemap",  Tilemaps },
+	{ "windows",  Windows  },
+	{ "planes",   Planes   },
+	{ "combined", Sprites | Tilemaps | Windows | Planes }
+};
+
+static elementsN(benchScenes);
+
+/* Deterministic, so every run draws the exact same scenes */
+struct Random
+{
+	unsigned int state;
+
+	Random()
+	    : state(0x2545F491)
+	{}
+
+	int operator()(int max)
+	{
+		state = state * 1103515245 + 12345;
+		return (state >> 16) % max;
+	}
+};
+
+static Vec4 randomColor(Random &rand)
+{
+	return Vec4(rand(256) / 255.f, rand(256) / 255.f, rand(256) / 255.f, 1);
+}
+
+/* Sequential access to a scene capture (see SceneCapture) */
+struct CaptureReader
+{
+	FILE *file;
+	const char *filename;
+
+	std::vector<char> serial;
+
+	CaptureReader(const char *filename)
+	    : file(fopen(filename, "rb")),
+	      filename(filename)
+	{
+		if (!file)
+			throw Exception(Exception::MKXPError,
+			                "Unable to open scene capture '%s'", filename);
+	}
+
+	~CaptureReader()
+	{
+		fclose(file);
+	}
+
+	void corrupt()
+	{
+		throw Exception(Exception::MKXPError,
+		                "Corrupt scene capture '%s'", filename);
+	}
+
+	void readBytes(void *data, size_t size)
+	{
+		if (size > 0 && fread(data, 1, size, file) != size)
+			corrupt();
+	}
+
+	int readInt()
+	{
+		int32_t value;
+		readBytes(&value, sizeof(value));
+
+		return value;
+	}
+
+	float readFloat()
+	{
+		float value;
+		readBytes(&value, sizeof(value));
+
+		return value;
+	}
+
+	bool readBool()
+	{
+		uint8_t value;
+		readBytes(&value, 1);
+
+		return value;
+	}
+
+	/* Sizes of individual chunks are capped well below
+	 * anything a capture of real data could contain */
+	int readSize()
+	{
+		int size = readInt();
+
+		if (size < 0 || size > (1 << 28))
+			corrupt();
+
+		return size;
+	}
+
+	const char *readSerial(int &size)
+	{
+		size = readSize();
+		serial.resize(std::max(size, 1));
+		readBytes(&serial[0], size);
+
+		return &serial[0];
+	}
+
+	template<class S>
+	void readSerial(S &dst)
+	{
+		int size;
+		const char *data = readSerial(size);
+
+		S *obj = S::deserialize(data, size);
+		dst = *obj;
+		delete obj;
+	}
+
+	/* Resolves a 1-based reference into what has been
+	 * read so far; 0 stands for none */
+	template<class C>
+	C *lookup(const std::vector<C*> &vec, int id)
+	{
+		if (id == 0)
+			return 0;
+
+		if (id < 0 || id > (int) vec.size())
+			corrupt();
+
+		return vec[id-1];
+	}
+};
+
+struct Bench
+{
+	Random rand;
+
+	/* Everything created for the current scene, released in reverse
+	 * order (bitmaps are created before the objects showing them) */
+	std::vector<Disposable*> disposables;
+	std::vector<Font*> fonts;
+	std::vector<Table*> tables;
+
+	/* Dynamic attributes, normally owned by the script wrappers */
+	std::vector<Rect*> rects;
+	std::vector<Color*> colors;
+	std::vector<Tone*> tones;
+
+	std::vector<Sprite*> sprites;
+	std::vector<Plane*> planes;
+	std::vector<Window*> windows;
+	std::vector<WindowVX*> windowsVX;
+	Tilemap *tilemap;
+	TilemapVX *tilemapVX;
+
+	/* Set for scenes loaded from a capture */
+	bool captured;
+
+	Bench()
+	    : tilemap(0),
+	      tilemapVX(0),
+	      captured(false)
+	{}
+
+	~Bench()
+	{
+		clear();
+	}
+
+	template<class C>
+	C *own(C *obj)
+	{
+		disposables.push_back(obj);
+		return obj;
+	}
+
+	Bitmap *newBitmap(int width, int height)
+	{
+		Bitmap *bitmap = own(new Bitmap(width, height));
+
+		Font *font = new Font();
+		fonts.push_back(font);
+		bitmap->setInitFont(font);
+
+		return bitmap;
+	}
+
+	/* A bitmap of 'cell' sized, randomly colored squares */
+	Bitmap *newPattern(int width, int height, int cell)
+	{
+		Bitmap *bitmap = newBitmap(width, height);
+
+		for (int y = 0; y < height; y += cell)
+			for (int x = 0; x < width; x += cell)
+				bitmap->fillRect(x, y, cell, cell, randomColor(rand));
+
+		return bitmap;
+	}
+
+	Table *newTable(int x, int y, int z)
+	{
+		Table *table = new Table(x, y, z);
+		tables.push_back(table);
+
+		return table;
+	}
+
+	void build(int contents)
+	{
+		if (contents & Tilemaps)
+			buildTilemap();
+		if (contents & Planes)
+			buildPlanes();
+		if (contents & Sprites)
+			buildSprites();
+		if (contents & Windows)
+			buildWindows();
+	}
+
+	void buildSprites()
+	{
+		const int scW = shState->graphics().width();
+		const int scH = shState->graphics().height();
+
+		Bitmap *bitmaps[] =
+		{
+			newPattern(32, 32, 8),
+			newPattern(32, 48, 16),
+			newPattern(64, 64, 32)
+		};
+
+		for (int i = 0; i < spriteCount; ++i)
+		{
+			Sprite *s = own(new Sprite());
+			s->initDynAttribs();
+
+			rects.push_back(&s->getSrcRect());
+			colors.push_back(&s->getColor());
+			tones.push_back(&s->getTone());
+
+			s->setBitmap(bitmaps[i % ARRAY_SIZE(bitmaps)]);
+			s->setX(rand(scW));
+			s->setY(rand(scH));
+			s->setZ(rand(200));
+			s->setOpacity(128 + rand(128));
+			s->setBlendType(i % 8 == 0 ? rand(3) : 0);
+
+			if (i % 4 == 0)
+				s->getTone().set(rand(128), -rand(128), 0, rand(255));
+
+			if (i % 16 == 0)
+			{
+				s->setZoomX(1.5f);
+				s->setAngle(rand(360));
+			}
+
+			sprites.push_back(s);
+		}
+	}
+
+	void buildTilemap()
+	{
+		const int mapW = 40, mapH = 30;
+
+		if (rgssVer == 1)
+		{
+			/* Created first, so they outlive the tilemap */
+			Bitmap *tileset = newPattern(256, 1024, 32);
+			Bitmap *autotiles[7];
+
+			for (int i = 0; i < 7; ++i)
+				autotiles[i] = newPattern(96, 128, 16);
+
+			tilemap = own(new Tilemap());
+			tilemap->setTileset(tileset);
+
+			for (int i = 0; i < 7; ++i)
+				tilemap->getAutotiles().set(i, autotiles[i]);
+
+			/* 384 autotile ids, then 8 tiles per tileset row */
+			const int tileCount = 384 + (1024 / 32) * 8;
+
+			Table *mapData = newTable(mapW, mapH, 3);
+			Table *priorities = newTable(tileCount, 1, 1);
+
+			for (int y = 0; y < mapH; ++y)
+				for (int x = 0; x < mapW; ++x)
+				{
+					mapData->set(48 + rand(7*48), x, y, 0);
+
+					if (rand(3) == 0)
+						mapData->set(384 + rand(tileCount - 384), x, y, 1);
+				}
+
+			for (int i = 384; i < tileCount; ++i)
+				priorities->set(rand(4) == 0 ? 1 + rand(5) : 0, i);
+
+			tilemap->setPriorities(priorities);
+			tilemap->setMapData(mapData);
+		}
+		else
+		{
+			static const int sizes[][2] =
+			{
+				{ 512, 384 }, { 512, 384 }, { 512, 256 }, { 512, 480 },
+				{ 256, 512 }, { 512, 512 }, { 512, 512 }, { 512, 512 },
+				{ 512, 512 }
+			};
+
+			Bitmap *bitmaps[9];
+
+			for (int i = 0; i < 9; ++i)
+				bitmaps[i] = newPattern(sizes[i][0], sizes[i][1], 32);
+
+			tilemapVX = own(new TilemapVX());
+
+			for (int i = 0; i < 9; ++i)
+				tilemapVX->getBitmapArray().set(i, bitmaps[i]);
+
+			Table *mapData = newTable(mapW, mapH, 4);
+			Table *flags = newTable(8192, 1, 1);
+
+			for (int y = 0; y < mapH; ++y)
+				for (int x = 0; x < mapW; ++x)
+				{
+					/* A1/A2 autotiles below, B-E tiles on top */
+					mapData->set(2048 + rand(32*48), x, y, 0);
+
+					if (rand(3) == 0)
+						mapData->set(rand(1024), x, y, 2);
+				}
+
+			for (int i = 0; i < 1024; ++i)
+				flags->set(rand(4) == 0 ? 0x10 : 0, i);
+
+			tilemapVX->setFlags(flags);
+			tilemapVX->setMapData(mapData);
+		}
+	}
+
+	void buildWindows()
+	{
+		const int scW = shState->graphics().width();
+
+		Bitmap *skin = (rgssVer == 1) ? newPattern(192, 128, 16)
+		                              : newPattern(128, 128, 16);
+
+		for (int i = 0; i < windowCount; ++i)
+		{
+			const int x = (i % 2) * (scW / 2);
+			const int y = (i / 2) * 96;
+			const int w = scW / 2, h = 96;
+
+			Bitmap *contents = newBitmap(w - 32, h - 32);
+
+			for (int line = 0; line < 2; ++line)
+				contents->drawText(0, line * 32, w - 32, 32, "The quick brown fox");
+
+			if (rgssVer == 1)
+			{
+				Window *win = own(new Window());
+				win->initDynAttribs();
+				rects.push_back(&win->getCursorRect());
+
+				win->setWindowskin(skin);
+				win->setContents(contents);
+				win->setX(x);
+				win->setY(y);
+				win->setWidth(w);
+				win->setHeight(h);
+				static_cast<SceneElement*>(win)->setZ(300 + i);
+				win->getCursorRect().set(0, 0, w - 32, 32);
+				win->setActive(true);
+
+				windows.push_back(win);
+			}
+			else
+			{
+				WindowVX *win = own(new WindowVX(x, y, w, h));
+				win->initDynAttribs();
+				rects.push_back(&win->getCursorRect());
+				tones.push_back(&win->getTone());
+
+				win->setWindowskin(skin);
+				win->setContents(contents);
+				static_cast<SceneElement*>(win)->setZ(300 + i);
+				win->getCursorRect().set(0, 0, w - 32, 32);
+				win->setActive(true);
+
+				windowsVX.push_back(win);
+			}
+		}
+	}
+
+	void buildPlanes()
+	{
+		for (int i = 0; i < planeCount; ++i)
+		{
+			Bitmap *bitmap = newPattern(64, 64, 16);
+
+			Plane *plane = own(new Plane());
+			plane->initDynAttribs();
+
+			colors.push_back(&plane->getColor());
+			tones.push_back(&plane->getTone());
+
+			plane->setBitmap(bitmap);
+			plane->setZ(-10 + i * 150);
+			plane->setOpacity(i == 0 ? 255 : 96);
+			plane->setBlendType(i == 2 ? 1 : 0);
+
+			if (i == 1)
+			{
+				plane->setZoomX(2.f);
+				plane->setZoomY(2.f);
+			}
+
+			planes.push_back(plane);
+		}
+	}
+
+	/* Recreates the objects of a scene capture using the same
+	 * setters the scripts would, in the captured display order */
+	void load(const char *filename)
+	{
+		CaptureReader in(filename);
+
+		char magic[sizeof(SceneCapture::magic)];
+		in.readBytes(magic, sizeof(magic));
+
+		if (memcmp(magic, SceneCapture::magic, sizeof(magic)))
+			in.corrupt();
+
+		const int scW = in.readInt();
+		const int scH = in.readInt();
+
+		Graphics &graphics = shState->graphics();
+
+		if (scW != graphics.width() || scH != graphics.height())
+			graphics.resizeScreen(scW, scH);
+
+		std::vector<Bitmap*> bitmaps;
+		std::vector<Table*> capTables;
+		std::vector<Viewport*> viewports;
+
+		std::vector<uint8_t> packed, pixels;
+
+		captured = true;
+
+		while (true)
+		{
+			uint8_t record;
+			in.readBytes(&record, 1);
+
+			switch (record)
+			{
+			case SceneCapture::End :
+				return;
+
+			case SceneCapture::BitmapData :
+			{
+				const int w = in.readInt();
+				const int h = in.readInt();
+				const int packedSize = in.readSize();
+
+				Bitmap *bitmap = newBitmap(w, h);
+				bitmaps.push_back(bitmap);
+
+				if (packedSize == 0)
+					break;
+
+				packed.resize(packedSize);
+				in.readBytes(&packed[0], packedSize);
+
+				pixels.resize(w * h * 4);
+				uLongf size = pixels.size();
+
+				if (uncompress(&pixels[0], &size, &packed[0], packedSize) != Z_OK
+				||  size != pixels.size())
+					in.corrupt();
+
+				bitmap->setPixels(IntRect(0, 0, w, h), &pixels[0]);
+				break;
+			}
+
+			case SceneCapture::TableData :
+			{
+				int size;
+				const char *data = in.readSerial(size);
+
+				Table *table = Table::deserialize(data, size);
+				tables.push_back(table);
+				capTables.push_back(table);
+				break;
+			}
+
+			case SceneCapture::ViewportElem :
+			{
+				const int z = in.readInt();
+				const bool visible = in.readBool();
+
+				Rect rect;
+				in.readSerial(rect);
+
+				Viewport *vp = own(new Viewport(rect.x, rect.y, rect.width, rect.height));
+				vp->initDynAttribs();
+
+				rects.push_back(&vp->getRect());
+				colors.push_back(&vp->getColor());
+				tones.push_back(&vp->getTone());
+
+				vp->setZ(z);
+				vp->setVisible(visible);
+				vp->setOX(in.readInt());
+				vp->setOY(in.readInt());
+
+				Color color;
+				in.readSerial(color);
+				vp->setColor(color);
+
+				Tone tone;
+				in.readSerial(tone);
+				vp->setTone(tone);
+
+				vp->setCache(in.readBool());
+
+				viewports.push_back(vp);
+				break;
+			}
+
+			case SceneCapture::SpriteElem :
+			{
+				const int z = in.readInt();
+				const bool visible = in.readBool();
+				Viewport *vp = in.lookup(viewports, in.readInt());
+
+				Sprite *s = own(new Sprite(vp));
+				s->initDynAttribs();
+
+				rects.push_back(&s->getSrcRect());
+				colors.push_back(&s->getColor());
+				tones.push_back(&s->getTone());
+
+				s->setZ(z);
+				s->setVisible(visible);
+
+				/* Resets the source rect, so goes first */
+				s->setBitmap(in.lookup(bitmaps, in.readInt()));
+
+				Rect srcRect;
+				in.readSerial(srcRect);
+				s->setSrcRect(srcRect);
+
+				s->setX(in.readInt());
+				s->setY(in.readInt());
+				s->setOX(in.readInt());
+				s->setOY(in.readInt());
+				s->setZoomX(in.readFloat());
+				s->setZoomY(in.readFloat());
+				s->setAngle(in.readFloat());
+				s->setMirror(in.readBool());
+				s->setBushDepth(in.readInt());
+				s->setBushOpacity(in.readInt());
+				s->setOpacity(in.readInt());
+				s->setBlendType(in.readInt());
+
+				Color color;
+				in.readSerial(color);
+				s->setColor(color);
+
+				Tone tone;
+				in.readSerial(tone);
+				s->setTone(tone);
+
+				s->setWaveAmp(in.readInt());
+				s->setWaveLength(in.readInt());
+				s->setWaveSpeed(in.readInt());
+				s->setWavePhase(in.readFloat());
+				break;
+			}
+
+			case SceneCapture::PlaneElem :
+			{
+				const int z = in.readInt();
+				const bool visible = in.readBool();
+				Viewport *vp = in.lookup(viewports, in.readInt());
+
+				Plane *plane = own(new Plane(vp));
+				plane->initDynAttribs();
+
+				colors.push_back(&plane->getColor());
+				tones.push_back(&plane->getTone());
+
+				plane->setZ(z);
+				plane->setVisible(visible);
+				plane->setBitmap(in.lookup(bitmaps, in.readInt()));
+				plane->setOX(in.readInt());
+				plane->setOY(in.readInt());
+				plane->setZoomX(in.readFloat());
+				plane->setZoomY(in.readFloat());
+				plane->setOpacity(in.readInt());
+				plane->setBlendType(in.readInt());
+
+				Color color;
+				in.readSerial(color);
+				plane->setColor(color);
+
+				Tone tone;
+				in.readSerial(tone);
+				plane->setTone(tone);
+				break;
+			}
+
+			case SceneCapture::WindowElem :
+			{
+				const int z = in.readInt();
+				const bool visible = in.readBool();
+				Viewport *vp = in.lookup(viewports, in.readInt());
+
+				Window *win = own(new Window(vp));
+				win->initDynAttribs();
+				rects.push_back(&win->getCursorRect());
+
+				static_cast<SceneElement*>(win)->setZ(z);
+				static_cast<SceneElement*>(win)->setVisible(visible);
+
+				win->setWindowskin(in.lookup(bitmaps, in.readInt()));
+				win->setContents(in.lookup(bitmaps, in.readInt()));
+				win->setStretch(in.readBool());
+
+				Rect cursorRect;
+				in.readSerial(cursorRect);
+				win->setCursorRect(cursorRect);
+
+				win->setActive(in.readBool());
+				win->setPause(in.readBool());
+				win->setX(in.readInt());
+				win->setY(in.readInt());
+				win->setWidth(in.readInt());
+				win->setHeight(in.readInt());
+				win->setOX(in.readInt());
+				win->setOY(in.readInt());
+				win->setOpacity(in.readInt());
+				win->setBackOpacity(in.readInt());
+				win->setContentsOpacity(in.readInt());
+				break;
+			}
+
+			case SceneCapture::TilemapElem :
+			{
+				Viewport *vp = in.lookup(viewports, in.readInt());
+
+				Tilemap *tm = own(new Tilemap(vp));
+				tm->setTileset(in.lookup(bitmaps, in.readInt()));
+
+				for (int i = 0; i < 7; ++i)
+					tm->getAutotiles().set(i, in.lookup(bitmaps, in.readInt()));
+
+				tm->setMapData(in.lookup(capTables, in.readInt()));
+				tm->setFlashData(in.lookup(capTables, in.readInt()));
+				tm->setPriorities(in.lookup(capTables, in.readInt()));
+				tm->setVisible(in.readBool());
+				tm->setOX(in.readInt());
+				tm->setOY(in.readInt());
+				break;
+			}
+
+			case SceneCapture::TilemapVXElem :
+			{
+				Viewport *vp = in.lookup(viewports, in.readInt());
+
+				TilemapVX *tm = own(new TilemapVX(vp));
+
+				for (int i = 0; i < 9; ++i)
+					tm->getBitmapArray().set(i, in.lookup(bitmaps, in.readInt()));
+
+				tm->setMapData(in.lookup(capTables, in.readInt()));
+				tm->setFlashData(in.lookup(capTables, in.readInt()));
+				tm->setFlags(in.lookup(capTables, in.readInt()));
+				tm->setVisible(in.readBool());
+				tm->setOX(in.readInt());
+				tm->setOY(in.readInt());
+				break;
+			}
+
+			default:
+				in.corrupt();
+			}
+		}
+	}
+
+	/* Moves things around like a game would, so every
+	 * frame has to be composited anew */
+	void animate(int frame)
+	{
+		/* A captured scene stays as it is, but
+		 * is still composited from scratch */
+		if (captured)
+			Scene::markDirty();
+
+		for (size_t i = 0; i < sprites.size(); ++i)
+		{
+			Sprite *s = sprites[i];
+			s->setX(s->getX() + ((i & 1) ? 1 : -1));
+
+			if (i % 16 == 0)
+				s->setAngle(frame * 2);
+		}
+
+		for (size_t i = 0; i < planes.size(); ++i)
+			planes[i]->setOX(frame * (i + 1));
+
+		if (tilemap)
+		{
+			tilemap->setOX(frame % 256);
+			tilemap->update();
+		}
+
+		if (tilemapVX)
+		{
+			tilemapVX->setOX(frame % 256);
+			tilemapVX->update();
+		}
+
+		for (size_t i = 0; i < windows.size(); ++i)
+			windows[i]->update();
+
+		for (size_t i = 0; i < windowsVX.size(); ++i)
+			windowsVX[i]->update();
+	}
+
+	void clear()
+	{
+		sprites.clear();
+		planes.clear();
+		windows.clear();
+		windowsVX.clear();
+		tilemap = 0;
+		tilemapVX = 0;
+
+		for (size_t i = disposables.size(); i > 0; --i)
+			delete disposables[i-1];
+
+		deleteAll(fonts);
+		deleteAll(tables);
+		deleteAll(rects);
+		deleteAll(colors);
+		deleteAll(tones);
+
+		disposables.clear();
+	}
+
+	template<class C>
+	static void deleteAll(std::vector<C*> &vec)
+	{
+		for (size_t i = 0; i < vec.size(); ++i)
+			delete vec[i];
+
+		vec.clear();
+	}
+};
+
+struct FrameTimes
+{
+	double cpuSum, cpuMax;
+	double gpuSum, gpuMax;
+	GLCallCounts calls;
+	int count;
+
+	FrameTimes()
+	    : cpuSum(0), cpuMax(0),
+	      gpuSum(0), gpuMax(0),
+	      count(0)
+	{}
+
+	void add(double cpu, double gpu)
+	{
+		cpuSum += cpu;
+		gpuSum += gpu;
+		cpuMax = std::max(cpuMax, cpu);
+		gpuMax = std::max(gpuMax, gpu);
+		++count;
+	}
+};
+
+static bool terminationRequested()
+{
+	return shState->rtData().rqTermAck;
+}
+
+/* Renders 'frames' frames of the current scene. 'cpu' is the time
+ * spent building and submitting a frame (animation, update() and the
+ * buffer swap), 'gpu' the time glFinish() then blocks, ie. the part
+ * of the GPU's work that isn't hidden behind the CPU time */
+static bool runFrames(Bench &bench, int frames, FrameTimes *times)
+{
+	Graphics &graphics = shState->graphics();
+	const double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+
+	for (int i = 0; i < frames; ++i)
+	{
+		if (terminationRequested())
+			return false;
+
+		const Uint64 start = SDL_GetPerformanceCounter();
+
+		bench.animate(i);
+		graphics.update();
+
+		const Uint64 submitted = SDL_GetPerformanceCounter();
+
+		gl.Finish();
+
+		const Uint64 finished = SDL_GetPerformanceCounter();
+
+		if (times)
+		{
+			times->add((submitted - start) * msPerTick,
+			           (finished - submitted) * msPerTick);
+			times->calls = graphics.glCalls();
+		}
+	}
+
+	return true;
+}
+
+static void report(const char *scene, const FrameTimes &t)
+{
+	char line[256];
+	snprintf(line, sizeof(line),
+	         "%-9s cpu %6.2f ms (max %6.2f)  gpu %6.2f ms (max %6.2f)  "
+	         "draws %u, programs %u, textures %u, culled %u",
+	         scene, t.cpuSum / t.count, t.cpuMax, t.gpuSum / t.count, t.gpuMax,
+	         t.calls.draws, t.calls.programBinds, t.calls.textureBinds, t.calls.culled);
+
+	Debug() << line;
+}
+
+/* Renders a captured scene, reporting the frame times
+ * along with the per section profiler averages */
+static void runSceneReplay(const char *filename)
+{
+	Bench bench;
+	FrameTimes times;
+
+	bench.load(filename);
+
+	Debug() << "Scene replay:" << filename << "," << benchFrames << "frames";
+
+	Profiler::setEnabled(true);
+
+	if (!runFrames(bench, warmupFrames, 0))
+		return;
+
+	if (!runFrames(bench, benchFrames, &times))
+		return;
+
+	report("capture", times);
+
+	float averages[Profiler::SectionCount];
+	Profiler::averages(averages, benchFrames);
+
+	for (int i = 0; i < Profiler::SectionCount; ++i)
+	{
+		if (averages[i] <= 0)
+			continue;
+
+		char line[64];
+		snprintf(line, sizeof(line), "  %-16s %7.3f ms",
+		         Profiler::sectionName(i), averages[i]);
+
+		Debug() << line;
+	}
+}
+
+static void runBenchmark()
+{
+	const Config &conf = shState->config();
+
+	if (conf.fixedFramerate >= 0 && !conf.syncToRefreshrate)
+		Debug() << "Benchmark: frame rate limited, set fixedFramerate=-1 for meaningful numbers";
+
+	if (!conf.sceneReplay.empty())
+	{
+		runSceneReplay(conf.sceneReplay.c_str());
+		return;
+	}
+
+	Debug() << "Benchmark:" << benchFrames << "frames per scene, RGSS" << rgssVer;
+
+	for (size_t i = 0; i < benchScenesN; ++i)
+	{
+		Bench bench;
+		FrameTimes times;
+
+		bench.build(benchScenes[i].contents);
+
+		if (!runFrames(bench, warmupFrames, 0))
+			return;
+
+		if (!runFrames(bench, benchFrames, &times))
+			return;
+
+		report(benchScenes[i].name, times);
+	}
+
+	runBitmapBenchmark();
+}
 
 static void nullBindingExecute()
 {
-	Debug() << "The null binding doesn't do anything, so we're done!";
+	try
+	{
+		runBenchmark();
+	}
+	catch (const Exception &e)
+	{
+		Debug() << "Benchmark failed:" << e.msg;
+	}
+
 	shState->rtData().rqTermAck.set();
 }
 
@@ -44,7 +1025,9 @@ ScriptBinding scriptBindingImpl =
 {
     nullBindingExecute,
     nullBindingTerminate,
-    nullBindingReset
+    nullBindingReset,
+    0,
+    0
 };
 
 ScriptBinding *scriptBinding = &scriptBindingImpl;
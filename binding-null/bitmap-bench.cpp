@@ -0,0 +1,235 @@
+/*
+** bitmap-bench.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "sharedstate.h"
+#include "eventthread.h"
+#include "debugwriter.h"
+#include "texpool.h"
+#include "bitmap.h"
+#include "font.h"
+#include "etc.h"
+#include "gl-fun.h"
+
+#include <SDL_timer.h>
+
+#include <stdio.h>
+
+/* Each Bitmap hot path in isolation, at a few sizes, reporting
+ * operations per second and the textures allocated per operation
+ * (TexPool misses). Every batch of operations is closed with a
+ * glFinish(), so the GPU's share of the work is accounted for */
+
+/* Minimum time spent on every operation and size */
+static const double runTimeMS = 250;
+static const int batchSize = 16;
+
+static const int sizes[] = { 32, 128, 512 };
+static elementsN(sizes);
+
+struct BenchContext
+{
+	Bitmap *dst;
+	Bitmap *src;
+	int size;
+};
+
+typedef void (*BitmapOp)(BenchContext &ctx, int i);
+
+static void opBlt(BenchContext &ctx, int)
+{
+	ctx.dst->blt(0, 0, *ctx.src, ctx.src->rect());
+}
+
+static void opBltOpacity(BenchContext &ctx, int)
+{
+	ctx.dst->blt(0, 0, *ctx.src, ctx.src->rect(), 128);
+}
+
+static void opStretchBlt(BenchContext &ctx, int)
+{
+	ctx.dst->stretchBlt(IntRect(0, 0, ctx.size / 2, ctx.size / 2),
+	                    *ctx.src, ctx.src->rect());
+}
+
+static void opStretchBltOpacity(BenchContext &ctx, int)
+{
+	ctx.dst->stretchBlt(IntRect(0, 0, ctx.size / 2, ctx.size / 2),
+	                    *ctx.src, ctx.src->rect(), 128);
+}
+
+static void opFillRect(BenchContext &ctx, int i)
+{
+	ctx.dst->fillRect(ctx.dst->rect(), Vec4((i % 256) / 255.f, 0.5f, 0.25f, 1));
+}
+
+static void drawLine(BenchContext &ctx, int i)
+{
+	/* A handful of distinct strings, like a menu redrawn every frame */
+	char str[32];
+	snprintf(str, sizeof(str), "Menu entry %d", i % 8);
+
+	ctx.dst->drawText(0, 0, ctx.size, 32, str);
+}
+
+static void opDrawText(BenchContext &ctx, int i)
+{
+	Font &font = ctx.dst->getFont();
+	font.setOutline(false);
+	font.setShadow(false);
+
+	drawLine(ctx, i);
+}
+
+static void opDrawTextOutline(BenchContext &ctx, int i)
+{
+	Font &font = ctx.dst->getFont();
+	font.setOutline(true);
+	font.setShadow(false);
+
+	drawLine(ctx, i);
+}
+
+static void opDrawTextShadow(BenchContext &ctx, int i)
+{
+	Font &font = ctx.dst->getFont();
+	font.setOutline(false);
+	font.setShadow(true);
+
+	drawLine(ctx, i);
+}
+
+static void opGetPixelModified(BenchContext &ctx, int i)
+{
+	ctx.dst->fillRect(0, 0, 1, 1, Vec4((i % 256) / 255.f, 0, 0, 1));
+	ctx.dst->getPixel(0, 0);
+}
+
+static void opHueChange(BenchContext &ctx, int i)
+{
+	ctx.dst->hueChange(1 + (i * 7) % 359);
+}
+
+static void opBlur(BenchContext &ctx, int)
+{
+	ctx.dst->blur();
+}
+
+static void opRadialBlur(BenchContext &ctx, int)
+{
+	ctx.dst->radialBlur(30, 6);
+}
+
+static const struct
+{
+	const char *name;
+	BitmapOp op;
+}
+bitmapOps[] =
+{
+	{ "blt",                 opBlt               },
+	{ "blt (opacity)",       opBltOpacity        },
+	{ "stretch_blt",         opStretchBlt        },
+	{ "stretch_blt (opac.)", opStretchBltOpacity },
+	{ "fill_rect",           opFillRect          },
+	{ "draw_text",           opDrawText          },
+	{ "draw_text (outline)", opDrawTextOutline   },
+	{ "draw_text (shadow)",  opDrawTextShadow    },
+	{ "get_pixel (dirty)",   opGetPixelModified  },
+	{ "hue_change",          opHueChange         },
+	{ "blur",                opBlur              },
+	{ "radial_blur",         opRadialBlur        }
+};
+
+static elementsN(bitmapOps);
+
+static Bitmap *patternBitmap(int size, Font *font)
+{
+	Bitmap *bitmap = new Bitmap(size, size);
+	bitmap->setInitFont(font);
+
+	const int cell = size / 4;
+
+	for (int y = 0; y < 4; ++y)
+		for (int x = 0; x < 4; ++x)
+			bitmap->fillRect(x * cell, y * cell, cell, cell,
+			                 Vec4(x / 3.f, y / 3.f, (x ^ y) / 3.f, 1));
+
+	return bitmap;
+}
+
+static void runOp(const char *name, BitmapOp op, int size)
+{
+	TexPool &pool = shState->texPool();
+	const double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+
+	Font dstFont, srcFont;
+	BenchContext ctx;
+	ctx.size = size;
+	ctx.dst = patternBitmap(size, &dstFont);
+	ctx.src = patternBitmap(size, &srcFont);
+
+	/* Warm up caches and lazily compiled shaders */
+	for (int i = 0; i < batchSize; ++i)
+		op(ctx, i);
+
+	gl.Finish();
+
+	const unsigned int missesBefore = pool.misses();
+	const Uint64 start = SDL_GetPerformanceCounter();
+
+	int count = 0;
+	double elapsed = 0;
+
+	while (elapsed < runTimeMS)
+	{
+		for (int i = 0; i < batchSize; ++i)
+			op(ctx, count++);
+
+		gl.Finish();
+		elapsed = (SDL_GetPerformanceCounter() - start) * msPerTick;
+	}
+
+	const unsigned int allocs = pool.misses() - missesBefore;
+
+	delete ctx.dst;
+	delete ctx.src;
+
+	char line[256];
+	snprintf(line, sizeof(line), "%-20s %3dx%-3d %10.0f ops/s  %6.3f allocs/op",
+	         name, size, size, count / (elapsed / 1000), (double) allocs / count);
+
+	Debug() << line;
+}
+
+void runBitmapBenchmark()
+{
+	Debug() << "Bitmap benchmark:";
+
+	for (size_t i = 0; i < bitmapOpsN; ++i)
+		for (size_t j = 0; j < sizesN; ++j)
+		{
+			if (shState->rtData().rqTermAck)
+				return;
+
+			runOp(bitmapOps[i].name, bitmapOps[i].op, sizes[j]);
+		}
+}
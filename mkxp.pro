@@ -52,6 +52,10 @@ unix {
 		PKGCONFIG += fluidsynth
 	}
 
+	THEORA {
+		PKGCONFIG += theoradec vorbis
+	}
+
 	INI_ENCODING {
 		PKGCONFIG += libguess
 	}
@@ -140,7 +144,45 @@ HEADERS += \
 	src/tileatlasvx.h \
 	src/sharedmidistate.h \
 	src/fluid-fun.h \
-	src/sdl-util.h
+	src/sdl-util.h \
+	src/glyphatlas.h \
+	src/textcache.h \
+	src/spritebatch.h \
+	src/preloader.h \
+	src/workerpool.h \
+	src/bitmapcache.h \
+	src/atlascache.h \
+	src/ktximage.h \
+	src/midicache.h \
+	src/shadercache.h \
+	src/fillqueue.h \
+	src/windowbasecache.h \
+	src/profiler.h \
+	src/gputimer.h \
+	src/memstats.h \
+	src/textcompose.h \
+	src/textmetrics.h \
+	src/bundle.h \
+	src/objectpool.h \
+	src/handletable.h \
+	src/spritesystem.h \
+	src/texuploader.h \
+	src/startuptimer.h \
+	src/tilevbo.h \
+	src/screencapture.h \
+	src/scratcharena.h \
+	src/spriteatlas.h \
+	src/particlesystem.h \
+	src/pcmcache.h \
+	src/softmixer.h \
+	src/inputreplay.h \
+	src/scenecapture.h \
+	src/budgettuner.h \
+	src/packeddatacache.h \
+	src/gldeletequeue.h \
+	src/threadpolicy.h \
+	src/idletasks.h \
+	src/uploadstaging.h
 
 SOURCES += \
 	src/main.cpp \
@@ -186,7 +228,43 @@ SOURCES += \
 	src/tileatlasvx.cpp \
 	src/autotilesvx.cpp \
 	src/midisource.cpp \
-	src/fluid-fun.cpp
+	src/fluid-fun.cpp \
+	src/glyphatlas.cpp \
+	src/textcache.cpp \
+	src/spritebatch.cpp \
+	src/preloader.cpp \
+	src/workerpool.cpp \
+	src/bitmapcache.cpp \
+	src/atlascache.cpp \
+	src/ktximage.cpp \
+	src/midicache.cpp \
+	src/shadercache.cpp \
+	src/fillqueue.cpp \
+	src/windowbasecache.cpp \
+	src/profiler.cpp \
+	src/gputimer.cpp \
+	src/memstats.cpp \
+	src/textcompose.cpp \
+	src/textmetrics.cpp \
+	src/bundle.cpp \
+	src/objectpool.cpp \
+	src/spritesystem.cpp \
+	src/texuploader.cpp \
+	src/tilevbo.cpp \
+	src/screencapture.cpp \
+	src/scratcharena.cpp \
+	src/spriteatlas.cpp \
+	src/particlesystem.cpp \
+	src/pcmcache.cpp \
+	src/softmixer.cpp \
+	src/inputreplay.cpp \
+	src/scenecapture.cpp \
+	src/budgettuner.cpp \
+	src/packeddatacache.cpp \
+	src/gldeletequeue.cpp \
+	src/threadpolicy.cpp \
+	src/idletasks.cpp \
+	src/uploadstaging.cpp
 
 EMBED = \
 	shader/common.h \
@@ -195,7 +273,7 @@ EMBED = \
 	shader/hue.frag \
 	shader/sprite.frag \
 	shader/plane.frag \
-	shader/gray.frag \
+	shader/viewport.frag \
 	shader/bitmapBlit.frag \
 	shader/flatColor.frag \
 	shader/simple.frag \
@@ -207,12 +285,25 @@ EMBED = \
 	shader/simple.vert \
 	shader/simpleColor.vert \
 	shader/sprite.vert \
+	shader/spriteWave.vert \
+	shader/spriteInstanced.vert \
+	shader/spriteInstanced.frag \
 	shader/tilemap.vert \
+	shader/tilemapIndexed.frag \
+	shader/tilemapDepth.vert \
+	shader/alphaTest.frag \
 	shader/blur.frag \
 	shader/blurH.vert \
 	shader/blurV.vert \
 	shader/simpleMatrix.vert \
 	shader/tilemapvx.vert \
+	shader/glyph.frag \
+	shader/textBlit.frag \
+	shader/radialBlur.frag \
+	shader/planeWrap.frag \
+	shader/upscale.frag \
+	shader/yuv.frag \
+	shader/particle.frag \
 	assets/liberation.ttf \
 	assets/icon.png
 
@@ -220,6 +311,12 @@ SHARED_FLUID {
 	DEFINES += SHARED_FLUID
 }
 
+THEORA {
+	DEFINES += THEORA
+	HEADERS += src/movieplayer.h
+	SOURCES += src/movieplayer.cpp
+}
+
 INI_ENCODING {
 	DEFINES += INI_ENCODING
 }
@@ -239,7 +336,9 @@ QMAKE_EXTRA_COMPILERS += xxd
 
 
 BINDING_NULL {
-	SOURCES += binding-null/binding-null.cpp
+	SOURCES += \
+	binding-null/binding-null.cpp \
+	binding-null/bitmap-bench.cpp
 }
 
 BINDING_MRUBY {
@@ -269,6 +368,7 @@ BINDING_MRUBY {
 	binding-mruby/font-binding.cpp \
 	binding-mruby/viewport-binding.cpp \
 	binding-mruby/plane-binding.cpp \
+	binding-mruby/particlesystem-binding.cpp \
 	binding-mruby/audio-binding.cpp \
 	binding-mruby/tilemap-binding.cpp \
 	binding-mruby/etc-binding.cpp \
@@ -320,10 +420,12 @@ BINDING_MRI {
 	binding-mri/sprite-binding.cpp \
 	binding-mri/viewport-binding.cpp \
 	binding-mri/plane-binding.cpp \
+	binding-mri/particlesystem-binding.cpp \
 	binding-mri/window-binding.cpp \
 	binding-mri/tilemap-binding.cpp \
 	binding-mri/audio-binding.cpp \
 	binding-mri/module_rpg.cpp \
+	binding-mri/rpgcache-binding.cpp \
 	binding-mri/filesystem-binding.cpp \
 	binding-mri/windowvx-binding.cpp \
 	binding-mri/tilemapvx-binding.cpp
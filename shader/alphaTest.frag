@@ -0,0 +1,16 @@
+
+uniform sampler2D texture;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+	vec4 frag = texture2D(texture, v_texCoord);
+
+	/* Mostly transparent pixels must not
+	 * occlude anything via depth */
+	if (frag.a < 0.5)
+		discard;
+
+	gl_FragColor = frag;
+}
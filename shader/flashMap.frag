@@ -1,9 +1,14 @@
 
+uniform sampler2D texture;
+
 uniform lowp float alpha;
 
-varying lowp vec4 v_color;
+/* One texel per tile */
+varying vec2 v_texCoord;
 
 void main()
 {
-	gl_FragColor = vec4(v_color.rgb * alpha, 1);
+	lowp vec3 color = texture2D(texture, v_texCoord).rgb;
+
+	gl_FragColor = vec4(color * alpha, 1);
 }
@@ -0,0 +1,12 @@
+
+uniform sampler2D texture;
+
+varying vec2 v_texCoord;
+varying lowp vec4 v_color;
+
+void main()
+{
+	/* Atlas glyphs only contribute their coverage */
+	gl_FragColor = v_color;
+	gl_FragColor.a *= texture2D(texture, v_texCoord).a;
+}
@@ -0,0 +1,51 @@
+/* Plane drawn as a single quad: the bitmap is repeated by
+ * wrapping the coordinates, as it may only occupy part of
+ * a (pooled) texture that hardware repeat can't be used on */
+
+#if defined(GLSLES) && defined(GL_FRAGMENT_PRECISION_HIGH)
+/* Positions are handled in pixels */
+precision highp float;
+#endif
+
+uniform sampler2D texture;
+
+uniform vec2 texSize;
+uniform vec2 bitmapSize;
+
+/* Scroll position, in bitmap pixels */
+uniform vec2 offset;
+
+uniform lowp vec4 tone;
+
+uniform lowp float opacity;
+uniform lowp vec4 color;
+uniform lowp vec4 flash;
+
+varying vec2 v_texCoord;
+
+const vec3 lumaF = vec3(.299, .587, .114);
+
+void main()
+{
+	/* Sample source color */
+	vec2 pos = mod(v_texCoord * texSize + offset, bitmapSize);
+	vec4 frag = texture2D(texture, pos / texSize);
+
+	/* Apply gray */
+	float luma = dot(frag.rgb, lumaF);
+	frag.rgb = mix(frag.rgb, vec3(luma), tone.w);
+
+	/* Apply tone */
+	frag.rgb += tone.rgb;
+
+	/* Apply opacity */
+	frag.a *= opacity;
+
+	/* Apply color */
+	frag.rgb = mix(frag.rgb, color.rgb, color.a);
+
+	/* Apply flash */
+	frag.rgb = mix(frag.rgb, flash.rgb, flash.a);
+
+	gl_FragColor = frag;
+}
@@ -0,0 +1,74 @@
+/* Single pass variant of Bitmap::radialBlur: sums 'divisions'
+ * rotations of the bitmap around its center, each weighted by
+ * 'opacity', the way additively blended rotated copies would */
+
+#if defined(GLSLES) && defined(GL_FRAGMENT_PRECISION_HIGH)
+/* Positions are handled in pixels */
+precision highp float;
+#endif
+
+#define MAX_DIVISIONS 100
+
+uniform sampler2D texture;
+
+uniform vec2 texSize;
+uniform vec2 bitmapSize;
+
+/* Cosine and sine of the first rotation and of the step between two */
+uniform vec2 baseRot;
+uniform vec2 stepRot;
+
+uniform int divisions;
+uniform float opacity;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+	vec2 center = bitmapSize * 0.5;
+	vec2 d = v_texCoord * texSize - center;
+
+	vec2 rot = baseRot;
+	vec4 sum = vec4(0.0);
+
+	for (int i = 0; i < MAX_DIVISIONS; ++i)
+	{
+		if (i >= divisions)
+			break;
+
+		vec2 pos = vec2(rot.x * d.x - rot.y * d.y,
+		                rot.y * d.x + rot.x * d.y) + center;
+
+		rot = vec2(rot.x * stepRot.x - rot.y * stepRot.y,
+		           rot.y * stepRot.x + rot.x * stepRot.y);
+
+		/* Areas rotated in from outside show the bitmap mirrored
+		 * once across the nearest edge, but not across corners */
+		bool outX = pos.x < 0.0 || pos.x > bitmapSize.x;
+		bool outY = pos.y < 0.0 || pos.y > bitmapSize.y;
+
+		if (outX && outY)
+			continue;
+
+		if (pos.x < 0.0)
+			pos.x = -pos.x;
+		else if (pos.x > bitmapSize.x)
+			pos.x = 2.0 * bitmapSize.x - pos.x;
+
+		if (pos.y < 0.0)
+			pos.y = -pos.y;
+		else if (pos.y > bitmapSize.y)
+			pos.y = 2.0 * bitmapSize.y - pos.y;
+
+		if (pos.x < 0.0 || pos.x > bitmapSize.x ||
+		    pos.y < 0.0 || pos.y > bitmapSize.y)
+			continue;
+
+		vec4 frag = texture2D(texture, pos / texSize);
+		float weight = frag.a * opacity;
+
+		sum += vec4(frag.rgb * weight, weight);
+	}
+
+	gl_FragColor = sum;
+}
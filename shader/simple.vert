@@ -4,6 +4,12 @@ uniform mat4 projMat;
 uniform vec2 texSizeInv;
 uniform vec2 translation;
 
+/* With 'unitQuad' set, the vertices are those of the shared
+ * unit quad and get placed by these rects (x, y, w, h) */
+uniform float unitQuad;
+uniform vec4 unitPosRect;
+uniform vec4 unitTexRect;
+
 attribute vec2 position;
 attribute vec2 texCoord;
 
@@ -11,7 +17,10 @@ varying vec2 v_texCoord;
 
 void main()
 {
-	gl_Position = projMat * vec4(position + translation, 0, 1);
+	vec2 pos = mix(position, unitPosRect.xy + position * unitPosRect.zw, unitQuad);
+	vec2 tex = mix(texCoord, unitTexRect.xy + texCoord * unitTexRect.zw, unitQuad);
+
+	gl_Position = projMat * vec4(pos + translation, 0, 1);
 
-	v_texCoord = texCoord * texSizeInv;
+	v_texCoord = tex * texSizeInv;
 }
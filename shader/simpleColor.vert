@@ -4,6 +4,10 @@ uniform mat4 projMat;
 uniform vec2 texSizeInv;
 uniform vec2 translation;
 
+/* Squashes the vertices vertically towards the line y = 'squash.y'
+ * by the factor 'squash.x' (0: untouched, 1: collapsed) */
+uniform vec2 squash;
+
 attribute vec2 position;
 attribute vec2 texCoord;
 attribute lowp vec4 color;
@@ -13,7 +17,9 @@ varying lowp vec4 v_color;
 
 void main()
 {
-	gl_Position = projMat * vec4(position + translation, 0, 1);
+	vec2 pos = vec2(position.x, mix(position.y, squash.y, squash.x));
+
+	gl_Position = projMat * vec4(pos + translation, 0, 1);
 
 	v_texCoord = texCoord * texSizeInv;
 	v_color = color;
@@ -1,13 +1,26 @@
 
+/* Permutations enable the effects with
+ * SPRITE_TONE, SPRITE_COLOR, SPRITE_OPACITY
+ * and SPRITE_BUSH (see SpriteFeature) */
+
 uniform sampler2D texture;
 
+#ifdef SPRITE_TONE
 uniform lowp vec4 tone;
+#endif
 
+#ifdef SPRITE_OPACITY
 uniform lowp float opacity;
+#endif
+
+#ifdef SPRITE_COLOR
 uniform lowp vec4 color;
+#endif
 
+#ifdef SPRITE_BUSH
 uniform float bushDepth;
 uniform lowp float bushOpacity;
+#endif
 
 varying vec2 v_texCoord;
 
@@ -17,23 +30,31 @@ void main()
 {
 	/* Sample source color */
 	vec4 frag = texture2D(texture, v_texCoord);
-	
+
+#ifdef SPRITE_TONE
 	/* Apply gray */
 	float luma = dot(frag.rgb, lumaF);
 	frag.rgb = mix(frag.rgb, vec3(luma), tone.w);
 	
 	/* Apply tone */
 	frag.rgb += tone.rgb;
+#endif
 
+#ifdef SPRITE_OPACITY
 	/* Apply opacity */
 	frag.a *= opacity;
-	
+#endif
+
+#ifdef SPRITE_COLOR
 	/* Apply color */
 	frag.rgb = mix(frag.rgb, color.rgb, color.a);
+#endif
 
+#ifdef SPRITE_BUSH
 	/* Apply bush alpha by mathematical if */
 	lowp float underBush = float(v_texCoord.y < bushDepth);
 	frag.a *= clamp(bushOpacity + underBush, 0.0, 1.0);
+#endif
 	
 	gl_FragColor = frag;
 }
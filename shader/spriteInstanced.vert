@@ -0,0 +1,41 @@
+
+uniform mat4 projMat;
+
+uniform vec2 texSizeInv;
+
+/* Corner of the shared quad, 0 or 1 on each axis */
+attribute vec2 position;
+
+/* Per instance attributes */
+
+/* Source rectangle (x, y, w, h) in pixels;
+ * a negative width mirrors the sprite */
+attribute vec4 texCoord;
+attribute vec4 color;
+/* xy: scene space edge along the sprite's x axis,
+ * zw: same for its y axis, both spanning the whole quad */
+attribute vec4 instAxes;
+/* xy: scene space position of the top left corner,
+ * z: opacity, w: bush opacity */
+attribute vec4 instOrigin;
+attribute vec4 instTone;
+attribute float instBushDepth;
+
+varying vec2 v_texCoord;
+
+varying lowp vec4 v_tone;
+varying lowp vec4 v_color;
+/* x: opacity, y: bush opacity, z: bush depth */
+varying vec3 v_effect;
+
+void main()
+{
+	vec2 pos = instOrigin.xy + position.x * instAxes.xy + position.y * instAxes.zw;
+
+	gl_Position = projMat * vec4(pos, 0, 1);
+	v_texCoord = (texCoord.xy + position * texCoord.zw) * texSizeInv;
+
+	v_tone = instTone;
+	v_color = color;
+	v_effect = vec3(instOrigin.zw, instBushDepth);
+}
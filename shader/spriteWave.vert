@@ -0,0 +1,40 @@
+
+uniform mat4 projMat;
+
+uniform mat4 spriteMat;
+
+uniform vec2 texSizeInv;
+
+/* x: amplitude, y: phase step per pixel (2pi / length),
+ * z: phase, w: inverse vertical zoom */
+uniform vec4 wave;
+
+/* x: start of the first chunk (may lie above the sprite),
+ * y: visible sprite height, z: sprite width */
+uniform vec4 waveChunks;
+
+/* Corner of the chunk quad, 0 or 1 on each axis */
+attribute vec2 position;
+/* x: chunk index */
+attribute vec2 texCoord;
+
+varying vec2 v_texCoord;
+
+const float chunkHeight = 8.0;
+
+void main()
+{
+	float chunkY = waveChunks.x + texCoord.x * chunkHeight;
+
+	/* The first and last chunk are cut to the sprite */
+	float top = max(chunkY, 0.0);
+	float bottom = min(chunkY + chunkHeight, waveChunks.y);
+
+	vec2 tex = vec2(position.x * waveChunks.z,
+	                mix(top, bottom, position.y) * wave.w);
+
+	float offset = sin(wave.z + top * wave.y) * wave.x;
+
+	gl_Position = projMat * spriteMat * vec4(tex.x + offset, tex.y, 0, 1);
+	v_texCoord = tex * texSizeInv;
+}
@@ -4,6 +4,9 @@ uniform mat4 projMat;
 uniform vec2 texSizeInv;
 uniform vec2 translation;
 
+/* 0.5 for packed (half pixel) tex coordinates */
+uniform float texCoordScale;
+
 uniform float aniIndex;
 
 attribute vec2 position;
@@ -17,7 +20,7 @@ const float atAniOffset = 32.0*3.0;
 
 void main()
 {
-	vec2 tex = texCoord;
+	vec2 tex = texCoord * texCoordScale;
 
 	lowp float pred = float(tex.x <= atAreaW && tex.y <= atAreaH);
 	tex.x += aniIndex * atAniOffset * pred;
@@ -0,0 +1,37 @@
+
+uniform mat4 projMat;
+
+uniform vec2 texSizeInv;
+uniform vec2 translation;
+
+uniform float aniIndex;
+
+/* Depth distance between neighboring layers */
+uniform float depthStep;
+
+attribute vec2 position;
+attribute vec2 texCoord;
+
+/* x: index of the layer the tile belongs to */
+attribute vec4 color;
+
+varying vec2 v_texCoord;
+
+const float atAreaW = 96.0;
+const float atAreaH = 128.0*7.0;
+const float atAniOffset = 32.0*3.0;
+
+void main()
+{
+	vec2 tex = texCoord;
+
+	lowp float pred = float(tex.x <= atAreaW && tex.y <= atAreaH);
+	tex.x += aniIndex * atAniOffset * pred;
+
+	gl_Position = projMat * vec4(position + translation, 0, 1);
+
+	/* Higher layers end up closer to the viewer */
+	gl_Position.z = 1.0 - 2.0 * (color.x + 1.0) * depthStep;
+
+	v_texCoord = tex * texSizeInv;
+}
@@ -0,0 +1,41 @@
+
+/* Map positions need more than mediump precision on big maps */
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+#define MAP_PRECISION highp
+#else
+#define MAP_PRECISION mediump
+#endif
+
+/* Autotile/tileset atlas */
+uniform sampler2D texture;
+
+/* One texel per 16x16 tile piece, holding the atlas position of
+ * the piece in 16 pixel units ('r', 'g', with the upper bits in
+ * the nibbles of 'b'); 'a' is 0 for empty, 1 for tileset and
+ * 2 for autotile pieces */
+uniform sampler2D mapTex;
+
+/* In pixels */
+uniform MAP_PRECISION vec2 mapSize;
+
+uniform vec2 atlasSizeInv;
+uniform float aniIndex;
+
+/* Map position in pixels */
+varying MAP_PRECISION vec2 v_texCoord;
+
+const float atAniOffset = 32.0*3.0;
+
+void main()
+{
+	MAP_PRECISION vec2 pos = mod(v_texCoord, mapSize);
+	vec4 piece = floor(texture2D(mapTex, pos / mapSize) * 255.0 + 0.5);
+
+	MAP_PRECISION vec2 atlasPos = vec2(piece.r + mod(piece.b, 16.0) * 256.0,
+	                           piece.g + floor(piece.b / 16.0) * 256.0);
+
+	atlasPos = atlasPos * 16.0 + mod(pos, 16.0);
+	atlasPos.x += aniIndex * atAniOffset * step(1.5, piece.a);
+
+	gl_FragColor = texture2D(texture, atlasPos * atlasSizeInv) * step(0.5, piece.a);
+}
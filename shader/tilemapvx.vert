@@ -4,6 +4,9 @@ uniform mat4 projMat;
 uniform vec2 texSizeInv;
 uniform vec2 translation;
 
+/* 0.5 for packed (half pixel) tex coordinates */
+uniform float texCoordScale;
+
 uniform vec2 aniOffset;
 
 attribute vec2 position;
@@ -17,7 +20,7 @@ const float atAreaCW = 4.0*32.0;
 
 void main()
 {
-	vec2 tex = texCoord;
+	vec2 tex = texCoord * texCoordScale;
 	lowp float pred;
 
 	/* Type A autotiles shift horizontally */
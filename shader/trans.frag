@@ -3,18 +3,18 @@
 uniform sampler2D currentScene;
 uniform sampler2D frozenScene;
 uniform sampler2D transMap;
-/* Normalized */
-uniform float prog;
-/* Vague [0, 512] normalized */
-uniform float vague;
+/* Part of 'transMap' covered by the image */
+uniform vec2 transMapScale;
+/* Progress and vague folded into scale and bias,
+ * mapping map values onto the frozen scene's alpha */
+uniform vec2 ramp;
 
 varying vec2 v_texCoord;
 
 void main()
 {
-    float transV = texture2D(transMap, v_texCoord).r;
-    float cTransV = clamp(transV, prog, prog+vague);
-    lowp float alpha = (cTransV - prog) / vague;
+    float transV = texture2D(transMap, v_texCoord * transMapScale).r;
+    lowp float alpha = clamp(transV * ramp.x + ramp.y, 0.0, 1.0);
     
     vec4 newFrag = texture2D(currentScene, v_texCoord);
     vec4 oldFrag = texture2D(frozenScene, v_texCoord);
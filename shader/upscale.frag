@@ -0,0 +1,23 @@
+
+uniform sampler2D texture;
+
+uniform vec2 texSizeInv;
+
+/* Source pixels covered by one screen pixel */
+uniform vec2 footprint;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+	vec2 texel = v_texCoord / texSizeInv;
+
+	/* Nearest boundary between two source pixels; a screen
+	 * pixel straddling it mixes both by how much of its
+	 * footprint falls onto either side, and takes the color
+	 * of a single source pixel otherwise */
+	vec2 edge = floor(texel + 0.5);
+	vec2 t = clamp((texel - edge) / footprint + 0.5, 0.0, 1.0);
+
+	gl_FragColor = texture2D(texture, (edge - 0.5 + t) * texSizeInv);
+}
@@ -0,0 +1,22 @@
+/* Converts a frame stored as separate Y, Cb and Cr
+ * planes (BT.601, video range) to RGB */
+
+uniform sampler2D texture;
+uniform sampler2D texCb;
+uniform sampler2D texCr;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+	float y  = texture2D(texture, v_texCoord).r;
+	float cb = texture2D(texCb, v_texCoord).r - 0.5;
+	float cr = texture2D(texCr, v_texCoord).r - 0.5;
+
+	y = 1.164 * (y - 0.0625);
+
+	gl_FragColor = vec4(y + 1.596 * cr,
+	                    y - 0.391 * cb - 0.813 * cr,
+	                    y + 2.018 * cb,
+	                    1.0);
+}
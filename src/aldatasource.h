@@ -46,7 +46,8 @@ struct ALDataSource
 	 * reset back to the beginning */
 	virtual void seekToOffset(float seconds) = 0;
 
-	/* The frame count right after wrap around */
+	/* The frame count right after the buffer
+	 * that wrapped around */
 	virtual uint32_t loopStartFrames() = 0;
 
 	/* Returns false if not supported */
@@ -58,10 +59,18 @@ ALDataSource *createSDLSource(SDL_RWops &ops,
 			                  uint32_t maxBufSize,
 			                  bool looped);
 
+/* 'bufSize' is the number of samples
+ * each filled AL buffer holds */
+
+/* Files whose decoded size doesn't exceed 'memLimit'
+ * bytes are decoded into memory once on creation */
 ALDataSource *createVorbisSource(SDL_RWops &ops,
-                                 bool looped);
+                                 bool looped,
+                                 uint32_t bufSize,
+                                 uint32_t memLimit = 0);
 
 ALDataSource *createMidiSource(SDL_RWops &ops,
-                               bool looped);
+                               bool looped,
+                               uint32_t bufSize);
 
 #endif // ALDATASOURCE_H
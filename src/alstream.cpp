@@ -23,6 +23,9 @@
 
 #include "sharedstate.h"
 #include "sharedmidistate.h"
+#include "midicache.h"
+#include "pcmcache.h"
+#include "config.h"
 #include "eventthread.h"
 #include "filesystem.h"
 #include "exception.h"
@@ -30,19 +33,34 @@
 #include "fluid-fun.h"
 #include "sdl-util.h"
 #include "debugwriter.h"
+#include "profiler.h"
 
 #include <SDL_mutex.h>
-#include <SDL_thread.h>
-#include <SDL_timer.h>
+
+static ALDataSource::Status fillBuffer(ALDataSource *source, AL::Buffer::ID buf)
+{
+	PROFILE_SCOPE(AudioFill);
+
+	return source->fillBuffer(buf);
+}
 
 ALStream::ALStream(LoopMode loopMode,
-		           const std::string &threadId)
+                   int bufCount, uint32_t bufSize,
+                   bool adaptive)
 	: looped(loopMode == Looped),
 	  state(Closed),
 	  source(0),
-	  thread(0),
+	  streamStarted(false),
+	  streaming(false),
+	  queueFilled(false),
 	  preemptPause(false),
-      pitch(1.0f)
+      pitch(1.0f),
+	  alBuf(bufCount),
+	  bufSize(bufSize),
+	  adaptive(adaptive),
+	  underruns(0),
+	  srcSlot(0),
+	  cache(0)
 {
 	alSrc = AL::Source::gen();
 
@@ -50,12 +68,10 @@ ALStream::ALStream(LoopMode loopMode,
 	AL::Source::setPitch(alSrc, 1.0f);
 	AL::Source::detachBuffer(alSrc);
 
-	for (int i = 0; i < STREAM_BUFS; ++i)
+	for (size_t i = 0; i < alBuf.size(); ++i)
 		alBuf[i] = AL::Buffer::gen();
 
 	pauseMut = SDL_CreateMutex();
-
-	threadName = std::string("al_stream (") + threadId + ")";
 }
 
 ALStream::~ALStream()
@@ -65,7 +81,7 @@ ALStream::~ALStream()
 	AL::Source::clearQueue(alSrc);
 	AL::Source::del(alSrc);
 
-	for (int i = 0; i < STREAM_BUFS; ++i)
+	for (size_t i = 0; i < alBuf.size(); ++i)
 		AL::Buffer::del(alBuf[i]);
 
 	SDL_DestroyMutex(pauseMut);
@@ -106,6 +122,41 @@ void ALStream::open(const std::string &filename)
 	state = Stopped;
 }
 
+ALDataSource *ALStream::prepareSource(const std::string &filename)
+{
+	try
+	{
+		return createSource(filename, srcOps[srcSlot ^ 1]);
+	}
+	catch (const Exception &e)
+	{
+		Debug() << "Unable to open audio stream:" << filename << ":" << e.msg;
+		return 0;
+	}
+}
+
+void ALStream::openPrepared(ALDataSource *prepared)
+{
+	checkStopped();
+
+	switch (state)
+	{
+	case Playing:
+	case Paused:
+		stopStream();
+	case Stopped:
+		closeSource();
+	case Closed:
+		break;
+	}
+
+	source = prepared;
+	srcSlot ^= 1;
+	needsRewind.clear();
+
+	state = Stopped;
+}
+
 void ALStream::stop()
 {
 	checkStopped();
@@ -169,6 +220,8 @@ void ALStream::setVolume(float value)
 
 void ALStream::setPitch(float value)
 {
+	pitch = value;
+
 	/* If the source supports setting pitch natively,
 	 * we don't have to do it via OpenAL */
 	if (source && source->setPitch(value))
@@ -203,11 +256,21 @@ struct ALStreamOpenHandler : FileSystem::OpenHandler
 {
 	SDL_RWops *srcOps;
 	bool looped;
+	uint32_t bufSize;
 	ALDataSource *source;
 	std::string errorMsg;
 
-	ALStreamOpenHandler(SDL_RWops &srcOps, bool looped)
-	    : srcOps(&srcOps), looped(looped), source(0)
+	/* Short looping tracks are played from memory */
+	uint32_t memLimit;
+
+	PcmCache *cache;
+	const std::string &filename;
+
+	ALStreamOpenHandler(SDL_RWops &srcOps, bool looped, uint32_t bufSize,
+	                    PcmCache *cache, const std::string &filename)
+	    : srcOps(&srcOps), looped(looped), bufSize(bufSize), source(0),
+	      memLimit(looped ? shState->config().memoryStreamSize : 0),
+	      cache(cache), filename(filename)
 	{}
 
 	bool tryRead(SDL_RWops &ops, const char *ext)
@@ -223,9 +286,20 @@ struct ALStreamOpenHandler : FileSystem::OpenHandler
 
 		try
 		{
+			/* Midi has its own cache */
+			if (cache && strcmp(sig, "MThd"))
+			{
+				source = cache->load(filename, *srcOps, ext,
+				                     looped, bufSize);
+
+				if (source)
+					return true;
+			}
+
 			if (!strcmp(sig, "OggS"))
 			{
-				source = createVorbisSource(*srcOps, looped);
+				source = createVorbisSource(*srcOps, looped, bufSize,
+				                            memLimit);
 				return true;
 			}
 
@@ -235,12 +309,19 @@ struct ALStreamOpenHandler : FileSystem::OpenHandler
 
 				if (HAVE_FLUID)
 				{
-					source = createMidiSource(*srcOps, looped);
+					MidiCache &cache = shState->midiCache();
+
+					if (cache.enabled())
+						source = cache.open(*srcOps, looped, bufSize);
+
+					if (!source)
+						source = createMidiSource(*srcOps, looped, bufSize);
+
 					return true;
 				}
 			}
 
-			source = createSDLSource(*srcOps, ext, STREAM_BUF_SIZE, looped);
+			source = createSDLSource(*srcOps, ext, bufSize, looped);
 		}
 		catch (const Exception &e)
 		{
@@ -254,14 +335,21 @@ struct ALStreamOpenHandler : FileSystem::OpenHandler
 	}
 };
 
-void ALStream::openSource(const std::string &filename)
+ALDataSource *ALStream::createSource(const std::string &filename,
+                                     SDL_RWops &ops)
 {
-	ALStreamOpenHandler handler(srcOps, looped);
+	if (cache)
+	{
+		ALDataSource *cached = cache->open(filename, looped, bufSize);
+
+		if (cached)
+			return cached;
+	}
+
+	ALStreamOpenHandler handler(ops, looped, bufSize, cache, filename);
 	shState->fileSystem().openRead(handler, filename.c_str());
-	source = handler.source;
-	needsRewind.clear();
 
-	if (!source)
+	if (!handler.source)
 	{
 		char buf[512];
 		snprintf(buf, sizeof(buf), "Unable to decode audio stream: %s: %s",
@@ -269,22 +357,26 @@ void ALStream::openSource(const std::string &filename)
 
 		Debug() << buf;
 	}
+
+	return handler.source;
+}
+
+void ALStream::openSource(const std::string &filename)
+{
+	source = createSource(filename, srcOps[srcSlot]);
+	needsRewind.clear();
 }
 
 void ALStream::stopStream()
 {
-	threadTermReq.set();
+	streaming = false;
 
-	if (thread)
+	if (streamStarted)
 	{
-		SDL_WaitThread(thread, 0);
-		thread = 0;
+		streamStarted = false;
 		needsRewind.set();
 	}
 
-	/* Need to stop the source _after_ the thread has terminated,
-	 * because it might have accidentally started it again before
-	 * seeing the term request */
 	AL::Source::stop(alSrc);
 
 	procFrames = 0;
@@ -297,13 +389,14 @@ void ALStream::startStream(float offset)
 	preemptPause = false;
 	streamInited.clear();
 	sourceExhausted.clear();
-	threadTermReq.clear();
 
 	startOffset = offset;
 	procFrames = offset * source->sampleRate();
 
-	thread = createSDLThread
-		<ALStream, &ALStream::streamData>(this, threadName);
+	/* The queue is filled by the next service() */
+	streamStarted = true;
+	streaming = true;
+	queueFilled = false;
 }
 
 void ALStream::pauseStream()
@@ -357,32 +450,40 @@ void ALStream::checkStopped()
 	state = Stopped;
 }
 
-/* thread func */
-void ALStream::streamData()
+void ALStream::service()
+{
+	if (!streaming)
+		return;
+
+	if (!queueFilled)
+		fillQueue();
+	else
+		refillQueue();
+}
+
+void ALStream::fillQueue()
 {
-	/* Fill up queue */
 	bool firstBuffer = true;
 	ALDataSource::Status status;
 
-	if (threadTermReq)
-		return;
+	queueFilled = true;
 
 	if (needsRewind)
 	{
 		source->seekToOffset(startOffset);
 	}
 
-	for (int i = 0; i < STREAM_BUFS; ++i)
+	for (size_t i = 0; i < alBuf.size(); ++i)
 	{
-		if (threadTermReq)
-			return;
-
 		AL::Buffer::ID buf = alBuf[i];
 
-		status = source->fillBuffer(buf);
+		status = fillBuffer(source, buf);
 
 		if (status == ALDataSource::Error)
+		{
+			streaming = false;
 			return;
+		}
 
 		AL::Source::queueBuffer(alSrc, buf);
 
@@ -394,86 +495,110 @@ void ALStream::streamData()
 			streamInited.set();
 		}
 
-		if (threadTermReq)
-			return;
-
 		if (status == ALDataSource::EndOfStream)
 		{
 			sourceExhausted.set();
 			break;
 		}
 	}
+}
 
-	/* Wait for buffers to be consumed, then
-	 * refill and queue them up again */
-	while (true)
+void ALStream::refillQueue()
+{
+	ALDataSource::Status status;
+	bool grow = false;
+
+	/* Refill the buffers that have been consumed
+	 * and queue them up again */
+	ALint procBufs = AL::Source::getProcBufferCount(alSrc);
+
+	while (procBufs--)
 	{
-		shState->rtData().syncPoint.passSecondarySync();
+		AL::Buffer::ID buf = AL::Source::unqueueBuffer(alSrc);
 
-		ALint procBufs = AL::Source::getProcBufferCount(alSrc);
+		/* If something went wrong, try again later */
+		if (buf == AL::Buffer::ID(0))
+			break;
 
-		while (procBufs--)
+		if (buf == lastBuf)
 		{
-			if (threadTermReq)
-				break;
+			/* Reset the processed sample count so
+			 * querying the playback offset returns 0.0 again */
+			procFrames = source->loopStartFrames();
+			lastBuf = AL::Buffer::ID(0);
+		}
+		else
+		{
+			/* Add the frame count contained in this
+			 * buffer to the total count */
+			ALint bits = AL::Buffer::getBits(buf);
+			ALint size = AL::Buffer::getSize(buf);
+			ALint chan = AL::Buffer::getChannels(buf);
+
+			if (bits != 0 && chan != 0)
+				procFrames += ((size / (bits / 8)) / chan);
+		}
 
-			AL::Buffer::ID buf = AL::Source::unqueueBuffer(alSrc);
+		if (sourceExhausted)
+			continue;
 
-			/* If something went wrong, try again later */
-			if (buf == AL::Buffer::ID(0))
-				break;
+		status = fillBuffer(source, buf);
 
-			if (buf == lastBuf)
-			{
-				/* Reset the processed sample count so
-				 * querying the playback offset returns 0.0 again */
-				procFrames = source->loopStartFrames();
-				lastBuf = AL::Buffer::ID(0);
-			}
-			else
-			{
-				/* Add the frame count contained in this
-				 * buffer to the total count */
-				ALint bits = AL::Buffer::getBits(buf);
-				ALint size = AL::Buffer::getSize(buf);
-				ALint chan = AL::Buffer::getChannels(buf);
-
-				if (bits != 0 && chan != 0)
-					procFrames += ((size / (bits / 8)) / chan);
-			}
+		if (status == ALDataSource::Error)
+		{
+			sourceExhausted.set();
+			streaming = false;
+			return;
+		}
 
-			if (sourceExhausted)
-				continue;
+		AL::Source::queueBuffer(alSrc, buf);
 
-			status = source->fillBuffer(buf);
+		/* In case of buffer underrun,
+		 * start playing again */
+		if (AL::Source::getState(alSrc) == AL_STOPPED)
+		{
+			AL::Source::play(alSrc);
 
-			if (status == ALDataSource::Error)
-			{
-				sourceExhausted.set();
-				return;
-			}
+			++underruns;
+			grow = adaptive && alBuf.size() < STREAM_MAX_BUFS;
+		}
 
-			AL::Source::queueBuffer(alSrc, buf);
+		/* If this was the last buffer before the data
+		 * source loop wrapped around again, mark it as
+		 * such so we can catch it and reset the processed
+		 * sample count once it gets unqueued */
+		if (status == ALDataSource::WrapAround)
+			lastBuf = buf;
 
-			/* In case of buffer underrun,
-			 * start playing again */
-			if (AL::Source::getState(alSrc) == AL_STOPPED)
-				AL::Source::play(alSrc);
+		if (status == ALDataSource::EndOfStream)
+			sourceExhausted.set();
+	}
 
-			/* If this was the last buffer before the data
-			 * source loop wrapped around again, mark it as
-			 * such so we can catch it and reset the processed
-			 * sample count once it gets unqueued */
-			if (status == ALDataSource::WrapAround)
-				lastBuf = buf;
+	/* A deeper queue keeps the stream going through
+	 * longer stalls of the service thread */
+	if (grow && !sourceExhausted)
+		growQueue();
+}
 
-			if (status == ALDataSource::EndOfStream)
-				sourceExhausted.set();
-		}
+void ALStream::growQueue()
+{
+	AL::Buffer::ID buf = AL::Buffer::gen();
+	alBuf.push_back(buf);
 
-		if (threadTermReq)
-			break;
+	ALDataSource::Status status = fillBuffer(source, buf);
 
-		SDL_Delay(AUDIO_SLEEP);
+	if (status == ALDataSource::Error)
+	{
+		sourceExhausted.set();
+		streaming = false;
+		return;
 	}
+
+	AL::Source::queueBuffer(alSrc, buf);
+
+	if (status == ALDataSource::WrapAround)
+		lastBuf = buf;
+
+	if (status == ALDataSource::EndOfStream)
+		sourceExhausted.set();
 }
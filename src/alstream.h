@@ -26,14 +26,21 @@
 #include "sdl-util.h"
 
 #include <string>
+#include <vector>
 #include <SDL_rwops.h>
 
 struct ALDataSource;
+class PcmCache;
 
-#define STREAM_BUFS 3
+/* Upper limit the buffer queue of an adaptive
+ * stream may grow to after repeated underruns */
+#define STREAM_MAX_BUFS 16
 
 /* State-machine like audio playback stream.
- * This class is NOT thread safe */
+ * This class is NOT thread safe; its buffer queue is kept
+ * filled by periodic calls to service() from the audio
+ * thread, which have to be serialized with all other
+ * calls (see AudioStream::lockStream()) */
 struct ALStream
 {
 	enum State
@@ -48,9 +55,15 @@ struct ALStream
 	State state;
 
 	ALDataSource *source;
-	SDL_Thread *thread;
 
-	std::string threadName;
+	/* Set by startStream() until the next stopStream() */
+	bool streamStarted;
+
+	/* Whether service() still has to feed the queue */
+	bool streaming;
+
+	/* Whether the initial buffers have been queued */
+	bool queueFilled;
 
 	SDL_mutex *pauseMut;
 	bool preemptPause;
@@ -61,20 +74,36 @@ struct ALStream
 	AtomicFlag streamInited;
 	AtomicFlag sourceExhausted;
 
-	AtomicFlag threadTermReq;
-
 	AtomicFlag needsRewind;
 	float startOffset;
 
 	float pitch;
 
 	AL::Source::ID alSrc;
-	AL::Buffer::ID alBuf[STREAM_BUFS];
+	std::vector<AL::Buffer::ID> alBuf;
+
+	/* Size of each buffer, in samples */
+	uint32_t bufSize;
+
+	/* Whether to queue up another buffer on underruns */
+	bool adaptive;
+
+	/* Number of times the AL source ran dry while
+	 * the data source still had more to give */
+	unsigned int underruns;
 
 	uint64_t procFrames;
 	AL::Buffer::ID lastBuf;
 
-	SDL_RWops srcOps;
+	/* Data sources keep reading from the ops they were
+	 * opened with; the second one is for the source
+	 * prepareSource() opens while the current one plays */
+	SDL_RWops srcOps[2];
+	int srcSlot;
+
+	/* If set, files are played from (and added to) this
+	 * cache of decoded files where possible. Not owned */
+	PcmCache *cache;
 
 	struct
 	{
@@ -89,11 +118,24 @@ struct ALStream
 	};
 
 	ALStream(LoopMode loopMode,
-	         const std::string &threadId);
+	         int bufCount, uint32_t bufSize,
+	         bool adaptive);
 	~ALStream();
 
 	void close();
 	void open(const std::string &filename);
+
+	/* Opens a data source for 'filename' next to the current
+	 * one, which is left untouched. Unlike all other functions,
+	 * this doesn't have to be serialized with them; it may only
+	 * be called by one thread at a time though, and the source
+	 * has to be passed to openPrepared() or deleted before the
+	 * next call. Returns null if the file can't be played */
+	ALDataSource *prepareSource(const std::string &filename);
+
+	/* Like open(), with a source from prepareSource() */
+	void openPrepared(ALDataSource *prepared);
+
 	void stop();
 	void play(float offset = 0);
 	void pause();
@@ -104,9 +146,14 @@ struct ALStream
 	float queryOffset();
 	bool queryNativePitch();
 
+	/* Queues up decoded buffers as they're consumed */
+	void service();
+
 private:
 	void closeSource();
 	void openSource(const std::string &filename);
+	ALDataSource *createSource(const std::string &filename,
+	                           SDL_RWops &ops);
 
 	void stopStream();
 	void startStream(float offset);
@@ -115,8 +162,9 @@ private:
 
 	void checkStopped();
 
-	/* thread func */
-	void streamData();
+	void fillQueue();
+	void refillQueue();
+	void growQueue();
 };
 
 #endif // ALSTREAM_H
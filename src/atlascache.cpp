@@ -0,0 +1,235 @@
+/*
+** atlascache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "atlascache.h"
+
+#include "bitmap.h"
+#include "texpool.h"
+#include "disposable.h"
+#include "boost-hash.h"
+
+#include <boost/functional/hash.hpp>
+
+#include <list>
+
+/* Stamp of absent (null or disposed) source bitmaps */
+static const unsigned int noBitmap = (unsigned int) -1;
+
+AtlasKey::AtlasKey()
+    : layout(0),
+      width(0),
+      height(0)
+{}
+
+void AtlasKey::addBitmap(const Bitmap *bitmap)
+{
+	stamps.push_back(nullOrDisposed(bitmap) ? noBitmap : bitmap->contentStamp());
+}
+
+bool AtlasKey::operator==(const AtlasKey &o) const
+{
+	return layout == o.layout && width == o.width
+	    && height == o.height && stamps == o.stamps;
+}
+
+size_t hash_value(const AtlasKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.layout);
+	boost::hash_combine(seed, key.width);
+	boost::hash_combine(seed, key.height);
+	boost::hash_range(seed, key.stamps.begin(), key.stamps.end());
+
+	return seed;
+}
+
+static uint32_t byteCount(const TEXFBO &tex)
+{
+	return tex.width * tex.height * 4;
+}
+
+struct CacheNode
+{
+	AtlasKey key;
+	TEXFBO tex;
+};
+
+typedef std::list<CacheNode> NodeList;
+
+struct AtlasCachePrivate
+{
+	TexPool &pool;
+
+	/* Idle atlases, most recently released first */
+	NodeList lru;
+	BoostHash<AtlasKey, NodeList::iterator> hash;
+
+	uint32_t maxMemSize;
+	uint32_t memSize;
+	int count;
+
+	unsigned int hits;
+	unsigned int misses;
+
+	AtlasCachePrivate(TexPool &pool, uint32_t maxMemSize)
+	    : pool(pool),
+	      maxMemSize(maxMemSize),
+	      memSize(0),
+	      count(0),
+	      hits(0),
+	      misses(0)
+	{}
+
+	/* Removes 'iter' from the cache, handing its atlas to 'out' */
+	void take(NodeList::iterator iter, TEXFBO &out)
+	{
+		out = iter->tex;
+
+		memSize -= byteCount(iter->tex);
+		--count;
+
+		hash.remove(iter->key);
+		lru.erase(iter);
+	}
+
+	void evictLast()
+	{
+		TEXFBO tex;
+		take(--lru.end(), tex);
+
+		pool.release(tex);
+	}
+};
+
+AtlasCache::AtlasCache(TexPool &pool, uint32_t maxMemSize)
+{
+	p = new AtlasCachePrivate(pool, maxMemSize);
+}
+
+AtlasCache::~AtlasCache()
+{
+	clear();
+
+	delete p;
+}
+
+bool AtlasCache::request(const AtlasKey &key, TEXFBO &out)
+{
+	if (p->hash.contains(key))
+	{
+		++p->hits;
+		p->take(p->hash[key], out);
+
+		return true;
+	}
+
+	++p->misses;
+
+	/* Recycle the least recently used atlas of the same size */
+	for (NodeList::iterator iter = p->lru.end(); iter != p->lru.begin();)
+	{
+		--iter;
+
+		if (iter->tex.width != key.width || iter->tex.height != key.height)
+			continue;
+
+		p->take(iter, out);
+
+		return false;
+	}
+
+	out = p->pool.request(key.width, key.height);
+
+	return false;
+}
+
+void AtlasCache::release(TEXFBO &tex, const AtlasKey &key)
+{
+	/* No point in caching an invalid object */
+	if (tex.tex == TEX::ID(0))
+		return;
+
+	/* Another tilemap already gave back the same atlas */
+	if (p->hash.contains(key))
+	{
+		p->pool.release(tex);
+		tex = TEXFBO();
+
+		return;
+	}
+
+	const uint32_t bytes = byteCount(tex);
+
+	while (p->count > 0 && p->memSize + bytes > p->maxMemSize)
+		p->evictLast();
+
+	CacheNode node;
+	node.key = key;
+	node.tex = tex;
+
+	p->lru.push_front(node);
+	p->hash.insert(key, p->lru.begin());
+
+	p->memSize += bytes;
+	++p->count;
+
+	tex = TEXFBO();
+}
+
+void AtlasCache::clear()
+{
+	while (!p->lru.empty())
+		p->evictLast();
+}
+
+unsigned int AtlasCache::hits() const
+{
+	return p->hits;
+}
+
+unsigned int AtlasCache::misses() const
+{
+	return p->misses;
+}
+
+uint32_t AtlasCache::maxMemSize() const
+{
+	return p->maxMemSize;
+}
+
+void AtlasCache::setMaxMemSize(uint32_t value)
+{
+	p->maxMemSize = value;
+
+	while (p->memSize > p->maxMemSize)
+		p->evictLast();
+}
+
+uint32_t AtlasCache::memSize() const
+{
+	return p->memSize;
+}
+
+int AtlasCache::entryCount() const
+{
+	return p->count;
+}
@@ -0,0 +1,100 @@
+/*
+** atlascache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ATLASCACHE_H
+#define ATLASCACHE_H
+
+#include "gl-util.h"
+
+#include <vector>
+#include <stdint.h>
+
+class Bitmap;
+class TexPool;
+struct AtlasCachePrivate;
+
+/* Everything a tilemap atlas is built from */
+struct AtlasKey
+{
+	enum Layout
+	{
+		TilemapLayout,
+		TilemapVXLayout
+	};
+
+	int layout;
+
+	int width;
+	int height;
+
+	/* Content stamps of the source bitmaps, in order */
+	std::vector<unsigned int> stamps;
+
+	AtlasKey();
+
+	void addBitmap(const Bitmap *bitmap);
+
+	bool operator==(const AtlasKey &o) const;
+};
+
+size_t hash_value(const AtlasKey &key);
+
+/* Keeps the atlases of disposed tilemaps (or of tilesets
+ * switched away from) around together with the source
+ * contents they were built from, so that a tilemap set up
+ * with the same tileset and autotiles again can take the
+ * finished atlas instead of assembling a new one.
+ * Idle atlases are returned to the TexPool least recently
+ * released first once they exceed 'maxMemSize'; the last
+ * one is always kept */
+class AtlasCache
+{
+public:
+	AtlasCache(TexPool &pool, uint32_t maxMemSize);
+	~AtlasCache();
+
+	/* Hands out an atlas of the size in 'key' and returns
+	 * true if it already holds the contents described by it.
+	 * Otherwise an idle atlas of the same size is recycled
+	 * (or a new one allocated) and false is returned */
+	bool request(const AtlasKey &key, TEXFBO &out);
+
+	/* Takes back an atlas built from 'key' */
+	void release(TEXFBO &tex, const AtlasKey &key);
+
+	/* Returns all idle atlases to the pool */
+	void clear();
+
+	/* Lowering the budget evicts idle
+	 * atlases until it is met again */
+	uint32_t maxMemSize() const;
+	void setMaxMemSize(uint32_t value);
+
+	unsigned int hits() const;
+	unsigned int misses() const;
+	uint32_t memSize() const;
+	int entryCount() const;
+
+private:
+	AtlasCachePrivate *p;
+};
+
+#endif // ATLASCACHE_H
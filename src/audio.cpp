@@ -23,10 +23,12 @@
 
 #include "audiostream.h"
 #include "soundemitter.h"
+#include "pcmcache.h"
 #include "sharedstate.h"
 #include "sharedmidistate.h"
 #include "eventthread.h"
 #include "sdl-util.h"
+#include "al-util.h"
 
 #include <string>
 
@@ -35,6 +37,9 @@
 
 struct AudioPrivate
 {
+	/* Declared ahead of 'me', which plays from it */
+	PcmCache meCache;
+
 	AudioStream bgm;
 	AudioStream bgs;
 	AudioStream me;
@@ -43,7 +48,11 @@ struct AudioPrivate
 
 	SyncPoint &syncPoint;
 
-	/* The 'MeWatch' is responsible for detecting
+	/* The audio thread services all streams (see
+	 * AudioStream::service()) and the SE emitter.
+	 * It also runs the 'MeWatch'.
+	 *
+	 * The 'MeWatch' is responsible for detecting
 	 * a playing ME, quickly fading out the BGM and
 	 * keeping it paused/stopped while the ME plays,
 	 * and unpausing/fading the BGM back in again
@@ -64,15 +73,32 @@ struct AudioPrivate
 	} meWatch;
 
 	AudioPrivate(RGSSThreadData &rtData)
-	    : bgm(ALStream::Looped, "bgm"),
-	      bgs(ALStream::Looped, "bgs"),
-	      me(ALStream::NotLooped, "me"),
+	    : meCache(rtData.config.ME.cacheSize),
+	      bgm(ALStream::Looped,
+	          rtData.config.BGM.bufferCount,
+	          rtData.config.BGM.bufferSize,
+	          rtData.config.adaptiveStreamBuffers,
+	          rtData.config.asyncStreamOpen,
+	          rtData.config.bgmCrossfade),
+	      bgs(ALStream::Looped,
+	          rtData.config.BGS.bufferCount,
+	          rtData.config.BGS.bufferSize,
+	          rtData.config.adaptiveStreamBuffers,
+	          rtData.config.asyncStreamOpen),
+	      me(ALStream::NotLooped,
+	          rtData.config.ME.bufferCount,
+	          rtData.config.ME.bufferSize,
+	          rtData.config.adaptiveStreamBuffers),
 	      se(rtData.config),
 	      syncPoint(rtData.syncPoint)
 	{
+		if (meCache.enabled())
+			me.stream.cache = &meCache;
+
 		meWatch.state = MeNotPlaying;
 		meWatch.thread = createSDLThread
-			<AudioPrivate, &AudioPrivate::meWatchFun>(this, "audio_mewatch");
+			<AudioPrivate, &AudioPrivate::meWatchFun>(this, "audio_service",
+			                                          ThreadPolicy::Audio);
 	}
 
 	~AudioPrivate()
@@ -81,6 +107,19 @@ struct AudioPrivate
 		SDL_WaitThread(meWatch.thread, 0);
 	}
 
+	AudioStream &getStream(Audio::StreamType type)
+	{
+		switch (type)
+		{
+		case Audio::BGS :
+			return bgs;
+		case Audio::ME :
+			return me;
+		default:
+			return bgm;
+		}
+	}
+
 	void meWatchFun()
 	{
 		const float fadeOutStep = 1.f / (200  / AUDIO_SLEEP);
@@ -93,6 +132,10 @@ struct AudioPrivate
 			if (meWatch.termReq)
 				return;
 
+			bgm.service();
+			bgs.service();
+			me.service();
+
 			switch (meWatch.state)
 			{
 			case MeNotPlaying:
@@ -232,6 +275,8 @@ struct AudioPrivate
 			}
 			}
 
+			se.update();
+
 			SDL_Delay(AUDIO_SLEEP);
 		}
 	}
@@ -305,6 +350,11 @@ void Audio::sePlay(const char *filename,
 	p->se.play(filename, volume, pitch);
 }
 
+void Audio::sePreload(const char *filename)
+{
+	p->se.preload(filename);
+}
+
 void Audio::seStop()
 {
 	p->se.stop();
@@ -325,6 +375,33 @@ float Audio::bgsPos()
 	return p->bgs.playingOffset();
 }
 
+unsigned int Audio::streamUnderruns(StreamType type)
+{
+	AudioStream &stream = p->getStream(type);
+
+	stream.lockStream();
+	unsigned int result = stream.stream.underruns;
+	stream.unlockStream();
+
+	return result;
+}
+
+int Audio::streamBufferCount(StreamType type)
+{
+	AudioStream &stream = p->getStream(type);
+
+	stream.lockStream();
+	int result = stream.stream.alBuf.size();
+	stream.unlockStream();
+
+	return result;
+}
+
+void Audio::setMuted(bool value)
+{
+	alListenerf(AL_GAIN, value ? 0.0f : 1.0f);
+}
+
 void Audio::reset()
 {
 	p->bgm.stop();
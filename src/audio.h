@@ -63,10 +63,28 @@ public:
 	            int pitch = 100);
 	void seStop();
 
+	/* Decodes 'filename' into the SE cache in the background */
+	void sePreload(const char *filename);
+
 	void setupMidi();
 	float bgmPos();
 	float bgsPos();
 
+	enum StreamType
+	{
+		BGM,
+		BGS,
+		ME
+	};
+
+	/* Buffer queue statistics of a stream, see
+	 * the adaptiveStreamBuffers config option */
+	unsigned int streamUnderruns(StreamType type);
+	int streamBufferCount(StreamType type);
+
+	/* Silences all output without affecting playback */
+	void setMuted(bool value);
+
 	void reset();
 
 private:
@@ -21,18 +21,23 @@
 
 #include "audiostream.h"
 
+#include "aldatasource.h"
 #include "util.h"
 #include "exception.h"
 
 #include <SDL_mutex.h>
-#include <SDL_thread.h>
 #include <SDL_timer.h>
 
 AudioStream::AudioStream(ALStream::LoopMode loopMode,
-                         const std::string &threadId)
+                         int bufCount, uint32_t bufSize,
+                         bool adaptive, bool asyncOpen,
+                         uint32_t crossfadeMs)
 	: extPaused(false),
 	  noResumeStop(false),
-	  stream(loopMode, threadId)
+	  stream(loopMode, bufCount, bufSize, adaptive),
+	  crossfadeMs(crossfadeMs),
+	  tail(0),
+	  asyncOpen(asyncOpen)
 {
 	current.volume = 1.0f;
 	current.pitch = 1.0f;
@@ -40,34 +45,32 @@ AudioStream::AudioStream(ALStream::LoopMode loopMode,
 	for (size_t i = 0; i < VolumeTypeCount; ++i)
 		volumes[i] = 1.0f;
 
-	fade.thread = 0;
-	fade.threadName = std::string("audio_fadeout (") + threadId + ")";
+	fade.active = false;
+	fadeIn.active = false;
+	fadeIn.duration = 1000;
+	crossfade.active = false;
+	crossfade.volume = 0;
 
-	fadeIn.thread = 0;
-	fadeIn.threadName = std::string("audio_fadein (") + threadId + ")";
+	if (crossfadeMs > 0)
+		tail = new ALStream(loopMode, bufCount, bufSize, adaptive);
+
+	pendingOpen.requested = false;
+	pendingOpen.offset = 0;
+	pendingOpen.serial = 0;
 
 	streamMut = SDL_CreateMutex();
 }
 
 AudioStream::~AudioStream()
 {
-	if (fade.thread)
-	{
-		fade.reqTerm.set();
-		SDL_WaitThread(fade.thread, 0);
-	}
-
-	if (fadeIn.thread)
-	{
-		fadeIn.rqTerm.set();
-		SDL_WaitThread(fadeIn.thread, 0);
-	}
-
 	lockStream();
 
 	stream.stop();
 	stream.close();
 
+	finiCrossfade();
+	delete tail;
+
 	unlockStream();
 
 	SDL_DestroyMutex(streamMut);
@@ -78,13 +81,39 @@ void AudioStream::play(const std::string &filename,
                        int pitch,
                        float offset)
 {
-	finiFadeOutInt();
-
 	lockStream();
 
 	float _volume = clamp<int>(volume, 0, 100) / 100.0f;
 	float _pitch  = clamp<int>(pitch, 50, 150) / 100.0f;
 
+	if (asyncOpen && pendingOpen.requested && filename == current.filename)
+	{
+		/* Applied once the pending file is switched to */
+		current.volume = _volume;
+		current.pitch = _pitch;
+
+		unlockStream();
+		return;
+	}
+
+	if (asyncOpen && filename != current.filename)
+	{
+		/* Fades of the current file carry on until the switch */
+		pendingOpen.requested = true;
+		pendingOpen.filename = filename;
+		pendingOpen.offset = offset;
+		++pendingOpen.serial;
+
+		current.filename = filename;
+		current.volume = _volume;
+		current.pitch = _pitch;
+
+		unlockStream();
+		return;
+	}
+
+	finiFades();
+
 	ALStream::State sState = stream.queryState();
 
 	/* If all parameters match the current ones and we're
@@ -98,14 +127,20 @@ void AudioStream::play(const std::string &filename,
 		return;
 	}
 
-	/* If all parameters except volume match the current ones,
-	 * we update the volume and continue streaming */
+	/* If only volume and/or pitch differ from the current ones,
+	 * we update them live and continue streaming */
 	if (filename == current.filename
-	&&  _pitch   == current.pitch
 	&&  (sState == ALStream::Playing || sState == ALStream::Paused))
 	{
 		setVolume(Base, _volume);
 		current.volume = _volume;
+
+		if (_pitch != current.pitch)
+		{
+			stream.setPitch(_pitch);
+			current.pitch = _pitch;
+		}
+
 		unlockStream();
 		return;
 	}
@@ -113,6 +148,9 @@ void AudioStream::play(const std::string &filename,
 	/* Requested audio file is different from current one */
 	bool diffFile = (filename != current.filename);
 
+	if (diffFile && canCrossfade())
+		startCrossfade(0);
+
 	switch (sState)
 	{
 	case ALStream::Paused :
@@ -135,38 +173,30 @@ void AudioStream::play(const std::string &filename,
 				unlockStream();
 				throw e;
 			}
+
+			crossfade.file = filename;
 		}
 
 		break;
 	}
 
-	setVolume(Base, _volume);
-	stream.setPitch(_pitch);
-
-	if (offset > 0)
-	{
-		setVolume(FadeIn, 0);
-		startFadeIn();
-	}
-
 	current.filename = filename;
 	current.volume = _volume;
 	current.pitch = _pitch;
 
-	if (!extPaused)
-		stream.play(offset);
-	else
-		noResumeStop = false;
+	startPlayback(offset);
 
 	unlockStream();
 }
 
 void AudioStream::stop()
 {
-	finiFadeOutInt();
-
 	lockStream();
 
+	cancelOpen();
+	finiFades();
+	finiCrossfade();
+
 	noResumeStop = true;
 
 	stream.stop();
@@ -178,6 +208,8 @@ void AudioStream::fadeOut(int duration)
 {
 	lockStream();
 
+	cancelOpen();
+
 	ALStream::State sState = stream.queryState();
 	noResumeStop = true;
 
@@ -203,22 +235,10 @@ void AudioStream::fadeOut(int duration)
 		return;
 	}
 
-	if (fade.thread)
-	{
-		fade.reqFini.set();
-		SDL_WaitThread(fade.thread, 0);
-		fade.thread = 0;
-	}
-
-	fade.active.set();
+	fade.active = true;
 	fade.msStep = 1.0f / duration;
-	fade.reqFini.clear();
-	fade.reqTerm.clear();
 	fade.startTicks = SDL_GetTicks();
 
-	fade.thread = createSDLThread
-		<AudioStream, &AudioStream::fadeOutThread>(this, fade.threadName);
-
 	unlockStream();
 }
 
@@ -246,120 +266,274 @@ float AudioStream::getVolume(VolumeType type)
 	return volumes[type];
 }
 
+void AudioStream::service()
+{
+	serviceOpen();
+
+	lockStream();
+
+	stream.service();
+
+	if (crossfade.active)
+		tail->service();
+
+	updateFades();
+
+	unlockStream();
+}
+
 float AudioStream::playingOffset()
 {
 	return stream.queryOffset();
 }
 
-void AudioStream::updateVolume()
+float AudioStream::mixedVolume()
 {
 	float vol = GLOBAL_VOLUME;
 
 	for (size_t i = 0; i < VolumeTypeCount; ++i)
 		vol *= volumes[i];
 
-	stream.setVolume(vol);
+	return vol;
+}
+
+void AudioStream::updateVolume()
+{
+	stream.setVolume(mixedVolume());
+}
+
+/* Applies 'current' to a freshly opened (stopped) stream */
+void AudioStream::startPlayback(float offset)
+{
+	setVolume(Base, current.volume);
+	stream.setPitch(current.pitch);
+
+	if (offset > 0 || crossfade.active)
+	{
+		setVolume(FadeIn, 0);
+		startFadeIn(crossfade.active ? crossfadeMs : 1000);
+	}
+
+	if (!extPaused)
+		stream.play(offset);
+	else
+		noResumeStop = false;
+}
+
+/* Stream lock must be held. Should the file have been
+ * opened already, it is dropped when it's picked up */
+void AudioStream::cancelOpen()
+{
+	if (!asyncOpen)
+		return;
+
+	pendingOpen.requested = false;
+	++pendingOpen.serial;
+}
+
+void AudioStream::serviceOpen()
+{
+	if (!asyncOpen)
+		return;
+
+	lockStream();
+
+	if (!pendingOpen.requested)
+	{
+		unlockStream();
+		return;
+	}
+
+	const std::string filename = pendingOpen.filename;
+	const unsigned int serial = pendingOpen.serial;
+
+	const bool handOver = canCrossfade();
+	const std::string tailFile = crossfade.file;
+
+	unlockStream();
+
+	/* Path lookup, header parsing and (for short loops)
+	 * decoding into memory happen here, while the previous
+	 * file keeps streaming under the lock taken by
+	 * other threads in the meantime */
+	ALDataSource *source = stream.prepareSource(filename);
+	ALDataSource *tailSource = 0;
+
+	if (source && handOver)
+		tailSource = tail->prepareSource(tailFile);
+
+	lockStream();
+
+	if (serial != pendingOpen.serial)
+	{
+		/* Superseded while opening */
+		delete source;
+		delete tailSource;
+		unlockStream();
+
+		return;
+	}
+
+	pendingOpen.requested = false;
+
+	if (tailSource && canCrossfade())
+		startCrossfade(tailSource);
+	else
+		delete tailSource;
+
+	finiFades();
+
+	if (source)
+	{
+		stream.openPrepared(source);
+		crossfade.file = filename;
+		startPlayback(pendingOpen.offset);
+
+		/* Queue the first buffers right away */
+		stream.service();
+	}
+	else
+	{
+		stream.close();
+	}
+
+	unlockStream();
 }
 
-void AudioStream::finiFadeOutInt()
+void AudioStream::finiFades()
 {
-	if (fade.thread)
+	/* Cleanup like a fade reaching its end would */
+	if (fade.active)
 	{
-		fade.reqFini.set();
-		SDL_WaitThread(fade.thread, 0);
-		fade.thread = 0;
+		if (stream.queryState() != ALStream::Paused)
+			stream.stop();
+
+		setVolume(FadeOut, 1.0f);
+		fade.active = false;
 	}
 
-	if (fadeIn.thread)
+	if (fadeIn.active)
 	{
-		fadeIn.rqFini.set();
-		SDL_WaitThread(fadeIn.thread, 0);
-		fadeIn.thread = 0;
+		setVolume(FadeIn, 1.0f);
+		fadeIn.active = false;
 	}
 }
 
-void AudioStream::startFadeIn()
+void AudioStream::startFadeIn(uint32_t duration)
 {
-	/* Previous fadein should always be terminated in play() */
-	assert(!fadeIn.thread);
+	/* Previous fadein should always be finished in play() */
+	assert(!fadeIn.active);
 
-	fadeIn.rqFini.clear();
-	fadeIn.rqTerm.clear();
+	fadeIn.active = true;
+	fadeIn.duration = duration;
 	fadeIn.startTicks = SDL_GetTicks();
+}
 
-	fadeIn.thread = createSDLThread
-		<AudioStream, &AudioStream::fadeInThread>(this, fadeIn.threadName);
+/* Stream lock must be held */
+bool AudioStream::canCrossfade()
+{
+	/* Files already fading out are stopped, and those
+	 * paused for an ME are not to be heard anyway */
+	return tail && !fade.active && !extPaused
+	    && stream.queryState() == ALStream::Playing;
 }
 
-void AudioStream::fadeOutThread()
+/* Stream lock must be held, and canCrossfade() true. Continues
+ * the file playing in 'stream' on 'tail' and starts fading it
+ * out. 'prepared' is a source of that same file from
+ * prepareSource(); if null, it is opened here */
+void AudioStream::startCrossfade(ALDataSource *prepared)
 {
-	while (true)
+	finiCrossfade();
+
+	if (prepared)
 	{
-		/* Just immediately terminate on request */
-		if (fade.reqTerm)
-			break;
+		tail->openPrepared(prepared);
+	}
+	else
+	{
+		try
+		{
+			tail->open(crossfade.file);
+		}
+		catch (const Exception &)
+		{
+			/* Just switch over without fading then */
+			return;
+		}
+	}
+
+	crossfade.active = true;
+	crossfade.volume = mixedVolume();
+	crossfade.startTicks = SDL_GetTicks();
 
-		lockStream();
+	tail->setVolume(crossfade.volume);
+	tail->setPitch(stream.pitch);
+	tail->play(stream.queryOffset());
+	tail->service();
+}
+
+void AudioStream::finiCrossfade()
+{
+	if (!crossfade.active)
+		return;
+
+	tail->stop();
+	tail->close();
 
+	crossfade.active = false;
+}
+
+void AudioStream::updateFades()
+{
+	if (fade.active)
+	{
 		uint32_t curDur = SDL_GetTicks() - fade.startTicks;
 		float resVol = 1.0f - (curDur*fade.msStep);
 
 		ALStream::State state = stream.queryState();
 
-		if (state != ALStream::Playing
-		|| resVol < 0
-		|| fade.reqFini)
+		if (state != ALStream::Playing || resVol < 0)
 		{
 			if (state != ALStream::Paused)
 				stream.stop();
 
 			setVolume(FadeOut, 1.0f);
-			unlockStream();
-
-			break;
+			fade.active = false;
+		}
+		else
+		{
+			setVolume(FadeOut, resVol);
 		}
-
-		setVolume(FadeOut, resVol);
-
-		unlockStream();
-
-		SDL_Delay(AUDIO_SLEEP);
 	}
 
-	fade.active.clear();
-}
-
-void AudioStream::fadeInThread()
-{
-	while (true)
+	if (fadeIn.active)
 	{
-		if (fadeIn.rqTerm)
-			break;
-
-		lockStream();
-
-		/* Fade in duration is always 1 second */
 		uint32_t cur = SDL_GetTicks() - fadeIn.startTicks;
-		float prog = cur / 1000.0f;
+		float prog = cur / (float) fadeIn.duration;
 
 		ALStream::State state = stream.queryState();
 
-		if (state != ALStream::Playing
-		||  prog >= 1.0f
-		||  fadeIn.rqFini)
+		if (state != ALStream::Playing || prog >= 1.0f)
 		{
 			setVolume(FadeIn, 1.0f);
-			unlockStream();
-
-			break;
+			fadeIn.active = false;
 		}
+		else
+		{
+			/* Quadratic increase (not really the same as
+			 * in RMVXA, but close enough) */
+			setVolume(FadeIn, prog*prog);
+		}
+	}
+	if (crossfade.active)
+	{
+		uint32_t cur = SDL_GetTicks() - crossfade.startTicks;
+		float prog = cur / (float) crossfadeMs;
 
-		/* Quadratic increase (not really the same as
-		 * in RMVXA, but close enough) */
-		setVolume(FadeIn, prog*prog);
-
-		unlockStream();
-
-		SDL_Delay(AUDIO_SLEEP);
+		if (tail->queryState() != ALStream::Playing || prog >= 1.0f)
+			finiCrossfade();
+		else
+			tail->setVolume(crossfade.volume * (1.0f - prog));
 	}
 }
@@ -81,22 +81,14 @@ struct AudioStream
 	ALStream stream;
 	SDL_mutex *streamMut;
 
+	/* Fades are advanced by service(), and like
+	 * 'stream' guarded by the stream lock */
+
 	/* Fade out */
 	struct
 	{
 		/* Fade out is in progress */
-		AtomicFlag active;
-
-		/* Request fade thread to finish and
-		 * cleanup (like it normally would) */
-		AtomicFlag reqFini;
-
-		/* Request fade thread to terminate
-		 * immediately */
-		AtomicFlag reqTerm;
-
-		SDL_Thread *thread;
-		std::string threadName;
+		bool active;
 
 		/* Amount of reduced absolute volume
 		 * per ms of fade time */
@@ -109,17 +101,57 @@ struct AudioStream
 	/* Fade in */
 	struct
 	{
-		AtomicFlag rqFini;
-		AtomicFlag rqTerm;
+		bool active;
 
-		SDL_Thread *thread;
-		std::string threadName;
+		/* In ms */
+		uint32_t duration;
 
 		uint32_t startTicks;
 	} fadeIn;
 
+	/* With a positive 'crossfadeMs', switching from a playing
+	 * file to another one hands the former over to 'tail', which
+	 * continues it from the same position and fades it out while
+	 * the new one fades in on 'stream'. 'tail' is serviced and
+	 * guarded like 'stream', but only used for this */
+	uint32_t crossfadeMs;
+	ALStream *tail;
+
+	struct
+	{
+		bool active;
+
+		/* Volume 'tail' fades out from */
+		float volume;
+
+		uint32_t startTicks;
+
+		/* File open in 'stream', which 'current.filename'
+		 * can already be ahead of (see 'asyncOpen') */
+		std::string file;
+	} crossfade;
+
+	/* With 'asyncOpen', play() only records a different file
+	 * here, and 'current' is updated right away. service() then
+	 * opens it on the audio thread (without the stream lock
+	 * held), and switches over once it succeeded. The previous
+	 * file keeps playing meanwhile. 'requested' stays set until
+	 * then; 'serial' is bumped by every play(), stop() and
+	 * fadeOut() superseding a request */
+	bool asyncOpen;
+
+	struct
+	{
+		bool requested;
+		std::string filename;
+		float offset;
+		unsigned int serial;
+	} pendingOpen;
+
 	AudioStream(ALStream::LoopMode loopMode,
-	            const std::string &threadId);
+	            int bufCount, uint32_t bufSize,
+	            bool adaptive, bool asyncOpen = false,
+	            uint32_t crossfadeMs = 0);
 	~AudioStream();
 
 	void play(const std::string &filename,
@@ -140,15 +172,26 @@ struct AudioStream
 
 	float playingOffset();
 
+	/* Called periodically from the audio thread;
+	 * feeds the stream and advances fades */
+	void service();
+
 private:
 	float volumes[VolumeTypeCount];
+	float mixedVolume();
 	void updateVolume();
 
-	void finiFadeOutInt();
-	void startFadeIn();
+	void finiFades();
+	void startFadeIn(uint32_t duration);
+	void updateFades();
+
+	bool canCrossfade();
+	void startCrossfade(ALDataSource *prepared);
+	void finiCrossfade();
 
-	void fadeOutThread();
-	void fadeInThread();
+	void cancelOpen();
+	void serviceOpen();
+	void startPlayback(float offset);
 };
 
 #endif // AUDIOSTREAM_H
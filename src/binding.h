@@ -39,6 +39,16 @@ struct ScriptBinding
 	/* Instructs the binding to issue a game reset.
 	 * Same conditions as for terminate apply */
 	void (*reset) (void);
+
+	/* Called on the RGSS thread when the engine is about to
+	 * wait out the rest of a frame. The binding may spend
+	 * up to 'usecs' on housekeeping */
+	void (*idle) (int usecs);
+
+	/* Calls 'func' with other script threads allowed to run
+	 * meanwhile, if the binding has any. 'func' must not call
+	 * into the binding. May be null */
+	void (*unlocked) (void (*func)(void *), void *data);
 };
 
 /* VTable defined in the binding source */
@@ -28,6 +28,10 @@
 #include <SDL_surface.h>
 
 #include <pixman.h>
+#include <zlib.h>
+
+#include <vector>
+#include <algorithm>
 
 #include "gl-util.h"
 #include "gl-meta.h"
@@ -39,176 +43,1901 @@
 #include "sharedstate.h"
 #include "glstate.h"
 #include "texpool.h"
+#include "texuploader.h"
 #include "shader.h"
 #include "filesystem.h"
+#include "preloader.h"
+#include "workerpool.h"
+#include "debugwriter.h"
 #include "font.h"
+#include "glyphatlas.h"
+#include "textcache.h"
+#include "textmetrics.h"
+#include "bitmapcache.h"
+#include "atlascache.h"
+#include "spriteatlas.h"
+#include "fillqueue.h"
+#include "gldeletequeue.h"
+#include "uploadstaging.h"
+#include "config.h"
+#include "intrulist.h"
+#include "ktximage.h"
+#include "util.h"
 #include "eventthread.h"
+#include "scene.h"
+#include "profiler.h"
+#include "memstats.h"
+#include "textcompose.h"
 
 #define GUARD_MEGA \
 	{ \
-		if (p->megaSurface) \
+		if (p->isMega()) \
 			throw Exception(Exception::MKXPError, \
                             "Operation not supported for mega surfaces"); \
 	}
 
 #define OUTLINE_SIZE 1
 
+/* Granularity (in full rows) at which
+ * getPixel reads back the bitmap */
+#define READBACK_BAND 16
+
+/* Pending single pixel writes after which
+ * they're uploaded regardless */
+#define PENDING_PIXELS_MAX 65536
+
+/* Upper bound (in pixels) of the area staged text is
+ * collected in before it has to be uploaded */
+#define STAGED_TEXT_MAX 65536
+
+/* Decoded images of at least this many pixels are
+ * uploaded from the TexUploader thread if enabled */
+#define ASYNC_UPLOAD_MIN (256*256)
+
+/* Zoom below which bitmaps are drawn mipmapped
+ * (with the 'mipmaps' config) */
+#define MIPMAP_ZOOM 0.75f
+
 /* Normalize (= ensure width and
  * height are positive) */
 static IntRect normalizedRect(const IntRect &rect)
 {
 	IntRect norm = rect;
 
-	if (norm.w < 0)
+	if (norm.w < 0)
+	{
+		norm.w = -norm.w;
+		norm.x -= norm.w;
+	}
+
+	if (norm.h < 0)
+	{
+		norm.h = -norm.h;
+		norm.y -= norm.h;
+	}
+
+	return norm;
+}
+
+/* Decodes an image file already read into memory */
+struct ImageDecodeJob : WorkerJob
+{
+	std::string filename;
+	std::string data;
+	std::string ext;
+
+	/* Result, converted to ABGR8888 */
+	SDL_Surface *surf;
+	std::string error;
+
+	/* Hue change requested while the image was still
+	 * being decoded, applied to 'surf' before the upload */
+	int hue;
+
+	ImageDecodeJob(const char *filename, FileSystem::ReadAllHandler &file)
+	    : filename(filename),
+	      ext(file.ext),
+	      surf(0),
+	      hue(0)
+	{
+		data.swap(file.data);
+	}
+
+	void run()
+	{
+		SDL_RWops *ops = SDL_RWFromConstMem(data.c_str(), data.size());
+		surf = IMG_LoadTyped_RW(ops, 1, ext.c_str());
+
+		if (surf && surf->format->format != SDL_PIXELFORMAT_ABGR8888)
+		{
+			SDL_Surface *conv = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ABGR8888, 0);
+			SDL_FreeSurface(surf);
+			surf = conv;
+		}
+
+		if (!surf)
+			error = SDL_GetError();
+
+		std::string().swap(data);
+	}
+};
+
+/* Rotates the hue of every pixel of 'surf' (in ABGR8888) by
+ * 'hue' degrees, the same way as the hue shader does. Works on
+ * the integer channel values: the largest and smallest channel
+ * stay, only the position between them moves */
+static void hueChangeSurface(SDL_Surface *surf, int hue)
+{
+	for (int y = 0; y < surf->h; ++y)
+	{
+		uint8_t *px = (uint8_t*) surf->pixels + y * surf->pitch;
+
+		for (int x = 0; x < surf->w; ++x, px += 4)
+		{
+			const int r = px[0], g = px[1], b = px[2];
+			const int max = std::max(r, std::max(g, b));
+			const int min = std::min(r, std::min(g, b));
+			const int c = max - min;
+
+			/* Grays have no hue */
+			if (c == 0)
+				continue;
+
+			/* Position on the hue circle, 360 * c being a full turn */
+			int h;
+
+			if (max == r)
+				h = (g - b) * 60;
+			else if (max == g)
+				h = (b - r + 2 * c) * 60;
+			else
+				h = (r - g + 4 * c) * 60;
+
+			h = (h + hue * c + 360 * c) % (360 * c);
+
+			const int sector = h / (60 * c);
+			const int f = (h - sector * 60 * c + 30) / 60;
+
+			const int rise = min + f;
+			const int fall = max - f;
+
+			static const int idx[6][3] =
+			{
+				{ 0, 1, 2 }, { 3, 0, 2 }, { 2, 0, 1 },
+				{ 2, 3, 0 }, { 1, 2, 0 }, { 0, 2, 3 }
+			};
+
+			const int val[4] = { max, rise, min, fall };
+			const int *sel = idx[sector];
+
+			px[0] = val[sel[0]];
+			px[1] = val[sel[1]];
+			px[2] = val[sel[2]];
+		}
+	}
+}
+
+struct BitmapOpenHandler : FileSystem::OpenHandler
+{
+	SDL_Surface *surf;
+
+	BitmapOpenHandler()
+	    : surf(0)
+	{}
+
+	bool tryRead(SDL_RWops &ops, const char *ext)
+	{
+		surf = IMG_LoadTyped_RW(&ops, 1, ext);
+		return surf != 0;
+	}
+};
+
+/* Looks for a precompressed version of an image
+ * (eg. 'Graphics/Pictures/Title.ktx' for 'Title.png') */
+struct KTXOpenHandler : FileSystem::OpenHandler
+{
+	KTXImage image;
+	bool found;
+
+	KTXOpenHandler()
+	    : found(false)
+	{}
+
+	bool tryRead(SDL_RWops &ops, const char *ext)
+	{
+		if (!ext || SDL_strcasecmp(ext, "ktx") != 0)
+		{
+			SDL_RWclose(&ops);
+			return false;
+		}
+
+		FileSystem::ReadAllHandler file;
+		file.tryRead(ops, ext);
+		found = image.parse(file.data);
+
+		return found;
+	}
+};
+
+/* Returns true if a precompressed image usable on this
+ * GL exists for 'filename' and compressed textures are on */
+static bool findCompressedImage(const char *filename, KTXImage &image)
+{
+	if (!shState->config().compressedTextures)
+		return false;
+
+	KTXOpenHandler handler;
+
+	try
+	{
+		shState->fileSystem().openRead(handler, filename);
+	}
+	catch (const Exception &)
+	{
+		return false;
+	}
+
+	if (!handler.found)
+		return false;
+
+	if (!glState.caps.supportsCompressed(handler.image.format))
+		return false;
+
+	const int maxSize = glState.caps.maxTexSize;
+
+	if (handler.image.width > maxSize || handler.image.height > maxSize)
+		return false;
+
+	image.format = handler.image.format;
+	image.width = handler.image.width;
+	image.height = handler.image.height;
+	image.data.swap(handler.image.data);
+
+	return true;
+}
+
+/* Loads may complete in the middle of rendering a frame,
+ * so the framebuffer binding is restored afterwards */
+struct FBOBindingGuard
+{
+	GLint fbo;
+
+	FBOBindingGuard()
+	{
+		gl.GetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+	}
+
+	~FBOBindingGuard()
+	{
+		FBO::bind(FBO::ID(fbo));
+	}
+};
+
+struct BitmapPrivate;
+
+/* Bitmaps with a reloadable texture, most recently
+ * used first (see Bitmap::enforceTextureBudget()) */
+static IntruList<BitmapPrivate> residentBitmaps;
+
+/* Advanced once per frame */
+static unsigned int residencyFrame = 0;
+
+/* Bitmaps to read back into their pixel pack buffer
+ * at the next frame (see Bitmap::flushReadbacks()) */
+static IntruList<BitmapPrivate> readbackBitmaps;
+
+/* All bitmaps (see Bitmap::snapshotTextures()) */
+static IntruList<BitmapPrivate> liveBitmaps;
+
+struct BitmapPrivate
+{
+	Bitmap *self;
+
+	TEXFBO gl;
+
+	Font *font;
+
+	/* "Mega surfaces" are a hack to allow Tilesets to be used
+	 * whose Bitmaps don't fit into a regular texture. They're
+	 * split into a row major grid of textures at most
+	 * 'maxTexSize' large, and will throw an error if they're
+	 * used in any context other than as blit sources */
+	std::vector<TEXFBO> megaTiles;
+	Vec2i megaSize;
+	int megaTileSize;
+
+	/* A cached version of the bitmap in client memory, for
+	 * getPixel calls. It's read back in bands of READBACK_BAND
+	 * rows as they're accessed ('validBands'). Operations the
+	 * CPU can reproduce (fills, clears, setPixel) are applied
+	 * to the valid bands directly; all others only invalidate
+	 * the bands they touched */
+	SDL_Surface *surface;
+	SDL_PixelFormat *format;
+	std::vector<bool> validBands;
+
+	/* Bands read back since the last modification. Once the
+	 * bitmap is modified, the same bands are asynchronously
+	 * read into 'pbo' at the next frame, so that scripts
+	 * polling the same pixels every frame don't stall on
+	 * the GPU. 'pboFirst' is -1 unless 'pbo' holds the
+	 * current contents of bands 'pboFirst' to 'pboLast' */
+	int readFirst, readLast;
+	int prefetchFirst, prefetchLast;
+	IntruListLink<BitmapPrivate> readbackLink;
+	PBO::ID pbo;
+	size_t pboSize;
+	int pboFirst, pboLast;
+
+	/* The 'tainted' area describes which parts of the
+	 * bitmap are not cleared, ie. don't have 0 opacity.
+	 * If we're blitting / drawing text to a cleared part
+	 * with full opacity, we can disregard any old contents
+	 * in the texture and blit to it directly, saving
+	 * ourselves the expensive blending calculation */
+	pixman_region16_t tainted;
+
+	/* The 'opaque' area is the part of 'tainted' known to
+	 * have full opacity. Blending onto it leaves the alpha
+	 * at 1, so translucent blits there can be done with
+	 * fixed function blending instead of the blt shader */
+	pixman_region16_t opaque;
+
+	/* Set while the image this bitmap was loaded from is
+	 * still being decoded on the worker pool. It's uploaded
+	 * at the next frame, or as soon as the bitmap is used */
+	ImageDecodeJob *loadJob;
+	sigc::connection prepareCon;
+
+	/* Set while the decoded image is being uploaded by the
+	 * TexUploader. It's shared and made resident (as
+	 * 'uploadFile') once the upload has been issued */
+	TexUpload *upload;
+	std::string uploadFile;
+
+	/* Key of the BitmapCache entry 'gl' is shared through,
+	 * if any. Empty once this bitmap owns its texture */
+	std::string cacheKey;
+
+	/* See Bitmap::contentStamp() */
+	unsigned int stamp;
+
+	/* setPixel writes not uploaded yet; they're coalesced into
+	 * row runs the next time the texture is used, like the
+	 * pending fills. Only one of both is pending at a time */
+	struct PendingPixel
+	{
+		int x, y;
+		uint8_t rgba[4];
+
+		bool operator<(const PendingPixel &o) const
+		{
+			return y != o.y ? y < o.y : x < o.x;
+		}
+	};
+
+	std::vector<PendingPixel> pendingPixels;
+
+	/* Software rendered text not uploaded yet. 'staging' holds
+	 * the pixels of all of 'stagedRect': the strings drawn into
+	 * it, and transparent black where the bitmap is known to be
+	 * cleared. It goes out in one upload at the next frame, or
+	 * as soon as the texture is used, so that message windows
+	 * drawing a character at a time cost one upload per frame.
+	 * setPixel writes inside 'stagedRect' are applied to it */
+	std::vector<uint8_t> staging;
+	IntRect stagedRect;
+	sigc::connection stagedCon;
+
+	/* Image file the contents were loaded from, as long as
+	 * they haven't been modified since. Over the texture
+	 * budget, such bitmaps give up their texture and load
+	 * it again on their next use ('evicted') */
+	std::string filename;
+	IntruListLink<BitmapPrivate> residentLink;
+	unsigned int lastUse;
+	bool evicted;
+
+	/* Like a non-empty 'filename', but independent
+	 * of the texture budget (see isUnmodifiedFile()) */
+	bool fileContents;
+
+	/* Set once the mipmap levels of 'gl.tex' have been
+	 * generated from the file contents (see useMipmaps()) */
+	bool mipmapped;
+
+	/* Compressed copy of the contents of an evicted bitmap
+	 * that can't be loaded from a file, taken before the app
+	 * was suspended. The texture is restored from it instead */
+	std::string snapshot;
+	IntruListLink<BitmapPrivate> liveLink;
+
+	/* Set while 'gl.tex' holds a precompressed or reduced
+	 * precision image (without an FBO). Such textures can only
+	 * be sampled from, so they are replaced by the decoded image
+	 * file as soon as the bitmap is rendered to, read back or
+	 * blitted from */
+	bool compressed;
+
+	BitmapPrivate(Bitmap *self)
+	    : self(self),
+	      megaTileSize(0),
+	      surface(0),
+	      readFirst(-1),
+	      readLast(-1),
+	      prefetchFirst(-1),
+	      prefetchLast(-1),
+	      readbackLink(this),
+	      pboSize(0),
+	      pboFirst(-1),
+	      pboLast(-1),
+	      loadJob(0),
+	      upload(0),
+	      stamp(shState->genTimeStamp()),
+	      residentLink(this),
+	      lastUse(0),
+	      evicted(false),
+	      fileContents(false),
+	      mipmapped(false),
+	      liveLink(this),
+	      compressed(false)
+	{
+		liveBitmaps.append(liveLink);
+
+		format = SDL_AllocFormat(SDL_PIXELFORMAT_ABGR8888);
+
+		font = &shState->defaultFont();
+		pixman_region_init(&tainted);
+		pixman_region_init(&opaque);
+	}
+
+	~BitmapPrivate()
+	{
+		stagedCon.disconnect();
+		readbackBitmaps.remove(readbackLink);
+		liveBitmaps.remove(liveLink);
+
+		if (pbo != PBO::ID(0))
+			PBO::del(pbo);
+
+		if (surface)
+		{
+			MemStats::add(MemStats::BitmapSurfaces, -(surface->pitch * surface->h));
+			SDL_FreeSurface(surface);
+		}
+
+		SDL_FreeFormat(format);
+		pixman_region_fini(&tainted);
+		pixman_region_fini(&opaque);
+	}
+
+	bool isMega() const
+	{
+		return !megaTiles.empty();
+	}
+
+	void initMegaTiles(SDL_Surface *imgSurf)
+	{
+		TexPool &pool = shState->texPool();
+		const int tileSize = glState.caps.maxTexSize;
+
+		megaSize = Vec2i(imgSurf->w, imgSurf->h);
+		megaTileSize = tileSize;
+
+		for (int y = 0; y < imgSurf->h; y += tileSize)
+			for (int x = 0; x < imgSurf->w; x += tileSize)
+			{
+				const int w = std::min(tileSize, imgSurf->w - x);
+				const int h = std::min(tileSize, imgSurf->h - y);
+
+				TEXFBO tile;
+
+				try
+				{
+					tile = pool.request(w, h);
+				}
+				catch (const Exception &e)
+				{
+					GLMeta::subRectImageEnd();
+					releaseMegaTiles();
+					throw e;
+				}
+
+				TEX::bind(tile.tex);
+				GLMeta::subRectImageUpload(imgSurf->w, x, y, 0, 0,
+				                           w, h, imgSurf, GL_RGBA);
+
+				megaTiles.push_back(tile);
+				MemStats::add(MemStats::MegaTiles, tile.texW * tile.texH * 4);
+			}
+
+		GLMeta::subRectImageEnd();
+	}
+
+	/* Runs every tile through the hue shader. Tiles can be as
+	 * large as the maximum texture size, so instead of growing
+	 * the shared scratch target to match, they're swapped for
+	 * pooled textures */
+	void hueChangeMega(float hueAdjust)
+	{
+		TexPool &pool = shState->texPool();
+
+		HueShader &shader = shState->shaders().hue();
+		shader.bind();
+		shader.setHueAdjust(hueAdjust);
+
+		Quad &quad = shState->gpQuad();
+		quad.setColor(Vec4(1, 1, 1, 1));
+
+		for (size_t i = 0; i < megaTiles.size(); ++i)
+		{
+			TEXFBO &tile = megaTiles[i];
+			TEXFBO newTile = pool.request(tile.width, tile.height);
+
+			FloatRect texRect(0, 0, tile.width, tile.height);
+			quad.setTexPosRect(texRect, texRect);
+
+			FBO::bind(newTile.fbo);
+			glState.viewport.pushSet(IntRect(0, 0, tile.width, tile.height));
+			shader.applyViewportProj();
+
+			TEX::bind(tile.tex);
+			shader.setTexSize(Vec2i(tile.texW, tile.texH));
+
+			blitQuad(quad, shader);
+
+			glState.viewport.pop();
+
+			pool.release(tile);
+			tile = newTile;
+		}
+
+		TEX::unbind();
+	}
+
+	void releaseMegaTiles()
+	{
+		for (size_t i = 0; i < megaTiles.size(); ++i)
+		{
+			MemStats::add(MemStats::MegaTiles, -(megaTiles[i].texW * megaTiles[i].texH * 4));
+			shState->texPool().release(megaTiles[i]);
+		}
+
+		megaTiles.clear();
+	}
+
+	/* Blits 'srcRect' of a mega surface to 'dstRect' of the
+	 * current blit target (scaled if the sizes differ), one
+	 * tile at a time. Has to be called between
+	 * GLMeta::blitBegin() and GLMeta::blitEnd() */
+	void blitMega(const IntRect &srcRect, const IntRect &dstRect)
+	{
+		if (srcRect.w <= 0 || srcRect.h <= 0)
+			return;
+
+		const int cols = (megaSize.x + megaTileSize - 1) / megaTileSize;
+
+		const int col0 = std::max(srcRect.x, 0) / megaTileSize;
+		const int row0 = std::max(srcRect.y, 0) / megaTileSize;
+		const int col1 = std::min(srcRect.x + srcRect.w, megaSize.x) - 1;
+		const int row1 = std::min(srcRect.y + srcRect.h, megaSize.y) - 1;
+
+		for (int row = row0; row <= row1 / megaTileSize; ++row)
+			for (int col = col0; col <= col1 / megaTileSize; ++col)
+			{
+				const int tileX = col * megaTileSize;
+				const int tileY = row * megaTileSize;
+
+				/* Part of 'srcRect' covered by this tile */
+				const int x0 = std::max(srcRect.x, tileX);
+				const int y0 = std::max(srcRect.y, tileY);
+				const int x1 = std::min(srcRect.x + srcRect.w, tileX + megaTileSize);
+				const int y1 = std::min(srcRect.y + srcRect.h, tileY + megaTileSize);
+
+				if (x0 >= x1 || y0 >= y1)
+					continue;
+
+				/* Map the piece edges into 'dstRect'; neighbouring
+				 * pieces share their edges, so there are no seams */
+				const int dx0 = dstRect.x + (x0 - srcRect.x) * dstRect.w / srcRect.w;
+				const int dy0 = dstRect.y + (y0 - srcRect.y) * dstRect.h / srcRect.h;
+				const int dx1 = dstRect.x + (x1 - srcRect.x) * dstRect.w / srcRect.w;
+				const int dy1 = dstRect.y + (y1 - srcRect.y) * dstRect.h / srcRect.h;
+
+				GLMeta::blitSource(megaTiles[row*cols+col]);
+				GLMeta::blitRectangle(IntRect(x0 - tileX, y0 - tileY, x1 - x0, y1 - y0),
+				                      IntRect(dx0, dy0, dx1 - dx0, dy1 - dy0));
+			}
+	}
+
+	/* Takes ownership of 'imgSurf' (in ABGR8888) */
+	void initFromSurface(SDL_Surface *imgSurf)
+	{
+		const IntRect imgRect(0, 0, imgSurf->w, imgSurf->h);
+
+		if (imgSurf->w > glState.caps.maxTexSize || imgSurf->h > glState.caps.maxTexSize)
+		{
+			/* Mega surface */
+			try
+			{
+				initMegaTiles(imgSurf);
+			}
+			catch (const Exception &e)
+			{
+				SDL_FreeSurface(imgSurf);
+				throw e;
+			}
+
+			SDL_FreeSurface(imgSurf);
+		}
+		else
+		{
+			/* Regular surface */
+			try
+			{
+				gl = shState->texPool().request(imgSurf->w, imgSurf->h);
+			}
+			catch (const Exception &e)
+			{
+				SDL_FreeSurface(imgSurf);
+				throw e;
+			}
+
+			TEX::bind(gl.tex);
+			TEX::uploadSubImage(0, 0, gl.width, gl.height, imgSurf->pixels, GL_RGBA);
+
+			SDL_FreeSurface(imgSurf);
+		}
+
+		addTaintedArea(imgRect);
+	}
+
+	/* Returns false if the GL rejects the image */
+	bool initFromCompressed(const KTXImage &image, const std::string &filename)
+	{
+		TEX::ID tex = TEX::gen();
+		TEX::bind(tex);
+		TEX::setRepeat(false);
+		TEX::setSmooth(false);
+
+		while (::gl.GetError() != GL_NO_ERROR) {}
+
+		TEX::uploadCompressed(image.width, image.height, image.format,
+		                      image.data.size(), image.data.c_str());
+
+		if (::gl.GetError() != GL_NO_ERROR)
+		{
+			TEX::del(tex);
+			return false;
+		}
+
+		gl.tex = tex;
+		gl.fbo = FBO::ID(0);
+		gl.width = gl.texW = image.width;
+		gl.height = gl.texH = image.height;
+
+		compressed = true;
+		this->filename = filename;
+
+		addTaintedArea(IntRect(0, 0, image.width, image.height));
+
+		return true;
+	}
+
+	/* With 'reducedTextures', uploads fully opaque images as
+	 * RGB565 and those with only 1 bit alpha as RGBA5551, in the
+	 * same sample-only state as precompressed ones. Takes
+	 * ownership of 'imgSurf' (in ABGR8888) if it returns true */
+	bool initReduced(SDL_Surface *imgSurf, const std::string &filename)
+	{
+		if (!shState->config().reducedTextures)
+			return false;
+
+		if (imgSurf->w > glState.caps.maxTexSize || imgSurf->h > glState.caps.maxTexSize)
+			return false;
+
+		const int w = imgSurf->w, h = imgSurf->h;
+		bool opaque = true;
+
+		for (int y = 0; y < h; ++y)
+		{
+			const uint8_t *row = (const uint8_t*) imgSurf->pixels + y*imgSurf->pitch;
+
+			for (int x = 0; x < w; ++x)
+			{
+				const uint8_t a = row[x*4+3];
+
+				if (a == 0)
+					opaque = false;
+				else if (a != 255)
+					return false;
+			}
+		}
+
+		std::vector<uint16_t> packed(w * h);
+
+		for (int y = 0; y < h; ++y)
+		{
+			const uint8_t *row = (const uint8_t*) imgSurf->pixels + y*imgSurf->pitch;
+			uint16_t *out = &packed[y*w];
+
+			for (int x = 0; x < w; ++x)
+			{
+				const uint8_t *px = &row[x*4];
+
+				if (opaque)
+					out[x] = ((px[0] >> 3) << 11) | ((px[1] >> 2) << 5) | (px[2] >> 3);
+				else
+					out[x] = ((px[0] >> 3) << 11) | ((px[1] >> 3) << 6)
+					       | ((px[2] >> 3) << 1) | (px[3] >> 7);
+			}
+		}
+
+		TEX::ID tex = TEX::gen();
+		TEX::bind(tex);
+		TEX::setRepeat(false);
+		TEX::setSmooth(false);
+
+		if (opaque)
+			TEX::uploadPacked(w, h, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, &packed[0]);
+		else
+			TEX::uploadPacked(w, h, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, &packed[0]);
+
+		SDL_FreeSurface(imgSurf);
+
+		gl.tex = tex;
+		gl.fbo = FBO::ID(0);
+		gl.width = gl.texW = w;
+		gl.height = gl.texH = h;
+
+		compressed = true;
+		this->filename = filename;
+
+		addTaintedArea(IntRect(0, 0, w, h));
+
+		/* Known from the analysis already */
+		if (opaque)
+			addOpaqueArea(IntRect(0, 0, w, h));
+
+		return true;
+	}
+
+	bool loadCompressed()
+	{
+		KTXImage image;
+
+		if (!findCompressedImage(filename.c_str(), image))
+			return false;
+
+		return initFromCompressed(image, filename);
+	}
+
+	/* Loads the image file in its regular form */
+	void loadImage()
+	{
+		BitmapCache &cache = shState->bitmapCache();
+		const std::string key = normalizedPath(filename.c_str());
+		unsigned int cachedStamp;
+
+		if (cache.enabled() && cache.acquire(key, gl, cachedStamp))
+		{
+			cacheKey = key;
+			stamp = cachedStamp;
+
+			return;
+		}
+
+		BitmapOpenHandler handler;
+		shState->fileSystem().openRead(handler, filename.c_str());
+		SDL_Surface *imgSurf = handler.surf;
+
+		if (!imgSurf)
+			throw Exception(Exception::SDLError, "Error loading image '%s': %s",
+			                filename.c_str(), SDL_GetError());
+
+		ensureFormat(imgSurf, SDL_PIXELFORMAT_ABGR8888);
+		initFromSurface(imgSurf);
+		shareTexture(filename.c_str());
+	}
+
+	/* Has to be called before 'gl' is used as anything
+	 * but a texture to sample from. Only allocates a blank
+	 * texture unless 'keepContents' is set */
+	void decompress(bool keepContents = true)
+	{
+		if (!compressed)
+			return;
+
+		FBOBindingGuard guard;
+		releaseTexture();
+
+		if (keepContents)
+			loadImage();
+		else
+			gl = shState->texPool().request(gl.width, gl.height);
+	}
+
+	/* Offers the just loaded texture to the bitmap cache */
+	void shareTexture(const char *filename)
+	{
+		shareTextureAs(normalizedPath(filename));
+	}
+
+	void shareTextureAs(const std::string &key)
+	{
+		if (isMega())
+			return;
+
+		BitmapCache &cache = shState->bitmapCache();
+
+		if (!cache.enabled())
+			return;
+
+		if (cache.insert(key, gl, stamp))
+			cacheKey = key;
+	}
+
+	/* Takes over a reference to a texture from the bitmap cache */
+	void adoptCached(const TEXFBO &cached, const std::string &key,
+	                 unsigned int cachedStamp)
+	{
+		gl = cached;
+		stamp = cachedStamp;
+		cacheKey = key;
+		addTaintedArea(IntRect(0, 0, cached.width, cached.height));
+	}
+
+	/* Keys of textures holding an image file's contents as is;
+	 * made up keys (copies, snapshots, variants) start with \1 */
+	static bool isFileKey(const std::string &key)
+	{
+		return !key.empty() && key[0] != '\1';
+	}
+
+	/* Takes over the cached texture 'key' in place of the current
+	 * contents, if there is one. For derived contents that are
+	 * cached under a made up key */
+	bool adoptVariant(const std::string &key)
+	{
+		BitmapCache &cache = shState->bitmapCache();
+		TEXFBO cached;
+		unsigned int cachedStamp;
+
+		if (!cache.enabled() || !cache.acquire(key, cached, cachedStamp))
+			return false;
+
+		discardFills();
+		releaseTexture();
+		onModified();
+
+		gl = cached;
+		stamp = cachedStamp;
+		cacheKey = key;
+
+		return true;
+	}
+
+	/* Lets 'copy' share 'gl' until either of both is modified
+	 * (detached). A private texture is registered with the
+	 * bitmap cache under a made up key for that. Returns false
+	 * if the contents have to be blitted over instead */
+	bool shareWith(BitmapPrivate &copy)
+	{
+		if (compressed || isMega() || loadJob || upload)
+			return false;
+
+		flushFills();
+
+		BitmapCache &cache = shState->bitmapCache();
+
+		if (cacheKey.empty())
+		{
+			static unsigned int copyCount = 0;
+
+			char key[32];
+			snprintf(key, sizeof(key), "\1copy/%u", ++copyCount);
+
+			cache.insert(key, gl, stamp, true);
+			cacheKey = key;
+		}
+
+		cache.addRef(cacheKey);
+
+		copy.gl = gl;
+		copy.stamp = stamp;
+		copy.cacheKey = cacheKey;
+
+		pixman_region_copy(&copy.tainted, &tainted);
+		pixman_region_copy(&copy.opaque, &opaque);
+
+		return true;
+	}
+
+	/* Has to be called before modifying 'gl'. If its texture
+	 * is shared, it's replaced by a private copy, which only
+	 * gets the old contents if 'keepContents' is set */
+	void detach(bool keepContents = true)
+	{
+		if (keepContents)
+			flushFills();
+		else
+			discardFills();
+
+		detachTexture(keepContents);
+	}
+
+	/* For operations only drawing into 'area': fills queued
+	 * elsewhere stay pending, so that they can still go out
+	 * in one batch with the ones that follow */
+	void detachArea(const IntRect &area)
+	{
+		flushFillsIn(area);
+		detachTexture(true);
+	}
+
+	/* Like detach(), but leaving the pending fills alone; the
+	 * caller has to flushFillsIn() the area it is drawing into.
+	 * A bitmap with pending fills is already private, so this
+	 * only ever copies textures that have none */
+	void detachTexture(bool keepContents = true)
+	{
+		decompress(keepContents);
+
+		if (cacheKey.empty())
+			return;
+
+		std::string key;
+		key.swap(cacheKey);
+
+		if (shState->bitmapCache().detach(key))
+			return;
+
+		TEXFBO shared = gl;
+		gl = shState->texPool().request(shared.width, shared.height);
+
+		if (!keepContents)
+			return;
+
+		GLMeta::blitBegin(gl);
+		GLMeta::blitSource(shared);
+		GLMeta::blitRectangle(IntRect(0, 0, gl.width, gl.height), Vec2i());
+		GLMeta::blitEnd();
+	}
+
+	/* Gives up 'gl', be it shared or not */
+	void releaseTexture()
+	{
+		mipmapped = false;
+
+		if (compressed)
+		{
+			GLDeleteQueue::texture(gl.tex);
+			compressed = false;
+
+			return;
+		}
+
+		if (cacheKey.empty())
+		{
+			shState->texPool().release(gl);
+			return;
+		}
+
+		shState->bitmapCache().release(cacheKey);
+		cacheKey.clear();
+	}
+
+	/* Registers just loaded contents as reloadable */
+	void makeResident(const std::string &filename)
+	{
+		fileContents = true;
+
+		if (isMega() || shState->config().textureBudget == 0)
+			return;
+
+		this->filename = filename;
+		lastUse = residencyFrame;
+		residentBitmaps.prepend(residentLink);
+	}
+
+	void markUsed()
+	{
+		if (!residentLink.next)
+			return;
+
+		lastUse = residencyFrame;
+		residentBitmaps.remove(residentLink);
+		residentBitmaps.prepend(residentLink);
+	}
+
+	/* Gives up the texture until the next use */
+	void evict()
+	{
+		residentBitmaps.remove(residentLink);
+		releaseTexture();
+
+		gl.tex = TEX::ID(0);
+		gl.fbo = FBO::ID(0);
+		evicted = true;
+	}
+
+	void reload()
+	{
+		if (!snapshot.empty())
+		{
+			restoreSnapshot();
+			evicted = false;
+
+			return;
+		}
+
+		if (!loadCompressed())
+			loadImage();
+
+		evicted = false;
+		residentBitmaps.prepend(residentLink);
+	}
+
+	/* Evicts the texture, keeping its contents in 'snapshot'
+	 * unless they can be loaded from the file again */
+	void takeSnapshot()
+	{
+		if (residentLink.next)
+		{
+			evict();
+			return;
+		}
+
+		/* Precompressed textures are file backed
+		 * (and have no FBO to read them back from) */
+		if (evicted || isMega() || compressed || loadJob)
+			return;
+
+		flushFills();
+
+		const int w = gl.width, h = gl.height;
+		const uLong size = w * h * 4;
+		std::vector<Bytef> pixels(size);
+
+		FBO::bind(gl.fbo);
+		::gl.ReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+		uLongf snapSize = compressBound(size);
+		snapshot.resize(snapSize);
+
+		if (compress2(reinterpret_cast<Bytef*>(&snapshot[0]), &snapSize,
+		              &pixels[0], size, Z_BEST_SPEED) != Z_OK)
+		{
+			std::string().swap(snapshot);
+			return;
+		}
+
+		snapshot.resize(snapSize);
+
+		/* Pending reads would refer to the old texture */
+		readbackBitmaps.remove(readbackLink);
+		prefetchFirst = prefetchLast = -1;
+		pboFirst = pboLast = -1;
+
+		if (pbo != PBO::ID(0))
+		{
+			PBO::del(pbo);
+			pbo = PBO::ID(0);
+			pboSize = 0;
+		}
+
+		releaseTexture();
+
+		gl.tex = TEX::ID(0);
+		gl.fbo = FBO::ID(0);
+		gl.width = w;
+		gl.height = h;
+		evicted = true;
+	}
+
+	void restoreSnapshot()
+	{
+		const int w = gl.width, h = gl.height;
+		uLongf size = w * h * 4;
+		std::vector<Bytef> pixels(size);
+
+		int result = uncompress(&pixels[0], &size,
+		                        reinterpret_cast<const Bytef*>(snapshot.data()),
+		                        snapshot.size());
+		std::string().swap(snapshot);
+
+		gl = shState->texPool().request(w, h);
+
+		TEX::bind(gl.tex);
+		TEX::uploadSubImage(0, 0, w, h, &pixels[0], GL_RGBA);
+
+		if (result != Z_OK)
+			throw Exception(Exception::MKXPError,
+			                "Error restoring bitmap contents (zlib %d)", result);
+	}
+
+	void startLoad(ImageDecodeJob *job)
+	{
+		loadJob = job;
+		shState->workerPool().submit(*job);
+
+		prepareCon = shState->prepareDraw.connect
+		        (sigc::mem_fun(this, &BitmapPrivate::onPrepareDraw));
+	}
+
+	/* Waits for a pending decode and uploads its result.
+	 * Also brings back the texture of an evicted bitmap.
+	 * With 'async', large images may be left uploading on
+	 * the TexUploader thread */
+	void finishLoad(bool async = false)
+	{
+		markUsed();
+
+		if (evicted)
+		{
+			FBOBindingGuard guard;
+			reload();
+		}
+
+		if (upload)
+			finishUpload();
+
+		if (!loadJob)
+			return;
+
+		FBOBindingGuard guard;
+
+		ImageDecodeJob *job = loadJob;
+		loadJob = 0;
+		prepareCon.disconnect();
+
+		shState->workerPool().wait(*job);
+
+		SDL_Surface *imgSurf = job->surf;
+		const std::string filename = job->filename;
+		std::string error = job->error;
+		const int hue = job->hue;
+		delete job;
+
+		if (!imgSurf)
+		{
+			/* Leave a valid (empty) bitmap behind */
+			imgSurf = SDL_CreateRGBSurface(0, 1, 1, format->BitsPerPixel,
+			                               format->Rmask, format->Gmask,
+			                               format->Bmask, format->Amask);
+			initFromSurface(imgSurf);
+			clearTaintedArea();
+
+			throw Exception(Exception::SDLError, "Error loading image '%s': %s",
+			                filename.c_str(), error.c_str());
+		}
+
+		/* Changed contents can neither be shared
+		 * nor reloaded from the file */
+		if (hue != 0)
+		{
+			hueChangeSurface(imgSurf, hue);
+			initFromSurface(imgSurf);
+
+			return;
+		}
+
+		if (initReduced(imgSurf, filename))
+		{
+			makeResident(filename);
+			return;
+		}
+
+		if (async && startUpload(imgSurf, filename))
+			return;
+
+		initFromSurface(imgSurf);
+		shareTexture(filename.c_str());
+		makeResident(filename);
+	}
+
+	/* Hands 'imgSurf' to the TexUploader if worth it. Until
+	 * the upload is finished, the bitmap is neither shared
+	 * nor resident, so no one else can sample the texture */
+	bool startUpload(SDL_Surface *imgSurf, const std::string &filename)
+	{
+		TexUploader &uploader = shState->texUploader();
+
+		if (!uploader.enabled() || imgSurf->w * imgSurf->h < ASYNC_UPLOAD_MIN)
+			return false;
+
+		if (imgSurf->w > glState.caps.maxTexSize || imgSurf->h > glState.caps.maxTexSize)
+			return false;
+
+		try
+		{
+			gl = shState->texPool().request(imgSurf->w, imgSurf->h);
+		}
+		catch (const Exception &e)
+		{
+			SDL_FreeSurface(imgSurf);
+			throw e;
+		}
+
+		addTaintedArea(IntRect(0, 0, imgSurf->w, imgSurf->h));
+
+		upload = uploader.upload(gl.tex, imgSurf);
+		uploadFile = filename;
+
+		prepareCon = shState->prepareDraw.connect
+		        (sigc::mem_fun(this, &BitmapPrivate::onPrepareDraw));
+
+		return true;
+	}
+
+	void finishUpload()
+	{
+		shState->texUploader().finish(upload);
+		upload = 0;
+		prepareCon.disconnect();
+
+		shareTexture(uploadFile.c_str());
+		makeResident(uploadFile);
+		uploadFile.clear();
+	}
+
+	/* Before the texture can be released */
+	void cancelUpload()
+	{
+		shState->texUploader().finish(upload);
+		upload = 0;
+		prepareCon.disconnect();
+	}
+
+	void cancelLoad()
+	{
+		prepareCon.disconnect();
+		shState->workerPool().wait(*loadJob);
+
+		if (loadJob->surf)
+			SDL_FreeSurface(loadJob->surf);
+
+		delete loadJob;
+		loadJob = 0;
+	}
+
+	void onPrepareDraw()
+	{
+		if (upload)
+		{
+			if (shState->texUploader().isIssued(*upload))
+				finishUpload();
+
+			return;
+		}
+
+		if (!shState->workerPool().isDone(*loadJob))
+			return;
+
+		try
+		{
+			finishLoad(true);
+		}
+		catch (const Exception &e)
+		{
+			Debug() << e.msg;
+		}
+	}
+
+	void allocSurface()
+	{
+		surface = SDL_CreateRGBSurface(0, gl.width, gl.height, format->BitsPerPixel,
+		                               format->Rmask, format->Gmask,
+		                               format->Bmask, format->Amask);
+
+		MemStats::add(MemStats::BitmapSurfaces, surface->pitch * surface->h);
+
+		validBands.assign((gl.height + READBACK_BAND - 1) / READBACK_BAND, false);
+	}
+
+	uint8_t *bandPixels(int band) const
+	{
+		return (uint8_t*) surface->pixels + band*READBACK_BAND*surface->pitch;
+	}
+
+	int bandRows(int first, int last) const
+	{
+		return std::min((last+1)*READBACK_BAND, gl.height) - first*READBACK_BAND;
+	}
+
+	/* Makes rows 'y' to 'y+h-1' of 'surface' valid */
+	void readBack(int y, int h)
+	{
+		flushFills();
+
+		if (!surface)
+		{
+			decompress();
+			allocSurface();
+		}
+
+		const int first = y / READBACK_BAND;
+		const int last = (y + h - 1) / READBACK_BAND;
+
+		consumePrefetch(first, last);
+
+		for (int band = first; band <= last; ++band)
+		{
+			if (validBands[band])
+				continue;
+
+			/* Read consecutive invalid bands in one go */
+			int end = band;
+
+			while (end < last && !validBands[end+1])
+				++end;
+
+			FBO::bind(gl.fbo);
+			::gl.ReadPixels(0, band*READBACK_BAND, gl.width, bandRows(band, end),
+			                GL_RGBA, GL_UNSIGNED_BYTE, bandPixels(band));
+
+			std::fill(validBands.begin() + band, validBands.begin() + end + 1, true);
+			band = end;
+		}
+
+		readFirst = (readFirst < 0) ? first : std::min(readFirst, first);
+		readLast = std::max(readLast, last);
+	}
+
+	/* Copies the prefetched bands into 'surface'
+	 * if they overlap 'first' to 'last' */
+	void consumePrefetch(int first, int last)
+	{
+		if (pboFirst < 0 || last < pboFirst || first > pboLast)
+			return;
+
+		const size_t size = bandRows(pboFirst, pboLast) * surface->pitch;
+
+		PBO::bind(pbo);
+		const void *data = PBO::mapRead(0, size);
+
+		if (data)
+		{
+			memcpy(bandPixels(pboFirst), data, size);
+			PBO::unmap();
+
+			std::fill(validBands.begin() + pboFirst, validBands.begin() + pboLast + 1, true);
+		}
+
+		PBO::unbind();
+
+		pboFirst = pboLast = -1;
+	}
+
+	/* Queues the read of 'prefetchFirst' to 'prefetchLast' */
+	void prefetch()
+	{
+		if (!surface || isMega() || compressed || evicted || prefetchFirst < 0)
+			return;
+
+		const int y = prefetchFirst*READBACK_BAND;
+		const int rows = bandRows(prefetchFirst, prefetchLast);
+		const size_t size = rows * surface->pitch;
+
+		FBOBindingGuard guard;
+
+		flushFills();
+
+		if (pbo == PBO::ID(0))
+			pbo = PBO::gen();
+
+		PBO::bind(pbo);
+
+		if (size > pboSize)
+		{
+			PBO::allocEmpty(size, GL_STREAM_READ);
+			pboSize = size;
+		}
+
+		FBO::bind(gl.fbo);
+		::gl.ReadPixels(0, y, gl.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+		PBO::unbind();
+
+		pboFirst = prefetchFirst;
+		pboLast = prefetchLast;
+		prefetchFirst = prefetchLast = -1;
+	}
+
+	void invalidateSurface()
+	{
+		invalidateRows(0, gl.height);
+	}
+
+	/* Marks the bands overlapping rows 'y' to 'y+h-1' stale */
+	void invalidateRows(int y, int h)
+	{
+		if (!surface)
+			return;
+
+		const int y1 = std::max(y, 0);
+		const int y2 = std::min(y + h, gl.height);
+
+		if (y1 >= y2)
+			return;
+
+		const int first = y1 / READBACK_BAND;
+		const int last = (y2 - 1) / READBACK_BAND;
+
+		/* Refetch the recently read bands that went stale */
+		if (readFirst >= 0 && ::gl.pixel_pack_buffer
+		    && first <= readLast && last >= readFirst)
+		{
+			int fetchFirst = std::max(first, readFirst);
+			int fetchLast = std::min(last, readLast);
+
+			if (prefetchFirst >= 0)
+			{
+				fetchFirst = std::min(fetchFirst, prefetchFirst);
+				fetchLast = std::max(fetchLast, prefetchLast);
+			}
+
+			prefetchFirst = fetchFirst;
+			prefetchLast = fetchLast;
+
+			readbackBitmaps.remove(readbackLink);
+			readbackBitmaps.append(readbackLink);
+		}
+
+		std::fill(validBands.begin() + first, validBands.begin() + last + 1, false);
+
+		if (first == 0 && last == (int) validBands.size() - 1)
+			readFirst = readLast = -1;
+	}
+
+	/* Same for the (possibly fractional) area a quad was drawn
+	 * to; filtering may bleed into a row on either side */
+	void invalidateArea(const FloatRect &rect)
+	{
+		const float y1 = std::min(rect.y, rect.y + rect.h);
+		const float y2 = std::max(rect.y, rect.y + rect.h);
+		const int y = (int) floorf(y1) - 1;
+
+		invalidateRows(y, (int) ceilf(y2) + 1 - y);
+	}
+
+	/* Applies a solid fill to the valid bands of 'surface';
+	 * the others pick it up once they're read back */
+	void patchFill(const IntRect &rect, const Vec4 &color)
+	{
+		if (!surface)
+			return;
+
+		const IntRect bounds(0, 0, gl.width, gl.height);
+		const IntRect norm = normalizedRect(rect);
+		SDL_Rect clip;
+
+		if (SDL_IntersectRect(&norm, &bounds, &clip) != SDL_TRUE)
+			return;
+
+		/* Unorm conversion as done by GL */
+		const uint32_t pixel =
+			SDL_MapRGBA(format,
+			            (uint8_t) (clamp(color.x, 0.0f, 1.0f) * 255 + 0.5f),
+			            (uint8_t) (clamp(color.y, 0.0f, 1.0f) * 255 + 0.5f),
+			            (uint8_t) (clamp(color.z, 0.0f, 1.0f) * 255 + 0.5f),
+			            (uint8_t) (clamp(color.w, 0.0f, 1.0f) * 255 + 0.5f));
+
+		for (int y = clip.y; y < clip.y + clip.h; ++y)
+		{
+			if (!validBands[y / READBACK_BAND])
+				continue;
+
+			uint32_t *row = (uint32_t*) ((uint8_t*) surface->pixels + y*surface->pitch);
+			std::fill(row + clip.x, row + clip.x + clip.w, pixel);
+		}
+	}
+
+	void clearTaintedArea()
+	{
+		pixman_region_fini(&tainted);
+		pixman_region_init(&tainted);
+
+		clearOpaqueArea();
+	}
+
+	void addTaintedArea(const IntRect &rect)
+	{	
+		IntRect norm = normalizedRect(rect);
+		pixman_region_union_rect
+		        (&tainted, &tainted, norm.x, norm.y, norm.w, norm.h);
+	}
+
+	void substractTaintedArea(const IntRect &rect)
+	{
+		if (!touchesTaintedArea(rect))
+			return;
+
+		pixman_region16_t m_reg;
+		pixman_region_init_rect(&m_reg, rect.x, rect.y, rect.w, rect.h);
+
+		pixman_region_subtract(&tainted, &m_reg, &tainted);
+
+		pixman_region_fini(&m_reg);
+	}
+
+	bool touchesTaintedArea(const IntRect &rect)
+	{
+		pixman_box16_t box;
+		box.x1 = rect.x;
+		box.y1 = rect.y;
+		box.x2 = rect.x + rect.w;
+		box.y2 = rect.y + rect.h;
+
+		pixman_region_overlap_t result =
+		        pixman_region_contains_rectangle(&tainted, &box);
+
+		return result != PIXMAN_REGION_OUT;
+	}
+
+	void clearOpaqueArea()
+	{
+		pixman_region_fini(&opaque);
+		pixman_region_init(&opaque);
+	}
+
+	void addOpaqueArea(const IntRect &rect)
+	{
+		IntRect norm = normalizedRect(rect);
+		pixman_region_union_rect
+		        (&opaque, &opaque, norm.x, norm.y, norm.w, norm.h);
+	}
+
+	void substractOpaqueArea(const IntRect &rect)
+	{
+		if (!pixman_region_not_empty(&opaque))
+			return;
+
+		IntRect norm = normalizedRect(rect);
+
+		pixman_region16_t m_reg;
+		pixman_region_init_rect(&m_reg, norm.x, norm.y, norm.w, norm.h);
+
+		pixman_region_subtract(&opaque, &opaque, &m_reg);
+
+		pixman_region_fini(&m_reg);
+	}
+
+	bool coversOpaqueArea(const IntRect &rect)
+	{
+		IntRect norm = normalizedRect(rect);
+
+		pixman_box16_t box;
+		box.x1 = norm.x;
+		box.y1 = norm.y;
+		box.x2 = norm.x + norm.w;
+		box.y2 = norm.y + norm.h;
+
+		pixman_region_overlap_t result =
+		        pixman_region_contains_rectangle(&opaque, &box);
+
+		return result == PIXMAN_REGION_IN;
+	}
+
+	void bindTexture(ShaderBase &shader)
+	{
+		flushFills();
+
+		TEX::bind(gl.tex);
+		shader.setTexSize(Vec2i(gl.texW, gl.texH));
+	}
+
+	void bindFBO()
+	{
+		FBO::bind(gl.fbo);
+	}
+
+	void pushSetViewport(ShaderBase &shader) const
+	{
+		glState.viewport.pushSet(IntRect(0, 0, gl.width, gl.height));
+		shader.applyViewportProj();
+	}
+
+	void popViewport() const
+	{
+		glState.viewport.pop();
+	}
+
+	/* Fill operations are deferred into the FillQueue, so
+	 * anything else using the texture has to flush them first */
+	void flushFillsIn(const IntRect &area)
+	{
+		if (shState->fillQueue().overlaps(this, area))
+			flushFills();
+		else if (stagedOverlaps(area))
+			flushStaged();
+	}
+
+	void flushFillsIn(const FloatRect &area)
 	{
-		norm.w = -norm.w;
-		norm.x -= norm.w;
+		const int x1 = floorf(area.x), y1 = floorf(area.y);
+		const int x2 = ceilf(area.x + area.w), y2 = ceilf(area.y + area.h);
+
+		flushFillsIn(IntRect(x1, y1, x2 - x1, y2 - y1));
 	}
 
-	if (norm.h < 0)
+	void flushFills()
 	{
-		norm.h = -norm.h;
-		norm.y -= norm.h;
+		shState->fillQueue().flush(this);
+		flushPixels();
+		flushStaged();
 	}
 
-	return norm;
-}
+	void discardFills()
+	{
+		shState->fillQueue().discard(this);
+		pendingPixels.clear();
+		discardStaged();
+	}
 
-struct BitmapPrivate
-{
-	Bitmap *self;
+	bool stagedOverlaps(const IntRect &area) const
+	{
+		return !staging.empty() && SDL_HasIntersection(&stagedRect, &area);
+	}
 
-	TEXFBO gl;
+	/* Adds the part of 'txtSurf' starting at 'srcX', 'srcY' to the
+	 * staged text, placed at 'dst' (which lies within the bitmap and
+	 * must not touch the tainted area yet). Returns false if it has
+	 * to be uploaded right away instead */
+	bool stageText(SDL_Surface *txtSurf, int srcX, int srcY, const IntRect &dst)
+	{
+		if (dst.w * dst.h > STAGED_TEXT_MAX)
+			return false;
 
-	Font *font;
+		if (!staging.empty() && !canGrowStaging(dst))
+			flushStaged();
 
-	/* "Mega surfaces" are a hack to allow Tilesets to be used
-	 * whose Bitmaps don't fit into a regular texture. They're
-	 * kept in RAM and will throw an error if they're used in
-	 * any context other than as Tilesets */
-	SDL_Surface *megaSurface;
+		if (staging.empty())
+		{
+			stagedRect = dst;
+			staging.assign(dst.w * dst.h * 4, 0);
 
-	/* A cached version of the bitmap in client memory, for
-	 * getPixel calls. Is invalidated any time the bitmap
-	 * is modified */
-	SDL_Surface *surface;
-	SDL_PixelFormat *format;
+			stagedCon = shState->prepareDraw.connect
+			        (sigc::mem_fun(this, &BitmapPrivate::flushStaged));
+		}
+		else
+		{
+			growStaging(dst);
+		}
 
-	/* The 'tainted' area describes which parts of the
-	 * bitmap are not cleared, ie. don't have 0 opacity.
-	 * If we're blitting / drawing text to a cleared part
-	 * with full opacity, we can disregard any old contents
-	 * in the texture and blit to it directly, saving
-	 * ourselves the expensive blending calculation */
-	pixman_region16_t tainted;
+		const uint8_t *src = static_cast<const uint8_t*>(txtSurf->pixels);
 
-	BitmapPrivate(Bitmap *self)
-	    : self(self),
-	      megaSurface(0),
-	      surface(0)
-	{
-		format = SDL_AllocFormat(SDL_PIXELFORMAT_ABGR8888);
+		for (int y = 0; y < dst.h; ++y)
+			memcpy(&staging[((dst.y - stagedRect.y + y) * stagedRect.w
+			                 + dst.x - stagedRect.x) * 4],
+			       src + (srcY + y) * txtSurf->pitch + srcX * 4, dst.w * 4);
 
-		font = &shState->defaultFont();
-		pixman_region_init(&tainted);
+		return true;
 	}
 
-	~BitmapPrivate()
+	static IntRect unitedRect(const IntRect &a, const IntRect &b)
 	{
-		SDL_FreeFormat(format);
-		pixman_region_fini(&tainted);
-	}
+		SDL_Rect result;
+		SDL_UnionRect(&a, &b, &result);
 
-	void allocSurface()
-	{
-		surface = SDL_CreateRGBSurface(0, gl.width, gl.height, format->BitsPerPixel,
-		                               format->Rmask, format->Gmask,
-		                               format->Bmask, format->Amask);
+		return IntRect(result.x, result.y, result.w, result.h);
 	}
 
-	void clearTaintedArea()
+	/* Whether the staged area can be extended over 'dst', ie. whatever
+	 * the extension covers besides 'dst' is known to be cleared */
+	bool canGrowStaging(const IntRect &dst)
 	{
-		pixman_region_fini(&tainted);
-		pixman_region_init(&tainted);
-	}
+		const IntRect united = unitedRect(stagedRect, dst);
 
-	void addTaintedArea(const IntRect &rect)
-	{	
-		IntRect norm = normalizedRect(rect);
-		pixman_region_union_rect
-		        (&tainted, &tainted, norm.x, norm.y, norm.w, norm.h);
+		if (united.w * united.h > STAGED_TEXT_MAX)
+			return false;
+
+		pixman_region16_t rest;
+		pixman_region_init_rect(&rest, united.x, united.y, united.w, united.h);
+
+		pixman_region16_t known;
+		pixman_region_init_rect(&known, stagedRect.x, stagedRect.y,
+		                        stagedRect.w, stagedRect.h);
+		pixman_region_union_rect(&known, &known, dst.x, dst.y, dst.w, dst.h);
+
+		pixman_region_subtract(&rest, &rest, &known);
+		pixman_region_intersect(&rest, &rest, &tainted);
+
+		const bool cleared = !pixman_region_not_empty(&rest);
+
+		pixman_region_fini(&known);
+		pixman_region_fini(&rest);
+
+		return cleared;
 	}
 
-	void substractTaintedArea(const IntRect &rect)
+	void growStaging(const IntRect &dst)
 	{
-		if (!touchesTaintedArea(rect))
+		const IntRect united = unitedRect(stagedRect, dst);
+
+		if (united == stagedRect)
 			return;
 
-		pixman_region16_t m_reg;
-		pixman_region_init_rect(&m_reg, rect.x, rect.y, rect.w, rect.h);
+		std::vector<uint8_t> grown(united.w * united.h * 4, 0);
 
-		pixman_region_subtract(&tainted, &m_reg, &tainted);
+		for (int y = 0; y < stagedRect.h; ++y)
+			memcpy(&grown[((stagedRect.y - united.y + y) * united.w
+			               + stagedRect.x - united.x) * 4],
+			       &staging[y * stagedRect.w * 4], stagedRect.w * 4);
 
-		pixman_region_fini(&m_reg);
+		staging.swap(grown);
+		stagedRect = united;
 	}
 
-	bool touchesTaintedArea(const IntRect &rect)
+	/* Returns false if ('x', 'y') lies outside the staged area */
+	bool stagePixel(int x, int y, const uint8_t rgba[4])
 	{
-		pixman_box16_t box;
-		box.x1 = rect.x;
-		box.y1 = rect.y;
-		box.x2 = rect.x + rect.w;
-		box.y2 = rect.y + rect.h;
+		if (!stagedOverlaps(IntRect(x, y, 1, 1)))
+			return false;
 
-		pixman_region_overlap_t result =
-		        pixman_region_contains_rectangle(&tainted, &box);
+		memcpy(&staging[((y - stagedRect.y) * stagedRect.w + x - stagedRect.x) * 4],
+		       rgba, 4);
 
-		return result != PIXMAN_REGION_OUT;
+		return true;
 	}
 
-	void bindTexture(ShaderBase &shader)
+	void flushStaged()
 	{
+		if (staging.empty())
+			return;
+
 		TEX::bind(gl.tex);
-		shader.setTexSize(Vec2i(gl.width, gl.height));
+		UploadStaging::uploadSubImage(stagedRect.x, stagedRect.y,
+		                              stagedRect.w, stagedRect.h,
+		                              &staging[0], GL_RGBA);
+
+		discardStaged();
 	}
 
-	void bindFBO()
+	void discardStaged()
 	{
-		FBO::bind(gl.fbo);
+		std::vector<uint8_t>().swap(staging);
+		stagedCon.disconnect();
 	}
 
-	void pushSetViewport(ShaderBase &shader) const
+	void flushPixels()
 	{
-		glState.viewport.pushSet(IntRect(0, 0, gl.width, gl.height));
-		shader.applyViewportProj();
+		if (pendingPixels.empty())
+			return;
+
+		/* Stable, so the last write to a pixel
+		 * ends up last among its duplicates */
+		std::stable_sort(pendingPixels.begin(), pendingPixels.end());
+
+		std::vector<uint8_t> run;
+		int runX = 0, runY = 0;
+
+		TEX::bind(gl.tex);
+
+		for (size_t i = 0; i < pendingPixels.size(); ++i)
+		{
+			const PendingPixel &px = pendingPixels[i];
+			const int runW = run.size() / 4;
+
+			if (!run.empty() && px.y == runY && px.x == runX + runW - 1)
+			{
+				/* Overwritten */
+				memcpy(&run[run.size() - 4], px.rgba, 4);
+				continue;
+			}
+
+			if (!run.empty() && (px.y != runY || px.x != runX + runW))
+			{
+				UploadStaging::uploadSubImage(runX, runY, runW, 1, &run[0], GL_RGBA);
+				run.clear();
+			}
+
+			if (run.empty())
+			{
+				runX = px.x;
+				runY = px.y;
+			}
+
+			run.insert(run.end(), px.rgba, px.rgba + 4);
+		}
+
+		UploadStaging::uploadSubImage(runX, runY, run.size() / 4, 1, &run[0], GL_RGBA);
+
+		pendingPixels.clear();
 	}
 
-	void popViewport() const
+	void queueFill(const IntRect &rect, const Vec4 &color1,
+	               const Vec4 &color2, bool vertical)
 	{
-		glState.viewport.pop();
+		if (!shState->fillQueue().pending(this))
+			detach();
+		else if (stagedOverlaps(rect))
+			flushStaged();
+
+		Vertex vert[4];
+		Quad::setPosRect(vert, rect);
+
+		vert[0].color = color1;
+		vert[1].color = vertical ? color1 : color2;
+		vert[2].color = color2;
+		vert[3].color = vertical ? color2 : color1;
+
+		shState->fillQueue().add(this, gl, vert);
 	}
 
-	void blitQuad(Quad &quad)
+	void blitQuad(Quad &quad, ShaderBase &shader)
 	{
 		glState.blend.pushSet(false);
-		quad.draw();
+		quad.draw(shader);
 		glState.blend.pop();
 	}
 
-	void fillRect(const IntRect &rect,
-	              const Vec4 &color)
+	/* Blends finished text ('size' being the used part of 'txt')
+	 * into 'posRect', using 'shader' to resolve its alpha format */
+	template<class Shader>
+	void blitTextTex(Shader &shader, const TEXFBO &txt, const Vec2i &size,
+	                 const FloatRect &posRect, float opacity)
 	{
+		/* Aquire a partial copy of the destination
+		 * buffer we're about to render to */
+		TEXFBO &gpTex2 = shState->gpTexFBO(posRect.w, posRect.h);
+
+		GLMeta::blitBegin(gpTex2);
+		GLMeta::blitSource(gl);
+		GLMeta::blitRectangle(posRect, Vec2i());
+		GLMeta::blitEnd();
+
+		FloatRect bltRect(0, 0,
+		                  (float) (txt.width * posRect.w / size.x) / gpTex2.width,
+		                  (float) txt.height / gpTex2.height);
+
+		shader.bind();
+		shader.setTexSize(Vec2i(txt.texW, txt.texH));
+		shader.setSource();
+		shader.setDestination(gpTex2.tex);
+		shader.setSubRect(bltRect);
+		shader.setOpacity(opacity);
+
+		TEX::bind(txt.tex);
+
+		Quad &quad = shState->gpQuad();
+		quad.setTexRect(FloatRect(0, 0, size.x, size.y));
+		quad.setPosRect(posRect);
+
 		bindFBO();
+		pushSetViewport(shader);
+
+		blitQuad(quad, shader);
+
+		popViewport();
+	}
+
+	/* Blends text composed by the glyph atlas into 'posRect' */
+	void blitComposedText(const TEXFBO &txt, const Vec2i &size,
+	                      const FloatRect &posRect, float opacity)
+	{
+		blitTextTex(shState->shaders().textBlt(), txt, size, posRect, opacity);
+	}
+
+	/* Blends a string from the text cache into 'posRect' */
+	void blitCachedText(const TextCacheEntry &entry,
+	                    const FloatRect &posRect, float opacity)
+	{
+		const TEXFBO &txt = entry.tex;
+		const Vec2i size(txt.width, txt.height);
 
-		glState.scissorTest.pushSet(true);
-		glState.scissorBox.pushSet(normalizedRect(rect));
-		glState.clearColor.pushSet(color);
+		/* Pooled textures are expected to sample sharp,
+		 * so only filter them for the duration of the blit */
+		TEX::bind(txt.tex);
+		TEX::setSmooth(true);
 
-		FBO::clear();
+		if (entry.premultiplied)
+			blitTextTex(shState->shaders().textBlt(), txt, size, posRect, opacity);
+		else
+			blitTextTex(shState->shaders().blt(), txt, size, posRect, opacity);
 
-		glState.clearColor.pop();
-		glState.scissorBox.pop();
-		glState.scissorTest.pop();
+		TEX::bind(txt.tex);
+		TEX::setSmooth(false);
 	}
 
 	static void ensureFormat(SDL_Surface *&surf, Uint32 format)
@@ -216,82 +1945,142 @@ struct BitmapPrivate
 		if (surf->format->format == format)
 			return;
 
-		SDL_Surface *surfConv = SDL_ConvertSurfaceFormat(surf, format, 0);
+		SDL_Surface *surfConv;
+
+		/* What TTF_RenderUTF8_Blended produces */
+		if (surf->format->format == SDL_PIXELFORMAT_ARGB8888 &&
+		    format == SDL_PIXELFORMAT_ABGR8888)
+		{
+			surfConv = SDL_CreateRGBSurfaceWithFormat(0, surf->w, surf->h, 32, format);
+
+			if (surfConv)
+				TextCompose::argbToAbgr(surf, surfConv);
+		}
+		else
+		{
+			surfConv = SDL_ConvertSurfaceFormat(surf, format, 0);
+		}
+
 		SDL_FreeSurface(surf);
 		surf = surfConv;
 	}
 
+	void onModified(const IntRect &area)
+	{
+		const IntRect norm = normalizedRect(area);
+		invalidateRows(norm.y, norm.h);
+		onModified(false);
+	}
+
+	void onModified(const FloatRect &area)
+	{
+		invalidateArea(area);
+		onModified(false);
+	}
+
 	void onModified(bool freeSurface = true)
 	{
-		if (surface && freeSurface)
-		{
-			SDL_FreeSurface(surface);
-			surface = 0;
-		}
+		/* A read in flight no longer matches */
+		pboFirst = pboLast = -1;
+
+		if (freeSurface)
+			invalidateSurface();
+
+		stamp = shState->genTimeStamp();
+
+		/* The file no longer reflects the contents */
+		residentBitmaps.remove(residentLink);
+		filename.clear();
+		fileContents = false;
+		mipmapped = false;
 
 		self->modified();
+		Scene::markDirty();
 	}
 };
 
-struct BitmapOpenHandler : FileSystem::OpenHandler
+Bitmap::Bitmap(const char *filename)
 {
-	SDL_Surface *surf;
-
-	BitmapOpenHandler()
-	    : surf(0)
-	{}
+	/* Available precompressed? */
+	KTXImage compressedImg;
 
-	bool tryRead(SDL_RWops &ops, const char *ext)
+	if (findCompressedImage(filename, compressedImg))
 	{
-		surf = IMG_LoadTyped_RW(&ops, 1, ext);
-		return surf != 0;
+		p = new BitmapPrivate(this);
+
+		if (p->initFromCompressed(compressedImg, filename))
+		{
+			p->makeResident(filename);
+			return;
+		}
+
+		delete p;
 	}
-};
 
-Bitmap::Bitmap(const char *filename)
-{
-	BitmapOpenHandler handler;
-	shState->fileSystem().openRead(handler, filename);
-	SDL_Surface *imgSurf = handler.surf;
+	/* Shared with other bitmaps loaded from the same file? */
+	BitmapCache &cache = shState->bitmapCache();
+	const std::string key = normalizedPath(filename);
+	TEXFBO cached;
+	unsigned int stamp;
 
-	if (!imgSurf)
-		throw Exception(Exception::SDLError, "Error loading image '%s': %s",
-		                filename, SDL_GetError());
+	if (cache.enabled() && cache.acquire(key, cached, stamp))
+	{
+		p = new BitmapPrivate(this);
+		p->adoptCached(cached, key, stamp);
+		p->makeResident(filename);
+
+		return;
+	}
 
-	p->ensureFormat(imgSurf, SDL_PIXELFORMAT_ABGR8888);
+	/* Already decoded in the background? */
+	SDL_Surface *imgSurf = shState->preloader().takeImage(filename);
 
-	if (imgSurf->w > glState.caps.maxTexSize || imgSurf->h > glState.caps.maxTexSize)
+	if (!imgSurf && shState->workerPool().enabled())
 	{
-		/* Mega surface */
+		/* Only decoding is deferred; the file is read right
+		 * away so that missing files still raise here */
+		FileSystem::ReadAllHandler file;
+		shState->fileSystem().openRead(file, filename);
+
 		p = new BitmapPrivate(this);
-		p->megaSurface = imgSurf;
-		SDL_SetSurfaceBlendMode(p->megaSurface, SDL_BLENDMODE_NONE);
+		p->startLoad(new ImageDecodeJob(filename, file));
+
+		return;
 	}
-	else
+
+	if (!imgSurf)
 	{
-		/* Regular surface */
-		TEXFBO tex;
+		BitmapOpenHandler handler;
+		shState->fileSystem().openRead(handler, filename);
+		imgSurf = handler.surf;
+	}
 
-		try
-		{
-			tex = shState->texPool().request(imgSurf->w, imgSurf->h);
-		}
-		catch (const Exception &e)
-		{
-			SDL_FreeSurface(imgSurf);
-			throw e;
-		}
+	if (!imgSurf)
+		throw Exception(Exception::SDLError, "Error loading image '%s': %s",
+		                filename, SDL_GetError());
 
-		p = new BitmapPrivate(this);
-		p->gl = tex;
+	BitmapPrivate::ensureFormat(imgSurf, SDL_PIXELFORMAT_ABGR8888);
 
-		TEX::bind(p->gl.tex);
-		TEX::uploadImage(p->gl.width, p->gl.height, imgSurf->pixels, GL_RGBA);
+	p = new BitmapPrivate(this);
 
-		SDL_FreeSurface(imgSurf);
+	if (p->initReduced(imgSurf, filename))
+	{
+		p->makeResident(filename);
+		return;
+	}
+
+	try
+	{
+		p->initFromSurface(imgSurf);
+	}
+	catch (const Exception &e)
+	{
+		delete p;
+		throw e;
 	}
 
-	p->addTaintedArea(rect());
+	p->shareTexture(filename);
+	p->makeResident(filename);
 }
 
 Bitmap::Bitmap(int width, int height)
@@ -307,12 +2096,34 @@ Bitmap::Bitmap(int width, int height)
 	clear();
 }
 
+Bitmap::Bitmap(const TEXFBO &cached, const std::string &key, unsigned int stamp)
+{
+	p = new BitmapPrivate(this);
+	p->adoptCached(cached, key, stamp);
+}
+
+Bitmap *Bitmap::fromCache(const std::string &key)
+{
+	BitmapCache &cache = shState->bitmapCache();
+	TEXFBO cached;
+	unsigned int stamp;
+
+	if (!cache.enabled() || !cache.acquire(key, cached, stamp))
+		return 0;
+
+	return new Bitmap(cached, key, stamp);
+}
+
 Bitmap::Bitmap(const Bitmap &other)
 {
 	other.ensureNonMega();
 
 	p = new BitmapPrivate(this);
 
+	/* The GPU copy is deferred until one of both is written to */
+	if (!other.isDisposed() && other.p->shareWith(*p))
+		return;
+
 	p->gl = shState->texPool().request(other.width(), other.height());
 
 	blt(0, 0, other, rect());
@@ -327,8 +2138,8 @@ int Bitmap::width() const
 {
 	guardDisposed();
 
-	if (p->megaSurface)
-		return p->megaSurface->w;
+	if (p->isMega())
+		return p->megaSize.x;
 
 	return p->gl.width;
 }
@@ -337,8 +2148,8 @@ int Bitmap::height() const
 {
 	guardDisposed();
 
-	if (p->megaSurface)
-		return p->megaSurface->h;
+	if (p->isMega())
+		return p->megaSize.y;
 
 	return p->gl.height;
 }
@@ -377,111 +2188,119 @@ void Bitmap::stretchBlt(const IntRect &destRect,
                         const Bitmap &source, const IntRect &sourceRect,
                         int opacity)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	if (source.isDisposed())
-		return;
-
-	opacity = clamp(opacity, 0, 255);
-
-	if (opacity == 0)
-		return;
-
-	SDL_Surface *srcSurf = source.megaSurface();
-
-	if (srcSurf && shState->config().subImageFix)
-	{
-		/* Blit from software surface, for broken GL drivers */
-		Vec2i gpTexSize;
-		shState->ensureTexSize(sourceRect.w, sourceRect.h, gpTexSize);
-		shState->bindTex();
-
-		GLMeta::subRectImageUpload(srcSurf->w, sourceRect.x, sourceRect.y, 0, 0,
-		                           sourceRect.w, sourceRect.h, srcSurf, GL_RGBA);
-		GLMeta::subRectImageEnd();
-
-		SimpleShader &shader = shState->shaders().simple;
-		shader.bind();
-		shader.setTranslation(Vec2i());
-		shader.setTexSize(gpTexSize);
-
-		p->pushSetViewport(shader);
-		p->bindFBO();
-
-		Quad &quad = shState->gpQuad();
-		quad.setTexRect(FloatRect(0, 0, sourceRect.w, sourceRect.h));
-		quad.setPosRect(destRect);
+	if (source.isDisposed())
+		return;
 
-		p->blitQuad(quad);
-		p->popViewport();
+	source.p->flushFills();
 
-		p->addTaintedArea(destRect);
-		p->onModified();
+	opacity = clamp(opacity, 0, 255);
 
+	if (opacity == 0)
 		return;
+
+	p->detachArea(normalizedRect(destRect));
+
+	const bool fastBlit = opacity == 255 && !p->touchesTaintedArea(destRect);
+
+	/* Translucent blits the fixed function blending can resolve
+	 * exactly: onto a cleared area the source only needs its alpha
+	 * scaled, and onto an opaque one the blt formula reduces to
+	 * normal blending, so no copy of the destination is needed */
+	const bool clearDest = !p->touchesTaintedArea(destRect);
+	const bool directBlit = !fastBlit && !source.p->isMega() &&
+	        (clearDest || p->coversOpaqueArea(destRect));
+
+	if (source.p->isMega() && fastBlit)
+	{
+		/* Fast blit, across the source tiles */
+		GLMeta::blitBegin(p->gl);
+		source.p->blitMega(sourceRect, destRect);
+		GLMeta::blitEnd();
 	}
-	else if (srcSurf)
+	else if (fastBlit)
 	{
-		/* Blit from software surface */
-		/* Don't do transparent blits for now */
-		if (opacity < 255)
-			source.ensureNonMega();
+		source.p->decompress();
 
-		SDL_Rect srcRect = sourceRect;
-		SDL_Rect dstRect = destRect;
-		SDL_Rect btmRect = { 0, 0, width(), height() };
-		SDL_Rect bltRect;
+		/* Fast blit */
+		GLMeta::blitBegin(p->gl);
+		GLMeta::blitSource(source.p->gl);
+		GLMeta::blitRectangle(sourceRect, destRect);
+		GLMeta::blitEnd();
 
-		if (SDL_IntersectRect(&btmRect, &dstRect, &bltRect) != SDL_TRUE)
-			return;
+		p->substractOpaqueArea(destRect);
+	}
+	else if (directBlit)
+	{
+		float normOpacity = (float) opacity / 255.0f;
 
-		int bpp;
-		Uint32 rMask, gMask, bMask, aMask;
-		SDL_PixelFormatEnumToMasks(SDL_PIXELFORMAT_ABGR8888,
-		                           &bpp, &rMask, &gMask, &bMask, &aMask);
-		SDL_Surface *blitTemp =
-			SDL_CreateRGBSurface(0, destRect.w, destRect.h, bpp, rMask, gMask, bMask, aMask);
+		SimpleAlphaShader &shader = shState->shaders().simpleAlpha();
+		shader.bind();
+		shader.setTranslation(Vec2i());
 
-		SDL_BlitScaled(srcSurf, &srcRect, blitTemp, 0);
+		Quad &quad = shState->gpQuad();
+		quad.setTexPosRect(sourceRect, destRect);
+		quad.setColor(Vec4(1, 1, 1, normOpacity));
 
-		TEX::bind(p->gl.tex);
+		TEX::bind(source.p->gl.tex);
+		shader.setTexSize(Vec2i(source.p->gl.texW, source.p->gl.texH));
+		p->bindFBO();
+		p->pushSetViewport(shader);
 
-		if (bltRect.w == dstRect.w && bltRect.h == dstRect.h)
+		if (clearDest)
 		{
-			/* Dest rectangle lies within bounding box */
-			TEX::uploadSubImage(destRect.x, destRect.y,
-			                    destRect.w, destRect.h,
-			                    blitTemp->pixels, GL_RGBA);
+			p->blitQuad(quad, shader);
+			p->substractOpaqueArea(destRect);
 		}
 		else
 		{
-			/* Clipped blit */
-			GLMeta::subRectImageUpload(blitTemp->w, bltRect.x - dstRect.x, bltRect.y - dstRect.y,
-			                           bltRect.x, bltRect.y, bltRect.w, bltRect.h, blitTemp, GL_RGBA);
-			GLMeta::subRectImageEnd();
+			glState.blendMode.pushSet(BlendNormal);
+			glState.blend.pushSet(true);
+			quad.draw();
+			glState.blend.pop();
+			glState.blendMode.pop();
 		}
 
-		SDL_FreeSurface(blitTemp);
-
-		p->onModified();
-		return;
-	}
-
-	if (opacity == 255 && !p->touchesTaintedArea(destRect))
-	{
-		/* Fast blit */
-		GLMeta::blitBegin(p->gl);
-		GLMeta::blitSource(source.p->gl);
-		GLMeta::blitRectangle(sourceRect, destRect);
-		GLMeta::blitEnd();
+		p->popViewport();
 	}
 	else
 	{
 		/* Fragment pipeline */
 		float normOpacity = (float) opacity / 255.0f;
 
+		TEXFBO *srcTex = &source.p->gl;
+		IntRect srcRect = sourceRect;
+		Vec2i srcSize(source.width(), source.height());
+
+		/* Mega surfaces are sampled from a copy
+		 * of the source area in a single texture */
+		TEXFBO megaTemp;
+
+		if (source.p->isMega())
+		{
+			const int maxSize = glState.caps.maxTexSize;
+
+			if (sourceRect.w <= 0 || sourceRect.h <= 0 ||
+			    sourceRect.w > maxSize || sourceRect.h > maxSize)
+				throw Exception(Exception::MKXPError,
+				                "Operation not supported for mega surfaces");
+
+			megaTemp = shState->texPool().request(sourceRect.w, sourceRect.h);
+
+			GLMeta::blitBegin(megaTemp);
+			source.p->blitMega(sourceRect, IntRect(0, 0, sourceRect.w, sourceRect.h));
+			GLMeta::blitEnd();
+
+			srcTex = &megaTemp;
+			srcRect = IntRect(0, 0, sourceRect.w, sourceRect.h);
+			srcSize = Vec2i(sourceRect.w, sourceRect.h);
+		}
+
 		TEXFBO &gpTex = shState->gpTexFBO(destRect.w, destRect.h);
 
 		GLMeta::blitBegin(gpTex);
@@ -489,32 +2308,36 @@ void Bitmap::stretchBlt(const IntRect &destRect,
 		GLMeta::blitRectangle(destRect, Vec2i());
 		GLMeta::blitEnd();
 
-		FloatRect bltSubRect((float) sourceRect.x / source.width(),
-		                     (float) sourceRect.y / source.height(),
-		                     ((float) source.width() / sourceRect.w) * ((float) destRect.w / gpTex.width),
-		                     ((float) source.height() / sourceRect.h) * ((float) destRect.h / gpTex.height));
+		FloatRect bltSubRect((float) srcRect.x / srcSize.x,
+		                     (float) srcRect.y / srcSize.y,
+		                     ((float) srcSize.x / srcRect.w) * ((float) destRect.w / gpTex.width),
+		                     ((float) srcSize.y / srcRect.h) * ((float) destRect.h / gpTex.height));
 
-		BltShader &shader = shState->shaders().blt;
+		BltShader &shader = shState->shaders().blt();
 		shader.bind();
 		shader.setDestination(gpTex.tex);
 		shader.setSubRect(bltSubRect);
 		shader.setOpacity(normOpacity);
 
 		Quad &quad = shState->gpQuad();
-		quad.setTexPosRect(sourceRect, destRect);
+		quad.setTexPosRect(srcRect, destRect);
 		quad.setColor(Vec4(1, 1, 1, normOpacity));
 
-		source.p->bindTexture(shader);
+		TEX::bind(srcTex->tex);
+		shader.setTexSize(Vec2i(srcTex->texW, srcTex->texH));
 		p->bindFBO();
 		p->pushSetViewport(shader);
 
-		p->blitQuad(quad);
+		p->blitQuad(quad, shader);
 
 		p->popViewport();
+
+		if (source.p->isMega())
+			shState->texPool().release(megaTemp);
 	}
 
 	p->addTaintedArea(destRect);
-	p->onModified();
+	p->onModified(destRect);
 }
 
 void Bitmap::fillRect(int x, int y,
@@ -526,11 +2349,13 @@ void Bitmap::fillRect(int x, int y,
 
 void Bitmap::fillRect(const IntRect &rect, const Vec4 &color)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	p->fillRect(rect, color);
+	p->queueFill(normalizedRect(rect), color, color, false);
 
 	if (color.w == 0)
 		/* Clear op */
@@ -539,7 +2364,13 @@ void Bitmap::fillRect(const IntRect &rect, const Vec4 &color)
 		/* Fill op */
 		p->addTaintedArea(rect);
 
-	p->onModified();
+	if (color.w == 1)
+		p->addOpaqueArea(rect);
+	else
+		p->substractOpaqueArea(rect);
+
+	p->patchFill(rect, color);
+	p->onModified(false);
 }
 
 void Bitmap::gradientFillRect(int x, int y,
@@ -554,43 +2385,22 @@ void Bitmap::gradientFillRect(const IntRect &rect,
                               const Vec4 &color1, const Vec4 &color2,
                               bool vertical)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	SimpleColorShader &shader = shState->shaders().simpleColor;
-	shader.bind();
-	shader.setTranslation(Vec2i());
+	p->queueFill(rect, color1, color2, vertical);
 
-	Quad &quad = shState->gpQuad();
+	p->addTaintedArea(rect);
 
-	if (vertical)
-	{
-		quad.vert[0].color = color1;
-		quad.vert[1].color = color1;
-		quad.vert[2].color = color2;
-		quad.vert[3].color = color2;
-	}
+	if (color1.w == 1 && color2.w == 1)
+		p->addOpaqueArea(rect);
 	else
-	{
-		quad.vert[0].color = color1;
-		quad.vert[3].color = color1;
-		quad.vert[1].color = color2;
-		quad.vert[2].color = color2;
-	}
-
-	quad.setPosRect(rect);
-
-	p->bindFBO();
-	p->pushSetViewport(shader);
-
-	p->blitQuad(quad);
-
-	p->popViewport();
+		p->substractOpaqueArea(rect);
 
-	p->addTaintedArea(rect);
-
-	p->onModified();
+	p->onModified(rect);
 }
 
 void Bitmap::clearRect(int x, int y, int width, int height)
@@ -600,62 +2410,158 @@ void Bitmap::clearRect(int x, int y, int width, int height)
 
 void Bitmap::clearRect(const IntRect &rect)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	p->fillRect(rect, Vec4());
+	p->queueFill(normalizedRect(rect), Vec4(), Vec4(), false);
 
-	p->onModified();
+	p->substractOpaqueArea(rect);
+
+	p->patchFill(rect, Vec4());
+	p->onModified(false);
+}
+
+/* Number of halvings the strongest blur downsamples by */
+#define BLUR_MAX_LEVELS 4
+
+/* Runs the separable 3 tap kernel over the 'size' area of 'src',
+ * horizontally into 'aux', then vertically into 'dst' */
+static void blurPasses(BlurShader &shader, TEX::ID src, const Vec2i &srcTexSize,
+                       FBO::ID dst, TEXFBO &aux, const Vec2i &size)
+{
+	Quad &quad = shState->gpQuad();
+	FloatRect rect(0, 0, size.x, size.y);
+	quad.setTexPosRect(rect, rect);
+
+	glState.viewport.pushSet(IntRect(0, 0, size.x, size.y));
+
+	TEX::bind(src);
+	FBO::bind(aux.fbo);
+
+	shader.pass1.bind();
+	shader.pass1.setTexSize(srcTexSize);
+	shader.pass1.applyViewportProj();
+
+	quad.draw();
+
+	TEX::bind(aux.tex);
+	FBO::bind(dst);
+
+	shader.pass2.bind();
+	shader.pass2.setTexSize(Vec2i(aux.texW, aux.texH));
+	shader.pass2.applyViewportProj();
+
+	quad.draw();
+
+	glState.viewport.pop();
 }
 
-void Bitmap::blur()
+void Bitmap::blur(int strength)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	Quad &quad = shState->gpQuad();
-	FloatRect rect(0, 0, width(), height());
-	quad.setTexPosRect(rect, rect);
+	p->detach();
 
-	TEXFBO auxTex = shState->texPool().request(width(), height());
+	strength = clamp<int>(strength, 1, 2 << BLUR_MAX_LEVELS);
 
-	BlurShader &shader = shState->shaders().blur;
-	BlurShader::HPass &pass1 = shader.pass1;
-	BlurShader::VPass &pass2 = shader.pass2;
+	const Vec2i size(width(), height());
+	BlurShader &shader = shState->shaders().blur();
 
 	glState.blend.pushSet(false);
-	glState.viewport.pushSet(IntRect(0, 0, width(), height()));
 
-	TEX::bind(p->gl.tex);
-	FBO::bind(auxTex.fbo);
+	if (strength == 1)
+	{
+		/* The RGSS blur, at full resolution */
+		TEXFBO &aux = shState->gpTexFBO(size.x, size.y);
 
-	pass1.bind();
-	pass1.setTexSize(Vec2i(width(), height()));
-	pass1.applyViewportProj();
+		blurPasses(shader, p->gl.tex, Vec2i(p->gl.texW, p->gl.texH),
+		           p->gl.fbo, aux, size);
+	}
+	else
+	{
+		/* Stronger blurs run the kernel on a downsampled copy
+		 * (each halving doubles its reach), then filter it back
+		 * up, costing a fraction of the fill rate */
+		int levels = 0;
 
-	quad.draw();
+		while (levels < BLUR_MAX_LEVELS && (2 << levels) <= strength
+		       && (size.x >> (levels+1)) > 0 && (size.y >> (levels+1)) > 0)
+			++levels;
 
-	TEX::bind(auxTex.tex);
-	p->bindFBO();
+		const int passes = std::max(1, strength >> levels);
 
-	pass2.bind();
-	pass2.setTexSize(Vec2i(width(), height()));
-	pass2.applyViewportProj();
+		TEXFBO *cur = &shState->gpTexFBO(size.x / 2, size.y / 2);
+		TEXFBO *other = &shState->auxTexFBO(size.x / 2, size.y / 2);
 
-	quad.draw();
+		Vec2i levelSize[BLUR_MAX_LEVELS+1];
+		levelSize[0] = size;
+
+		for (int i = 1; i <= levels; ++i)
+			levelSize[i] = Vec2i(levelSize[i-1].x / 2, levelSize[i-1].y / 2);
+
+		GLMeta::blitBegin(*cur);
+		GLMeta::blitSource(p->gl);
+		GLMeta::blitRectangle(IntRect(0, 0, size.x, size.y),
+		                      IntRect(0, 0, levelSize[1].x, levelSize[1].y), true);
+		GLMeta::blitEnd();
+
+		for (int i = 2; i <= levels; ++i)
+		{
+			const Vec2i &from = levelSize[i-1];
+
+			GLMeta::blitBegin(*other);
+			GLMeta::blitSource(*cur);
+			GLMeta::blitRectangle(IntRect(0, 0, from.x, from.y),
+			                      IntRect(0, 0, levelSize[i].x, levelSize[i].y), true);
+			GLMeta::blitEnd();
+
+			std::swap(cur, other);
+		}
+
+		for (int i = 0; i < passes; ++i)
+			blurPasses(shader, cur->tex, Vec2i(cur->texW, cur->texH),
+			           cur->fbo, *other, levelSize[levels]);
+
+		for (int i = levels; i > 1; --i)
+		{
+			const Vec2i &from = levelSize[i];
+
+			GLMeta::blitBegin(*other);
+			GLMeta::blitSource(*cur);
+			GLMeta::blitRectangle(IntRect(0, 0, from.x, from.y),
+			                      IntRect(0, 0, levelSize[i-1].x, levelSize[i-1].y), true);
+			GLMeta::blitEnd();
+
+			std::swap(cur, other);
+		}
+
+		const Vec2i &from = levelSize[1];
+
+		GLMeta::blitBegin(p->gl);
+		GLMeta::blitSource(*cur);
+		GLMeta::blitRectangle(IntRect(0, 0, from.x, from.y),
+		                      IntRect(0, 0, size.x, size.y), true);
+		GLMeta::blitEnd();
+	}
 
-	glState.viewport.pop();
 	glState.blend.pop();
 
-	shState->texPool().release(auxTex);
+	p->clearOpaqueArea();
 
 	p->onModified();
 }
 
 void Bitmap::radialBlur(int angle, int divisions)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
@@ -670,6 +2576,49 @@ void Bitmap::radialBlur(int angle, int divisions)
 	float opacity   = 1.0f / divisions;
 	float baseAngle = -((float) angle / 2);
 
+	TEXFBO newTex = shState->texPool().request(_width, _height);
+
+	if (shState->config().singlePassRadialBlur)
+	{
+		/* Samples all rotations per pixel instead of
+		 * blending 'divisions' full size draws */
+		RadialBlurShader &shader = shState->shaders().radialBlur();
+		shader.bind();
+		shader.setTexSize(Vec2i(p->gl.texW, p->gl.texH));
+		shader.setBitmapSize(Vec2i(_width, _height));
+		shader.setRotation(baseAngle, angleStep);
+		shader.setDivisions(divisions);
+		shader.setTranslation(Vec2i());
+
+		FBO::bind(newTex.fbo);
+		glState.viewport.pushSet(IntRect(0, 0, _width, _height));
+		shader.applyViewportProj();
+
+		glState.blend.pushSet(false);
+
+		TEX::bind(p->gl.tex);
+		TEX::setSmooth(true);
+
+		Quad &quad = shState->gpQuad();
+		FloatRect rect(0, 0, _width, _height);
+		quad.setTexPosRect(rect, rect);
+		quad.draw(shader);
+
+		TEX::setSmooth(false);
+
+		glState.blend.pop();
+		glState.viewport.pop();
+
+		p->releaseTexture();
+		p->gl = newTex;
+
+		p->clearOpaqueArea();
+
+		p->onModified();
+
+		return;
+	}
+
 	ColorQuadArray qArray;
 	qArray.resize(5);
 
@@ -708,8 +2657,6 @@ void Bitmap::radialBlur(int angle, int divisions)
 
 	qArray.commit();
 
-	TEXFBO newTex = shState->texPool().request(_width, _height);
-
 	FBO::bind(newTex.fbo);
 
 	glState.clearColor.pushSet(Vec4());
@@ -721,7 +2668,7 @@ void Bitmap::radialBlur(int angle, int divisions)
 
 	glState.blendMode.pushSet(BlendAddition);
 
-	SimpleMatrixShader &shader = shState->shaders().simpleMatrix;
+	SimpleMatrixShader &shader = shState->shaders().simpleMatrix();
 	shader.bind();
 
 	p->bindTexture(shader);
@@ -743,20 +2690,29 @@ void Bitmap::radialBlur(int angle, int divisions)
 	glState.blendMode.pop();
 	glState.clearColor.pop();
 
-	shState->texPool().release(p->gl);
+	p->releaseTexture();
 	p->gl = newTex;
 
+	p->clearOpaqueArea();
+
 	p->onModified();
 }
 
 void Bitmap::clear()
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
+	p->detach(false);
 	p->bindFBO();
 
+	/* Nothing of the old contents survives the clear */
+	if (!glState.scissorTest.get())
+		FBO::discard();
+
 	glState.clearColor.pushSet(Vec4());
 
 	FBO::clear();
@@ -765,7 +2721,14 @@ void Bitmap::clear()
 
 	p->clearTaintedArea();
 
-	p->onModified();
+	/* Trivially known on the CPU side as well */
+	if (p->surface)
+	{
+		memset(p->surface->pixels, 0, p->surface->pitch * p->surface->h);
+		std::fill(p->validBands.begin(), p->validBands.end(), true);
+	}
+
+	p->onModified(false);
 }
 
 static uint32_t &getPixelAt(SDL_Surface *surf, SDL_PixelFormat *form, int x, int y)
@@ -778,6 +2741,8 @@ static uint32_t &getPixelAt(SDL_Surface *surf, SDL_PixelFormat *form, int x, int
 
 Color Bitmap::getPixel(int x, int y) const
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
@@ -785,18 +2750,7 @@ Color Bitmap::getPixel(int x, int y) const
 	if (x < 0 || y < 0 || x >= width() || y >= height())
 		return Vec4();
 
-	if (!p->surface)
-	{
-		p->allocSurface();
-
-		FBO::bind(p->gl.fbo);
-
-		glState.viewport.pushSet(IntRect(0, 0, width(), height()));
-
-		gl.ReadPixels(0, 0, width(), height(), GL_RGBA, GL_UNSIGNED_BYTE, p->surface->pixels);
-
-		glState.viewport.pop();
-	}
+	p->readBack(y, 1);
 
 	uint32_t pixel = getPixelAt(p->surface, p->format, x, y);
 
@@ -806,25 +2760,69 @@ Color Bitmap::getPixel(int x, int y) const
 	             (pixel >> p->format->Ashift) & 0xFF);
 }
 
+void Bitmap::getPixels(const IntRect &rect, uint8_t *data) const
+{
+	PROFILE_SCOPE(BitmapOps);
+
+	guardDisposed();
+
+	GUARD_MEGA;
+
+	const size_t rowSize = rect.w * 4;
+	memset(data, 0, rowSize * rect.h);
+
+	const IntRect bounds = this->rect();
+	SDL_Rect clip;
+
+	if (SDL_IntersectRect(&rect, &bounds, &clip) != SDL_TRUE)
+		return;
+
+	p->readBack(clip.y, clip.h);
+
+	for (int y = clip.y; y < clip.y + clip.h; ++y)
+		memcpy(data + (y - rect.y) * rowSize + (clip.x - rect.x) * 4,
+		       &getPixelAt(p->surface, p->format, clip.x, y), clip.w * 4);
+}
+
 void Bitmap::setPixel(int x, int y, const Color &color)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	uint8_t pixel[] =
+	if (x < 0 || y < 0 || x >= width() || y >= height())
+		return;
+
+	BitmapPrivate::PendingPixel pending;
+	pending.x = x;
+	pending.y = y;
+
+	uint8_t *pixel = pending.rgba;
+	pixel[0] = clamp<double>(color.red,   0, 255);
+	pixel[1] = clamp<double>(color.green, 0, 255);
+	pixel[2] = clamp<double>(color.blue,  0, 255);
+	pixel[3] = clamp<double>(color.alpha, 0, 255);
+
+	/* Staged text is uploaded after the pending writes,
+	 * so pixels it covers have to be written into it */
+	if (!p->stagePixel(x, y, pixel))
 	{
-		(uint8_t) clamp<double>(color.red,   0, 255),
-		(uint8_t) clamp<double>(color.green, 0, 255),
-		(uint8_t) clamp<double>(color.blue,  0, 255),
-		(uint8_t) clamp<double>(color.alpha, 0, 255)
-	};
+		/* With writes pending, the fills are flushed already */
+		if (p->pendingPixels.empty())
+			p->detach();
+		else if (p->pendingPixels.size() >= PENDING_PIXELS_MAX)
+			p->flushPixels();
 
-	TEX::bind(p->gl.tex);
-	TEX::uploadSubImage(x, y, 1, 1, &pixel, GL_RGBA);
+		p->pendingPixels.push_back(pending);
+	}
 
 	p->addTaintedArea(IntRect(x, y, 1, 1));
 
+	if (pixel[3] < 255)
+		p->substractOpaqueArea(IntRect(x, y, 1, 1));
+
 	/* Setting just a single pixel is no reason to throw away the
 	 * whole cached surface; we can just apply the same change */
 
@@ -837,16 +2835,112 @@ void Bitmap::setPixel(int x, int y, const Color &color)
 	p->onModified(false);
 }
 
-void Bitmap::hueChange(int hue)
+void Bitmap::setPixels(const IntRect &rect, const uint8_t *data)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
 
-	if ((hue % 360) == 0)
-		return;
+	const IntRect bounds = this->rect();
+	SDL_Rect clip;
+
+	if (SDL_IntersectRect(&rect, &bounds, &clip) != SDL_TRUE)
+		return;
+
+	p->detach();
+
+	const size_t rowSize = rect.w * 4;
+	const uint8_t *first = data + (clip.y - rect.y) * rowSize + (clip.x - rect.x) * 4;
+
+	TEX::bind(p->gl.tex);
+
+	/* Without GL_UNPACK_ROW_LENGTH on GLES, clipped
+	 * rows are gathered in staging memory first */
+	if (clip.w == rect.w)
+	{
+		UploadStaging::uploadSubImage(clip.x, clip.y, clip.w, clip.h, first, GL_RGBA);
+	}
+	else
+	{
+		const size_t clipRowSize = clip.w * 4;
+		uint8_t *staged = static_cast<uint8_t*>(UploadStaging::map(clipRowSize * clip.h));
+
+		for (int y = 0; y < clip.h; ++y)
+			memcpy(staged + y * clipRowSize, first + y * rowSize, clipRowSize);
+
+		UploadStaging::upload(clip.x, clip.y, clip.w, clip.h, GL_RGBA);
+	}
+
+	const IntRect area(clip.x, clip.y, clip.w, clip.h);
+	p->addTaintedArea(area);
+	p->substractOpaqueArea(area);
+
+	/* The surface holds the same RGBA8 layout */
+	if (p->surface)
+		for (int y = 0; y < clip.h; ++y)
+			memcpy(&getPixelAt(p->surface, p->format, clip.x, clip.y + y),
+			       first + y * rowSize, clip.w * 4);
+
+	p->onModified(false);
+}
+
+void Bitmap::hueChange(int hue)
+{
+	PROFILE_SCOPE(BitmapOps);
+
+	Disposable::guardDisposed();
+
+	if ((hue % 360) == 0)
+		return;
+
+	hue = wrapRange(hue, 0, 359);
+
+	if (p->loadJob)
+	{
+		/* Shift the pixels on the CPU before the first upload */
+		p->loadJob->hue = (p->loadJob->hue + hue) % 360;
+		p->onModified();
+
+		return;
+	}
+
+	guardDisposed();
+
+	/* Shader expects normalized value */
+	const float hueAdjust = hue / 360.0f;
+
+	if (p->isMega())
+	{
+		p->hueChangeMega(hueAdjust);
+		p->onModified();
+
+		return;
+	}
+
+	/* Hue variants of unmodified image files are shared
+	 * through the bitmap cache, keyed by hue and path */
+	std::string variantKey;
+
+	if (BitmapPrivate::isFileKey(p->cacheKey))
+	{
+		char prefix[32];
+		snprintf(prefix, sizeof(prefix), "\1hue/%d/", hue);
+		variantKey = prefix + p->cacheKey;
+
+		if (p->adoptVariant(variantKey))
+			return;
+	}
+
+	/* A shared (or sample-only) texture is given up anyway, so
+	 * render straight into its replacement. Otherwise, render
+	 * into the scratch target and copy the result back, rather
+	 * than requesting a whole new texture from the pool */
+	const bool replaceTex = !p->cacheKey.empty() || p->compressed;
 
-	TEXFBO newTex = shState->texPool().request(width(), height());
+	TEXFBO target = replaceTex ? shState->texPool().request(width(), height())
+	                            : shState->gpTexFBO(width(), height());
 
 	FloatRect texRect(rect());
 
@@ -854,25 +2948,44 @@ void Bitmap::hueChange(int hue)
 	quad.setTexPosRect(texRect, texRect);
 	quad.setColor(Vec4(1, 1, 1, 1));
 
-	HueShader &shader = shState->shaders().hue;
+	HueShader &shader = shState->shaders().hue();
 	shader.bind();
-	/* Shader expects normalized value */
-	shader.setHueAdjust(wrapRange(hue, 0, 359) / 360.0f);
+	shader.setHueAdjust(hueAdjust);
+
+	/* Whatever the target held is of no interest */
+	FBO::bind(target.fbo);
+	FBO::discard();
 
-	FBO::bind(newTex.fbo);
 	p->pushSetViewport(shader);
 	p->bindTexture(shader);
 
-	p->blitQuad(quad);
+	p->blitQuad(quad, shader);
 
 	p->popViewport();
 
 	TEX::unbind();
 
-	shState->texPool().release(p->gl);
-	p->gl = newTex;
+	/* The old contents are fully replaced */
+	if (replaceTex)
+	{
+		p->discardFills();
+		p->releaseTexture();
+		p->gl = target;
+	}
+	else
+	{
+		p->detach(false);
+
+		GLMeta::blitBegin(p->gl);
+		GLMeta::blitSource(target);
+		GLMeta::blitRectangle(rect(), Vec2i());
+		GLMeta::blitEnd();
+	}
 
 	p->onModified();
+
+	if (!variantKey.empty())
+		p->shareTextureAs(variantKey);
 }
 
 void Bitmap::drawText(int x, int y,
@@ -897,95 +3010,65 @@ static std::string fixupString(const char *str)
 	return s;
 }
 
+/* Opacity is applied at blit time, so only
+ * the color channels identify rendered text */
+static uint32_t packColor(const SDL_Color &c)
+{
+	return (c.r << 16) | (c.g << 8) | c.b;
+}
+
 static void applyShadow(SDL_Surface *&in, const SDL_PixelFormat &fm, const SDL_Color &c)
 {
 	SDL_Surface *out = SDL_CreateRGBSurface
 		(0, in->w+1, in->h+1, fm.BitsPerPixel, fm.Rmask, fm.Gmask, fm.Bmask, fm.Amask);
 
-	float fr = c.r / 255.0f;
-	float fg = c.g / 255.0f;
-	float fb = c.b / 255.0f;
-
-	/* We allocate an output surface one pixel wider and higher than the input,
-	 * (implicitly) blit a copy of the input with RGB values set to black into
-	 * it with x/y offset by 1, then blend the input surface over it at origin
-	 * (0,0) using the bitmap blit equation (see shader/bitmapBlit.frag) */
-
-	for (int y = 0; y < in->h+1; ++y)
-		for (int x = 0; x < in->w+1; ++x)
-		{
-			/* src: input pixel, shd: shadow pixel */
-			uint32_t src = 0, shd = 0;
-
-			/* Output pixel location */
-			uint32_t *outP = ((uint32_t*) ((uint8_t*) out->pixels + y*out->pitch)) + x;
-
-			if (y < in->h && x < in->w)
-				src = ((uint32_t*) ((uint8_t*) in->pixels + y*in->pitch))[x];
-
-			if (y > 0 && x > 0)
-				shd = ((uint32_t*) ((uint8_t*) in->pixels + (y-1)*in->pitch))[x-1];
+	TextCompose::shadow(in, out, c);
 
-			/* Set shadow pixel RGB values to 0 (black) */
-			shd &= fm.Amask;
-
-			if (x == 0 || y == 0)
-			{
-				*outP = src;
-				continue;
-			}
-
-			if (x == in->w || y == in->h)
-			{
-				*outP = shd;
-				continue;
-			}
+	/* Store new surface in the input pointer */
+	SDL_FreeSurface(in);
+	in = out;
+}
 
-			/* Input and shadow alpha values */
-			uint8_t srcA, shdA;
-			srcA = (src & fm.Amask) >> fm.Ashift;
-			shdA = (shd & fm.Amask) >> fm.Ashift;
+/* Positions rendered text of the given dimensions inside 'rect'
+ * according to 'align', squeezing it horizontally if it's wider */
+static FloatRect alignTextRect(const IntRect &rect, int align,
+                               int txtW, int txtH, int rawTxtH,
+                               float &squeeze)
+{
+	int alignX = rect.x;
 
-			if (srcA == 255 || shdA == 0)
-			{
-				*outP = src;
-				continue;
-			}
+	switch (align)
+	{
+	default:
+	case Bitmap::Left :
+		break;
 
-			if (srcA == 0 && shdA == 0)
-			{
-				*outP = 0;
-				continue;
-			}
+	case Bitmap::Center :
+		alignX += (rect.w - txtW) / 2;
+		break;
 
-			float fSrcA = srcA / 255.0f;
-			float fShdA = shdA / 255.0f;
+	case Bitmap::Right :
+		alignX += rect.w - txtW;
+		break;
+	}
 
-			/* Because opacity == 1, co1 == fSrcA */
-			float co2 = fShdA * (1.0f - fSrcA);
-			/* Result alpha */
-			float fa = fSrcA + co2;
-			/* Temp value to simplify arithmetic below */
-			float co3 = fSrcA / fa;
+	if (alignX < rect.x)
+		alignX = rect.x;
 
-			/* Result colors */
-			uint8_t r, g, b, a;
+	int alignY = rect.y + (rect.h - rawTxtH) / 2;
 
-			r = clamp<float>(fr * co3, 0, 1) * 255.0f;
-			g = clamp<float>(fg * co3, 0, 1) * 255.0f;
-			b = clamp<float>(fb * co3, 0, 1) * 255.0f;
-			a = clamp<float>(fa, 0, 1) * 255.0f;
+	squeeze = (float) rect.w / txtW;
 
-			*outP = SDL_MapRGBA(&fm, r, g, b, a);
-		}
+	if (squeeze > 1)
+		squeeze = 1;
 
-	/* Store new surface in the input pointer */
-	SDL_FreeSurface(in);
-	in = out;
+	return FloatRect(alignX, alignY, txtW * squeeze, txtH);
 }
 
 void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 {
+	PROFILE_SCOPE(BitmapOps);
+
 	guardDisposed();
 
 	GUARD_MEGA;
@@ -999,6 +3082,9 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 	if (str[0] == ' ' && str[1] == '\0')
 		return;
 
+	/* Pending fills are flushed once the text area is known */
+	p->detachTexture();
+
 	TTF_Font *font = p->font->getSdlFont();
 	const Color &fontColor = p->font->getColor();
 	const Color &outColor = p->font->getOutColor();
@@ -1008,6 +3094,84 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 
 	float txtAlpha = fontColor.norm.w;
 
+	TextCache &textCache = shState->textCache();
+	TextKey cacheKey;
+
+	if (textCache.enabled())
+	{
+		cacheKey.text = fixed;
+		cacheKey.font = font;
+		cacheKey.style = TTF_GetFontStyle(font);
+		cacheKey.color = packColor(c);
+		cacheKey.outColor = packColor(outColor.toSDLColor());
+		cacheKey.shadow = p->font->getShadow();
+		cacheKey.outline = p->font->getOutline();
+		cacheKey.solid = shState->config().solidFonts;
+
+		const TextCacheEntry *cached = textCache.lookup(cacheKey);
+
+		if (cached)
+		{
+			float squeeze;
+			FloatRect posRect = alignTextRect(rect, align, cached->tex.width,
+			                                  cached->tex.height, cached->rawHeight,
+			                                  squeeze);
+
+			p->flushFillsIn(posRect);
+			p->blitCachedText(*cached, posRect, txtAlpha);
+			p->addTaintedArea(posRect);
+
+			p->onModified(posRect);
+
+			return;
+		}
+	}
+
+	if (shState->config().glyphAtlas)
+	{
+		Vec2i txtSize;
+		int rawTxtH;
+
+		TEXFBO *txtTex = shState->glyphAtlas().composeText
+		        (font, str, fontColor.norm, outColor.norm,
+		         p->font->getShadow(), p->font->getOutline() ? OUTLINE_SIZE : 0,
+		         shState->config().solidFonts, txtSize, rawTxtH);
+
+		if (txtTex)
+		{
+			float squeeze;
+			FloatRect posRect = alignTextRect(rect, align, txtSize.x, txtSize.y,
+			                                  rawTxtH, squeeze);
+
+			TextCacheEntry *entry = 0;
+
+			if (textCache.enabled())
+				entry = textCache.insert(cacheKey, txtSize, rawTxtH, true);
+
+			p->flushFillsIn(posRect);
+
+			if (entry)
+			{
+				GLMeta::blitBegin(entry->tex);
+				GLMeta::blitSource(*txtTex);
+				GLMeta::blitRectangle(IntRect(0, 0, txtSize.x, txtSize.y), Vec2i());
+				GLMeta::blitEnd();
+
+				p->blitCachedText(*entry, posRect, txtAlpha);
+			}
+			else
+			{
+				p->blitComposedText(*txtTex, txtSize, posRect, txtAlpha);
+			}
+
+			p->addTaintedArea(posRect);
+
+			p->onModified(posRect);
+
+			return;
+		}
+	}
+
 	SDL_Surface *txtSurf;
 
 	if (shState->rtData().config.solidFonts)
@@ -1022,7 +3186,7 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 	if (p->font->getShadow())
 		applyShadow(txtSurf, *p->format, c);
 
-	/* outline using TTF_Outline and blending it together with SDL_BlitSurface
+	/* outline using TTF_Outline and blending the text over it
 	 * FIXME: outline is forced to have the same opacity as the font color */
 	if (p->font->getOutline())
 	{
@@ -1037,44 +3201,41 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 			outline = TTF_RenderUTF8_Blended(font, str, co);
 
 		p->ensureFormat(outline, SDL_PIXELFORMAT_ABGR8888);
-		SDL_Rect outRect = {OUTLINE_SIZE, OUTLINE_SIZE, txtSurf->w, txtSurf->h}; 
 
-		SDL_SetSurfaceBlendMode(txtSurf, SDL_BLENDMODE_BLEND);
-		SDL_BlitSurface(txtSurf, NULL, outline, &outRect);
+		TextCompose::blendOver(txtSurf, outline, OUTLINE_SIZE, OUTLINE_SIZE);
 		SDL_FreeSurface(txtSurf);
 		txtSurf = outline;
 		/* reset outline to 0 */
 		TTF_SetFontOutline(font, 0);
 	}
 
-	int alignX = rect.x;
-
-	switch (align)
-	{
-	default:
-	case Left :
-		break;
-
-	case Center :
-		alignX += (rect.w - txtSurf->w) / 2;
-		break;
+	float squeeze;
+	FloatRect posRect = alignTextRect(rect, align, txtSurf->w, txtSurf->h,
+	                                  rawTxtSurfH, squeeze);
 
-	case Right :
-		alignX += rect.w - txtSurf->w;
-		break;
-	}
+	p->flushFillsIn(posRect);
 
-	if (alignX < rect.x)
-		alignX = rect.x;
+	if (textCache.enabled())
+	{
+		TextCacheEntry *entry =
+		        textCache.insert(cacheKey, Vec2i(txtSurf->w, txtSurf->h),
+		                         rawTxtSurfH, false);
 
-	int alignY = rect.y + (rect.h - rawTxtSurfH) / 2;
+		if (entry)
+		{
+			TEX::bind(entry->tex.tex);
+			UploadStaging::uploadSubImage(0, 0, txtSurf->w, txtSurf->h,
+			                              txtSurf->pixels, GL_RGBA);
+			SDL_FreeSurface(txtSurf);
 
-	float squeeze = (float) rect.w / txtSurf->w;
+			p->blitCachedText(*entry, posRect, txtAlpha);
+			p->addTaintedArea(posRect);
 
-	if (squeeze > 1)
-		squeeze = 1;
+			p->onModified(posRect);
 
-	FloatRect posRect(alignX, alignY, txtSurf->w * squeeze, txtSurf->h);
+			return;
+		}
+	}
 
 	Vec2i gpTexSize;
 	shState->ensureTexSize(txtSurf->w, txtSurf->h, gpTexSize);
@@ -1123,21 +3284,28 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 					posRect.h = inters.h;
 				}
 
-				TEX::bind(p->gl.tex);
+				/* Usually goes out together with the
+				 * other text drawn during this frame */
+				const IntRect dstRect(inters.x, inters.y, inters.w, inters.h);
 
-				if (!subImage)
-				{
-					TEX::uploadSubImage(posRect.x, posRect.y,
-					                    posRect.w, posRect.h,
-					                    txtSurf->pixels, GL_RGBA);
-				}
-				else
+				if (!p->stageText(txtSurf, subSrcX, subSrcY, dstRect))
 				{
-					GLMeta::subRectImageUpload(txtSurf->w, subSrcX, subSrcY,
-					                           posRect.x, posRect.y,
-					                           posRect.w, posRect.h,
-					                           txtSurf, GL_RGBA);
-					GLMeta::subRectImageEnd();
+					TEX::bind(p->gl.tex);
+
+					if (!subImage)
+					{
+						UploadStaging::uploadSubImage(posRect.x, posRect.y,
+						                              posRect.w, posRect.h,
+						                              txtSurf->pixels, GL_RGBA);
+					}
+					else
+					{
+						GLMeta::subRectImageUpload(txtSurf->w, subSrcX, subSrcY,
+						                           posRect.x, posRect.y,
+						                           posRect.w, posRect.h,
+						                           txtSurf, GL_RGBA);
+						GLMeta::subRectImageEnd();
+					}
 				}
 			}
 		}
@@ -1147,7 +3315,8 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 			TEXFBO &gpTF = shState->gpTexFBO(txtSurf->w, txtSurf->h);
 
 			TEX::bind(gpTF.tex);
-			TEX::uploadSubImage(0, 0, txtSurf->w, txtSurf->h, txtSurf->pixels, GL_RGBA);
+			UploadStaging::uploadSubImage(0, 0, txtSurf->w, txtSurf->h,
+			                              txtSurf->pixels, GL_RGBA);
 
 			GLMeta::blitBegin(p->gl);
 			GLMeta::blitSource(gpTF);
@@ -1155,6 +3324,8 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 			                      posRect, true);
 			GLMeta::blitEnd();
 		}
+
+		p->substractOpaqueArea(posRect);
 	}
 	else
 	{
@@ -1171,7 +3342,7 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 		                  (float) (gpTexSize.x * squeeze) / gpTex2.width,
 		                  (float) gpTexSize.y / gpTex2.height);
 
-		BltShader &shader = shState->shaders().blt;
+		BltShader &shader = shState->shaders().blt();
 		shader.bind();
 		shader.setTexSize(gpTexSize);
 		shader.setSource();
@@ -1180,7 +3351,8 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 		shader.setOpacity(txtAlpha);
 
 		shState->bindTex();
-		TEX::uploadSubImage(0, 0, txtSurf->w, txtSurf->h, txtSurf->pixels, GL_RGBA);
+		UploadStaging::uploadSubImage(0, 0, txtSurf->w, txtSurf->h,
+		                              txtSurf->pixels, GL_RGBA);
 		TEX::setSmooth(true);
 
 		Quad &quad = shState->gpQuad();
@@ -1190,7 +3362,7 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 		p->bindFBO();
 		p->pushSetViewport(shader);
 
-		p->blitQuad(quad);
+		p->blitQuad(quad, shader);
 
 		p->popViewport();
 	}
@@ -1198,7 +3370,7 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 	SDL_FreeSurface(txtSurf);
 	p->addTaintedArea(posRect);
 
-	p->onModified();
+	p->onModified(posRect);
 }
 
 /* http://www.lemoda.net/c/utf8-to-ucs2/index.html */
@@ -1257,7 +3429,7 @@ IntRect Bitmap::textSize(const char *str)
 	str = fixed.c_str();
 
 	int w, h;
-	TTF_SizeUTF8(font, str, &w, &h);
+	shState->textMetrics().size(font, str, w, h);
 
 	/* If str is one character long, *endPtr == 0 */
 	const char *endPtr;
@@ -1271,6 +3443,123 @@ IntRect Bitmap::textSize(const char *str)
 	return IntRect(0, 0, w, h);
 }
 
+/* Byte offsets at which each character of 'str' ends,
+ * stepping the same way TextMetrics::prefixWidths does */
+static void charEnds(const char *str, std::vector<size_t> &out)
+{
+	const char *s = str;
+
+	out.clear();
+
+	while (*s)
+	{
+		const char *chStart = s;
+		uint16_t ch;
+
+		if (!nextUCS2(s, ch))
+			s = chStart + 1;
+
+		out.push_back(s - str);
+	}
+}
+
+int Bitmap::drawTextWrapped(const IntRect &rect, const char *str,
+                            int align, int lineHeight)
+{
+	guardDisposed();
+
+	GUARD_MEGA;
+
+	TTF_Font *font = p->font->getSdlFont();
+	TextMetrics &metrics = shState->textMetrics();
+
+	if (lineHeight <= 0)
+		lineHeight = TTF_FontLineSkip(font);
+
+	std::vector<int> widths;
+	std::vector<size_t> ends;
+
+	int lines = 0;
+	IntRect lineRect(rect.x, rect.y, rect.w, lineHeight);
+
+	const char *para = str;
+
+	while (*para)
+	{
+		/* Explicit line breaks end a paragraph */
+		const char *paraEnd = para + strcspn(para, "\n");
+		std::string rest(para, paraEnd);
+		strReplace(rest, '\r', ' ');
+
+		do
+		{
+			if (lines > 0 && lineRect.y + lineHeight > rect.y + rect.h)
+				return lines;
+
+			metrics.prefixWidths(font, rest.c_str(), widths);
+			charEnds(rest.c_str(), ends);
+
+			size_t lineEnd = rest.size();
+			size_t nextStart = rest.size();
+
+			/* Last character that still fits */
+			size_t fit = 0;
+			while (fit < widths.size() && widths[fit] <= rect.w)
+				++fit;
+
+			if (widths.size() == ends.size() && fit < ends.size())
+			{
+				/* Break before the last space that still
+				 * fits, or in the middle of the word if
+				 * there is none */
+				size_t brk = fit;
+
+				while (brk > 0 && rest[ends[brk] - 1] != ' ')
+					--brk;
+
+				if (brk > 0)
+				{
+					lineEnd = ends[brk] - 1;
+					nextStart = ends[brk];
+				}
+				else
+				{
+					lineEnd = nextStart = ends[std::max<size_t>(fit, 1) - 1];
+				}
+
+				/* Spaces carried over would indent the next line */
+				while (nextStart < rest.size() && rest[nextStart] == ' ')
+					++nextStart;
+			}
+
+			drawText(lineRect, rest.substr(0, lineEnd).c_str(), align);
+
+			++lines;
+			lineRect.y += lineHeight;
+
+			rest.erase(0, nextStart);
+		}
+		while (!rest.empty());
+
+		para = *paraEnd ? paraEnd + 1 : paraEnd;
+	}
+
+	return lines;
+}
+
+void Bitmap::textPrefixWidths(const char *str, std::vector<int> &out)
+{
+	guardDisposed();
+
+	GUARD_MEGA;
+
+	TTF_Font *font = p->font->getSdlFont();
+
+	std::string fixed = fixupString(str);
+
+	shState->textMetrics().prefixWidths(font, fixed.c_str(), out);
+}
+
 DEF_ATTR_RD_SIMPLE(Bitmap, Font, Font&, *p->font)
 
 void Bitmap::setFont(Font &value)
@@ -1285,12 +3574,37 @@ void Bitmap::setInitFont(Font *value)
 
 TEXFBO &Bitmap::getGLTypes()
 {
+	p->finishLoad();
+	p->flushFills();
+	p->decompress();
+
 	return p->gl;
 }
 
-SDL_Surface *Bitmap::megaSurface() const
+bool Bitmap::texturePadded() const
+{
+	p->finishLoad();
+
+	return p->gl.width != p->gl.texW || p->gl.height != p->gl.texH;
+}
+
+Vec2i Bitmap::textureSize() const
+{
+	p->finishLoad();
+
+	return Vec2i(p->gl.texW, p->gl.texH);
+}
+
+bool Bitmap::isMega() const
+{
+	p->finishLoad();
+
+	return p->isMega();
+}
+
+void Bitmap::blitMega(const IntRect &srcRect, const IntRect &dstRect) const
 {
-	return p->megaSurface;
+	p->blitMega(srcRect, dstRect);
 }
 
 void Bitmap::ensureNonMega() const
@@ -1298,25 +3612,170 @@ void Bitmap::ensureNonMega() const
 	if (isDisposed())
 		return;
 
+	p->finishLoad();
+
 	GUARD_MEGA;
 }
 
+void Bitmap::flushReadbacks()
+{
+	while (BitmapPrivate *p = readbackBitmaps.tail())
+	{
+		readbackBitmaps.remove(p->readbackLink);
+		p->prefetch();
+	}
+}
+
+void Bitmap::snapshotTextures()
+{
+	FBOBindingGuard guard;
+
+	IntruListLink<BitmapPrivate> *iter;
+
+	for (iter = liveBitmaps.begin(); iter != liveBitmaps.end(); iter = iter->next)
+	{
+		BitmapPrivate *p = iter->data;
+
+		/* Uploads still in flight have to land first */
+		if (p->upload)
+			p->finishUpload();
+
+		p->takeSnapshot();
+	}
+
+	shState->textCache().clear();
+	shState->atlasCache().clear();
+	shState->spriteAtlas().clear();
+	shState->bitmapCache().clear();
+	shState->texPool().clear();
+}
+
+unsigned int Bitmap::contentStamp() const
+{
+	return p->stamp;
+}
+
+bool Bitmap::isUnmodifiedFile() const
+{
+	return p->fileContents && !p->compressed;
+}
+
+void Bitmap::enforceTextureBudget()
+{
+	++residencyFrame;
+
+	const uint32_t budget = shState->config().textureBudget;
+
+	if (budget == 0)
+		return;
+
+	TexPool &pool = shState->texPool();
+
+	if (pool.liveMemSize() + pool.memSize() <= budget)
+		return;
+
+	/* Textures no one is using go first */
+	shState->atlasCache().clear();
+	shState->bitmapCache().clear();
+	pool.clear();
+
+	/* Then those of the bitmaps used least recently,
+	 * sparing any that were used during the last frame */
+	while (pool.liveMemSize() > budget)
+	{
+		BitmapPrivate *p = residentBitmaps.tail();
+
+		if (!p || p->lastUse + 1 >= residencyFrame)
+			break;
+
+		p->evict();
+
+		shState->bitmapCache().clear();
+		pool.clear();
+	}
+}
+
 void Bitmap::bindTex(ShaderBase &shader)
 {
+	p->finishLoad();
+
+	p->bindTexture(shader);
+}
+
+bool Bitmap::useMipmaps(float zoom) const
+{
+	if (zoom >= MIPMAP_ZOOM || !shState->config().mipmaps)
+		return false;
+
+	if (!gl.npot_repeat)
+		return false;
+
+	p->finishLoad();
+
+	return isUnmodifiedFile() && !p->isMega() &&
+	       p->gl.width == p->gl.texW && p->gl.height == p->gl.texH;
+}
+
+void Bitmap::bindTexMipmapped(ShaderBase &shader)
+{
+	p->finishLoad();
+
 	p->bindTexture(shader);
+
+	if (!p->mipmapped)
+	{
+		TEX::generateMipmaps();
+		p->mipmapped = true;
+	}
+
+	TEX::setMipmapped(true);
+}
+
+void Bitmap::shareAs(const std::string &key)
+{
+	guardDisposed();
+
+	/* Already shared, or not a TexPool texture */
+	if (!p->cacheKey.empty() || p->compressed)
+		return;
+
+	p->flushFills();
+	p->shareTextureAs(key);
 }
 
 void Bitmap::taintArea(const IntRect &rect)
 {
+	p->finishLoad();
+
 	p->addTaintedArea(rect);
+	p->substractOpaqueArea(rect);
+	Scene::markDirty();
+}
+
+void Bitmap::guardDisposed() const
+{
+	Disposable::guardDisposed();
+
+	p->finishLoad();
 }
 
 void Bitmap::releaseResources()
 {
-	if (p->megaSurface)
-		SDL_FreeSurface(p->megaSurface);
+	p->discardFills();
+
+	if (p->upload)
+		p->cancelUpload();
+
+	if (p->loadJob)
+		p->cancelLoad();
+	else if (p->isMega())
+		p->releaseMegaTiles();
 	else
-		shState->texPool().release(p->gl);
+		p->releaseTexture();
+
+	residentBitmaps.remove(p->residentLink);
 
 	delete p;
+
+	Scene::markDirty();
 }
@@ -28,6 +28,9 @@
 
 #include <sigc++/signal.h>
 
+#include <string>
+#include <vector>
+
 class Font;
 class ShaderBase;
 struct TEXFBO;
@@ -73,14 +76,24 @@ public:
 	               int width, int height);
 	void clearRect(const IntRect &rect);
 
-	void blur();
+	/* A 'strength' above 1 (the RGSS blur) is a non-standard
+	 * extension, blurring roughly that many times as far */
+	void blur(int strength = 1);
 	void radialBlur(int angle, int divisions);
 
 	void clear();
 
 	Color getPixel(int x, int y) const;
+
+	/* Writes 'rect' as RGBA8 rows (rect.w * rect.h * 4 bytes)
+	 * to 'data'; pixels outside the bitmap read as 0 */
+	void getPixels(const IntRect &rect, uint8_t *data) const;
 	void setPixel(int x, int y, const Color &color);
 
+	/* Counterpart to 'getPixels'; uploads 'data' in one go.
+	 * Pixels outside the bitmap are skipped */
+	void setPixels(const IntRect &rect, const uint8_t *data);
+
 	void hueChange(int hue);
 
 	enum TextAlign
@@ -99,6 +112,17 @@ public:
 
 	IntRect textSize(const char *str);
 
+	/* Draws 'str' into consecutive lines of 'rect', breaking at
+	 * spaces (or inside words too long for a line) and at '\n'.
+	 * Stops at the bottom of 'rect'; a non-positive 'lineHeight'
+	 * uses the font's line skip. Returns the lines drawn */
+	int drawTextWrapped(const IntRect &rect, const char *str,
+	                    int align = Left, int lineHeight = 0);
+
+	/* Width of 'str' up to and including each of its
+	 * characters, as textSize() would report it */
+	void textPrefixWidths(const char *str, std::vector<int> &out);
+
 	DECL_ATTR(Font, Font&)
 
 	/* Sets initial reference without copying by value,
@@ -106,20 +130,93 @@ public:
 	void setInitFont(Font *value);
 
 	/* <internal> */
+	/* The texture may be shared with other bitmaps
+	 * loaded from the same file; don't render to it
+	 * unless the bitmap was created empty */
 	TEXFBO &getGLTypes();
-	SDL_Surface *megaSurface() const;
+
+	/* Whether the backing texture is larger than the bitmap
+	 * (see TexPool), which rules out texture repeat */
+	bool texturePadded() const;
+
+	/* Dimensions of the backing texture */
+	Vec2i textureSize() const;
+
+	/* Bitmaps too large for a single texture are split into
+	 * several ("mega surfaces"); they can only be blitted from,
+	 * and have no usable getGLTypes() */
+	bool isMega() const;
+
+	/* Blits 'srcRect' of a mega surface to 'dstRect' of the
+	 * current target; call between GLMeta::blitBegin/End() */
+	void blitMega(const IntRect &srcRect, const IntRect &dstRect) const;
 	void ensureNonMega() const;
 
+	/* Identifies the current contents; changes whenever
+	 * the bitmap is modified. Bitmaps sharing a texture
+	 * share the stamp as well */
+	unsigned int contentStamp() const;
+
+	/* Whether the contents are still those of the image
+	 * file the bitmap was loaded from, in a texture that
+	 * can be blitted from without decompressing it */
+	bool isUnmodifiedFile() const;
+
+	/* Called once per frame. While the textures handed out
+	 * by the TexPool exceed the 'textureBudget' config, idle
+	 * caches are emptied and then the textures of unmodified
+	 * file backed bitmaps not used lately are dropped; they're
+	 * loaded again from disk when next used */
+	static void enforceTextureBudget();
+
+	/* Called once per frame. Issues the asynchronous reads of
+	 * bitmaps modified since getPixel was last used on them */
+	static void flushReadbacks();
+
+	/* Called before the app is suspended (with the
+	 * 'snapshotOnSuspend' config). Gives up all bitmap
+	 * textures; those of bitmaps that can't be loaded from
+	 * disk again are kept compressed in RAM meanwhile. Each
+	 * one is restored on its next use */
+	static void snapshotTextures();
+
 	/* Binds the backing texture and sets the correct
 	 * texture size uniform in shader */
 	void bindTex(ShaderBase &shader);
 
+	/* Whether drawing scaled by 'zoom' (the smaller of both
+	 * factors) should sample from mipmaps, which requires
+	 * the 'mipmaps' config and an unmodified file bitmap
+	 * in an unpadded texture */
+	bool useMipmaps(float zoom) const;
+
+	/* Like bindTex(), but with mipmapped minification; the
+	 * mipmaps are generated on first use. Only valid if
+	 * useMipmaps() is true. Call TEX::setMipmapped(false)
+	 * once done drawing */
+	void bindTexMipmapped(ShaderBase &shader);
+
 	/* Adds 'rect' to tainted area */
 	void taintArea(const IntRect &rect);
 
+	/* Offers the texture to the BitmapCache under 'key', if
+	 * it isn't shared already. Until either is modified, it is
+	 * then shared with the bitmaps fromCache() returns for it */
+	void shareAs(const std::string &key);
+
+	/* Returns a new bitmap sharing the texture cached under
+	 * 'key', or null if there's no such entry */
+	static Bitmap *fromCache(const std::string &key);
+
 	sigc::signal<void> modified;
 
 private:
+	/* Shares a texture acquired from the BitmapCache */
+	Bitmap(const TEXFBO &cached, const std::string &key, unsigned int stamp);
+
+	/* Also completes a pending background load */
+	void guardDisposed() const;
+
 	void releaseResources();
 	const char *klassName() const { return "bitmap"; }
 
@@ -0,0 +1,249 @@
+/*
+** bitmapcache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bitmapcache.h"
+
+#include "texpool.h"
+#include "boost-hash.h"
+
+#include <list>
+
+typedef std::list<std::string> KeyList;
+
+struct CacheEntry
+{
+	TEXFBO tex;
+	unsigned int stamp;
+	int refCount;
+
+	/* Not kept around once unreferenced */
+	bool transient;
+
+	/* Position in the LRU list, only valid
+	 * while the entry is unreferenced */
+	KeyList::iterator lruIter;
+};
+
+static uint32_t byteCount(const TEXFBO &tex)
+{
+	return tex.width * tex.height * 4;
+}
+
+struct BitmapCachePrivate
+{
+	TexPool &pool;
+
+	BoostHash<std::string, CacheEntry> hash;
+
+	/* Unreferenced entries, most recently released first */
+	KeyList lru;
+
+	uint32_t maxMemSize;
+
+	/* Size of all entries, referenced or not */
+	uint32_t memSize;
+
+	/* Size of the unreferenced entries only */
+	uint32_t idleSize;
+
+	int count;
+
+	unsigned int hits;
+	unsigned int misses;
+
+	BitmapCachePrivate(TexPool &pool, uint32_t maxMemSize)
+	    : pool(pool),
+	      maxMemSize(maxMemSize),
+	      memSize(0),
+	      idleSize(0),
+	      count(0),
+	      hits(0),
+	      misses(0)
+	{}
+
+	void drop(const std::string &key)
+	{
+		CacheEntry &entry = hash[key];
+		memSize -= byteCount(entry.tex);
+		--count;
+
+		hash.remove(key);
+	}
+
+	void evictLast()
+	{
+		std::string key = lru.back();
+		lru.pop_back();
+
+		CacheEntry &entry = hash[key];
+		idleSize -= byteCount(entry.tex);
+		pool.release(entry.tex);
+
+		drop(key);
+	}
+
+	void trim()
+	{
+		while (idleSize > maxMemSize)
+			evictLast();
+	}
+};
+
+BitmapCache::BitmapCache(TexPool &pool, uint32_t maxMemSize)
+{
+	p = new BitmapCachePrivate(pool, maxMemSize);
+}
+
+BitmapCache::~BitmapCache()
+{
+	clear();
+
+	delete p;
+}
+
+bool BitmapCache::enabled() const
+{
+	return p->maxMemSize > 0;
+}
+
+bool BitmapCache::acquire(const std::string &key, TEXFBO &tex, unsigned int &stamp)
+{
+	if (!p->hash.contains(key))
+	{
+		++p->misses;
+		return false;
+	}
+
+	++p->hits;
+
+	CacheEntry &entry = p->hash[key];
+
+	if (entry.refCount++ == 0)
+	{
+		p->idleSize -= byteCount(entry.tex);
+		p->lru.erase(entry.lruIter);
+	}
+
+	tex = entry.tex;
+	stamp = entry.stamp;
+
+	return true;
+}
+
+bool BitmapCache::insert(const std::string &key, const TEXFBO &tex, unsigned int stamp,
+                         bool transient)
+{
+	if (p->hash.contains(key))
+		return false;
+
+	CacheEntry entry;
+	entry.tex = tex;
+	entry.stamp = stamp;
+	entry.refCount = 1;
+	entry.transient = transient;
+
+	p->hash.insert(key, entry);
+	p->memSize += byteCount(tex);
+	++p->count;
+
+	return true;
+}
+
+void BitmapCache::addRef(const std::string &key)
+{
+	++p->hash[key].refCount;
+}
+
+void BitmapCache::release(const std::string &key)
+{
+	CacheEntry &entry = p->hash[key];
+
+	if (--entry.refCount > 0)
+		return;
+
+	if (entry.transient)
+	{
+		p->pool.release(entry.tex);
+		p->drop(key);
+
+		return;
+	}
+
+	p->lru.push_front(key);
+	entry.lruIter = p->lru.begin();
+	p->idleSize += byteCount(entry.tex);
+
+	p->trim();
+}
+
+bool BitmapCache::detach(const std::string &key)
+{
+	CacheEntry &entry = p->hash[key];
+
+	if (--entry.refCount > 0)
+		return false;
+
+	p->drop(key);
+
+	return true;
+}
+
+void BitmapCache::clear()
+{
+	while (!p->lru.empty())
+		p->evictLast();
+}
+
+uint32_t BitmapCache::maxMemSize() const
+{
+	return p->maxMemSize;
+}
+
+void BitmapCache::setMaxMemSize(uint32_t value)
+{
+	p->maxMemSize = value;
+	p->trim();
+}
+
+unsigned int BitmapCache::hits() const
+{
+	return p->hits;
+}
+
+unsigned int BitmapCache::misses() const
+{
+	return p->misses;
+}
+
+uint32_t BitmapCache::idleMemSize() const
+{
+	return p->idleSize;
+}
+
+uint32_t BitmapCache::memSize() const
+{
+	return p->memSize;
+}
+
+int BitmapCache::entryCount() const
+{
+	return p->count;
+}
@@ -0,0 +1,94 @@
+/*
+** bitmapcache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITMAPCACHE_H
+#define BITMAPCACHE_H
+
+#include "gl-util.h"
+
+#include <string>
+#include <stdint.h>
+
+class TexPool;
+struct BitmapCachePrivate;
+
+/* Shares the textures of Bitmaps loaded from the same image
+ * file. Entries are keyed by normalized path and refcounted;
+ * a Bitmap about to modify a shared texture detaches from its
+ * entry first and continues on a private copy.
+ * Textures no longer referenced by any Bitmap are kept around
+ * (least recently used first to go) up to 'maxMemSize', so
+ * that reloading a just disposed image is free as well.
+ * Copied Bitmaps share their texture through 'transient'
+ * entries, which go back to the pool with the last reference */
+class BitmapCache
+{
+public:
+	BitmapCache(TexPool &pool, uint32_t maxMemSize);
+	~BitmapCache();
+
+	bool enabled() const;
+
+	/* On a hit, takes a reference and returns true.
+	 * 'stamp' receives the content stamp of the texture */
+	bool acquire(const std::string &key, TEXFBO &tex, unsigned int &stamp);
+
+	/* Registers a freshly loaded texture with a reference
+	 * held by the caller, and the content stamp of the bitmap
+	 * it was loaded into. Returns false (and leaves 'tex'
+	 * to the caller) if 'key' is already cached */
+	bool insert(const std::string &key, const TEXFBO &tex, unsigned int stamp,
+	            bool transient = false);
+
+	/* Takes another reference to an entry the
+	 * caller already holds one to */
+	void addRef(const std::string &key);
+
+	/* Drops a reference */
+	void release(const std::string &key);
+
+	/* Drops a reference with the intent of modifying the
+	 * texture. If no one else holds it, the entry is removed
+	 * and ownership of the texture passes to the caller (true
+	 * is returned). Otherwise the caller has to make a copy */
+	bool detach(const std::string &key);
+
+	/* Returns all unreferenced textures to the pool */
+	void clear();
+
+	/* Bounds the unreferenced textures only; lowering
+	 * it evicts them until it is met again */
+	uint32_t maxMemSize() const;
+	void setMaxMemSize(uint32_t value);
+
+	unsigned int hits() const;
+	unsigned int misses() const;
+
+	/* Of the unreferenced textures only */
+	uint32_t idleMemSize() const;
+	uint32_t memSize() const;
+	int entryCount() const;
+
+private:
+	BitmapCachePrivate *p;
+};
+
+#endif // BITMAPCACHE_H
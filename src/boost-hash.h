@@ -58,6 +58,11 @@ public:
 		p.erase(key);
 	}
 
+	inline void clear()
+	{
+		p.clear();
+	}
+
 	inline const V value(const K &key) const
 	{
 		const_iterator iter = p.find(key);
@@ -0,0 +1,307 @@
+/*
+** budgettuner.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "budgettuner.h"
+
+#include "config.h"
+#include "sharedstate.h"
+#include "texpool.h"
+#include "textcache.h"
+#include "bitmapcache.h"
+#include "atlascache.h"
+#include "debugwriter.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __vita__
+#include <psp2/kernel/sysmem.h>
+#endif
+
+/* Budgets are only raised on behalf of caches missing at least
+ * this often per pass, and at most this share of the lookups */
+#define MIN_MISSES 8
+#define MAX_MISS_PERCENT 10
+
+enum Budget
+{
+	TexPoolBudget = 0,
+	TextCacheBudget,
+	BitmapCacheBudget,
+	AtlasCacheBudget,
+
+	BudgetCount
+};
+
+static const char *budgetNames[] =
+{
+	"texPoolSize",
+	"textCacheSize",
+	"bitmapCacheSize",
+	"atlasCacheSize"
+};
+
+struct BudgetState
+{
+	bool tuned;
+	uint32_t floor;
+	uint32_t ceiling;
+
+	/* Counters as of the last pass */
+	unsigned int hits;
+	unsigned int misses;
+};
+
+struct BudgetStats
+{
+	uint32_t budget;
+	/* Memory the cache currently keeps */
+	uint32_t used;
+	unsigned int hits;
+	unsigned int misses;
+};
+
+static BudgetStats readStats(Budget b)
+{
+	BudgetStats s;
+
+	switch (b)
+	{
+	case TexPoolBudget :
+	{
+		TexPool &pool = shState->texPool();
+		s.budget = pool.maxMemSize();
+		s.used = pool.memSize();
+		s.hits = pool.hits();
+		s.misses = pool.misses();
+		break;
+	}
+	case TextCacheBudget :
+	{
+		TextCache &cache = shState->textCache();
+		s.budget = cache.maxMemSize();
+		s.used = cache.memSize();
+		s.hits = cache.hits();
+		s.misses = cache.misses();
+		break;
+	}
+	case BitmapCacheBudget :
+	{
+		BitmapCache &cache = shState->bitmapCache();
+		s.budget = cache.maxMemSize();
+		s.used = cache.idleMemSize();
+		s.hits = cache.hits();
+		s.misses = cache.misses();
+		break;
+	}
+	default :
+	{
+		AtlasCache &cache = shState->atlasCache();
+		s.budget = cache.maxMemSize();
+		s.used = cache.memSize();
+		s.hits = cache.hits();
+		s.misses = cache.misses();
+		break;
+	}
+	}
+
+	return s;
+}
+
+static void setBudget(Budget b, uint32_t value)
+{
+	switch (b)
+	{
+	case TexPoolBudget :
+		shState->texPool().setMaxMemSize(value);
+		break;
+	case TextCacheBudget :
+		shState->textCache().setMaxMemSize(value);
+		break;
+	case BitmapCacheBudget :
+		shState->bitmapCache().setMaxMemSize(value);
+		break;
+	default :
+		shState->atlasCache().setMaxMemSize(value);
+		break;
+	}
+}
+
+/* Returns -1 where it can't be told */
+static int64_t freeMemory()
+{
+#ifdef __vita__
+	SceKernelFreeMemorySizeInfo info;
+	info.size = sizeof(info);
+
+	if (sceKernelGetFreeMemorySize(&info) < 0)
+		return -1;
+
+	return (int64_t) info.size_user + info.size_cdram + info.size_phycont;
+#else
+	return -1;
+#endif
+}
+
+struct BudgetTunerPrivate
+{
+	const Config &conf;
+	BudgetState states[BudgetCount];
+
+	bool enabled;
+	int frames;
+
+	BudgetTunerPrivate(const Config &conf)
+	    : conf(conf),
+	      enabled(false),
+	      frames(0)
+	{
+		const int initial[] =
+		{
+			conf.performance.texPoolSize,
+			conf.textCacheSize,
+			conf.bitmapCacheSize,
+			conf.atlasCacheSize
+		};
+
+		for (int i = 0; i < BudgetCount; ++i)
+		{
+			BudgetState &s = states[i];
+			const uint32_t size = initial[i];
+
+			s.tuned = conf.performance.autoTune && size > 0;
+			s.floor = std::max<uint32_t>(size / 4, 1);
+			s.ceiling = std::min<uint64_t>((uint64_t) size * 4, 0x7FFFFFFF);
+			s.hits = s.misses = 0;
+
+			enabled |= s.tuned;
+		}
+	}
+
+	void tune()
+	{
+		const int64_t freeMem = freeMemory();
+		const int64_t reserve = conf.performance.memoryReserve;
+		const uint64_t limit = conf.performance.tuneLimit;
+
+		const bool lowMemory = freeMem >= 0 && freeMem < reserve;
+
+		/* Leave half of what's free beyond the reserve to others */
+		int64_t headroom = freeMem >= 0 ? (freeMem - reserve) / 2 : -1;
+
+		BudgetStats stats[BudgetCount];
+		uint64_t total = 0;
+
+		for (int i = 0; i < BudgetCount; ++i)
+		{
+			if (!states[i].tuned)
+				continue;
+
+			stats[i] = readStats((Budget) i);
+			total += stats[i].budget;
+		}
+
+		for (int i = 0; i < BudgetCount; ++i)
+		{
+			BudgetState &s = states[i];
+
+			if (!s.tuned)
+				continue;
+
+			const BudgetStats &st = stats[i];
+
+			const unsigned int hits = st.hits - s.hits;
+			const unsigned int misses = st.misses - s.misses;
+			s.hits = st.hits;
+			s.misses = st.misses;
+
+			const unsigned int lookups = hits + misses;
+			const bool full = st.used >= st.budget - st.budget / 8;
+
+			uint32_t target = st.budget;
+
+			if (lowMemory)
+			{
+				target = std::max(s.floor, st.budget - st.budget / 4);
+			}
+			else if (full && misses >= MIN_MISSES
+			         && misses * 100 > lookups * MAX_MISS_PERCENT)
+			{
+				uint64_t growth = std::min<uint64_t>(st.budget / 4 + 1,
+				                                     s.ceiling - std::min(s.ceiling, st.budget));
+
+				if (limit > 0)
+					growth = std::min(growth, limit - std::min(limit, total));
+
+				if (freeMem >= 0)
+				{
+					growth = std::min<uint64_t>(growth, std::max<int64_t>(headroom, 0));
+					headroom -= (int64_t) growth;
+				}
+
+				target = st.budget + growth;
+			}
+
+			if (target == st.budget)
+				continue;
+
+			setBudget((Budget) i, target);
+			total = total - st.budget + target;
+
+			char line[192];
+			int len = snprintf(line, sizeof(line),
+			                   "Auto-tune: %s %u -> %u (%u of %u lookups missed",
+			                   budgetNames[i], st.budget, target, misses, lookups);
+
+			if (freeMem >= 0)
+				snprintf(line + len, sizeof(line) - len, ", %d KB free)",
+				         (int) (freeMem / 1024));
+			else
+				snprintf(line + len, sizeof(line) - len, ")");
+
+			Debug() << line;
+		}
+	}
+};
+
+BudgetTuner::BudgetTuner(const Config &conf)
+{
+	p = new BudgetTunerPrivate(conf);
+}
+
+BudgetTuner::~BudgetTuner()
+{
+	delete p;
+}
+
+void BudgetTuner::update()
+{
+	if (!p->enabled)
+		return;
+
+	if (++p->frames < p->conf.performance.tuneInterval)
+		return;
+
+	p->frames = 0;
+	p->tune();
+}
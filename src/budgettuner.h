@@ -0,0 +1,48 @@
+/*
+** budgettuner.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BUDGETTUNER_H
+#define BUDGETTUNER_H
+
+struct Config;
+struct BudgetTunerPrivate;
+
+/* Revisits the budgets of the texture pool and the texture
+ * caches every few hundred frames ('performance.autoTune'):
+ * a cache that is full and keeps missing gets more room, as
+ * long as the combined limit and free memory allow it, and
+ * all of them give some back while free memory runs low.
+ * Every change is logged */
+class BudgetTuner
+{
+public:
+	BudgetTuner(const Config &conf);
+	~BudgetTuner();
+
+	/* Called once per frame */
+	void update();
+
+private:
+	BudgetTunerPrivate *p;
+};
+
+#endif // BUDGETTUNER_H
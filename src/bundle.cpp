@@ -0,0 +1,772 @@
+/*
+** bundle.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "bundle.h"
+#include "exception.h"
+#include "debugwriter.h"
+
+#include <zlib.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* File layout, all integers little endian:
+ *
+ *  header  magic[8], version u32, entry count u32,
+ *          names size u32, reserved u32
+ *  index   per entry: data offset u64, size u32, stored size u32,
+ *          name offset u32, name length u16, compression u8,
+ *          reserved u8; sorted by (bytewise) path
+ *  names   the entry paths, '/' separated and not terminated
+ *  data    the entries, the ones of at least BUNDLE_ALIGN bytes
+ *          aligned to a multiple of it */
+#define BUNDLE_MAGIC "MKXPBNDL"
+#define BUNDLE_VERSION 1
+
+#define HEADER_SIZE 24
+#define INDEX_ENTRY_SIZE 24
+
+#define BUNDLE_ALIGN 4096
+#define SMALL_ALIGN 16
+
+enum Compression
+{
+	Stored   = 0,
+	Deflated = 1
+};
+
+#define PHYSFS_ALLOC(type) \
+	static_cast<type*>(PHYSFS_getAllocator()->Malloc(sizeof(type)))
+
+#define IO_READ(io, dest, size) (io->read(io, dest, size) == (PHYSFS_sint64) (size))
+
+static uint32_t getU32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t getU64(const uint8_t *p)
+{
+	return getU32(p) | ((uint64_t) getU32(p+4) << 32);
+}
+
+static void putU32(uint8_t *p, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		p[i] = value >> (i*8);
+}
+
+static void putU64(uint8_t *p, uint64_t value)
+{
+	putU32(p, value);
+	putU32(p+4, value >> 32);
+}
+
+struct BundleEntry
+{
+	/* Points into the names table */
+	const char *name;
+	uint16_t nameLen;
+
+	uint64_t offset;
+	uint32_t size;
+	uint32_t storedSize;
+	uint8_t compression;
+};
+
+struct BundleData
+{
+	PHYSFS_Io *archiveIo;
+
+	/* Index and names table as read from the file */
+	std::vector<uint8_t> table;
+
+	/* Sorted by path */
+	std::vector<BundleEntry> entries;
+};
+
+struct PathKey
+{
+	const char *str;
+	size_t len;
+
+	PathKey(const char *str, size_t len)
+	    : str(str), len(len)
+	{}
+};
+
+static int comparePath(const char *a, size_t aLen, const char *b, size_t bLen)
+{
+	int result = memcmp(a, b, std::min(aLen, bLen));
+
+	if (result != 0)
+		return result;
+
+	return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+static bool entryBefore(const BundleEntry &entry, const PathKey &key)
+{
+	return comparePath(entry.name, entry.nameLen, key.str, key.len) < 0;
+}
+
+typedef std::vector<BundleEntry>::const_iterator EntryIter;
+
+static EntryIter lowerBound(const BundleData *data, const PathKey &key)
+{
+	return std::lower_bound(data->entries.begin(), data->entries.end(),
+	                        key, entryBefore);
+}
+
+static bool hasPrefix(const BundleEntry &entry, const std::string &prefix)
+{
+	return entry.nameLen >= prefix.size() &&
+	       !memcmp(entry.name, prefix.c_str(), prefix.size());
+}
+
+static const BundleEntry *findEntry(const BundleData *data, const char *path)
+{
+	PathKey key(path, strlen(path));
+	EntryIter iter = lowerBound(data, key);
+
+	if (iter == data->entries.end() ||
+	    comparePath(iter->name, iter->nameLen, key.str, key.len) != 0)
+		return 0;
+
+	return &*iter;
+}
+
+/* Directories aren't stored; they exist as
+ * long as any entry path descends into them */
+static bool hasDir(const BundleData *data, const char *path)
+{
+	if (!*path)
+		return true;
+
+	const std::string prefix = std::string(path) + "/";
+	EntryIter iter = lowerBound(data, PathKey(prefix.c_str(), prefix.size()));
+
+	return iter != data->entries.end() && hasPrefix(*iter, prefix);
+}
+
+struct BundleHandle
+{
+	const BundleEntry entry;
+	uint64_t currentOffset;
+
+	/* Stored entries are read from their own
+	 * duplicate of the archive stream */
+	PHYSFS_Io *io;
+	int64_t ioOffset;
+
+	/* Deflated entries are inflated as a whole on open */
+	std::vector<uint8_t> inflated;
+
+	BundleHandle(const BundleEntry &entry)
+	    : entry(entry),
+	      currentOffset(0),
+	      io(0),
+	      ioOffset(-1)
+	{}
+
+	BundleHandle(const BundleHandle &other)
+	    : entry(other.entry),
+	      currentOffset(other.currentOffset),
+	      io(0),
+	      ioOffset(-1),
+	      inflated(other.inflated)
+	{
+		if (other.io)
+			io = other.io->duplicate(other.io);
+	}
+
+	~BundleHandle()
+	{
+		if (io)
+			io->destroy(io);
+	}
+};
+
+static PHYSFS_sint64
+Bundle_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
+{
+	BundleHandle *handle = static_cast<BundleHandle*>(self->opaque);
+	const BundleEntry &entry = handle->entry;
+
+	uint64_t toRead = std::min<uint64_t>(entry.size - handle->currentOffset, len);
+
+	if (toRead == 0)
+		return 0;
+
+	if (entry.compression == Deflated)
+	{
+		memcpy(buffer, &handle->inflated[handle->currentOffset], toRead);
+		handle->currentOffset += toRead;
+
+		return toRead;
+	}
+
+	PHYSFS_Io *io = handle->io;
+	int64_t archOffs = entry.offset + handle->currentOffset;
+
+	if (handle->ioOffset != archOffs)
+	{
+		if (!io->seek(io, archOffs))
+		{
+			handle->ioOffset = -1;
+			return -1;
+		}
+
+		handle->ioOffset = archOffs;
+	}
+
+	PHYSFS_sint64 count = io->read(io, buffer, toRead);
+
+	if (count < 0)
+	{
+		handle->ioOffset = -1;
+		return -1;
+	}
+
+	handle->ioOffset += count;
+	handle->currentOffset += count;
+
+	return count;
+}
+
+static int
+Bundle_ioSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
+{
+	BundleHandle *handle = static_cast<BundleHandle*>(self->opaque);
+
+	if (offset > handle->entry.size)
+		return 0;
+
+	handle->currentOffset = offset;
+
+	return 1;
+}
+
+static PHYSFS_sint64
+Bundle_ioTell(PHYSFS_Io *self)
+{
+	const BundleHandle *handle = static_cast<BundleHandle*>(self->opaque);
+
+	return handle->currentOffset;
+}
+
+static PHYSFS_sint64
+Bundle_ioLength(PHYSFS_Io *self)
+{
+	const BundleHandle *handle = static_cast<BundleHandle*>(self->opaque);
+
+	return handle->entry.size;
+}
+
+static PHYSFS_Io*
+Bundle_ioDuplicate(PHYSFS_Io *self)
+{
+	const BundleHandle *handle = static_cast<BundleHandle*>(self->opaque);
+
+	PHYSFS_Io *dup = PHYSFS_ALLOC(PHYSFS_Io);
+	*dup = *self;
+	dup->opaque = new BundleHandle(*handle);
+
+	return dup;
+}
+
+static void
+Bundle_ioDestroy(PHYSFS_Io *self)
+{
+	BundleHandle *handle = static_cast<BundleHandle*>(self->opaque);
+
+	delete handle;
+
+	PHYSFS_getAllocator()->Free(self);
+}
+
+static const PHYSFS_Io Bundle_IoTemplate =
+{
+    0, /* version */
+    0, /* opaque */
+    Bundle_ioRead,
+    0, /* write */
+    Bundle_ioSeek,
+    Bundle_ioTell,
+    Bundle_ioLength,
+    Bundle_ioDuplicate,
+    0, /* flush */
+    Bundle_ioDestroy
+};
+
+static void*
+Bundle_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
+{
+	if (forWrite)
+		return NULL;
+
+	uint8_t header[HEADER_SIZE];
+
+	if (!IO_READ(io, header, sizeof(header)))
+		return NULL;
+
+	if (memcmp(header, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)-1))
+		return NULL;
+	else
+		*claimed = 1;
+
+	if (getU32(&header[8]) != BUNDLE_VERSION)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_UNSUPPORTED);
+		return NULL;
+	}
+
+	const uint32_t count = getU32(&header[12]);
+	const uint32_t namesSize = getU32(&header[16]);
+	const uint64_t indexSize = (uint64_t) count * INDEX_ENTRY_SIZE;
+
+	BundleData *data = new BundleData;
+	data->archiveIo = io;
+
+	/* Index and names are contiguous, so one read covers both */
+	data->table.resize(indexSize + namesSize);
+
+	if (!data->table.empty() && !IO_READ(io, &data->table[0], data->table.size()))
+		goto error;
+
+	{
+		const char *names = reinterpret_cast<const char*>(&data->table[indexSize]);
+		data->entries.resize(count);
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const uint8_t *rec = &data->table[i*INDEX_ENTRY_SIZE];
+			BundleEntry &entry = data->entries[i];
+
+			uint32_t nameOffset = getU32(&rec[16]);
+
+			entry.offset = getU64(&rec[0]);
+			entry.size = getU32(&rec[8]);
+			entry.storedSize = getU32(&rec[12]);
+			entry.nameLen = rec[20] | (rec[21] << 8);
+			entry.compression = rec[22];
+			entry.name = names + nameOffset;
+
+			if ((uint64_t) nameOffset + entry.nameLen > namesSize)
+				goto error;
+
+			if (entry.compression != Stored && entry.compression != Deflated)
+				goto error;
+
+			/* Lookups rely on the ordering */
+			if (i > 0 && !entryBefore(data->entries[i-1],
+			                          PathKey(entry.name, entry.nameLen)))
+				goto error;
+		}
+	}
+
+	return data;
+
+error:
+	PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+	delete data;
+
+	return NULL;
+}
+
+static PHYSFS_EnumerateCallbackResult
+Bundle_enumerateFiles(void *opaque, const char *dirname,
+                      PHYSFS_EnumerateCallback cb,
+                      const char *origdir, void *callbackdata)
+{
+	const BundleData *data = static_cast<BundleData*>(opaque);
+
+	if (!hasDir(data, dirname))
+		return PHYSFS_ENUM_STOP;
+
+	const std::string prefix = *dirname ? std::string(dirname) + "/" : "";
+	EntryIter iter = lowerBound(data, PathKey(prefix.c_str(), prefix.size()));
+
+	/* All paths below a subdirectory sort next to each other,
+	 * so skipping repeats of the previous name is enough */
+	std::string prevName;
+
+	for (; iter != data->entries.end() && hasPrefix(*iter, prefix); ++iter)
+	{
+		const char *rest = iter->name + prefix.size();
+		const size_t restLen = iter->nameLen - prefix.size();
+
+		const char *slash = static_cast<const char*>(memchr(rest, '/', restLen));
+		const size_t nameLen = slash ? slash - rest : restLen;
+
+		if (prevName.size() == nameLen && !memcmp(prevName.c_str(), rest, nameLen))
+			continue;
+
+		prevName.assign(rest, nameLen);
+
+		PHYSFS_EnumerateCallbackResult result =
+		        cb(callbackdata, origdir, prevName.c_str());
+
+		if (result != PHYSFS_ENUM_OK)
+			return result;
+	}
+
+	return PHYSFS_ENUM_OK;
+}
+
+static PHYSFS_Io*
+Bundle_openRead(void *opaque, const char *filename)
+{
+	BundleData *data = static_cast<BundleData*>(opaque);
+	const BundleEntry *entry = findEntry(data, filename);
+
+	if (!entry)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+		return 0;
+	}
+
+	BundleHandle *handle = new BundleHandle(*entry);
+	PHYSFS_Io *archIo = data->archiveIo;
+
+	if (entry->compression == Stored)
+	{
+		handle->io = archIo->duplicate(archIo);
+
+		if (!handle->io)
+		{
+			delete handle;
+			return 0;
+		}
+	}
+	else
+	{
+		std::vector<uint8_t> stored(entry->storedSize);
+		uLongf outSize = entry->size;
+		handle->inflated.resize(entry->size);
+
+		PHYSFS_Io *io = archIo->duplicate(archIo);
+		bool success = io && io->seek(io, entry->offset) &&
+		        (stored.empty() || IO_READ(io, &stored[0], stored.size()));
+
+		if (io)
+			io->destroy(io);
+
+		if (success && entry->size > 0)
+			success = uncompress(&handle->inflated[0], &outSize,
+			                     &stored[0], stored.size()) == Z_OK &&
+			          outSize == entry->size;
+
+		if (!success)
+		{
+			PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+			delete handle;
+			return 0;
+		}
+	}
+
+	PHYSFS_Io *io = PHYSFS_ALLOC(PHYSFS_Io);
+
+	*io = Bundle_IoTemplate;
+	io->opaque = handle;
+
+	return io;
+}
+
+static int
+Bundle_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
+{
+	const BundleData *data = static_cast<BundleData*>(opaque);
+
+	const BundleEntry *entry = findEntry(data, filename);
+
+	if (!entry && !hasDir(data, filename))
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+		return 0;
+	}
+
+	stat->modtime    =
+	stat->createtime =
+	stat->accesstime = 0;
+	stat->readonly   = 1;
+
+	if (entry)
+	{
+		stat->filesize = entry->size;
+		stat->filetype = PHYSFS_FILETYPE_REGULAR;
+	}
+	else
+	{
+		stat->filesize = 0;
+		stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+	}
+
+	return 1;
+}
+
+static void
+Bundle_closeArchive(void *opaque)
+{
+	BundleData *data = static_cast<BundleData*>(opaque);
+
+	delete data;
+}
+
+static PHYSFS_Io*
+Bundle_noop1(void*, const char*)
+{
+	return 0;
+}
+
+static int
+Bundle_noop2(void*, const char*)
+{
+	return 0;
+}
+
+const PHYSFS_Archiver Bundle_Archiver =
+{
+	0,
+	{
+		"MKXPB",
+		"mkxp asset bundle format",
+		"", /* Author */
+		"", /* Website */
+		0 /* symlinks not supported */
+	},
+	Bundle_openArchive,
+	Bundle_enumerateFiles,
+	Bundle_openRead,
+	Bundle_noop1, /* openWrite */
+	Bundle_noop1, /* openAppend */
+	Bundle_noop2, /* remove */
+	Bundle_noop2, /* mkdir */
+	Bundle_stat,
+	Bundle_closeArchive
+};
+
+static bool isArchivePath(const std::string &path)
+{
+	static const char *exts[] =
+	{
+		".rgssad", ".rgss2a", ".rgss3a", BUNDLE_EXT
+	};
+
+	/* Only mounted from the game's top level directory */
+	if (path.find('/') != std::string::npos)
+		return false;
+
+	std::string lower = path;
+	for (size_t i = 0; i < lower.size(); ++i)
+		lower[i] = tolower(lower[i]);
+
+	for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i)
+	{
+		const size_t len = strlen(exts[i]);
+
+		if (lower.size() > len && !lower.compare(lower.size() - len, len, exts[i]))
+			return true;
+	}
+
+	return false;
+}
+
+static PHYSFS_EnumerateCallbackResult
+packEnumCB(void *d, const char *origdir, const char *fname)
+{
+	std::vector<std::string> &files = *static_cast<std::vector<std::string>*>(d);
+
+	std::string path = *origdir ? std::string(origdir) + "/" + fname : fname;
+
+	PHYSFS_Stat stat;
+
+	if (!PHYSFS_stat(path.c_str(), &stat))
+		return PHYSFS_ENUM_OK;
+
+	if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY)
+		PHYSFS_enumerate(path.c_str(), packEnumCB, d);
+	else if (!isArchivePath(path))
+		files.push_back(path);
+
+	return PHYSFS_ENUM_OK;
+}
+
+static void readPhysfsFile(const std::string &path, std::vector<uint8_t> &out)
+{
+	PHYSFS_File *handle = PHYSFS_openRead(path.c_str());
+
+	if (!handle)
+		throw Exception(Exception::PHYSFSError, "Cannot read '%s'", path.c_str());
+
+	PHYSFS_sint64 length = PHYSFS_fileLength(handle);
+	out.resize(std::max<PHYSFS_sint64>(length, 0));
+
+	bool success = length >= 0 && (out.empty() ||
+	        PHYSFS_readBytes(handle, &out[0], out.size()) == length);
+
+	PHYSFS_close(handle);
+
+	if (!success)
+		throw Exception(Exception::PHYSFSError, "Cannot read '%s'", path.c_str());
+}
+
+struct PackWriter
+{
+	FILE *f;
+	const char *filename;
+	uint64_t pos;
+
+	PackWriter(const char *filename)
+	    : filename(filename), pos(0)
+	{
+		f = fopen(filename, "wb");
+
+		if (!f)
+			throw Exception(Exception::MKXPError,
+			                "Cannot create bundle '%s'", filename);
+	}
+
+	~PackWriter()
+	{
+		fclose(f);
+	}
+
+	void write(const void *data, size_t size)
+	{
+		if (size > 0 && fwrite(data, 1, size, f) != size)
+			throw Exception(Exception::MKXPError,
+			                "Error writing bundle '%s'", filename);
+
+		pos += size;
+	}
+
+	void padTo(uint64_t align)
+	{
+		static const uint8_t zeros[BUNDLE_ALIGN] = { 0 };
+		write(zeros, (align - pos % align) % align);
+	}
+
+	void rewind()
+	{
+		if (fseek(f, 0, SEEK_SET) != 0)
+			throw Exception(Exception::MKXPError,
+			                "Error writing bundle '%s'", filename);
+
+		pos = 0;
+	}
+};
+
+void Bundle_pack(const char *outFile)
+{
+	std::vector<std::string> files;
+	PHYSFS_enumerate("", packEnumCB, &files);
+
+	/* Earlier mounts shadow later ones, which PhysFS' merged
+	 * view already accounts for; only the order is left */
+	std::sort(files.begin(), files.end());
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+
+	std::string names;
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (files[i].size() > 0xFFFF)
+			throw Exception(Exception::MKXPError,
+			                "Path too long for bundle: '%s'", files[i].c_str());
+
+		names += files[i];
+	}
+
+	std::vector<uint8_t> table(files.size() * INDEX_ENTRY_SIZE + names.size());
+	memcpy(&table[files.size() * INDEX_ENTRY_SIZE], names.c_str(), names.size());
+
+	PackWriter w(outFile);
+
+	/* The index is filled in and rewritten once
+	 * the entry offsets and sizes are known */
+	uint8_t header[HEADER_SIZE] = { 0 };
+	memcpy(header, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)-1);
+	putU32(&header[8], BUNDLE_VERSION);
+	putU32(&header[12], files.size());
+	putU32(&header[16], names.size());
+
+	w.write(header, sizeof(header));
+	w.write(table.empty() ? 0 : &table[0], table.size());
+
+	std::vector<uint8_t> data, deflated;
+	uint32_t nameOffset = 0;
+	uint64_t totalSize = 0, totalStored = 0;
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		readPhysfsFile(files[i], data);
+
+		if (data.size() > 0xFFFFFFFF)
+			throw Exception(Exception::MKXPError,
+			                "File too large for bundle: '%s'", files[i].c_str());
+
+		/* Only keep the deflated data if it saves at
+		 * least an eighth, as it has to be inflated
+		 * as a whole whenever the entry is opened */
+		uLongf deflatedSize = compressBound(data.size());
+		deflated.resize(deflatedSize);
+
+		bool deflate = !data.empty() &&
+		        compress2(&deflated[0], &deflatedSize, &data[0], data.size(),
+		                  Z_BEST_COMPRESSION) == Z_OK &&
+		        deflatedSize < data.size() - data.size() / 8;
+
+		const std::vector<uint8_t> &stored = deflate ? deflated : data;
+		const size_t storedSize = deflate ? deflatedSize : data.size();
+
+		w.padTo(storedSize >= BUNDLE_ALIGN ? BUNDLE_ALIGN : SMALL_ALIGN);
+
+		uint8_t *rec = &table[i*INDEX_ENTRY_SIZE];
+		putU64(&rec[0], w.pos);
+		putU32(&rec[8], data.size());
+		putU32(&rec[12], storedSize);
+		putU32(&rec[16], nameOffset);
+		rec[20] = files[i].size() & 0xFF;
+		rec[21] = files[i].size() >> 8;
+		rec[22] = deflate ? Deflated : Stored;
+		rec[23] = 0;
+
+		w.write(stored.empty() ? 0 : &stored[0], storedSize);
+
+		nameOffset += files[i].size();
+		totalSize += data.size();
+		totalStored += storedSize;
+	}
+
+	w.rewind();
+	w.write(header, sizeof(header));
+	w.write(table.empty() ? 0 : &table[0], table.size());
+
+	Debug() << "Packed" << files.size() << "files into" << outFile
+	        << "(" << totalStored / 1024 << "KiB stored," << totalSize / 1024 << "KiB total)";
+}
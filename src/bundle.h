@@ -0,0 +1,42 @@
+/*
+** bundle.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <physfs.h>
+
+#define BUNDLE_EXT ".mkxpb"
+
+/* mkxp's own asset bundle format. Unlike RGSSAD archives it needs
+ * no decryption, and all entry headers sit in one table sorted by
+ * path at the start of the file, so mounting it takes a single read
+ * and lookups are a binary search. Entries are stored or deflated,
+ * larger ones start on a page boundary so they can be mapped */
+extern const PHYSFS_Archiver Bundle_Archiver;
+
+/* Writes everything currently visible through PhysFS, except for
+ * game archives and bundles, into a new bundle at 'outFile'.
+ * Throws Exception on error */
+void Bundle_pack(const char *outFile);
+
+#endif // BUNDLE_H
@@ -135,6 +135,14 @@ static std::string prefPath(const char *org, const char *app)
 	return str;
 }
 
+static void clampStreamBuffers(int &count, int &size)
+{
+	count = clamp(count, 2, 16);
+
+	/* Keep whole stereo frames / midi ticks per buffer */
+	size = clamp(size, 1024, 1048576) & ~63;
+}
+
 template<typename T>
 std::set<T> setFromVec(const std::vector<T> &vec)
 {
@@ -155,18 +163,43 @@ void Config::read(int argc, char *argv[])
 	PO_DESC(rgssVersion, int, 0) \
 	PO_DESC(debugMode, bool, false) \
 	PO_DESC(printFPS, bool, false) \
+	PO_DESC(profiler, bool, false) \
+	PO_DESC(profilerTrace, std::string, "") \
+	PO_DESC(inputRecord, std::string, "") \
+	PO_DESC(inputReplay, std::string, "") \
+	PO_DESC(replayFrames, int, 0) \
+	PO_DESC(replayReport, std::string, "replay-report.json") \
+	PO_DESC(randomSeed, int, 0) \
+	PO_DESC(sceneReplay, std::string, "") \
 	PO_DESC(winResizable, bool, false) \
 	PO_DESC(fullscreen, bool, false) \
 	PO_DESC(fixedAspectRatio, bool, true) \
 	PO_DESC(smoothScaling, bool, true) \
+	PO_DESC(scalingMode, std::string, "") \
+	PO_DESC(dynamicResolution, bool, false) \
+	PO_DESC(directRender, bool, true) \
+	PO_DESC(skipUnchangedFrames, bool, true) \
 	PO_DESC(vsync, bool, false) \
 	PO_DESC(defScreenW, int, 0) \
 	PO_DESC(defScreenH, int, 0) \
 	PO_DESC(windowTitle, std::string, "") \
 	PO_DESC(fixedFramerate, int, 0) \
+	PO_DESC(eventPollInterval, int, 0) \
 	PO_DESC(frameSkip, bool, true) \
+	PO_DESC(maxFrameSkip, int, 5) \
+	PO_DESC(frameSpinTime, int, 0) \
+	PO_DESC(deferredPresent, bool, false) \
 	PO_DESC(syncToRefreshrate, bool, false) \
+	PO_DESC(headless, bool, false) \
+	PO_DESC(headlessDrawInterval, int, 1) \
+	PO_DESC(fastForwardSpeed, int, 4) \
 	PO_DESC(solidFonts, bool, false) \
+	PO_DESC(glyphAtlas, bool, true) \
+	PO_DESC(textCacheSize, int, 2097152) \
+	PO_DESC(staticTilemapSize, int, 6400) \
+	PO_DESC(indexedTilemap, bool, false) \
+	PO_DESC(tilemapDepthMerge, bool, false) \
+	PO_DESC(packedTileVertices, bool, false) \
 	PO_DESC(subImageFix, bool, false) \
 	PO_DESC(enableBlitting, bool, true) \
 	PO_DESC(maxTextureSize, int, 0) \
@@ -174,17 +207,69 @@ void Config::read(int argc, char *argv[])
 	PO_DESC(anyAltToggleFS, bool, false) \
 	PO_DESC(enableReset, bool, true) \
 	PO_DESC(allowSymlinks, bool, false) \
+	PO_DESC(archiveReadAhead, int, 65536) \
+	PO_DESC(preloadMemSize, int, 33554432) \
+	PO_DESC(decodeThreads, int, 2) \
+	PO_DESC(asyncTextureUpload, bool, false) \
+	PO_DESC(bitmapCacheSize, int, 16777216) \
+	PO_DESC(dataCacheSize, int, 4194304) \
+	PO_DESC(packedDataSize, int, 0) \
+	PO_DESC(asyncSave, bool, false) \
+	PO_DESC(atlasCacheSize, int, 16777216) \
+	PO_DESC(spriteAtlasPages, int, 0) \
+	PO_DESC(mipmaps, bool, false) \
+	PO_DESC(textureBudget, int, 0) \
+	PO_DESC(performance.texPoolSize, int, 20000000) \
+	PO_DESC(performance.autoTune, bool, false) \
+	PO_DESC(performance.tuneInterval, int, 300) \
+	PO_DESC(performance.tuneLimit, int, 0) \
+	PO_DESC(performance.memoryReserve, int, 16777216) \
+	PO_DESC(performance.deleteBudget, int, 64) \
+	PO_DESC(threads.rgssPriority, int, 0) \
+	PO_DESC(threads.rgssCore, int, -1) \
+	PO_DESC(threads.eventPriority, int, 0) \
+	PO_DESC(threads.eventCore, int, -1) \
+	PO_DESC(threads.audioPriority, int, 1) \
+	PO_DESC(threads.audioCore, int, 2) \
+	PO_DESC(threads.workerPriority, int, 0) \
+	PO_DESC(snapshotOnSuspend, bool, false) \
+	PO_DESC(compressedTextures, bool, false) \
+	PO_DESC(reducedTextures, bool, false) \
 	PO_DESC(dataPathOrg, std::string, "") \
 	PO_DESC(dataPathApp, std::string, "") \
 	PO_DESC(iconPath, std::string, "") \
 	PO_DESC(execName, std::string, "Game") \
+	PO_DESC(packBundle, std::string, "") \
 	PO_DESC(titleLanguage, std::string, "") \
 	PO_DESC(midi.soundFont, std::string, "") \
 	PO_DESC(midi.chorus, bool, false) \
 	PO_DESC(midi.reverb, bool, false) \
+	PO_DESC(midi.prerender, bool, false) \
 	PO_DESC(SE.sourceCount, int, 6) \
+	PO_DESC(SE.maxSourceCount, int, 32) \
+	PO_DESC(SE.strictTiming, bool, false) \
+	PO_DESC(SE.cacheSize, int, 10485760) \
+	PO_DESC(SE.compressedCacheSize, int, 0) \
+	PO_DESC(SE.softwareMix, bool, false) \
+	PO_DESC(BGM.bufferCount, int, 3) \
+	PO_DESC(BGM.bufferSize, int, 32768) \
+	PO_DESC(BGS.bufferCount, int, 3) \
+	PO_DESC(BGS.bufferSize, int, 32768) \
+	PO_DESC(ME.bufferCount, int, 3) \
+	PO_DESC(ME.bufferSize, int, 32768) \
+	PO_DESC(ME.cacheSize, int, 8388608) \
+	PO_DESC(adaptiveStreamBuffers, bool, true) \
+	PO_DESC(memoryStreamSize, int, 4194304) \
+	PO_DESC(asyncStreamOpen, bool, false) \
+	PO_DESC(bgmCrossfade, int, 0) \
 	PO_DESC(customScript, std::string, "") \
 	PO_DESC(pathCache, bool, true) \
+	PO_DESC(persistentPathCache, bool, true) \
+	PO_DESC(shaderCache, bool, true) \
+	PO_DESC(scriptCache, bool, true) \
+	PO_DESC(scheduledGC, bool, false) \
+	PO_DESC(lazyShaders, bool, true) \
+	PO_DESC(singlePassRadialBlur, bool, true) \
 	PO_DESC(useScriptNames, bool, false)
 
 // Not gonna take your shit boost
@@ -271,6 +356,43 @@ void Config::read(int argc, char *argv[])
 	rgssVersion = clamp(rgssVersion, 0, 3);
 
 	SE.sourceCount = clamp(SE.sourceCount, 1, 64);
+	SE.maxSourceCount = clamp(SE.maxSourceCount, SE.sourceCount, 256);
+	SE.cacheSize = std::max(SE.cacheSize, 0);
+	SE.compressedCacheSize = std::max(SE.compressedCacheSize, 0);
+	clampStreamBuffers(BGM.bufferCount, BGM.bufferSize);
+	clampStreamBuffers(BGS.bufferCount, BGS.bufferSize);
+	clampStreamBuffers(ME.bufferCount, ME.bufferSize);
+	ME.cacheSize = std::max(ME.cacheSize, 0);
+	memoryStreamSize = std::max(memoryStreamSize, 0);
+	bgmCrossfade = std::max(bgmCrossfade, 0);
+	textCacheSize = std::max(textCacheSize, 0);
+	staticTilemapSize = std::max(staticTilemapSize, 0);
+	archiveReadAhead = std::max(archiveReadAhead, 0);
+	preloadMemSize = std::max(preloadMemSize, 0);
+	decodeThreads = clamp(decodeThreads, 0, 8);
+	frameSpinTime = clamp(frameSpinTime, 0, 20000);
+	maxFrameSkip = clamp(maxFrameSkip, 0, 60);
+	headlessDrawInterval = std::max(headlessDrawInterval, 0);
+	fastForwardSpeed = clamp(fastForwardSpeed, 1, 16);
+	bitmapCacheSize = std::max(bitmapCacheSize, 0);
+	dataCacheSize = std::max(dataCacheSize, 0);
+	packedDataSize = std::max(packedDataSize, 0);
+	atlasCacheSize = std::max(atlasCacheSize, 0);
+	spriteAtlasPages = std::max(spriteAtlasPages, 0);
+	textureBudget = std::max(textureBudget, 0);
+	performance.texPoolSize = std::max(performance.texPoolSize, 0);
+	performance.tuneInterval = clamp(performance.tuneInterval, 30, 3600);
+	performance.tuneLimit = std::max(performance.tuneLimit, 0);
+	performance.memoryReserve = std::max(performance.memoryReserve, 0);
+	performance.deleteBudget = std::max(performance.deleteBudget, 0);
+
+	threads.rgssPriority = clamp(threads.rgssPriority, -1, 2);
+	threads.eventPriority = clamp(threads.eventPriority, -1, 2);
+	threads.audioPriority = clamp(threads.audioPriority, -1, 2);
+	threads.workerPriority = clamp(threads.workerPriority, -1, 2);
+	threads.rgssCore = clamp(threads.rgssCore, -1, 2);
+	threads.eventCore = clamp(threads.eventCore, -1, 2);
+	threads.audioCore = clamp(threads.audioCore, -1, 2);
 
 	if (!dataPathOrg.empty() && !dataPathApp.empty())
 		customDataPath = prefPath(dataPathOrg.c_str(), dataPathApp.c_str());
@@ -32,11 +32,25 @@ struct Config
 
 	bool debugMode;
 	bool printFPS;
+	bool profiler;
+	std::string profilerTrace;
+
+	std::string inputRecord;
+	std::string inputReplay;
+	int replayFrames;
+	std::string replayReport;
+	int randomSeed;
+
+	std::string sceneReplay;
 
 	bool winResizable;
 	bool fullscreen;
 	bool fixedAspectRatio;
 	bool smoothScaling;
+	std::string scalingMode;
+	bool dynamicResolution;
+	bool directRender;
+	bool skipUnchangedFrames;
 	bool vsync;
 
 	int defScreenW;
@@ -44,10 +58,23 @@ struct Config
 	std::string windowTitle;
 
 	int fixedFramerate;
+	int eventPollInterval;
 	bool frameSkip;
+	int maxFrameSkip;
+	int frameSpinTime;
+	bool deferredPresent;
 	bool syncToRefreshrate;
+	bool headless;
+	int headlessDrawInterval;
+	int fastForwardSpeed;
 
 	bool solidFonts;
+	bool glyphAtlas;
+	int textCacheSize;
+	int staticTilemapSize;
+	bool indexedTilemap;
+	bool tilemapDepthMerge;
+	bool packedTileVertices;
 
 	bool subImageFix;
 	bool enableBlitting;
@@ -57,13 +84,35 @@ struct Config
 	bool anyAltToggleFS;
 	bool enableReset;
 	bool allowSymlinks;
+	int archiveReadAhead;
+	int preloadMemSize;
+	int decodeThreads;
+	bool asyncTextureUpload;
+	int bitmapCacheSize;
+	int dataCacheSize;
+	int packedDataSize;
+	bool asyncSave;
+	int atlasCacheSize;
+	int spriteAtlasPages;
+	bool mipmaps;
+	int textureBudget;
+	bool snapshotOnSuspend;
+	bool compressedTextures;
+	bool reducedTextures;
 	bool pathCache;
+	bool persistentPathCache;
+	bool shaderCache;
+	bool scriptCache;
+	bool scheduledGC;
+	bool lazyShaders;
+	bool singlePassRadialBlur;
 
 	std::string dataPathOrg;
 	std::string dataPathApp;
 
 	std::string iconPath;
 	std::string execName;
+	std::string packBundle;
 	std::string titleLanguage;
 
 	struct
@@ -71,13 +120,62 @@ struct Config
 		std::string soundFont;
 		bool chorus;
 		bool reverb;
+		bool prerender;
 	} midi;
 
 	struct
 	{
 		int sourceCount;
+		int maxSourceCount;
+		bool strictTiming;
+		int cacheSize;
+		int compressedCacheSize;
+		bool softwareMix;
 	} SE;
 
+	/* Buffer queue of the streamed audio types */
+	struct
+	{
+		int bufferCount;
+		int bufferSize;
+	} BGM, BGS;
+
+	struct
+	{
+		int bufferCount;
+		int bufferSize;
+		int cacheSize;
+	} ME;
+
+	/* Cache budgets, and their tuning at runtime */
+	struct
+	{
+		int texPoolSize;
+		bool autoTune;
+		int tuneInterval;
+		int tuneLimit;
+		int memoryReserve;
+		int deleteBudget;
+	} performance;
+
+	/* Priorities (-1 to 2) and cores (-1 for any)
+	 * of the engine threads, see ThreadPolicy */
+	struct
+	{
+		int rgssPriority;
+		int rgssCore;
+		int eventPriority;
+		int eventCore;
+		int audioPriority;
+		int audioCore;
+		int workerPriority;
+	} threads;
+
+	bool adaptiveStreamBuffers;
+	int memoryStreamSize;
+	bool asyncStreamOpen;
+	int bgmCrossfade;
+
 	bool useScriptNames;
 
 	std::string customScript;
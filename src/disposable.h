@@ -22,7 +22,7 @@
 #ifndef DISPOSABLE_H
 #define DISPOSABLE_H
 
-#include "intrulist.h"
+#include "handletable.h"
 #include "exception.h"
 #include "sharedstate.h"
 #include "graphics.h"
@@ -35,8 +35,7 @@ class Disposable
 {
 public:
 	Disposable()
-	    : disposed(false),
-	      link(this)
+	    : disposed(false)
 	{
 		shState->graphics().addDisposable(this);
 	}
@@ -78,7 +77,9 @@ private:
 	friend class Graphics;
 
 	bool disposed;
-	IntruListLink<Disposable> link;
+
+	/* Slot in the global table of live Disposables */
+	Handle handle;
 };
 
 template<class C>
@@ -249,6 +249,16 @@ struct FloatRect
 		return IntRect(x, y, w, h);
 	}
 
+	bool operator==(const FloatRect &other) const
+	{
+		return x == other.x && y == other.y && w == other.w && h == other.h;
+	}
+
+	bool operator!=(const FloatRect &other) const
+	{
+		return !(*this == other);
+	}
+
 	Vec2 topLeft() const { return Vec2(x, y); }
 	Vec2 bottomLeft() const { return Vec2(x, y+h); }
 	Vec2 topRight() const { return Vec2(x+w, y); }
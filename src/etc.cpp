@@ -23,6 +23,7 @@
 
 #include "serial-util.h"
 #include "exception.h"
+#include "scene.h"
 
 #include <SDL_types.h>
 #include <SDL_pixels.h>
@@ -65,36 +66,61 @@ const Color &Color::operator=(const Color &o)
 
 void Color::set(double red, double green, double blue, double alpha)
 {
+	if (this->red   == red   &&
+	    this->green == green &&
+	    this->blue  == blue  &&
+	    this->alpha == alpha)
+	{
+		return;
+	}
+
 	this->red   = red;
 	this->green = green;
 	this->blue  = blue;
 	this->alpha = alpha;
 
 	updateInternal();
+	Scene::markDirty();
 }
 
 void Color::setRed(double value)
 {
+	if (red == value)
+		return;
+
 	red = value;
 	norm.x = clamp<double>(value, 0, 255) / 255;
+	Scene::markDirty();
 }
 
 void Color::setGreen(double value)
 {
+	if (green == value)
+		return;
+
 	green = value;
 	norm.y = clamp<double>(value, 0, 255) / 255;
+	Scene::markDirty();
 }
 
 void Color::setBlue(double value)
 {
+	if (blue == value)
+		return;
+
 	blue = value;
 	norm.z = clamp<double>(value, 0, 255) / 255;
+	Scene::markDirty();
 }
 
 void Color::setAlpha(double value)
 {
+	if (alpha == value)
+		return;
+
 	alpha = value;
 	norm.w = clamp<double>(value, 0, 255) / 255;
+	Scene::markDirty();
 }
 
 /* Serializable */
@@ -176,13 +202,22 @@ bool Tone::operator==(const Tone &o) const
 
 void Tone::set(double red, double green, double blue, double gray)
 {
+	if (this->red   == red   &&
+	    this->green == green &&
+	    this->blue  == blue  &&
+	    this->gray  == gray)
+	{
+		return;
+	}
+
 	this->red   = red;
 	this->green = green;
 	this->blue  = blue;
 	this->gray  = gray;
 
 	updateInternal();
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 const Tone& Tone::operator=(const Tone &o)
@@ -193,41 +228,57 @@ const Tone& Tone::operator=(const Tone &o)
 	gray  = o.gray;
 	norm  = o.norm;
 
-	valueChanged();
+	changed.raise();
 
 	return o;
 }
 
 void Tone::setRed(double value)
 {
+	if (red == value)
+		return;
+
 	red = value;
 	norm.x = (float) clamp<double>(value, -255, 255) / 255;
 
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 void Tone::setGreen(double value)
 {
+	if (green == value)
+		return;
+
 	green = value;
 	norm.y = (float) clamp<double>(value, -255, 255) / 255;
 
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 void Tone::setBlue(double value)
 {
+	if (blue == value)
+		return;
+
 	blue = value;
 	norm.z = (float) clamp<double>(value, -255, 255) / 255;
 
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 void Tone::setGray(double value)
 {
+	if (gray == value)
+		return;
+
 	gray = value;
 	norm.w = (float) clamp<double>(value, 0, 255) / 255;
 
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 /* Serializable */
@@ -312,7 +363,8 @@ void Rect::set(int x, int y, int w, int h)
 	this->y = y;
 	width = w;
 	height = h;
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 const Rect &Rect::operator=(const Rect &o)
@@ -322,7 +374,7 @@ const Rect &Rect::operator=(const Rect &o)
 	width  = o.width;
 	height = o.height;
 
-	valueChanged();
+	changed.raise();
 
 	return o;
 }
@@ -333,7 +385,8 @@ void Rect::empty()
 		return;
 
 	x = y = width = height = 0;
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 bool Rect::isEmpty() const
@@ -347,7 +400,8 @@ void Rect::setX(int value)
 		return;
 
 	x = value;
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 void Rect::setY(int value)
@@ -356,7 +410,8 @@ void Rect::setY(int value)
 		return;
 
 	y = value;
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 void Rect::setWidth(int value)
@@ -365,7 +420,8 @@ void Rect::setWidth(int value)
 		return;
 
 	width = value;
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 void Rect::setHeight(int value)
@@ -374,7 +430,8 @@ void Rect::setHeight(int value)
 		return;
 
 	height = value;
-	valueChanged();
+	changed.raise();
+	Scene::markDirty();
 }
 
 int Rect::serialSize() const
@@ -22,23 +22,50 @@
 #ifndef ETC_H
 #define ETC_H
 
-#include <sigc++/signal.h>
-
 #include "serializable.h"
 #include "etc-internal.h"
+#include "objectpool.h"
 
 struct SDL_Color;
 
 enum BlendType
 {
 	BlendKeepDestAlpha = -1,
+	/* Source color is premultiplied with its alpha */
+	BlendPremultiplied = -2,
 
 	BlendNormal = 0,
 	BlendAddition = 1,
 	BlendSubstraction = 2
 };
 
-struct Color : public Serializable
+/* Stands in for a change signal on value types that only
+ * ever have a single owner; setters raise it, and the owner
+ * consumes it once it prepares to draw */
+struct ChangeFlag
+{
+	ChangeFlag()
+	    : raised(true)
+	{}
+
+	void raise()
+	{
+		raised = true;
+	}
+
+	bool consume()
+	{
+		bool result = raised;
+		raised = false;
+
+		return result;
+	}
+
+private:
+	bool raised;
+};
+
+struct Color : public Serializable, public Pooled<Color>
 {
 	Color()
 	    : red(0), green(0), blue(0), alpha(0)
@@ -91,7 +118,7 @@ struct Color : public Serializable
 	Vec4 norm;
 };
 
-struct Tone : public Serializable
+struct Tone : public Serializable, public Pooled<Tone>
 {
 	Tone()
 	    : red(0), green(0), blue(0), gray(0)
@@ -143,10 +170,10 @@ struct Tone : public Serializable
 	/* Normalized (-1.0 ~ 1.0) */
 	Vec4 norm;
 
-	sigc::signal<void> valueChanged;
+	ChangeFlag changed;
 };
 
-struct Rect : public Serializable
+struct Rect : public Serializable, public Pooled<Rect>
 {
 	Rect()
 	    : x(0), y(0), width(0), height(0)
@@ -197,7 +224,7 @@ struct Rect : public Serializable
 	int width;
 	int height;
 
-	sigc::signal<void> valueChanged;
+	ChangeFlag changed;
 };
 
 /* For internal use.
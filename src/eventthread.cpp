@@ -37,6 +37,7 @@
 #include "settingsmenu.h"
 #include "al-util.h"
 #include "debugwriter.h"
+#include "profiler.h"
 
 #include <string.h>
 
@@ -72,6 +73,7 @@ initALCFunctions(ALCdevice *alcDev)
 uint8_t EventThread::keyStates[];
 EventThread::JoyState EventThread::joyState;
 EventThread::MouseState EventThread::mouseState;
+InputEventQueue EventThread::inputEvents;
 EventThread::TouchState EventThread::touchState;
 
 /* User event codes */
@@ -103,13 +105,131 @@ bool EventThread::allocUserEvents()
 EventThread::EventThread()
     : fullscreen(false),
       showCursor(false)
-{}
+{
+	stats.windowStart = 0;
+	stats.wakeups = stats.events = stats.coalesced = 0;
+
+	SDL_AtomicSet(&stats.wakeupRate, 0);
+	SDL_AtomicSet(&stats.eventRate, 0);
+	SDL_AtomicSet(&stats.coalescedRate, 0);
+}
+
+/* Waits for the next event. With a positive 'pollInterval', the
+ * queue is instead polled every that many ms, which bounds the
+ * wakeups where SDL_WaitEvent itself polls at a higher rate */
+bool EventThread::waitEvent(SDL_Event &event, int pollInterval)
+{
+	if (pollInterval <= 0)
+	{
+		bool result = SDL_WaitEvent(&event);
+		countWakeup();
+
+		if (result)
+			++stats.events;
+
+		return result;
+	}
+
+	while (true)
+	{
+		countWakeup();
+
+		if (SDL_PollEvent(&event))
+		{
+			++stats.events;
+			return true;
+		}
+
+		SDL_Delay(pollInterval);
+	}
+}
+
+void EventThread::countWakeup()
+{
+	++stats.wakeups;
+
+	const uint32_t now = SDL_GetTicks();
+	const uint32_t elapsed = now - stats.windowStart;
+
+	if (elapsed < 1000)
+		return;
+
+	SDL_AtomicSet(&stats.wakeupRate, stats.wakeups * 1000.0 / elapsed);
+	SDL_AtomicSet(&stats.eventRate, stats.events * 1000.0 / elapsed);
+	SDL_AtomicSet(&stats.coalescedRate, stats.coalesced * 1000.0 / elapsed);
+
+	stats.windowStart = now;
+	stats.wakeups = stats.events = stats.coalesced = 0;
+}
+
+static void applyMotion(const SDL_Event &event, int winW, int winH)
+{
+	switch (event.type)
+	{
+	case SDL_JOYAXISMOTION :
+		EventThread::joyState.axes[event.jaxis.axis] = event.jaxis.value;
+		break;
+
+	case SDL_MOUSEMOTION :
+		EventThread::mouseState.x = event.motion.x;
+		EventThread::mouseState.y = event.motion.y;
+		break;
+
+	case SDL_FINGERMOTION :
+	{
+		EventThread::FingerState &finger =
+		        EventThread::touchState.fingers[event.tfinger.fingerId];
+
+		finger.x = event.tfinger.x * winW;
+		finger.y = event.tfinger.y * winH;
+		break;
+	}
+	}
+}
+
+/* Motion events only update state, of which the latest values
+ * win, so consume all queued ones of 'type' in one go */
+void EventThread::coalesceMotion(uint32_t type, int winW, int winH)
+{
+	SDL_Event queued[32];
+	int count;
+
+	while ((count = SDL_PeepEvents(queued, 32, SDL_GETEVENT, type, type)) > 0)
+	{
+		for (int i = 0; i < count; ++i)
+			applyMotion(queued[i], winW, winH);
+
+		stats.coalesced += count;
+	}
+}
+
+EventThread::EventStats EventThread::eventStats() const
+{
+	EventStats result;
+	result.wakeups = SDL_AtomicGet(&stats.wakeupRate);
+	result.events = SDL_AtomicGet(&stats.eventRate);
+	result.coalesced = SDL_AtomicGet(&stats.coalescedRate);
+
+	return result;
+}
+
+static void pushInputEvent(InputEvent::Source source, int code,
+                           bool down, uint32_t timestamp)
+{
+	InputEvent event;
+	event.source = source;
+	event.down = down;
+	event.code = code;
+	event.timestamp = timestamp;
+
+	EventThread::inputEvents.push(event);
+}
 
 void EventThread::process(RGSSThreadData &rtData)
 {
 	SDL_Event event;
 	SDL_Window *win = rtData.window;
-	UnidirMessage<Vec2i> &windowSizeMsg = rtData.windowSizeMsg;
+	AtomicMessage<Vec2i> &windowSizeMsg = rtData.windowSizeMsg;
 
 	initALCFunctions(rtData.alcDev);
 
@@ -160,12 +280,14 @@ void EventThread::process(RGSSThreadData &rtData)
 
 	while (true)
 	{
-		if (!SDL_WaitEvent(&event))
+		if (!waitEvent(event, rtData.config.eventPollInterval))
 		{
 			Debug() << "EventThread: Event error";
 			break;
 		}
 
+		TRACE_SCOPE("EventThread::process");
+
 		if (sMenu && sMenu->onEvent(event))
 		{
 			if (sMenu->destroyReq())
@@ -308,6 +430,27 @@ void EventThread::process(RGSSThreadData &rtData)
 				break;
 			}
 
+			if (event.key.keysym.scancode == SDL_SCANCODE_F3)
+			{
+				if (rtData.config.profiler)
+					Profiler::toggleOverlay();
+
+				break;
+			}
+
+			if (event.key.keysym.scancode == SDL_SCANCODE_F4)
+			{
+				if (event.key.repeat)
+					break;
+
+				if (event.key.keysym.mod & KMOD_SHIFT)
+					rtData.rqRecordToggle.set();
+				else
+					rtData.rqScreenshot.set();
+
+				break;
+			}
+
 			if (event.key.keysym.scancode == SDL_SCANCODE_F12)
 			{
 				if (!rtData.config.enableReset)
@@ -323,6 +466,10 @@ void EventThread::process(RGSSThreadData &rtData)
 			}
 
 			keyStates[event.key.keysym.scancode] = true;
+
+			if (!event.key.repeat)
+				pushInputEvent(InputEvent::Key, event.key.keysym.scancode,
+				               true, event.key.timestamp);
 			break;
 
 		case SDL_KEYUP :
@@ -337,14 +484,20 @@ void EventThread::process(RGSSThreadData &rtData)
 			}
 
 			keyStates[event.key.keysym.scancode] = false;
+			pushInputEvent(InputEvent::Key, event.key.keysym.scancode,
+			               false, event.key.timestamp);
 			break;
 
 		case SDL_JOYBUTTONDOWN :
 			joyState.buttons[event.jbutton.button] = true;
+			pushInputEvent(InputEvent::JoyButton, event.jbutton.button,
+			               true, event.jbutton.timestamp);
 			break;
 
 		case SDL_JOYBUTTONUP :
 			joyState.buttons[event.jbutton.button] = false;
+			pushInputEvent(InputEvent::JoyButton, event.jbutton.button,
+			               false, event.jbutton.timestamp);
 			break;
 
 		case SDL_JOYHATMOTION :
@@ -353,6 +506,9 @@ void EventThread::process(RGSSThreadData &rtData)
 
 		case SDL_JOYAXISMOTION :
 			joyState.axes[event.jaxis.axis] = event.jaxis.value;
+
+			if (!sMenu)
+				coalesceMotion(event.type, winW, winH);
 			break;
 
 		case SDL_JOYDEVICEADDED :
@@ -368,15 +524,23 @@ void EventThread::process(RGSSThreadData &rtData)
 
 		case SDL_MOUSEBUTTONDOWN :
 			mouseState.buttons[event.button.button] = true;
+			pushInputEvent(InputEvent::MouseButton, event.button.button,
+			               true, event.button.timestamp);
 			break;
 
 		case SDL_MOUSEBUTTONUP :
 			mouseState.buttons[event.button.button] = false;
+			pushInputEvent(InputEvent::MouseButton, event.button.button,
+			               false, event.button.timestamp);
 			break;
 
 		case SDL_MOUSEMOTION :
 			mouseState.x = event.motion.x;
 			mouseState.y = event.motion.y;
+
+			if (!sMenu)
+				coalesceMotion(event.type, winW, winH);
+
 			updateCursorState(cursorInWindow, gameScreen);
 			break;
 
@@ -388,6 +552,9 @@ void EventThread::process(RGSSThreadData &rtData)
 			i = event.tfinger.fingerId;
 			touchState.fingers[i].x = event.tfinger.x * winW;
 			touchState.fingers[i].y = event.tfinger.y * winH;
+
+			if (event.type == SDL_FINGERMOTION && !sMenu)
+				coalesceMotion(event.type, winW, winH);
 			break;
 
 		case SDL_FINGERUP :
@@ -705,6 +872,8 @@ bool SyncPoint::mainSyncLocked()
 
 void SyncPoint::waitMainSync()
 {
+	TRACE_SCOPE("SyncPoint::waitMainSync");
+
 	reply.unlock(false);
 	mainSync.waitForUnlock();
 }
@@ -714,6 +883,8 @@ void SyncPoint::passSecondarySync()
 	if (!secondSync.locked)
 		return;
 
+	TRACE_SCOPE("SyncPoint::passSecondarySync");
+
 	secondSync.waitForUnlock();
 }
 
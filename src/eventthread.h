@@ -35,6 +35,7 @@
 #include <string>
 
 #include <stdint.h>
+#include <string.h>
 
 #include <alc.h>
 
@@ -44,6 +45,70 @@ union SDL_Event;
 
 #define MAX_FINGERS 4
 
+/* A button going down or up, in the order
+ * the event thread received them */
+struct InputEvent
+{
+	enum Source
+	{
+		Key,
+		MouseButton,
+		JoyButton
+	};
+
+	uint8_t source;
+	bool down;
+	uint16_t code;
+
+	/* SDL_GetTicks() time of the event */
+	uint32_t timestamp;
+};
+
+#define INPUT_QUEUE_SIZE 256
+
+/* Passes input events from the event thread (the only producer)
+ * to the RGSS thread (the only consumer) without locking. When
+ * full, further events are dropped; the state arrays still track
+ * the current button states either way */
+struct InputEventQueue
+{
+	InputEventQueue()
+	{
+		SDL_AtomicSet(&head, 0);
+		SDL_AtomicSet(&tail, 0);
+	}
+
+	void push(const InputEvent &event)
+	{
+		const unsigned int h = SDL_AtomicGet(&head);
+		const unsigned int t = SDL_AtomicGet(&tail);
+
+		if (h - t == INPUT_QUEUE_SIZE)
+			return;
+
+		events[h % INPUT_QUEUE_SIZE] = event;
+		SDL_AtomicSet(&head, h + 1);
+	}
+
+	bool pop(InputEvent &out)
+	{
+		const unsigned int t = SDL_AtomicGet(&tail);
+
+		if (t == (unsigned int) SDL_AtomicGet(&head))
+			return false;
+
+		out = events[t % INPUT_QUEUE_SIZE];
+		SDL_AtomicSet(&tail, t + 1);
+
+		return true;
+	}
+
+private:
+	InputEvent events[INPUT_QUEUE_SIZE];
+	SDL_atomic_t head;
+	SDL_atomic_t tail;
+};
+
 class EventThread
 {
 public:
@@ -76,6 +141,7 @@ public:
 	static JoyState joyState;
 	static MouseState mouseState;
 	static TouchState touchState;
+	static InputEventQueue inputEvents;
 
 	static bool allocUserEvents();
 
@@ -102,9 +168,26 @@ public:
 	/* Called on game screen (size / offset) changes */
 	void notifyGameScreenChange(const SDL_Rect &screen);
 
+	/* Per second, averaged over the last second or so */
+	struct EventStats
+	{
+		/* Returns from waiting (or polling) for events */
+		int wakeups;
+		int events;
+		/* Motion events folded into a preceding one */
+		int coalesced;
+	};
+
+	/* May be called from any thread */
+	EventStats eventStats() const;
+
 private:
 	static int eventFilter(void *, SDL_Event*);
 
+	bool waitEvent(SDL_Event &event, int pollInterval);
+	void countWakeup();
+	void coalesceMotion(uint32_t type, int winW, int winH);
+
 	void resetInputStates();
 	void setFullscreen(SDL_Window *, bool mode);
 	void updateCursorState(bool inWindow,
@@ -114,6 +197,20 @@ private:
 	bool showCursor;
 	AtomicFlag msgBoxDone;
 
+	struct
+	{
+		/* Counted by the event thread */
+		uint32_t windowStart;
+		int wakeups;
+		int events;
+		int coalesced;
+
+		/* Published once per window */
+		mutable SDL_atomic_t wakeupRate;
+		mutable SDL_atomic_t eventRate;
+		mutable SDL_atomic_t coalescedRate;
+	} stats;
+
 	struct
 	{
 		uint64_t lastFrame;
@@ -144,6 +241,8 @@ struct UnidirMessage
 	/* Done from the sending side */
 	void post(const T &value)
 	{
+		TRACE_SCOPE("UnidirMessage::post");
+
 		SDL_LockMutex(mutex);
 
 		changed.set();
@@ -158,6 +257,8 @@ struct UnidirMessage
 		if (!changed)
 			return false;
 
+		TRACE_SCOPE("UnidirMessage::poll");
+
 		SDL_LockMutex(mutex);
 
 		out = current;
@@ -171,6 +272,8 @@ struct UnidirMessage
 	/* Done from either */
 	void get(T &out) const
 	{
+		TRACE_SCOPE("UnidirMessage::get");
+
 		SDL_LockMutex(mutex);
 		out = current;
 		SDL_UnlockMutex(mutex);
@@ -182,6 +285,65 @@ private:
 	T current;
 };
 
+/* Like UnidirMessage, but for plain data types (copyable with
+ * memcpy) sent by a single thread. Guarded by a sequence counter
+ * instead of a mutex: the sender never waits, and the receiver
+ * only retries a copy that raced with a post */
+template<typename T>
+struct AtomicMessage
+{
+	AtomicMessage()
+	    : current(T())
+	{
+		SDL_AtomicSet(&seq, 0);
+	}
+
+	/* Done from the sending side */
+	void post(const T &value)
+	{
+		/* Odd while the value is being written */
+		const int s = SDL_AtomicGet(&seq);
+		SDL_AtomicSet(&seq, s + 1);
+
+		memcpy(&current, &value, sizeof(T));
+
+		SDL_AtomicSet(&seq, s + 2);
+		changed.set();
+	}
+
+	/* Done from the receiving side */
+	bool poll(T &out) const
+	{
+		if (!changed)
+			return false;
+
+		/* A post racing with this one sets it again */
+		changed.clear();
+		get(out);
+
+		return true;
+	}
+
+	/* Done from either */
+	void get(T &out) const
+	{
+		int before, after;
+
+		do
+		{
+			before = SDL_AtomicGet(&seq);
+			memcpy(&out, &current, sizeof(T));
+			after = SDL_AtomicGet(&seq);
+		}
+		while ((before & 1) || before != after);
+	}
+
+private:
+	mutable SDL_atomic_t seq;
+	mutable AtomicFlag changed;
+	T current;
+};
+
 struct SyncPoint
 {
 	/* Used by eventFilter to control sleep/wakeup */
@@ -229,8 +391,14 @@ struct RGSSThreadData
 	/* Set when F12 is released */
 	AtomicFlag rqResetFinish;
 
+	/* Set when F4 is pressed */
+	AtomicFlag rqScreenshot;
+
+	/* Set when Shift+F4 is pressed */
+	AtomicFlag rqRecordToggle;
+
 	EventThread *ethread;
-	UnidirMessage<Vec2i> windowSizeMsg;
+	AtomicMessage<Vec2i> windowSizeMsg;
 	UnidirMessage<BDescVec> bindingUpdateMsg;
 	SyncPoint syncPoint;
 
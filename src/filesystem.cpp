@@ -22,12 +22,16 @@
 #include "filesystem.h"
 
 #include "rgssad.h"
+#include "bundle.h"
 #include "font.h"
 #include "util.h"
 #include "exception.h"
 #include "sharedstate.h"
 #include "boost-hash.h"
 #include "debugwriter.h"
+#include "preloader.h"
+#include "packeddatacache.h"
+#include "workerpool.h"
 
 #include <physfs.h>
 
@@ -37,12 +41,22 @@
 #include <string.h>
 #include <algorithm>
 #include <vector>
-#include <stack>
+
+#include <sys/stat.h>
 
 #ifdef __APPLE__
 #include <iconv.h>
 #endif
 
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__vita__)
+#define HAVE_MMAP
+#define HAVE_DIRENT
+#include <dirent.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 struct SDLRWIoContext
 {
 	SDL_RWops *ops;
@@ -289,6 +303,204 @@ initReadOps(PHYSFS_File *handle,
 	ops.hidden.unknown.data1 = handle;
 }
 
+/* Read ops over an in-memory copy of a file, or over a
+ * read-only mapping of it. Either is owned by the ops and
+ * released on close */
+struct MemFile
+{
+	/* Empty if the file is mapped */
+	std::string data;
+
+	const char *mem;
+	size_t size;
+	size_t pos;
+
+	/* Only set for mappings */
+	void *mapping;
+};
+
+static inline MemFile *memFile(SDL_RWops *ops)
+{
+	return static_cast<MemFile*>(ops->hidden.unknown.data1);
+}
+
+static Sint64 MemFileSize(SDL_RWops *ops)
+{
+	MemFile *f = memFile(ops);
+
+	return f ? (Sint64) f->size : -1;
+}
+
+static Sint64 MemFileSeek(SDL_RWops *ops, int64_t offset, int whence)
+{
+	MemFile *f = memFile(ops);
+
+	if (!f)
+		return -1;
+
+	int64_t base;
+
+	switch (whence)
+	{
+	default:
+	case RW_SEEK_SET :
+		base = 0;
+		break;
+	case RW_SEEK_CUR :
+		base = f->pos;
+		break;
+	case RW_SEEK_END :
+		base = f->size;
+		break;
+	}
+
+	int64_t pos = base + offset;
+
+	if (pos < 0 || pos > (int64_t) f->size)
+		return -1;
+
+	f->pos = pos;
+
+	return pos;
+}
+
+static size_t MemFileRead(SDL_RWops *ops, void *buffer, size_t size, size_t maxnum)
+{
+	MemFile *f = memFile(ops);
+
+	if (!f || size == 0)
+		return 0;
+
+	size_t num = std::min(maxnum, (f->size - f->pos) / size);
+
+	memcpy(buffer, f->mem + f->pos, num * size);
+	f->pos += num * size;
+
+	return num;
+}
+
+static size_t MemFileWrite(SDL_RWops *, const void *, size_t, size_t)
+{
+	return 0;
+}
+
+static int MemFileClose(SDL_RWops *ops)
+{
+	MemFile *f = memFile(ops);
+
+#ifdef HAVE_MMAP
+	if (f && f->mapping)
+		munmap(f->mapping, f->size);
+#endif
+
+	delete f;
+	ops->hidden.unknown.data1 = 0;
+
+	return 0;
+}
+
+static int MemFileCloseFree(SDL_RWops *ops)
+{
+	int result = MemFileClose(ops);
+
+	SDL_FreeRW(ops);
+
+	return result;
+}
+
+static void
+initMemFileOps(MemFile *f,
+               SDL_RWops &ops,
+               bool freeOnClose)
+{
+	ops.size  = MemFileSize;
+	ops.seek  = MemFileSeek;
+	ops.read  = MemFileRead;
+	ops.write = MemFileWrite;
+	ops.close = freeOnClose ? MemFileCloseFree : MemFileClose;
+
+	ops.type = SDL_RWOPS_UNKNOWN;
+	ops.hidden.unknown.data1 = f;
+}
+
+/* Takes over the contents of 'data' */
+static void
+initMemReadOps(std::string &data,
+               SDL_RWops &ops,
+               bool freeOnClose)
+{
+	MemFile *f = new MemFile;
+	f->data.swap(data);
+	f->mem = f->data.c_str();
+	f->size = f->data.size();
+	f->pos = 0;
+	f->mapping = 0;
+
+	initMemFileOps(f, ops, freeOnClose);
+}
+
+/* Maps 'filename' into memory if it is a loose file in a
+ * host directory, so reads turn into plain copies instead
+ * of going through PhysFS. Returns false if the file lives
+ * in an archive or can't be mapped, in which case the caller
+ * falls back to regular PhysFS reads */
+static bool
+initMappedReadOps(const char *filename,
+                  SDL_RWops &ops,
+                  bool freeOnClose)
+{
+#ifdef HAVE_MMAP
+	const char *realDir = PHYSFS_getRealDir(filename);
+
+	if (!realDir)
+		return false;
+
+	struct stat st;
+
+	/* Archives are mounted as files */
+	if (stat(realDir, &st) != 0 || !S_ISDIR(st.st_mode))
+		return false;
+
+	std::string hostPath(realDir);
+	hostPath += "/";
+	hostPath += filename;
+
+	int fd = open(hostPath.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	/* Empty files can't be mapped */
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+		return false;
+
+	MemFile *f = new MemFile;
+	f->mem = static_cast<const char*>(mapping);
+	f->size = st.st_size;
+	f->pos = 0;
+	f->mapping = mapping;
+
+	initMemFileOps(f, ops, freeOnClose);
+
+	return true;
+#else
+	(void) filename;
+	(void) ops;
+	(void) freeOnClose;
+
+	return false;
+#endif
+}
+
 static void strTolower(std::string &str)
 {
 	for (size_t i = 0; i < str.size(); ++i)
@@ -305,10 +517,25 @@ struct FileSystemPrivate
 	/* Maps: lower case directory path,
 	 * To:   list of lower case filenames */
 	BoostHash<std::string, std::vector<std::string> > fileLists;
+	/* Maps: lower case full filepath, cut at any of its dots,
+	 * To:   the lower case filenames it is a prefix of,
+	 *       in alphabetical order. Derived from 'fileLists' */
+	BoostHash<std::string, std::vector<std::string> > baseIndex;
 
 	/* This is for compatibility with games that take Windows'
 	 * case insensitivity for granted */
 	bool havePathCache;
+
+	bool allowSymlinks;
+
+	/* Everything passed to 'addPath()', in order */
+	std::vector<std::string> searchPaths;
+
+#ifdef HAVE_MMAP
+	/* Bundles mounted from memory; only
+	 * unmapped after PhysFS is shut down */
+	std::vector<std::pair<void*, size_t> > mappings;
+#endif
 };
 
 static void throwPhysfsError(const char *desc)
@@ -320,7 +547,8 @@ static void throwPhysfsError(const char *desc)
 }
 
 FileSystem::FileSystem(const char *argv0,
-                       bool allowSymlinks)
+                       bool allowSymlinks,
+                       int archiveReadAhead)
 {
 	if (PHYSFS_init(argv0) == 0)
 		throwPhysfsError("Error initializing PhysFS");
@@ -330,12 +558,16 @@ FileSystem::FileSystem(const char *argv0,
 	er *= PHYSFS_registerArchiver(&RGSS1_Archiver);
 	er *= PHYSFS_registerArchiver(&RGSS2_Archiver);
 	er *= PHYSFS_registerArchiver(&RGSS3_Archiver);
+	er *= PHYSFS_registerArchiver(&Bundle_Archiver);
 
 	if (er == 0)
 		throwPhysfsError("Error registering PhysFS RGSS archiver");
 
+	RGSS_setReadAhead(archiveReadAhead);
+
 	p = new FileSystemPrivate;
 	p->havePathCache = false;
+	p->allowSymlinks = allowSymlinks;
 
 	if (allowSymlinks)
 		PHYSFS_permitSymbolicLinks(1);
@@ -343,14 +575,70 @@ FileSystem::FileSystem(const char *argv0,
 
 FileSystem::~FileSystem()
 {
+#ifdef HAVE_MMAP
+	std::vector<std::pair<void*, size_t> > mappings = p->mappings;
+#endif
+
 	delete p;
 
 	if (PHYSFS_deinit() == 0)
 		Debug() << "PhyFS failed to deinit.";
+
+#ifdef HAVE_MMAP
+	for (size_t i = 0; i < mappings.size(); ++i)
+		munmap(mappings[i].first, mappings[i].second);
+#endif
+}
+
+#ifdef HAVE_MMAP
+/* Bundle entries are page aligned, so serving them from
+ * a mapping avoids both read calls and a second copy
+ * in the page cache */
+static bool mountMapped(FileSystemPrivate *p, const char *path)
+{
+	const size_t pathLen = strlen(path);
+	const size_t extLen = sizeof(BUNDLE_EXT)-1;
+
+	if (pathLen <= extLen || strcmp(path + pathLen - extLen, BUNDLE_EXT))
+		return false;
+
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	void *mem = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (mem == MAP_FAILED)
+		return false;
+
+	if (!PHYSFS_mountMemory(mem, st.st_size, 0, path, 0, 1))
+	{
+		munmap(mem, st.st_size);
+		return false;
+	}
+
+	p->mappings.push_back(std::make_pair(mem, (size_t) st.st_size));
+
+	return true;
 }
+#endif
 
 void FileSystem::addPath(const char *path)
 {
+	p->searchPaths.push_back(path);
+
+#ifdef HAVE_MMAP
+	if (mountMapped(p, path))
+		return;
+#endif
+
 	/* Try the normal mount first */
 	if (!PHYSFS_mount(path, 0, 1))
 	{
@@ -363,25 +651,23 @@ void FileSystem::addPath(const char *path)
 	}
 }
 
-struct CacheEnumData
+/* Converts the decomposed UTF-8 OSX' file systems hand
+ * out to the composed form; a no-op everywhere else */
+struct NFCConverter
 {
-	FileSystemPrivate *p;
-	std::stack<std::vector<std::string>*> fileLists;
-
 #ifdef __APPLE__
 	iconv_t nfd2nfc;
 	char buf[512];
 #endif
 
-	CacheEnumData(FileSystemPrivate *p)
-	    : p(p)
+	NFCConverter()
 	{
 #ifdef __APPLE__
 		nfd2nfc = iconv_open("utf-8", "utf-8-mac");
 #endif
 	}
 
-	~CacheEnumData()
+	~NFCConverter()
 	{
 #ifdef __APPLE__
 		iconv_close(nfd2nfc);
@@ -412,66 +698,874 @@ struct CacheEnumData
 	}
 };
 
+/* Entries of one directory, which is given mixed case and
+ * relative to the mounted path ("" being its root) */
+struct DirListing
+{
+	std::string dir;
+	/* Modification time at the point of listing */
+	int64_t mtime;
+	std::vector<std::string> files;
+	std::vector<std::string> subdirs;
+};
+
+/* All directories below one mounted path, parents first */
+typedef std::vector<DirListing> TreeListing;
+
+static std::string joinPath(const std::string &dir, const std::string &name)
+{
+	return dir.empty() ? name : dir + "/" + name;
+}
+
+/* Modification state of a host file or directory
+ * the path cache was built from */
+struct PathStamp
+{
+	std::string path;
+	int64_t mtime;
+	int64_t size;
+};
+
+static PathStamp makeStamp(const std::string &path)
+{
+	PathStamp stamp;
+	stamp.path = path;
+
+	struct stat st;
+
+	if (stat(path.c_str(), &st) != 0)
+	{
+		/* Missing paths are recorded too, so
+		 * their later appearance is noticed */
+		stamp.mtime = -1;
+		stamp.size = -1;
+	}
+	else
+	{
+		stamp.mtime = st.st_mtime;
+		stamp.size = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+	}
+
+	return stamp;
+}
+
+static bool isHostDir(const std::string &path)
+{
+	struct stat st;
+
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+#ifdef HAVE_DIRENT
+/* Lists a host directory directly instead of through PhysFS,
+ * which serializes all calls on its global state lock and thus
+ * can't be walked from several threads at once */
+static void listHostDir(const std::string &hostPath, bool allowSymlinks,
+                        NFCConverter &nfc, DirListing &listing)
+{
+	DIR *dir = opendir(hostPath.c_str());
+
+	if (!dir)
+		return;
+
+	while (struct dirent *ent = readdir(dir))
+	{
+		const char *name = ent->d_name;
+
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+
+		const std::string entPath = hostPath + "/" + name;
+		bool isDir, isLink;
+
+#ifdef DT_DIR
+		if (ent->d_type != DT_UNKNOWN)
+		{
+			isDir = ent->d_type == DT_DIR;
+			isLink = ent->d_type == DT_LNK;
+		}
+		else
+#endif
+		{
+			struct stat st;
+
+			if (lstat(entPath.c_str(), &st) != 0)
+				continue;
+
+			isDir = S_ISDIR(st.st_mode);
+			isLink = S_ISLNK(st.st_mode);
+		}
+
+		/* Same policy PhysFS applies to its own enumeration */
+		if (isLink)
+		{
+			struct stat st;
+
+			if (!allowSymlinks || stat(entPath.c_str(), &st) != 0)
+				continue;
+
+			isDir = S_ISDIR(st.st_mode);
+		}
+
+		char buf[512];
+		snprintf(buf, sizeof(buf), "%s", name);
+
+		/* Deal with OSX' weird UTF-8 standards */
+		nfc.toNFC(buf);
+
+		if (isDir)
+			listing.subdirs.push_back(buf);
+		else
+			listing.files.push_back(buf);
+	}
+
+	closedir(dir);
+}
+
+typedef BoostHash<std::string, const DirListing*> ListingIndex;
+
+/* Walks one directory tree of a mounted host path. Directories
+ * whose modification time didn't change since 'cached' was
+ * built (an entry being added, removed or renamed bumps it)
+ * are taken over from there instead of being listed again */
+struct HostWalkJob : WorkerJob
+{
+	const std::string &root;
+	const std::string dir;
+	const bool recurse;
+	const bool allowSymlinks;
+	const ListingIndex &cached;
+
+	TreeListing out;
+	/* Whether any directory had to be listed anew */
+	bool changed;
+
+	HostWalkJob(const std::string &root, const std::string &dir,
+	            bool recurse, bool allowSymlinks, const ListingIndex &cached)
+	    : root(root), dir(dir), recurse(recurse),
+	      allowSymlinks(allowSymlinks), cached(cached),
+	      changed(false)
+	{}
+
+	void run()
+	{
+		NFCConverter nfc;
+		walk(dir, nfc);
+	}
+
+	void walk(const std::string &rel, NFCConverter &nfc)
+	{
+		const std::string hostPath = joinPath(root, rel);
+		const int64_t mtime = makeStamp(hostPath).mtime;
+
+		/* Recursing may reallocate 'out', so refer by index */
+		const size_t idx = out.size();
+		out.push_back(DirListing());
+
+		const DirListing *prev = cached.value(rel, 0);
+
+		if (prev && prev->mtime == mtime)
+		{
+			out[idx] = *prev;
+		}
+		else
+		{
+			out[idx].dir = rel;
+			out[idx].mtime = mtime;
+			listHostDir(hostPath, allowSymlinks, nfc, out[idx]);
+			changed = true;
+		}
+
+		if (!recurse)
+			return;
+
+		const std::vector<std::string> subdirs = out[idx].subdirs;
+
+		for (size_t i = 0; i < subdirs.size(); ++i)
+			walk(joinPath(rel, subdirs[i]), nfc);
+	}
+};
+
+/* The top level directories (Graphics, Audio, Data...) of a
+ * mounted path are walked concurrently on 'pool'.
+ * Returns whether the result differs from 'cached' */
+static bool walkHostPath(const std::string &root, const TreeListing &cached,
+                         WorkerPool *pool, bool allowSymlinks, TreeListing &out)
+{
+	ListingIndex index;
+
+	for (size_t i = 0; i < cached.size(); ++i)
+		index.insert(cached[i].dir, &cached[i]);
+
+	HostWalkJob rootJob(root, "", false, allowSymlinks, index);
+	rootJob.run();
+
+	const bool threaded = pool && pool->enabled();
+	const std::vector<std::string> &subdirs = rootJob.out[0].subdirs;
+	std::vector<HostWalkJob*> jobs;
+
+	for (size_t i = 0; i < subdirs.size(); ++i)
+	{
+		jobs.push_back(new HostWalkJob(root, subdirs[i], true,
+		                               allowSymlinks, index));
+
+		if (threaded)
+			pool->submit(*jobs.back());
+	}
+
+	bool changed = rootJob.changed;
+	out = rootJob.out;
+
+	/* Merged in submission order, so the result is
+	 * independent of how the jobs were scheduled */
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (threaded)
+			pool->wait(*jobs[i]);
+		else
+			jobs[i]->run();
+
+		changed |= jobs[i]->changed;
+		out.insert(out.end(), jobs[i]->out.begin(), jobs[i]->out.end());
+
+		delete jobs[i];
+	}
+
+	/* Removed directories show up as a changed parent,
+	 * but don't depend on that */
+	changed |= out.size() != cached.size();
+
+	return changed;
+}
+#endif
+
+/* Collects what PhysFS provides beyond the walked host
+ * directories, ie. the contents of archives and of mounts
+ * which couldn't be walked directly */
+struct ExtrasEnumData
+{
+	BoostSet<std::string> &hostFiles;
+	BoostSet<std::string> &hostDirs;
+	TreeListing &out;
+
+	/* Maps mixed case directory to its index in 'out' */
+	BoostHash<std::string, size_t> index;
+
+	/* Directory currently being enumerated */
+	std::string current;
+
+	NFCConverter nfc;
+
+	ExtrasEnumData(BoostSet<std::string> &hostFiles,
+	               BoostSet<std::string> &hostDirs,
+	               TreeListing &out)
+	    : hostFiles(hostFiles), hostDirs(hostDirs), out(out)
+	{}
+
+	DirListing &listing(const std::string &dir)
+	{
+		if (!index.contains(dir))
+		{
+			index.insert(dir, out.size());
+			out.push_back(DirListing());
+			out.back().dir = dir;
+			out.back().mtime = -1;
+		}
+
+		return out[index[dir]];
+	}
+};
+
 static PHYSFS_EnumerateCallbackResult
-cacheEnumCB(void *d, const char *origdir, const char *fname)
+extrasEnumCB(void *d, const char *origdir, const char *fname)
 {
-	CacheEnumData &data = *static_cast<CacheEnumData*>(d);
+	ExtrasEnumData &data = *static_cast<ExtrasEnumData*>(d);
+	char rawPath[512];
 	char fullPath[512];
+	char name[512];
 
 	if (!*origdir)
-		snprintf(fullPath, sizeof(fullPath), "%s", fname);
+		snprintf(rawPath, sizeof(rawPath), "%s", fname);
 	else
-		snprintf(fullPath, sizeof(fullPath), "%s/%s", origdir, fname);
+		snprintf(rawPath, sizeof(rawPath), "%s/%s", origdir, fname);
 
 	/* Deal with OSX' weird UTF-8 standards */
-	data.toNFC(fullPath);
+	snprintf(fullPath, sizeof(fullPath), "%s", rawPath);
+	data.nfc.toNFC(fullPath);
+	snprintf(name, sizeof(name), "%s", fname);
+	data.nfc.toNFC(name);
 
-	std::string mixedCase(fullPath);
-	std::string lowerCase = mixedCase;
-	strTolower(lowerCase);
+	const std::string path(fullPath);
 
-	PHYSFS_Stat stat;
-	PHYSFS_stat(fullPath, &stat);
+	if (data.hostFiles.contains(path))
+		return PHYSFS_ENUM_OK;
 
-	if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY)
+	/* Walked directories might still hold archive contents */
+	if (!data.hostDirs.contains(path))
 	{
-		/* Create a new list for this directory */
-		std::vector<std::string> &list = data.p->fileLists[lowerCase];
+		PHYSFS_Stat stat;
+
+		if (!PHYSFS_stat(rawPath, &stat))
+			return PHYSFS_ENUM_OK;
 
-		/* Iterate over its contents */
-		data.fileLists.push(&list);
-		PHYSFS_enumerate(fullPath, cacheEnumCB, d);
-		data.fileLists.pop();
+		if (stat.filetype != PHYSFS_FILETYPE_DIRECTORY)
+		{
+			data.listing(data.current).files.push_back(name);
+			return PHYSFS_ENUM_OK;
+		}
+
+		data.listing(data.current).subdirs.push_back(name);
+		data.listing(path);
 	}
-	else
+
+	const std::string parent = data.current;
+	data.current = path;
+	PHYSFS_enumerate(rawPath, extrasEnumCB, d);
+	data.current = parent;
+
+	return PHYSFS_ENUM_OK;
+}
+
+/* Mounted paths which weren't walked directly (archives, and
+ * everything where there is no dirent API) are stamped as a
+ * whole, host directories also for every directory found in them */
+static std::vector<PathStamp>
+collectStamps(const std::vector<std::string> &searchPaths,
+              const std::vector<char> &walked,
+              const TreeListing &extras)
+{
+	std::vector<PathStamp> stamps;
+
+	for (size_t i = 0; i < searchPaths.size(); ++i)
+	{
+		const std::string &sp = searchPaths[i];
+
+		if (walked[i])
+			continue;
+
+		stamps.push_back(makeStamp(sp));
+
+		if (!isHostDir(sp))
+			continue;
+
+		for (size_t j = 0; j < extras.size(); ++j)
+			if (!extras[j].dir.empty())
+				stamps.push_back(makeStamp(sp + "/" + extras[j].dir));
+	}
+
+	return stamps;
+}
+
+#define PATH_CACHE_MAGIC "MKXPPC02"
+
+struct CacheWriter
+{
+	std::vector<char> data;
+
+	void put(const void *src, size_t size)
 	{
-		/* Get the file list for the directory we're currently
-		 * traversing and append this filename to it */
-		std::vector<std::string> &list = *data.fileLists.top();
-		std::string lowerFilename(fname);
-		strTolower(lowerFilename);
-		list.push_back(lowerFilename);
+		const char *bytes = static_cast<const char*>(src);
+		data.insert(data.end(), bytes, bytes + size);
+	}
 
-		/* Add the lower -> mixed mapping of the file's full path */
-		data.p->pathCache.insert(lowerCase, mixedCase);
+	void putInt(int64_t value)
+	{
+		put(&value, sizeof(value));
 	}
 
-	return PHYSFS_ENUM_OK;
+	void putStr(const std::string &str)
+	{
+		putInt(str.size());
+		put(str.c_str(), str.size());
+	}
+
+	void putStrs(const std::vector<std::string> &strs)
+	{
+		putInt(strs.size());
+
+		for (size_t i = 0; i < strs.size(); ++i)
+			putStr(strs[i]);
+	}
+
+	void putTree(const TreeListing &tree)
+	{
+		putInt(tree.size());
+
+		for (size_t i = 0; i < tree.size(); ++i)
+		{
+			putStr(tree[i].dir);
+			putInt(tree[i].mtime);
+			putStrs(tree[i].files);
+			putStrs(tree[i].subdirs);
+		}
+	}
+};
+
+struct CacheReader
+{
+	const std::vector<char> &data;
+	size_t pos;
+	bool ok;
+
+	CacheReader(const std::vector<char> &data)
+	    : data(data), pos(0), ok(true)
+	{}
+
+	bool get(void *dst, size_t size)
+	{
+		if (!ok || data.size() - pos < size)
+			return ok = false;
+
+		memcpy(dst, &data[pos], size);
+		pos += size;
+
+		return true;
+	}
+
+	int64_t getInt()
+	{
+		int64_t value = 0;
+		get(&value, sizeof(value));
+
+		return value;
+	}
+
+	std::string getStr()
+	{
+		int64_t size = getInt();
+
+		if (!ok || size < 0 || (uint64_t) size > data.size() - pos)
+		{
+			ok = false;
+			return std::string();
+		}
+
+		std::string str(&data[pos], size);
+		pos += size;
+
+		return str;
+	}
+
+	void getStrs(std::vector<std::string> &out)
+	{
+		int64_t n = getInt();
+
+		for (int64_t i = 0; i < n && ok; ++i)
+			out.push_back(getStr());
+	}
+
+	void getTree(TreeListing &out)
+	{
+		int64_t n = getInt();
+
+		for (int64_t i = 0; i < n && ok; ++i)
+		{
+			out.push_back(DirListing());
+			DirListing &listing = out.back();
+
+			listing.dir = getStr();
+			listing.mtime = getInt();
+			getStrs(listing.files);
+			getStrs(listing.subdirs);
+		}
+	}
+};
+
+static bool readWholeFile(const char *path, std::vector<char> &out)
+{
+	FILE *f = fopen(path, "rb");
+
+	if (!f)
+		return false;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	bool result = false;
+
+	if (size > 0)
+	{
+		out.resize(size);
+		result = fread(&out[0], 1, size, f) == (size_t) size;
+	}
+
+	fclose(f);
+
+	return result;
 }
 
-void FileSystem::createPathCache()
+/* What the path cache is built from, per mounted path */
+struct PathCacheSource
+{
+	/* Listings of the directly walked host paths */
+	std::vector<TreeListing> trees;
+	std::vector<char> walked;
+
+	/* Everything else, enumerated through PhysFS */
+	std::vector<PathStamp> stamps;
+	TreeListing extras;
+};
+
+static bool loadPathCache(FileSystemPrivate *p, const char *cacheFile,
+                          PathCacheSource &src)
 {
-	CacheEnumData data(p);
-	data.fileLists.push(&p->fileLists[""]);
-	PHYSFS_enumerate("", cacheEnumCB, &data);
+	std::vector<char> data;
+
+	if (!readWholeFile(cacheFile, data))
+		return false;
+
+	CacheReader r(data);
+
+	char magic[sizeof(PATH_CACHE_MAGIC)-1];
+	if (!r.get(magic, sizeof(magic)) || memcmp(magic, PATH_CACHE_MAGIC, sizeof(magic)))
+		return false;
 
+	/* The mounts must be identical */
+	size_t pathCount = r.getInt();
+
+	if (!r.ok || pathCount != p->searchPaths.size())
+		return false;
+
+	for (size_t i = 0; i < pathCount; ++i)
+		if (r.getStr() != p->searchPaths[i])
+			return false;
+
+	PathCacheSource cached;
+	cached.trees.resize(pathCount);
+	cached.walked.resize(pathCount);
+
+	for (size_t i = 0; i < pathCount && r.ok; ++i)
+	{
+		cached.walked[i] = r.getInt();
+
+		if (cached.walked[i])
+			r.getTree(cached.trees[i]);
+	}
+
+	int64_t stampCount = r.getInt();
+
+	for (int64_t i = 0; i < stampCount && r.ok; ++i)
+	{
+		PathStamp stamp;
+		stamp.path = r.getStr();
+		stamp.mtime = r.getInt();
+		stamp.size = r.getInt();
+		cached.stamps.push_back(stamp);
+	}
+
+	r.getTree(cached.extras);
+
+	if (!r.ok || r.pos != data.size())
+		return false;
+
+	src = cached;
+
+	return true;
+}
+
+static void savePathCache(const FileSystemPrivate *p, const char *cacheFile,
+                          const PathCacheSource &src)
+{
+	CacheWriter w;
+
+	w.put(PATH_CACHE_MAGIC, sizeof(PATH_CACHE_MAGIC)-1);
+
+	w.putStrs(p->searchPaths);
+
+	for (size_t i = 0; i < p->searchPaths.size(); ++i)
+	{
+		w.putInt(src.walked[i]);
+
+		if (src.walked[i])
+			w.putTree(src.trees[i]);
+	}
+
+	w.putInt(src.stamps.size());
+	for (size_t i = 0; i < src.stamps.size(); ++i)
+	{
+		w.putStr(src.stamps[i].path);
+		w.putInt(src.stamps[i].mtime);
+		w.putInt(src.stamps[i].size);
+	}
+
+	w.putTree(src.extras);
+
+	FILE *f = fopen(cacheFile, "wb");
+
+	if (!f)
+	{
+		Debug() << "Failed to write path cache" << cacheFile;
+		return;
+	}
+
+	if (fwrite(&w.data[0], 1, w.data.size(), f) != w.data.size())
+		Debug() << "Failed to write path cache" << cacheFile;
+
+	fclose(f);
+}
+
+static bool stampsUnchanged(const std::vector<PathStamp> &stamps)
+{
+	for (size_t i = 0; i < stamps.size(); ++i)
+	{
+		PathStamp now = makeStamp(stamps[i].path);
+
+		if (now.mtime != stamps[i].mtime || now.size != stamps[i].size)
+			return false;
+	}
+
+	return true;
+}
+
+/* Adds the files of 'tree' to the lookup tables. Earlier
+ * mounts take precedence, like they do for PhysFS */
+static void mergeTree(FileSystemPrivate *p, const TreeListing &tree)
+{
+	for (size_t i = 0; i < tree.size(); ++i)
+	{
+		const DirListing &listing = tree[i];
+
+		std::string lowerDir = listing.dir;
+		strTolower(lowerDir);
+
+		/* Create the list even for empty directories */
+		std::vector<std::string> &list = p->fileLists[lowerDir];
+
+		for (size_t j = 0; j < listing.files.size(); ++j)
+		{
+			const std::string mixedCase = joinPath(listing.dir, listing.files[j]);
+			std::string lowerCase = mixedCase;
+			strTolower(lowerCase);
+
+			if (p->pathCache.contains(lowerCase))
+				continue;
+
+			p->pathCache.insert(lowerCase, mixedCase);
+			list.push_back(lowerCase.substr(lowerCase.size() - listing.files[j].size()));
+		}
+	}
+}
+
+static void buildBaseIndex(FileSystemPrivate *p)
+{
+	p->baseIndex.clear();
+
+	BoostHash<std::string, std::vector<std::string> >::const_iterator iter;
+
+	for (iter = p->fileLists.cbegin(); iter != p->fileLists.cend(); ++iter)
+	{
+		const std::string &dir = iter->first;
+
+		/* A name sorts before all names it is a prefix of,
+		 * so full matches come first */
+		std::vector<std::string> list = iter->second;
+		std::sort(list.begin(), list.end());
+
+		for (size_t i = 0; i < list.size(); ++i)
+		{
+			const std::string &name = list[i];
+			const std::string path = dir.empty() ? name : dir + "/" + name;
+			const size_t nameStart = path.size() - name.size();
+
+			/* "a.b.png" can be opened as "a", "a.b" or "a.b.png" */
+			for (size_t j = nameStart + 1; j < path.size(); ++j)
+				if (path[j] == '.')
+					p->baseIndex[path.substr(0, j)].push_back(name);
+
+			p->baseIndex[path].push_back(name);
+		}
+	}
+}
+
+void FileSystem::createPathCache(const char *cacheFile, WorkerPool *pool)
+{
 	p->havePathCache = true;
+
+	const size_t pathCount = p->searchPaths.size();
+
+	PathCacheSource cached;
+	const bool haveCached = cacheFile && loadPathCache(p, cacheFile, cached);
+
+	if (!haveCached)
+	{
+		cached.trees.resize(pathCount);
+		cached.walked.resize(pathCount);
+	}
+
+	PathCacheSource src;
+	src.trees.resize(pathCount);
+	src.walked.resize(pathCount);
+
+	bool changed = !haveCached;
+	bool haveExtras = false;
+
+	for (size_t i = 0; i < pathCount; ++i)
+	{
+		const std::string &sp = p->searchPaths[i];
+
+#ifdef HAVE_DIRENT
+		src.walked[i] = isHostDir(sp);
+#endif
+
+		if (src.walked[i] != cached.walked[i])
+			changed = true;
+
+		if (!src.walked[i])
+		{
+			haveExtras = true;
+			continue;
+		}
+
+#ifdef HAVE_DIRENT
+		/* A path previously not walked has no listings */
+		if (walkHostPath(sp, cached.trees[i], pool, p->allowSymlinks, src.trees[i]))
+			changed = true;
+#endif
+	}
+
+	/* Archive contents can only be gathered through PhysFS'
+	 * merged view, in which they might hide below any
+	 * directory; that costs a full traversal, so it is
+	 * only redone when anything at all changed */
+	if (haveExtras)
+	{
+		if (!changed && stampsUnchanged(cached.stamps))
+		{
+			src.extras = cached.extras;
+		}
+		else
+		{
+			BoostSet<std::string> hostFiles, hostDirs;
+
+			for (size_t i = 0; i < pathCount; ++i)
+				for (size_t j = 0; j < src.trees[i].size(); ++j)
+				{
+					const DirListing &listing = src.trees[i][j];
+
+					if (!listing.dir.empty())
+						hostDirs.insert(listing.dir);
+
+					for (size_t k = 0; k < listing.files.size(); ++k)
+						hostFiles.insert(joinPath(listing.dir, listing.files[k]));
+				}
+
+			ExtrasEnumData data(hostFiles, hostDirs, src.extras);
+			data.listing("");
+			PHYSFS_enumerate("", extrasEnumCB, &data);
+
+			changed = true;
+		}
+
+		src.stamps = collectStamps(p->searchPaths, src.walked, src.extras);
+	}
+
+	p->pathCache.clear();
+	p->fileLists.clear();
+
+	p->fileLists[""];
+
+	for (size_t i = 0; i < pathCount; ++i)
+		mergeTree(p, src.trees[i]);
+
+	mergeTree(p, src.extras);
+
+	buildBaseIndex(p);
+
+	if (cacheFile && changed)
+		savePathCache(p, cacheFile, src);
+}
+
+#define FONT_CACHE_MAGIC "MKXPFC01"
+
+/* Scan result of one font file; an empty family
+ * marks files which couldn't be opened as fonts */
+struct FontScanEntry
+{
+	int64_t size;
+	int64_t mtime;
+	std::string family;
+	std::string style;
+};
+
+typedef BoostHash<std::string, FontScanEntry> FontScanCache;
+
+static void loadFontCache(FontScanCache &cache, const char *cacheFile)
+{
+	std::vector<char> data;
+
+	if (!readWholeFile(cacheFile, data))
+		return;
+
+	CacheReader r(data);
+
+	char magic[sizeof(FONT_CACHE_MAGIC)-1];
+	if (!r.get(magic, sizeof(magic)) || memcmp(magic, FONT_CACHE_MAGIC, sizeof(magic)))
+		return;
+
+	int64_t count = r.getInt();
+
+	for (int64_t i = 0; i < count && r.ok; ++i)
+	{
+		std::string path = r.getStr();
+
+		FontScanEntry entry;
+		entry.size = r.getInt();
+		entry.mtime = r.getInt();
+		entry.family = r.getStr();
+		entry.style = r.getStr();
+
+		if (r.ok)
+			cache.insert(path, entry);
+	}
+}
+
+static void saveFontCache(const FontScanCache &cache, const char *cacheFile)
+{
+	CacheWriter w;
+
+	w.put(FONT_CACHE_MAGIC, sizeof(FONT_CACHE_MAGIC)-1);
+
+	int64_t count = 0;
+	FontScanCache::const_iterator iter;
+
+	for (iter = cache.cbegin(); iter != cache.cend(); ++iter)
+		++count;
+
+	w.putInt(count);
+	for (iter = cache.cbegin(); iter != cache.cend(); ++iter)
+	{
+		w.putStr(iter->first);
+		w.putInt(iter->second.size);
+		w.putInt(iter->second.mtime);
+		w.putStr(iter->second.family);
+		w.putStr(iter->second.style);
+	}
+
+	FILE *f = fopen(cacheFile, "wb");
+
+	if (!f)
+	{
+		Debug() << "Failed to write font cache" << cacheFile;
+		return;
+	}
+
+	if (fwrite(&w.data[0], 1, w.data.size(), f) != w.data.size())
+		Debug() << "Failed to write font cache" << cacheFile;
+
+	fclose(f);
 }
 
 struct FontSetsCBData
 {
 	FileSystemPrivate *p;
 	SharedFontState *sfs;
+
+	/* Previous scan results */
+	FontScanCache cached;
+	/* Results of this scan */
+	FontScanCache scanned;
+	bool changed;
 };
 
 static PHYSFS_EnumerateCallbackResult
@@ -498,17 +1592,51 @@ fontSetEnumCB (void *data, const char *dir, const char *fname)
 	char filename[512];
 	snprintf(filename, sizeof(filename), "%s/%s", dir, fname);
 
-	PHYSFS_File *handle = PHYSFS_openRead(filename);
+	PHYSFS_Stat stat;
+	FontScanEntry entry;
 
-	if (!handle)
-		return PHYSFS_ENUM_ERROR;
+	if (PHYSFS_stat(filename, &stat))
+	{
+		entry.size = stat.filesize;
+		entry.mtime = stat.modtime;
+	}
+	else
+	{
+		entry.size = entry.mtime = -1;
+	}
 
-	SDL_RWops ops;
-	initReadOps(handle, ops, false);
+	const FontScanEntry *prev = 0;
 
-	d->sfs->initFontSetCB(ops, filename);
+	if (d->cached.contains(filename))
+		prev = &d->cached[filename];
 
-	SDL_RWclose(&ops);
+	if (prev && prev->size == entry.size && prev->mtime == entry.mtime)
+	{
+		entry.family = prev->family;
+		entry.style = prev->style;
+	}
+	else
+	{
+		PHYSFS_File *handle = PHYSFS_openRead(filename);
+
+		if (!handle)
+			return PHYSFS_ENUM_ERROR;
+
+		SDL_RWops ops;
+		initReadOps(handle, ops, false);
+
+		if (!SharedFontState::readFontNames(ops, entry.family, entry.style))
+			entry.family.clear();
+
+		SDL_RWclose(&ops);
+
+		d->changed = true;
+	}
+
+	if (!entry.family.empty())
+		d->sfs->addFontSet(filename, entry.family, entry.style);
+
+	d->scanned.insert(filename, entry);
 
 	return PHYSFS_ENUM_OK;
 }
@@ -533,11 +1661,29 @@ findFontsFolderCB(void *data, const char *, const char *fname)
 	return PHYSFS_ENUM_OK;
 }
 
-void FileSystem::initFontSets(SharedFontState &sfs)
+void FileSystem::initFontSets(SharedFontState &sfs, const char *cacheFile)
 {
-	FontSetsCBData d = { p, &sfs };
+	FontSetsCBData d;
+	d.p = p;
+	d.sfs = &sfs;
+	d.changed = false;
+
+	if (cacheFile)
+		loadFontCache(d.cached, cacheFile);
 
 	PHYSFS_enumerate("", findFontsFolderCB, &d);
+
+	/* Removed fonts also count as a change */
+	int64_t cachedCount = 0, scannedCount = 0;
+	FontScanCache::const_iterator iter;
+
+	for (iter = d.cached.cbegin(); iter != d.cached.cend(); ++iter)
+		++cachedCount;
+	for (iter = d.scanned.cbegin(); iter != d.scanned.cend(); ++iter)
+		++scannedCount;
+
+	if (cacheFile && (d.changed || cachedCount != scannedCount))
+		saveFontCache(d.scanned, cacheFile);
 }
 
 struct OpenReadEnumData
@@ -607,6 +1753,17 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename)
 	if (data.pathTrans)
 		fullPath = (*data.pathTrans)[fullPath].c_str();
 
+	const char *ext = findExt(filename);
+
+	if (initMappedReadOps(fullPath, data.ops, false))
+	{
+		if (data.handler.tryRead(data.ops, ext))
+			data.stopSearching = true;
+
+		++data.matchCount;
+		return PHYSFS_ENUM_OK;
+	}
+
 	PHYSFS_File *phys = PHYSFS_openRead(fullPath);
 
 	if (!phys)
@@ -622,8 +1779,6 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename)
 
 	initReadOps(phys, data.ops, false);
 
-	const char *ext = findExt(filename);
-
 	if (data.handler.tryRead(data.ops, ext))
 		data.stopSearching = true;
 
@@ -633,6 +1788,29 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename)
 
 void FileSystem::openRead(OpenHandler &handler, const char *filename)
 {
+	std::string preloaded, preloadedExt;
+
+	if (shState->preloader().takeData(filename, preloaded, preloadedExt))
+	{
+		SDL_RWops ops;
+		initMemReadOps(preloaded, ops, false);
+		handler.tryRead(ops, preloadedExt.c_str());
+
+		return;
+	}
+
+	/* Only matches paths given with their extension */
+	if (shState->packedData().take(filename, preloaded))
+	{
+		const char *ext = strrchr(filename, '.');
+
+		SDL_RWops ops;
+		initMemReadOps(preloaded, ops, false);
+		handler.tryRead(ops, ext ? ext + 1 : "");
+
+		return;
+	}
+
 	char buffer[512];
 	size_t len = strcpySafe(buffer, filename, sizeof(buffer), -1);
 	char *delim;
@@ -648,6 +1826,9 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename)
 
 	const bool root = (delim == buffer);
 
+	/* Lower case full path, before it's cut in half below */
+	const std::string basePath(p->havePathCache ? buffer : "");
+
 	const char *file = buffer;
 	const char *dir = "";
 
@@ -665,12 +1846,15 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename)
 
 	if (p->havePathCache)
 	{
-		/* Get the list of files contained in this directory
-		 * and manually iterate over them */
-		const std::vector<std::string> &fileList = p->fileLists[dir];
-
-		for (size_t i = 0; i < fileList.size(); ++i)
-			openReadEnumCB(&data, dir, fileList[i].c_str());
+		/* Only try the files in this directory
+		 * that 'file' is a prefix of */
+		if (p->baseIndex.contains(basePath))
+		{
+			const std::vector<std::string> &candidates = p->baseIndex[basePath];
+
+			for (size_t i = 0; i < candidates.size(); ++i)
+				openReadEnumCB(&data, dir, candidates[i].c_str());
+		}
 	}
 	else
 	{
@@ -684,10 +1868,46 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename)
 		throw Exception(Exception::NoFileError, "%s", filename);
 }
 
+bool FileSystem::ReadAllHandler::tryRead(SDL_RWops &ops, const char *ext)
+{
+	Sint64 size = SDL_RWsize(&ops);
+
+	if (size >= 0)
+	{
+		data.resize(size);
+
+		if (size > 0)
+			data.resize(SDL_RWread(&ops, &data[0], 1, size));
+	}
+
+	SDL_RWclose(&ops);
+
+	this->ext = ext ? ext : "";
+
+	return size >= 0;
+}
+
 void FileSystem::openReadRaw(SDL_RWops &ops,
                              const char *filename,
                              bool freeOnClose)
 {
+	std::string preloaded, preloadedExt;
+
+	if (shState->preloader().takeData(filename, preloaded, preloadedExt))
+	{
+		initMemReadOps(preloaded, ops, freeOnClose);
+		return;
+	}
+
+	if (shState->packedData().take(filename, preloaded))
+	{
+		initMemReadOps(preloaded, ops, freeOnClose);
+		return;
+	}
+
+	if (initMappedReadOps(filename, ops, freeOnClose))
+		return;
+
 	PHYSFS_File *handle = PHYSFS_openRead(filename);
 	assert(handle);
 
@@ -24,24 +24,37 @@
 
 #include <SDL_rwops.h>
 
+#include <string>
+
 struct FileSystemPrivate;
 class SharedFontState;
+class WorkerPool;
 
 class FileSystem
 {
 public:
 	FileSystem(const char *argv0,
-	           bool allowSymlinks);
+	           bool allowSymlinks,
+	           int archiveReadAhead);
 	~FileSystem();
 
 	void addPath(const char *path);
 
 	/* Call these after the last 'addPath()' */
-	void createPathCache();
+
+	/* If 'cacheFile' is given, the cache is loaded from there
+	 * and only the directories which changed since are listed
+	 * again; the result is written back if anything differed.
+	 * Mounted host directories are walked on 'pool', if given */
+	void createPathCache(const char *cacheFile = 0,
+	                     WorkerPool *pool = 0);
 
 	/* Scans "Fonts/" and creates inventory of
-	 * available font assets */
-	void initFontSets(SharedFontState &sfs);
+	 * available font assets. If 'cacheFile' is given, the names
+	 * of fonts whose size and modification time are unchanged
+	 * are taken from there instead of opening the files, and
+	 * the results are written back if anything changed */
+	void initFontSets(SharedFontState &sfs, const char *cacheFile = 0);
 
 	struct OpenHandler
 	{
@@ -56,6 +69,15 @@ public:
 		virtual bool tryRead(SDL_RWops &ops, const char *ext) = 0;
 	};
 
+	/* Reads the first match into memory as is */
+	struct ReadAllHandler : OpenHandler
+	{
+		std::string data;
+		std::string ext;
+
+		bool tryRead(SDL_RWops &ops, const char *ext);
+	};
+
 	void openRead(OpenHandler &handler,
 	              const char *filename);
 
@@ -0,0 +1,163 @@
+/*
+** fillqueue.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "fillqueue.h"
+
+#include "glstate.h"
+#include "quadarray.h"
+#include "shader.h"
+#include "sharedstate.h"
+
+#include <algorithm>
+#include <vector>
+
+struct FillQueuePrivate
+{
+	ColorQuadArray quads;
+
+	/* Of each queued quad */
+	std::vector<IntRect> bounds;
+
+	const void *owner;
+	TEXFBO target;
+
+	FillQueuePrivate()
+	    : owner(0)
+	{}
+};
+
+FillQueue::FillQueue()
+    : p(0)
+{}
+
+FillQueue::~FillQueue()
+{
+	delete p;
+}
+
+void FillQueue::add(const void *owner, const TEXFBO &target, const Vertex vert[4])
+{
+	/* Created lazily, as QuadArray requires a fully
+	 * constructed SharedState */
+	if (!p)
+		p = new FillQueuePrivate;
+
+	if (p->owner != owner)
+		flush();
+
+	p->owner = owner;
+	p->target = target;
+
+	size_t i = p->quads.count();
+	p->quads.resize(i + 1);
+
+	for (int j = 0; j < 4; ++j)
+		p->quads.vertices[i*4+j] = vert[j];
+
+	const Vec2 &a = vert[0].pos;
+	const Vec2 &b = vert[2].pos;
+
+	const int x1 = std::min(a.x, b.x), y1 = std::min(a.y, b.y);
+	const int x2 = std::max(a.x, b.x), y2 = std::max(a.y, b.y);
+
+	p->bounds.push_back(IntRect(x1, y1, x2 - x1, y2 - y1));
+}
+
+bool FillQueue::pending(const void *owner) const
+{
+	return p && p->owner == owner && owner;
+}
+
+bool FillQueue::overlaps(const void *owner, const IntRect &rect) const
+{
+	if (!pending(owner))
+		return false;
+
+	for (size_t i = 0; i < p->bounds.size(); ++i)
+	{
+		const IntRect &b = p->bounds[i];
+
+		if (b.x < rect.x + rect.w && rect.x < b.x + b.w &&
+		    b.y < rect.y + rect.h && rect.y < b.y + b.h)
+			return true;
+	}
+
+	return false;
+}
+
+void FillQueue::flush(const void *owner)
+{
+	if (pending(owner))
+		flush();
+}
+
+void FillQueue::discard(const void *owner)
+{
+	if (!pending(owner))
+		return;
+
+	p->quads.clear();
+	p->bounds.clear();
+	p->owner = 0;
+}
+
+void FillQueue::flush()
+{
+	if (!p || p->quads.count() == 0)
+		return;
+
+	/* Flushes may happen in the middle of drawing something else
+	 * (eg. when a sprite binds the bitmap), so restore everything */
+	GLint prevFBO;
+	gl.GetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+
+	/* The bitmap is never the target of the screen mapping */
+	const ScreenMapping prevMapping = glState.scissorBox.getMapping();
+	glState.scissorBox.setMapping(ScreenMapping());
+
+	glState.program.push();
+	glState.blend.pushSet(false);
+	glState.scissorTest.pushSet(false);
+	glState.viewport.pushSet(IntRect(0, 0, p->target.width, p->target.height));
+
+	FBO::bind(p->target.fbo);
+
+	SimpleColorShader &shader = shState->shaders().simpleColor();
+	shader.bind();
+	shader.applyViewportProj();
+	shader.setTranslation(Vec2i());
+
+	p->quads.commit();
+	p->quads.draw();
+
+	glState.viewport.pop();
+	glState.scissorTest.pop();
+	glState.blend.pop();
+	glState.program.pop();
+
+	glState.scissorBox.setMapping(prevMapping);
+	FBO::bind(FBO::ID(prevFBO));
+
+	p->quads.clear();
+	p->bounds.clear();
+	p->owner = 0;
+}
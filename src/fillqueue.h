@@ -0,0 +1,67 @@
+/*
+** fillqueue.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef FILLQUEUE_H
+#define FILLQUEUE_H
+
+#include "etc-internal.h"
+#include "gl-util.h"
+
+struct Vertex;
+struct FillQueuePrivate;
+
+/* Defers the solid and gradient rectangle fills (including
+ * clears) of a bitmap, so that runs of them can be written
+ * with one upload and a single draw call instead of one
+ * each. Only one target has pending fills at any time;
+ * queueing into another one flushes the current one first.
+ * 'owner' merely identifies the target */
+class FillQueue
+{
+public:
+	FillQueue();
+	~FillQueue();
+
+	/* Queues one quad, to be drawn into 'target' without blending */
+	void add(const void *owner, const TEXFBO &target, const Vertex vert[4]);
+
+	bool pending(const void *owner) const;
+
+	/* Whether any fill pending for 'owner' touches 'rect'.
+	 * Operations that don't can be drawn ahead of them */
+	bool overlaps(const void *owner, const IntRect &rect) const;
+
+	/* Draws the fills pending for 'owner', if any. Leaves
+	 * the GL state (including the bound FBO) untouched */
+	void flush(const void *owner);
+
+	/* Drops the fills pending for 'owner' without drawing them,
+	 * for targets that are about to be cleared or released */
+	void discard(const void *owner);
+
+private:
+	void flush();
+
+	FillQueuePrivate *p;
+};
+
+#endif // FILLQUEUE_H
@@ -24,6 +24,7 @@
 
 #include "etc.h"
 #include "etc-internal.h"
+#include "handletable.h"
 
 class Flashable
 {
@@ -85,6 +86,12 @@ private:
 	float flashAlpha;
 	int duration;
 	int counter;
+
+	/* Entry in the table of elements Graphics
+	 * updates itself (see setAutoUpdateFlash) */
+	Handle autoHandle;
+
+	friend class Graphics;
 };
 
 #endif // FLASHABLE_H
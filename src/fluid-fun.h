@@ -9,10 +9,14 @@
 
 typedef struct _fluid_hashtable_t fluid_settings_t;
 typedef struct _fluid_synth_t fluid_synth_t;
+typedef struct _fluid_sfont_t fluid_sfont_t;
 
 typedef int (*FLUIDSETTINGSSETNUMPROC)(fluid_settings_t* settings, const char *name, double val);
 typedef int (*FLUIDSETTINGSSETSTRPROC)(fluid_settings_t* settings, const char *name, const char *str);
 typedef int (*FLUIDSYNTHSFLOADPROC)(fluid_synth_t* synth, const char* filename, int reset_presets);
+typedef fluid_sfont_t* (*FLUIDSYNTHGETSFONTPROC)(fluid_synth_t* synth, unsigned int num);
+typedef int (*FLUIDSYNTHADDSFONTPROC)(fluid_synth_t* synth, fluid_sfont_t* sfont);
+typedef int (*FLUIDSYNTHREMOVESFONTPROC)(fluid_synth_t* synth, fluid_sfont_t* sfont);
 typedef int (*FLUIDSYNTHSYSTEMRESETPROC)(fluid_synth_t* synth);
 typedef int (*FLUIDSYNTHWRITES16PROC)(fluid_synth_t* synth, int len, void* lout, int loff, int lincr, void* rout, int roff, int rincr);
 typedef int (*FLUIDSYNTHNOTEONPROC)(fluid_synth_t* synth, int chan, int key, int vel);
@@ -36,6 +40,9 @@ typedef void (*DELETEFLUIDSYNTHPROC)(fluid_synth_t* synth);
 	FLUID_FUN(settings_setnum, FLUIDSETTINGSSETNUMPROC) \
 	FLUID_FUN(settings_setstr, FLUIDSETTINGSSETSTRPROC) \
 	FLUID_FUN(synth_sfload, FLUIDSYNTHSFLOADPROC) \
+	FLUID_FUN(synth_get_sfont, FLUIDSYNTHGETSFONTPROC) \
+	FLUID_FUN(synth_add_sfont, FLUIDSYNTHADDSFONTPROC) \
+	FLUID_FUN(synth_remove_sfont, FLUIDSYNTHREMOVESFONTPROC) \
 	FLUID_FUN(synth_system_reset, FLUIDSYNTHSYSTEMRESETPROC) \
 	FLUID_FUN(synth_write_s16, FLUIDSYNTHWRITES16PROC) \
 	FLUID_FUN(synth_noteon, FLUIDSYNTHNOTEONPROC) \
@@ -27,6 +27,11 @@
 #include "boost-hash.h"
 #include "util.h"
 #include "config.h"
+#include "memstats.h"
+#include "workerpool.h"
+#include "startuptimer.h"
+
+#include <boost/functional/hash.hpp>
 
 #include <string>
 #include <utility>
@@ -48,7 +53,35 @@ BUNDLED_FONT_DECL(liberation)
 #define BNDL_F_D(f) BUNDLED_FONT_D(f)
 #define BNDL_F_L(f) BUNDLED_FONT_L(f)
 
-typedef std::pair<std::string, int> FontKey;
+/* SDL_ttf drops its glyph cache whenever the style of a
+ * handle changes, so every style gets a handle of its own */
+struct FontKey
+{
+	std::string family;
+	int size;
+	/* TTF_STYLE_* flags */
+	int style;
+
+	FontKey(const std::string &family, int size, int style)
+	    : family(family), size(size), style(style)
+	{}
+
+	bool operator==(const FontKey &o) const
+	{
+		return size == o.size && style == o.style && family == o.family;
+	}
+};
+
+static size_t hash_value(const FontKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.family);
+	boost::hash_combine(seed, key.size);
+	boost::hash_combine(seed, key.style);
+
+	return seed;
+}
 
 static SDL_RWops *openBundledFont()
 {
@@ -64,6 +97,19 @@ struct FontSet
 	std::string other;
 };
 
+/* Scans "Fonts/" off the RGSS thread during startup */
+struct FontScanJob : WorkerJob
+{
+	FileSystem *fs;
+	SharedFontState *sfs;
+	const std::string *cacheFile;
+
+	void run()
+	{
+		fs->initFontSets(*sfs, cacheFile->empty() ? 0 : cacheFile->c_str());
+	}
+};
+
 struct SharedFontStatePrivate
 {
 	/* Maps: font family name, To: substituted family name,
@@ -77,11 +123,64 @@ struct SharedFontStatePrivate
 	/* Pool of already opened fonts; once opened, they are reused
 	 * and never closed until the termination of the program */
 	BoostHash<FontKey, TTF_Font*> pool;
+
+	/* Whether "Fonts/" was scanned into 'sets' yet */
+	bool scanned;
+	std::string scanCacheFile;
+
+	/* Set if the scan was handed to 'scanJob' */
+	WorkerPool *scanPool;
+	FontScanJob scanJob;
+
+	void ensureScanned(SharedFontState &sfs)
+	{
+		if (scanned)
+			return;
+
+		scanned = true;
+		StartupPhase phase("Font scan");
+
+		if (scanPool)
+		{
+			scanPool->wait(scanJob);
+			return;
+		}
+
+		shState->fileSystem().initFontSets(sfs, scanCacheFile.empty()
+		                                   ? 0 : scanCacheFile.c_str());
+	}
+
+	/* Maps: physical font filename, To: its contents, which all
+	 * sizes of the font are opened from. Outlives 'pool' */
+	BoostHash<std::string, std::string*> fileData;
+
+	const std::string &getFileData(const char *path)
+	{
+		std::string *&data = fileData[path];
+
+		if (!data)
+		{
+			SDL_RWops ops;
+			shState->fileSystem().openReadRaw(ops, path, false);
+
+			FileSystem::ReadAllHandler reader;
+			reader.tryRead(ops, 0);
+
+			data = new std::string;
+			data->swap(reader.data);
+
+			MemStats::add(MemStats::FontData, data->size());
+		}
+
+		return *data;
+	}
 };
 
 SharedFontState::SharedFontState(const Config &conf)
 {
 	p = new SharedFontStatePrivate;
+	p->scanned = false;
+	p->scanPool = 0;
 
 	/* Parse font substitutions */
 	for (size_t i = 0; i < conf.fontSubs.size(); ++i)
@@ -101,26 +200,63 @@ SharedFontState::SharedFontState(const Config &conf)
 
 SharedFontState::~SharedFontState()
 {
+	/* The job must not outlive us */
+	if (p->scanPool && !p->scanned)
+		p->scanPool->wait(p->scanJob);
+
 	BoostHash<FontKey, TTF_Font*>::const_iterator iter;
 	for (iter = p->pool.cbegin(); iter != p->pool.cend(); ++iter)
 		TTF_CloseFont(iter->second);
 
+	BoostHash<std::string, std::string*>::const_iterator diter;
+	for (diter = p->fileData.cbegin(); diter != p->fileData.cend(); ++diter)
+		delete diter->second;
+
+	MemStats::set(MemStats::FontHandles, 0);
+	MemStats::set(MemStats::FontData, 0);
+
 	delete p;
 }
 
-void SharedFontState::initFontSetCB(SDL_RWops &ops,
-                                    const std::string &filename)
+void SharedFontState::setScanCacheFile(const std::string &cacheFile)
+{
+	p->scanCacheFile = cacheFile;
+}
+
+void SharedFontState::prescan(FileSystem &fs, WorkerPool &pool)
+{
+	if (p->scanned || p->scanPool || !pool.enabled())
+		return;
+
+	p->scanJob.fs = &fs;
+	p->scanJob.sfs = this;
+	p->scanJob.cacheFile = &p->scanCacheFile;
+
+	p->scanPool = &pool;
+	pool.submit(p->scanJob);
+}
+
+bool SharedFontState::readFontNames(SDL_RWops &ops,
+                                    std::string &family,
+                                    std::string &style)
 {
 	TTF_Font *font = TTF_OpenFontRW(&ops, 0, 0);
 
 	if (!font)
-		return;
+		return false;
 
-	std::string family = TTF_FontFaceFamilyName(font);
-	std::string style = TTF_FontFaceStyleName(font);
+	family = TTF_FontFaceFamilyName(font);
+	style = TTF_FontFaceStyleName(font);
 
 	TTF_CloseFont(font);
 
+	return true;
+}
+
+void SharedFontState::addFontSet(const std::string &filename,
+                                 const std::string &family,
+                                 const std::string &style)
+{
 	FontSet &set = p->sets[family];
 
 	if (style == "Regular")
@@ -130,12 +266,15 @@ void SharedFontState::initFontSetCB(SDL_RWops &ops,
 }
 
 _TTF_Font *SharedFontState::getFont(std::string family,
-                                    int size)
+                                    int size, int style)
 {
 	/* Check for substitutions */
 	if (p->subs.contains(family))
 		family = p->subs[family];
 
+	if (!family.empty())
+		p->ensureScanned(*this);
+
 	/* Find out if the font asset exists */
 	const FontSet &req = p->sets[family];
 
@@ -145,7 +284,7 @@ _TTF_Font *SharedFontState::getFont(std::string family,
 		family = "";
 	}
 
-	FontKey key(family, size);
+	FontKey key(family, size, style);
 
 	TTF_Font *font = p->pool.value(key);
 
@@ -167,8 +306,9 @@ _TTF_Font *SharedFontState::getFont(std::string family,
 		const char *path = !req.regular.empty()
 		                 ? req.regular.c_str() : req.other.c_str();
 
-		ops = SDL_AllocRW();
-		shState->fileSystem().openReadRaw(*ops, path, true);
+		/* Read the file only once for all sizes */
+		const std::string &data = p->getFileData(path);
+		ops = SDL_RWFromConstMem(data.c_str(), data.size());
 	}
 
 	// FIXME 0.9 is guesswork at this point
@@ -179,7 +319,10 @@ _TTF_Font *SharedFontState::getFont(std::string family,
 	if (!font)
 		throw Exception(Exception::SDLError, "%s", SDL_GetError());
 
+	TTF_SetFontStyle(font, style);
+
 	p->pool.insert(key, font);
+	MemStats::add(MemStats::FontHandles, 1);
 
 	return font;
 }
@@ -190,6 +333,11 @@ bool SharedFontState::fontPresent(std::string family) const
 	if (p->subs.contains(family))
 		family = p->subs[family];
 
+	if (family.empty())
+		return false;
+
+	p->ensureScanned(const_cast<SharedFontState&>(*this));
+
 	const FontSet &set = p->sets[family];
 
 	return !(set.regular.empty() && set.other.empty());
@@ -251,10 +399,29 @@ struct FontPrivate
 
 	static std::vector<std::string> initialDefaultNames;
 
+	/* The initial default names are only checked for presence
+	 * once the default name is first needed, as that requires
+	 * "Fonts/" to be scanned */
+	static bool defaultNamePending;
+
+	static const std::string &getDefaultName()
+	{
+		if (defaultNamePending)
+		{
+			defaultNamePending = false;
+			pickExistingFontName(initialDefaultNames, defaultName,
+			                     shState->fontState());
+		}
+
+		return defaultName;
+	}
+
 	/* The actual font is opened as late as possible
 	 * (when it is queried by a Bitmap), prior it is
 	 * set to null */
 	TTF_Font *sdlFont;
+	/* Style of the pooled handle 'sdlFont' */
+	int sdlStyle;
 
 	FontPrivate(int size)
 	    : size(size),
@@ -266,7 +433,8 @@ struct FontPrivate
 	      outColor(&outColorTmp),
 	      colorTmp(*defaultColor),
 	      outColorTmp(*defaultOutColor),
-	      sdlFont(0)
+	      sdlFont(0),
+	      sdlStyle(TTF_STYLE_NORMAL)
 	{}
 
 	FontPrivate(const FontPrivate &other)
@@ -280,7 +448,8 @@ struct FontPrivate
 	      outColor(&outColorTmp),
 	      colorTmp(*other.color),
 	      outColorTmp(*other.outColor),
-	      sdlFont(other.sdlFont)
+	      sdlFont(other.sdlFont),
+	      sdlStyle(other.sdlStyle)
 	{}
 
 	void operator=(const FontPrivate &o)
@@ -311,6 +480,7 @@ Color FontPrivate::defaultColorTmp(255, 255, 255, 255);
 Color FontPrivate::defaultOutColorTmp(0, 0, 0, 128);
 
 std::vector<std::string> FontPrivate::initialDefaultNames;
+bool FontPrivate::defaultNamePending = false;
 
 bool Font::doesExist(const char *name)
 {
@@ -328,7 +498,7 @@ Font::Font(const std::vector<std::string> *names,
 	if (names)
 		setName(*names);
 	else
-		p->name = FontPrivate::defaultName;
+		p->name = FontPrivate::getDefaultName();
 }
 
 Font::Font(const Font &other)
@@ -389,6 +559,7 @@ DEF_ATTR_SIMPLE_STATIC(Font, DefaultOutColor, Color&, *FontPrivate::defaultOutCo
 void Font::setDefaultName(const std::vector<std::string> &names,
                           const SharedFontState &sfs)
 {
+	FontPrivate::defaultNamePending = false;
 	pickExistingFontName(names, FontPrivate::defaultName, sfs);
 }
 
@@ -435,7 +606,8 @@ void Font::initDefaults(const SharedFontState &sfs)
 		names.push_back("VL Gothic");
 	}
 
-	setDefaultName(names, sfs);
+	(void) sfs;
+	FontPrivate::defaultNamePending = true;
 
 	FontPrivate::defaultOutline = (rgssVer >= 3 ? true : false);
 	FontPrivate::defaultShadow  = (rgssVer == 2 ? true : false);
@@ -443,10 +615,6 @@ void Font::initDefaults(const SharedFontState &sfs)
 
 _TTF_Font *Font::getSdlFont()
 {
-	if (!p->sdlFont)
-		p->sdlFont = shState->fontState().getFont(p->name.c_str(),
-		                                          p->size);
-
 	int style = TTF_STYLE_NORMAL;
 
 	if (p->bold)
@@ -455,7 +623,12 @@ _TTF_Font *Font::getSdlFont()
 	if (p->italic)
 		style |= TTF_STYLE_ITALIC;
 
-	TTF_SetFontStyle(p->sdlFont, style);
+	if (!p->sdlFont || p->sdlStyle != style)
+	{
+		p->sdlFont = shState->fontState().getFont(p->name.c_str(),
+		                                          p->size, style);
+		p->sdlStyle = style;
+	}
 
 	return p->sdlFont;
 }
@@ -31,6 +31,8 @@
 struct SDL_RWops;
 struct _TTF_Font;
 struct Config;
+class FileSystem;
+class WorkerPool;
 
 struct SharedFontStatePrivate;
 
@@ -40,15 +42,33 @@ public:
 	SharedFontState(const Config &conf);
 	~SharedFontState();
 
-	/* Called from FileSystem during font cache initialization
-	 * (when "Fonts/" is scanned for available assets).
-	 * 'ops' is an opened handle to a possible font file,
-	 * 'filename' is the corresponding path */
-	void initFontSetCB(SDL_RWops &ops,
-	                   const std::string &filename);
-
+	/* "Fonts/" is only scanned once a font family is first
+	 * looked up. If 'cacheFile' isn't empty, the scan results
+	 * are persisted there (see FileSystem::initFontSets) */
+	void setScanCacheFile(const std::string &cacheFile);
+
+	/* Starts the scan right away on 'pool', so that it overlaps
+	 * with the rest of startup; the first lookup then only waits
+	 * for it to finish. The cache file must be set before */
+	void prescan(FileSystem &fs, WorkerPool &pool);
+
+	/* Called from FileSystem during the scan of "Fonts/".
+	 * Reads the names of the font in 'ops'; returns false
+	 * if it can't be opened as one. Doesn't close 'ops' */
+	static bool readFontNames(SDL_RWops &ops,
+	                          std::string &family,
+	                          std::string &style);
+
+	/* Adds the font file 'filename' to the inventory */
+	void addFontSet(const std::string &filename,
+	                const std::string &family,
+	                const std::string &style);
+
+	/* Handles are pooled per family, size and style
+	 * (TTF_STYLE_* flags); callers must leave the style
+	 * of the returned handle alone */
 	_TTF_Font *getFont(std::string family,
-	                   int size);
+	                   int size, int style = 0);
 
 	bool fontPresent(std::string family) const;
 
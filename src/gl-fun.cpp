@@ -97,6 +97,7 @@ void initGLFunctions()
 
 	/* Assume single digit */
 	int glMajor = *ver - '0';
+	int glMinor = ver[1] == '.' ? ver[2] - '0' : 0;
 
 	if (glMajor < 2)
 		throw EXC("At least OpenGL (ES) 2.0 is required");
@@ -105,6 +106,10 @@ void initGLFunctions()
 	{
 		GL_ES_FUN;
 	}
+	else
+	{
+		GL_DESKTOP_FUN;
+	}
 
 	BoostSet<std::string> ext;
 
@@ -163,6 +168,123 @@ void initGLFunctions()
 		GL_VAO_FUN;
 	}
 
+	/* Instancing entrypoints */
+	bool core33 = !gles && (glMajor > 3 || (glMajor == 3 && glMinor >= 3));
+
+	if (core33 || (gles && glMajor >= 3))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX ""
+		GL_INSTANCED_FUN;
+	}
+	else if (HAVE_EXT(ARB_instanced_arrays) && HAVE_EXT(ARB_draw_instanced))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX "ARB"
+		GL_INSTANCED_FUN;
+	}
+	else if (HAVE_EXT(EXT_instanced_arrays))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX "EXT"
+		GL_INSTANCED_FUN;
+	}
+
+	gl.instanced_arrays = gl.VertexAttribDivisor && gl.DrawElementsInstanced;
+
+	/* Buffer mapping entrypoints (only used
+	 * together with pixel pack buffers) */
+	if (glMajor >= 3 || (!gles && HAVE_EXT(ARB_map_buffer_range)))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX ""
+		GL_MAP_BUFFER_FUN;
+
+		gl.pixel_pack_buffer = true;
+	}
+
+	/* Program binary entrypoints */
+	bool core41 = !gles && (glMajor > 4 || (glMajor == 4 && glMinor >= 1));
+
+	if (core41 || (gles && glMajor >= 3) || HAVE_EXT(ARB_get_program_binary))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX ""
+		GL_PROGRAM_BINARY_FUN;
+		GL_PROGRAM_PARAM_FUN;
+	}
+	else if (HAVE_EXT(OES_get_program_binary))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX "OES"
+		GL_PROGRAM_BINARY_FUN;
+	}
+
+	if (gl.GetProgramBinary && gl.ProgramBinary)
+	{
+		/* Some drivers expose the entrypoints
+		 * without supporting a single format */
+		GLint formatCount = 0;
+		gl.GetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+
+		gl.program_binary = formatCount > 0;
+	}
+
+	/* Timer query entrypoints */
+	if (core33 || (!gles && HAVE_EXT(ARB_timer_query)))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX ""
+		GL_TIMER_QUERY_FUN;
+
+		gl.timer_query = true;
+	}
+	else if (HAVE_EXT(EXT_disjoint_timer_query))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX "EXT"
+		GL_TIMER_QUERY_FUN;
+
+		gl.timer_query = true;
+		gl.timer_query_disjoint = true;
+	}
+
+	/* Sync object entrypoints */
+	bool core32 = !gles && (glMajor > 3 || (glMajor == 3 && glMinor >= 2));
+
+	if (core32 || (gles && glMajor >= 3) || HAVE_EXT(ARB_sync))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX ""
+		GL_SYNC_FUN;
+
+		gl.sync = true;
+	}
+	else if (HAVE_EXT(APPLE_sync))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX "APPLE"
+		GL_SYNC_FUN;
+
+		gl.sync = true;
+	}
+
+	/* Framebuffer invalidation entrypoints, hints only */
+	bool core43 = !gles && (glMajor > 4 || (glMajor == 4 && glMinor >= 3));
+
+	if (core43 || (gles && glMajor >= 3))
+	{
+#undef EXT_SUFFIX
+#define EXT_SUFFIX ""
+		GL_INVALIDATE_FUN;
+	}
+	else if (gles && HAVE_EXT(EXT_discard_framebuffer))
+	{
+		/* Same semantics under a different name */
+		gl.InvalidateFramebuffer = (_PFNGLINVALIDATEFRAMEBUFFERPROC)
+		        SDL_GL_GetProcAddress("glDiscardFramebufferEXT");
+	}
+
 	/* Debug callback entrypoints */
 	if (HAVE_EXT(KHR_debug))
 	{
@@ -33,6 +33,8 @@
 typedef GLenum (APIENTRYP _PFNGLGETERRORPROC) (void);
 typedef void (APIENTRYP _PFNGLCLEARCOLORPROC) (GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
 typedef void (APIENTRYP _PFNGLCLEARPROC) (GLbitfield mask);
+typedef void (APIENTRYP _PFNGLFLUSHPROC) (void);
+typedef void (APIENTRYP _PFNGLFINISHPROC) (void);
 typedef const GLubyte * (APIENTRYP _PFNGLGETSTRINGPROC) (GLenum name);
 typedef void (APIENTRYP _PFNGLGETINTEGERVPROC) (GLenum pname, GLint *params);
 typedef void (APIENTRYP _PFNGLPIXELSTOREIPROC) (GLenum pname, GLint param);
@@ -45,6 +47,12 @@ typedef void (APIENTRYP _PFNGLBLENDFUNCPROC) (GLenum sfactor, GLenum dfactor);
 typedef void (APIENTRYP _PFNGLBLENDFUNCSEPARATEPROC) (GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha);
 typedef void (APIENTRYP _PFNGLBLENDEQUATIONPROC) (GLenum mode);
 typedef void (APIENTRYP _PFNGLDRAWELEMENTSPROC) (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+typedef void (APIENTRYP _PFNGLDEPTHMASKPROC) (GLboolean flag);
+typedef void (APIENTRYP _PFNGLDEPTHFUNCPROC) (GLenum func);
+
+/* Depth range */
+typedef void (APIENTRYP _PFNGLDEPTHRANGEFPROC) (GLclampf zNear, GLclampf zFar);
+typedef void (APIENTRYP _PFNGLDEPTHRANGEPROC) (double zNear, double zFar);
 
 /* Texture */
 typedef void (APIENTRYP _PFNGLGENTEXTURESPROC) (GLsizei n, GLuint *textures);
@@ -54,6 +62,7 @@ typedef void (APIENTRYP _PFNGLTEXIMAGE2DPROC) (GLenum target, GLint level, GLint
 typedef void (APIENTRYP _PFNGLTEXSUBIMAGE2DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid *pixels);
 typedef void (APIENTRYP _PFNGLTEXPARAMETERIPROC) (GLenum target, GLenum pname, GLint param);
 typedef void (APIENTRYP _PFNGLACTIVETEXTUREPROC) (GLenum texture);
+typedef void (APIENTRYP _PFNGLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
 
 /* Debugging */
 typedef void (APIENTRY * _GLDEBUGPROC) (GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void *userParam);
@@ -67,6 +76,10 @@ typedef void (APIENTRYP _PFNGLBINDBUFFERPROC) (GLenum target, GLuint buffer);
 typedef void (APIENTRYP _PFNGLBUFFERDATAPROC) (GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage);
 typedef void (APIENTRYP _PFNGLBUFFERSUBDATAPROC) (GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data);
 
+/* Buffer mapping */
+typedef void* (APIENTRYP _PFNGLMAPBUFFERRANGEPROC) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean (APIENTRYP _PFNGLUNMAPBUFFERPROC) (GLenum target);
+
 /* Shader */
 typedef GLuint (APIENTRYP _PFNGLCREATESHADERPROC) (GLenum type);
 typedef void (APIENTRYP _PFNGLDELETESHADERPROC) (GLuint shader);
@@ -103,6 +116,12 @@ typedef void (APIENTRYP _PFNGLGENFRAMEBUFFERSPROC) (GLsizei n, GLuint* framebuff
 typedef void (APIENTRYP _PFNGLDELETEFRAMEBUFFERSPROC) (GLsizei n, const GLuint* framebuffers);
 typedef void (APIENTRYP _PFNGLBINDFRAMEBUFFERPROC) (GLenum target, GLuint framebuffer);
 typedef void (APIENTRYP _PFNGLFRAMEBUFFERTEXTURE2DPROC) (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+typedef void (APIENTRYP _PFNGLGENRENDERBUFFERSPROC) (GLsizei n, GLuint* renderbuffers);
+typedef void (APIENTRYP _PFNGLDELETERENDERBUFFERSPROC) (GLsizei n, const GLuint* renderbuffers);
+typedef void (APIENTRYP _PFNGLBINDRENDERBUFFERPROC) (GLenum target, GLuint renderbuffer);
+typedef void (APIENTRYP _PFNGLRENDERBUFFERSTORAGEPROC) (GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP _PFNGLFRAMEBUFFERRENDERBUFFERPROC) (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+typedef void (APIENTRYP _PFNGLGENERATEMIPMAPPROC) (GLenum target);
 typedef void (APIENTRYP _PFNGLBLITFRAMEBUFFERPROC) (GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
 
 /* Vertex array object */
@@ -110,9 +129,35 @@ typedef void (APIENTRYP _PFNGLGENVERTEXARRAYSPROC) (GLsizei n, GLuint* arrays);
 typedef void (APIENTRYP _PFNGLDELETEVERTEXARRAYSPROC) (GLsizei n, const GLuint* arrays);
 typedef void (APIENTRYP _PFNGLBINDVERTEXARRAYPROC) (GLuint array);
 
+/* Instanced rendering */
+typedef void (APIENTRYP _PFNGLVERTEXATTRIBDIVISORPROC) (GLuint index, GLuint divisor);
+typedef void (APIENTRYP _PFNGLDRAWELEMENTSINSTANCEDPROC) (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount);
+
 /* GLES only */
 typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 
+/* Program binary */
+typedef void (APIENTRYP _PFNGLGETPROGRAMBINARYPROC) (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP _PFNGLPROGRAMBINARYPROC) (GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP _PFNGLPROGRAMPARAMETERIPROC) (GLuint program, GLenum pname, GLint value);
+
+/* Timer query */
+typedef void (APIENTRYP _PFNGLGENQUERIESPROC) (GLsizei n, GLuint *ids);
+typedef void (APIENTRYP _PFNGLDELETEQUERIESPROC) (GLsizei n, const GLuint *ids);
+typedef void (APIENTRYP _PFNGLBEGINQUERYPROC) (GLenum target, GLuint id);
+typedef void (APIENTRYP _PFNGLENDQUERYPROC) (GLenum target);
+typedef void (APIENTRYP _PFNGLGETQUERYOBJECTUIVPROC) (GLuint id, GLenum pname, GLuint *params);
+typedef void (APIENTRYP _PFNGLGETQUERYOBJECTUI64VPROC) (GLuint id, GLenum pname, GLuint64 *params);
+
+/* Sync objects (the GLES2 headers lack GLsync) */
+typedef struct __GLsync *_GLsync;
+typedef _GLsync (APIENTRYP _PFNGLFENCESYNCPROC) (GLenum condition, GLbitfield flags);
+typedef void (APIENTRYP _PFNGLDELETESYNCPROC) (_GLsync sync);
+typedef void (APIENTRYP _PFNGLWAITSYNCPROC) (_GLsync sync, GLbitfield flags, GLuint64 timeout);
+
+/* Also matches glDiscardFramebufferEXT */
+typedef void (APIENTRYP _PFNGLINVALIDATEFRAMEBUFFERPROC) (GLenum target, GLsizei numAttachments, const GLenum *attachments);
+
 #ifdef GLES2_HEADER
 #define GL_NUM_EXTENSIONS 0x821D
 #define GL_READ_FRAMEBUFFER 0x8CA8
@@ -120,6 +165,48 @@ typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 #define GL_UNPACK_ROW_LENGTH 0x0CF2
 #define GL_UNPACK_SKIP_PIXELS 0x0CF4
 #define GL_UNPACK_SKIP_ROWS 0x0CF3
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#define GL_STREAM_READ 0x88E1
+#define GL_MAP_READ_BIT 0x0001
+#define GL_MAP_WRITE_BIT 0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+
+#ifndef GL_COLOR
+#define GL_COLOR 0x1800
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
 #endif
 
 #define GL_20_FUN \
@@ -127,6 +214,8 @@ typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 	GL_FUN(GetError, _PFNGLGETERRORPROC) \
 	GL_FUN(ClearColor, _PFNGLCLEARCOLORPROC) \
 	GL_FUN(Clear, _PFNGLCLEARPROC) \
+	GL_FUN(Flush, _PFNGLFLUSHPROC) \
+	GL_FUN(Finish, _PFNGLFINISHPROC) \
 	GL_FUN(GetString, _PFNGLGETSTRINGPROC) \
 	GL_FUN(GetIntegerv, _PFNGLGETINTEGERVPROC) \
 	GL_FUN(PixelStorei, _PFNGLPIXELSTOREIPROC) \
@@ -139,6 +228,8 @@ typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 	GL_FUN(BlendFuncSeparate, _PFNGLBLENDFUNCSEPARATEPROC) \
 	GL_FUN(BlendEquation, _PFNGLBLENDEQUATIONPROC) \
 	GL_FUN(DrawElements, _PFNGLDRAWELEMENTSPROC) \
+	GL_FUN(DepthMask, _PFNGLDEPTHMASKPROC) \
+	GL_FUN(DepthFunc, _PFNGLDEPTHFUNCPROC) \
 	/* Texture */ \
 	GL_FUN(GenTextures, _PFNGLGENTEXTURESPROC) \
 	GL_FUN(DeleteTextures, _PFNGLDELETETEXTURESPROC) \
@@ -147,6 +238,7 @@ typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 	GL_FUN(TexSubImage2D, _PFNGLTEXSUBIMAGE2DPROC) \
 	GL_FUN(TexParameteri, _PFNGLTEXPARAMETERIPROC) \
 	GL_FUN(ActiveTexture, _PFNGLACTIVETEXTUREPROC) \
+	GL_FUN(CompressedTexImage2D, _PFNGLCOMPRESSEDTEXIMAGE2DPROC) \
 	/* Buffer object */ \
 	GL_FUN(GenBuffers, _PFNGLGENBUFFERSPROC) \
 	GL_FUN(DeleteBuffers, _PFNGLDELETEBUFFERSPROC) \
@@ -182,14 +274,26 @@ typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 	GL_FUN(VertexAttribPointer, _PFNGLVERTEXATTRIBPOINTERPROC)
 
 #define GL_ES_FUN \
-	GL_FUN(ReleaseShaderCompiler, _PFNGLRELEASESHADERCOMPILERPROC)
+	GL_FUN(ReleaseShaderCompiler, _PFNGLRELEASESHADERCOMPILERPROC) \
+	GL_FUN(DepthRangef, _PFNGLDEPTHRANGEFPROC)
+
+#define GL_DESKTOP_FUN \
+	GL_FUN(DepthRange, _PFNGLDEPTHRANGEPROC)
 
 #define GL_FBO_FUN \
 	/* Framebuffer object */ \
 	GL_FUN(GenFramebuffers, _PFNGLGENFRAMEBUFFERSPROC) \
 	GL_FUN(DeleteFramebuffers, _PFNGLDELETEFRAMEBUFFERSPROC) \
 	GL_FUN(BindFramebuffer, _PFNGLBINDFRAMEBUFFERPROC) \
-	GL_FUN(FramebufferTexture2D, _PFNGLFRAMEBUFFERTEXTURE2DPROC)
+	GL_FUN(FramebufferTexture2D, _PFNGLFRAMEBUFFERTEXTURE2DPROC) \
+	/* Renderbuffer object */ \
+	GL_FUN(GenRenderbuffers, _PFNGLGENRENDERBUFFERSPROC) \
+	GL_FUN(DeleteRenderbuffers, _PFNGLDELETERENDERBUFFERSPROC) \
+	GL_FUN(BindRenderbuffer, _PFNGLBINDRENDERBUFFERPROC) \
+	GL_FUN(RenderbufferStorage, _PFNGLRENDERBUFFERSTORAGEPROC) \
+	GL_FUN(FramebufferRenderbuffer, _PFNGLFRAMEBUFFERRENDERBUFFERPROC) \
+	/* Part of the FBO extensions */ \
+	GL_FUN(GenerateMipmap, _PFNGLGENERATEMIPMAPPROC)
 
 #define GL_FBO_BLIT_FUN \
 	GL_FUN(BlitFramebuffer, _PFNGLBLITFRAMEBUFFERPROC)
@@ -200,6 +304,38 @@ typedef void (APIENTRYP _PFNGLRELEASESHADERCOMPILERPROC) (void);
 	GL_FUN(DeleteVertexArrays, _PFNGLDELETEVERTEXARRAYSPROC) \
 	GL_FUN(BindVertexArray, _PFNGLBINDVERTEXARRAYPROC)
 
+#define GL_INSTANCED_FUN \
+	/* Instanced rendering */ \
+	GL_FUN(VertexAttribDivisor, _PFNGLVERTEXATTRIBDIVISORPROC) \
+	GL_FUN(DrawElementsInstanced, _PFNGLDRAWELEMENTSINSTANCEDPROC)
+
+#define GL_MAP_BUFFER_FUN \
+	GL_FUN(MapBufferRange, _PFNGLMAPBUFFERRANGEPROC) \
+	GL_FUN(UnmapBuffer, _PFNGLUNMAPBUFFERPROC)
+
+#define GL_PROGRAM_BINARY_FUN \
+	GL_FUN(GetProgramBinary, _PFNGLGETPROGRAMBINARYPROC) \
+	GL_FUN(ProgramBinary, _PFNGLPROGRAMBINARYPROC)
+
+#define GL_PROGRAM_PARAM_FUN \
+	GL_FUN(ProgramParameteri, _PFNGLPROGRAMPARAMETERIPROC)
+
+#define GL_TIMER_QUERY_FUN \
+	GL_FUN(GenQueries, _PFNGLGENQUERIESPROC) \
+	GL_FUN(DeleteQueries, _PFNGLDELETEQUERIESPROC) \
+	GL_FUN(BeginQuery, _PFNGLBEGINQUERYPROC) \
+	GL_FUN(EndQuery, _PFNGLENDQUERYPROC) \
+	GL_FUN(GetQueryObjectuiv, _PFNGLGETQUERYOBJECTUIVPROC) \
+	GL_FUN(GetQueryObjectui64v, _PFNGLGETQUERYOBJECTUI64VPROC)
+
+#define GL_SYNC_FUN \
+	GL_FUN(FenceSync, _PFNGLFENCESYNCPROC) \
+	GL_FUN(DeleteSync, _PFNGLDELETESYNCPROC) \
+	GL_FUN(WaitSync, _PFNGLWAITSYNCPROC)
+
+#define GL_INVALIDATE_FUN \
+	GL_FUN(InvalidateFramebuffer, _PFNGLINVALIDATEFRAMEBUFFERPROC)
+
 #define GL_DEBUG_KHR_FUN \
 	GL_FUN(DebugMessageCallback, _PFNGLDEBUGMESSAGECALLBACKPROC)
 
@@ -213,9 +349,17 @@ struct GLFunctions
 
 	GL_20_FUN
 	GL_ES_FUN
+	GL_DESKTOP_FUN
 	GL_FBO_FUN
 	GL_FBO_BLIT_FUN
 	GL_VAO_FUN
+	GL_INSTANCED_FUN
+	GL_MAP_BUFFER_FUN
+	GL_PROGRAM_BINARY_FUN
+	GL_PROGRAM_PARAM_FUN
+	GL_TIMER_QUERY_FUN
+	GL_SYNC_FUN
+	GL_INVALIDATE_FUN
 	GL_DEBUG_KHR_FUN
 	GL_GREMEMDY_FUN
 
@@ -223,6 +367,22 @@ struct GLFunctions
 	bool unpack_subimage;
 	bool npot_repeat;
 
+	/* Pixel pack buffers that can be mapped for reading
+	 * (and unpack buffers that can be mapped for writing) */
+	bool pixel_pack_buffer;
+
+	/* Per-instance vertex attributes and instanced draws */
+	bool instanced_arrays;
+
+	/* Linked programs can be retrieved and reloaded as binaries */
+	bool program_binary;
+	/* GL_TIME_ELAPSED queries */
+	bool timer_query;
+	/* Results can be invalidated by GPU_DISJOINT events */
+	bool timer_query_disjoint;
+	/* Fences, also for ordering work across shared contexts */
+	bool sync;
+
 #undef GL_FUN
 };
 
@@ -24,6 +24,11 @@
 #include "sharedstate.h"
 #include "glstate.h"
 #include "quad.h"
+#include "quadarray.h"
+#include "global-ibo.h"
+#include "uploadstaging.h"
+
+#include <algorithm>
 
 namespace GLMeta
 {
@@ -42,16 +47,17 @@ void subRectImageUpload(GLint srcW, GLint srcX, GLint srcY,
 	}
 	else
 	{
-		SDL_PixelFormat *form = src->format;
-		SDL_Surface *tmp = SDL_CreateRGBSurface(0, dstW, dstH, form->BitsPerPixel,
-		                                        form->Rmask, form->Gmask, form->Bmask, form->Amask);
-		SDL_Rect srcRect = { srcX, srcY, dstW, dstH };
-
-		SDL_BlitSurface(src, &srcRect, tmp, 0);
+		/* Gather the rows in staging memory */
+		const int bpp = src->format->BytesPerPixel;
+		const size_t rowSize = dstW * bpp;
+		uint8_t *dst = static_cast<uint8_t*>(UploadStaging::map(rowSize * dstH));
+		const uint8_t *pixels = static_cast<const uint8_t*>(src->pixels);
 
-		TEX::uploadSubImage(dstX, dstY, dstW, dstH, tmp->pixels, format);
+		for (int y = 0; y < dstH; ++y)
+			memcpy(dst + y * rowSize,
+			       pixels + (srcY + y) * src->pitch + srcX * bpp, rowSize);
 
-		SDL_FreeSurface(tmp);
+		UploadStaging::upload(dstX, dstY, dstW, dstH, format);
 	}
 }
 
@@ -67,18 +73,89 @@ void subRectImageEnd()
 
 #define HAVE_NATIVE_VAO gl.GenVertexArrays
 
+static void vaoPointAttribs(VAO &vao, size_t baseVertex)
+{
+	const char *base = (const char*) 0 + baseVertex * vao.vertSize;
+
+	for (size_t i = 0; i < vao.attrCount; ++i)
+	{
+		const VertexAttribute &va = vao.attr[i];
+
+		gl.VertexAttribPointer(va.index, va.size, va.type, GL_FALSE, vao.vertSize,
+		                       base + (size_t) va.offset);
+	}
+}
+
 static void vaoBindRes(VAO &vao)
 {
 	VBO::bind(vao.vbo);
 	IBO::bind(vao.ibo);
 
 	for (size_t i = 0; i < vao.attrCount; ++i)
+		gl.EnableVertexAttribArray(vao.attr[i].index);
+
+	vaoPointAttribs(vao, 0);
+}
+
+/* Without native VAOs, the attribute setup of the last bound
+ * VAO is left applied (vaoUnbind doesn't undo it), so binding
+ * the same one again, as consecutive draws of eg. the shared
+ * quads do, costs nothing */
+static struct
+{
+	const VAO *vao;
+	const VertexAttribute *attr;
+	VBO::ID vbo;
+	IBO::ID ibo;
+
+	/* Bit per currently enabled attribute index */
+	uint32_t enabled;
+} vaoApplied;
+
+static void vaoApply(VAO &vao)
+{
+	if (vaoApplied.vao == &vao && vaoApplied.attr == vao.attr &&
+	    vaoApplied.vbo == vao.vbo && vaoApplied.ibo == vao.ibo)
+		return;
+
+	VBO::bind(vao.vbo);
+	IBO::bind(vao.ibo);
+
+	uint32_t enabled = 0;
+
+	for (size_t i = 0; i < vao.attrCount; ++i)
+		enabled |= 1u << vao.attr[i].index;
+
+	for (GLuint i = 0; i < 32; ++i)
 	{
-		const VertexAttribute &va = vao.attr[i];
+		const uint32_t bit = 1u << i;
 
-		gl.EnableVertexAttribArray(va.index);
-		gl.VertexAttribPointer(va.index, va.size, va.type, GL_FALSE, vao.vertSize, va.offset);
+		if ((enabled & bit) && !(vaoApplied.enabled & bit))
+			gl.EnableVertexAttribArray(i);
+		else if (!(enabled & bit) && (vaoApplied.enabled & bit))
+			gl.DisableVertexAttribArray(i);
 	}
+
+	vaoPointAttribs(vao, 0);
+
+	vaoApplied.vao = &vao;
+	vaoApplied.attr = vao.attr;
+	vaoApplied.vbo = vao.vbo;
+	vaoApplied.ibo = vao.ibo;
+	vaoApplied.enabled = enabled;
+}
+
+void vaoInvalidate()
+{
+	if (HAVE_NATIVE_VAO)
+		return;
+
+	for (GLuint i = 0; i < 32; ++i)
+		if (vaoApplied.enabled & (1u << i))
+			gl.DisableVertexAttribArray(i);
+
+	vaoApplied.vao = 0;
+	vaoApplied.enabled = 0;
 }
 
 void vaoInit(VAO &vao, bool keepBound)
@@ -105,6 +182,8 @@ void vaoFini(VAO &vao)
 {
 	if (HAVE_NATIVE_VAO)
 		gl.DeleteVertexArrays(1, &vao.nativeVAO);
+	else if (vaoApplied.vao == &vao)
+		vaoInvalidate();
 }
 
 void vaoBind(VAO &vao)
@@ -112,27 +191,118 @@ void vaoBind(VAO &vao)
 	if (HAVE_NATIVE_VAO)
 		gl.BindVertexArray(vao.nativeVAO);
 	else
-		vaoBindRes(vao);
+		vaoApply(vao);
 }
 
-void vaoUnbind(VAO &vao)
+void vaoUnbind(VAO &)
 {
+	/* The emulated state stays applied (see vaoApply) */
 	if (HAVE_NATIVE_VAO)
-	{
 		gl.BindVertexArray(0);
+}
+
+void vaoDrawQuads(VAO &vao, size_t offset, size_t count)
+{
+	if (count == 0)
+		return;
+
+	glCallCounts.quads += count;
+
+	if (offset + count <= QUAD_CHUNK_SIZE)
+	{
+		gl.DrawElements(GL_TRIANGLES, count*6, _GL_INDEX_TYPE,
+		                (const char*) 0 + offset*6*sizeof(index_t));
+		++glCallCounts.draws;
+
+		return;
 	}
-	else
+
+	/* GLES2 has no base vertex draws, so move the
+	 * attributes instead (part of a native VAO's state,
+	 * hence restored afterwards) */
+	VBO::bind(vao.vbo);
+
+	while (count > 0)
 	{
-		for (size_t i = 0; i < vao.attrCount; ++i)
-			gl.DisableVertexAttribArray(vao.attr[i].index);
+		const size_t chunk = std::min<size_t>(count, QUAD_CHUNK_SIZE);
+
+		vaoPointAttribs(vao, offset*4);
+		gl.DrawElements(GL_TRIANGLES, chunk*6, _GL_INDEX_TYPE, 0);
+		++glCallCounts.draws;
 
-		VBO::unbind();
-		IBO::unbind();
+		offset += chunk;
+		count -= chunk;
 	}
+
+	vaoPointAttribs(vao, 0);
 }
 
 #define HAVE_NATIVE_BLIT gl.BlitFramebuffer
 
+/* Without native blits, the rectangles are collected and drawn
+ * together once the source or filtering changes, or at blitEnd().
+ * Getting hold of the next source may involve GL work of its own
+ * (eg. flushing its pending fills), so the batch restores the
+ * state it needs when it's drawn */
+static struct
+{
+	FBO::ID target;
+	TEX::ID source;
+	Vec2i sourceSize;
+	bool smooth;
+} blitState;
+
+static void flushBlits()
+{
+	SimpleQuadArray &quads = shState->blitQuads();
+
+	if (quads.count() == 0)
+		return;
+
+	FBO::bind(blitState.target);
+
+	SimpleShader &shader = shState->shaders().simple();
+	shader.bind();
+	shader.applyViewportProj();
+	shader.setTranslation(Vec2i());
+	shader.setTexSize(blitState.sourceSize);
+
+	TEX::bind(blitState.source);
+
+	if (blitState.smooth)
+		TEX::setSmooth(true);
+
+	glState.blend.pushSet(false);
+
+	if (quads.count() == 1)
+	{
+		/* Not worth an upload; goes through the unit quad */
+		const SVertex *vert = &quads.vertices[0];
+		const FloatRect pos(vert[0].pos.x, vert[0].pos.y,
+		                    vert[2].pos.x - vert[0].pos.x,
+		                    vert[2].pos.y - vert[0].pos.y);
+		const FloatRect tex(vert[0].texPos.x, vert[0].texPos.y,
+		                    vert[2].texPos.x - vert[0].texPos.x,
+		                    vert[2].texPos.y - vert[0].texPos.y);
+
+		Quad &quad = shState->gpQuad();
+		quad.setTexPosRect(tex, pos);
+		quad.draw(shState->shaders().simple());
+	}
+	else
+	{
+		quads.commit();
+		quads.draw();
+	}
+
+	glState.blend.pop();
+
+	if (blitState.smooth)
+		TEX::setSmooth(false);
+
+	quads.clear();
+}
+
 static void _blitBegin(FBO::ID fbo, const Vec2i &size)
 {
 	if (HAVE_NATIVE_BLIT)
@@ -144,7 +314,9 @@ static void _blitBegin(FBO::ID fbo, const Vec2i &size)
 		FBO::bind(fbo);
 		glState.viewport.pushSet(IntRect(0, 0, size.x, size.y));
 
-		SimpleShader &shader = shState->shaders().simple;
+		blitState.target = fbo;
+
+		SimpleShader &shader = shState->shaders().simple();
 		shader.bind();
 		shader.applyViewportProj();
 		shader.setTranslation(Vec2i());
@@ -169,8 +341,13 @@ void blitSource(TEXFBO &source)
 	}
 	else
 	{
-		SimpleShader &shader = shState->shaders().simple;
-		shader.setTexSize(Vec2i(source.width, source.height));
+		flushBlits();
+
+		blitState.source = source.tex;
+		blitState.sourceSize = Vec2i(source.texW, source.texH);
+
+		SimpleShader &shader = shState->shaders().simple();
+		shader.setTexSize(blitState.sourceSize);
 		TEX::bind(source.tex);
 	}
 }
@@ -190,24 +367,27 @@ void blitRectangle(const IntRect &src, const IntRect &dst, bool smooth)
 	}
 	else
 	{
-		if (smooth)
-			TEX::setSmooth(true);
+		if (smooth != blitState.smooth)
+		{
+			flushBlits();
+			blitState.smooth = smooth;
+		}
 
-		glState.blend.pushSet(false);
-		Quad &quad = shState->gpQuad();
-		quad.setTexPosRect(src, dst);
-		quad.draw();
-		glState.blend.pop();
+		SimpleQuadArray &quads = shState->blitQuads();
+		const size_t i = quads.count();
 
-		if (smooth)
-			TEX::setSmooth(false);
+		quads.resize(i + 1);
+		Quad::setTexPosRect(&quads.vertices[i*4], src, dst);
 	}
 }
 
 void blitEnd()
 {
 	if (!HAVE_NATIVE_BLIT)
+	{
+		flushBlits();
 		glState.viewport.pop();
+	}
 }
 
 }
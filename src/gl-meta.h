@@ -64,6 +64,17 @@ void vaoFini(VAO &vao);
 void vaoBind(VAO &vao);
 void vaoUnbind(VAO &vao);
 
+/* Without native VAOs, disables the attributes left enabled by
+ * the last vaoBind; has to be called before setting up vertex
+ * attributes (or the element buffer binding) by hand */
+void vaoInvalidate();
+
+/* Draws 'count' quads of the bound 'vao' starting at quad
+ * 'offset', using the global IBO. Draws reaching past its
+ * size are split up, with the attributes pointed at each
+ * chunk's first vertex in turn */
+void vaoDrawQuads(VAO &vao, size_t offset, size_t count);
+
 /* EXT_framebuffer_blit */
 void blitBegin(TEXFBO &target);
 void blitBeginScreen(const Vec2i &size);
@@ -24,6 +24,10 @@
 
 #include "gl-fun.h"
 #include "etc-internal.h"
+#include "profiler.h"
+
+#include <string.h>
+#include <algorithm>
 
 /* Struct wrapping GLuint for some light type safety */
 #define DEF_GL_ID \
@@ -48,11 +52,44 @@ struct ID \
 	} \
 };
 
+/* Counts of the GL calls issued through the wrappers that
+ * skip redundant state changes, and of the calls they skipped.
+ * 'culled' counts scene elements not drawn for being offscreen.
+ * Graphics takes a snapshot of them every frame */
+struct GLCallCounts
+{
+	unsigned int draws;
+	unsigned int programBinds;
+	unsigned int textureBinds;
+	unsigned int uniformUploads;
+	unsigned int skipped;
+	unsigned int culled;
+
+	unsigned int quads;
+	unsigned int fboBinds;
+	/* Pixel data handed to the driver */
+	unsigned int texBytes;
+	/* Vertex and index data handed to the driver */
+	unsigned int bufferBytes;
+
+	unsigned int poolHits;
+	unsigned int poolMisses;
+	unsigned int poolEvictions;
+};
+
+extern GLCallCounts glCallCounts;
+
+#define TEX_UNIT_COUNT 4
+
 /* 2D Texture */
 namespace TEX
 {
 	DEF_GL_ID
 
+	/* Texture currently bound to each unit. All functions
+	 * below except bindUnit() operate on unit 0 */
+	extern GLuint boundUnits[TEX_UNIT_COUNT];
+
 	inline ID gen()
 	{
 		ID id;
@@ -64,11 +101,42 @@ namespace TEX
 	static inline void del(ID id)
 	{
 		gl.DeleteTextures(1, &id.gl);
+
+		/* Deleting a texture unbinds it, and
+		 * its name might be handed out again */
+		for (size_t i = 0; i < TEX_UNIT_COUNT; ++i)
+			if (boundUnits[i] == id.gl)
+				boundUnits[i] = 0;
 	}
 
 	static inline void bind(ID id)
 	{
+		if (boundUnits[0] == id.gl)
+		{
+			++glCallCounts.skipped;
+			return;
+		}
+
+		gl.BindTexture(GL_TEXTURE_2D, id.gl);
+		boundUnits[0] = id.gl;
+		++glCallCounts.textureBinds;
+	}
+
+	/* Leaves unit 0 active */
+	static inline void bindUnit(unsigned int unit, ID id)
+	{
+		if (boundUnits[unit] == id.gl)
+		{
+			++glCallCounts.skipped;
+			return;
+		}
+
+		gl.ActiveTexture(GL_TEXTURE0 + unit);
 		gl.BindTexture(GL_TEXTURE_2D, id.gl);
+		gl.ActiveTexture(GL_TEXTURE0);
+
+		boundUnits[unit] = id.gl;
+		++glCallCounts.textureBinds;
 	}
 
 	static inline void unbind()
@@ -78,12 +146,36 @@ namespace TEX
 
 	static inline void uploadImage(GLsizei width, GLsizei height, const void *data, GLenum format)
 	{
+		PROFILE_SCOPE(TexUpload);
 		gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		glCallCounts.texBytes += width * height * 4;
 	}
 
 	static inline void uploadSubImage(GLint x, GLint y, GLsizei width, GLsizei height, const void *data, GLenum format)
 	{
+		PROFILE_SCOPE(TexUpload);
 		gl.TexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+		glCallCounts.texBytes += width * height * 4;
+	}
+
+	/* 'format' is GL_RGB or GL_RGBA; 'type' one of
+	 * the packed 16 bit types. Rows are tightly packed */
+	static inline void uploadPacked(GLsizei width, GLsizei height, GLenum format,
+	                                GLenum type, const void *data)
+	{
+		PROFILE_SCOPE(TexUpload);
+		gl.PixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		gl.TexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, type, data);
+		gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glCallCounts.texBytes += width * height * 2;
+	}
+
+	static inline void uploadCompressed(GLsizei width, GLsizei height, GLenum format,
+	                                    GLsizei size, const void *data)
+	{
+		PROFILE_SCOPE(TexUpload);
+		gl.CompressedTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, size, data);
+		glCallCounts.texBytes += size;
 	}
 
 	static inline void allocEmpty(GLsizei width, GLsizei height)
@@ -102,9 +194,57 @@ namespace TEX
 		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mode ? GL_LINEAR : GL_NEAREST);
 		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mode ? GL_LINEAR : GL_NEAREST);
 	}
+
+	/* Fills in all mipmap levels from level 0 */
+	static inline void generateMipmaps()
+	{
+		gl.GenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	/* Minifies through the mipmap chain (which has to be
+	 * complete) instead of sampling level 0 only. Textures
+	 * are magnified without filtering either way */
+	static inline void setMipmapped(bool mode)
+	{
+		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		                 mode ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	}
 }
 
 /* Framebuffer Object */
+namespace RBO
+{
+	DEF_GL_ID
+
+	inline ID gen()
+	{
+		ID id;
+		gl.GenRenderbuffers(1, &id.gl);
+
+		return id;
+	}
+
+	static inline void del(ID id)
+	{
+		gl.DeleteRenderbuffers(1, &id.gl);
+	}
+
+	static inline void bind(ID id)
+	{
+		gl.BindRenderbuffer(GL_RENDERBUFFER, id.gl);
+	}
+
+	static inline void unbind()
+	{
+		bind(ID(0));
+	}
+
+	static inline void allocDepth(GLsizei width, GLsizei height)
+	{
+		gl.RenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+	}
+}
+
 namespace FBO
 {
 	DEF_GL_ID
@@ -125,6 +265,7 @@ namespace FBO
 	static inline void bind(ID id)
 	{
 		gl.BindFramebuffer(GL_FRAMEBUFFER, id.gl);
+		++glCallCounts.fboBinds;
 	}
 
 	static inline void unbind()
@@ -137,12 +278,44 @@ namespace FBO
 		gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + colorAttach, GL_TEXTURE_2D, target.gl, 0);
 	}
 
+	static inline void setDepthTarget(RBO::ID target)
+	{
+		gl.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.gl);
+	}
+
 	static inline void clear()
 	{
 		gl.Clear(GL_COLOR_BUFFER_BIT);
 	}
+
+	/* Hints that the color contents of the bound FBO won't be
+	 * read anymore before being overwritten, so that tiled GPUs
+	 * can skip loading them into (and storing them back from)
+	 * tile memory. Afterwards they're undefined */
+	static inline void discard()
+	{
+		if (!gl.InvalidateFramebuffer)
+			return;
+
+		static const GLenum attachment = GL_COLOR_ATTACHMENT0;
+		gl.InvalidateFramebuffer(GL_FRAMEBUFFER, 1, &attachment);
+	}
+
+	/* Same, for the window framebuffer (which has to be bound) */
+	static inline void discardWindow()
+	{
+		if (!gl.InvalidateFramebuffer)
+			return;
+
+		static const GLenum attachment = GL_COLOR;
+		gl.InvalidateFramebuffer(GL_FRAMEBUFFER, 1, &attachment);
+	}
 }
 
+/* Below this size, replacing a buffer's contents
+ * is cheaper than mapping it */
+#define STREAM_MAP_MIN 4096
+
 template<GLenum target>
 struct GenericBO
 {
@@ -174,17 +347,89 @@ struct GenericBO
 	static inline void uploadData(GLsizeiptr size, const GLvoid *data, GLenum usage = GL_STATIC_DRAW)
 	{
 		gl.BufferData(target, size, data, usage);
+
+		if (data)
+			glCallCounts.bufferBytes += size;
 	}
 
 	static inline void uploadSubData(GLintptr offset, GLsizeiptr size, const GLvoid *data)
 	{
 		gl.BufferSubData(target, offset, size, data);
+		glCallCounts.bufferBytes += size;
 	}
 
 	static inline void allocEmpty(GLsizeiptr size, GLenum usage = GL_STATIC_DRAW)
 	{
 		uploadData(size, 0, usage);
 	}
+
+	static inline const void *mapRead(GLintptr offset, GLsizeiptr size)
+	{
+		return gl.MapBufferRange(target, offset, size, GL_MAP_READ_BIT);
+	}
+
+	static inline void unmap()
+	{
+		gl.UnmapBuffer(target);
+	}
+
+	/* Rewrites the whole contents of the bound buffer, which
+	 * the GPU might still be reading from, without waiting for
+	 * it: the old storage is orphaned (the driver hands out fresh
+	 * storage if the old one is in use), and larger uploads are
+	 * written through a mapping where available.
+	 * The buffer is (re)allocated to 'capacity' bytes, of which
+	 * the first 'size' are then filled in with 'write()' calls */
+	struct Stream
+	{
+		Stream(GLsizeiptr capacity, GLsizeiptr size, GLenum usage = GL_DYNAMIC_DRAW)
+		    : mapped(0)
+		{
+			gl.BufferData(target, capacity, 0, usage);
+
+			if (gl.MapBufferRange && size >= STREAM_MAP_MIN)
+				mapped = (char*) gl.MapBufferRange(target, 0, size,
+				                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		}
+
+		~Stream()
+		{
+			/* A failed unmap (storage lost, eg. on mode switches)
+			 * leaves the contents undefined until the next upload */
+			if (mapped)
+				gl.UnmapBuffer(target);
+		}
+
+		void write(GLintptr offset, GLsizeiptr size, const GLvoid *data)
+		{
+			if (mapped)
+			{
+				memcpy(mapped + offset, data, size);
+				glCallCounts.bufferBytes += size;
+			}
+			else
+			{
+				uploadSubData(offset, size, data);
+			}
+		}
+
+	private:
+		char *mapped;
+	};
+
+	/* Single upload through a 'Stream' */
+	static inline void uploadStreamed(GLsizeiptr capacity, GLsizeiptr size, const GLvoid *data)
+	{
+		/* Orphaning and filling in one call */
+		if (capacity == size && size < STREAM_MAP_MIN)
+		{
+			uploadData(size, data, GL_DYNAMIC_DRAW);
+			return;
+		}
+
+		Stream stream(capacity, size);
+		stream.write(0, size, data);
+	}
 };
 
 /* Vertex Buffer Object */
@@ -193,6 +438,12 @@ typedef struct GenericBO<GL_ARRAY_BUFFER> VBO;
 /* Index Buffer Object */
 typedef struct GenericBO<GL_ELEMENT_ARRAY_BUFFER> IBO;
 
+/* Pixel Pack Buffer (requires gl.pixel_pack_buffer) */
+typedef struct GenericBO<GL_PIXEL_PACK_BUFFER> PBO;
+
+/* Pixel Unpack Buffer (likewise) */
+typedef struct GenericBO<GL_PIXEL_UNPACK_BUFFER> UnpackBO;
+
 #undef DEF_GL_ID
 
 /* Convenience struct wrapping a framebuffer
@@ -203,8 +454,13 @@ struct TEXFBO
 	FBO::ID fbo;
 	int width, height;
 
+	/* Dimensions of the texture storage. Textures handed
+	 * out by TexPool may be larger than 'width' x 'height',
+	 * so texture coordinates must be normalized by these */
+	int texW, texH;
+
 	TEXFBO()
-	    : tex(0), fbo(0), width(0), height(0)
+	    : tex(0), fbo(0), width(0), height(0), texW(0), texH(0)
 	{}
 
 	bool operator==(const TEXFBO &other) const
@@ -225,6 +481,24 @@ struct TEXFBO
 	{
 		TEX::bind(obj.tex);
 		TEX::allocEmpty(width, height);
+		obj.width = obj.texW = width;
+		obj.height = obj.texH = height;
+	}
+
+	/* Like allocEmpty, but only reallocates the storage if it
+	 * is too small to hold 'width' x 'height'; it never shrinks.
+	 * Users have to normalize by 'texW' / 'texH' afterwards */
+	static inline void growEmpty(TEXFBO &obj, int width, int height)
+	{
+		if (width > obj.texW || height > obj.texH)
+		{
+			obj.texW = std::max(width, obj.texW);
+			obj.texH = std::max(height, obj.texH);
+
+			TEX::bind(obj.tex);
+			TEX::allocEmpty(obj.texW, obj.texH);
+		}
+
 		obj.width = width;
 		obj.height = height;
 	}
@@ -246,6 +520,7 @@ struct TEXFBO
 		obj.tex = TEX::ID(0);
 		obj.fbo = FBO::ID(0);
 		obj.width = obj.height = 0;
+		obj.texW = obj.texH = 0;
 	}
 };
 
@@ -0,0 +1,184 @@
+/*
+** gldeletequeue.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "gldeletequeue.h"
+
+#include "gl-meta.h"
+#include "idletasks.h"
+
+#include <SDL_timer.h>
+
+#include <deque>
+
+/* Queued objects beyond this many frames' budget
+ * are deleted without regard to the budget */
+#define BACKLOG_FRAMES 8
+
+struct PendingDelete
+{
+	enum Type
+	{
+		Texture,
+		Framebuffer,
+		Buffer,
+		VertexArray
+	};
+
+	Type type;
+	GLuint id;
+
+	/* Frame the object was given up in */
+	unsigned int frame;
+};
+
+static std::deque<PendingDelete> pending;
+static unsigned int currentFrame = 0;
+static int budget = 0;
+
+static void deleteNow(const PendingDelete &del)
+{
+	switch (del.type)
+	{
+	case PendingDelete::Texture :
+		TEX::del(TEX::ID(del.id));
+		break;
+
+	case PendingDelete::Framebuffer :
+		FBO::del(FBO::ID(del.id));
+		break;
+
+	case PendingDelete::Buffer :
+		VBO::del(VBO::ID(del.id));
+		break;
+
+	case PendingDelete::VertexArray :
+		gl.DeleteVertexArrays(1, &del.id);
+		break;
+	}
+}
+
+/* Deletes in between checks of the clock */
+#define IDLE_DELETE_BATCH 16
+
+/* Works off the queue in the slack of a frame, so that
+ * less is left to be deleted when the next one starts */
+static bool deleteIdle(void *, int usecs)
+{
+	const uint64_t end = SDL_GetPerformanceCounter()
+	                   + (uint64_t) usecs * SDL_GetPerformanceFrequency() / 1000000;
+
+	int batch = 0;
+
+	while (!pending.empty() && pending.front().frame != currentFrame)
+	{
+		deleteNow(pending.front());
+		pending.pop_front();
+
+		if (++batch == IDLE_DELETE_BATCH)
+		{
+			if (SDL_GetPerformanceCounter() >= end)
+				break;
+
+			batch = 0;
+		}
+	}
+
+	return pending.empty();
+}
+
+static void enqueue(PendingDelete::Type type, GLuint id)
+{
+	if (id == 0)
+		return;
+
+	PendingDelete del;
+	del.type = type;
+	del.id = id;
+	del.frame = currentFrame;
+
+	if (budget == 0)
+	{
+		deleteNow(del);
+		return;
+	}
+
+	pending.push_back(del);
+	IdleTasks::add(deleteIdle, 0);
+}
+
+void GLDeleteQueue::texFBO(TEXFBO &obj)
+{
+	enqueue(PendingDelete::Framebuffer, obj.fbo.gl);
+	enqueue(PendingDelete::Texture, obj.tex.gl);
+}
+
+void GLDeleteQueue::texture(TEX::ID tex)
+{
+	enqueue(PendingDelete::Texture, tex.gl);
+}
+
+void GLDeleteQueue::buffer(VBO::ID vbo)
+{
+	enqueue(PendingDelete::Buffer, vbo.gl);
+}
+
+void GLDeleteQueue::vertexArray(GLMeta::VAO &vao)
+{
+	if (gl.GenVertexArrays)
+		enqueue(PendingDelete::VertexArray, vao.nativeVAO);
+	else
+		GLMeta::vaoFini(vao);
+}
+
+void GLDeleteQueue::newFrame()
+{
+	int deleted = 0;
+
+	/* Objects given up this frame wait for the next one. A
+	 * backlog of many frames' worth goes out regardless */
+	while (!pending.empty() && pending.front().frame != currentFrame
+	       && (deleted < budget || pending.size() > (size_t) budget * BACKLOG_FRAMES))
+	{
+		deleteNow(pending.front());
+		pending.pop_front();
+		++deleted;
+	}
+
+	++currentFrame;
+}
+
+void GLDeleteQueue::flush()
+{
+	while (!pending.empty())
+	{
+		deleteNow(pending.front());
+		pending.pop_front();
+	}
+}
+
+void GLDeleteQueue::setBudget(int value)
+{
+	budget = value;
+
+	if (budget == 0)
+		flush();
+}
@@ -0,0 +1,61 @@
+/*
+** gldeletequeue.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GLDELETEQUEUE_H
+#define GLDELETEQUEUE_H
+
+#include "gl-util.h"
+
+namespace GLMeta
+{
+	struct VAO;
+}
+
+/* Delays the deletion of GL objects to the end of the frame
+ * after the one they were given up in, so that objects dropped
+ * mid-frame (eg. by the Ruby GC finalizing sprites and bitmaps,
+ * or evicted from the TexPool) neither cause bursts of deletes
+ * in the middle of rendering nor stall on draws still using
+ * them. At most 'budget' objects are deleted per frame, plus
+ * whatever fits into the idle time before the frame deadline
+ * (see IdleTasks); with a budget of 0, objects are deleted
+ * right away. RGSS thread only */
+class GLDeleteQueue
+{
+public:
+	static void texFBO(TEXFBO &obj);
+	static void texture(TEX::ID tex);
+	static void buffer(VBO::ID vbo);
+
+	/* Emulated VAOs are finalized right away */
+	static void vertexArray(GLMeta::VAO &vao);
+
+	/* Called once per frame */
+	static void newFrame();
+
+	/* Deletes everything still queued */
+	static void flush();
+
+	static void setBudget(int value);
+};
+
+#endif // GLDELETEQUEUE_H
@@ -26,13 +26,18 @@
 
 #include <vector>
 #include <limits>
-#include <assert.h>
+#include <algorithm>
 #include <stdint.h>
 
 typedef uint16_t index_t;
 #define INDEX_T_MAX std::numeric_limits<index_t>::max()
 #define _GL_INDEX_TYPE GL_UNSIGNED_SHORT
 
+/* Most quads addressable with 16 bit indices. The IBO never
+ * grows beyond this; bigger draws are split into chunks of it
+ * (see 'GLMeta::vaoDrawQuads()') */
+#define QUAD_CHUNK_SIZE ((INDEX_T_MAX+1) / 4)
+
 struct GlobalIBO
 {
 	IBO::ID ibo;
@@ -50,7 +55,7 @@ struct GlobalIBO
 
 	void ensureSize(size_t quadCount)
 	{
-		assert(quadCount*6 < INDEX_T_MAX);
+		quadCount = std::min<size_t>(quadCount, QUAD_CHUNK_SIZE);
 
 		if (buffer.size() >= quadCount*6)
 			return;
@@ -66,9 +71,10 @@ struct GlobalIBO
 				buffer.push_back(i * 4 + indTemp[j]);
 		}
 
+		/* Left bound, as all VAOs use this one; without native
+		 * VAOs, the last one applied may still count on it */
 		IBO::bind(ibo);
 		IBO::uploadData(buffer.size() * sizeof(index_t), dataPtr(buffer));
-		IBO::unbind();
 	}
 };
 
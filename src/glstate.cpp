@@ -23,10 +23,14 @@
 #include "shader.h"
 #include "etc.h"
 #include "gl-fun.h"
+#include "gl-util.h"
 #include "config.h"
 
 #include <SDL_rect.h>
 
+GLCallCounts glCallCounts;
+GLuint TEX::boundUnits[TEX_UNIT_COUNT];
+
 static void applyBool(GLenum state, bool mode)
 {
 	mode ? gl.Enable(state) : gl.Disable(state);
@@ -37,9 +41,25 @@ void GLClearColor::apply(const Vec4 &value)
 	gl.ClearColor(value.x, value.y, value.z, value.w);
 }
 
+IntRect ScreenMapping::map(const IntRect &rect) const
+{
+	return IntRect(dst.x + rect.x * dst.w / res.x,
+	               dst.y + (res.y - rect.y - rect.h) * dst.h / res.y,
+	               rect.w * dst.w / res.x,
+	               rect.h * dst.h / res.y);
+}
+
 void GLScissorBox::apply(const IntRect &value)
 {
-	gl.Scissor(value.x, value.y, value.w, value.h);
+	const IntRect box = mapping.active() ? mapping.map(value) : value;
+
+	gl.Scissor(box.x, box.y, box.w, box.h);
+}
+
+void GLScissorBox::setMapping(const ScreenMapping &value)
+{
+	mapping = value;
+	refresh();
 }
 
 void GLScissorBox::setIntersect(const IntRect &value)
@@ -71,6 +91,12 @@ void GLBlendMode::apply(const BlendType &value)
 		                     GL_ZERO,      GL_ONE);
 		break;
 
+	case BlendPremultiplied :
+		gl.BlendEquation(GL_FUNC_ADD);
+		gl.BlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA,
+		                     GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+		break;
+
 	case BlendNormal :
 		gl.BlendEquation(GL_FUNC_ADD);
 		gl.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
@@ -96,6 +122,19 @@ void GLBlend::apply(const bool &value)
 	applyBool(GL_BLEND, value);
 }
 
+void GLDepthTest::apply(const bool &value)
+{
+	applyBool(GL_DEPTH_TEST, value);
+}
+
+void GLDepthRange::apply(const Vec2 &value)
+{
+	if (gl.DepthRangef)
+		gl.DepthRangef(value.x, value.y);
+	else
+		gl.DepthRange(value.x, value.y);
+}
+
 void GLViewport::apply(const IntRect &value)
 {
 	gl.Viewport(value.x, value.y, value.w, value.h);
@@ -104,22 +143,46 @@ void GLViewport::apply(const IntRect &value)
 void GLProgram::apply(const unsigned int &value)
 {
 	gl.UseProgram(value);
+	++glCallCounts.programBinds;
 }
 
 GLState::Caps::Caps()
 {
 	gl.GetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexSize);
+
+	GLint formatCount = 0;
+	gl.GetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &formatCount);
+
+	compressedFormats.resize(formatCount);
+
+	if (formatCount > 0)
+		gl.GetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, (GLint*) &compressedFormats[0]);
+
+	instancedSprites = gl.instanced_arrays;
 }
 
-GLState::GLState(const Config &conf)
+bool GLState::Caps::supportsCompressed(unsigned int format) const
 {
-	gl.Disable(GL_DEPTH_TEST);
+	for (size_t i = 0; i < compressedFormats.size(); ++i)
+		if ((unsigned int) compressedFormats[i] == format)
+			return true;
+
+	return false;
+}
 
+GLState::GLState(const Config &conf)
+    : depthBuffer(false)
+{
 	clearColor.init(Vec4(0, 0, 0, 1));
 	blendMode.init(BlendNormal);
 	blend.init(true);
 	scissorTest.init(false);
 	scissorBox.init(IntRect(0, 0, 640, 480));
+	depthTest.init(false);
+	depthRange.init(Vec2(0, 1));
+
+	/* Tiles of the same layer overlap in draw order */
+	gl.DepthFunc(GL_LEQUAL);
 	program.init(0);
 
 	if (conf.maxTextureSize > 0)
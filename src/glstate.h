@@ -25,6 +25,7 @@
 #include "etc.h"
 
 #include <stack>
+#include <vector>
 #include <assert.h>
 
 struct Config;
@@ -77,14 +78,38 @@ class GLClearColor : public GLProperty<Vec4>
 	void apply(const Vec4 &);
 };
 
+/* Describes compositing the screen straight into the window
+ * framebuffer: scene coordinates of 'res' size are mapped,
+ * vertically flipped, onto the 'dst' viewport. The scale
+ * factor between the two is expected to be integral */
+struct ScreenMapping
+{
+	Vec2i res;
+	IntRect dst;
+
+	bool active() const
+	{
+		return res.x > 0 && res.y > 0;
+	}
+
+	IntRect map(const IntRect &rect) const;
+};
+
 class GLScissorBox : public GLProperty<IntRect>
 {
 public:
 	/* Sets the intersection of the current box with value */
 	void setIntersect(const IntRect &value);
 
+	/* While the mapping is active, boxes are given in
+	 * screen coordinates and mapped before being applied */
+	void setMapping(const ScreenMapping &value);
+	const ScreenMapping &getMapping() const { return mapping; }
+
 private:
 	void apply(const IntRect &value);
+
+	ScreenMapping mapping;
 };
 
 class GLScissorTest : public GLProperty<bool>
@@ -102,6 +127,17 @@ class GLBlend : public GLProperty<bool>
 	void apply(const bool &value);
 };
 
+class GLDepthTest : public GLProperty<bool>
+{
+	void apply(const bool &value);
+};
+
+/* Near (x) and far (y) end of the window depth range */
+class GLDepthRange : public GLProperty<Vec2>
+{
+	void apply(const Vec2 &value);
+};
+
 class GLViewport : public GLProperty<IntRect>
 {
 	void apply(const IntRect &value);
@@ -121,13 +157,27 @@ public:
 	GLScissorTest scissorTest;
 	GLBlendMode blendMode;
 	GLBlend blend;
+	GLDepthTest depthTest;
+	GLDepthRange depthRange;
 	GLViewport viewport;
 	GLProgram program;
 
+	/* Whether the framebuffer the scene is currently
+	 * being composited to has a depth attachment */
+	bool depthBuffer;
+
 	struct Caps
 	{
 		int maxTexSize;
 
+		/* Compressed texture formats the GL can sample */
+		std::vector<int> compressedFormats; /* GLenum */
+
+		bool supportsCompressed(unsigned int format) const;
+
+		/* Sprites can be submitted as instances of one quad */
+		bool instancedSprites;
+
 		Caps();
 
 	} caps;
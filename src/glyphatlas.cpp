@@ -0,0 +1,450 @@
+/*
+** glyphatlas.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "glyphatlas.h"
+
+#include "gl-util.h"
+#include "glstate.h"
+#include "quad.h"
+#include "quadarray.h"
+#include "shader.h"
+#include "sharedstate.h"
+#include "uploadstaging.h"
+#include "boost-hash.h"
+#include "util.h"
+
+#include <SDL_ttf.h>
+#include <SDL_surface.h>
+
+#include <boost/functional/hash.hpp>
+
+#include <string.h>
+#include <vector>
+#include <utility>
+
+/* Preferred edge length of the atlas texture */
+#define ATLAS_SIZE 512
+
+/* Space left between neighboring glyph cells */
+#define CELL_PADDING 1
+
+struct GlyphKey
+{
+	TTF_Font *font;
+	uint16_t ch;
+	uint8_t style;
+	uint8_t outline;
+	bool solid;
+
+	bool operator==(const GlyphKey &o) const
+	{
+		return font == o.font && ch == o.ch && style == o.style
+		    && outline == o.outline && solid == o.solid;
+	}
+};
+
+static size_t hash_value(const GlyphKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.font);
+	boost::hash_combine(seed, key.ch);
+	boost::hash_combine(seed, key.style);
+	boost::hash_combine(seed, key.outline);
+	boost::hash_combine(seed, key.solid);
+
+	return seed;
+}
+
+struct Glyph
+{
+	/* Location of the glyph cell inside the atlas */
+	IntRect rect;
+
+	/* Pen position inside the cell; SDL_ttf shifts glyphs
+	 * with negative 'minx' to the right by that amount */
+	int origin;
+
+	int advance;
+};
+
+/* Font handle and style combinations for which the atlas
+ * layout didn't match SDL_ttf's; these always fall back */
+typedef std::pair<TTF_Font*, int> FontStyle;
+
+struct PlacedGlyph
+{
+	const Glyph *glyph;
+	int x;
+};
+
+struct GlyphAtlasPrivate
+{
+	TEXFBO atlas;
+
+	/* Intermediary target the strings are composed to */
+	TEXFBO layer;
+
+	BoostHash<GlyphKey, Glyph> glyphs;
+	BoostSet<FontStyle> mismatched;
+
+	/* Shelf packing state */
+	int packX, packY, rowH;
+
+	ColorQuadArray quads;
+
+	std::vector<PlacedGlyph> textLayout;
+	std::vector<PlacedGlyph> outlineLayout;
+
+	GlyphAtlasPrivate()
+	    : packX(0), packY(0), rowH(0)
+	{
+		int size = std::min<int>(ATLAS_SIZE, glState.caps.maxTexSize);
+
+		TEXFBO::init(atlas);
+		TEXFBO::allocEmpty(atlas, size, size);
+		TEXFBO::linkFBO(atlas);
+
+		TEXFBO::init(layer);
+		TEX::setSmooth(true);
+		TEXFBO::allocEmpty(layer, 256, 64);
+		TEXFBO::linkFBO(layer);
+	}
+
+	~GlyphAtlasPrivate()
+	{
+		TEXFBO::fini(atlas);
+		TEXFBO::fini(layer);
+	}
+
+	void flush()
+	{
+		glyphs.clear();
+		packX = packY = rowH = 0;
+	}
+
+	bool allocCell(int w, int h, IntRect &out)
+	{
+		if (w > atlas.width || h > atlas.height)
+			return false;
+
+		if (packX + w > atlas.width)
+		{
+			packX = 0;
+			packY += rowH + CELL_PADDING;
+			rowH = 0;
+		}
+
+		if (packY + h > atlas.height)
+			return false;
+
+		out = IntRect(packX, packY, w, h);
+
+		packX += w + CELL_PADDING;
+		rowH = std::max(rowH, h);
+
+		return true;
+	}
+
+	/* Returns null if the glyph couldn't be rendered or
+	 * there is no space left in the atlas */
+	const Glyph *getGlyph(TTF_Font *font, const char *utf8, size_t len,
+	                      const GlyphKey &key)
+	{
+		if (glyphs.contains(key))
+			return &glyphs[key];
+
+		int minx, advance;
+
+		if (TTF_GlyphMetrics(font, key.ch, &minx, 0, 0, 0, &advance) < 0)
+			return 0;
+
+		char buf[4] = { 0 };
+		memcpy(buf, utf8, len);
+
+		/* Glyphs are rendered white; only their
+		 * coverage is used when composing */
+		SDL_Color white = { 255, 255, 255, 255 };
+		SDL_Surface *surf;
+
+		if (key.solid)
+			surf = TTF_RenderUTF8_Solid(font, buf, white);
+		else
+			surf = TTF_RenderUTF8_Blended(font, buf, white);
+
+		if (!surf)
+			return 0;
+
+		if (surf->format->format != SDL_PIXELFORMAT_ABGR8888)
+		{
+			SDL_Surface *conv =
+			        SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ABGR8888, 0);
+			SDL_FreeSurface(surf);
+			surf = conv;
+
+			if (!surf)
+				return 0;
+		}
+
+		Glyph glyph;
+
+		if (!allocCell(surf->w, surf->h, glyph.rect))
+		{
+			SDL_FreeSurface(surf);
+			return 0;
+		}
+
+		TEX::bind(atlas.tex);
+		UploadStaging::uploadSubImage(glyph.rect.x, glyph.rect.y,
+		                              glyph.rect.w, glyph.rect.h,
+		                              surf->pixels, GL_RGBA);
+
+		SDL_FreeSurface(surf);
+
+		glyph.origin = std::max(0, -minx);
+		glyph.advance = advance;
+
+		glyphs.insert(key, glyph);
+
+		return &glyphs[key];
+	}
+
+	/* Places the glyphs of 'str' the same way TTF_RenderUTF8 does,
+	 * rendering missing ones into the atlas on the way.
+	 * 'extent' receives the size of the laid out string */
+	bool layoutString(TTF_Font *font, const char *str,
+	                  uint8_t outline, bool solid,
+	                  std::vector<PlacedGlyph> &out, Vec2i &extent)
+	{
+		GlyphKey key;
+		key.font = font;
+		key.style = TTF_GetFontStyle(font);
+		key.outline = outline;
+		key.solid = solid;
+
+		const bool kerning = TTF_GetFontKerning(font);
+
+		out.clear();
+		extent = Vec2i();
+
+		uint16_t prev = 0;
+		int pen = 0;
+
+		while (*str)
+		{
+			const char *chStart = str;
+
+			if (!nextUCS2(str, key.ch))
+				return false;
+
+			const Glyph *glyph = getGlyph(font, chStart, str - chStart, key);
+
+			if (!glyph)
+				return false;
+
+			if (out.empty())
+				pen = glyph->origin;
+			else if (kerning)
+				pen += TTF_GetFontKerningSizeGlyphs(font, prev, key.ch);
+
+			PlacedGlyph placed;
+			placed.glyph = glyph;
+			placed.x = pen - glyph->origin;
+			out.push_back(placed);
+
+			extent.x = std::max(extent.x, placed.x + glyph->rect.w);
+			extent.y = std::max(extent.y, glyph->rect.h);
+
+			pen += glyph->advance;
+			prev = key.ch;
+		}
+
+		return true;
+	}
+
+	bool layoutAll(TTF_Font *font, const char *str,
+	               int outlineSize, bool solid,
+	               Vec2i &textExtent, Vec2i &outlineExtent)
+	{
+		if (!layoutString(font, str, 0, solid, textLayout, textExtent))
+			return false;
+
+		if (outlineSize > 0)
+		{
+			TTF_SetFontOutline(font, outlineSize);
+			bool success = layoutString(font, str, outlineSize, solid,
+			                            outlineLayout, outlineExtent);
+			TTF_SetFontOutline(font, 0);
+
+			if (!success)
+				return false;
+		}
+
+		return true;
+	}
+
+	void appendQuads(const std::vector<PlacedGlyph> &layout,
+	                 const Vec2i &offset, const Vec4 &color)
+	{
+		size_t base = quads.count();
+		quads.resize(base + layout.size());
+
+		for (size_t i = 0; i < layout.size(); ++i)
+		{
+			const Glyph &glyph = *layout[i].glyph;
+			Vertex *vert = &quads.vertices[(base+i)*4];
+
+			FloatRect pos(offset.x + layout[i].x, offset.y,
+			              glyph.rect.w, glyph.rect.h);
+
+			Quad::setTexPosRect(vert, glyph.rect, pos);
+			Quad::setColor(vert, color);
+		}
+	}
+
+	void ensureLayerSize(int w, int h)
+	{
+		if (w <= layer.width && h <= layer.height)
+			return;
+
+		TEXFBO::allocEmpty(layer, std::max(layer.width,  findNextPow2(w)),
+		                          std::max(layer.height, findNextPow2(h)));
+	}
+};
+
+GlyphAtlas::GlyphAtlas()
+    : p(0)
+{}
+
+GlyphAtlas::~GlyphAtlas()
+{
+	delete p;
+}
+
+TEXFBO *GlyphAtlas::composeText(_TTF_Font *font, const char *str,
+                                const Vec4 &color, const Vec4 &outColor,
+                                bool shadow, int outlineSize, bool solid,
+                                Vec2i &size, int &rawHeight)
+{
+	/* GL resources (and the shState dependent quad array) can only
+	 * be created once SharedState is fully constructed */
+	if (!p)
+		p = new GlyphAtlasPrivate;
+
+	FontStyle fontStyle(font, TTF_GetFontStyle(font));
+
+	if (p->mismatched.contains(fontStyle))
+		return 0;
+
+	Vec2i textExt, outlineExt;
+
+	if (!p->layoutAll(font, str, outlineSize, solid, textExt, outlineExt))
+	{
+		/* Might have run out of atlas space; start over
+		 * with an empty atlas and give it another try */
+		p->flush();
+
+		if (!p->layoutAll(font, str, outlineSize, solid, textExt, outlineExt))
+			return 0;
+	}
+
+	/* Verify our layout against SDL_ttf's own idea of the text
+	 * dimensions (eg. bold overhang isn't exposed via its API).
+	 * If they disagree, this font style can't be served */
+	int sdlW, sdlH;
+
+	if (TTF_SizeUTF8(font, str, &sdlW, &sdlH) < 0)
+		return 0;
+
+	if (textExt.x != sdlW || textExt.y != sdlH)
+	{
+		p->mismatched.insert(fontStyle);
+		return 0;
+	}
+
+	/* Mirror the surface dimensions of the software path */
+	if (outlineSize > 0)
+		size = outlineExt;
+	else if (shadow)
+		size = Vec2i(textExt.x + 1, textExt.y + 1);
+	else
+		size = textExt;
+
+	rawHeight = textExt.y;
+
+	const Vec2i textOffset(outlineSize, outlineSize);
+
+	/* Layers are composed back to front with premultiplied alpha */
+	p->quads.clear();
+
+	if (outlineSize > 0)
+		p->appendQuads(p->outlineLayout, Vec2i(),
+		               Vec4(outColor.x, outColor.y, outColor.z, 1));
+
+	if (shadow)
+		p->appendQuads(p->textLayout, textOffset + Vec2i(1, 1),
+		               Vec4(0, 0, 0, 1));
+
+	p->appendQuads(p->textLayout, textOffset,
+	               Vec4(color.x, color.y, color.z, 1));
+
+	p->quads.commit();
+
+	p->ensureLayerSize(size.x, size.y);
+
+	FBO::bind(p->layer.fbo);
+	glState.viewport.pushSet(IntRect(0, 0, p->layer.width, p->layer.height));
+	glState.scissorTest.pushSet(true);
+	glState.scissorBox.pushSet(IntRect(0, 0, size.x, size.y));
+	glState.clearColor.pushSet(Vec4());
+
+	FBO::clear();
+
+	GlyphShader &shader = shState->shaders().glyph();
+	shader.bind();
+	shader.applyViewportProj();
+	shader.setTexSize(Vec2i(p->atlas.width, p->atlas.height));
+
+	TEX::bind(p->atlas.tex);
+
+	/* With the shader emitting straight color, regular blending
+	 * into the (transparent black) cleared layer accumulates
+	 * premultiplied color */
+	glState.blend.pushSet(true);
+	glState.blendMode.pushSet(BlendNormal);
+
+	p->quads.draw();
+
+	glState.blendMode.pop();
+	glState.blend.pop();
+	glState.clearColor.pop();
+	glState.scissorBox.pop();
+	glState.scissorTest.pop();
+	glState.viewport.pop();
+
+	return &p->layer;
+}
+
+void GlyphAtlas::clear()
+{
+	if (p)
+		p->flush();
+}
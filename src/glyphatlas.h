@@ -0,0 +1,66 @@
+/*
+** glyphatlas.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include "etc-internal.h"
+
+struct _TTF_Font;
+struct TEXFBO;
+struct GlyphAtlasPrivate;
+
+/* Keeps rasterized glyphs in a texture so that strings can be
+ * composed out of textured quads on the GPU, instead of being
+ * rendered from scratch by SDL_ttf on every drawText call.
+ * Glyphs are keyed by their (pooled, never closed) TTF_Font
+ * handle, which implies family and size, the active font style,
+ * and whether they were rendered outlined and/or solid */
+class GlyphAtlas
+{
+public:
+	GlyphAtlas();
+	~GlyphAtlas();
+
+	/* Composes 'str' into an intermediary texture holding
+	 * premultiplied alpha, mimicking the layout the software
+	 * path produces with the same parameters. 'font' must have
+	 * its style already set. A positive 'outlineSize' enables
+	 * the outline layer.
+	 * 'size' receives the dimensions of the composed text,
+	 * 'rawHeight' the height of the plain text (without shadow
+	 * and outline).
+	 * Returns null if the string can't be provided from the
+	 * atlas, in which case the caller has to fall back to
+	 * rendering it with SDL_ttf */
+	TEXFBO *composeText(_TTF_Font *font, const char *str,
+	                    const Vec4 &color, const Vec4 &outColor,
+	                    bool shadow, int outlineSize, bool solid,
+	                    Vec2i &size, int &rawHeight);
+
+	/* Drops all cached glyphs */
+	void clear();
+
+private:
+	GlyphAtlasPrivate *p;
+};
+
+#endif // GLYPHATLAS_H
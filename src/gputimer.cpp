@@ -0,0 +1,248 @@
+/*
+** gputimer.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "gputimer.h"
+
+#include "gl-fun.h"
+
+#include <deque>
+#include <vector>
+#include <utility>
+
+/* Frames whose results haven't been read
+ * back yet; older ones are given up on */
+#define MAX_PENDING_FRAMES 8
+
+/* Frames covered by frameAverage() */
+#define AVERAGE_FRAMES 60
+
+/* Deepest phase nesting tracked */
+#define MAX_DEPTH 8
+
+typedef std::vector<std::pair<GLuint, Profiler::Section> > QueryList;
+
+struct GPUTimerState
+{
+	std::vector<GLuint> freeQueries;
+
+	QueryList current;
+	std::deque<QueryList> pending;
+
+	Profiler::Section stack[MAX_DEPTH];
+	int depth;
+
+	double totals[AVERAGE_FRAMES];
+	int nextTotal;
+	int totalCount;
+
+	GPUTimerState()
+	    : depth(0),
+	      nextTotal(0),
+	      totalCount(0)
+	{}
+
+	void startQuery(Profiler::Section s)
+	{
+		GLuint query;
+
+		if (freeQueries.empty())
+		{
+			gl.GenQueries(1, &query);
+		}
+		else
+		{
+			query = freeQueries.back();
+			freeQueries.pop_back();
+		}
+
+		gl.BeginQuery(GL_TIME_ELAPSED, query);
+		current.push_back(std::make_pair(query, s));
+	}
+
+	void recycle(const QueryList &list)
+	{
+		for (size_t i = 0; i < list.size(); ++i)
+			freeQueries.push_back(list[i].first);
+	}
+
+	/* Returns false if the oldest pending frame isn't done yet */
+	bool collectOldest(bool disjoint)
+	{
+		const QueryList &list = pending.front();
+
+		if (!list.empty())
+		{
+			/* Queries finish in order */
+			GLuint available = 0;
+			gl.GetQueryObjectuiv(list.back().first, GL_QUERY_RESULT_AVAILABLE, &available);
+
+			if (!available)
+				return false;
+		}
+
+		if (!disjoint)
+		{
+			double total = 0;
+
+			for (size_t i = 0; i < list.size(); ++i)
+			{
+				GLuint64 ns = 0;
+				gl.GetQueryObjectui64v(list[i].first, GL_QUERY_RESULT, &ns);
+
+				if (Profiler::isEnabled())
+					Profiler::addTime(list[i].second, ns / 1000);
+
+				total += ns / 1000000.0;
+			}
+
+			totals[nextTotal] = total;
+			nextTotal = (nextTotal + 1) % AVERAGE_FRAMES;
+
+			if (totalCount < AVERAGE_FRAMES)
+				++totalCount;
+		}
+
+		recycle(list);
+		pending.pop_front();
+
+		return true;
+	}
+};
+
+static GPUTimerState *state = 0;
+static bool required = false;
+
+bool GPUTimer::isActive()
+{
+	return (Profiler::isEnabled() || required) && gl.timer_query;
+}
+
+void GPUTimer::newFrame()
+{
+	if (!isActive())
+		return;
+
+	if (!state)
+		state = new GPUTimerState;
+
+	/* A phase left open would break all following queries */
+	while (state->depth > 0)
+		end();
+
+	state->pending.push_back(QueryList());
+	state->pending.back().swap(state->current);
+
+	bool disjoint = false;
+
+	if (gl.timer_query_disjoint)
+	{
+		GLint value = 0;
+		gl.GetIntegerv(GL_GPU_DISJOINT_EXT, &value);
+		disjoint = value != 0;
+	}
+
+	while (!state->pending.empty() && state->collectOldest(disjoint))
+		;
+
+	while (state->pending.size() > MAX_PENDING_FRAMES)
+	{
+		state->recycle(state->pending.front());
+		state->pending.pop_front();
+	}
+}
+
+double GPUTimer::frameAverage()
+{
+	if (!state || state->totalCount == 0)
+		return -1;
+
+	double sum = 0;
+
+	for (int i = 0; i < state->totalCount; ++i)
+		sum += state->totals[i];
+
+	return sum / state->totalCount;
+}
+
+void GPUTimer::resetAverage()
+{
+	if (!state)
+		return;
+
+	state->nextTotal = 0;
+	state->totalCount = 0;
+}
+
+void GPUTimer::setRequired(bool value)
+{
+	required = value;
+}
+
+void GPUTimer::fini()
+{
+	if (!state)
+		return;
+
+	while (state->depth > 0)
+		end();
+
+	for (size_t i = 0; i < state->pending.size(); ++i)
+		state->recycle(state->pending[i]);
+
+	state->recycle(state->current);
+
+	if (!state->freeQueries.empty())
+		gl.DeleteQueries(state->freeQueries.size(), &state->freeQueries[0]);
+
+	delete state;
+	state = 0;
+}
+
+void GPUTimer::begin(Profiler::Section s)
+{
+	if (!state)
+		state = new GPUTimerState;
+
+	if (state->depth == MAX_DEPTH)
+	{
+		/* Keep counting for the current phase */
+		++state->depth;
+		return;
+	}
+
+	if (state->depth > 0)
+		gl.EndQuery(GL_TIME_ELAPSED);
+
+	state->stack[state->depth++] = s;
+	state->startQuery(s);
+}
+
+void GPUTimer::end()
+{
+	if (state->depth-- > MAX_DEPTH)
+		return;
+
+	gl.EndQuery(GL_TIME_ELAPSED);
+
+	if (state->depth > 0)
+		state->startQuery(state->stack[state->depth-1]);
+}
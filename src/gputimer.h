@@ -0,0 +1,86 @@
+/*
+** gputimer.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include "profiler.h"
+
+/* Measures GPU time of render phases with GL_TIME_ELAPSED
+ * queries. Results are read back a few frames later, once
+ * available, and added to the profiler sections of the frame
+ * they arrive in. Nested phases are measured exclusively:
+ * starting one interrupts the enclosing phase's query.
+ * Only active while the profiler is enabled (or measurements
+ * are otherwise required) and the driver supports timer
+ * queries. RGSS thread only */
+class GPUTimer
+{
+public:
+	static bool isActive();
+
+	/* Called once per frame, before anything is drawn: closes
+	 * the previous frame and collects finished results */
+	static void newFrame();
+
+	/* Average GPU time per frame (in ms) over
+	 * the recent frames, or -1 if not measured */
+	static double frameAverage();
+
+	/* Forgets the frames measured so far, eg. after
+	 * a change that affects their costs */
+	static void resetAverage();
+
+	/* Keeps measuring while the profiler is disabled,
+	 * for consumers of frameAverage() */
+	static void setRequired(bool value);
+
+	/* Releases all queries; the GL context must be current */
+	static void fini();
+
+	/* <internal> */
+	static void begin(Profiler::Section s);
+	static void end();
+};
+
+struct GPUScope
+{
+	bool active;
+
+	GPUScope(Profiler::Section section)
+	    : active(GPUTimer::isActive())
+	{
+		if (active)
+			GPUTimer::begin(section);
+	}
+
+	~GPUScope()
+	{
+		if (active)
+			GPUTimer::end();
+	}
+};
+
+#define GPU_SCOPE(section) \
+	GPUScope _gpuScope(Profiler::section)
+
+#endif // GPUTIMER_H
@@ -29,14 +29,32 @@
 #include "shader.h"
 #include "scene.h"
 #include "quad.h"
+#include "quadarray.h"
 #include "eventthread.h"
 #include "texpool.h"
 #include "bitmap.h"
 #include "etc-internal.h"
 #include "disposable.h"
-#include "intrulist.h"
+#include "flashable.h"
+#include "handletable.h"
 #include "binding.h"
 #include "debugwriter.h"
+#include "profiler.h"
+#include "memstats.h"
+#include "gputimer.h"
+#include "workerpool.h"
+#include "input.h"
+#include "audio.h"
+#include "screencapture.h"
+#include "scratcharena.h"
+#include "gldeletequeue.h"
+#include "idletasks.h"
+#include "budgettuner.h"
+#include "exception.h"
+
+#ifdef THEORA
+#include "movieplayer.h"
+#endif
 
 #include <SDL_video.h>
 #include <SDL_timer.h>
@@ -45,27 +63,128 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <algorithm>
+#include <vector>
+#include <list>
+#include <string>
 
 #define DEF_SCREEN_W  (rgssVer == 1 ? 640 : 544)
 #define DEF_SCREEN_H  (rgssVer == 1 ? 480 : 416)
 #define DEF_FRAMERATE (rgssVer == 1 ?  40 :  60)
 
+/* Internal resolutions available to dynamic resolution,
+ * as fractions of the game screen */
+static const float renderScales[] = { 1.0f, 0.75f, 0.5f };
+static const int renderScaleCount = sizeof(renderScales) / sizeof(renderScales[0]);
+
+/* Frames rendered between render scale adjustments */
+static const int dynResInterval = 60;
+
+/* How the finished frame is brought to the window */
+enum ScaleMode
+{
+	/* Framebuffer blit, nearest or linear per 'smoothScaling' */
+	ScaleBlit,
+
+	/* Shader pass (see UpscaleShader) */
+	ScaleInteger,
+	ScaleSharp,
+	ScaleArea
+};
+
+static ScaleMode scaleModeFromName(const std::string &name)
+{
+	if (name == "integer")
+		return ScaleInteger;
+	if (name == "sharp")
+		return ScaleSharp;
+	if (name == "area")
+		return ScaleArea;
+
+	return ScaleBlit;
+}
+
+/* Timestamped file in the data path, for
+ * captures started by hotkey */
+static std::string captureFile(const Config &conf, const char *prefix, const char *ext)
+{
+	const std::string &dir = conf.customDataPath.empty() ?
+	        conf.commonDataPath : conf.customDataPath;
+
+	char stamp[32];
+	time_t now = time(0);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+	/* Several captures within one second are numbered */
+	static std::string lastStamp;
+	static int seq = 0;
+
+	seq = (lastStamp == stamp) ? seq + 1 : 0;
+	lastStamp = stamp;
+
+	char name[64];
+
+	if (seq > 0)
+		snprintf(name, sizeof(name), "%s-%s-%d.%s", prefix, stamp, seq, ext);
+	else
+		snprintf(name, sizeof(name), "%s-%s.%s", prefix, stamp, ext);
+
+	return dir + name;
+}
+
+/* Runs 'func' with the script lock released, so other script
+ * threads get to run while the RGSS thread is blocked in it
+ * (see ScriptBinding::unlocked). 'func' must not call into the
+ * scripts or touch anything they might touch meanwhile */
+static void callUnlocked(void (*func)(void *), void *data)
+{
+	if (scriptBinding->unlocked)
+		scriptBinding->unlocked(func, data);
+	else
+		func(data);
+}
+
+static void swapUnlocked(void *window)
+{
+	SDL_GL_SwapWindow(static_cast<SDL_Window*>(window));
+}
+
 struct PingPong
 {
 	TEXFBO rt[2];
 	uint8_t srcInd, dstInd;
 	int screenW, screenH;
 
-	PingPong(int screenW, int screenH)
+	/* Shared by both buffers, so depth values
+	 * survive swaps in the middle of a frame */
+	bool hasDepth;
+	RBO::ID depth;
+
+	PingPong(int screenW, int screenH, bool hasDepth)
 	    : srcInd(0), dstInd(1),
-	      screenW(screenW), screenH(screenH)
+	      screenW(screenW), screenH(screenH),
+	      hasDepth(hasDepth)
 	{
+		if (hasDepth)
+		{
+			depth = RBO::gen();
+			RBO::bind(depth);
+			RBO::allocDepth(screenW, screenH);
+			RBO::unbind();
+		}
+
 		for (int i = 0; i < 2; ++i)
 		{
 			TEXFBO::init(rt[i]);
 			TEXFBO::allocEmpty(rt[i], screenW, screenH);
 			TEXFBO::linkFBO(rt[i]);
+
+			if (hasDepth)
+				FBO::setDepthTarget(depth);
+
 			gl.ClearColor(0, 0, 0, 1);
 			FBO::clear();
 		}
@@ -75,6 +194,9 @@ struct PingPong
 	{
 		for (int i = 0; i < 2; ++i)
 			TEXFBO::fini(rt[i]);
+
+		if (hasDepth)
+			RBO::del(depth);
 	}
 
 	TEXFBO &backBuffer()
@@ -87,14 +209,27 @@ struct PingPong
 		return rt[dstInd];
 	}
 
-	/* Better not call this during render cycles */
+	/* Better not call this during render cycles.
+	 * Storage only ever grows, so scripts switching back and
+	 * forth between resolutions don't reallocate every time;
+	 * the buffers are then used only in part */
 	void resize(int width, int height)
 	{
 		screenW = width;
 		screenH = height;
 
+		const Vec2i oldStorage(rt[0].texW, rt[0].texH);
+
 		for (int i = 0; i < 2; ++i)
-			TEXFBO::allocEmpty(rt[i], width, height);
+			TEXFBO::growEmpty(rt[i], width, height);
+
+		/* Attachments have to match in size */
+		if (hasDepth && Vec2i(rt[0].texW, rt[0].texH) != oldStorage)
+		{
+			RBO::bind(depth);
+			RBO::allocDepth(rt[0].texW, rt[0].texH);
+			RBO::unbind();
+		}
 	}
 
 	void startRender()
@@ -132,13 +267,31 @@ private:
 class ScreenScene : public Scene
 {
 public:
-	ScreenScene(int width, int height)
-	    : pp(width, height)
+	ScreenScene(int width, int height, bool depthBuffer)
+	    : pp(width, height, depthBuffer)
 	{
 		updateReso(width, height);
 
 		brightEffect = false;
 		brightnessQuad.setColor(Vec4());
+
+		direct = false;
+		effectsRequested = false;
+
+		frontValid = false;
+		frontStamp = 0;
+		frontSerial = 0;
+
+		TEXFBO::init(effectBuffer);
+
+		profilerQuads = 0;
+	}
+
+	~ScreenScene()
+	{
+		TEXFBO::fini(effectBuffer);
+
+		delete profilerQuads;
 	}
 
 	void composite()
@@ -146,135 +299,170 @@ public:
 		const int w = geometry.rect.w;
 		const int h = geometry.rect.h;
 
+		GPU_SCOPE(GPUComposite);
+
 		shState->prepareDraw();
 
 		pp.startRender();
 
 		glState.viewport.set(IntRect(0, 0, w, h));
 
+		/* The previous frame is cleared away entirely */
+		FBO::discard();
 		FBO::clear();
 
-		Scene::composite();
+		glState.depthBuffer = pp.hasDepth;
+		compositeScene();
+		glState.depthBuffer = false;
 
-		if (brightEffect)
-		{
-			SimpleColorShader &shader = shState->shaders().simpleColor;
-			shader.bind();
-			shader.applyViewportProj();
-			shader.setTranslation(Vec2i());
+		/* Left enabled by the tilemap if its
+		 * topmost layer didn't get to draw */
+		glState.depthTest.set(false);
+		glState.depthRange.set(Vec2(0, 1));
 
-			brightnessQuad.draw();
-		}
+		frontValid = true;
+		frontStamp = Scene::getChangeStamp();
+		++frontSerial;
 	}
 
-	void requestViewportRender(const Vec4 &c, const Vec4 &f, const Vec4 &t)
+	/* Whether the PingPong front buffer still holds the
+	 * scene as it would be composited right now */
+	bool frontBufferCurrent() const
 	{
-		const IntRect &viewpRect = glState.scissorBox.get();
-		const IntRect &screenRect = geometry.rect;
+		return frontValid && frontStamp == Scene::getChangeStamp();
+	}
 
-		const bool toneRGBEffect  = t.xyzNotNull();
-		const bool toneGrayEffect = t.w != 0;
-		const bool colorEffect    = c.w > 0;
-		const bool flashEffect    = f.w > 0;
+	void invalidateFrontBuffer()
+	{
+		frontValid = false;
+	}
 
-		if (toneGrayEffect)
-		{
-			pp.swapRender();
+	/* Identifies the contents of the front buffer;
+	 * advances with every composition into it */
+	unsigned int frontBufferSerial() const
+	{
+		return frontSerial;
+	}
 
-			if (!viewpRect.encloses(screenRect))
-			{
-				/* Scissor test _does_ affect FBO blit operations,
-				 * and since we're inside the draw cycle, it will
-				 * be turned on, so turn it off temporarily */
-				glState.scissorTest.pushSet(false);
+	/* Composites straight into the window framebuffer (or the
+	 * 'target' framebuffer), mapping the screen onto 'dst' (see
+	 * ScreenMapping). Returns false if a viewport effect turned
+	 * up on the way, in which case the frame has to be redone
+	 * through the PingPong buffers */
+	bool compositeDirect(const IntRect &dst, FBO::ID target = FBO::ID(0))
+	{
+		ScreenMapping mapping;
+		mapping.res = geometry.rect.size();
+		mapping.dst = dst;
 
-				GLMeta::blitBegin(pp.frontBuffer());
-				GLMeta::blitSource(pp.backBuffer());
-				GLMeta::blitRectangle(geometry.rect, Vec2i());
-				GLMeta::blitEnd();
+		GPU_SCOPE(GPUComposite);
 
-				glState.scissorTest.pop();
-			}
+		shState->prepareDraw();
 
-			GrayShader &shader = shState->shaders().gray;
-			shader.bind();
-			shader.setGray(t.w);
-			shader.applyViewportProj();
-			shader.setTexSize(screenRect.size());
+		/* The PingPong buffers are left behind */
+		frontValid = false;
 
-			TEX::bind(pp.backBuffer().tex);
+		FBO::bind(target);
 
-			glState.blend.pushSet(false);
-			screenQuad.draw();
-			glState.blend.pop();
-		}
+		glState.viewport.set(dst);
+		glState.scissorBox.setMapping(mapping);
+
+		FBO::clear();
+
+		direct = true;
+		compositeScene();
+		direct = false;
+
+		glState.scissorBox.setMapping(ScreenMapping());
+
+		return !effectsRequested;
+	}
+
+	/* Whether any viewport effects were requested
+	 * during the last composition */
+	bool hadEffects() const
+	{
+		return effectsRequested;
+	}
 
-		if (!toneRGBEffect && !colorEffect && !flashEffect)
+	/* Tone, color and flash are applied in a single pass reading
+	 * the composited viewport area from a second buffer. For a
+	 * viewport covering the screen that's the other PingPong
+	 * buffer, otherwise just its area is copied out first */
+	void requestViewportRender(const Vec4 &c, const Vec4 &f, const Vec4 &t)
+	{
+		effectsRequested = true;
+
+		/* Can't read back from the window framebuffer */
+		if (direct)
 			return;
 
-		FlatColorShader &shader = shState->shaders().flatColor;
+		GPU_SCOPE(GPUViewport);
+
+		const IntRect &viewpRect = glState.scissorBox.get();
+		const IntRect &screenRect = geometry.rect;
+
+		ViewportShader &shader = shState->shaders().viewport();
 		shader.bind();
 		shader.applyViewportProj();
+		shader.setTone(t);
+		shader.setColor(c.w > 0 ? c : Vec4());
+		shader.setFlash(f.w > 0 ? f : Vec4());
+
+		glState.blend.pushSet(false);
+		glState.depthTest.pushSet(false);
 
-		if (toneRGBEffect)
+		if (viewpRect.encloses(screenRect))
 		{
-			/* First split up additive / substractive components */
-			Vec4 add, sub;
-
-			if (t.x > 0)
-				add.x = t.x;
-			if (t.y > 0)
-				add.y = t.y;
-			if (t.z > 0)
-				add.z = t.z;
-
-			if (t.x < 0)
-				sub.x = -t.x;
-			if (t.y < 0)
-				sub.y = -t.y;
-			if (t.z < 0)
-				sub.z = -t.z;
-
-			/* Then apply them using hardware blending */
-			gl.BlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE);
-
-			if (add.xyzNotNull())
-			{
-				gl.BlendEquation(GL_FUNC_ADD);
-				shader.setColor(add);
+			pp.swapRender();
 
-				screenQuad.draw();
-			}
+			/* Overwritten by the opaque screen quad */
+			FBO::discard();
 
-			if (sub.xyzNotNull())
-			{
-				gl.BlendEquation(GL_FUNC_REVERSE_SUBTRACT);
-				shader.setColor(sub);
+			TEXFBO &back = pp.backBuffer();
+			shader.setTexSize(Vec2i(back.texW, back.texH));
+			TEX::bind(back.tex);
 
-				screenQuad.draw();
-			}
+			screenQuad.draw();
 		}
-
-		if (colorEffect || flashEffect)
+		else
 		{
-			gl.BlendEquation(GL_FUNC_ADD);
-			gl.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
-			                     GL_ZERO, GL_ONE);
-		}
+			int x1 = std::max(viewpRect.x, 0);
+			int y1 = std::max(viewpRect.y, 0);
+			int x2 = std::min(viewpRect.x + viewpRect.w, screenRect.w);
+			int y2 = std::min(viewpRect.y + viewpRect.h, screenRect.h);
 
-		if (colorEffect)
-		{
-			shader.setColor(c);
-			screenQuad.draw();
-		}
+			if (x2 > x1 && y2 > y1)
+			{
+				const IntRect area(x1, y1, x2 - x1, y2 - y1);
 
-		if (flashEffect)
-		{
-			shader.setColor(f);
-			screenQuad.draw();
+				ensureEffectBuffer(area.w, area.h);
+
+				/* Scissor test _does_ affect FBO blit operations,
+				 * and since we're inside the draw cycle, it will
+				 * be turned on, so turn it off temporarily */
+				glState.scissorTest.pushSet(false);
+
+				GLMeta::blitBegin(effectBuffer);
+				GLMeta::blitSource(pp.frontBuffer());
+				GLMeta::blitRectangle(area, Vec2i());
+				GLMeta::blitEnd();
+
+				glState.scissorTest.pop();
+
+				pp.startRender();
+
+				shader.bind();
+				shader.setTexSize(Vec2i(effectBuffer.width, effectBuffer.height));
+				TEX::bind(effectBuffer.tex);
+
+				effectQuad.setTexPosRect(IntRect(0, 0, area.w, area.h), area);
+				effectQuad.draw(shader);
+			}
 		}
 
-		glState.blendMode.refresh();
+		glState.depthTest.pop();
+		glState.blend.pop();
 	}
 
 	void setBrightness(float norm)
@@ -282,6 +470,7 @@ public:
 		brightnessQuad.setColor(Vec4(0, 0, 0, 1.0f - norm));
 
 		brightEffect = norm < 1.0f;
+		markDirty();
 	}
 
 	void updateReso(int width, int height)
@@ -307,16 +496,226 @@ public:
 	}
 
 private:
+	void compositeScene()
+	{
+		effectsRequested = false;
+
+		Scene::composite();
+
+		if (brightEffect)
+		{
+			SimpleColorShader &shader = shState->shaders().simpleColor();
+			shader.bind();
+			shader.applyViewportProj();
+			shader.setTranslation(Vec2i());
+
+			brightnessQuad.draw();
+		}
+
+		if (Profiler::overlayVisible())
+			drawProfilerOverlay();
+	}
+
+	/* One bar per profiled section, averaged over the last
+	 * half second, on a backdrop spanning two 60 FPS frames
+	 * with a marker at the end of the first one */
+	void drawProfilerOverlay()
+	{
+		static const Vec4 colors[] =
+		{
+			Vec4(0.9f, 0.3f, 0.3f, 1), /* Script */
+			Vec4(0.9f, 0.9f, 0.9f, 1), /* Composite */
+			Vec4(0.3f, 0.8f, 0.3f, 1), /* Sprites */
+			Vec4(0.3f, 0.8f, 0.8f, 1), /* Planes */
+			Vec4(0.4f, 0.5f, 1.0f, 1), /* Windows */
+			Vec4(0.8f, 0.5f, 0.2f, 1), /* Tilemaps */
+			Vec4(1.0f, 0.8f, 0.3f, 1), /* TilemapPrepare */
+			Vec4(0.8f, 0.4f, 0.9f, 1), /* BitmapOps */
+			Vec4(1.0f, 0.5f, 0.7f, 1), /* TexUpload */
+			Vec4(0.5f, 0.9f, 0.6f, 1), /* AudioFill */
+			Vec4(0.6f, 0.6f, 0.6f, 1), /* SwapWait */
+			Vec4(1.0f, 0.4f, 0.2f, 1), /* ScriptGC */
+			Vec4(0.9f, 0.9f, 0.5f, 1), /* GPUComposite */
+			Vec4(0.9f, 0.6f, 0.4f, 1), /* GPUViewport */
+			Vec4(0.5f, 0.7f, 0.9f, 1), /* GPUBlit */
+			Vec4(0.7f, 0.5f, 0.7f, 1)  /* GPUTransition */
+		};
+
+		const float pxPerMS = 6;
+		/* Memory rows, below the timings */
+		const float pxPerKB = 1 / 256.f;
+		const float pxPerCount = 4;
+		const int barHeight = 4;
+		const int margin = 2;
+
+		/* Created lazily, as QuadArray requires a fully
+		 * constructed SharedState */
+		if (!profilerQuads)
+			profilerQuads = new ColorQuadArray;
+
+		float times[Profiler::SectionCount];
+		Profiler::averages(times, 30);
+
+		ColorQuadArray &quads = *profilerQuads;
+		quads.resize(Profiler::SectionCount + 2 + MemStats::SubsystemCount * 2);
+		Vertex *vert = &quads.vertices[0];
+
+		const float width = pxPerMS * 1000.f / 30 + margin * 2;
+		const float timeHeight = Profiler::SectionCount * barHeight + margin * 2;
+		const float height = timeHeight + MemStats::SubsystemCount * barHeight + margin;
+
+		Quad::setPosRect(vert, FloatRect(0, 0, width, height));
+		Quad::setColor(vert, Vec4(0, 0, 0, 0.6f));
+		vert += 4;
+
+		Quad::setPosRect(vert, FloatRect(margin + pxPerMS * 1000.f / 60, 0, 1, timeHeight));
+		Quad::setColor(vert, Vec4(1, 1, 1, 0.5f));
+		vert += 4;
+
+		for (int i = 0; i < Profiler::SectionCount; ++i, vert += 4)
+		{
+			const float len = std::min(times[i] * pxPerMS, width - margin * 2);
+
+			Quad::setPosRect(vert, FloatRect(margin, margin + i * barHeight,
+			                                 len, barHeight - 1));
+			Quad::setColor(vert, colors[i]);
+		}
+
+		/* Peak as a dim bar behind the current value */
+		for (int i = 0; i < MemStats::SubsystemCount; ++i, vert += 8)
+		{
+			const MemStats::Subsystem sub = (MemStats::Subsystem) i;
+			const bool isCount = (sub == MemStats::MidiSynths ||
+			                      sub == MemStats::FontHandles);
+			const float scale = isCount ? pxPerCount : pxPerKB / 1024;
+			const float maxLen = width - margin * 2;
+			const float y = timeHeight + i * barHeight;
+
+			const float peak = std::min(MemStats::peak(sub) * scale, maxLen);
+			const float cur = std::min(MemStats::current(sub) * scale, maxLen);
+
+			Quad::setPosRect(vert, FloatRect(margin, y, peak, barHeight - 1));
+			Quad::setColor(vert, Vec4(0.5f, 0.5f, 0.9f, 0.4f));
+
+			Quad::setPosRect(vert+4, FloatRect(margin, y, cur, barHeight - 1));
+			Quad::setColor(vert+4, Vec4(0.5f, 0.6f, 1.0f, 1));
+		}
+
+		SimpleColorShader &shader = shState->shaders().simpleColor();
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setTranslation(Vec2i());
+
+		quads.commit();
+		quads.draw();
+	}
+
+	/* Only ever grows */
+	void ensureEffectBuffer(int width, int height)
+	{
+		if (effectBuffer.width >= width && effectBuffer.height >= height)
+			return;
+
+		width = std::max(width, effectBuffer.width);
+		height = std::max(height, effectBuffer.height);
+
+		TEXFBO::allocEmpty(effectBuffer, width, height);
+		TEXFBO::linkFBO(effectBuffer);
+	}
+
 	PingPong pp;
 	Quad screenQuad;
 
 	Quad brightnessQuad;
 	bool brightEffect;
+
+	ColorQuadArray *profilerQuads;
+
+	/* Set while compositing into the window framebuffer */
+	bool direct;
+	bool effectsRequested;
+
+	/* Change stamp of the scene as last composited
+	 * into the front buffer (see Scene::getChangeStamp()) */
+	bool frontValid;
+	unsigned int frontStamp;
+	unsigned int frontSerial;
+
+	/* Receives the area of viewports smaller than the screen */
+	TEXFBO effectBuffer;
+	Quad effectQuad;
 };
 
 /* Nanoseconds per second */
 #define NS_PER_S 1000000000
 
+/* Number of most recent frames covered by the frame stats */
+#define FRAME_STATS_N 256
+
+/* Records the intervals between consecutive frames */
+struct FrameTimer
+{
+	uint64_t lastTick;
+	const double tickFreqMS;
+
+	/* Ring buffer of intervals */
+	float times[FRAME_STATS_N];
+	int next;
+	int count;
+
+	FrameTimer()
+	    : lastTick(0),
+	      tickFreqMS(SDL_GetPerformanceFrequency() / 1000.0),
+	      next(0),
+	      count(0)
+	{}
+
+	void tick()
+	{
+		const uint64_t now = SDL_GetPerformanceCounter();
+
+		if (lastTick != 0)
+		{
+			times[next] = (now - lastTick) / tickFreqMS;
+			next = (next + 1) % FRAME_STATS_N;
+			count = std::min(count + 1, FRAME_STATS_N);
+		}
+
+		lastTick = now;
+	}
+
+	/* Breaks the chain of intervals, so that
+	 * deliberate pauses don't show up as frames */
+	void reset()
+	{
+		lastTick = 0;
+	}
+
+	Graphics::FrameStats stats() const
+	{
+		Graphics::FrameStats result;
+		result.count = count;
+		result.min = result.avg = result.p99 = 0;
+
+		if (count == 0)
+			return result;
+
+		std::vector<float> sorted(times, times + count);
+		std::sort(sorted.begin(), sorted.end());
+
+		double sum = 0;
+
+		for (int i = 0; i < count; ++i)
+			sum += sorted[i];
+
+		result.min = sorted.front();
+		result.avg = sum / count;
+		result.p99 = sorted[(count * 99) / 100];
+
+		return result;
+	}
+};
+
 struct FPSLimiter
 {
 	uint64_t lastTickCount;
@@ -335,6 +734,14 @@ struct FPSLimiter
 
 	bool disabled;
 
+	/* Ticks before the deadline that are busy-waited
+	 * instead of slept through */
+	uint64_t spinTicks;
+
+	/* Offered the time left until the deadline
+	 * (see ScriptBinding::idle), if any */
+	void (*idleWork)(int usecs);
+
 	/* Data for frame timing adjustment */
 	struct
 	{
@@ -352,7 +759,9 @@ struct FPSLimiter
 	      tickFreq(SDL_GetPerformanceFrequency()),
 	      tickFreqMS(tickFreq / 1000),
 	      tickFreqNS((double) tickFreq / NS_PER_S),
-	      disabled(false)
+	      disabled(false),
+	      spinTicks(0),
+	      idleWork(0)
 	{
 		setDesiredFPS(desiredFPS);
 
@@ -366,12 +775,18 @@ struct FPSLimiter
 		tpf = tickFreq / value;
 	}
 
+	void setSpinTime(int usecs)
+	{
+		spinTicks = tickFreq * usecs / 1000000;
+	}
+
 	void delay()
 	{
 		if (disabled)
 			return;
 
-		int64_t tickDelta = SDL_GetPerformanceCounter() - lastTickCount;
+		uint64_t start = SDL_GetPerformanceCounter();
+		int64_t tickDelta = start - lastTickCount;
 		int64_t toDelay = tpf - tickDelta;
 
 		/* Compensate for the last delta
@@ -381,7 +796,35 @@ struct FPSLimiter
 		if (toDelay < 0)
 			toDelay = 0;
 
-		delayTicks(toDelay);
+		/* Less than a millisecond isn't worth handing out */
+		if ((idleWork || IdleTasks::pending())
+		    && toDelay > (int64_t) (spinTicks + tickFreqMS))
+		{
+			const uint64_t deadline = start + toDelay;
+
+			/* GL thread tasks first, the binding gets the rest */
+			int usecs = (toDelay - spinTicks) * 1000000 / tickFreq;
+			usecs = IdleTasks::run(usecs);
+
+			if (idleWork && usecs >= 1000)
+				idleWork(usecs);
+
+			start = SDL_GetPerformanceCounter();
+			toDelay = start < deadline ? deadline - start : 0;
+		}
+
+		Wait wait = { this, start, toDelay };
+		callUnlocked(waitUnlocked, &wait);
+
+		tick();
+	}
+
+	/* The timing bookkeeping of delay() without the waiting,
+	 * for frames that are skipped to catch up */
+	void tick()
+	{
+		if (disabled)
+			return;
 
 		uint64_t now = lastTickCount = SDL_GetPerformanceCounter();
 		int64_t diff = now - adj.last;
@@ -416,6 +859,35 @@ struct FPSLimiter
 	}
 
 private:
+	struct Wait
+	{
+		FPSLimiter *self;
+		uint64_t start;
+		int64_t ticks;
+	};
+
+	static void waitUnlocked(void *data)
+	{
+		Wait &wait = *static_cast<Wait*>(data);
+		FPSLimiter &self = *wait.self;
+
+		if (self.spinTicks == 0)
+		{
+			self.delayTicks(wait.ticks);
+		}
+		else
+		{
+			/* Sleep to just before the deadline, then spin
+			 * out the rest so oversleeping can't miss it */
+			const uint64_t deadline = wait.start + wait.ticks;
+
+			if ((uint64_t) wait.ticks > self.spinTicks)
+				self.delayTicks(wait.ticks - self.spinTicks);
+
+			while (SDL_GetPerformanceCounter() < deadline) {}
+		}
+	}
+
 	void delayTicks(uint64_t ticks)
 	{
 #if defined(HAVE_NANOSLEEP)
@@ -443,6 +915,60 @@ private:
 	}
 };
 
+/* Transition maps most recently used first; games tend
+ * to reuse the same few (eg. for every battle start) */
+#define TRANS_MAP_CACHE_SIZE 4
+
+struct TransMapCache
+{
+	struct Entry
+	{
+		std::string filename;
+		Bitmap *map;
+	};
+
+	/* Cleared by Graphics before it goes away, as
+	 * disposing Bitmaps goes through it */
+	std::list<Entry> entries;
+
+	/* Throws if the map can't be loaded */
+	Bitmap *get(const std::string &filename)
+	{
+		std::list<Entry>::iterator iter;
+
+		for (iter = entries.begin(); iter != entries.end(); ++iter)
+		{
+			if (iter->filename != filename || iter->map->isDisposed())
+				continue;
+
+			entries.splice(entries.begin(), entries, iter);
+			return iter->map;
+		}
+
+		Entry entry;
+		entry.filename = filename;
+		entry.map = new Bitmap(filename.c_str());
+		entries.push_front(entry);
+
+		if (entries.size() > TRANS_MAP_CACHE_SIZE)
+		{
+			delete entries.back().map;
+			entries.pop_back();
+		}
+
+		return entry.map;
+	}
+
+	void clear()
+	{
+		for (std::list<Entry>::iterator iter = entries.begin();
+		     iter != entries.end(); ++iter)
+			delete iter->map;
+
+		entries.clear();
+	}
+};
+
 struct GraphicsPrivate
 {
 	/* Screen resolution, ie. the resolution at which
@@ -471,27 +997,98 @@ struct GraphicsPrivate
 	int brightness;
 
 	FPSLimiter fpsLimiter;
+	FrameTimer frameTimer;
 
 	bool frozen;
 	TEXFBO frozenScene;
 	Quad screenQuad;
 
-	/* Global list of all live Disposables
+	/* Transition from 'frozenScene' in progress. Unless run
+	 * asynchronously, it's completed within transition() */
+	struct
+	{
+		bool active;
+		int duration;
+		int frame;
+		float vague;
+		/* Owned by 'transMaps' */
+		Bitmap *map;
+	} trans;
+
+	TransMapCache transMaps;
+
+	ScaleMode scaleMode;
+
+	/* With 'dynamicResolution', fill rate bound frames are composited
+	 * at a reduced scale into 'buffer' (the way compositeDirect()
+	 * maps them to the window) and stretched to the window from
+	 * there. 'step' indexes 'renderScales' and is adjusted after
+	 * every 'dynResInterval' frames, by their average GPU time */
+	struct
+	{
+		bool enabled;
+		int step;
+		int frames;
+		TEXFBO buffer;
+	} dynRes;
+
+	/* Whether the last frame was composited straight into the
+	 * window framebuffer, leaving the PingPong buffers stale */
+	bool lastFrameDirect;
+
+	/* Frames presented since the screen was last composited */
+	int idleFrames;
+
+	/* A frame sits in the window framebuffer, waiting to be
+	 * swapped in at the start of the next one */
+	bool presentPending;
+
+	/* Fast forward button held as of the last update, and
+	 * the frames run since the last one drawn while it is */
+	bool fastForward;
+	int fastForwardFrames;
+
+	/* Frames skipped in a row to catch up, and in total */
+	int skipRun;
+	int skippedFrames;
+
+	/* GL calls issued between the last two updates */
+	GLCallCounts lastCallCounts;
+
+	ScreenCapture capture;
+
+	BudgetTuner budgetTuner;
+
+	/* Global table of all live Disposables
 	 * (disposed on reset) */
-	IntruList<Disposable> dispList;
+	HandleTable<Disposable> dispTable;
+
+	/* Live elements stepped by update() with 'autoUpdateFlash' */
+	HandleTable<Flashable> flashTable;
+	bool autoUpdateFlash;
 
 	GraphicsPrivate(RGSSThreadData *rtData)
 	    : scRes(DEF_SCREEN_W, DEF_SCREEN_H),
 	      scSize(scRes),
 	      winSize(rtData->config.defScreenW, rtData->config.defScreenH),
-	      screen(scRes.x, scRes.y),
+	      screen(scRes.x, scRes.y, rtData->config.tilemapDepthMerge),
 	      threadData(rtData),
 	      glCtx(SDL_GL_GetCurrentContext()),
 	      frameRate(DEF_FRAMERATE),
 	      frameCount(0),
 	      brightness(255),
 	      fpsLimiter(frameRate),
-	      frozen(false)
+	      frozen(false),
+	      scaleMode(scaleModeFromName(rtData->config.scalingMode)),
+	      lastFrameDirect(false),
+	      idleFrames(0),
+	      presentPending(false),
+	      fastForward(false),
+	      fastForwardFrames(0),
+	      skipRun(0),
+	      skippedFrames(0),
+	      budgetTuner(rtData->config),
+	      autoUpdateFlash(false)
 	{
 		recalculateScreenSize(rtData);
 		updateScreenResoRatio(rtData);
@@ -500,15 +1097,54 @@ struct GraphicsPrivate
 		TEXFBO::allocEmpty(frozenScene, scRes.x, scRes.y);
 		TEXFBO::linkFBO(frozenScene);
 
-		FloatRect screenRect(0, 0, scRes.x, scRes.y);
+		dynRes.enabled = rtData->config.dynamicResolution && gl.timer_query;
+		dynRes.step = 0;
+		dynRes.frames = 0;
+
+		if (dynRes.enabled)
+		{
+			TEXFBO::init(dynRes.buffer);
+			TEXFBO::allocEmpty(dynRes.buffer, scRes.x, scRes.y);
+			TEXFBO::linkFBO(dynRes.buffer);
+		}
+
+		GPUTimer::setRequired(dynRes.enabled);
+
+		FloatRect screenRect(0, 0, scRes.x, scRes.y);
 		screenQuad.setTexPosRect(screenRect, screenRect);
 
 		fpsLimiter.resetFrameAdjust();
+		fpsLimiter.idleWork = scriptBinding->idle;
+
+		trans.active = false;
+		trans.duration = trans.frame = 0;
+		trans.vague = 0;
+		trans.map = 0;
+
+		memset(&lastCallCounts, 0, sizeof(lastCallCounts));
+
+		/* Replays are run for their profile */
+		Profiler::setEnabled(rtData->config.profiler
+		                     || !rtData->config.inputReplay.empty());
+
+		if (!rtData->config.profilerTrace.empty())
+			Profiler::startTrace();
 	}
 
 	~GraphicsPrivate()
 	{
 		TEXFBO::fini(frozenScene);
+
+		if (dynRes.enabled)
+			TEXFBO::fini(dynRes.buffer);
+
+		GPUTimer::fini();
+
+		const std::string &tracePath = threadData->config.profilerTrace;
+
+		if (!tracePath.empty() && Profiler::isTracing())
+			if (!Profiler::stopTrace(tracePath.c_str()))
+				Debug() << "Unable to write trace to" << tracePath;
 	}
 
 	void updateScreenResoRatio(RGSSThreadData *rtData)
@@ -525,6 +1161,16 @@ struct GraphicsPrivate
 	{
 		scSize = winSize;
 
+		if (scaleMode == ScaleInteger)
+		{
+			int scale = std::min(winSize.x / scRes.x, winSize.y / scRes.y);
+			scale = std::max(scale, 1);
+
+			scSize = scRes * scale;
+			scOffset = (winSize - scSize) / 2;
+			return;
+		}
+
 		if (!rtData->config.fixedAspectRatio)
 		{
 			scOffset = Vec2i(0, 0);
@@ -549,6 +1195,7 @@ struct GraphicsPrivate
 		{
 			/* some GL drivers change the viewport on window resize */
 			glState.viewport.refresh();
+			Scene::markDirty();
 			recalculateScreenSize(threadData);
 			updateScreenResoRatio(threadData);
 
@@ -571,19 +1218,244 @@ struct GraphicsPrivate
 		scriptBinding->terminate();
 	}
 
+	void swapWindow()
+	{
+		/* Nothing is shown; just keep the GL queue moving */
+		if (threadData->config.headless)
+		{
+			gl.Flush();
+			return;
+		}
+
+		PROFILE_SCOPE(SwapWait);
+		callUnlocked(swapUnlocked, threadData->window);
+
+		/* The back buffer is undefined after a swap anyway; tell
+		 * tilers not to load it back in for the next frame */
+		FBO::unbind();
+		FBO::discardWindow();
+	}
+
+	/* In headless mode, whether the current frame
+	 * gets composited at all */
+	bool headlessDrawDue() const
+	{
+		const int interval = threadData->config.headlessDrawInterval;
+
+		return interval > 0 && frameCount % interval == 0;
+	}
+
+	/* Counts a frame that isn't drawn */
+	void tickUndrawnFrame()
+	{
+		frameTimer.tick();
+		++frameCount;
+		threadData->ethread->notifyFrame();
+	}
+
+	/* While fast forwarding, only the last of every 'fastForwardSpeed'
+	 * frames is drawn, and the frame limiter only paces those */
+	bool skipFastForwardFrame()
+	{
+		const int speed = threadData->config.fastForwardSpeed;
+		const bool active = speed > 1 && shState->input().isPressed(Input::FastForward);
+
+		if (active != fastForward)
+		{
+			fastForward = active;
+			fastForwardFrames = 0;
+			shState->audio().setMuted(active);
+		}
+
+		if (!active)
+			return false;
+
+		if (++fastForwardFrames < speed)
+			return true;
+
+		fastForwardFrames = 0;
+
+		return false;
+	}
+
 	void swapGLBuffer()
 	{
 		fpsLimiter.delay();
-		SDL_GL_SwapWindow(threadData->window);
+		swapWindow();
+		frameTimer.tick();
 
 		++frameCount;
 
 		threadData->ethread->notifyFrame();
 	}
 
-	void compositeToBuffer(TEXFBO &buffer)
+	/* Presents the frame drawn into the window framebuffer. When
+	 * presenting is deferred, the swap is put off until the next
+	 * frame starts, so the GPU works through this one while the
+	 * scripts run. The frame count still advances right away */
+	void presentFrame()
+	{
+		if (!threadData->config.deferredPresent)
+		{
+			swapGLBuffer();
+			return;
+		}
+
+		gl.Flush();
+
+		presentPending = true;
+		++frameCount;
+	}
+
+	/* Performs a swap put off by presentFrame(). Has to be called
+	 * before anything else is drawn into the window framebuffer */
+	void flushPresent()
 	{
+		if (!presentPending)
+			return;
+
+		presentPending = false;
+
+		fpsLimiter.delay();
+		swapWindow();
+		frameTimer.tick();
+
+		threadData->ethread->notifyFrame();
+	}
+
+	/* Composites the screen into the PingPong front buffer,
+	 * unless it already holds the current scene (as it does
+	 * when the last frame was presented from it unchanged) */
+	void ensureFrontBuffer()
+	{
+		if (threadData->config.skipUnchangedFrames && screen.frontBufferCurrent())
+			return;
+
 		screen.composite();
+	}
+
+	/* Draws the current transition frame, blending from the frozen
+	 * scene to the one in the PingPong front buffer. Where the
+	 * screen could be composited straight into the window
+	 * framebuffer, so can the transition */
+	void drawTransitionFrame()
+	{
+		GPU_SCOPE(GPUTransition);
+
+		const float prog = trans.frame * (1.0f / trans.duration);
+		TEXFBO &currentScene = screen.getPP().frontBuffer();
+		ShaderBase *base;
+
+		/* The scene buffers may be larger than the screen
+		 * (see PingPong::resize), but are always equally so */
+		const Vec2i sceneStorage(currentScene.texW, currentScene.texH);
+		const Vec2 sceneCoverage((float) scRes.x / sceneStorage.x,
+		                         (float) scRes.y / sceneStorage.y);
+
+		if (trans.map)
+		{
+			TransShader &shader = shState->shaders().trans();
+			shader.bind();
+			shader.setFrozenScene(frozenScene.tex);
+			shader.setCurrentScene(currentScene.tex);
+			shader.setTransMap(trans.map->getGLTypes(), sceneCoverage);
+			shader.setRamp(prog, trans.vague);
+			shader.setTexSize(sceneStorage);
+			base = &shader;
+		}
+		else
+		{
+			SimpleTransShader &shader = shState->shaders().simpleTrans();
+			shader.bind();
+			shader.setFrozenScene(frozenScene.tex);
+			shader.setCurrentScene(currentScene.tex);
+			shader.setProg(prog);
+			shader.setTexSize(sceneStorage);
+			base = &shader;
+		}
+
+		glState.blend.pushSet(false);
+
+		if (canRenderDirect())
+		{
+			ScreenMapping mapping;
+			mapping.res = scRes;
+			mapping.dst = IntRect(scOffset.x, scOffset.y, scSize.x, scSize.y);
+
+			FBO::unbind();
+			glState.viewport.pushSet(mapping.dst);
+			glState.scissorBox.setMapping(mapping);
+
+			base->applyViewportProj();
+
+			FBO::clear();
+			screenQuad.draw();
+
+			glState.scissorBox.setMapping(ScreenMapping());
+			glState.viewport.pop();
+		}
+		else
+		{
+			/* The back buffer is unused during the transition,
+			 * so it can hold the frame until it's blitted
+			 * flipped and scaled to the screen */
+			TEXFBO &transBuffer = screen.getPP().backBuffer();
+
+			FBO::bind(transBuffer.fbo);
+			glState.viewport.pushSet(IntRect(0, 0, scRes.x, scRes.y));
+
+			base->applyViewportProj();
+
+			FBO::clear();
+			screenQuad.draw();
+
+			glState.viewport.pop();
+
+			presentScaled(transBuffer);
+		}
+
+		glState.blend.pop();
+	}
+
+	/* Presents the next frame of the transition in progress.
+	 * Once all are shown, ends it and returns false */
+	bool stepTransition()
+	{
+		if (!trans.active)
+			return false;
+
+		if (trans.frame >= trans.duration)
+		{
+			finishTransition();
+			return false;
+		}
+
+		checkResize();
+		drawTransitionFrame();
+		++trans.frame;
+
+		swapGLBuffer();
+
+		return true;
+	}
+
+	/* Ends the transition in progress, if any, unfreezing
+	 * the screen as if it had run its course */
+	void finishTransition()
+	{
+		if (!trans.active)
+			return;
+
+		trans.map = 0;
+		trans.active = false;
+
+		frozen = false;
+		Scene::markDirty();
+	}
+
+	void compositeToBuffer(TEXFBO &buffer)
+	{
+		ensureFrontBuffer();
 
 		GLMeta::blitBegin(buffer);
 		GLMeta::blitSource(screen.getPP().frontBuffer());
@@ -591,26 +1463,296 @@ struct GraphicsPrivate
 		GLMeta::blitEnd();
 	}
 
+	/* Fills the window with 'source' (holding the game screen),
+	 * flipped and scaled according to the scaling mode */
+	void presentScaled(TEXFBO &source)
+	{
+		if (scaleMode == ScaleBlit)
+		{
+			GLMeta::blitBeginScreen(winSize);
+			GLMeta::blitSource(source);
+
+			FBO::clear();
+			metaBlitBufferFlippedScaled();
+
+			GLMeta::blitEnd();
+
+			return;
+		}
+
+		GPU_SCOPE(GPUBlit);
+
+		FBO::unbind();
+		glState.viewport.pushSet(IntRect(0, 0, winSize.x, winSize.y));
+
+		FBO::clear();
+
+		const Vec2 scale((float) scSize.x / scRes.x,
+		                 (float) scSize.y / scRes.y);
+		Vec2 footprint(1 / scale.x, 1 / scale.y);
+
+		/* Only the fraction beyond the largest whole
+		 * multiple is spent on smoothing edges */
+		if (scaleMode == ScaleSharp)
+			footprint = Vec2(1 / std::max(floorf(scale.x), 1.0f),
+			                 1 / std::max(floorf(scale.y), 1.0f));
+
+		UpscaleShader &shader = shState->shaders().upscale();
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setTranslation(Vec2i());
+		shader.setTexSize(Vec2i(source.texW, source.texH));
+		shader.setFootprint(footprint);
+
+		TEX::bind(source.tex);
+		TEX::setSmooth(true);
+
+		glState.blend.pushSet(false);
+
+		Quad &quad = shState->gpQuad();
+		quad.setTexPosRect(IntRect(0, 0, scRes.x, scRes.y),
+		                   IntRect(scOffset.x, scSize.y+scOffset.y, scSize.x, -scSize.y));
+		quad.draw(shader);
+
+		glState.blend.pop();
+
+		TEX::setSmooth(false);
+
+		glState.viewport.pop();
+	}
+
 	void metaBlitBufferFlippedScaled()
 	{
+		GPU_SCOPE(GPUBlit);
+
 		GLMeta::blitRectangle(IntRect(0, 0, scRes.x, scRes.y),
 		                      IntRect(scOffset.x, scSize.y+scOffset.y, scSize.x, -scSize.y),
 		                      threadData->config.smoothScaling);
 	}
 
-	void redrawScreen()
+	/* The window framebuffer can be rendered into directly if the
+	 * game screen lands on it unscaled, or at an integer scale
+	 * that would be sampled without smoothing anyway */
+	bool canRenderDirect() const
 	{
-		screen.composite();
+		if (!threadData->config.directRender)
+			return false;
+
+		/* Effects from the previous frame are likely to persist */
+		if (screen.hadEffects())
+			return false;
+
+		if (scSize == scRes)
+			return true;
+
+		/* All shader modes sample integer scales
+		 * exactly like nearest filtering does */
+		if (scaleMode == ScaleBlit && threadData->config.smoothScaling)
+			return false;
+
+		if (scSize.x % scRes.x || scSize.y % scRes.y)
+			return false;
+
+		return scSize.x / scRes.x == scSize.y / scRes.y;
+	}
+
+	/* Steps the render scale down while the GPU can't keep up
+	 * with the frame rate, and back up once it has headroom */
+	void updateRenderScale()
+	{
+		if (++dynRes.frames < dynResInterval)
+			return;
+
+		double gpuTime = GPUTimer::frameAverage();
+
+		if (gpuTime < 0)
+			return;
+
+		const double budget = 1000.0 / frameRate;
+		int step = dynRes.step;
+
+		if (gpuTime > budget * 0.9 && step < renderScaleCount-1)
+			++step;
+		else if (gpuTime < budget * 0.5 && step > 0)
+			--step;
+
+		dynRes.frames = 0;
+
+		if (step == dynRes.step)
+			return;
+
+		dynRes.step = step;
+
+		/* Earlier frames were measured at the old scale */
+		GPUTimer::resetAverage();
+	}
+
+	/* Composites and presents the frame at the current reduced
+	 * render scale. Returns false if it has to be drawn at full
+	 * resolution instead (viewport effects can't be mapped) */
+	bool redrawScaled()
+	{
+		if (!dynRes.enabled)
+			return false;
+
+		updateRenderScale();
+
+		if (dynRes.step == 0 || screen.hadEffects())
+			return false;
+
+		const float scale = renderScales[dynRes.step];
+		const IntRect dst(0, 0, scRes.x * scale, scRes.y * scale);
+
+		TEXFBO &buffer = dynRes.buffer;
+
+		/* Follows screen resizes */
+		TEXFBO::growEmpty(buffer, scRes.x, scRes.y);
 
+		if (!screen.compositeDirect(dst, buffer.fbo))
+			return false;
+
+		Scene::clearDirty();
+		lastFrameDirect = true;
+
+		/* Already laid out like the window,
+		 * so it's stretched without flipping */
 		GLMeta::blitBeginScreen(winSize);
-		GLMeta::blitSource(screen.getPP().frontBuffer());
+		GLMeta::blitSource(buffer);
 
 		FBO::clear();
-		metaBlitBufferFlippedScaled();
+		GLMeta::blitRectangle(dst, IntRect(scOffset.x, scOffset.y, scSize.x, scSize.y), true);
 
 		GLMeta::blitEnd();
 
-		swapGLBuffer();
+		presentFrame();
+
+		return true;
+	}
+
+	void redrawScreen()
+	{
+		idleFrames = 0;
+
+		if (redrawScaled())
+			return;
+
+		if (canRenderDirect())
+		{
+			const IntRect dst(scOffset.x, scOffset.y, scSize.x, scSize.y);
+
+			if (screen.compositeDirect(dst))
+			{
+				Scene::clearDirty();
+				lastFrameDirect = true;
+				presentFrame();
+
+				return;
+			}
+		}
+
+		lastFrameDirect = false;
+
+		screen.composite();
+		Scene::clearDirty();
+
+		presentFrontBuffer();
+	}
+
+	void presentFrontBuffer()
+	{
+		presentScaled(screen.getPP().frontBuffer());
+
+		presentFrame();
+	}
+
+	/* Redraws the screen, unless nothing in the scene changed
+	 * since the last frame. Then the window is left showing
+	 * it, and only the frame timing is kept up */
+	void updateScreen()
+	{
+		flushPresent();
+
+		if (!threadData->config.skipUnchangedFrames || Scene::isDirty())
+		{
+			redrawScreen();
+			return;
+		}
+
+		/* Recomposite once in a while anyway, in case
+		 * the window contents got lost */
+		if (++idleFrames >= frameRate)
+		{
+			redrawScreen();
+			return;
+		}
+
+		if (!fpsLimiter.disabled)
+		{
+			fpsLimiter.delay();
+			frameTimer.tick();
+			++frameCount;
+			threadData->ethread->notifyFrame();
+
+			return;
+		}
+
+		/* Frames are paced by the buffer swap, so something has
+		 * to be presented; the last one is reused if possible */
+		if (lastFrameDirect)
+			redrawScreen();
+		else
+			presentFrontBuffer();
+	}
+
+	/* Once per update, the way scripts calling
+	 * 'update' on every element each frame would */
+	void updateFlashables()
+	{
+		for (size_t i = 0; i < flashTable.capacity(); ++i)
+			if (Flashable *f = flashTable.at(i))
+				f->update();
+	}
+
+	void checkCaptureKeys()
+	{
+		if (threadData->rqScreenshot)
+		{
+			threadData->rqScreenshot.clear();
+			capture.requestScreenshot(captureFile(threadData->config, "screenshot", "png"));
+		}
+
+		if (threadData->rqRecordToggle)
+		{
+			threadData->rqRecordToggle.clear();
+
+			if (capture.recording())
+			{
+				capture.stopRecording();
+				return;
+			}
+
+			try
+			{
+				capture.startRecording(captureFile(threadData->config, "recording", "rgba"));
+			}
+			catch (const Exception &e)
+			{
+				Debug() << e.msg;
+			}
+		}
+	}
+
+	/* Hands the frame just drawn to the screen capture */
+	void captureFrame()
+	{
+		if (!capture.pending())
+			return;
+
+		/* Only these bypass the PingPong buffers */
+		if (lastFrameDirect)
+			screen.composite();
+
+		capture.capture(screen.getPP().frontBuffer(), scRes.x, scRes.y);
 	}
 
 	void checkSyncLock()
@@ -618,6 +1760,11 @@ struct GraphicsPrivate
 		if (!threadData->syncPoint.mainSyncLocked())
 			return;
 
+		flushPresent();
+
+		if (threadData->config.snapshotOnSuspend)
+			Bitmap::snapshotTextures();
+
 		/* Releasing the GL context before sleeping and making it
 		 * current again on wakeup seems to avoid the context loss
 		 * when the app moves into the background on Android */
@@ -626,6 +1773,7 @@ struct GraphicsPrivate
 		SDL_GL_MakeCurrent(threadData->window, glCtx);
 
 		fpsLimiter.resetFrameAdjust();
+		frameTimer.reset();
 	}
 };
 
@@ -633,6 +1781,8 @@ Graphics::Graphics(RGSSThreadData *data)
 {
 	p = new GraphicsPrivate(data);
 
+	p->fpsLimiter.setSpinTime(data->config.frameSpinTime);
+
 	if (data->config.syncToRefreshrate)
 	{
 		p->frameRate = data->refreshRate;
@@ -646,45 +1796,101 @@ Graphics::Graphics(RGSSThreadData *data)
 	{
 		p->fpsLimiter.disabled = true;
 	}
+
+	if (data->config.headless)
+		p->fpsLimiter.disabled = true;
 }
 
 Graphics::~Graphics()
 {
+	p->transMaps.clear();
+
 	delete p;
 }
 
 void Graphics::update()
 {
+	ProfileFrame profileFrame;
+	GPUTimer::newFrame();
+
+	p->lastCallCounts = glCallCounts;
+	memset(&glCallCounts, 0, sizeof(glCallCounts));
+
 	p->checkShutDownReset();
 	p->checkSyncLock();
+	p->flushPresent();
+
+	shState->workerPool().runContinuations();
+
+	p->checkCaptureKeys();
+	p->capture.process();
+
+	if (p->autoUpdateFlash)
+		p->updateFlashables();
+
+	/* An asynchronous transition is shown until it's done */
+	if (p->stepTransition())
+		return;
 
 	if (p->frozen)
 		return;
 
+	if (p->skipFastForwardFrame())
+	{
+		p->tickUndrawnFrame();
+		return;
+	}
+
 	if (p->fpsLimiter.frameSkipRequired())
 	{
-		if (p->threadData->config.frameSkip)
+		const Config &conf = p->threadData->config;
+
+		if (conf.frameSkip && p->skipRun < conf.maxFrameSkip)
 		{
-			/* Skip frame */
-			p->fpsLimiter.delay();
-			++p->frameCount;
-			p->threadData->ethread->notifyFrame();
+			/* Skip frame; no point in waiting when behind */
+			p->fpsLimiter.tick();
+			p->tickUndrawnFrame();
+
+			++p->skipRun;
+			++p->skippedFrames;
 
 			return;
 		}
 		else
 		{
-			/* Just reset frame adjust counter */
+			/* Give up on catching up, so that a device too slow
+			 * for the frame rate settles at a steady lower one */
 			p->fpsLimiter.resetFrameAdjust();
 		}
 	}
 
+	p->skipRun = 0;
+
+	Bitmap::flushReadbacks();
+	Bitmap::enforceTextureBudget();
+	p->budgetTuner.update();
+	shState->scratchArena().newFrame();
+	GLDeleteQueue::newFrame();
+
+	if (p->threadData->config.headless && !p->headlessDrawDue())
+	{
+		p->tickUndrawnFrame();
+		return;
+	}
+
+	/* Keep the overlay current on otherwise unchanged frames */
+	if (Profiler::overlayVisible())
+		Scene::markDirty();
+
 	p->checkResize();
-	p->redrawScreen();
+	p->updateScreen();
+	p->captureFrame();
 }
 
 void Graphics::freeze()
 {
+	p->flushPresent();
+	p->finishTransition();
 	p->frozen = true;
 
 	p->checkShutDownReset();
@@ -696,122 +1902,81 @@ void Graphics::freeze()
 
 void Graphics::transition(int duration,
                           const char *filename,
-                          int vague)
+                          int vague,
+                          bool async)
 {
 	p->checkSyncLock();
 
+	/* Complete a still running asynchronous one first */
+	p->finishTransition();
+
 	if (!p->frozen)
 		return;
 
 	vague = clamp(vague, 1, 256);
-	Bitmap *transMap = *filename ? new Bitmap(filename) : 0;
+	Bitmap *transMap = *filename ? p->transMaps.get(filename) : 0;
 
 	setBrightness(255);
 
-	/* Capture new scene */
-	p->screen.composite();
+	p->flushPresent();
 
-	/* The PP frontbuffer will hold the current scene after the
-	 * composition step. Since the backbuffer is unused during
-	 * the transition, we can reuse it as the target buffer for
-	 * the final rendered image. */
-	TEXFBO &currentScene = p->screen.getPP().frontBuffer();
-	TEXFBO &transBuffer  = p->screen.getPP().backBuffer();
+	/* Capture new scene */
+	p->ensureFrontBuffer();
 
-	/* If no transition bitmap is provided,
-	 * we can use a simplified shader */
-	TransShader &transShader = shState->shaders().trans;
-	SimpleTransShader &simpleShader = shState->shaders().simpleTrans;
+	p->trans.active = true;
+	p->trans.duration = duration;
+	p->trans.frame = 0;
+	p->trans.vague = vague / 256.0f;
+	p->trans.map = transMap;
 
-	if (transMap)
-	{
-		TransShader &shader = transShader;
-		shader.bind();
-		shader.applyViewportProj();
-		shader.setFrozenScene(p->frozenScene.tex);
-		shader.setCurrentScene(currentScene.tex);
-		shader.setTransMap(transMap->getGLTypes().tex);
-		shader.setVague(vague / 256.0f);
-		shader.setTexSize(p->scRes);
-	}
-	else
-	{
-		SimpleTransShader &shader = simpleShader;
-		shader.bind();
-		shader.applyViewportProj();
-		shader.setFrozenScene(p->frozenScene.tex);
-		shader.setCurrentScene(currentScene.tex);
-		shader.setTexSize(p->scRes);
-	}
-
-	glState.blend.pushSet(false);
+	/* Left to be stepped by update() */
+	if (async)
+		return;
 
-	for (int i = 0; i < duration; ++i)
+	while (true)
 	{
 		/* We need to clean up transMap properly before
 		 * a possible longjmp, so we manually test for
 		 * shutdown/reset here */
 		if (p->threadData->rqTerm)
 		{
-			glState.blend.pop();
-			delete transMap;
+			p->finishTransition();
 			p->shutdown();
 			return;
 		}
 
 		if (p->threadData->rqReset)
 		{
-			glState.blend.pop();
-			delete transMap;
+			p->finishTransition();
 			scriptBinding->reset();
 			return;
 		}
 
 		p->checkSyncLock();
 
-		const float prog = i * (1.0f / duration);
-
-		if (transMap)
-		{
-			transShader.bind();
-			transShader.setProg(prog);
-		}
-		else
-		{
-			simpleShader.bind();
-			simpleShader.setProg(prog);
-		}
-
-		/* Draw the composed frame to a buffer first
-		 * (we need this because we're skipping PingPong) */
-		FBO::bind(transBuffer.fbo);
-		FBO::clear();
-		p->screenQuad.draw();
-
-		p->checkResize();
-
-		/* Then blit it flipped and scaled to the screen */
-		FBO::unbind();
-		FBO::clear();
-
-		GLMeta::blitBeginScreen(Vec2i(p->winSize));
-		GLMeta::blitSource(transBuffer);
-		p->metaBlitBufferFlippedScaled();
-		GLMeta::blitEnd();
-
-		p->swapGLBuffer();
+		if (!p->stepTransition())
+			break;
 	}
+}
 
-	glState.blend.pop();
+void Graphics::frameReset()
+{
+	p->fpsLimiter.resetFrameAdjust();
+	p->frameTimer.reset();
+}
 
-	delete transMap;
+Graphics::FrameStats Graphics::frameStats() const
+{
+	FrameStats stats = p->frameTimer.stats();
+	stats.gpu = GPUTimer::frameAverage();
+	stats.skipped = p->skippedFrames;
 
-	p->frozen = false;
+	return stats;
 }
 
-void Graphics::frameReset()
+GLCallCounts Graphics::glCalls() const
 {
-	p->fpsLimiter.resetFrameAdjust();
+	return p->lastCallCounts;
 }
 
 static void guardDisposed() {}
@@ -838,12 +2003,14 @@ void Graphics::wait(int duration)
 	for (int i = 0; i < duration; ++i)
 	{
 		p->checkShutDownReset();
-		p->redrawScreen();
+		p->updateScreen();
 	}
 }
 
 void Graphics::fadeout(int duration)
 {
+	p->flushPresent();
+	p->finishTransition();
 	FBO::unbind();
 
 	float curr = p->brightness;
@@ -855,14 +2022,7 @@ void Graphics::fadeout(int duration)
 
 		if (p->frozen)
 		{
-			GLMeta::blitBeginScreen(p->scSize);
-			GLMeta::blitSource(p->frozenScene);
-
-			FBO::clear();
-			p->metaBlitBufferFlippedScaled();
-
-			GLMeta::blitEnd();
-
+			p->presentScaled(p->frozenScene);
 			p->swapGLBuffer();
 		}
 		else
@@ -874,6 +2034,8 @@ void Graphics::fadeout(int duration)
 
 void Graphics::fadein(int duration)
 {
+	p->flushPresent();
+	p->finishTransition();
 	FBO::unbind();
 
 	float curr = p->brightness;
@@ -885,14 +2047,7 @@ void Graphics::fadein(int duration)
 
 		if (p->frozen)
 		{
-			GLMeta::blitBeginScreen(p->scSize);
-			GLMeta::blitSource(p->frozenScene);
-
-			FBO::clear();
-			p->metaBlitBufferFlippedScaled();
-
-			GLMeta::blitEnd();
-
+			p->presentScaled(p->frozenScene);
 			p->swapGLBuffer();
 		}
 		else
@@ -902,8 +2057,38 @@ void Graphics::fadein(int duration)
 	}
 }
 
-Bitmap *Graphics::snapToBitmap()
+void Graphics::saveScreenshot(const char *filename)
+{
+	p->capture.requestScreenshot(filename);
+}
+
+void Graphics::startRecording(const char *filename)
 {
+	p->capture.startRecording(filename);
+}
+
+void Graphics::stopRecording()
+{
+	p->capture.stopRecording();
+}
+
+Bitmap *Graphics::snapToBitmap(bool shared)
+{
+	p->ensureFrontBuffer();
+
+	/* Snapshots of the same frame can share one texture,
+	 * which is only copied once a bitmap is modified */
+	char key[32];
+	snprintf(key, sizeof(key), "\1snapshot/%u", p->screen.frontBufferSerial());
+
+	if (shared)
+	{
+		Bitmap *bitmap = Bitmap::fromCache(key);
+
+		if (bitmap)
+			return bitmap;
+	}
+
 	Bitmap *bitmap = new Bitmap(width(), height());
 
 	p->compositeToBuffer(bitmap->getGLTypes());
@@ -911,6 +2096,9 @@ Bitmap *Graphics::snapToBitmap()
 	/* Taint entire bitmap */
 	bitmap->taintArea(IntRect(0, 0, width(), height()));
 
+	if (shared)
+		bitmap->shareAs(key);
+
 	return bitmap;
 }
 
@@ -938,7 +2126,8 @@ void Graphics::resizeScreen(int width, int height)
 
 	p->screen.setResolution(width, height);
 
-	TEXFBO::allocEmpty(p->frozenScene, width, height);
+	/* Grows along with the PingPong buffers */
+	TEXFBO::growEmpty(p->frozenScene, width, height);
 
 	FloatRect screenRect(0, 0, width, height);
 	p->screenQuad.setTexPosRect(screenRect, screenRect);
@@ -946,10 +2135,66 @@ void Graphics::resizeScreen(int width, int height)
 	shState->eThread().requestWindowResize(width, height);
 }
 
+#ifdef THEORA
+void Graphics::playMovie(const char *filename)
+{
+	p->flushPresent();
+	p->finishTransition();
+
+	MoviePlayer *movie;
+
+	try
+	{
+		movie = new MoviePlayer(filename);
+	}
+	catch (const Exception &e)
+	{
+		Debug() << "Graphics.playMovie:" << e.msg;
+		return;
+	}
+
+	/* Fit the picture into the game screen, keeping its aspect */
+	const IntRect sc(p->scOffset.x, p->scOffset.y, p->scSize.x, p->scSize.y);
+	const float scale = std::min((float) sc.w / movie->width(),
+	                             (float) sc.h / movie->height());
+	const int w = movie->width() * scale;
+	const int h = movie->height() * scale;
+	const int x = sc.x + (sc.w - w) / 2;
+	const int y = sc.y + (sc.h - h) / 2;
+
+	RGSSThreadData &td = *p->threadData;
+
+	/* Script termination and reset longjmp out of the binding,
+	 * so the flags are polled here and the player freed first */
+	while (!td.rqTerm && !td.rqReset && movie->update())
+	{
+		FBO::unbind();
+		glState.viewport.pushSet(IntRect(0, 0, p->winSize.x, p->winSize.y));
+
+		FBO::clear();
+
+		glState.blend.pushSet(false);
+		movie->draw(IntRect(x, h+y, w, -h));
+		glState.blend.pop();
+
+		glState.viewport.pop();
+
+		p->swapGLBuffer();
+	}
+
+	delete movie;
+
+	p->fpsLimiter.resetFrameAdjust();
+	Scene::markDirty();
+
+	p->checkShutDownReset();
+}
+#else
 void Graphics::playMovie(const char *filename)
 {
 	Debug() << "Graphics.playMovie(" << filename << ") not implemented";
 }
+#endif
 
 DEF_ATTR_RD_SIMPLE(Graphics, Brightness, int, p->brightness)
 
@@ -966,22 +2211,27 @@ void Graphics::setBrightness(int value)
 
 void Graphics::reset()
 {
-	/* Dispose all live Disposables */
-	IntruListLink<Disposable> *iter;
+	p->finishTransition();
+	p->transMaps.clear();
 
-	for (iter = p->dispList.begin();
-	     iter != p->dispList.end();
-	     iter = iter->next)
-	{
-		iter->data->dispose();
-	}
+	/* Dispose all live Disposables. Slots emptied along the
+	 * way (by Disposables owning others) simply read as null */
+	for (size_t i = 0; i < p->dispTable.capacity(); ++i)
+		if (Disposable *d = p->dispTable.at(i))
+			d->dispose();
 
-	p->dispList.clear();
+	/* The disposed objects may outlive this; their
+	 * now stale handles are ignored on destruction */
+	p->dispTable.clear();
+	p->flashTable.clear();
+	p->autoUpdateFlash = false;
 
 	/* Reset attributes (frame count not included) */
 	p->fpsLimiter.resetFrameAdjust();
 	p->frozen = false;
+	p->lastFrameDirect = false;
 	p->screen.getPP().clearBuffers();
+	p->screen.invalidateFrontBuffer();
 
 	setFrameRate(DEF_FRAMERATE);
 	setBrightness(255);
@@ -997,6 +2247,16 @@ void Graphics::setFullscreen(bool value)
 	p->threadData->ethread->requestFullscreenMode(value);
 }
 
+bool Graphics::getAutoUpdateFlash() const
+{
+	return p->autoUpdateFlash;
+}
+
+void Graphics::setAutoUpdateFlash(bool value)
+{
+	p->autoUpdateFlash = value;
+}
+
 bool Graphics::getShowCursor() const
 {
 	return p->threadData->ethread->getShowCursor();
@@ -1017,10 +2277,17 @@ void Graphics::repaintWait(const AtomicFlag &exitCond, bool checkReset)
 	if (exitCond)
 		return;
 
+	p->flushPresent();
+
+	/* The last frame never made it into the PingPong buffers */
+	if (p->lastFrameDirect)
+	{
+		p->screen.composite();
+		p->lastFrameDirect = false;
+	}
+
 	/* Repaint the screen with the last good frame we drew */
 	TEXFBO &lastFrame = p->screen.getPP().frontBuffer();
-	GLMeta::blitBeginScreen(p->winSize);
-	GLMeta::blitSource(lastFrame);
 
 	while (!exitCond)
 	{
@@ -1029,23 +2296,30 @@ void Graphics::repaintWait(const AtomicFlag &exitCond, bool checkReset)
 		if (checkReset)
 			shState->checkReset();
 
-		FBO::clear();
-		p->metaBlitBufferFlippedScaled();
-		SDL_GL_SwapWindow(p->threadData->window);
+		p->presentScaled(lastFrame);
+		p->swapWindow();
 		p->fpsLimiter.delay();
 
 		p->threadData->ethread->notifyFrame();
 	}
-
-	GLMeta::blitEnd();
 }
 
 void Graphics::addDisposable(Disposable *d)
 {
-	p->dispList.append(d->link);
+	d->handle = p->dispTable.insert(d);
 }
 
 void Graphics::remDisposable(Disposable *d)
 {
-	p->dispList.remove(d->link);
+	p->dispTable.remove(d->handle);
+}
+
+void Graphics::addFlashable(Flashable *f)
+{
+	f->autoHandle = p->flashTable.insert(f);
+}
+
+void Graphics::remFlashable(Flashable *f)
+{
+	p->flashTable.remove(f->autoHandle);
 }
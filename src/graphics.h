@@ -27,18 +27,24 @@
 class Scene;
 class Bitmap;
 class Disposable;
+class Flashable;
 struct RGSSThreadData;
 struct GraphicsPrivate;
 struct AtomicFlag;
+struct GLCallCounts;
 
 class Graphics
 {
 public:
 	void update();
 	void freeze();
+	/* With 'async', returns right away; the transition is
+	 * then shown frame by frame by the following update()
+	 * calls, while scripts go on preparing the new scene */
 	void transition(int duration = 8,
 	                const char *filename = "",
-	                int vague = 40);
+	                int vague = 40,
+	                bool async = false);
 	void frameReset();
 
 	DECL_ATTR( FrameRate,  int )
@@ -49,7 +55,17 @@ public:
 	void fadeout(int duration);
 	void fadein(int duration);
 
-	Bitmap *snapToBitmap();
+	/* With 'shared', snapshots of an unchanged screen share
+	 * their texture until modified (copy on write) */
+	Bitmap *snapToBitmap(bool shared = false);
+
+	/* Saves the next drawn frame to a PNG file, without
+	 * waiting for it to be read back and encoded */
+	void saveScreenshot(const char *filename);
+
+	/* Appends every drawn frame to a raw RGBA video file */
+	void startRecording(const char *filename);
+	void stopRecording();
 
 	int width() const;
 	int height() const;
@@ -62,6 +78,32 @@ public:
 	DECL_ATTR( Fullscreen, bool )
 	DECL_ATTR( ShowCursor, bool )
 
+	/* When set, every update() advances the flash (and sprite
+	 * wave) state of all live sprites and viewports, and their
+	 * own update methods become no-ops for scripts */
+	DECL_ATTR( AutoUpdateFlash, bool )
+
+	/* Intervals between the most recent frames, in ms */
+	struct FrameStats
+	{
+		double min;
+		double avg;
+		double p99;
+		int count;
+
+		/* Average GPU time per frame, or -1 if not
+		 * measured (see the 'profiler' option) */
+		double gpu;
+
+		/* Frames skipped to catch up since startup */
+		int skipped;
+	};
+
+	FrameStats frameStats() const;
+
+	/* State changes and draws of the last frame */
+	GLCallCounts glCalls() const;
+
 	/* <internal> */
 	Scene *getScreen() const;
 	/* Repaint screen with static image until exitCond
@@ -70,6 +112,10 @@ public:
 	void repaintWait(const AtomicFlag &exitCond,
 	                 bool checkReset = true);
 
+	/* Called by elements for the lifetime of their resources */
+	void addFlashable(Flashable *);
+	void remFlashable(Flashable *);
+
 private:
 	Graphics(RGSSThreadData *data);
 	~Graphics();
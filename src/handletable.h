@@ -0,0 +1,147 @@
+/*
+** handletable.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef HANDLETABLE_H
+#define HANDLETABLE_H
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+struct Handle
+{
+	uint32_t index;
+	uint32_t generation;
+
+	Handle()
+	    : index(0),
+	      generation(0)
+	{}
+};
+
+/* Dense table of object pointers addressed by generational
+ * handles. Freed slots are recycled, and their generation is
+ * bumped so that stale handles are recognized as such (and
+ * ones that were handed out before a 'clear()' are ignored).
+ * Generation 0 is never valid */
+template<typename T>
+class HandleTable
+{
+	struct Slot
+	{
+		T *object;
+		uint32_t generation;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+	size_t count;
+
+public:
+	HandleTable()
+	    : count(0)
+	{}
+
+	Handle insert(T *object)
+	{
+		Handle h;
+
+		if (freeSlots.empty())
+		{
+			Slot slot = { object, 1 };
+			h.index = slots.size();
+			slots.push_back(slot);
+		}
+		else
+		{
+			h.index = freeSlots.back();
+			freeSlots.pop_back();
+			slots[h.index].object = object;
+		}
+
+		h.generation = slots[h.index].generation;
+		++count;
+
+		return h;
+	}
+
+	void remove(Handle h)
+	{
+		if (!isValid(h))
+			return;
+
+		release(h.index);
+	}
+
+	T *get(Handle h) const
+	{
+		return isValid(h) ? slots[h.index].object : 0;
+	}
+
+	bool isValid(Handle h) const
+	{
+		return h.index < slots.size()
+		    && slots[h.index].generation == h.generation
+		    && slots[h.index].object;
+	}
+
+	/* For iteration; unoccupied slots yield null.
+	 * Removing entries doesn't move any others */
+	size_t capacity() const
+	{
+		return slots.size();
+	}
+
+	T *at(size_t index) const
+	{
+		return slots[index].object;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	/* Invalidates every outstanding handle */
+	void clear()
+	{
+		for (size_t i = 0; i < slots.size(); ++i)
+			if (slots[i].object)
+				release(i);
+	}
+
+private:
+	void release(size_t index)
+	{
+		slots[index].object = 0;
+		++slots[index].generation;
+
+		/* Once wrapped around, retire the slot for good
+		 * rather than risk handing out a stale handle */
+		if (slots[index].generation != 0)
+			freeSlots.push_back(index);
+
+		--count;
+	}
+};
+
+#endif // HANDLETABLE_H
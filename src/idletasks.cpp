@@ -0,0 +1,143 @@
+/*
+** idletasks.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "idletasks.h"
+
+#include <SDL_timer.h>
+
+#include <algorithm>
+#include <vector>
+
+/* Slack shorter than this isn't handed out */
+#define MIN_SLICE_US 100
+
+struct IdleTask
+{
+	IdleTasks::Func func;
+	void *data;
+
+	/* How far the task recently ran past the time it was
+	 * offered, decaying over time. Held back from later
+	 * offers to keep it from overrunning again */
+	int overrunUs;
+};
+
+static std::vector<IdleTask> tasks;
+
+/* Rotates through the tasks, so that one that
+ * always takes all the slack can't starve others */
+static size_t nextTask = 0;
+
+static int findTask(IdleTasks::Func func, void *data)
+{
+	for (size_t i = 0; i < tasks.size(); ++i)
+		if (tasks[i].func == func && tasks[i].data == data)
+			return i;
+
+	return -1;
+}
+
+static int elapsedUs(uint64_t since)
+{
+	return (SDL_GetPerformanceCounter() - since)
+	       * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+void IdleTasks::add(Func func, void *data)
+{
+	if (findTask(func, data) >= 0)
+		return;
+
+	IdleTask task;
+	task.func = func;
+	task.data = data;
+	task.overrunUs = 0;
+
+	tasks.push_back(task);
+}
+
+void IdleTasks::remove(Func func, void *data)
+{
+	int i = findTask(func, data);
+
+	if (i < 0)
+		return;
+
+	tasks.erase(tasks.begin() + i);
+
+	if (nextTask > (size_t) i)
+		--nextTask;
+}
+
+bool IdleTasks::pending()
+{
+	return !tasks.empty();
+}
+
+int IdleTasks::run(int usecs)
+{
+	const uint64_t start = SDL_GetPerformanceCounter();
+
+	/* Each task gets at most one turn per frame */
+	size_t turns = tasks.size();
+
+	while (turns-- > 0 && !tasks.empty())
+	{
+		const int left = usecs - elapsedUs(start);
+
+		if (left < MIN_SLICE_US)
+			break;
+
+		if (nextTask >= tasks.size())
+			nextTask = 0;
+
+		const size_t i = nextTask++;
+		const int offer = left - tasks[i].overrunUs;
+
+		/* Not enough left for this one; maybe next frame */
+		if (offer < MIN_SLICE_US)
+			continue;
+
+		/* Copied, as the task may add or remove tasks */
+		const IdleTask task = tasks[i];
+
+		const uint64_t taskStart = SDL_GetPerformanceCounter();
+		const bool done = task.func(task.data, offer);
+		const int overrun = elapsedUs(taskStart) - offer;
+
+		const int at = findTask(task.func, task.data);
+
+		if (at < 0)
+			continue;
+
+		if (done)
+		{
+			remove(task.func, task.data);
+			continue;
+		}
+
+		IdleTask &kept = tasks[at];
+		kept.overrunUs = std::max(overrun, kept.overrunUs * 7 / 8);
+	}
+
+	return std::max(0, usecs - elapsedUs(start));
+}
@@ -0,0 +1,52 @@
+/*
+** idletasks.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IDLETASKS_H
+#define IDLETASKS_H
+
+/* Housekeeping for the RGSS (GL) thread that is run in the
+ * time left until a frame's deadline (see FPSLimiter::delay),
+ * instead of sleeping through it. Tasks are offered the time
+ * they may take, and are called again at the following frames
+ * until they report being done. Time a task overran its offer
+ * by is held back from its following offers, and tasks that
+ * wouldn't get enough are put off to a later frame, so that
+ * they don't push frames past their deadline. RGSS thread only */
+class IdleTasks
+{
+public:
+	/* Should return within 'usecs'. Returns
+	 * true once there's nothing left to do */
+	typedef bool (*Func)(void *data, int usecs);
+
+	/* Does nothing if the task is queued already */
+	static void add(Func func, void *data);
+	static void remove(Func func, void *data);
+
+	static bool pending();
+
+	/* Runs the queued tasks for at most 'usecs',
+	 * returning how much of that was left unused */
+	static int run(int usecs);
+};
+
+#endif // IDLETASKS_H
@@ -25,15 +25,18 @@
 #include "keybindings.h"
 #include "exception.h"
 #include "util.h"
+#include "inputreplay.h"
 
 #include <SDL_scancode.h>
 #include <SDL_mouse.h>
+#include <SDL_timer.h>
 
 #include <vector>
+#include <algorithm>
 #include <string.h>
 #include <assert.h>
 
-#define BUTTON_CODE_COUNT 24
+#define BUTTON_CODE_COUNT 25
 
 struct ButtonState
 {
@@ -41,167 +44,118 @@ struct ButtonState
 	bool triggered;
 	bool repeated;
 
+	/* SDL_GetTicks() time the current press began */
+	uint32_t pressTime;
+
 	ButtonState()
 		: pressed(false),
 		  triggered(false),
-		  repeated(false)
+		  repeated(false),
+		  pressTime(0)
 	{}
 };
 
-struct KbBindingData
+/* Filled from the event queue on each Input.update. A press that
+ * came in since the previous update counts even if the button
+ * was already released again, so taps shorter than a frame
+ * aren't lost. Press times come from the event timestamps */
+static struct
 {
-	SDL_Scancode source;
-	Input::ButtonCode target;
-};
+	bool keys[SDL_NUM_SCANCODES];
+	bool mouse[32];
+	bool joy[256];
+} sourceTaps;
 
-struct Binding
+static struct
 {
-	Binding(Input::ButtonCode target = Input::None)
-		: target(target)
-	{}
-
-	virtual bool sourceActive() const = 0;
-	virtual bool sourceRepeatable() const = 0;
+	uint32_t keys[SDL_NUM_SCANCODES];
+	uint32_t mouse[32];
+	uint32_t joy[256];
+} sourcePressTimes;
 
+struct KbBindingData
+{
+	SDL_Scancode source;
 	Input::ButtonCode target;
 };
 
+/* Bindings are compiled into flat per-source tables whenever
+ * they change, so that polling them is a handful of plain loops.
+ * Entries with an Input::None target are never compiled in */
+
 /* Keyboard binding */
-struct KbBinding : public Binding
+struct KbBinding
 {
-	KbBinding() {}
-
-	KbBinding(const KbBindingData &data)
-		: Binding(data.target),
-		  source(data.source)
-	{}
-
-	bool sourceActive() const
-	{
-		/* Special case aliases */
-		if (source == SDL_SCANCODE_LSHIFT)
-			return EventThread::keyStates[source]
-			    || EventThread::keyStates[SDL_SCANCODE_RSHIFT];
-
-		if (source == SDL_SCANCODE_RETURN)
-			return EventThread::keyStates[source]
-			    || EventThread::keyStates[SDL_SCANCODE_KP_ENTER];
-
-		return EventThread::keyStates[source];
-	}
+	SDL_Scancode source;
 
-	bool sourceRepeatable() const
-	{
-		return (source >= SDL_SCANCODE_A     && source <= SDL_SCANCODE_0)    ||
-		       (source >= SDL_SCANCODE_RIGHT && source <= SDL_SCANCODE_UP)   ||
-		       (source >= SDL_SCANCODE_F1    && source <= SDL_SCANCODE_F12);
-	}
+	/* Second key counting as the same source, if any
+	 * (eg. RSHIFT for LSHIFT), otherwise SDL_SCANCODE_UNKNOWN */
+	SDL_Scancode alias;
 
-	SDL_Scancode source;
+	Input::ButtonCode target;
+	bool repeatable;
 };
 
 /* Joystick button binding */
-struct JsButtonBinding : public Binding
+struct JsButtonBinding
 {
-	JsButtonBinding() {}
-
-	bool sourceActive() const
-	{
-		return EventThread::joyState.buttons[source];
-	}
-
-	bool sourceRepeatable() const
-	{
-		return true;
-	}
-
 	uint8_t source;
+	Input::ButtonCode target;
 };
 
 /* Joystick axis binding */
-struct JsAxisBinding : public Binding
+struct JsAxisBinding
 {
-	JsAxisBinding() {}
-
-	JsAxisBinding(uint8_t source,
-	              AxisDir dir,
-	              Input::ButtonCode target)
-	    : Binding(target),
-	      source(source),
-	      dir(dir)
-	{}
-
-	bool sourceActive() const
-	{
-		int val = EventThread::joyState.axes[source];
-
-		if (dir == Negative)
-			return val < -JAXIS_THRESHOLD;
-		else /* dir == Positive */
-			return val > JAXIS_THRESHOLD;
-	}
+	uint8_t source;
 
-	bool sourceRepeatable() const
-	{
-		return true;
-	}
+	/* -1 for the negative, 1 for the positive direction */
+	int sign;
 
-	uint8_t source;
-	AxisDir dir;
+	Input::ButtonCode target;
 };
 
 /* Joystick hat binding */
-struct JsHatBinding : public Binding
+struct JsHatBinding
 {
-	JsHatBinding() {}
-
-	JsHatBinding(uint8_t source,
-	              uint8_t pos,
-	              Input::ButtonCode target)
-	    : Binding(target),
-	      source(source),
-	      pos(pos)
-	{}
-
-	bool sourceActive() const
-	{
-		/* For a diagonal input accept it as an input for both the axes */
-		return (pos & EventThread::joyState.hats[source]) != 0;
-	}
-
-	bool sourceRepeatable() const
-	{
-		return true;
-	}
-
 	uint8_t source;
 	uint8_t pos;
+	Input::ButtonCode target;
 };
 
 /* Mouse button binding */
-struct MsBinding : public Binding
+struct MsBinding
 {
-	MsBinding() {}
-
-	MsBinding(int buttonIndex,
-	          Input::ButtonCode target)
-	    : Binding(target),
-	      index(buttonIndex)
-	{}
-
-	bool sourceActive() const
-	{
-		return EventThread::mouseState.buttons[index];
-	}
-
-	bool sourceRepeatable() const
-	{
-		return false;
-	}
-
 	int index;
+	Input::ButtonCode target;
 };
 
+static KbBinding compileKbBinding(SDL_Scancode source, Input::ButtonCode target)
+{
+	KbBinding bind;
+	bind.source = source;
+	bind.target = target;
+
+	/* Special case aliases */
+	if (source == SDL_SCANCODE_LSHIFT)
+		bind.alias = SDL_SCANCODE_RSHIFT;
+	else if (source == SDL_SCANCODE_RETURN)
+		bind.alias = SDL_SCANCODE_KP_ENTER;
+	else
+		bind.alias = SDL_SCANCODE_UNKNOWN;
+
+	bind.repeatable =
+	       (source >= SDL_SCANCODE_A     && source <= SDL_SCANCODE_0)    ||
+	       (source >= SDL_SCANCODE_RIGHT && source <= SDL_SCANCODE_UP)   ||
+	       (source >= SDL_SCANCODE_F1    && source <= SDL_SCANCODE_F12);
+
+	return bind;
+}
+
+static inline bool keyActive(SDL_Scancode code)
+{
+	return EventThread::keyStates[code] || sourceTaps.keys[code];
+}
+
 /* Not rebindable */
 static const KbBindingData staticKbBindings[] =
 {
@@ -233,7 +187,8 @@ static const int mapToIndex[] =
 	0,
 	16, 17, 18, 19, 20,
 	0, 0, 0, 0, 0, 0, 0, 0,
-	21, 22, 23
+	21, 22, 23,
+	24
 };
 
 static elementsN(mapToIndex);
@@ -273,9 +228,6 @@ struct InputPrivate
 	std::vector<JsButtonBinding> jsBBindings;
 	std::vector<MsBinding> msBindings;
 
-	/* Collective binding array */
-	std::vector<Binding*> bindings;
-
 	ButtonState stateArray[BUTTON_CODE_COUNT*2];
 
 	ButtonState *states;
@@ -295,8 +247,17 @@ struct InputPrivate
 		int active;
 	} dir8Data;
 
+	/* SDL_GetTicks() time of the last update */
+	uint32_t updateTime;
+
+	InputReplay replay;
+
+	/* Presses of the update in progress, while recording */
+	InputReplay::Presses presses;
+
 
 	InputPrivate(const RGSSThreadData &rtData)
+	    : replay(rtData.config)
 	{
 		initStaticKbBindings();
 		initMsBindings();
@@ -319,6 +280,8 @@ struct InputPrivate
 		dir4Data.previous = Input::None;
 
 		dir8Data.active = 0;
+
+		updateTime = 0;
 	}
 
 	inline ButtonState &getStateCheck(int code)
@@ -356,6 +319,54 @@ struct InputPrivate
 		memset(states, 0, size);
 	}
 
+	void drainEvents()
+	{
+		InputEvent event;
+
+		while (EventThread::inputEvents.pop(event))
+		{
+			if (!event.down)
+				continue;
+
+			switch (event.source)
+			{
+			case InputEvent::Key :
+				sourceTaps.keys[event.code] = true;
+				sourcePressTimes.keys[event.code] = event.timestamp;
+				break;
+			case InputEvent::MouseButton :
+				sourceTaps.mouse[event.code] = true;
+				sourcePressTimes.mouse[event.code] = event.timestamp;
+				break;
+			case InputEvent::JoyButton :
+				sourceTaps.joy[event.code] = true;
+				sourcePressTimes.joy[event.code] = event.timestamp;
+				break;
+			}
+		}
+	}
+
+	void clearTaps()
+	{
+		memset(&sourceTaps, 0, sizeof(sourceTaps));
+	}
+
+	/* Presses from sources without events (axes, hats)
+	 * are dated to the update that first saw them */
+	void updatePressTimes()
+	{
+		for (size_t i = 1; i < BUTTON_CODE_COUNT; ++i)
+		{
+			ButtonState &state = states[i];
+
+			if (!state.pressed || state.pressTime)
+				continue;
+
+			const ButtonState &old = statesOld[i];
+			state.pressTime = old.pressed && old.pressTime ? old.pressTime : updateTime;
+		}
+	}
+
 	void checkBindingChange(const RGSSThreadData &rtData)
 	{
 		BDescVec d;
@@ -366,13 +377,6 @@ struct InputPrivate
 		applyBindingDesc(d);
 	}
 
-	template<class B>
-	void appendBindings(std::vector<B> &bind)
-	{
-		for (size_t i = 0; i < bind.size(); ++i)
-			bindings.push_back(&bind[i]);
-	}
-
 	void applyBindingDesc(const BDescVec &d)
 	{
 		kbBindings.clear();
@@ -394,10 +398,7 @@ struct InputPrivate
 				break;
 			case Key :
 			{
-				KbBinding bind;
-				bind.source = src.d.scan;
-				bind.target = desc.target;
-				kbBindings.push_back(bind);
+				kbBindings.push_back(compileKbBinding(src.d.scan, desc.target));
 
 				break;
 			}
@@ -405,7 +406,7 @@ struct InputPrivate
 			{
 				JsAxisBinding bind;
 				bind.source = src.d.ja.axis;
-				bind.dir = src.d.ja.dir;
+				bind.sign = src.d.ja.dir == Negative ? -1 : 1;
 				bind.target = desc.target;
 				jsABindings.push_back(bind);
 
@@ -434,16 +435,6 @@ struct InputPrivate
 				assert(!"unreachable");
 			}
 		}
-
-		bindings.clear();
-
-		appendBindings(kbStatBindings);
-		appendBindings(msBindings);
-
-		appendBindings(kbBindings);
-		appendBindings(jsABindings);
-		appendBindings(jsHBindings);
-		appendBindings(jsBBindings);
 	}
 
 	void initStaticKbBindings()
@@ -451,42 +442,123 @@ struct InputPrivate
 		kbStatBindings.clear();
 
 		for (size_t i = 0; i < staticKbBindingsN; ++i)
-			kbStatBindings.push_back(KbBinding(staticKbBindings[i]));
+			kbStatBindings.push_back(compileKbBinding(staticKbBindings[i].source,
+			                                          staticKbBindings[i].target));
 	}
 
 	void initMsBindings()
 	{
-		msBindings.resize(3);
+		static const MsBinding buttons[] =
+		{
+			{ SDL_BUTTON_LEFT,   Input::MouseLeft   },
+			{ SDL_BUTTON_MIDDLE, Input::MouseMiddle },
+			{ SDL_BUTTON_RIGHT,  Input::MouseRight  }
+		};
 
-		size_t i = 0;
-		msBindings[i++] = MsBinding(SDL_BUTTON_LEFT,   Input::MouseLeft);
-		msBindings[i++] = MsBinding(SDL_BUTTON_MIDDLE, Input::MouseMiddle);
-		msBindings[i++] = MsBinding(SDL_BUTTON_RIGHT,  Input::MouseRight);
+		msBindings.assign(buttons, buttons + 3);
 	}
 
+	void pollKbBindings(const std::vector<KbBinding> &bind,
+	                    Input::ButtonCode &repeatCand)
+	{
+		for (size_t i = 0; i < bind.size(); ++i)
+		{
+			const KbBinding &b = bind[i];
+			uint32_t time = sourcePressTimes.keys[b.source];
+			bool active = keyActive(b.source);
+
+			if (b.alias != SDL_SCANCODE_UNKNOWN)
+			{
+				active = active || keyActive(b.alias);
+				time = std::max(time, sourcePressTimes.keys[b.alias]);
+			}
+
+			if (active)
+				pressTarget(b.target, time, b.repeatable, repeatCand);
+		}
+	}
+
+	/* The tables are polled in a fixed order, which decides
+	 * which of several newly pressed sources starts repeating */
 	void pollBindings(Input::ButtonCode &repeatCand)
 	{
-		for (size_t i = 0; i < bindings.size(); ++i)
-			pollBindingPriv(*bindings[i], repeatCand);
+		const EventThread::JoyState &joy = EventThread::joyState;
+
+		pollKbBindings(kbStatBindings, repeatCand);
+
+		for (size_t i = 0; i < msBindings.size(); ++i)
+		{
+			const MsBinding &b = msBindings[i];
+
+			if (EventThread::mouseState.buttons[b.index] || sourceTaps.mouse[b.index])
+				pressTarget(b.target, sourcePressTimes.mouse[b.index],
+				            false, repeatCand);
+		}
+
+		pollKbBindings(kbBindings, repeatCand);
+
+		for (size_t i = 0; i < jsABindings.size(); ++i)
+		{
+			const JsAxisBinding &b = jsABindings[i];
+
+			if (joy.axes[b.source] * b.sign > JAXIS_THRESHOLD)
+				pressTarget(b.target, 0, true, repeatCand);
+		}
+
+		/* For a diagonal input accept it as an input for both the axes */
+		for (size_t i = 0; i < jsHBindings.size(); ++i)
+		{
+			const JsHatBinding &b = jsHBindings[i];
+
+			if (b.pos & joy.hats[b.source])
+				pressTarget(b.target, 0, true, repeatCand);
+		}
+
+		for (size_t i = 0; i < jsBBindings.size(); ++i)
+		{
+			const JsButtonBinding &b = jsBBindings[i];
+
+			if (joy.buttons[b.source] || sourceTaps.joy[b.source])
+				pressTarget(b.target, sourcePressTimes.joy[b.source],
+				            true, repeatCand);
+		}
 
 		updateDir4();
 		updateDir8();
 	}
 
-	void pollBindingPriv(const Binding &b,
-	                     Input::ButtonCode &repeatCand)
-	{	
-		if (!b.sourceActive())
-			return;
+	/* Presses the buttons recorded for this update in the same
+	 * order as pollBindings() did, so repeats match too */
+	void playBindings(Input::ButtonCode &repeatCand)
+	{
+		replay.playFrame(presses);
 
-		if (b.target == Input::None)
-			return;
+		for (size_t i = 0; i < presses.size(); ++i)
+			pressTarget((Input::ButtonCode) (presses[i] & 0x7F), 0,
+			            presses[i] & 0x80, repeatCand);
+
+		updateDir4();
+		updateDir8();
+	}
 
-		ButtonState &state = getState(b.target);
-		ButtonState &oldState = getOldState(b.target);
+	/* 'pressTime' is the time of the press event,
+	 * or 0 for sources without events */
+	void pressTarget(Input::ButtonCode target, uint32_t pressTime,
+	                 bool repeatable, Input::ButtonCode &repeatCand)
+	{
+		ButtonState &state = getState(target);
+		ButtonState &oldState = getOldState(target);
 
 		state.pressed = true;
 
+		if (replay.mode() == InputReplay::Record)
+			presses.push_back(target | (repeatable ? 0x80 : 0));
+
+		/* Of several active sources, the earliest press counts */
+
+		if (pressTime && (!state.pressTime || pressTime < state.pressTime))
+			state.pressTime = pressTime;
+
 		/* Must have been released before to trigger */
 		if (!oldState.pressed)
 			state.triggered = true;
@@ -495,11 +567,11 @@ struct InputPrivate
 		if (repeatCand != Input::None)
 			return;
 
-		if (repeating != b.target &&
+		if (repeating != target &&
 			!oldState.pressed)
 		{
-			if (b.sourceRepeatable())
-				repeatCand = b.target;
+			if (repeatable)
+				repeatCand = target;
 			else
 				/* Unrepeatable keys still break current repeat */
 				repeating = Input::None;
@@ -599,13 +671,31 @@ void Input::update()
 	shState->checkShutdown();
 	p->checkBindingChange(shState->rtData());
 
+	p->drainEvents();
+	p->updateTime = SDL_GetTicks();
+
 	p->swapBuffers();
 	p->clearBuffer();
 
 	ButtonCode repeatCand = None;
 
 	/* Poll all bindings */
-	p->pollBindings(repeatCand);
+	switch (p->replay.mode())
+	{
+	case InputReplay::Play :
+		p->playBindings(repeatCand);
+		break;
+	case InputReplay::Record :
+		p->presses.clear();
+		p->pollBindings(repeatCand);
+		p->replay.recordFrame(p->presses);
+		break;
+	default :
+		p->pollBindings(repeatCand);
+	}
+
+	p->updatePressTimes();
+	p->clearTaps();
 
 	/* Check for new repeating key */
 	if (repeatCand != None && repeatCand != p->repeating)
@@ -651,6 +741,20 @@ bool Input::isRepeated(int button)
 	return p->getStateCheck(button).repeated;
 }
 
+float Input::pressTime(int button)
+{
+	const ButtonState &state = p->getStateCheck(button);
+
+	if (!state.pressed || !state.pressTime)
+		return 0;
+
+	/* The press may have been timestamped just after the update */
+	if (state.pressTime > p->updateTime)
+		return 0;
+
+	return (p->updateTime - state.pressTime) / 1000.0f;
+}
+
 int Input::dir4Value()
 {
 	return p->dir4Data.active;
@@ -661,6 +765,36 @@ int Input::dir8Value()
 	return p->dir8Data.active;
 }
 
+uint32_t Input::randomSeed()
+{
+	return p->replay.seed();
+}
+
+void Input::snapshot(Snapshot &out)
+{
+	out.pressed = out.triggered = out.repeated = 0;
+
+	for (size_t code = 1; code < mapToIndexN; ++code)
+	{
+		/* Codes without a state share the dummy slot */
+		if (mapToIndex[code] == 0)
+			continue;
+
+		const ButtonState &state = p->states[mapToIndex[code]];
+		const uint64_t bit = (uint64_t) 1 << code;
+
+		if (state.pressed)
+			out.pressed |= bit;
+		if (state.triggered)
+			out.triggered |= bit;
+		if (state.repeated)
+			out.repeated |= bit;
+	}
+
+	out.dir4 = p->dir4Data.active;
+	out.dir8 = p->dir8Data.active;
+}
+
 int Input::mouseX()
 {
 	RGSSThreadData &rtData = shState->rtData();
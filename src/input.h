@@ -22,6 +22,8 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdint.h>
+
 struct InputPrivate;
 struct RGSSThreadData;
 
@@ -43,7 +45,10 @@ public:
 		F5 = 25, F6 = 26, F7 = 27, F8 = 28, F9 = 29,
 
 		/* Non-standard extensions */
-		MouseLeft = 38, MouseMiddle = 39, MouseRight = 40
+		MouseLeft = 38, MouseMiddle = 39, MouseRight = 40,
+
+		/* Held to fast forward (see the fastForwardSpeed config option) */
+		FastForward = 41
 	};
 
 	void update();
@@ -55,6 +60,28 @@ public:
 	int dir4Value();
 	int dir8Value();
 
+	/* Seconds between the press of 'button' and the last
+	 * update, as timestamped by the event thread; 0 if the
+	 * button isn't pressed */
+	float pressTime(int button);
+
+	/* The state of every button for the current frame,
+	 * with bit n corresponding to button code n */
+	struct Snapshot
+	{
+		uint64_t pressed;
+		uint64_t triggered;
+		uint64_t repeated;
+		int dir4;
+		int dir8;
+	};
+
+	void snapshot(Snapshot &out);
+
+	/* Seed the script RNG is initialized with, so an input
+	 * recording plays back the same; 0 if not recording */
+	uint32_t randomSeed();
+
 	/* Non-standard extensions */
 	int mouseX();
 	int mouseY();
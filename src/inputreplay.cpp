@@ -0,0 +1,238 @@
+/*
+** inputreplay.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inputreplay.h"
+
+#include "config.h"
+#include "profiler.h"
+#include "memstats.h"
+#include "sharedstate.h"
+#include "eventthread.h"
+#include "debugwriter.h"
+
+#include <SDL_timer.h>
+
+#include <algorithm>
+#include <string.h>
+
+static const char replayMagic[8] = { 'M', 'K', 'X', 'P', 'R', 'E', 'C', '1' };
+
+InputReplay::InputReplay(const Config &conf)
+    : m(Off),
+      file(0),
+      rngSeed(0),
+      conf(conf),
+      framesPlayed(0)
+{
+	if (!conf.inputReplay.empty())
+	{
+		file = fopen(conf.inputReplay.c_str(), "rb");
+
+		char magic[sizeof(replayMagic)];
+
+		if (!file
+		||  fread(magic, sizeof(magic), 1, file) != 1
+		||  memcmp(magic, replayMagic, sizeof(magic))
+		||  fread(&rngSeed, sizeof(rngSeed), 1, file) != 1)
+		{
+			Debug() << "Unable to read input recording:" << conf.inputReplay;
+
+			if (file)
+				fclose(file);
+
+			file = 0;
+			rngSeed = 0;
+
+			return;
+		}
+
+		m = Play;
+		timings.resize(Profiler::SectionCount);
+
+		return;
+	}
+
+	if (!conf.inputRecord.empty())
+	{
+		file = fopen(conf.inputRecord.c_str(), "wb");
+
+		if (!file)
+		{
+			Debug() << "Unable to write input recording:" << conf.inputRecord;
+			return;
+		}
+
+		rngSeed = conf.randomSeed ? conf.randomSeed : SDL_GetTicks() | 1;
+
+		fwrite(replayMagic, sizeof(replayMagic), 1, file);
+		fwrite(&rngSeed, sizeof(rngSeed), 1, file);
+
+		m = Record;
+	}
+}
+
+InputReplay::~InputReplay()
+{
+	if (file)
+		fclose(file);
+}
+
+InputReplay::Mode InputReplay::mode() const
+{
+	return m;
+}
+
+uint32_t InputReplay::seed() const
+{
+	return rngSeed;
+}
+
+void InputReplay::recordFrame(const Presses &presses)
+{
+	/* More presses than buttons only happen with several
+	 * sources bound to the same ones; drop the excess */
+	uint8_t count = std::min<size_t>(presses.size(), 0xFF);
+
+	fwrite(&count, 1, 1, file);
+
+	if (count > 0)
+		fwrite(&presses[0], 1, count, file);
+}
+
+bool InputReplay::playFrame(Presses &presses)
+{
+	presses.clear();
+
+	if (m != Play)
+		return false;
+
+	/* Timings of the frame that just ended */
+	if (framesPlayed > 0)
+	{
+		float last[Profiler::SectionCount];
+		Profiler::averages(last, 1);
+
+		for (int i = 0; i < Profiler::SectionCount; ++i)
+			timings[i].push_back(last[i]);
+	}
+
+	uint8_t count;
+
+	if ((conf.replayFrames > 0 && framesPlayed >= conf.replayFrames)
+	||  fread(&count, 1, 1, file) != 1)
+	{
+		finish();
+		return false;
+	}
+
+	presses.resize(count);
+
+	if (count > 0 && fread(&presses[0], 1, count, file) != count)
+	{
+		presses.clear();
+		finish();
+
+		return false;
+	}
+
+	++framesPlayed;
+
+	return true;
+}
+
+void InputReplay::finish()
+{
+	writeReport();
+
+	fclose(file);
+	file = 0;
+	m = Off;
+
+	shState->rtData().ethread->requestTerminate();
+}
+
+static float percentile(std::vector<float> &values, float p)
+{
+	if (values.empty())
+		return 0;
+
+	size_t index = std::min<size_t>(values.size() * p, values.size() - 1);
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+
+	return values[index];
+}
+
+void InputReplay::writeReport()
+{
+	const char *filename = conf.replayReport.c_str();
+	FILE *f = fopen(filename, "w");
+
+	if (!f)
+	{
+		Debug() << "Unable to write replay report:" << filename;
+		return;
+	}
+
+	const size_t frames = timings.empty() ? 0 : timings[0].size();
+
+	fprintf(f, "{\n\t\"frames\": %d,\n\t\"unit\": \"ms\",\n\t\"sections\": {\n",
+	        (int) frames);
+
+	for (int i = 0; i < Profiler::SectionCount; ++i)
+	{
+		std::vector<float> &values = timings[i];
+		double sum = 0;
+		float max = 0;
+
+		for (size_t j = 0; j < values.size(); ++j)
+		{
+			sum += values[j];
+			max = std::max(max, values[j]);
+		}
+
+		float avg = frames ? sum / frames : 0;
+		float p50 = percentile(values, 0.50f);
+		float p95 = percentile(values, 0.95f);
+
+		fprintf(f, "\t\t\"%s\": { \"avg\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f }%s\n",
+		        Profiler::sectionName(i), avg, p50, p95, max,
+		        i + 1 < Profiler::SectionCount ? "," : "");
+	}
+
+	fprintf(f, "\t},\n\t\"memory\": {\n");
+
+	for (int i = 0; i < MemStats::SubsystemCount; ++i)
+	{
+		MemStats::Subsystem s = (MemStats::Subsystem) i;
+
+		fprintf(f, "\t\t\"%s\": { \"current\": %lld, \"peak\": %lld }%s\n",
+		        MemStats::name(i), (long long) MemStats::current(s),
+		        (long long) MemStats::peak(s),
+		        i + 1 < MemStats::SubsystemCount ? "," : "");
+	}
+
+	fprintf(f, "\t}\n}\n");
+
+	if (fclose(f) != 0)
+		Debug() << "Unable to write replay report:" << filename;
+	else
+		Debug() << "Wrote replay report:" << filename;
+}
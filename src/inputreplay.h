@@ -0,0 +1,84 @@
+/*
+** inputreplay.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INPUTREPLAY_H
+#define INPUTREPLAY_H
+
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+struct Config;
+
+/* Records the button presses of every Input.update to the file
+ * set via 'inputRecord', or plays them back from 'inputReplay'
+ * in place of the actual input, so that games can be benchmarked
+ * deterministically. The script RNG is seeded with seed() in
+ * both cases; the recorded seed is reused on playback. Only bound
+ * buttons are covered, not the mouse position.
+ * While playing back, the profiled frame timings and memory
+ * figures are summarized into the 'replayReport' file once the
+ * recording (or 'replayFrames') runs out, and the engine quits */
+class InputReplay
+{
+public:
+	enum Mode
+	{
+		Off,
+		Record,
+		Play
+	};
+
+	/* Each press is stored as its button code, with
+	 * the top bit set if the source is repeatable */
+	typedef std::vector<uint8_t> Presses;
+
+	InputReplay(const Config &conf);
+	~InputReplay();
+
+	Mode mode() const;
+
+	/* 0 if neither recording nor playing back */
+	uint32_t seed() const;
+
+	/* Appends the presses of one update to the recording */
+	void recordFrame(const Presses &presses);
+
+	/* Fetches the presses of the next update; returns false
+	 * (leaving 'presses' empty) once the replay is over */
+	bool playFrame(Presses &presses);
+
+private:
+	void finish();
+	void writeReport();
+
+	Mode m;
+	FILE *file;
+	uint32_t rngSeed;
+
+	const Config &conf;
+	int framesPlayed;
+
+	/* Per section, one entry per played frame */
+	std::vector<std::vector<float> > timings;
+};
+
+#endif // INPUTREPLAY_H
@@ -142,6 +142,75 @@ public:
 	{
 		return size;
 	}
+
+	/* Stable merge sort, with 'less' comparing
+	 * two elements' data */
+	template<typename Less>
+	void sort(Less less)
+	{
+		if (size < 2)
+			return;
+
+		/* Detach into a null terminated chain */
+		root.prev->next = 0;
+		IntruListLink<T> *head = mergeSort(root.next, size, less);
+
+		/* Restore the back links and close the ring */
+		IntruListLink<T> *prev = &root;
+
+		for (IntruListLink<T> *node = head; node; node = node->next)
+		{
+			node->prev = prev;
+			prev = node;
+		}
+
+		root.next = head;
+		root.prev = prev;
+		prev->next = &root;
+	}
+
+private:
+	template<typename Less>
+	static IntruListLink<T> *mergeSort(IntruListLink<T> *head, int count, Less less)
+	{
+		if (count == 1)
+		{
+			head->next = 0;
+			return head;
+		}
+
+		int half = count / 2;
+		IntruListLink<T> *mid = head;
+
+		for (int i = 0; i < half; ++i)
+			mid = mid->next;
+
+		IntruListLink<T> *a = mergeSort(head, half, less);
+		IntruListLink<T> *b = mergeSort(mid, count - half, less);
+
+		IntruListLink<T> *result = 0;
+		IntruListLink<T> **tail = &result;
+
+		while (a && b)
+		{
+			if (less(b->data, a->data))
+			{
+				*tail = b;
+				b = b->next;
+			}
+			else
+			{
+				*tail = a;
+				a = a->next;
+			}
+
+			tail = &(*tail)->next;
+		}
+
+		*tail = a ? a : b;
+
+		return result;
+	}
 };
 
 #endif // INTRULIST_H
@@ -81,7 +81,8 @@ static const KbBindingData defaultKbBindings[] =
 	{ SDL_SCANCODE_Q,      Input::L     },
 	{ SDL_SCANCODE_W,      Input::R     },
 	{ SDL_SCANCODE_A,      Input::X     },
-	{ SDL_SCANCODE_S,      Input::Y     }
+	{ SDL_SCANCODE_S,      Input::Y     },
+	{ SDL_SCANCODE_TAB,    Input::FastForward }
 };
 
 /* RGSS1 */
@@ -243,7 +244,8 @@ static bool verifyDesc(const BindingDesc &desc)
 	    Input::X, Input::Y, Input::Z,
 	    Input::L, Input::R,
 	    Input::Shift, Input::Ctrl, Input::Alt,
-	    Input::F5, Input::F6, Input::F7, Input::F8, Input::F9
+	    Input::F5, Input::F6, Input::F7, Input::F8, Input::F9,
+	    Input::FastForward
 	};
 
 	elementsN(codes);
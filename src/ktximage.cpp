@@ -0,0 +1,111 @@
+/*
+** ktximage.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ktximage.h"
+
+#include <string.h>
+
+static const uint8_t ktxIdentifier[12] =
+{
+	0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+enum HeaderField
+{
+	Endianness,
+	GLType,
+	GLTypeSize,
+	GLFormat,
+	GLInternalFormat,
+	GLBaseInternalFormat,
+	PixelWidth,
+	PixelHeight,
+	PixelDepth,
+	ArrayElements,
+	Faces,
+	MipmapLevels,
+	KeyValueBytes,
+
+	HeaderFieldCount
+};
+
+static uint32_t swapped(uint32_t value)
+{
+	return ((value & 0x000000FF) << 24) | ((value & 0x0000FF00) << 8)
+	     | ((value & 0x00FF0000) >> 8)  | ((value & 0xFF000000) >> 24);
+}
+
+bool KTXImage::parse(const std::string &file)
+{
+	const size_t headerSize = sizeof(ktxIdentifier) + HeaderFieldCount * 4;
+
+	if (file.size() < headerSize + 4)
+		return false;
+
+	if (memcmp(file.data(), ktxIdentifier, sizeof(ktxIdentifier)) != 0)
+		return false;
+
+	uint32_t header[HeaderFieldCount];
+	memcpy(header, file.data() + sizeof(ktxIdentifier), sizeof(header));
+
+	/* Written in the converter's byte order */
+	const bool swap = (header[Endianness] == 0x01020304);
+
+	if (swap)
+		for (int i = 0; i < HeaderFieldCount; ++i)
+			header[i] = swapped(header[i]);
+
+	if (header[Endianness] != 0x04030201)
+		return false;
+
+	/* Compressed formats have no pixel type */
+	if (header[GLType] != 0 || header[GLFormat] != 0)
+		return false;
+
+	if (header[PixelDepth] > 1 || header[ArrayElements] != 0 || header[Faces] != 1)
+		return false;
+
+	size_t offset = headerSize + header[KeyValueBytes];
+
+	if (offset + 4 > file.size())
+		return false;
+
+	uint32_t imageSize;
+	memcpy(&imageSize, file.data() + offset, 4);
+	offset += 4;
+
+	if (swap)
+		imageSize = swapped(imageSize);
+
+	if (imageSize == 0 || imageSize > file.size() - offset)
+		return false;
+
+	format = header[GLInternalFormat];
+	width = header[PixelWidth];
+	height = header[PixelHeight];
+
+	if (width <= 0 || height <= 0)
+		return false;
+
+	data.assign(file, offset, imageSize);
+
+	return true;
+}
@@ -0,0 +1,44 @@
+/*
+** ktximage.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KTXIMAGE_H
+#define KTXIMAGE_H
+
+#include <string>
+#include <stdint.h>
+
+/* A compressed texture image in a KTX (version 1) container,
+ * as written by offline converters such as PVRTexTool or
+ * etcpack. Only the base level of a plain 2D texture is used */
+struct KTXImage
+{
+	/* GL internal format of 'data' */
+	uint32_t format;
+	int width;
+	int height;
+	std::string data;
+
+	/* Extracts the image from the contents of a .ktx file.
+	 * Returns false if they aren't a usable KTX container */
+	bool parse(const std::string &file);
+};
+
+#endif // KTXIMAGE_H
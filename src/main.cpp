@@ -37,6 +37,11 @@
 #include "debugwriter.h"
 #include "exception.h"
 #include "gl-fun.h"
+#include "profiler.h"
+#include "filesystem.h"
+#include "bundle.h"
+#include "startuptimer.h"
+#include "threadpolicy.h"
 
 #include "binding.h"
 
@@ -76,30 +81,36 @@ int rgssThreadFun(void *userdata)
 	SDL_Window *win = threadData->window;
 	SDL_GLContext glCtx;
 
+	ThreadPolicy::apply(ThreadPolicy::RGSS);
+
 	/* Setup GL context */
-	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+	{
+		StartupPhase phase("GL context");
 
-	if (conf.debugMode)
-		SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+		SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 
-	glCtx = SDL_GL_CreateContext(win);
+		if (conf.debugMode)
+			SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
 
-	if (!glCtx)
-	{
-		rgssThreadError(threadData, std::string("Error creating context: ") + SDL_GetError());
-		return 0;
-	}
+		glCtx = SDL_GL_CreateContext(win);
 
-	try
-	{
-		initGLFunctions();
-	}
-	catch (const Exception &exc)
-	{
-		rgssThreadError(threadData, exc.msg);
-		SDL_GL_DeleteContext(glCtx);
+		if (!glCtx)
+		{
+			rgssThreadError(threadData, std::string("Error creating context: ") + SDL_GetError());
+			return 0;
+		}
 
-		return 0;
+		try
+		{
+			initGLFunctions();
+		}
+		catch (const Exception &exc)
+		{
+			rgssThreadError(threadData, exc.msg);
+			SDL_GL_DeleteContext(glCtx);
+
+			return 0;
+		}
 	}
 
 	if (!conf.enableBlitting)
@@ -117,17 +128,22 @@ int rgssThreadFun(void *userdata)
 	GLDebugLogger dLogger;
 
 	/* Setup AL context */
-	ALCcontext *alcCtx = alcCreateContext(threadData->alcDev, 0);
+	ALCcontext *alcCtx;
 
-	if (!alcCtx)
 	{
-		rgssThreadError(threadData, "Error creating OpenAL context");
-		SDL_GL_DeleteContext(glCtx);
+		StartupPhase phase("AL context");
+		alcCtx = alcCreateContext(threadData->alcDev, 0);
 
-		return 0;
-	}
+		if (!alcCtx)
+		{
+			rgssThreadError(threadData, "Error creating OpenAL context");
+			SDL_GL_DeleteContext(glCtx);
 
-	alcMakeContextCurrent(alcCtx);
+			return 0;
+		}
+
+		alcMakeContextCurrent(alcCtx);
+	}
 
 	try
 	{
@@ -191,6 +207,34 @@ static void setupWindowIcon(const Config &conf, SDL_Window *win)
 	}
 }
 
+/* Packs the game's assets into a bundle instead of running it */
+static void packBundle(const Config &conf, const char *argv0)
+{
+	static const char *archExts[] = { ".rgssad", ".rgss2a", ".rgss3a" };
+
+	try
+	{
+		FileSystem fileSystem(argv0, conf.allowSymlinks, conf.archiveReadAhead);
+
+		std::string archPath = conf.execName + archExts[conf.rgssVersion-1];
+
+		FILE *tmp = fopen(archPath.c_str(), "rb");
+		if (tmp)
+		{
+			fileSystem.addPath(archPath.c_str());
+			fclose(tmp);
+		}
+
+		fileSystem.addPath(".");
+
+		Bundle_pack(conf.packBundle.c_str());
+	}
+	catch (const Exception &exc)
+	{
+		showInitError(exc.msg);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
@@ -233,12 +277,22 @@ int main(int argc, char *argv[])
 
 	conf.readGameINI();
 
+	StartupPhase::enabled() = conf.debugMode;
+
 	if (conf.windowTitle.empty())
 		conf.windowTitle = conf.game.title;
 
 	assert(conf.rgssVersion >= 1 && conf.rgssVersion <= 3);
 	printRgssVersion(conf.rgssVersion);
 
+	if (!conf.packBundle.empty())
+	{
+		packBundle(conf, argv[0]);
+		SDL_Quit();
+
+		return 0;
+	}
+
 	int imgFlags = IMG_INIT_PNG | IMG_INIT_JPG;
 	if (IMG_Init(imgFlags) != imgFlags)
 	{
@@ -270,6 +324,9 @@ int main(int argc, char *argv[])
 	SDL_Window *win;
 	Uint32 winFlags = SDL_WINDOW_OPENGL | SDL_WINDOW_INPUT_FOCUS;
 
+	if (conf.headless)
+		winFlags |= SDL_WINDOW_HIDDEN;
+
 	if (conf.winResizable)
 		winFlags |= SDL_WINDOW_RESIZABLE;
 	if (conf.fullscreen)
@@ -324,11 +381,19 @@ int main(int argc, char *argv[])
 	/* Load and post key bindings */
 	rtData.bindingUpdateMsg.post(loadBindings(conf));
 
+	ThreadPolicy::init(conf);
+
 	/* Start RGSS thread */
 	SDL_Thread *rgssThread =
 	        SDL_CreateThread(rgssThreadFun, "rgss", &rtData);
 
+	Profiler::nameThread(SDL_ThreadID(), "main");
+
+	if (rgssThread)
+		Profiler::nameThread(SDL_GetThreadID(rgssThread), "rgss");
+
 	/* Start event processing */
+	ThreadPolicy::apply(ThreadPolicy::Event);
 	eventThread.process(rtData);
 
 	/* Request RGSS thread to stop */
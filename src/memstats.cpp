@@ -0,0 +1,106 @@
+/*
+** memstats.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "memstats.h"
+
+#include <SDL_atomic.h>
+
+/* Updates are infrequent and short; a spinlock
+ * keeps current and peak values consistent */
+static SDL_SpinLock lock;
+
+static int64_t currentVal[MemStats::SubsystemCount];
+static int64_t peakVal[MemStats::SubsystemCount];
+
+static const char *names[] =
+{
+	"bitmap_surfaces",
+	"textures",
+	"mega_tiles",
+	"sound_buffers",
+	"encoded_sounds",
+	"decoded_mes",
+	"soundfont",
+	"midi_synths",
+	"font_handles",
+	"font_data",
+	"packed_data",
+	"script_heap",
+	"engine_objects"
+};
+
+const char *MemStats::name(int s)
+{
+	return names[s];
+}
+
+void MemStats::add(Subsystem s, int64_t delta)
+{
+	SDL_AtomicLock(&lock);
+
+	currentVal[s] += delta;
+
+	if (currentVal[s] > peakVal[s])
+		peakVal[s] = currentVal[s];
+
+	SDL_AtomicUnlock(&lock);
+}
+
+void MemStats::set(Subsystem s, int64_t value)
+{
+	SDL_AtomicLock(&lock);
+
+	currentVal[s] = value;
+
+	if (value > peakVal[s])
+		peakVal[s] = value;
+
+	SDL_AtomicUnlock(&lock);
+}
+
+int64_t MemStats::current(Subsystem s)
+{
+	SDL_AtomicLock(&lock);
+	int64_t value = currentVal[s];
+	SDL_AtomicUnlock(&lock);
+
+	return value;
+}
+
+int64_t MemStats::peak(Subsystem s)
+{
+	SDL_AtomicLock(&lock);
+	int64_t value = peakVal[s];
+	SDL_AtomicUnlock(&lock);
+
+	return value;
+}
+
+void MemStats::resetPeaks()
+{
+	SDL_AtomicLock(&lock);
+
+	for (int i = 0; i < SubsystemCount; ++i)
+		peakVal[i] = currentVal[i];
+
+	SDL_AtomicUnlock(&lock);
+}
@@ -0,0 +1,79 @@
+/*
+** memstats.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <stdint.h>
+
+/* Current and peak memory held by a few subsystems, which are
+ * the usual suspects when running out of RAM. Figures are
+ * updated at the allocation sites themselves and may be touched
+ * from any thread. Values are in bytes, unless noted otherwise */
+class MemStats
+{
+public:
+	enum Subsystem
+	{
+		/* CPU side shadows of bitmaps ('surface') */
+		BitmapSurfaces = 0,
+		/* Textures taken from the TexPool, live and pooled */
+		Textures,
+		/* The part of 'Textures' held by mega surface tiles */
+		MegaTiles,
+		/* Decoded SE cache (OpenAL buffers) */
+		SoundBuffers,
+		/* Encoded SE cache */
+		EncodedSounds,
+		/* Decoded ME cache */
+		DecodedMEs,
+		/* Size of the loaded soundfont file */
+		SoundFont,
+		/* Live fluidsynth synths (count) */
+		MidiSynths,
+		/* Open TTF_Font handles in the font pool (count) */
+		FontHandles,
+		/* Font files, shared by all sizes */
+		FontData,
+		/* Compressed Data/ files (PackedDataCache) */
+		PackedData,
+		/* Sampled from the script interpreter */
+		ScriptHeap,
+		/* Slabs backing pooled sprites, rects, colors and tones */
+		EngineObjects,
+
+		SubsystemCount
+	};
+
+	static const char *name(int s);
+
+	static void add(Subsystem s, int64_t delta);
+	static void set(Subsystem s, int64_t value);
+
+	static int64_t current(Subsystem s);
+	static int64_t peak(Subsystem s);
+
+	/* Starts tracking peaks anew from the current values */
+	static void resetPeaks();
+};
+
+#endif // MEMSTATS_H
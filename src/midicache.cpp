@@ -0,0 +1,542 @@
+/*
+** midicache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "midicache.h"
+
+#include "aldatasource.h"
+#include "config.h"
+#include "sharedmidistate.h"
+#include "boost-hash.h"
+#include "sdl-util.h"
+#include "debugwriter.h"
+
+#include <boost/functional/hash.hpp>
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include <zlib.h>
+
+#include <deque>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#define CACHE_MAGIC "MKXPMID1"
+
+/* Frames per compressed chunk (~0.75 seconds) */
+#define CHUNK_FRAMES 32768
+
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t rate;
+	uint32_t totalFrames;
+	uint32_t loopFrame;
+	uint32_t chunkFrames;
+	uint32_t chunkCount;
+
+	/* Offsets of all chunks plus the end of the last one */
+	uint32_t tableOffset;
+};
+
+/* Neighbouring samples of a channel differ far less than the
+ * samples themselves, which deflate compresses a lot better */
+static void deltaEncode(int16_t *samples, uint32_t frames)
+{
+	for (uint32_t i = frames*2; i-- > 2;)
+		samples[i] = (uint16_t) samples[i] - (uint16_t) samples[i-2];
+}
+
+static void deltaDecode(int16_t *samples, uint32_t frames)
+{
+	for (uint32_t i = 2; i < frames*2; ++i)
+		samples[i] = (uint16_t) samples[i] + (uint16_t) samples[i-2];
+}
+
+struct CachedMidiSource : ALDataSource
+{
+	FILE *f;
+	CacheHeader header;
+	std::vector<uint32_t> offsets;
+
+	bool looped;
+	uint32_t currentFrame;
+
+	/* Decoded chunk */
+	std::vector<int16_t> chunk;
+	int64_t chunkIndex;
+
+	std::vector<uint8_t> compressed;
+	std::vector<int16_t> sampleBuf;
+
+	CachedMidiSource(FILE *f, const CacheHeader &header,
+	                 std::vector<uint32_t> &offsets,
+	                 bool looped, uint32_t bufSize)
+	    : f(f),
+	      header(header),
+	      looped(looped),
+	      currentFrame(0),
+	      chunk(header.chunkFrames*2),
+	      chunkIndex(-1),
+	      sampleBuf(std::max<uint32_t>(bufSize / 2, 1) * 2)
+	{
+		this->offsets.swap(offsets);
+	}
+
+	~CachedMidiSource()
+	{
+		fclose(f);
+	}
+
+	bool loadChunk(uint32_t index)
+	{
+		if (index == chunkIndex)
+			return true;
+
+		uint32_t size = offsets[index+1] - offsets[index];
+		compressed.resize(size);
+
+		if (fseek(f, offsets[index], SEEK_SET) != 0)
+			return false;
+
+		if (fread(&compressed[0], 1, size, f) != size)
+			return false;
+
+		uLongf outSize = chunk.size() * sizeof(int16_t);
+
+		if (uncompress(reinterpret_cast<Bytef*>(&chunk[0]), &outSize,
+		               &compressed[0], size) != Z_OK)
+			return false;
+
+		if (outSize != chunk.size() * sizeof(int16_t))
+			return false;
+
+		deltaDecode(&chunk[0], header.chunkFrames);
+		chunkIndex = index;
+
+		return true;
+	}
+
+	Status fillBuffer(AL::Buffer::ID alBuffer)
+	{
+		uint32_t frames = std::min<uint32_t>(sampleBuf.size() / 2,
+		                                     header.totalFrames - currentFrame);
+
+		for (uint32_t done = 0; done < frames;)
+		{
+			uint32_t frame = currentFrame + done;
+
+			if (!loadChunk(frame / header.chunkFrames))
+				return ALDataSource::Error;
+
+			uint32_t inChunk = frame % header.chunkFrames;
+			uint32_t count = std::min(frames - done, header.chunkFrames - inChunk);
+
+			memcpy(&sampleBuf[done*2], &chunk[inChunk*2], count*2*sizeof(int16_t));
+			done += count;
+		}
+
+		AL::Buffer::uploadData(alBuffer, AL_FORMAT_STEREO16, &sampleBuf[0],
+		                       frames*2*sizeof(int16_t), header.rate);
+
+		currentFrame += frames;
+
+		if (currentFrame < header.totalFrames)
+			return ALDataSource::NoError;
+
+		if (!looped)
+			return ALDataSource::EndOfStream;
+
+		currentFrame = header.loopFrame;
+
+		return ALDataSource::WrapAround;
+	}
+
+	int sampleRate()
+	{
+		return header.rate;
+	}
+
+	void seekToOffset(float seconds)
+	{
+		currentFrame = std::max(seconds, 0.0f) * header.rate;
+
+		if (currentFrame >= header.totalFrames)
+			currentFrame = 0;
+	}
+
+	uint32_t loopStartFrames()
+	{
+		return looped ? header.loopFrame : 0;
+	}
+
+	bool setPitch(float)
+	{
+		/* Transposing isn't possible anymore */
+		return false;
+	}
+};
+
+/* Writes rendered frames to a cache file as compressed chunks */
+struct ChunkWriter : MidiRenderSink
+{
+	FILE *f;
+	AtomicFlag &cancel;
+
+	std::vector<uint32_t> offsets;
+	uint32_t chunkFrames;
+	uint32_t totalFrames;
+
+	std::vector<int16_t> samples;
+	std::vector<uint8_t> compressed;
+
+	ChunkWriter(FILE *f, AtomicFlag &cancel)
+	    : f(f),
+	      cancel(cancel),
+	      chunkFrames(0),
+	      totalFrames(0)
+	{}
+
+	bool write(const int16_t *data, uint32_t frames)
+	{
+		if (cancel)
+			return false;
+
+		/* All chunks have to be the same size */
+		if (chunkFrames == 0)
+			chunkFrames = frames;
+		else if (frames != chunkFrames)
+			return false;
+
+		samples.assign(data, data + frames*2);
+		deltaEncode(&samples[0], frames);
+
+		const uLong bytes = frames*2*sizeof(int16_t);
+		uLongf outSize = compressBound(bytes);
+		compressed.resize(outSize);
+
+		if (compress(&compressed[0], &outSize,
+		             reinterpret_cast<const Bytef*>(&samples[0]), bytes) != Z_OK)
+			return false;
+
+		offsets.push_back(ftell(f));
+
+		if (fwrite(&compressed[0], 1, outSize, f) != outSize)
+			return false;
+
+		totalFrames += frames;
+
+		return true;
+	}
+};
+
+struct RenderItem
+{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+struct MidiCachePrivate
+{
+	SharedMidiState &midiState;
+
+	std::string dir;
+	bool enabled;
+
+	/* Part of every entry's key */
+	std::string soundFont;
+	bool chorus;
+	bool reverb;
+
+	/* Checked between rendered chunks */
+	AtomicFlag cancel;
+
+	/* Everything below is guarded by 'mutex' */
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+
+	std::deque<RenderItem> queue;
+
+	/* Queued or being rendered */
+	BoostSet<std::string> pending;
+
+	SDL_Thread *thread;
+	bool quit;
+
+	MidiCachePrivate(const Config &conf, SharedMidiState &midiState)
+	    : midiState(midiState),
+	      dir(conf.customDataPath.empty() ?
+	          conf.commonDataPath : conf.customDataPath),
+	      enabled(conf.midi.prerender && !dir.empty()),
+	      soundFont(conf.midi.soundFont),
+	      chorus(conf.midi.chorus),
+	      reverb(conf.midi.reverb),
+	      mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      thread(0),
+	      quit(false)
+	{}
+
+	~MidiCachePrivate()
+	{
+		cancel.set();
+
+		SDL_LockMutex(mutex);
+		quit = true;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+
+		if (thread)
+			SDL_WaitThread(thread, 0);
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
+	}
+
+	std::string entryName(const std::vector<uint8_t> &data)
+	{
+		size_t seed = boost::hash_range(data.begin(), data.end());
+
+		boost::hash_combine(seed, soundFont);
+		boost::hash_combine(seed, chorus);
+		boost::hash_combine(seed, reverb);
+		boost::hash_combine(seed, SYNTH_SAMPLERATE);
+
+		char name[64];
+		snprintf(name, sizeof(name), "midi-%08x-%08x.pcm",
+		         (unsigned) seed, (unsigned) data.size());
+
+		return name;
+	}
+
+	ALDataSource *openEntry(const std::string &name,
+	                        bool looped, uint32_t bufSize)
+	{
+		std::string path = dir + name;
+		FILE *f = fopen(path.c_str(), "rb");
+
+		if (!f)
+			return 0;
+
+		CacheHeader header;
+		std::vector<uint32_t> offsets;
+
+		if (readEntry(f, header, offsets))
+			return new CachedMidiSource(f, header, offsets, looped, bufSize);
+
+		/* Corrupt, render it again */
+		fclose(f);
+		remove(path.c_str());
+
+		return 0;
+	}
+
+	bool readEntry(FILE *f, CacheHeader &header,
+	               std::vector<uint32_t> &offsets)
+	{
+		if (fread(&header, sizeof(header), 1, f) != 1)
+			return false;
+
+		if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)))
+			return false;
+
+		if (header.rate == 0 || header.chunkFrames == 0 || header.chunkCount == 0)
+			return false;
+
+		if ((uint64_t) header.chunkFrames * header.chunkCount != header.totalFrames)
+			return false;
+
+		if (header.loopFrame >= header.totalFrames)
+			return false;
+
+		offsets.resize(header.chunkCount+1);
+
+		if (fseek(f, header.tableOffset, SEEK_SET) != 0)
+			return false;
+
+		if (fread(&offsets[0], sizeof(uint32_t), offsets.size(), f) != offsets.size())
+			return false;
+
+		for (size_t i = 0; i < header.chunkCount; ++i)
+			if (offsets[i] >= offsets[i+1])
+				return false;
+
+		return true;
+	}
+
+	void enqueue(const std::string &name, std::vector<uint8_t> &data)
+	{
+		SDL_LockMutex(mutex);
+
+		if (!pending.contains(name))
+		{
+			pending.insert(name);
+
+			queue.push_back(RenderItem());
+			queue.back().name = name;
+			queue.back().data.swap(data);
+
+			/* Only spawn the thread once it's actually used */
+			if (!thread)
+				thread = createSDLThread
+				        <MidiCachePrivate, &MidiCachePrivate::worker>(this, "midi_render");
+
+			SDL_CondBroadcast(cond);
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+
+	void render(const RenderItem &item)
+	{
+		std::string path = dir + item.name;
+		std::string tmpPath = path + ".tmp";
+
+		FILE *f = fopen(tmpPath.c_str(), "wb");
+
+		if (!f)
+			return;
+
+		CacheHeader header;
+		memset(&header, 0, sizeof(header));
+
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+		ChunkWriter writer(f, cancel);
+		uint32_t loopFrame = 0;
+
+		if (ok)
+		{
+			fluid_synth_t *synth = midiState.newSynth();
+			ok = renderMidi(item.data, synth, CHUNK_FRAMES, writer, loopFrame);
+			midiState.deleteSynth(synth);
+		}
+
+		if (ok && writer.totalFrames > 0)
+		{
+			memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+			header.rate = SYNTH_SAMPLERATE;
+			header.totalFrames = writer.totalFrames;
+			header.loopFrame = std::min(loopFrame, writer.totalFrames - 1);
+			header.chunkFrames = writer.chunkFrames;
+			header.chunkCount = writer.offsets.size();
+			header.tableOffset = ftell(f);
+
+			writer.offsets.push_back(header.tableOffset);
+
+			ok = fwrite(&writer.offsets[0], sizeof(uint32_t),
+			            writer.offsets.size(), f) == writer.offsets.size();
+
+			ok = ok && fseek(f, 0, SEEK_SET) == 0;
+			ok = ok && fwrite(&header, sizeof(header), 1, f) == 1;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		ok = (fclose(f) == 0) && ok;
+
+		/* Only complete entries ever carry the final name */
+		if (ok && rename(tmpPath.c_str(), path.c_str()) == 0)
+			return;
+
+		remove(tmpPath.c_str());
+	}
+
+	void worker()
+	{
+		/* Must not take time away from realtime playback */
+		SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+		SDL_LockMutex(mutex);
+
+		while (true)
+		{
+			while (queue.empty() && !quit)
+				SDL_CondWait(cond, mutex);
+
+			if (quit)
+				break;
+
+			RenderItem item;
+			item.name = queue.front().name;
+			item.data.swap(queue.front().data);
+			queue.pop_front();
+
+			SDL_UnlockMutex(mutex);
+
+			render(item);
+
+			SDL_LockMutex(mutex);
+
+			pending.remove(item.name);
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+};
+
+MidiCache::MidiCache(const Config &conf, SharedMidiState &midiState)
+{
+	p = new MidiCachePrivate(conf, midiState);
+}
+
+MidiCache::~MidiCache()
+{
+	delete p;
+}
+
+bool MidiCache::enabled() const
+{
+	return p->enabled;
+}
+
+ALDataSource *MidiCache::open(SDL_RWops &ops, bool looped, uint32_t bufSize)
+{
+	Sint64 dataLen = SDL_RWsize(&ops);
+
+	if (dataLen <= 0)
+		return 0;
+
+	std::vector<uint8_t> data(dataLen);
+
+	bool read = (Sint64) SDL_RWread(&ops, &data[0], 1, dataLen) == dataLen;
+	SDL_RWseek(&ops, 0, RW_SEEK_SET);
+
+	if (!read)
+		return 0;
+
+	std::string name = p->entryName(data);
+	ALDataSource *source = p->openEntry(name, looped, bufSize);
+
+	if (source)
+	{
+		SDL_RWclose(&ops);
+		return source;
+	}
+
+	p->enqueue(name, data);
+
+	return 0;
+}
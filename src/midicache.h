@@ -0,0 +1,85 @@
+/*
+** midicache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MIDICACHE_H
+#define MIDICACHE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include <SDL_rwops.h>
+
+struct Config;
+struct SharedMidiState;
+struct ALDataSource;
+struct MidiCachePrivate;
+typedef struct _fluid_synth_t fluid_synth_t;
+
+/* Longest output renderMidi() produces before giving up */
+#define MIDI_RENDER_MAX_SECS (30*60)
+
+/* Receives the output of renderMidi() */
+struct MidiRenderSink
+{
+	virtual ~MidiRenderSink() {}
+
+	/* 'samples' holds 'frames' interleaved stereo frames.
+	 * Returning false aborts rendering */
+	virtual bool write(const int16_t *samples, uint32_t frames) = 0;
+};
+
+/* Renders the midi file 'data' from start to end, as fast as
+ * 'synth' allows, in chunks of (about) 'chunkFrames' frames.
+ * 'loopFrame' receives the output frame playback jumps back to
+ * when looping. Implemented in midisource.cpp */
+bool renderMidi(const std::vector<uint8_t> &data,
+                fluid_synth_t *synth,
+                uint32_t chunkFrames,
+                MidiRenderSink &sink,
+                uint32_t &loopFrame);
+
+/* Disk cache of midi files pre-rendered to PCM, so that playing
+ * them again is plain streaming instead of realtime synthesis.
+ * Entries are keyed by the file contents, soundfont and effect
+ * settings, and written to the data path by a low priority thread.
+ * Samples are delta coded and deflated in independently
+ * compressed chunks, which keeps seeking (and looping) cheap */
+class MidiCache
+{
+public:
+	MidiCache(const Config &conf, SharedMidiState &midiState);
+	~MidiCache();
+
+	bool enabled() const;
+
+	/* Returns a source streaming the cached rendition of the
+	 * midi file in 'ops' (which is then closed), or null
+	 * with 'ops' rewound if there is none yet, queueing the
+	 * file for rendering */
+	ALDataSource *open(SDL_RWops &ops, bool looped, uint32_t bufSize);
+
+private:
+	MidiCachePrivate *p;
+};
+
+#endif // MIDICACHE_H
@@ -28,6 +28,7 @@
 #include "util.h"
 #include "debugwriter.h"
 #include "fluid-fun.h"
+#include "midicache.h"
 
 #include <SDL_rwops.h>
 
@@ -53,7 +54,6 @@
  */
 
 #define TICK_FRAMES 32
-#define BUF_TICKS (STREAM_BUF_SIZE / TICK_FRAMES)
 #define DEFAULT_BPM 120
 #define MAX_CHANNELS 16
 
@@ -445,6 +445,8 @@ void readMidi(MidiReadHandler *handler, const std::vector<uint8_t> &data)
 		readMidiTrack(handler, chunk);
 }
 
+/* Events as read from one track, before they
+ * are merged into the song timeline */
 struct Track
 {
 	std::vector<MidiEvent> events;
@@ -452,33 +454,8 @@ struct Track
 	/* Combined deltas of all events */
 	uint64_t length;
 
-	/* Event index that is resumed from after loop wraparound */
-	int32_t loopI;
-
-	/* Difference between last event's position and length of
-	 * the longest overall track / song length */
-	uint32_t loopOffsetEnd;
-
-	/* Delta offset from the loop beginning to event[loopI] */
-	uint32_t loopOffsetStart;
-
-	bool valid;
-	MidiEvent event;
-	int32_t remDeltas;
-
-	uint32_t index;
-	bool wrapAroundFlag;
-	bool atEnd;
-
 	Track()
-	    : length(0),
-	      loopI(-1),
-	      loopOffsetEnd(0),
-	      loopOffsetStart(0),
-	      valid(false),
-	      index(0),
-	      wrapAroundFlag(false),
-	      atEnd(false)
+	    : length(0)
 	{}
 
 	void appendEvent(const MidiEvent &e)
@@ -486,48 +463,22 @@ struct Track
 		length += e.delta;
 		events.push_back(e);
 	}
+};
 
-	void scheduleEvent(bool looped)
-	{
-		if (valid)
-			return;
-
-		/* At end and not looped? */
-		if (index == events.size() && ((!looped || loopI < 0) || length == 0))
-		{
-			valid = false;
-			atEnd = true;
-			return;
-		}
-
-		MidiEvent &e = events[index++];
-
-		event = e;
-		remDeltas = e.delta;
-		valid = true;
-
-		if (wrapAroundFlag)
-		{
-			remDeltas = loopOffsetEnd + loopOffsetStart;
-			wrapAroundFlag = false;
-		}
-
-		if (looped && (index == events.size()) && loopI >= 0)
-		{
-			index = loopI;
-			wrapAroundFlag = true;
-		}
-	}
+/* An event placed on the merged timeline of all tracks */
+struct TimedEvent
+{
+	MidiEvent event;
 
-	void reset()
-	{
-		valid = false;
-		index = 0;
-		wrapAroundFlag = false;
-		atEnd = false;
-	}
+	/* Absolute position in deltas */
+	uint64_t delta;
 };
 
+static bool timedEventLess(const TimedEvent &a, const TimedEvent &b)
+{
+	return a.delta < b.delta;
+}
+
 /* Some songs use CC events for effects like fade-out,
  * slowly decreasing a channel's volume to 0. The problem is that
  * for looped songs, events are continuously fed into the synth
@@ -586,14 +537,37 @@ struct MidiSource : ALDataSource, MidiReadHandler
 	const uint16_t freq;
 	fluid_synth_t *synth;
 
-	int16_t synthBuf[BUF_TICKS*TICK_FRAMES*2];
+	/* Whether 'synth' was taken from the SharedMidiState */
+	bool pooledSynth;
+
+	/* Ticks rendered per AL buffer */
+	const size_t bufTicks;
+	std::vector<int16_t> synthBuf;
 
+	/* Only populated while reading the file */
 	std::vector<Track> tracks;
 	CCResetter<CC_CTRL_VOLUME>     volReset;
 	CCResetter<CC_CTRL_EXPRESSION> expReset;
 
-	/* Index of longest track */
-	uint8_t longestI;
+	/* All events of the song, sorted by position */
+	std::vector<TimedEvent> events;
+
+	/* Position of each event in ticks (at the tempo
+	 * in effect up to it), used for seeking */
+	std::vector<double> eventTicks;
+
+	/* Next event to be activated */
+	size_t cursor;
+
+	/* First event at or past the loop marker */
+	size_t loopCursor;
+
+	/* Current position, and that of the last event */
+	uint64_t songDelta;
+	uint64_t songLength;
+
+	/* All events have been activated (never set when looped) */
+	bool ended;
 
 	bool looped;
 
@@ -613,14 +587,30 @@ struct MidiSource : ALDataSource, MidiReadHandler
 	/* MidiReadHandler (track that's currently being read) */
 	int16_t curTrack;
 
+	/* Frames rendered so far, used to locate the
+	 * loop marker in the output (see renderMidi()) */
+	uint64_t renderedFrames;
+	int64_t loopFrame;
+
 	MidiSource(SDL_RWops &ops,
-	           bool looped)
+	           bool looped,
+	           uint32_t bufSize)
 	    : freq(SYNTH_SAMPLERATE),
+	      bufTicks(std::max<uint32_t>(bufSize / TICK_FRAMES, 1)),
+	      synthBuf(bufTicks*TICK_FRAMES*2),
+	      cursor(0),
+	      loopCursor(0),
+	      songDelta(0),
+	      songLength(0),
+	      ended(false),
 	      looped(looped),
+	      loopDelta(0),
 	      dpb(480),
 	      pitchShift(0),
 	      genDeltasCarry(0),
-	      curTrack(-1)
+	      curTrack(-1),
+	      renderedFrames(0),
+	      loopFrame(-1)
 	{
 		size_t dataLen = SDL_RWsize(&ops);
 		std::vector<uint8_t> data(dataLen);
@@ -642,58 +632,97 @@ struct MidiSource : ALDataSource, MidiReadHandler
 		}
 
 		synth = shState->midiState().allocateSynth();
+		pooledSynth = true;
 
-		uint64_t longest = 0;
+		buildTimeline();
+	}
 
+	/* For offline rendering with a synth owned by the caller */
+	MidiSource(const std::vector<uint8_t> &data,
+	           fluid_synth_t *synth,
+	           uint32_t bufSize)
+	    : freq(SYNTH_SAMPLERATE),
+	      synth(synth),
+	      pooledSynth(false),
+	      bufTicks(std::max<uint32_t>(bufSize / TICK_FRAMES, 1)),
+	      synthBuf(bufTicks*TICK_FRAMES*2),
+	      cursor(0),
+	      loopCursor(0),
+	      songDelta(0),
+	      songLength(0),
+	      ended(false),
+	      looped(false),
+	      loopDelta(0),
+	      dpb(480),
+	      pitchShift(0),
+	      genDeltasCarry(0),
+	      curTrack(-1),
+	      renderedFrames(0),
+	      loopFrame(-1)
+	{
+		readMidi(this, data);
+		buildTimeline();
+	}
+
+	void buildTimeline()
+	{
 		for (size_t i = 0; i < tracks.size(); ++i)
-			if (tracks[i].length > longest)
+		{
+			const Track &track = tracks[i];
+
+			uint64_t base = 0;
+			for (size_t j = 0; j < track.events.size(); ++j)
 			{
-				longest = tracks[i].length;
-				longestI = i;
+				base += track.events[j].delta;
+
+				TimedEvent te;
+				te.event = track.events[j];
+				te.delta = base;
+				events.push_back(te);
 			}
 
-		for (size_t i = 0; i < tracks.size(); ++i)
-			tracks[i].loopOffsetEnd = longest - tracks[i].length;
+			songLength = std::max(songLength, track.length);
+		}
+
+		/* Stable, so simultaneous events keep their track order */
+		std::stable_sort(events.begin(), events.end(), timedEventLess);
+		std::vector<Track>().swap(tracks);
+
+		ended = events.empty();
 
 		/* Enterbrain likes to be funny and put loop markers at
 		 * the very end of ME tracks */
-		if (loopDelta >= longest)
+		if (loopDelta >= songLength)
 			loopDelta = 0;
 
-		for (size_t i = 0; i < tracks.size(); ++i)
-		{
-			Track &track = tracks[i];
+		TimedEvent loopEvent;
+		loopEvent.delta = loopDelta;
+		loopCursor = std::lower_bound(events.begin(), events.end(),
+		                              loopEvent, timedEventLess) - events.begin();
 
-			int64_t base = 0;
-			for (size_t j = 0; j < track.events.size(); ++j)
-			{
-				MidiEvent &e = track.events[j];
-				base += e.delta;
+		eventTicks.resize(events.size());
+		updatePlaybackSpeed(DEFAULT_BPM);
 
-				if (base < loopDelta)
-					continue;
+		double ticks = 0;
+		uint64_t prevDelta = 0;
 
-				/* Don't make the last event loop eternally */
-				if (j < track.events.size())
-				{
-					track.loopI = j;
-					track.loopOffsetStart = base - loopDelta;
-				}
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			ticks += (events[i].delta - prevDelta) / playbackSpeed;
+			prevDelta = events[i].delta;
+			eventTicks[i] = ticks;
 
-				break;
-			}
+			if (events[i].event.type == Tempo)
+				updatePlaybackSpeed(events[i].event.e.tempo.bpm);
 		}
 
 		updatePlaybackSpeed(DEFAULT_BPM);
-
-		// FIXME: It would make the code in 'fillBuffer' a lot nicer if
-		// we could combine all tracks into one giant one on construction,
-		// instead of having to constantly iterate through all of them
 	}
 
 	~MidiSource()
 	{
-		shState->midiState().releaseSynth(synth);
+		if (pooledSynth)
+			shState->midiState().releaseSynth(synth);
 	}
 
 
@@ -788,98 +817,91 @@ struct MidiSource : ALDataSource, MidiReadHandler
 			loopDelta = absDelta;
 	}
 
-	/* ALDataSource */
-	Status fillBuffer(AL::Buffer::ID buf)
+	/* Jumps back to the loop marker once the song is over */
+	void wrapAround()
 	{
-		/* In case there is no currently scheduled one */
-		for (size_t i = 0; i < tracks.size(); ++i)
-			tracks[i].scheduleEvent(looped);
+		if (looped && songLength > 0)
+		{
+			cursor = loopCursor;
+			songDelta -= songLength - loopDelta;
+		}
+		else
+		{
+			ended = true;
+		}
+	}
 
-		size_t remTicks = BUF_TICKS;
+	/* Renders the next 'bufTicks' ticks into 'synthBuf' */
+	void render()
+	{
+		size_t remTicks = bufTicks;
 
 		/* Iterate until all ticks that fit into the buffer
 		 * have been rendered */
 		while (remTicks > 0)
 		{
-			/* Check for events that have to be activated now, activate them,
-			 * and schedule new ones if the queue isn't empty */
-			for (size_t i = 0; i < tracks.size(); ++i)
+			if (loopFrame < 0 && songDelta >= loopDelta)
+				loopFrame = renderedFrames;
+
+			/* Activate all events that are due. Wrapping around
+			 * at most once per tick guards against loops shorter
+			 * than a single tick */
+			while (!ended && cursor < events.size()
+			       && events[cursor].delta <= songDelta)
 			{
-				Track &track = tracks[i];
+				activateEvent(events[cursor++].event);
 
-				/* We have to loop and ensure that the final scheduled
-				 * event lies in the future, as multiple events might
-				 * have to be activated at once */
-				while (true)
+				if (cursor == events.size())
 				{
-					if (!track.valid || track.remDeltas > 0)
-						break;
-
-					int32_t prevOffset = track.remDeltas;
-
-					activateEvent(track.event);
-
-					track.valid = false;
-					track.scheduleEvent(looped);
-
-					/* Negative deltas from the previous event have to
-					 * be carried over into the next to stay in sync */
-					if (prevOffset < 0)
-						track.remDeltas += prevOffset;
-
-					/* Ensure it lies in the future */
-					if (track.remDeltas > 0)
-						break;
+					wrapAround();
+					break;
 				}
 			}
 
-			size_t nextEvent = (size_t) -1;
-			bool allInvalid = true;
+			/* Calculate amount of ticks we'll render next */
+			size_t genTicks = remTicks;
 
-			/* Search all tracks for the temporally nearest event */
-			for (size_t i = 0; i < tracks.size(); ++i)
+			if (!ended && cursor < events.size())
 			{
-				Track &track = tracks[i];
-
-				if (!track.valid)
-					continue;
-
-				allInvalid = false;
-
-				uint32_t remDelta = track.remDeltas / playbackSpeed;
+				int64_t remDelta = events[cursor].delta - songDelta;
+				uint32_t nextEvent = std::max<int64_t>(remDelta, 0) / playbackSpeed;
 
 				/* We need to render at least one tick regardless to
 				 * avoid an endless loop of waiting for the next event
 				 * to become current */
-				if (remDelta < nextEvent)
-					nextEvent = std::max<uint32_t>(remDelta, 1);
+				genTicks = std::min<size_t>(remTicks, std::max<uint32_t>(nextEvent, 1));
 			}
 
-			/* Calculate amount of ticks we'll render next */
-			size_t genTicks = allInvalid ? remTicks : std::min(remTicks, nextEvent);
-
-			if (genTicks == 0)
-				continue;
-
-			renderTicks(genTicks, BUF_TICKS - remTicks);
+			renderTicks(genTicks, bufTicks - remTicks);
 			remTicks -= genTicks;
+			renderedFrames += genTicks * TICK_FRAMES;
 
 			float genDeltas = (genTicks * playbackSpeed) + genDeltasCarry;
 
 			float intDeltas;
 			genDeltasCarry = modff(genDeltas, &intDeltas);
 
-			/* Substract integer part of consumed deltas while carrying
-			 * over the fractional amount into the next iteration */
-			for (size_t i = 0; i < tracks.size(); ++i)
-				if (tracks[i].valid)
-					tracks[i].remDeltas -= intDeltas;
+			/* Advance by the integer part of consumed deltas while
+			 * carrying over the fractional amount into the next iteration */
+			songDelta += intDeltas;
 		}
+	}
+
+	bool atEnd()
+	{
+		return ended;
+	}
+
+	/* ALDataSource */
+	Status fillBuffer(AL::Buffer::ID buf)
+	{
+		render();
 
 		/* Fill AL buffer */
-		AL::Buffer::uploadData(buf, AL_FORMAT_STEREO16, synthBuf, sizeof(synthBuf), freq);
+		AL::Buffer::uploadData(buf, AL_FORMAT_STEREO16, &synthBuf[0],
+		                       synthBuf.size()*sizeof(int16_t), freq);
 
-		if (tracks[longestI].atEnd)
+		if (atEnd())
 			return EndOfStream;
 
 		return NoError;
@@ -890,8 +912,7 @@ struct MidiSource : ALDataSource, MidiReadHandler
 		return freq;
 	}
 
-	/* Midi sources cannot seek, and so always reset to beginning */
-	void seekToOffset(float)
+	void seekToOffset(float seconds)
 	{
 		/* Reset synth */
 		fluid.synth_system_reset(synth);
@@ -900,9 +921,32 @@ struct MidiSource : ALDataSource, MidiReadHandler
 		genDeltasCarry = 0;
 		updatePlaybackSpeed(DEFAULT_BPM);
 
-		/* Reset tracks */
-		for (size_t i = 0; i < tracks.size(); ++i)
-			tracks[i].reset();
+		cursor = 0;
+		songDelta = 0;
+		ended = events.empty();
+
+		double target = seconds * freq / TICK_FRAMES;
+
+		if (target <= 0 || events.empty() || target >= eventTicks.back())
+			return;
+
+		size_t i = std::upper_bound(eventTicks.begin(), eventTicks.end(), target)
+		         - eventTicks.begin();
+
+		/* Bring the synth into the state it would be in at
+		 * the target position, minus the notes playing */
+		for (; cursor < i; ++cursor)
+		{
+			const MidiEvent &e = events[cursor].event;
+
+			if (e.type != NoteOn && e.type != NoteOff)
+				activateEvent(e);
+		}
+
+		if (i == 0)
+			songDelta = target * playbackSpeed;
+		else
+			songDelta = events[i-1].delta + (target - eventTicks[i-1]) * playbackSpeed;
 	}
 
 	uint32_t loopStartFrames() { return 0; }
@@ -910,14 +954,61 @@ struct MidiSource : ALDataSource, MidiReadHandler
 	bool setPitch(float value)
 	{
 		// not completely correct, but close
-		pitchShift = round((value > 1.0f ? 14 : 24) * (value - 1.0f));
+		int8_t shift = round((value > 1.0f ? 14 : 24) * (value - 1.0f));
+
+		/* Notes still sounding under the previous shift would
+		 * never receive their (now shifted) note off */
+		if (shift != pitchShift)
+			for (int i = 0; i < 16; ++i)
+				if (i != 9)
+					fluid.synth_cc(synth, i, 123 /* All Notes Off */, 0);
+
+		pitchShift = shift;
 
 		return true;
 	}
 };
 
 ALDataSource *createMidiSource(SDL_RWops &ops,
-                               bool looped)
+                               bool looped,
+                               uint32_t bufSize)
+{
+	return new MidiSource(ops, looped, bufSize);
+}
+
+bool renderMidi(const std::vector<uint8_t> &data,
+                fluid_synth_t *synth,
+                uint32_t chunkFrames,
+                MidiRenderSink &sink,
+                uint32_t &loopFrame)
 {
-	return new MidiSource(ops, looped);
+	try
+	{
+		MidiSource source(data, synth, chunkFrames);
+
+		if (source.events.empty())
+			return false;
+
+		const uint64_t maxFrames = (uint64_t) MIDI_RENDER_MAX_SECS * source.freq;
+
+		do
+		{
+			source.render();
+
+			if (!sink.write(&source.synthBuf[0], source.synthBuf.size() / 2))
+				return false;
+
+			if (source.renderedFrames > maxFrames)
+				return false;
+		}
+		while (!source.atEnd());
+
+		loopFrame = std::max<int64_t>(source.loopFrame, 0);
+	}
+	catch (const Exception &)
+	{
+		return false;
+	}
+
+	return true;
 }
@@ -0,0 +1,779 @@
+/*
+** movieplayer.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "movieplayer.h"
+
+#include "sharedstate.h"
+#include "filesystem.h"
+#include "exception.h"
+#include "gl-util.h"
+#include "quad.h"
+#include "shader.h"
+#include "al-util.h"
+#include "sdl-util.h"
+
+#include <theora/theoradec.h>
+#include <vorbis/codec.h>
+
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+#include <SDL_timer.h>
+#include <SDL_rwops.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+/* Decoded frames kept ahead of display */
+#define FRAME_QUEUE_SIZE 8
+
+/* Buffers queued on the audio source,
+ * and frames (samples per channel) in each */
+#define AUDIO_BUFFER_COUNT 4
+#define AUDIO_BUFFER_FRAMES 4096
+
+/* How long the decoder sleeps with nothing to do (ms) */
+#define DECODE_SLEEP 5
+
+struct MovieFrame
+{
+	/* Presentation time in seconds */
+	double time;
+
+	/* Y, Cb and Cr, each tightly packed */
+	std::vector<uint8_t> planes[3];
+};
+
+struct MovieOpenHandler : FileSystem::OpenHandler
+{
+	SDL_RWops *ops;
+	bool opened;
+
+	MovieOpenHandler(SDL_RWops *ops)
+	    : ops(ops),
+	      opened(false)
+	{}
+
+	bool tryRead(SDL_RWops &ops, const char *)
+	{
+		char sig[5] = { 0 };
+		SDL_RWread(&ops, sig, 1, 4);
+		SDL_RWseek(&ops, 0, RW_SEEK_SET);
+
+		/* Only Ogg containers are supported */
+		if (strcmp(sig, "OggS"))
+		{
+			SDL_RWclose(&ops);
+			return false;
+		}
+
+		*this->ops = ops;
+		opened = true;
+
+		return true;
+	}
+};
+
+struct MoviePlayerPrivate
+{
+	SDL_RWops ops;
+	bool opsOpen;
+
+	ogg_sync_state sync;
+	ogg_page page;
+
+	/* Theora video */
+	ogg_stream_state thStream;
+	bool haveTheora;
+	th_info thInfo;
+	th_comment thComment;
+	th_setup_info *thSetup;
+	th_dec_ctx *thDec;
+
+	/* Vorbis audio */
+	ogg_stream_state vbStream;
+	bool haveVorbis;
+	vorbis_info vbInfo;
+	vorbis_comment vbComment;
+	vorbis_dsp_state vbDsp;
+	vorbis_block vbBlock;
+	bool vbInit;
+
+	/* Picture region of each plane in the decoded frames */
+	IntRect planeRect[3];
+
+	/* Frames decoded ahead, and ones free for reuse */
+	std::deque<MovieFrame*> queue;
+	std::vector<MovieFrame*> spare;
+
+	TEX::ID tex[3];
+	bool haveFrame;
+
+	AL::Source::ID alSrc;
+	AL::Buffer::ID alBuf[AUDIO_BUFFER_COUNT];
+	std::vector<AL::Buffer::ID> freeBufs;
+	std::vector<int16_t> pcm;
+	ALenum alFormat;
+	int channels;
+
+	/* Frames of the buffers already unqueued from the source */
+	uint64_t audioDone;
+
+	/* Wall clock, for movies without (or past their) audio */
+	uint64_t wallStart;
+	double wallBase;
+	bool useWallClock;
+
+	/* Guards the frame queue and 'audioDone' */
+	SDL_mutex *mutex;
+	SDL_Thread *thread;
+
+	AtomicFlag stopRequested;
+	AtomicFlag videoEnded;
+	AtomicFlag audioEnded;
+
+	/* Set once the last buffer has played and been unqueued */
+	AtomicFlag audioFinished;
+
+	MoviePlayerPrivate()
+	    : opsOpen(false),
+	      haveTheora(false),
+	      thSetup(0),
+	      thDec(0),
+	      haveVorbis(false),
+	      vbInit(false),
+	      haveFrame(false),
+	      alFormat(0),
+	      channels(0),
+	      audioDone(0),
+	      wallStart(0),
+	      wallBase(0),
+	      useWallClock(true),
+	      mutex(SDL_CreateMutex()),
+	      thread(0)
+	{
+		ogg_sync_init(&sync);
+
+		th_info_init(&thInfo);
+		th_comment_init(&thComment);
+		vorbis_info_init(&vbInfo);
+		vorbis_comment_init(&vbComment);
+
+		for (size_t i = 0; i < 3; ++i)
+			tex[i] = TEX::ID();
+	}
+
+	~MoviePlayerPrivate()
+	{
+		if (thread)
+		{
+			stopRequested.set();
+			SDL_WaitThread(thread, 0);
+		}
+
+		if (alSrc.al)
+		{
+			AL::Source::stop(alSrc);
+			AL::Source::clearQueue(alSrc);
+			AL::Source::del(alSrc);
+
+			for (size_t i = 0; i < AUDIO_BUFFER_COUNT; ++i)
+				AL::Buffer::del(alBuf[i]);
+		}
+
+		for (size_t i = 0; i < 3; ++i)
+			if (tex[i].gl)
+				TEX::del(tex[i]);
+
+		for (size_t i = 0; i < queue.size(); ++i)
+			delete queue[i];
+
+		for (size_t i = 0; i < spare.size(); ++i)
+			delete spare[i];
+
+		if (vbInit)
+		{
+			vorbis_block_clear(&vbBlock);
+			vorbis_dsp_clear(&vbDsp);
+		}
+
+		if (haveVorbis)
+			ogg_stream_clear(&vbStream);
+
+		if (thDec)
+			th_decode_free(thDec);
+
+		if (thSetup)
+			th_setup_free(thSetup);
+
+		if (haveTheora)
+			ogg_stream_clear(&thStream);
+
+		vorbis_comment_clear(&vbComment);
+		vorbis_info_clear(&vbInfo);
+		th_comment_clear(&thComment);
+		th_info_clear(&thInfo);
+
+		ogg_sync_clear(&sync);
+
+		if (opsOpen)
+			SDL_RWclose(&ops);
+
+		SDL_DestroyMutex(mutex);
+	}
+
+	bool readPage()
+	{
+		while (ogg_sync_pageout(&sync, &page) != 1)
+		{
+			char *buffer = ogg_sync_buffer(&sync, 4096);
+			size_t read = SDL_RWread(&ops, buffer, 1, 4096);
+
+			if (read == 0)
+				return false;
+
+			ogg_sync_wrote(&sync, read);
+		}
+
+		return true;
+	}
+
+	/* Pages of other streams are rejected */
+	void queuePage()
+	{
+		if (haveTheora)
+			ogg_stream_pagein(&thStream, &page);
+		if (haveVorbis)
+			ogg_stream_pagein(&vbStream, &page);
+	}
+
+	bool nextPacket(ogg_stream_state &stream, ogg_packet &packet)
+	{
+		while (ogg_stream_packetout(&stream, &packet) != 1)
+		{
+			if (!readPage())
+				return false;
+
+			queuePage();
+		}
+
+		return true;
+	}
+
+	void open(const char *filename)
+	{
+		MovieOpenHandler handler(&ops);
+		shState->fileSystem().openRead(handler, filename);
+
+		if (!handler.opened)
+			throw Exception(Exception::MKXPError, "%s: not an Ogg movie", filename);
+
+		opsOpen = true;
+
+		readHeaders(filename);
+
+		thDec = th_decode_alloc(&thInfo, thSetup);
+
+		if (!thDec)
+			throw Exception(Exception::MKXPError, "%s: unsupported video format", filename);
+
+		setupPlanes();
+		setupTextures();
+
+		if (haveVorbis)
+			setupAudio();
+
+		thread = createSDLThread
+		        <MoviePlayerPrivate, &MoviePlayerPrivate::decodeLoop>(this, "movie");
+
+		if (!thread)
+			throw Exception(Exception::SDLError, "%s", SDL_GetError());
+	}
+
+	void readHeaders(const char *filename)
+	{
+		int thHeaders = 0, vbHeaders = 0;
+		ogg_packet packet;
+
+		/* The first page of every stream comes up front */
+		while (true)
+		{
+			if (!readPage())
+				throw Exception(Exception::MKXPError, "%s: truncated movie", filename);
+
+			if (!ogg_page_bos(&page))
+			{
+				queuePage();
+				break;
+			}
+
+			ogg_stream_state test;
+			ogg_stream_init(&test, ogg_page_serialno(&page));
+			ogg_stream_pagein(&test, &page);
+
+			if (ogg_stream_packetout(&test, &packet) != 1)
+			{
+				ogg_stream_clear(&test);
+				continue;
+			}
+
+			if (!haveTheora && th_decode_headerin(&thInfo, &thComment, &thSetup, &packet) > 0)
+			{
+				thStream = test;
+				haveTheora = true;
+				thHeaders = 1;
+			}
+			else if (!haveVorbis && vorbis_synthesis_headerin(&vbInfo, &vbComment, &packet) == 0)
+			{
+				vbStream = test;
+				haveVorbis = true;
+				vbHeaders = 1;
+			}
+			else
+			{
+				ogg_stream_clear(&test);
+			}
+		}
+
+		if (!haveTheora)
+			throw Exception(Exception::MKXPError, "%s: no Theora video stream", filename);
+
+		/* Both codecs have three header packets */
+		while (thHeaders < 3 || (haveVorbis && vbHeaders < 3))
+		{
+			bool progress = false;
+
+			while (thHeaders < 3 && ogg_stream_packetout(&thStream, &packet) == 1)
+			{
+				if (th_decode_headerin(&thInfo, &thComment, &thSetup, &packet) <= 0)
+					throw Exception(Exception::MKXPError, "%s: corrupt video headers", filename);
+
+				++thHeaders;
+				progress = true;
+			}
+
+			while (haveVorbis && vbHeaders < 3 && ogg_stream_packetout(&vbStream, &packet) == 1)
+			{
+				if (vorbis_synthesis_headerin(&vbInfo, &vbComment, &packet) != 0)
+					throw Exception(Exception::MKXPError, "%s: corrupt audio headers", filename);
+
+				++vbHeaders;
+				progress = true;
+			}
+
+			if (progress)
+				continue;
+
+			if (!readPage())
+				throw Exception(Exception::MKXPError, "%s: truncated movie", filename);
+
+			queuePage();
+		}
+	}
+
+	void setupPlanes()
+	{
+		planeRect[0] = IntRect(thInfo.pic_x, thInfo.pic_y,
+		                       thInfo.pic_width, thInfo.pic_height);
+
+		/* Chroma subsampling of the pixel format */
+		const int hdec = !(thInfo.pixel_fmt & 1);
+		const int vdec = !(thInfo.pixel_fmt & 2);
+
+		const IntRect &y = planeRect[0];
+		const int cx = y.x >> hdec;
+		const int cy = y.y >> vdec;
+
+		planeRect[1] = planeRect[2] =
+		        IntRect(cx, cy,
+		                ((y.x + y.w + hdec) >> hdec) - cx,
+		                ((y.y + y.h + vdec) >> vdec) - cy);
+	}
+
+	void setupTextures()
+	{
+		for (size_t i = 0; i < 3; ++i)
+		{
+			tex[i] = TEX::gen();
+			TEX::bind(tex[i]);
+			TEX::setRepeat(false);
+			TEX::setSmooth(true);
+
+			gl.TexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, planeRect[i].w, planeRect[i].h,
+			              0, GL_LUMINANCE, GL_UNSIGNED_BYTE, 0);
+		}
+	}
+
+	void setupAudio()
+	{
+		vorbis_synthesis_init(&vbDsp, &vbInfo);
+		vorbis_block_init(&vbDsp, &vbBlock);
+		vbInit = true;
+
+		/* Anything beyond stereo is cut down to its first two channels */
+		channels = std::min(vbInfo.channels, 2);
+		alFormat = chooseALFormat(2, channels);
+		pcm.resize(AUDIO_BUFFER_FRAMES * channels);
+
+		alSrc = AL::Source::gen();
+
+		for (size_t i = 0; i < AUDIO_BUFFER_COUNT; ++i)
+		{
+			alBuf[i] = AL::Buffer::gen();
+			freeBufs.push_back(alBuf[i]);
+		}
+
+		useWallClock = false;
+	}
+
+	/* Decode thread */
+
+	MovieFrame *takeSpare()
+	{
+		SDL_LockMutex(mutex);
+
+		MovieFrame *frame = 0;
+
+		if (!spare.empty())
+		{
+			frame = spare.back();
+			spare.pop_back();
+		}
+
+		SDL_UnlockMutex(mutex);
+
+		return frame ? frame : new MovieFrame;
+	}
+
+	bool decodeFrame(MovieFrame &frame)
+	{
+		ogg_packet packet;
+		ogg_int64_t granule;
+
+		while (nextPacket(thStream, packet))
+		{
+			/* Duplicate frames just leave the last one up */
+			if (th_decode_packetin(thDec, &packet, &granule) != 0)
+				continue;
+
+			th_ycbcr_buffer buffer;
+			th_decode_ycbcr_out(thDec, buffer);
+
+			frame.time = th_granule_time(thDec, granule);
+
+			for (size_t i = 0; i < 3; ++i)
+			{
+				const IntRect &r = planeRect[i];
+				const th_img_plane &plane = buffer[i];
+
+				frame.planes[i].resize(r.w * r.h);
+
+				for (int y = 0; y < r.h; ++y)
+					memcpy(&frame.planes[i][y*r.w],
+					       plane.data + (r.y + y) * plane.stride + r.x, r.w);
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	/* Fills 'pcm' with up to AUDIO_BUFFER_FRAMES frames;
+	 * returns how many were decoded */
+	size_t decodeAudio()
+	{
+		size_t done = 0;
+
+		while (done < AUDIO_BUFFER_FRAMES)
+		{
+			float **samples;
+			int avail = vorbis_synthesis_pcmout(&vbDsp, &samples);
+
+			if (avail > 0)
+			{
+				const size_t count = std::min<size_t>(avail, AUDIO_BUFFER_FRAMES - done);
+
+				for (size_t i = 0; i < count; ++i)
+					for (int c = 0; c < channels; ++c)
+					{
+						const float value = clamp(samples[c][i], -1.0f, 1.0f);
+						pcm[(done+i)*channels + c] = value * 32767;
+					}
+
+				vorbis_synthesis_read(&vbDsp, count);
+				done += count;
+
+				continue;
+			}
+
+			ogg_packet packet;
+
+			if (!nextPacket(vbStream, packet))
+				break;
+
+			if (vorbis_synthesis(&vbBlock, &packet) == 0)
+				vorbis_synthesis_blockin(&vbDsp, &vbBlock);
+		}
+
+		return done;
+	}
+
+	/* Refills played buffers; returns true if it did any work */
+	bool pumpAudio()
+	{
+		ALint processed = AL::Source::getProcBufferCount(alSrc);
+
+		if (processed > 0)
+		{
+			SDL_LockMutex(mutex);
+
+			while (processed-- > 0)
+			{
+				AL::Buffer::ID buf = AL::Source::unqueueBuffer(alSrc);
+				audioDone += AL::Buffer::getSize(buf) / (2 * channels);
+				freeBufs.push_back(buf);
+			}
+
+			SDL_UnlockMutex(mutex);
+		}
+
+		bool worked = false;
+
+		while (!audioEnded && !freeBufs.empty())
+		{
+			const size_t count = decodeAudio();
+
+			if (count == 0)
+			{
+				audioEnded.set();
+				break;
+			}
+
+			AL::Buffer::ID buf = freeBufs.back();
+			freeBufs.pop_back();
+
+			AL::Buffer::uploadData(buf, alFormat, &pcm[0],
+			                       count * 2 * channels, vbInfo.rate);
+			AL::Source::queueBuffer(alSrc, buf);
+
+			worked = true;
+		}
+
+		const bool playing = AL::Source::getState(alSrc) == AL_PLAYING;
+
+		/* Starts playback, or resumes it after an underrun */
+		if (worked && !playing)
+			AL::Source::play(alSrc);
+
+		if (audioEnded && !playing && freeBufs.size() == AUDIO_BUFFER_COUNT)
+			audioFinished.set();
+
+		return worked;
+	}
+
+	void decodeLoop()
+	{
+		while (!stopRequested)
+		{
+			bool worked = false;
+
+			if (haveVorbis && !audioFinished)
+				worked = pumpAudio();
+
+			if (!videoEnded)
+			{
+				SDL_LockMutex(mutex);
+				const bool full = queue.size() >= FRAME_QUEUE_SIZE;
+				SDL_UnlockMutex(mutex);
+
+				if (!full)
+				{
+					MovieFrame *frame = takeSpare();
+
+					if (decodeFrame(*frame))
+					{
+						SDL_LockMutex(mutex);
+						queue.push_back(frame);
+						SDL_UnlockMutex(mutex);
+
+						worked = true;
+					}
+					else
+					{
+						delete frame;
+						videoEnded.set();
+					}
+				}
+			}
+
+			if (videoEnded && (!haveVorbis || audioFinished))
+				break;
+
+			if (!worked)
+				SDL_Delay(DECODE_SLEEP);
+		}
+	}
+
+	/* Main thread */
+
+	double audioClock()
+	{
+		SDL_LockMutex(mutex);
+
+		const uint64_t frames = audioDone + AL::Source::getInteger(alSrc, AL_SAMPLE_OFFSET);
+
+		SDL_UnlockMutex(mutex);
+
+		return (double) frames / vbInfo.rate;
+	}
+
+	double wallClock()
+	{
+		if (wallStart == 0)
+			wallStart = SDL_GetPerformanceCounter();
+
+		return wallBase + (double) (SDL_GetPerformanceCounter() - wallStart)
+		                  / SDL_GetPerformanceFrequency();
+	}
+
+	bool audioPlaying()
+	{
+		return haveVorbis && !audioFinished;
+	}
+
+	double clock()
+	{
+		if (useWallClock)
+			return wallClock();
+
+		const double time = audioClock();
+
+		/* Even when the audio ends early, the video plays on */
+		if (!audioPlaying())
+		{
+			useWallClock = true;
+			wallBase = time;
+		}
+
+		return time;
+	}
+
+	void upload(const MovieFrame &frame)
+	{
+		gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		for (size_t i = 0; i < 3; ++i)
+		{
+			TEX::bind(tex[i]);
+			TEX::uploadSubImage(0, 0, planeRect[i].w, planeRect[i].h,
+			                    &frame.planes[i][0], GL_LUMINANCE);
+		}
+
+		gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		haveFrame = true;
+	}
+};
+
+MoviePlayer::MoviePlayer(const char *filename)
+{
+	p = new MoviePlayerPrivate;
+
+	try
+	{
+		p->open(filename);
+	}
+	catch (...)
+	{
+		delete p;
+		throw;
+	}
+}
+
+MoviePlayer::~MoviePlayer()
+{
+	delete p;
+}
+
+int MoviePlayer::width() const
+{
+	return p->planeRect[0].w;
+}
+
+int MoviePlayer::height() const
+{
+	return p->planeRect[0].h;
+}
+
+bool MoviePlayer::update()
+{
+	const double now = p->clock();
+	MovieFrame *due = 0;
+
+	SDL_LockMutex(p->mutex);
+
+	/* Frames that are overdue are dropped */
+	while (!p->queue.empty() && p->queue.front()->time <= now)
+	{
+		if (due)
+			p->spare.push_back(due);
+
+		due = p->queue.front();
+		p->queue.pop_front();
+	}
+
+	const bool videoDone = p->videoEnded && p->queue.empty();
+
+	SDL_UnlockMutex(p->mutex);
+
+	if (due)
+	{
+		p->upload(*due);
+
+		SDL_LockMutex(p->mutex);
+		p->spare.push_back(due);
+		SDL_UnlockMutex(p->mutex);
+	}
+
+	return !(videoDone && !due && !p->audioPlaying());
+}
+
+void MoviePlayer::draw(const IntRect &dst)
+{
+	if (!p->haveFrame)
+		return;
+
+	YUVShader &shader = shState->shaders().yuv();
+	shader.bind();
+	shader.applyViewportProj();
+	shader.setTexSize(Vec2i(width(), height()));
+	shader.setChroma(p->tex[1], p->tex[2]);
+
+	TEX::bind(p->tex[0]);
+
+	Quad &quad = shState->gpQuad();
+	quad.setTexPosRect(IntRect(0, 0, width(), height()), dst);
+	quad.draw(shader);
+}
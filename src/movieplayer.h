@@ -0,0 +1,60 @@
+/*
+** movieplayer.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MOVIEPLAYER_H
+#define MOVIEPLAYER_H
+
+#include "etc-internal.h"
+
+struct MoviePlayerPrivate;
+
+/* Plays Ogg Theora movies with optional Vorbis audio. Demuxing
+ * and decoding happen on a thread of their own, which keeps a
+ * bounded queue of frames ahead of display; the frames are only
+ * converted from YUV by the shader drawing them. Audio is
+ * streamed through an OpenAL source, whose playback position
+ * is the clock frames are shown by (the wall clock for movies
+ * without audio) */
+class MoviePlayer
+{
+public:
+	/* Throws if the movie can't be opened */
+	MoviePlayer(const char *filename);
+	~MoviePlayer();
+
+	/* Picture size in pixels */
+	int width() const;
+	int height() const;
+
+	/* Takes on the most recent frame that is due.
+	 * Returns false once playback has finished */
+	bool update();
+
+	/* Draws the current frame to 'dst' of the bound
+	 * framebuffer, with the viewport already set up */
+	void draw(const IntRect &dst);
+
+private:
+	MoviePlayerPrivate *p;
+};
+
+#endif // MOVIEPLAYER_H
@@ -0,0 +1,93 @@
+/*
+** objectpool.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "objectpool.h"
+
+#include "memstats.h"
+
+#include <stdlib.h>
+#include <new>
+
+/* Blocks are aligned for any fundamental type */
+static const size_t blockAlign = 16;
+
+static size_t alignedSize(size_t size)
+{
+	if (size < sizeof(void*))
+		size = sizeof(void*);
+
+	return (size + blockAlign - 1) & ~(blockAlign - 1);
+}
+
+BlockPool::BlockPool(size_t blockSize, size_t slabBlocks)
+    : blockSize(alignedSize(blockSize)),
+      slabBlocks(slabBlocks),
+      freeList(0),
+      lock(0)
+{}
+
+void *BlockPool::alloc()
+{
+	SDL_AtomicLock(&lock);
+
+	if (!freeList)
+	{
+		const size_t slabSize = blockSize * slabBlocks;
+		char *slab = static_cast<char*>(malloc(slabSize));
+
+		if (!slab)
+		{
+			SDL_AtomicUnlock(&lock);
+			throw std::bad_alloc();
+		}
+
+		/* Thread the new blocks onto the free list
+		 * in address order, the first one on top */
+		for (size_t i = slabBlocks; i-- > 0;)
+		{
+			Block *block = reinterpret_cast<Block*>(slab + i * blockSize);
+			block->next = freeList;
+			freeList = block;
+		}
+
+		MemStats::add(MemStats::EngineObjects, slabSize);
+	}
+
+	Block *block = freeList;
+	freeList = block->next;
+
+	SDL_AtomicUnlock(&lock);
+
+	return block;
+}
+
+void BlockPool::free(void *ptr)
+{
+	Block *block = static_cast<Block*>(ptr);
+
+	SDL_AtomicLock(&lock);
+
+	block->next = freeList;
+	freeList = block;
+
+	SDL_AtomicUnlock(&lock);
+}
@@ -0,0 +1,95 @@
+/*
+** objectpool.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <SDL_atomic.h>
+
+#include <stddef.h>
+
+/* Hands out fixed size blocks carved from slabs of 'slabBlocks'
+ * blocks each. Freed blocks are kept for reuse instead of being
+ * returned to the system, which spares the heap the churn of
+ * objects being created and dropped in large numbers. Slab
+ * memory is accounted as MemStats::EngineObjects */
+class BlockPool
+{
+public:
+	BlockPool(size_t blockSize, size_t slabBlocks);
+
+	void *alloc();
+	void free(void *block);
+
+private:
+	struct Block
+	{
+		Block *next;
+	};
+
+	const size_t blockSize;
+	const size_t slabBlocks;
+
+	Block *freeList;
+	SDL_SpinLock lock;
+};
+
+/* Base for classes whose objects are allocated from their own
+ * BlockPool. Subclasses of 'T' (which have a different size)
+ * fall back to regular allocation. The pool lives on until
+ * exit, so objects can safely be deleted during shutdown */
+template<typename T, size_t slabBlocks = 64>
+class Pooled
+{
+public:
+	static void *operator new(size_t size)
+	{
+		if (size != sizeof(T))
+			return ::operator new(size);
+
+		return pool().alloc();
+	}
+
+	static void operator delete(void *ptr, size_t size)
+	{
+		if (!ptr)
+			return;
+
+		if (size != sizeof(T))
+		{
+			::operator delete(ptr);
+			return;
+		}
+
+		pool().free(ptr);
+	}
+
+private:
+	static BlockPool &pool()
+	{
+		static BlockPool *p = new BlockPool(sizeof(T), slabBlocks);
+
+		return *p;
+	}
+};
+
+#endif // OBJECTPOOL_H
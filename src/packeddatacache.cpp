@@ -0,0 +1,371 @@
+/*
+** packeddatacache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "packeddatacache.h"
+
+#include "workerpool.h"
+#include "memstats.h"
+#include "boost-hash.h"
+#include "debugwriter.h"
+#include "util.h"
+
+#include <physfs.h>
+#include <zlib.h>
+
+#include <SDL_mutex.h>
+#include <SDL_atomic.h>
+#include <SDL_timer.h>
+#include <SDL_stdinc.h>
+
+#include <string.h>
+#include <vector>
+
+/* Read jobs the file list is split into */
+#define JOB_COUNT 4
+
+struct PackedFile
+{
+	std::string packed;
+	uint32_t size;
+};
+
+struct PackedLoadJob;
+
+struct PackedDataCachePrivate
+{
+	const uint32_t maxMemSize;
+
+	WorkerPool *pool;
+	std::vector<PackedLoadJob*> jobs;
+
+	/* Physical paths of all files to be read; fixed once
+	 * the jobs are running */
+	std::vector<std::string> paths;
+
+	/* Everything below is guarded by 'mutex' */
+	SDL_mutex *mutex;
+
+	/* Maps: normalized path,
+	 * to:   compressed contents */
+	BoostHash<std::string, PackedFile> files;
+
+	/* Rewritten files, not to be cached once their read finishes */
+	BoostSet<std::string> invalidated;
+
+	int fileCount;
+	uint32_t memSize;
+	uint64_t rawSize;
+	int skipped;
+
+	SDL_atomic_t quit;
+	SDL_atomic_t jobsLeft;
+	Uint64 startTicks;
+
+	PackedDataCachePrivate(uint32_t maxMemSize)
+	    : maxMemSize(maxMemSize),
+	      pool(0),
+	      mutex(SDL_CreateMutex()),
+	      fileCount(0),
+	      memSize(0),
+	      rawSize(0),
+	      skipped(0),
+	      startTicks(0)
+	{
+		SDL_AtomicSet(&quit, 0);
+		SDL_AtomicSet(&jobsLeft, 0);
+	}
+
+	~PackedDataCachePrivate();
+
+	void insert(const std::string &key, std::string &packed, uint32_t size)
+	{
+		SDL_LockMutex(mutex);
+
+		if (invalidated.contains(key) || files.contains(key))
+		{
+			SDL_UnlockMutex(mutex);
+			return;
+		}
+
+		if (memSize + packed.size() > maxMemSize)
+		{
+			++skipped;
+			SDL_UnlockMutex(mutex);
+			return;
+		}
+
+		PackedFile &file = files[key];
+		file.packed.swap(packed);
+		file.size = size;
+
+		++fileCount;
+		memSize += file.packed.size();
+		rawSize += size;
+		MemStats::add(MemStats::PackedData, file.packed.size());
+
+		SDL_UnlockMutex(mutex);
+	}
+
+	/* Called by whichever job finishes last */
+	void report()
+	{
+		SDL_LockMutex(mutex);
+
+		const double ms = (SDL_GetPerformanceCounter() - startTicks) * 1000.0
+		                / SDL_GetPerformanceFrequency();
+
+		Debug() << "Packed data cache:" << fileCount << "files,"
+		        << (int) (rawSize / 1024) << "KB ->" << (int) (memSize / 1024) << "KB"
+		        << "in" << (int) ms << "ms";
+
+		if (skipped > 0)
+			Debug() << "Packed data cache:" << skipped << "files over budget";
+
+		SDL_UnlockMutex(mutex);
+	}
+};
+
+struct PackedLoadJob : WorkerJob
+{
+	PackedDataCachePrivate *p;
+	size_t begin, end;
+
+	void run()
+	{
+		std::string raw, packed;
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (SDL_AtomicGet(&p->quit))
+				break;
+
+			load(p->paths[i], raw, packed);
+		}
+
+		if (SDL_AtomicDecRef(&p->jobsLeft))
+			p->report();
+	}
+
+	void load(const std::string &path, std::string &raw, std::string &packed)
+	{
+		PHYSFS_File *handle = PHYSFS_openRead(path.c_str());
+
+		if (!handle)
+			return;
+
+		const PHYSFS_sint64 length = PHYSFS_fileLength(handle);
+
+		if (length <= 0 || length > 0x7FFFFFFF)
+		{
+			PHYSFS_close(handle);
+			return;
+		}
+
+		raw.resize(length);
+		const PHYSFS_sint64 read = PHYSFS_readBytes(handle, &raw[0], length);
+		PHYSFS_close(handle);
+
+		if (read != length)
+			return;
+
+		uLongf packedSize = compressBound(length);
+		packed.resize(packedSize);
+
+		if (compress2((Bytef*) &packed[0], &packedSize,
+		              (const Bytef*) raw.data(), length, Z_BEST_SPEED) != Z_OK)
+			return;
+
+		packed.resize(packedSize);
+
+		p->insert(normalizedPath(path.c_str()), packed, length);
+	}
+};
+
+PackedDataCachePrivate::~PackedDataCachePrivate()
+{
+	/* Pending jobs run inline, and exit right away */
+	SDL_AtomicSet(&quit, 1);
+
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		pool->wait(*jobs[i]);
+		delete jobs[i];
+	}
+
+	MemStats::add(MemStats::PackedData, -(int64_t) memSize);
+
+	SDL_DestroyMutex(mutex);
+}
+
+static bool isDataFile(const char *name)
+{
+	static const char *exts[] = { ".rxdata", ".rvdata", ".rvdata2" };
+
+	const char *ext = strrchr(name, '.');
+
+	if (!ext)
+		return false;
+
+	for (size_t i = 0; i < ARRAY_SIZE(exts); ++i)
+		if (!SDL_strcasecmp(ext, exts[i]))
+			return true;
+
+	return false;
+}
+
+struct EnumData
+{
+	std::vector<std::string> &out;
+	bool dirs;
+
+	EnumData(std::vector<std::string> &out, bool dirs)
+	    : out(out), dirs(dirs)
+	{}
+};
+
+static PHYSFS_EnumerateCallbackResult
+enumCB(void *d, const char *dir, const char *fname)
+{
+	EnumData &data = *static_cast<EnumData*>(d);
+
+	if (data.dirs)
+	{
+		/* The data directory, in whatever case the game uses */
+		if (!SDL_strcasecmp(fname, "Data"))
+			data.out.push_back(fname);
+	}
+	else if (isDataFile(fname))
+	{
+		data.out.push_back(std::string(dir) + "/" + fname);
+	}
+
+	return PHYSFS_ENUM_OK;
+}
+
+PackedDataCache::PackedDataCache(uint32_t maxMemSize)
+{
+	p = new PackedDataCachePrivate(maxMemSize);
+}
+
+PackedDataCache::~PackedDataCache()
+{
+	delete p;
+}
+
+void PackedDataCache::start(WorkerPool &pool)
+{
+	if (p->maxMemSize == 0 || p->pool)
+		return;
+
+	if (!pool.enabled())
+	{
+		Debug() << "Packed data cache: needs decodeThreads > 0";
+		return;
+	}
+
+	p->pool = &pool;
+	p->startTicks = SDL_GetPerformanceCounter();
+
+	std::vector<std::string> dirs;
+	EnumData dirData(dirs, true);
+	PHYSFS_enumerate("", enumCB, &dirData);
+
+	EnumData fileData(p->paths, false);
+
+	for (size_t i = 0; i < dirs.size(); ++i)
+		PHYSFS_enumerate(dirs[i].c_str(), enumCB, &fileData);
+
+	if (p->paths.empty())
+		return;
+
+	const size_t count = std::min<size_t>(JOB_COUNT, p->paths.size());
+	const size_t perJob = (p->paths.size() + count - 1) / count;
+
+	SDL_AtomicSet(&p->jobsLeft, count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		PackedLoadJob *job = new PackedLoadJob;
+		job->p = p;
+		job->begin = i * perJob;
+		job->end = std::min(job->begin + perJob, p->paths.size());
+
+		p->jobs.push_back(job);
+	}
+
+	/* Only submitted once the list is complete */
+	for (size_t i = 0; i < p->jobs.size(); ++i)
+		pool.submit(*p->jobs[i]);
+}
+
+bool PackedDataCache::take(const char *path, std::string &data)
+{
+	if (!p->pool)
+		return false;
+
+	const std::string key = normalizedPath(path);
+	bool found = false;
+
+	SDL_LockMutex(p->mutex);
+
+	if (p->files.contains(key))
+	{
+		const PackedFile &file = p->files[key];
+
+		data.resize(file.size);
+		uLongf size = file.size;
+
+		found = uncompress((Bytef*) &data[0], &size,
+		                   (const Bytef*) file.packed.data(),
+		                   file.packed.size()) == Z_OK
+		     && size == file.size;
+	}
+
+	SDL_UnlockMutex(p->mutex);
+
+	return found;
+}
+
+void PackedDataCache::invalidate(const char *path)
+{
+	if (!p->pool)
+		return;
+
+	const std::string key = normalizedPath(path);
+
+	SDL_LockMutex(p->mutex);
+
+	if (p->files.contains(key))
+	{
+		const uint32_t bytes = p->files[key].packed.size();
+
+		--p->fileCount;
+		p->memSize -= bytes;
+		MemStats::add(MemStats::PackedData, -(int64_t) bytes);
+
+		p->files.remove(key);
+	}
+
+	p->invalidated.insert(key);
+
+	SDL_UnlockMutex(p->mutex);
+}
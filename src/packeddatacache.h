@@ -0,0 +1,58 @@
+/*
+** packeddatacache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PACKEDDATACACHE_H
+#define PACKEDDATACACHE_H
+
+#include <string>
+#include <stdint.h>
+
+class WorkerPool;
+struct PackedDataCachePrivate;
+
+/* Holds the game's Data/ files (maps, the database) in RAM,
+ * zlib compressed, so that map transfers don't have to wait
+ * on the memory card and archive decryption. The whole
+ * directory is read in the background right after the game
+ * archives have been mounted, on the worker pool. Files that
+ * don't fit into 'maxMemSize' (compressed) are left out */
+class PackedDataCache
+{
+public:
+	PackedDataCache(uint32_t maxMemSize);
+	~PackedDataCache();
+
+	/* Call once all paths are added to the file system */
+	void start(WorkerPool &pool);
+
+	/* Unpacks the contents of 'path' into 'data' if it has
+	 * been read already. Never waits on pending reads */
+	bool take(const char *path, std::string &data);
+
+	/* Forgets the copy of 'path', which is being rewritten */
+	void invalidate(const char *path);
+
+private:
+	PackedDataCachePrivate *p;
+};
+
+#endif // PACKEDDATACACHE_H
@@ -0,0 +1,444 @@
+/*
+** particlesystem.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "particlesystem.h"
+
+#include "sharedstate.h"
+#include "bitmap.h"
+#include "etc.h"
+#include "etc-internal.h"
+#include "util.h"
+
+#include "gl-util.h"
+#include "quad.h"
+#include "quadarray.h"
+#include "shader.h"
+#include "glstate.h"
+#include "profiler.h"
+
+#include <sigc++/connection.h>
+
+#include <vector>
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/* Upper limit of 'capacity' */
+#define MAX_PARTICLES 65536
+
+struct ParticleSystemPrivate
+{
+	Bitmap *bitmap;
+
+	int ox, oy;
+	BlendType blendType;
+	int capacity;
+	float gravity;
+	Rect *bounds;
+
+	/* Particle attributes, kept as separate arrays so
+	 * that update() can step several at once */
+	std::vector<float> x, y;
+	std::vector<float> vx, vy;
+	std::vector<float> opacity, fade;
+	std::vector<int> life;
+	std::vector<Vec4> color;
+	size_t count;
+
+	Vec2i sceneOffset;
+
+	ColorQuadArray quads;
+	bool quadsDirty;
+
+	EtcTemps tmp;
+
+	sigc::connection prepareCon;
+
+	ParticleSystemPrivate()
+	    : bitmap(0),
+	      ox(0), oy(0),
+	      blendType(BlendNormal),
+	      capacity(256),
+	      gravity(0),
+	      bounds(&tmp.rect),
+	      count(0),
+	      quadsDirty(false)
+	{
+		prepareCon = shState->prepareDraw.connect
+		        (sigc::mem_fun(this, &ParticleSystemPrivate::prepare));
+	}
+
+	~ParticleSystemPrivate()
+	{
+		prepareCon.disconnect();
+	}
+
+	void resize(size_t size)
+	{
+		x.resize(size);
+		y.resize(size);
+		vx.resize(size);
+		vy.resize(size);
+		opacity.resize(size);
+		fade.resize(size);
+		life.resize(size);
+		color.resize(size);
+	}
+
+	void move(size_t from, size_t to)
+	{
+		x[to] = x[from];
+		y[to] = y[from];
+		vx[to] = vx[from];
+		vy[to] = vy[from];
+		opacity[to] = opacity[from];
+		fade[to] = fade[from];
+		life[to] = life[from];
+		color[to] = color[from];
+	}
+
+	void integrate()
+	{
+		size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		const float32x4_t g = vdupq_n_f32(gravity);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t vy4 = vaddq_f32(vld1q_f32(&vy[i]), g);
+			vst1q_f32(&vy[i], vy4);
+
+			vst1q_f32(&x[i], vaddq_f32(vld1q_f32(&x[i]), vld1q_f32(&vx[i])));
+			vst1q_f32(&y[i], vaddq_f32(vld1q_f32(&y[i]), vy4));
+			vst1q_f32(&opacity[i], vsubq_f32(vld1q_f32(&opacity[i]), vld1q_f32(&fade[i])));
+		}
+#elif defined(__SSE2__)
+		const __m128 g = _mm_set1_ps(gravity);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 vy4 = _mm_add_ps(_mm_loadu_ps(&vy[i]), g);
+			_mm_storeu_ps(&vy[i], vy4);
+
+			_mm_storeu_ps(&x[i], _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_loadu_ps(&vx[i])));
+			_mm_storeu_ps(&y[i], _mm_add_ps(_mm_loadu_ps(&y[i]), vy4));
+			_mm_storeu_ps(&opacity[i], _mm_sub_ps(_mm_loadu_ps(&opacity[i]), _mm_loadu_ps(&fade[i])));
+		}
+#endif
+
+		for (; i < count; ++i)
+		{
+			vy[i] += gravity;
+			x[i] += vx[i];
+			y[i] += vy[i];
+			opacity[i] -= fade[i];
+		}
+	}
+
+	/* Drops expired particles, keeping the others in order */
+	void cull()
+	{
+		const bool bounded = bounds->width > 0 && bounds->height > 0;
+		const float bx1 = bounds->x + ox, by1 = bounds->y + oy;
+		const float bx2 = bx1 + bounds->width, by2 = by1 + bounds->height;
+
+		size_t alive = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (life[i] > 0 && --life[i] == 0)
+				continue;
+
+			if (opacity[i] <= 0)
+				continue;
+
+			if (bounded && (x[i] < bx1 || x[i] > bx2 || y[i] < by1 || y[i] > by2))
+				continue;
+
+			if (alive != i)
+				move(i, alive);
+
+			++alive;
+		}
+
+		count = alive;
+	}
+
+	void truncate(size_t size)
+	{
+		if (count <= size)
+			return;
+
+		count = size;
+		quadsDirty = true;
+	}
+
+	void updateQuads()
+	{
+		quads.resize(count);
+
+		if (nullOrDisposed(bitmap))
+			return;
+
+		const float bw = bitmap->width();
+		const float bh = bitmap->height();
+		const FloatRect texRect(0, 0, bw, bh);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			Vertex *vert = &quads.vertices[i*4];
+			const Vec4 &c = color[i];
+			const float alpha = clamp<float>(opacity[i], 0, 255) / 255.0f;
+
+			Quad::setTexPosRect(vert, texRect,
+			                    FloatRect(x[i] - ox, y[i] - oy, bw, bh));
+			Quad::setColor(vert, Vec4(c.x, c.y, c.z, c.w * alpha));
+		}
+
+		quads.commit();
+	}
+
+	void prepare()
+	{
+		if (quadsDirty)
+		{
+			updateQuads();
+			quadsDirty = false;
+		}
+	}
+
+	void markDirty()
+	{
+		quadsDirty = true;
+	}
+};
+
+ParticleSystem::ParticleSystem(Viewport *viewport)
+    : ViewportElement(viewport)
+{
+	p = new ParticleSystemPrivate;
+	onGeometryChange(scene->getGeometry());
+}
+
+ParticleSystem::~ParticleSystem()
+{
+	dispose();
+}
+
+DEF_ATTR_RD_SIMPLE(ParticleSystem, Bitmap,    Bitmap*, p->bitmap)
+DEF_ATTR_RD_SIMPLE(ParticleSystem, OX,        int,     p->ox)
+DEF_ATTR_RD_SIMPLE(ParticleSystem, OY,        int,     p->oy)
+DEF_ATTR_RD_SIMPLE(ParticleSystem, BlendType, int,     p->blendType)
+DEF_ATTR_RD_SIMPLE(ParticleSystem, Capacity,  int,     p->capacity)
+DEF_ATTR_RD_SIMPLE(ParticleSystem, Gravity,   float,   p->gravity)
+DEF_ATTR_RD_SIMPLE(ParticleSystem, Bounds,    Rect&,  *p->bounds)
+
+void ParticleSystem::setBitmap(Bitmap *value)
+{
+	guardDisposed();
+
+	if (p->bitmap == value)
+		return;
+
+	p->bitmap = value;
+	p->markDirty();
+	markSceneDirty();
+
+	if (!value)
+		return;
+
+	value->ensureNonMega();
+}
+
+void ParticleSystem::setOX(int value)
+{
+	guardDisposed();
+
+	if (p->ox == value)
+		return;
+
+	p->ox = value;
+	p->markDirty();
+	markSceneDirty();
+}
+
+void ParticleSystem::setOY(int value)
+{
+	guardDisposed();
+
+	if (p->oy == value)
+		return;
+
+	p->oy = value;
+	p->markDirty();
+	markSceneDirty();
+}
+
+void ParticleSystem::setBlendType(int value)
+{
+	guardDisposed();
+	markSceneDirty();
+
+	switch (value)
+	{
+	default :
+	case BlendNormal :
+		p->blendType = BlendNormal;
+		return;
+	case BlendAddition :
+		p->blendType = BlendAddition;
+		return;
+	case BlendSubstraction :
+		p->blendType = BlendSubstraction;
+		return;
+	}
+}
+
+void ParticleSystem::setCapacity(int value)
+{
+	guardDisposed();
+
+	p->capacity = clamp(value, 0, MAX_PARTICLES);
+
+	if (p->count > (size_t) p->capacity)
+	{
+		p->truncate(p->capacity);
+		markSceneDirty();
+	}
+}
+
+void ParticleSystem::setGravity(float value)
+{
+	guardDisposed();
+
+	p->gravity = value;
+}
+
+void ParticleSystem::setBounds(Rect &value)
+{
+	guardDisposed();
+
+	*p->bounds = value;
+}
+
+bool ParticleSystem::emit(float x, float y, float vx, float vy, int life,
+                          float opacity, float fade, const Color *color)
+{
+	guardDisposed();
+
+	if (p->count >= (size_t) p->capacity)
+		return false;
+
+	const size_t i = p->count++;
+
+	if (p->x.size() < p->count)
+		p->resize(std::max<size_t>(p->count, p->x.size() * 2));
+
+	p->x[i] = x;
+	p->y[i] = y;
+	p->vx[i] = vx;
+	p->vy[i] = vy;
+	p->life[i] = std::max(life, 0);
+	p->opacity[i] = opacity;
+	p->fade[i] = fade;
+	p->color[i] = color ? color->norm : Vec4(1, 1, 1, 1);
+
+	p->markDirty();
+	markSceneDirty();
+
+	return true;
+}
+
+int ParticleSystem::count() const
+{
+	guardDisposed();
+
+	return p->count;
+}
+
+void ParticleSystem::clear()
+{
+	guardDisposed();
+
+	if (p->count == 0)
+		return;
+
+	p->truncate(0);
+	markSceneDirty();
+}
+
+void ParticleSystem::update()
+{
+	guardDisposed();
+
+	if (p->count == 0)
+		return;
+
+	p->integrate();
+	p->cull();
+
+	p->markDirty();
+	markSceneDirty();
+}
+
+void ParticleSystem::initDynAttribs()
+{
+	p->bounds = new Rect;
+}
+
+void ParticleSystem::draw()
+{
+	PROFILE_SCOPE(Sprites);
+
+	if (nullOrDisposed(p->bitmap) || p->quads.count() == 0)
+		return;
+
+	ParticleShader &shader = shState->shaders().particle();
+
+	shader.bind();
+	shader.applyViewportProj();
+	shader.setTranslation(p->sceneOffset);
+
+	glState.blendMode.pushSet(p->blendType);
+
+	p->bitmap->bindTex(shader);
+	p->quads.draw();
+
+	glState.blendMode.pop();
+}
+
+void ParticleSystem::onGeometryChange(const Scene::Geometry &geo)
+{
+	p->sceneOffset = geo.offset();
+}
+
+void ParticleSystem::releaseResources()
+{
+	unlink();
+
+	delete p;
+}
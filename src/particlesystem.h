@@ -0,0 +1,82 @@
+/*
+** particlesystem.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PARTICLESYSTEM_H
+#define PARTICLESYSTEM_H
+
+#include "disposable.h"
+#include "viewport.h"
+
+class Bitmap;
+struct Color;
+struct Rect;
+
+struct ParticleSystemPrivate;
+
+/* Any number of particles sharing one bitmap, simulated
+ * natively and drawn with a single call. Each particle moves
+ * by its velocity (plus the common 'gravity', accelerating
+ * it downwards) and loses 'fade' opacity per update, and is
+ * removed once its lifetime ends, it is fully faded or it
+ * left the (non-empty) 'bounds'. Particles are positioned
+ * like sprites with their origin at 'ox', 'oy' */
+class ParticleSystem : public ViewportElement, public Disposable
+{
+public:
+	ParticleSystem(Viewport *viewport = 0);
+	~ParticleSystem();
+
+	DECL_ATTR( Bitmap,    Bitmap* )
+	DECL_ATTR( OX,        int     )
+	DECL_ATTR( OY,        int     )
+	DECL_ATTR( BlendType, int     )
+	DECL_ATTR( Capacity,  int     )
+	DECL_ATTR( Gravity,   float   )
+	DECL_ATTR( Bounds,    Rect&   )
+
+	/* Adds a particle living for 'life' updates (forever if
+	 * not positive). 'color' tints it, with its alpha scaling
+	 * the opacity. Returns false if 'capacity' is reached */
+	bool emit(float x, float y, float vx, float vy, int life,
+	          float opacity = 255, float fade = 0, const Color *color = 0);
+
+	int count() const;
+	void clear();
+
+	/* Advances every particle by one frame */
+	void update();
+
+	void initDynAttribs();
+
+private:
+	ParticleSystemPrivate *p;
+
+	void draw();
+	void onGeometryChange(const Scene::Geometry &);
+
+	void releaseResources();
+	const char *klassName() const { return "particle system"; }
+
+	ABOUT_TO_ACCESS_DISP
+};
+
+#endif // PARTICLESYSTEM_H
@@ -0,0 +1,296 @@
+/*
+** pcmcache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pcmcache.h"
+
+#include "aldatasource.h"
+#include "al-util.h"
+#include "boost-hash.h"
+#include "memstats.h"
+
+#include <SDL_sound.h>
+
+#include <list>
+#include <algorithm>
+
+struct PcmData
+{
+	std::string samples;
+
+	ALenum alFormat;
+	int rate;
+	uint32_t frameSize;
+	uint32_t frames;
+
+	/* Held by the cache and every source playing it */
+	uint32_t refCount;
+
+	PcmData()
+	    : alFormat(0), rate(0), frameSize(0), frames(0), refCount(1)
+	{}
+
+	static PcmData *ref(PcmData *data)
+	{
+		++data->refCount;
+
+		return data;
+	}
+
+	static void deref(PcmData *data)
+	{
+		if (--data->refCount == 0)
+			delete data;
+	}
+
+private:
+	~PcmData()
+	{
+		MemStats::add(MemStats::DecodedMEs, -(int64_t) samples.size());
+	}
+};
+
+/* Plays back PcmData like the in-memory path of VorbisSource;
+ * buffers are uploaded straight from the decoded samples */
+struct PcmSource : ALDataSource
+{
+	PcmData *data;
+	bool looped;
+	uint32_t bufFrames;
+	uint32_t currentFrame;
+
+	PcmSource(PcmData *data, bool looped, uint32_t bufSize)
+	    : data(PcmData::ref(data)),
+	      looped(looped),
+	      currentFrame(0)
+	{
+		/* 'bufSize' is in samples, as with the other sources */
+		bufFrames = std::max<uint32_t>(1, bufSize * sizeof(int16_t) / data->frameSize);
+	}
+
+	~PcmSource()
+	{
+		PcmData::deref(data);
+	}
+
+	Status fillBuffer(AL::Buffer::ID alBuffer)
+	{
+		uint32_t frames = std::min(bufFrames, data->frames - currentFrame);
+
+		AL::Buffer::uploadData(alBuffer, data->alFormat,
+		                       &data->samples[currentFrame * data->frameSize],
+		                       frames * data->frameSize, data->rate);
+
+		currentFrame += frames;
+
+		if (currentFrame < data->frames)
+			return ALDataSource::NoError;
+
+		if (!looped)
+			return ALDataSource::EndOfStream;
+
+		currentFrame = 0;
+
+		return ALDataSource::WrapAround;
+	}
+
+	int sampleRate()
+	{
+		return data->rate;
+	}
+
+	void seekToOffset(float seconds)
+	{
+		currentFrame = std::max(seconds, 0.0f) * data->rate;
+
+		if (currentFrame >= data->frames)
+			currentFrame = 0;
+	}
+
+	uint32_t loopStartFrames()
+	{
+		return 0;
+	}
+
+	bool setPitch(float)
+	{
+		return false;
+	}
+};
+
+struct CacheNode
+{
+	std::string key;
+	PcmData *data;
+};
+
+typedef std::list<CacheNode> NodeList;
+
+struct PcmCachePrivate
+{
+	/* Sorted by last use, most recent first */
+	NodeList lru;
+	BoostHash<std::string, NodeList::iterator> hash;
+
+	const uint32_t maxBytes;
+	uint32_t bytes;
+
+	PcmCachePrivate(uint32_t maxBytes)
+	    : maxBytes(maxBytes),
+	      bytes(0)
+	{}
+
+	void evictLast()
+	{
+		CacheNode &node = lru.back();
+
+		bytes -= node.data->samples.size();
+
+		PcmData::deref(node.data);
+		hash.remove(node.key);
+		lru.pop_back();
+	}
+
+	/* Returns null if the decoded samples
+	 * would exceed 'maxBytes' */
+	PcmData *decode(const std::string &file, const char *ext)
+	{
+		SDL_RWops *ops = SDL_RWFromConstMem(file.c_str(), file.size());
+		Sound_Sample *sample = Sound_NewSample(ops, ext, 0, STREAM_BUF_SIZE);
+
+		if (!sample)
+		{
+			SDL_RWclose(ops);
+			return 0;
+		}
+
+		PcmData *data = new PcmData;
+		bool ok = true;
+
+		while (!(sample->flags & (SOUND_SAMPLEFLAG_EOF | SOUND_SAMPLEFLAG_ERROR)))
+		{
+			uint32_t decoded = Sound_Decode(sample);
+
+			if (data->samples.size() + decoded > maxBytes
+			||  (sample->flags & SOUND_SAMPLEFLAG_ERROR))
+			{
+				ok = false;
+				break;
+			}
+
+			data->samples.append((const char*) sample->buffer, decoded);
+		}
+
+		uint8_t sampleSize = formatSampleSize(sample->actual.format);
+
+		data->alFormat = chooseALFormat(sampleSize, sample->actual.channels);
+		data->rate = sample->actual.rate;
+		data->frameSize = sampleSize * sample->actual.channels;
+		data->frames = data->samples.size() / data->frameSize;
+
+		/* This also closes 'ops' */
+		Sound_FreeSample(sample);
+
+		MemStats::add(MemStats::DecodedMEs, data->samples.size());
+
+		if (!ok || data->frames == 0)
+		{
+			PcmData::deref(data);
+			return 0;
+		}
+
+		return data;
+	}
+};
+
+PcmCache::PcmCache(uint32_t maxBytes)
+{
+	p = new PcmCachePrivate(maxBytes);
+}
+
+PcmCache::~PcmCache()
+{
+	clear();
+
+	delete p;
+}
+
+bool PcmCache::enabled() const
+{
+	return p->maxBytes > 0;
+}
+
+ALDataSource *PcmCache::open(const std::string &filename,
+                             bool looped, uint32_t bufSize)
+{
+	if (!p->hash.contains(filename))
+		return 0;
+
+	NodeList::iterator iter = p->hash[filename];
+	p->lru.splice(p->lru.begin(), p->lru, iter);
+
+	return new PcmSource(iter->data, looped, bufSize);
+}
+
+ALDataSource *PcmCache::load(const std::string &filename,
+                             SDL_RWops &ops, const char *ext,
+                             bool looped, uint32_t bufSize)
+{
+	Sint64 size = SDL_RWsize(&ops);
+
+	/* Files beyond the limit won't fit once decoded either */
+	if (size <= 0 || size > p->maxBytes || p->hash.contains(filename))
+		return 0;
+
+	std::string file(size, '\0');
+	size_t read = SDL_RWread(&ops, &file[0], 1, size);
+	SDL_RWseek(&ops, 0, RW_SEEK_SET);
+
+	if (read != (size_t) size)
+		return 0;
+
+	PcmData *data = p->decode(file, ext);
+
+	if (!data)
+		return 0;
+
+	SDL_RWclose(&ops);
+
+	const uint32_t dataBytes = data->samples.size();
+
+	while (p->bytes + dataBytes > p->maxBytes)
+		p->evictLast();
+
+	CacheNode node;
+	node.key = filename;
+	node.data = data;
+
+	p->lru.push_front(node);
+	p->hash.insert(filename, p->lru.begin());
+	p->bytes += dataBytes;
+
+	return new PcmSource(data, looped, bufSize);
+}
+
+void PcmCache::clear()
+{
+	while (!p->lru.empty())
+		p->evictLast();
+}
@@ -0,0 +1,67 @@
+/*
+** pcmcache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include <SDL_rwops.h>
+
+#include <string>
+#include <stdint.h>
+
+struct ALDataSource;
+struct PcmCachePrivate;
+
+/* Keeps short audio files completely decoded in memory once
+ * played, so that playing them again starts right away, without
+ * any file I/O or decoding. Meant for MEs, which are short and
+ * repeat all the time. Entries are keyed by the requested file
+ * name, and dropped least recently played first once their
+ * combined size would exceed 'maxBytes'. Sources handed out keep
+ * their data alive on their own. Not thread safe */
+class PcmCache
+{
+public:
+	PcmCache(uint32_t maxBytes);
+	~PcmCache();
+
+	bool enabled() const;
+
+	/* Returns a source playing the cached decoding
+	 * of 'filename', or null if there is none */
+	ALDataSource *open(const std::string &filename,
+	                   bool looped, uint32_t bufSize);
+
+	/* Decodes the file in 'ops' completely and adds it as
+	 * 'filename'. Returns a source playing it (with 'ops' closed),
+	 * or null with 'ops' rewound if the file is too large to be
+	 * cached or can't be decoded this way */
+	ALDataSource *load(const std::string &filename,
+	                   SDL_RWops &ops, const char *ext,
+	                   bool looped, uint32_t bufSize);
+
+	void clear();
+
+private:
+	PcmCachePrivate *p;
+};
+
+#endif // PCMCACHE_H
@@ -28,14 +28,18 @@
 
 #include "gl-util.h"
 #include "quad.h"
-#include "quadarray.h"
 #include "transform.h"
 #include "etc-internal.h"
 #include "shader.h"
 #include "glstate.h"
+#include "profiler.h"
+#include "scenecapture.h"
 
 #include <sigc++/connection.h>
 
+#include <math.h>
+#include <algorithm>
+
 static float fwrap(float value, float range)
 {
 	float res = fmod(value, range);
@@ -56,9 +60,16 @@ struct PlanePrivate
 
 	Scene::Geometry sceneGeo;
 
+	/* Whether 'quad' relies on texture repeat; otherwise
+	 * the bitmap is wrapped by the fragment shader */
+	bool repeat;
+
+	/* Scroll offset of the shader wrapped quad */
+	Vec2 wrapOffset;
+
 	bool quadSourceDirty;
 
-	SimpleQuadArray qArray;
+	Quad quad;
 
 	EtcTemps tmp;
 
@@ -72,12 +83,11 @@ struct PlanePrivate
 	      tone(&tmp.tone),
 	      ox(0), oy(0),
 	      zoomX(1), zoomY(1),
+	      repeat(false),
 	      quadSourceDirty(false)
 	{
 		prepareCon = shState->prepareDraw.connect
 		        (sigc::mem_fun(this, &PlanePrivate::prepare));
-
-		qArray.resize(1);
 	}
 
 	~PlanePrivate()
@@ -85,9 +95,26 @@ struct PlanePrivate
 		prepareCon.disconnect();
 	}
 
+	/* Pooled textures may be larger than their bitmap,
+	 * in which case it has to be wrapped in the shader */
+	bool canRepeat()
+	{
+		if (!gl.npot_repeat)
+			return false;
+
+		return !bitmap->texturePadded();
+	}
+
 	void updateQuadSource()
 	{
-		if (gl.npot_repeat)
+		if (nullOrDisposed(bitmap))
+			return;
+
+		repeat = canRepeat();
+
+		quad.setPosRect(FloatRect(sceneGeo.rect));
+
+		if (repeat)
 		{
 			FloatRect srcRect;
 			srcRect.x = (sceneGeo.orig.x + ox) / zoomX;
@@ -95,45 +122,32 @@ struct PlanePrivate
 			srcRect.w = sceneGeo.rect.w / zoomX;
 			srcRect.h = sceneGeo.rect.h / zoomY;
 
-			Quad::setTexRect(&qArray.vertices[0], srcRect);
-			qArray.commit();
+			quad.setTexRect(srcRect);
 
 			return;
 		}
 
-		if (nullOrDisposed(bitmap))
-			return;
-
-		/* Scaled (zoomed) bitmap dimensions */
-		float sw = bitmap->width()  * zoomX;
-		float sh = bitmap->height() * zoomY;
-
-		/* Plane offset wrapped by scaled bitmap dims */
-		float wox = fwrap(ox, sw);
-		float woy = fwrap(oy, sh);
-
-		/* Viewport dimensions */
-		int vpw = sceneGeo.rect.w;
-		int vph = sceneGeo.rect.h;
-
-		/* Amount the scaled bitmap is tiled (repeated) */
-		size_t tilesX = ceil((vpw - sw + wox) / sw) + 1;
-		size_t tilesY = ceil((vph - sh + woy) / sh) + 1;
-
-		FloatRect tex = bitmap->rect();
+		/* Scrolling only moves the offset uniform, so the
+		 * quad covers the bitmap from its origin. Both are
+		 * wrapped to keep the shader's coordinates small */
+		const float bw = bitmap->width();
+		const float bh = bitmap->height();
 
-		qArray.resize(tilesX * tilesY);
+		FloatRect srcRect;
+		srcRect.x = fwrap(sceneGeo.orig.x / zoomX, bw);
+		srcRect.y = fwrap(sceneGeo.orig.y / zoomY, bh);
+		srcRect.w = sceneGeo.rect.w / zoomX;
+		srcRect.h = sceneGeo.rect.h / zoomY;
 
-		for (size_t y = 0; y < tilesY; ++y)
-			for (size_t x = 0; x < tilesX; ++x)
-			{
-				SVertex *vert = &qArray.vertices[(y*tilesX + x) * 4];
-				FloatRect pos(x*sw - wox, y*sh - woy, sw, sh);
+		quad.setTexRect(srcRect);
 
-				Quad::setTexPosRect(vert, tex, pos);
-			}
+		updateWrapOffset();
+	}
 
-		qArray.commit();
+	void updateWrapOffset()
+	{
+		wrapOffset.x = fwrap(ox / zoomX, bitmap->width());
+		wrapOffset.y = fwrap(oy / zoomY, bitmap->height());
 	}
 
 	void prepare()
@@ -161,9 +175,9 @@ DEF_ATTR_RD_SIMPLE(Plane, ZoomX,     float,   p->zoomX)
 DEF_ATTR_RD_SIMPLE(Plane, ZoomY,     float,   p->zoomY)
 DEF_ATTR_RD_SIMPLE(Plane, BlendType, int,     p->blendType)
 
-DEF_ATTR_SIMPLE(Plane, Opacity,   int,     p->opacity)
-DEF_ATTR_SIMPLE(Plane, Color,     Color&, *p->color)
-DEF_ATTR_SIMPLE(Plane, Tone,      Tone&,  *p->tone)
+DEF_ATTR_SCENE(Plane, Opacity,   int,     p->opacity)
+DEF_ATTR_SCENE(Plane, Color,     Color&, *p->color)
+DEF_ATTR_SCENE(Plane, Tone,      Tone&,  *p->tone)
 
 Plane::~Plane()
 {
@@ -175,6 +189,8 @@ void Plane::setBitmap(Bitmap *value)
 	guardDisposed();
 
 	p->bitmap = value;
+	p->quadSourceDirty = true;
+	markSceneDirty();
 
 	if (!value)
 		return;
@@ -190,7 +206,13 @@ void Plane::setOX(int value)
 	        return;
 
 	p->ox = value;
-	p->quadSourceDirty = true;
+
+	if (p->repeat)
+		p->quadSourceDirty = true;
+	else if (!nullOrDisposed(p->bitmap))
+		p->updateWrapOffset();
+
+	markSceneDirty();
 }
 
 void Plane::setOY(int value)
@@ -201,7 +223,13 @@ void Plane::setOY(int value)
 	        return;
 
 	p->oy = value;
-	p->quadSourceDirty = true;
+
+	if (p->repeat)
+		p->quadSourceDirty = true;
+	else if (!nullOrDisposed(p->bitmap))
+		p->updateWrapOffset();
+
+	markSceneDirty();
 }
 
 void Plane::setZoomX(float value)
@@ -213,6 +241,7 @@ void Plane::setZoomX(float value)
 
 	p->zoomX = value;
 	p->quadSourceDirty = true;
+	markSceneDirty();
 }
 
 void Plane::setZoomY(float value)
@@ -224,11 +253,13 @@ void Plane::setZoomY(float value)
 
 	p->zoomY = value;
 	p->quadSourceDirty = true;
+	markSceneDirty();
 }
 
 void Plane::setBlendType(int value)
 {
 	guardDisposed();
+	markSceneDirty();
 
 	switch (value)
 	{
@@ -253,17 +284,45 @@ void Plane::initDynAttribs()
 
 void Plane::draw()
 {
+	PROFILE_SCOPE(Planes);
+
 	if (nullOrDisposed(p->bitmap))
 		return;
 
 	if (!p->opacity)
 		return;
 
+	if (!p->repeat)
+	{
+		PlaneWrapShader &shader = shState->shaders().planeWrap();
+
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setTranslation(Vec2i());
+		shader.setTone(p->tone->norm);
+		shader.setColor(p->color->norm);
+		shader.setFlash(Vec4());
+		shader.setOpacity(p->opacity.norm);
+		shader.setBitmapSize(Vec2i(p->bitmap->width(), p->bitmap->height()));
+		shader.setOffset(p->wrapOffset);
+
+		glState.blendMode.pushSet(p->blendType);
+
+		p->bitmap->bindTex(shader);
+		shader.setTexSize(p->bitmap->textureSize());
+
+		p->quad.draw();
+
+		glState.blendMode.pop();
+
+		return;
+	}
+
 	ShaderBase *base;
 
 	if (p->color->hasEffect() || p->tone->hasEffect() || p->opacity != 255)
 	{
-		PlaneShader &shader = shState->shaders().plane;
+		PlaneShader &shader = shState->shaders().plane();
 
 		shader.bind();
 		shader.applyViewportProj();
@@ -276,7 +335,7 @@ void Plane::draw()
 	}
 	else
 	{
-		SimpleShader &shader = shState->shaders().simple;
+		SimpleShader &shader = shState->shaders().simple();
 
 		shader.bind();
 		shader.applyViewportProj();
@@ -287,28 +346,35 @@ void Plane::draw()
 
 	glState.blendMode.pushSet(p->blendType);
 
-	p->bitmap->bindTex(*base);
+	const float zoom = std::min(fabs(p->zoomX), fabs(p->zoomY));
+	const bool mipmapped = p->bitmap->useMipmaps(zoom);
 
-	if (gl.npot_repeat)
-		TEX::setRepeat(true);
+	if (mipmapped)
+		p->bitmap->bindTexMipmapped(*base);
+	else
+		p->bitmap->bindTex(*base);
 
-	p->qArray.draw();
+	TEX::setRepeat(true);
+	p->quad.draw();
+	TEX::setRepeat(false);
 
-	if (gl.npot_repeat)
-		TEX::setRepeat(false);
+	if (mipmapped)
+		TEX::setMipmapped(false);
 
 	glState.blendMode.pop();
 }
 
 void Plane::onGeometryChange(const Scene::Geometry &geo)
 {
-	if (gl.npot_repeat)
-		Quad::setPosRect(&p->qArray.vertices[0], FloatRect(geo.rect));
-
 	p->sceneGeo = geo;
 	p->quadSourceDirty = true;
 }
 
+void Plane::capture(SceneCapture &c)
+{
+	c.plane(*this);
+}
+
 void Plane::releaseResources()
 {
 	unlink();
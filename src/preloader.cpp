@@ -0,0 +1,314 @@
+/*
+** preloader.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "preloader.h"
+
+#include "filesystem.h"
+#include "exception.h"
+#include "boost-hash.h"
+#include "sdl-util.h"
+#include "profiler.h"
+#include "util.h"
+
+#include <SDL_image.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include <deque>
+
+struct PreloadItem
+{
+	/* Still queued or being loaded */
+	bool pending;
+
+	SDL_Surface *image;
+	std::string data;
+	std::string ext;
+
+	PreloadItem()
+	    : pending(true),
+	      image(0)
+	{}
+};
+
+static bool isImageExt(std::string ext)
+{
+	static const char *imageExts[] =
+	{
+		"png", "jpg", "jpeg", "bmp", "gif", "tga", "tif", "tiff", "webp"
+	};
+
+	for (size_t i = 0; i < ext.size(); ++i)
+		ext[i] = tolower(ext[i]);
+
+	for (size_t i = 0; i < ARRAY_SIZE(imageExts); ++i)
+		if (ext == imageExts[i])
+			return true;
+
+	return false;
+}
+
+static uint32_t itemSize(const PreloadItem &item)
+{
+	if (item.image)
+		return item.image->w * item.image->h * 4;
+
+	return item.data.size();
+}
+
+static void freeItem(PreloadItem &item)
+{
+	if (item.image)
+		SDL_FreeSurface(item.image);
+}
+
+struct PreloaderPrivate
+{
+	FileSystem &fs;
+	const uint32_t maxMemSize;
+
+	/* Everything below is guarded by 'mutex' */
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+
+	/* Maps: normalized path,
+	 * to:   loaded (or pending) asset */
+	BoostHash<std::string, PreloadItem> items;
+	std::deque<std::string> queue;
+
+	/* Loaded bytes not yet handed out */
+	uint32_t memSize;
+
+	SDL_Thread *thread;
+	bool quit;
+
+	PreloaderPrivate(FileSystem &fs, uint32_t maxMemSize)
+	    : fs(fs),
+	      maxMemSize(maxMemSize),
+	      mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      memSize(0),
+	      thread(0),
+	      quit(false)
+	{}
+
+	~PreloaderPrivate()
+	{
+		SDL_LockMutex(mutex);
+		quit = true;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+
+		if (thread)
+			SDL_WaitThread(thread, 0);
+
+		BoostHash<std::string, PreloadItem>::const_iterator iter;
+
+		for (iter = items.cbegin(); iter != items.cend(); ++iter)
+			if (iter->second.image)
+				SDL_FreeSurface(iter->second.image);
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
+	}
+
+	/* Mutex must be held */
+	void dropItem(const std::string &key)
+	{
+		PreloadItem &item = items[key];
+
+		memSize -= itemSize(item);
+		items.remove(key);
+	}
+
+	bool load(const std::string &key, PreloadItem &result)
+	{
+		FileSystem::ReadAllHandler handler;
+
+		try
+		{
+			fs.openRead(handler, key.c_str());
+		}
+		catch (const Exception &)
+		{
+			return false;
+		}
+
+		result.ext = handler.ext;
+
+		if (!isImageExt(handler.ext))
+		{
+			result.data.swap(handler.data);
+			return true;
+		}
+
+		SDL_RWops *ops = SDL_RWFromConstMem(handler.data.c_str(), handler.data.size());
+		SDL_Surface *surf = IMG_LoadTyped_RW(ops, 1, handler.ext.c_str());
+
+		if (!surf)
+			return false;
+
+		if (surf->format->format != SDL_PIXELFORMAT_ABGR8888)
+		{
+			SDL_Surface *conv = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ABGR8888, 0);
+			SDL_FreeSurface(surf);
+			surf = conv;
+		}
+
+		result.image = surf;
+
+		return surf != 0;
+	}
+
+	void worker()
+	{
+		SDL_LockMutex(mutex);
+
+		while (true)
+		{
+			while (queue.empty() && !quit)
+				SDL_CondWait(cond, mutex);
+
+			if (quit)
+				break;
+
+			std::string key = queue.front();
+			queue.pop_front();
+
+			bool overBudget = memSize >= maxMemSize;
+
+			SDL_UnlockMutex(mutex);
+
+			PreloadItem result;
+			bool loaded;
+
+			{
+				TRACE_SCOPE("Preloader::load");
+				loaded = !overBudget && load(key, result);
+			}
+
+			SDL_LockMutex(mutex);
+
+			result.pending = false;
+
+			if (!loaded || !items.contains(key))
+			{
+				freeItem(result);
+				items.remove(key);
+			}
+			else
+			{
+				items[key] = result;
+				memSize += itemSize(result);
+			}
+
+			SDL_CondBroadcast(cond);
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+};
+
+Preloader::Preloader(FileSystem &fs, uint32_t maxMemSize)
+{
+	p = new PreloaderPrivate(fs, maxMemSize);
+}
+
+Preloader::~Preloader()
+{
+	delete p;
+}
+
+void Preloader::enqueue(const char *path)
+{
+	if (p->maxMemSize == 0)
+		return;
+
+	std::string key = normalizedPath(path);
+
+	SDL_LockMutex(p->mutex);
+
+	if (!p->items.contains(key))
+	{
+		p->items.insert(key, PreloadItem());
+		p->queue.push_back(key);
+
+		/* Only spawn the thread once it's actually used */
+		if (!p->thread)
+			p->thread = createSDLThread
+			        <PreloaderPrivate, &PreloaderPrivate::worker>(p, "preloader");
+
+		SDL_CondBroadcast(p->cond);
+	}
+
+	SDL_UnlockMutex(p->mutex);
+}
+
+SDL_Surface *Preloader::takeImage(const char *path)
+{
+	std::string key = normalizedPath(path);
+	SDL_Surface *image = 0;
+
+	TRACE_SCOPE("Preloader::takeImage");
+
+	SDL_LockMutex(p->mutex);
+
+	while (p->items.contains(key) && p->items[key].pending)
+		SDL_CondWait(p->cond, p->mutex);
+
+	if (p->items.contains(key) && p->items[key].image)
+	{
+		image = p->items[key].image;
+		p->dropItem(key);
+	}
+
+	SDL_UnlockMutex(p->mutex);
+
+	return image;
+}
+
+bool Preloader::takeData(const char *path, std::string &data, std::string &ext)
+{
+	std::string key = normalizedPath(path);
+	bool found = false;
+
+	SDL_LockMutex(p->mutex);
+
+	if (p->items.contains(key))
+	{
+		PreloadItem &item = p->items[key];
+
+		if (!item.pending && !item.image)
+		{
+			p->memSize -= itemSize(item);
+
+			data.swap(item.data);
+			ext = item.ext;
+			p->items.remove(key);
+			found = true;
+		}
+	}
+
+	SDL_UnlockMutex(p->mutex);
+
+	return found;
+}
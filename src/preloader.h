@@ -0,0 +1,62 @@
+/*
+** preloader.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PRELOADER_H
+#define PRELOADER_H
+
+#include <string>
+#include <stdint.h>
+
+struct SDL_Surface;
+class FileSystem;
+struct PreloaderPrivate;
+
+/* Loads assets on a worker thread ahead of their use, so that
+ * scene changes don't stall on file access and image decoding.
+ * Images are kept decoded (as ABGR8888 surfaces ready for
+ * upload), everything else as the raw file contents. Paths are
+ * matched the way the game requests them, case insensitively.
+ * Each preloaded asset is handed out once, then forgotten */
+class Preloader
+{
+public:
+	Preloader(FileSystem &fs, uint32_t maxMemSize);
+	~Preloader();
+
+	/* Queues 'path' for loading. Requests exceeding
+	 * the memory budget are dropped */
+	void enqueue(const char *path);
+
+	/* Hands over the preloaded image for 'path', waiting
+	 * for it if it's still being loaded. Returns null if
+	 * the path wasn't preloaded or isn't an image */
+	SDL_Surface *takeImage(const char *path);
+
+	/* Hands over the raw contents of 'path' if they have
+	 * already been loaded; never waits */
+	bool takeData(const char *path, std::string &data, std::string &ext);
+
+private:
+	PreloaderPrivate *p;
+};
+
+#endif // PRELOADER_H
@@ -0,0 +1,355 @@
+/*
+** profiler.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "profiler.h"
+
+#include <SDL_mutex.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+static const char *sectionNames[] =
+{
+	"script",
+	"composite",
+	"sprites",
+	"planes",
+	"windows",
+	"tilemaps",
+	"tilemap_prepare",
+	"bitmap_ops",
+	"tex_upload",
+	"audio_fill",
+	"swap_wait",
+	"script_gc",
+	"gpu_composite",
+	"gpu_viewport",
+	"gpu_blit",
+	"gpu_transition"
+};
+
+bool Profiler::enabled = false;
+SDL_atomic_t Profiler::tracing;
+
+/* Microseconds of the frame in progress; atomic, as
+ * the audio stream threads add to it as well */
+static SDL_atomic_t current[Profiler::SectionCount];
+
+/* Nesting depth of each section */
+static int depth[Profiler::SectionCount];
+
+static float frames[PROFILER_FRAMES][Profiler::SectionCount];
+static int nextFrame = 0;
+static int frameCount = 0;
+
+static uint64_t scriptStart = 0;
+static SDL_atomic_t overlay;
+
+/* Bounds the memory a forgotten trace can take up */
+#define TRACE_MAX_EVENTS (1 << 20)
+
+struct TraceEvent
+{
+	const char *name;
+	SDL_threadID thread;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct TraceState
+{
+	SDL_mutex *mutex;
+
+	std::vector<TraceEvent> events;
+	std::vector<std::pair<SDL_threadID, std::string> > threads;
+
+	uint64_t start;
+
+	TraceState()
+	    : mutex(SDL_CreateMutex()),
+	      start(0)
+	{}
+
+	~TraceState()
+	{
+		SDL_DestroyMutex(mutex);
+	}
+};
+
+/* Thread names are registered before main() might create the
+ * mutex otherwise, so construct on first use */
+static TraceState &traceState()
+{
+	static TraceState *state = new TraceState;
+
+	return *state;
+}
+
+static uint64_t frameStart = 0;
+
+static uint64_t ticksToUS(uint64_t ticks)
+{
+	return ticks * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+void Profiler::setEnabled(bool value)
+{
+	enabled = value;
+	scriptStart = 0;
+}
+
+const char *Profiler::sectionName(int section)
+{
+	return sectionNames[section];
+}
+
+void Profiler::addTime(Section s, uint64_t us)
+{
+	if (enabled)
+		SDL_AtomicAdd(&current[s], us);
+}
+
+bool Profiler::enter(Section s)
+{
+	/* Concurrent streams never nest their fills */
+	if (s == AudioFill)
+		return true;
+
+	return depth[s]++ == 0;
+}
+
+void Profiler::leave(Section s, uint64_t start)
+{
+	SDL_AtomicAdd(&current[s], ticksToUS(SDL_GetPerformanceCounter() - start));
+
+	if (isTracing())
+		traceEvent(sectionNames[s], start);
+
+	if (s != AudioFill)
+		--depth[s];
+}
+
+void Profiler::frameBegin()
+{
+	if (!enabled)
+		return;
+
+	frameStart = SDL_GetPerformanceCounter();
+
+	if (!scriptStart)
+		return;
+
+	SDL_AtomicAdd(&current[Script], ticksToUS(frameStart - scriptStart));
+
+	if (isTracing())
+		traceEvent(sectionNames[Script], scriptStart);
+}
+
+void Profiler::frameEnd()
+{
+	if (!enabled)
+		return;
+
+	if (isTracing())
+		traceEvent("Graphics.update", frameStart);
+
+	float *frame = frames[nextFrame];
+
+	for (int i = 0; i < SectionCount; ++i)
+		frame[i] = SDL_AtomicSet(&current[i], 0) / 1000.f;
+
+	nextFrame = (nextFrame + 1) % PROFILER_FRAMES;
+	frameCount = frameCount < PROFILER_FRAMES ? frameCount + 1 : PROFILER_FRAMES;
+
+	scriptStart = SDL_GetPerformanceCounter();
+}
+
+void Profiler::averages(float out[SectionCount], int count)
+{
+	memset(out, 0, sizeof(float) * SectionCount);
+
+	count = count < frameCount ? count : frameCount;
+
+	if (count == 0)
+		return;
+
+	for (int j = 1; j <= count; ++j)
+	{
+		const float *frame = frames[(nextFrame - j + PROFILER_FRAMES) % PROFILER_FRAMES];
+
+		for (int i = 0; i < SectionCount; ++i)
+			out[i] += frame[i];
+	}
+
+	for (int i = 0; i < SectionCount; ++i)
+		out[i] /= count;
+}
+
+bool Profiler::dumpJSON(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+
+	if (!f)
+		return false;
+
+	fprintf(f, "{\n\t\"unit\": \"ms\",\n\t\"sections\": [");
+
+	for (int i = 0; i < SectionCount; ++i)
+		fprintf(f, "%s\"%s\"", i ? ", " : "", sectionNames[i]);
+
+	fprintf(f, "],\n\t\"frames\": [\n");
+
+	for (int j = 0; j < frameCount; ++j)
+	{
+		const int index = (nextFrame - frameCount + j + PROFILER_FRAMES) % PROFILER_FRAMES;
+
+		fprintf(f, "\t\t[");
+
+		for (int i = 0; i < SectionCount; ++i)
+			fprintf(f, "%s%.3f", i ? ", " : "", frames[index][i]);
+
+		fprintf(f, "]%s\n", j + 1 < frameCount ? "," : "");
+	}
+
+	fprintf(f, "\t]\n}\n");
+
+	return fclose(f) == 0;
+}
+
+bool Profiler::overlayVisible()
+{
+	return enabled && SDL_AtomicGet(&overlay);
+}
+
+void Profiler::toggleOverlay()
+{
+	int value;
+
+	do
+		value = SDL_AtomicGet(&overlay);
+	while (!SDL_AtomicCAS(&overlay, value, !value));
+}
+
+void Profiler::startTrace()
+{
+	if (!enabled)
+		return;
+
+	TraceState &state = traceState();
+
+	SDL_LockMutex(state.mutex);
+
+	state.events.clear();
+	state.start = SDL_GetPerformanceCounter();
+
+	SDL_AtomicSet(&tracing, 1);
+
+	SDL_UnlockMutex(state.mutex);
+}
+
+static double ticksToTraceUS(uint64_t ticks, uint64_t start)
+{
+	return (ticks - start) * 1000000.0 / SDL_GetPerformanceFrequency();
+}
+
+bool Profiler::stopTrace(const char *filename)
+{
+	TraceState &state = traceState();
+
+	SDL_LockMutex(state.mutex);
+
+	SDL_AtomicSet(&tracing, 0);
+
+	std::vector<TraceEvent> events;
+	events.swap(state.events);
+
+	std::vector<std::pair<SDL_threadID, std::string> > threads = state.threads;
+
+	SDL_UnlockMutex(state.mutex);
+
+	if (events.empty())
+		return true;
+
+	FILE *f = fopen(filename, "w");
+
+	if (!f)
+		return false;
+
+	fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+		           "\"tid\": %lu, \"args\": {\"name\": \"%s\"}},\n",
+		        (unsigned long) threads[i].first, threads[i].second.c_str());
+
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const TraceEvent &e = events[i];
+
+		fprintf(f, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %lu, "
+		           "\"ts\": %.3f, \"dur\": %.3f}%s\n",
+		        e.name, (unsigned long) e.thread,
+		        ticksToTraceUS(e.start, state.start),
+		        ticksToTraceUS(e.end, e.start),
+		        i + 1 < events.size() ? "," : "");
+	}
+
+	fprintf(f, "]}\n");
+
+	return fclose(f) == 0;
+}
+
+void Profiler::nameThread(SDL_threadID id, const char *name)
+{
+	TraceState &state = traceState();
+
+	SDL_LockMutex(state.mutex);
+	state.threads.push_back(std::make_pair(id, std::string(name)));
+	SDL_UnlockMutex(state.mutex);
+}
+
+void Profiler::traceEvent(const char *name, uint64_t start)
+{
+	TraceEvent e;
+	e.name = name;
+	e.thread = SDL_ThreadID();
+	e.start = start;
+	e.end = SDL_GetPerformanceCounter();
+
+	TraceState &state = traceState();
+
+	SDL_LockMutex(state.mutex);
+
+	/* Scopes opened before the trace started are cut off */
+	if (isTracing() && state.events.size() < TRACE_MAX_EVENTS)
+	{
+		if (e.start < state.start)
+			e.start = state.start;
+
+		state.events.push_back(e);
+	}
+
+	SDL_UnlockMutex(state.mutex);
+}
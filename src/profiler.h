@@ -0,0 +1,184 @@
+/*
+** profiler.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <SDL_timer.h>
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
+
+#include <stdint.h>
+
+/* Number of most recent frames kept */
+#define PROFILER_FRAMES 300
+
+/* Accumulates the time spent in a few engine sections per frame.
+ * Sections are timed with PROFILE_SCOPE; only the outermost scope
+ * of a section counts, so nested or recursive uses don't add up
+ * twice. All sections except AudioFill are only entered on the
+ * RGSS thread. While disabled, a scope costs one branch.
+ *
+ * While a trace is being recorded, every timed scope (and every
+ * TRACE_SCOPE zone) is additionally logged as an event of the
+ * calling thread, and written out in the Chrome trace event
+ * format, as read by chrome://tracing and Perfetto */
+class Profiler
+{
+public:
+	enum Section
+	{
+		/* Between two Graphics.update calls */
+		Script = 0,
+		Composite,
+		Sprites,
+		Planes,
+		Windows,
+		Tilemaps,
+		TilemapPrepare,
+		BitmapOps,
+		TexUpload,
+		AudioFill,
+		SwapWait,
+		ScriptGC,
+
+		/* GPU time, as measured by GPUTimer */
+		GPUComposite,
+		GPUViewport,
+		GPUBlit,
+		GPUTransition,
+
+		SectionCount
+	};
+
+	static bool isEnabled()
+	{
+		return enabled;
+	}
+
+	static void setEnabled(bool value);
+
+	static const char *sectionName(int section);
+
+	/* Called on entering / leaving Graphics::update,
+	 * which delimits frames and the script time */
+	static void frameBegin();
+	static void frameEnd();
+
+	/* Average time per section (in ms) over the
+	 * last 'frames' recorded frames */
+	static void averages(float out[SectionCount], int frames);
+
+	/* Writes all recorded frames, oldest first */
+	static bool dumpJSON(const char *filename);
+
+	static bool overlayVisible();
+	/* May be called from any thread */
+	static void toggleOverlay();
+
+	static bool isTracing()
+	{
+		return SDL_AtomicGet(&tracing);
+	}
+
+	/* Discards previously recorded events */
+	static void startTrace();
+	/* Writes the recorded events (if any) and stops tracing */
+	static bool stopTrace(const char *filename);
+
+	/* Labels the thread's events in traces; may be
+	 * called at any time from any thread */
+	static void nameThread(SDL_threadID id, const char *name);
+
+	/* Adds to the frame in progress; may be called from any thread */
+	static void addTime(Section s, uint64_t us);
+
+	/* <internal> */
+	static bool enter(Section s);
+	static void leave(Section s, uint64_t start);
+	/* 'name' has to outlive the trace */
+	static void traceEvent(const char *name, uint64_t start);
+
+private:
+	static bool enabled;
+	static SDL_atomic_t tracing;
+};
+
+struct ProfileScope
+{
+	Profiler::Section section;
+	uint64_t start;
+
+	ProfileScope(Profiler::Section section)
+	    : section(section),
+	      start(0)
+	{
+		if (Profiler::isEnabled() && Profiler::enter(section))
+			start = SDL_GetPerformanceCounter();
+	}
+
+	~ProfileScope()
+	{
+		if (start)
+			Profiler::leave(section, start);
+	}
+};
+
+#define PROFILE_SCOPE(section) \
+	ProfileScope _profileScope(Profiler::section)
+
+/* A zone which only shows up in traces */
+struct TraceScope
+{
+	const char *name;
+	uint64_t start;
+
+	TraceScope(const char *name)
+	    : name(name),
+	      start(Profiler::isTracing() ? SDL_GetPerformanceCounter() : 0)
+	{}
+
+	~TraceScope()
+	{
+		if (start)
+			Profiler::traceEvent(name, start);
+	}
+};
+
+#define TRACE_SCOPE(name) \
+	TraceScope _traceScope(name)
+
+/* Delimits a frame for the span of Graphics::update */
+struct ProfileFrame
+{
+	ProfileFrame()
+	{
+		Profiler::frameBegin();
+	}
+
+	~ProfileFrame()
+	{
+		Profiler::frameEnd();
+	}
+};
+
+#endif // PROFILER_H
@@ -25,10 +25,61 @@
 #include "vertex.h"
 #include "gl-util.h"
 #include "gl-meta.h"
+#include "gldeletequeue.h"
 #include "sharedstate.h"
 #include "global-ibo.h"
 #include "shader.h"
 
+#include <algorithm>
+
+/* Static quad spanning (0, 0) to (1, 1) in both position and
+ * texture coordinates, which shaders supporting it (see
+ * 'ShaderBase::hasUnitQuad()') place via uniforms. Owned by
+ * SharedState and shared by all 'Quad's */
+struct UnitQuad
+{
+	VBO::ID vbo;
+	GLMeta::VAO vao;
+
+	UnitQuad()
+	    : vbo(VBO::gen())
+	{
+		Vertex vert[4];
+		const FloatRect unit(0, 0, 1, 1);
+
+		for (int i = 0; i < 4; ++i)
+			vert[i].color = Vec4(1, 1, 1, 1);
+
+		vert[0].pos = vert[0].texPos = unit.topLeft();
+		vert[1].pos = vert[1].texPos = unit.topRight();
+		vert[2].pos = vert[2].texPos = unit.bottomRight();
+		vert[3].pos = vert[3].texPos = unit.bottomLeft();
+
+		GLMeta::vaoFillInVertexData<Vertex>(vao);
+		vao.vbo = vbo;
+		vao.ibo = shState->globalIBO().ibo;
+
+		GLMeta::vaoInit(vao, true);
+		VBO::uploadData(sizeof(vert), vert);
+		GLMeta::vaoUnbind(vao);
+	}
+
+	~UnitQuad()
+	{
+		GLMeta::vaoFini(vao);
+		VBO::del(vbo);
+	}
+
+	void draw()
+	{
+		GLMeta::vaoBind(vao);
+		gl.DrawElements(GL_TRIANGLES, 6, _GL_INDEX_TYPE, 0);
+		++glCallCounts.draws;
+		++glCallCounts.quads;
+		GLMeta::vaoUnbind(vao);
+	}
+};
+
 struct Quad
 {
 	Vertex vert[4];
@@ -36,6 +87,11 @@ struct Quad
 	GLMeta::VAO vao;
 	bool vboDirty;
 
+	/* What 'vert' was last set up from, for drawing
+	 * through the unit quad instead */
+	FloatRect posRect;
+	FloatRect texRect;
+
 	template<typename V>
 	static void setPosRect(V *vert, const FloatRect &r)
 	{
@@ -72,6 +128,54 @@ struct Quad
 			vert[i].color = c;
 	}
 
+	/* Clips 'pos' to 'clip', moving the edges of 'tex' along
+	 * proportionally, so that the visible part still samples
+	 * the same texels. Returns false if nothing is left */
+	static bool clipTexPosRect(FloatRect &tex, FloatRect &pos,
+	                           const FloatRect &clip)
+	{
+		const float x1 = std::max(pos.x, clip.x);
+		const float y1 = std::max(pos.y, clip.y);
+		const float x2 = std::min(pos.x + pos.w, clip.x + clip.w);
+		const float y2 = std::min(pos.y + pos.h, clip.y + clip.h);
+
+		if (x1 >= x2 || y1 >= y2)
+			return false;
+
+		const float sx = tex.w / pos.w;
+		const float sy = tex.h / pos.h;
+
+		tex = FloatRect(tex.x + (x1 - pos.x) * sx, tex.y + (y1 - pos.y) * sy,
+		                (x2 - x1) * sx, (y2 - y1) * sy);
+		pos = FloatRect(x1, y1, x2 - x1, y2 - y1);
+
+		return true;
+	}
+
+	/* Clips the 'count' axis aligned quads in 'vert' (as set up
+	 * by 'setTexPosRect()') to 'clip'. Quads entirely outside
+	 * are collapsed, so that the quad indices stay valid */
+	template<typename V>
+	static void clipQuads(V *vert, size_t count, const FloatRect &clip)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			V *quad = &vert[i*4];
+
+			FloatRect pos(quad[0].pos.x, quad[0].pos.y,
+			              quad[2].pos.x - quad[0].pos.x,
+			              quad[2].pos.y - quad[0].pos.y);
+			FloatRect tex(quad[0].texPos.x, quad[0].texPos.y,
+			              quad[2].texPos.x - quad[0].texPos.x,
+			              quad[2].texPos.y - quad[0].texPos.y);
+
+			if (!clipTexPosRect(tex, pos, clip))
+				pos = tex = FloatRect();
+
+			setTexPosRect(quad, tex, pos);
+		}
+	}
+
 	Quad()
 	    : vbo(VBO::gen()),
 	      vboDirty(true)
@@ -89,32 +193,38 @@ struct Quad
 
 	~Quad()
 	{
-		GLMeta::vaoFini(vao);
-		VBO::del(vbo);
+		GLDeleteQueue::vertexArray(vao);
+		GLDeleteQueue::buffer(vbo);
 	}
 
 	void updateBuffer()
 	{
+		/* Shared quads (eg. gpQuad) are rewritten many
+		 * times per frame while earlier draws are pending */
 		VBO::bind(vbo);
-		VBO::uploadSubData(0, sizeof(Vertex[4]), vert);
+		VBO::uploadStreamed(sizeof(Vertex[4]), sizeof(Vertex[4]), vert);
 		VBO::unbind();
 	}
 
 	void setPosRect(const FloatRect &r)
 	{
 		setPosRect(vert, r);
+		posRect = r;
 		vboDirty = true;
 	}
 
 	void setTexRect(const FloatRect &r)
 	{
 		setTexRect(vert, r);
+		texRect = r;
 		vboDirty = true;
 	}
 
 	void setTexPosRect(const FloatRect &tex, const FloatRect &pos)
 	{
 		setTexPosRect(vert, tex, pos);
+		posRect = pos;
+		texRect = tex;
 		vboDirty = true;
 	}
 
@@ -136,8 +246,27 @@ struct Quad
 
 		GLMeta::vaoBind(vao);
 		gl.DrawElements(GL_TRIANGLES, 6, _GL_INDEX_TYPE, 0);
+		++glCallCounts.draws;
+		++glCallCounts.quads;
 		GLMeta::vaoUnbind(vao);
 	}
+
+	/* Same as 'draw()', but if the bound 'shader' can place
+	 * the shared unit quad, the rects are passed as uniforms
+	 * instead of being uploaded. Such shaders don't read
+	 * vertex colors */
+	void draw(ShaderBase &shader)
+	{
+		if (!shader.hasUnitQuad())
+		{
+			draw();
+			return;
+		}
+
+		shader.setUnitQuad(posRect, texRect);
+		shState->unitQuad().draw();
+		shader.clearUnitQuad();
+	}
 };
 
 #endif // QUAD_H
@@ -25,6 +25,7 @@
 #include "vertex.h"
 #include "gl-util.h"
 #include "gl-meta.h"
+#include "gldeletequeue.h"
 #include "sharedstate.h"
 #include "global-ibo.h"
 #include "shader.h"
@@ -58,8 +59,8 @@ struct QuadArray
 
 	~QuadArray()
 	{
-		GLMeta::vaoFini(vao);
-		VBO::del(vbo);
+		GLDeleteQueue::vertexArray(vao);
+		GLDeleteQueue::buffer(vbo);
 	}
 
 	void resize(size_t size)
@@ -91,10 +92,11 @@ struct QuadArray
 
 			shState->ensureQuadIBO(quadCount);
 		}
-		else
+		else if (size > 0)
 		{
-			/* New data fits in allocated size */
-			VBO::uploadSubData(0, size, dataPtr(vertices));
+			/* New data fits in allocated size; the previous
+			 * contents might still be in use by the GPU */
+			VBO::uploadStreamed(vboSize, size, dataPtr(vertices));
 		}
 
 		VBO::unbind();
@@ -103,10 +105,7 @@ struct QuadArray
 	void draw(size_t offset, size_t count)
 	{
 		GLMeta::vaoBind(vao);
-
-		const char *_offset = (const char*) 0 + offset * 6 * sizeof(index_t);
-		gl.DrawElements(GL_TRIANGLES, count * 6, _GL_INDEX_TYPE, _offset);
-
+		GLMeta::vaoDrawQuads(vao, offset, count);
 		GLMeta::vaoUnbind(vao);
 	}
 
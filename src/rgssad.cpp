@@ -24,6 +24,14 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 struct RGSS_entryData
 {
@@ -32,21 +40,50 @@ struct RGSS_entryData
 	uint32_t startMagic;
 };
 
+/* Size of the decrypted read-ahead window kept per open entry */
+static size_t readAheadSize = 0x10000;
+
+void RGSS_setReadAhead(size_t bytes)
+{
+	readAheadSize = bytes;
+}
+
 struct RGSS_entryHandle
 {
 	const RGSS_entryData data;
-	uint32_t currentMagic;
 	uint64_t currentOffset;
 	PHYSFS_Io *io;
 
+	/* Position of 'io' relative to the archive start,
+	 * so we only seek when reads aren't contiguous */
+	int64_t ioOffset;
+
+	/* Already decrypted bytes of the entry starting
+	 * at 'bufferOffset' */
+	std::vector<uint8_t> buffer;
+	uint64_t bufferOffset;
+	size_t bufferFill;
+
 	RGSS_entryHandle(const RGSS_entryData &data, PHYSFS_Io *archIo)
 	    : data(data),
-	      currentMagic(data.startMagic),
-	      currentOffset(0)
+	      currentOffset(0),
+	      ioOffset(-1),
+	      bufferOffset(0),
+	      bufferFill(0)
 	{
 		io = archIo->duplicate(archIo);
 	}
 
+	RGSS_entryHandle(const RGSS_entryHandle &other)
+	    : data(other.data),
+	      currentOffset(other.currentOffset),
+	      ioOffset(-1),
+	      bufferOffset(0),
+	      bufferFill(0)
+	{
+		io = other.io->duplicate(other.io);
+	}
+
 	~RGSS_entryHandle()
 	{
 		io->destroy(io);
@@ -66,18 +103,82 @@ struct RGSS_archiveData
 	BoostHash<std::string, BoostSet<std::string> > dirHash;
 };
 
+/* Reads the archive header through a buffer, so that small
+ * fields don't each cost a call (and possibly a seek) on the
+ * underlying IO; seeks within the buffer are free */
+struct HeaderReader
+{
+	PHYSFS_Io *io;
+	std::vector<uint8_t> buffer;
+
+	/* Archive offset of the next byte to be read */
+	uint64_t offset;
+
+	/* Archive offsets of 'buffer' and of 'io' */
+	uint64_t bufferStart;
+	size_t bufferFill;
+	uint64_t ioOffset;
+
+	HeaderReader(PHYSFS_Io *io, uint64_t offset, size_t blockSize)
+	    : io(io),
+	      buffer(blockSize),
+	      offset(offset),
+	      bufferStart(0),
+	      bufferFill(0),
+	      ioOffset(offset)
+	{}
+
+	bool read(void *dst, size_t len)
+	{
+		uint8_t *out = static_cast<uint8_t*>(dst);
+
+		while (len > 0)
+		{
+			if (offset < bufferStart || offset >= bufferStart + bufferFill)
+			{
+				if (ioOffset != offset && !io->seek(io, offset))
+					return false;
+
+				PHYSFS_sint64 count = io->read(io, &buffer[0], buffer.size());
+
+				if (count <= 0)
+					return false;
+
+				bufferStart = offset;
+				bufferFill = count;
+				ioOffset = offset + count;
+			}
+
+			size_t count = std::min<uint64_t>(bufferStart + bufferFill - offset, len);
+			memcpy(out, &buffer[offset - bufferStart], count);
+
+			out += count;
+			len -= count;
+			offset += count;
+		}
+
+		return true;
+	}
+};
+
+static inline uint32_t
+getUint32(const uint8_t *buff)
+{
+	return buff[0] | (buff[1] << 0x08) | (buff[2] << 0x10) |
+	       ((uint32_t) buff[3] << 0x18);
+}
+
 static bool
-readUint32(PHYSFS_Io *io, uint32_t &result)
+readUint32(HeaderReader &reader, uint32_t &result)
 {
-	char buff[4];
-	PHYSFS_sint64 count = io->read(io, buff, 4);
+	uint8_t buff[4];
 
-	result = ((buff[0] << 0x00) & 0x000000FF) |
-	         ((buff[1] << 0x08) & 0x0000FF00) |
-	         ((buff[2] << 0x10) & 0x00FF0000) |
-	         ((buff[3] << 0x18) & 0xFF000000) ;
+	if (!reader.read(buff, 4))
+		return false;
 
-	return (count == 4);
+	result = getUint32(buff);
+
+	return true;
 }
 
 #define RGSS_HEADER "RGSSAD"
@@ -98,100 +199,241 @@ advanceMagic(uint32_t &magic)
 	return old;
 }
 
-static PHYSFS_sint64
-RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
+/* Advancing the magic is the affine map m -> 7m + 3.
+ * Entry i of this table holds the map advancing by 2^i
+ * dwords; it doesn't depend on the entry's start magic,
+ * so one table serves every archive */
+static struct
 {
-	RGSS_entryHandle *entry = static_cast<RGSS_entryHandle*>(self->opaque);
+	uint32_t mul;
+	uint32_t add;
+} magicSteps[64];
 
-	PHYSFS_Io *io = entry->io;
+static void
+initMagicSteps()
+{
+	static bool initialized = false;
 
-	uint64_t toRead = std::min<uint64_t>(entry->data.size - entry->currentOffset, len);
-	uint64_t offs = entry->currentOffset;
-
-	io->seek(io, entry->data.offset + offs);
-
-	/* We divide up the bytes to be read in 3 categories:
-	 *
-	 * preAlign: If the current read address is not dword
-	 *   aligned, this is the number of bytes to read til
-	 *   we reach alignment again (therefore can only be
-	 *   3 or less).
-	 *
-	 * align: The number of aligned dwords we can read
-	 *   times 4 (= number of bytes).
-	 *
-	 * postAlign: The number of bytes to read after the
-	 *   last aligned dword. Always 3 or less.
-	 *
-	 * Treating the pre- and post aligned reads specially,
-	 * we can read all aligned dwords in one syscall directly
-	 * into the write buffer and then run the xor chain on
-	 * it afterwards. */
-
-	uint8_t preAlign = 4 - (offs % 4);
-
-	if (preAlign == 4)
-		preAlign = 0;
-	else
-		preAlign = std::min<uint64_t>(preAlign, len);
+	if (initialized)
+		return;
 
-	uint8_t postAlign = (len > preAlign) ? (offs + len) % 4 : 0;
+	initialized = true;
 
-	uint64_t align = len - (preAlign + postAlign);
+	uint32_t mul = 7, add = 3;
 
-	/* Byte buffer pointer */
-	uint8_t *bBufferP = static_cast<uint8_t*>(buffer);
+	for (int i = 0; i < 64; ++i)
+	{
+		magicSteps[i].mul = mul;
+		magicSteps[i].add = add;
+
+		add = add * mul + add;
+		mul = mul * mul;
+	}
+}
+
+/* Returns the magic used for the dword at index 'dword',
+ * applying one table step per set bit of the index */
+static uint32_t
+magicAt(uint32_t magic, uint64_t dword)
+{
+	for (int i = 0; dword > 0; ++i, dword >>= 1)
+		if (dword & 1)
+			magic = magic * magicSteps[i].mul + magicSteps[i].add;
+
+	return magic;
+}
 
-	if (preAlign > 0)
+/* Four consecutive dwords advance their magic by
+ * m -> 7^4 m + 3 (7^3 + 7^2 + 7 + 1) */
+#define MAGIC_MUL4 2401
+#define MAGIC_ADD4 1200
+
+/* XORs 'len' bytes of entry data located at entry offset
+ * 'offs' with the key stream, in place */
+static void
+xorKeyStream(uint8_t *buf, size_t len, uint64_t offs, uint32_t startMagic)
+{
+	uint32_t magic = magicAt(startMagic, offs / 4);
+	unsigned phase = offs % 4;
+
+	/* Bytes up to the next dword boundary */
+	while (phase != 0 && len > 0)
 	{
-		uint32_t dword;
-		io->read(io, &dword, preAlign);
+		*buf++ ^= (magic >> (8 * phase)) & 0xFF;
+		--len;
+
+		if (++phase == 4)
+		{
+			advanceMagic(magic);
+			phase = 0;
+		}
+	}
+
+	/* Blocks of four dwords, each lane
+	 * running its own key stream */
+	uint32_t lanes[4];
 
-		/* Need to align the bytes with the
-		 * magic before xoring */
-		dword <<= 8 * (offs % 4);
-		dword ^= entry->currentMagic;
+	for (int i = 0; i < 4; ++i)
+		lanes[i] = advanceMagic(magic);
 
-		/* Shift them back to normal */
-		dword >>= 8 * (offs % 4);
-		memcpy(bBufferP, &dword, preAlign);
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	if (len >= 16)
+	{
+		uint32x4_t key = vld1q_u32(lanes);
+		const uint32x4_t mul = vdupq_n_u32(MAGIC_MUL4);
+		const uint32x4_t add = vdupq_n_u32(MAGIC_ADD4);
 
-		bBufferP += preAlign;
+		for (; len >= 16; len -= 16, buf += 16)
+		{
+			uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(buf));
+			vst1q_u8(buf, vreinterpretq_u8_u32(veorq_u32(v, key)));
+			key = vmlaq_u32(add, key, mul);
+		}
 
-		/* Only advance the magic if we actually
-		 * reached the next alignment */
-		if ((offs+preAlign) % 4 == 0)
-			advanceMagic(entry->currentMagic);
+		vst1q_u32(lanes, key);
 	}
+#elif defined(__SSE2__)
+	if (len >= 16)
+	{
+		__m128i key = _mm_loadu_si128((const __m128i*) lanes);
+		const __m128i mul = _mm_set1_epi32(MAGIC_MUL4);
+		const __m128i add = _mm_set1_epi32(MAGIC_ADD4);
+
+		for (; len >= 16; len -= 16, buf += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*) buf);
+			_mm_storeu_si128((__m128i*) buf, _mm_xor_si128(v, key));
+
+			/* No 32 bit multiply before SSE4.1: multiply
+			 * even and odd lanes separately and interleave */
+			__m128i even = _mm_mul_epu32(key, mul);
+			__m128i odd = _mm_mul_epu32(_mm_srli_epi64(key, 32), mul);
+			key = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			                         _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+			key = _mm_add_epi32(key, add);
+		}
 
-	if (align > 0)
+		_mm_storeu_si128((__m128i*) lanes, key);
+	}
+#else
+	for (; len >= 16; len -= 16, buf += 16)
 	{
-		/* Double word buffer pointer */
-		uint32_t *dwBufferP = reinterpret_cast<uint32_t*>(bBufferP);
+		uint32_t v[4];
+		memcpy(v, buf, 16);
 
-		/* Read aligned dwords in one go */
-		io->read(io, bBufferP, align);
+		for (int i = 0; i < 4; ++i)
+		{
+			v[i] ^= lanes[i];
+			lanes[i] = lanes[i] * MAGIC_MUL4 + MAGIC_ADD4;
+		}
 
-		/* Then xor them */
-		for (uint64_t i = 0; i < (align / 4); ++i)
-			dwBufferP[i] ^= advanceMagic(entry->currentMagic);
+		memcpy(buf, v, 16);
+	}
+#endif
+
+	/* Remaining bytes continue from the first lane */
+	magic = lanes[0];
 
-		bBufferP += align;
+	for (size_t i = 0; i < len; ++i)
+	{
+		buf[i] ^= (magic >> (8 * (i % 4))) & 0xFF;
+
+		if (i % 4 == 3)
+			advanceMagic(magic);
 	}
+}
+
+/* Reads and decrypts 'len' bytes of the entry starting at entry
+ * offset 'offs' straight from the archive. Returns the number
+ * of bytes read, or -1 on error */
+static PHYSFS_sint64
+readDecrypted(RGSS_entryHandle *entry, uint8_t *buf, uint64_t offs, uint64_t len)
+{
+	PHYSFS_Io *io = entry->io;
+	int64_t archOffs = entry->data.offset + offs;
 
-	if (postAlign > 0)
+	if (entry->ioOffset != archOffs)
 	{
-		uint32_t dword;
-		io->read(io, &dword, postAlign);
+		if (!io->seek(io, archOffs))
+		{
+			entry->ioOffset = -1;
+			return -1;
+		}
+
+		entry->ioOffset = archOffs;
+	}
+
+	PHYSFS_sint64 count = io->read(io, buf, len);
 
-		/* Bytes are already aligned with magic */
-		dword ^= entry->currentMagic;
-		memcpy(bBufferP, &dword, postAlign);
+	if (count < 0)
+	{
+		entry->ioOffset = -1;
+		return -1;
 	}
 
-	entry->currentOffset += toRead;
+	entry->ioOffset += count;
+	xorKeyStream(buf, count, offs, entry->data.startMagic);
+
+	return count;
+}
+
+static PHYSFS_sint64
+RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
+{
+	RGSS_entryHandle *entry = static_cast<RGSS_entryHandle*>(self->opaque);
+
+	uint64_t toRead = std::min<uint64_t>(entry->data.size - entry->currentOffset, len);
+	uint8_t *bBufferP = static_cast<uint8_t*>(buffer);
+	uint64_t done = 0;
+
+	while (done < toRead)
+	{
+		uint64_t offs = entry->currentOffset;
+		uint64_t remaining = toRead - done;
+
+		/* Serve from the read-ahead window if it covers 'offs' */
+		if (offs >= entry->bufferOffset &&
+		    offs < entry->bufferOffset + entry->bufferFill)
+		{
+			size_t bufPos = offs - entry->bufferOffset;
+			size_t count = std::min<uint64_t>(entry->bufferFill - bufPos, remaining);
+
+			memcpy(bBufferP, &entry->buffer[bufPos], count);
+
+			bBufferP += count;
+			done += count;
+			entry->currentOffset += count;
+
+			continue;
+		}
+
+		/* Reads at least as large as the window gain nothing
+		 * from it, so these go directly to the caller */
+		if (remaining >= readAheadSize)
+		{
+			PHYSFS_sint64 count = readDecrypted(entry, bBufferP, offs, remaining);
+
+			if (count < 0)
+				return done > 0 ? (PHYSFS_sint64) done : -1;
+
+			done += count;
+			entry->currentOffset += count;
 
-	return toRead;
+			break;
+		}
+
+		uint64_t fill = std::min<uint64_t>(readAheadSize, entry->data.size - offs);
+		entry->buffer.resize(readAheadSize);
+
+		PHYSFS_sint64 count = readDecrypted(entry, &entry->buffer[0], offs, fill);
+		entry->bufferOffset = offs;
+		entry->bufferFill = std::max<PHYSFS_sint64>(count, 0);
+
+		if (count <= 0)
+			return done > 0 ? (PHYSFS_sint64) done : count;
+	}
+
+	return done;
 }
 
 static int
@@ -205,23 +447,9 @@ RGSS_ioSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
 	if (offset > entry->data.size-1)
 		return 0;
 
-	/* If rewinding, we need to rewind to begining */
-	if (offset < entry->currentOffset)
-	{
-		entry->currentOffset = 0;
-		entry->currentMagic = entry->data.startMagic;
-	}
-
-	/* For each overstepped alignment, advance magic */
-	uint64_t currentDword = entry->currentOffset / 4;
-	uint64_t targetDword  = offset / 4;
-	uint64_t dwordsSought = targetDword - currentDword;
-
-	for (uint64_t i = 0; i < dwordsSought; ++i)
-		advanceMagic(entry->currentMagic);
-
+	/* The magic is derived from the offset on the next
+	 * read, and the archive is only sought when needed */
 	entry->currentOffset = offset;
-	entry->io->seek(entry->io, entry->data.offset + entry->currentOffset);
 
 	return 1;
 }
@@ -279,40 +507,41 @@ static const PHYSFS_Io RGSS_IoTemplate =
     RGSS_ioDestroy
 };
 
+/* Adds the entry to the listing of its directory, and each
+ * directory to that of its parent. Walking up stops at the
+ * first directory that was already known, as all of its
+ * parents are then known too */
 static void
-processDirectories(RGSS_archiveData *data, BoostSet<std::string> &topLevel,
-                   char *nameBuf, uint32_t nameLen)
+processDirectories(RGSS_archiveData *data, const char *nameBuf, uint32_t nameLen)
 {
-	/* Check for top level entries */
-	for (uint32_t i = 0; i < nameLen; ++i)
+	uint32_t childEnd = nameLen;
+	bool isFile = true;
+
+	for (uint32_t i = nameLen; ; --i)
 	{
-		bool slash = nameBuf[i] == '/';
-		if (!slash && i+1 < nameLen)
+		const bool atStart = (i == 0);
+
+		if (!atStart && nameBuf[i-1] != '/')
 			continue;
 
-		if (slash)
-			nameBuf[i] = '\0';
+		const uint32_t dirLen = atStart ? 0 : i-1;
 
-		topLevel.insert(nameBuf);
+		BoostSet<std::string> &entryList =
+		        data->dirHash[std::string(nameBuf, dirLen)];
 
-		if (slash)
-			nameBuf[i] = '/';
+		std::string child(nameBuf + i, childEnd - i);
 
-		break;
-	}
+		if (!isFile && entryList.contains(child))
+			return;
 
-	/* Check for more entries */
-	for (uint32_t i = nameLen; i > 0; i--)
-		if (nameBuf[i] == '/')
-		{
-			nameBuf[i] = '\0';
+		entryList.insert(child);
 
-			const char *dir = nameBuf;
-			const char *entry = &nameBuf[i+1];
+		if (atStart)
+			return;
 
-			BoostSet<std::string> &entryList = data->dirHash[dir];
-			entryList.insert(entry);
-		}
+		isFile = false;
+		childEnd = dirLen;
+	}
 }
 
 static bool
@@ -332,6 +561,13 @@ verifyHeader(PHYSFS_Io *io, char version)
 	return true;
 }
 
+/* RGSS1/2 headers are interleaved with the entry data,
+ * so only a little more than one header is read at once */
+#define RGSS1_BLOCK_SIZE 0x1000
+
+/* RGSS3 headers are contiguous */
+#define RGSS3_BLOCK_SIZE 0x10000
+
 static void*
 RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 {
@@ -344,13 +580,16 @@ RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 	else
 		*claimed = 1;
 
+	initMagicSteps();
+
 	RGSS_archiveData *data = new RGSS_archiveData;
 	data->archiveIo = io;
 
+	HeaderReader reader(io, 8, RGSS1_BLOCK_SIZE);
 	uint32_t magic = RGSS_MAGIC;
 
 	/* Top level entry list */
-	BoostSet<std::string> &topLevel = data->dirHash[""];
+	data->dirHash[""];
 
 	while (true)
 	{
@@ -358,17 +597,19 @@ RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
          * if nothing was read, no files remain */
 		uint32_t nameLen;
 
-		if (!readUint32(io, nameLen))
+		if (!readUint32(reader, nameLen))
 			break;
 
 		nameLen ^= advanceMagic(magic);
 
-		static char nameBuf[512];
+		char nameBuf[512];
+
+		if (nameLen >= sizeof(nameBuf) || !reader.read(nameBuf, nameLen))
+			break;
+
 		for (uint32_t i = 0; i < nameLen; ++i)
 		{
-			char c;
-			io->read(io, &c, 1);
-			nameBuf[i] = c ^ (advanceMagic(magic) & 0xFF);
+			nameBuf[i] ^= advanceMagic(magic) & 0xFF;
 			if (nameBuf[i] == '\\')
 				nameBuf[i] = '/';
 		}
@@ -376,18 +617,21 @@ RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 		nameBuf[nameLen] = '\0';
 
 		uint32_t entrySize;
-		readUint32(io, entrySize);
+
+		if (!readUint32(reader, entrySize))
+			break;
+
 		entrySize ^= advanceMagic(magic);
 
 		RGSS_entryData entry;
-		entry.offset = io->tell(io);
+		entry.offset = reader.offset;
 		entry.size = entrySize;
 		entry.startMagic = magic;
 
 		data->entryHash.insert(nameBuf, entry);
-		processDirectories(data, topLevel, nameBuf, nameLen);
+		processDirectories(data, nameBuf, nameLen);
 
-		io->seek(io, entry.offset + entry.size);
+		reader.offset = entry.offset + entry.size;
 	}
 
 	return data;
@@ -530,17 +774,6 @@ const PHYSFS_Archiver RGSS2_Archiver =
 	RGSS_closeArchive
 };
 
-static bool
-readUint32AndXor(PHYSFS_Io *io, uint32_t &result, uint32_t key)
-{
-	if (!readUint32(io, result))
-		return false;
-
-	result ^= key;
-
-	return true;
-}
-
 static void*
 RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 {
@@ -553,47 +786,55 @@ RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 	else
 		*claimed = 1;
 
+	initMagicSteps();
+
+	HeaderReader reader(io, 8, RGSS3_BLOCK_SIZE);
 	uint32_t baseMagic;
 
-	if (!readUint32(io, baseMagic))
+	if (!readUint32(reader, baseMagic))
 		return NULL;
 
 	baseMagic = (baseMagic * 9) + 3;
 
+	/* Key bytes for the names, in the order they cycle */
+	uint8_t nameKey[4];
+	for (int i = 0; i < 4; ++i)
+		nameKey[i] = (baseMagic >> 8*i) & 0xFF;
+
 	RGSS_archiveData *data = new RGSS_archiveData;
 	data->archiveIo = io;
 
 	/* Top level entry list */
-	BoostSet<std::string> &topLevel = data->dirHash[""];
+	data->dirHash[""];
 
 	while (true)
 	{
-		uint32_t offset, size, magic, nameLen;
+		uint8_t raw[16];
 
-		if (!readUint32AndXor(io, offset, baseMagic))
+		if (!reader.read(raw, 4))
 			goto error;
 
+		uint32_t offset = getUint32(&raw[0]) ^ baseMagic;
+
 		/* Zero offset means entry list has ended */
 		if (offset == 0)
 			break;
 
-		if (!readUint32AndXor(io, size, baseMagic))
+		if (!reader.read(&raw[4], 12))
 			goto error;
 
-		if (!readUint32AndXor(io, magic, baseMagic))
-			goto error;
-
-		if (!readUint32AndXor(io, nameLen, baseMagic))
-			goto error;
+		uint32_t size    = getUint32(&raw[4])  ^ baseMagic;
+		uint32_t magic   = getUint32(&raw[8])  ^ baseMagic;
+		uint32_t nameLen = getUint32(&raw[12]) ^ baseMagic;
 
 		char nameBuf[512];
 
-		if (!IO_READ(io, nameBuf, nameLen))
+		if (nameLen >= sizeof(nameBuf) || !reader.read(nameBuf, nameLen))
 			goto error;
 
 		for (uint32_t i = 0; i < nameLen; ++i)
 		{
-			nameBuf[i] ^= ((baseMagic >> 8*(i%4)) & 0xFF);
+			nameBuf[i] ^= nameKey[i%4];
 
 			if (nameBuf[i] == '\\')
 				nameBuf[i] = '/';
@@ -607,16 +848,14 @@ RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 		entry.startMagic = magic;
 
 		data->entryHash.insert(nameBuf, entry);
-		processDirectories(data, topLevel, nameBuf, nameLen);
-
-		continue;
-
-	error:
-		delete data;
-		return NULL;
+		processDirectories(data, nameBuf, nameLen);
 	}
 
 	return data;
+
+error:
+	delete data;
+	return NULL;
 }
 
 const PHYSFS_Archiver RGSS3_Archiver =
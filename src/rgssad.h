@@ -23,9 +23,15 @@
 #define RGSSAD_H
 
 #include <physfs.h>
+#include <stddef.h>
 
 extern const PHYSFS_Archiver RGSS1_Archiver;
 extern const PHYSFS_Archiver RGSS2_Archiver;
 extern const PHYSFS_Archiver RGSS3_Archiver;
 
+/* Sets how many bytes are read and decrypted ahead for each
+ * opened archive entry (0 reads exactly what was requested).
+ * Only affects entries opened afterwards */
+void RGSS_setReadAhead(size_t bytes);
+
 #endif // RGSSAD_H
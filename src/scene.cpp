@@ -21,8 +21,17 @@
 
 #include "scene.h"
 #include "sharedstate.h"
+#include "spritebatch.h"
+#include "profiler.h"
+
+/* Initially dirty */
+unsigned int Scene::changeStamp = 1;
+unsigned int Scene::cleanStamp = 0;
+unsigned int Scene::globalRevision = 0;
 
 Scene::Scene()
+    : orderDirty(false),
+      revision(0)
 {}
 
 Scene::~Scene()
@@ -38,24 +47,28 @@ Scene::~Scene()
 
 void Scene::insert(SceneElement &element)
 {
-	IntruListLink<SceneElement> *iter;
+	SceneElement *last = elements.tail();
 
-	for (iter = elements.begin(); iter != elements.end(); iter = iter->next)
-	{
-		SceneElement *e = iter->data;
-
-		if (element < *e)
-		{
-			elements.insertBefore(element.link, *iter);
-			return;
-		}
-	}
+	/* Newly created elements usually go last anyway */
+	if (last && element < *last)
+		orderDirty = true;
 
 	elements.append(element.link);
+	markContentDirty();
 }
 
 void Scene::insertAfter(SceneElement &element, SceneElement &after)
 {
+	markContentDirty();
+
+	/* 'after' is only a valid starting point
+	 * for the search while the list is in order */
+	if (orderDirty)
+	{
+		insert(element);
+		return;
+	}
+
 	IntruListLink<SceneElement> *iter;
 
 	for (iter = &after.link; iter != elements.end(); iter = iter->next)
@@ -74,8 +87,29 @@ void Scene::insertAfter(SceneElement &element, SceneElement &after)
 
 void Scene::reinsert(SceneElement &element)
 {
-	elements.remove(element.link);
-	insert(element);
+	/* Not currently linked */
+	if (!element.link.next)
+	{
+		insert(element);
+		return;
+	}
+
+	orderDirty = true;
+	markContentDirty();
+}
+
+void Scene::sortElements()
+{
+	if (!orderDirty)
+		return;
+
+	elements.sort(elementLess);
+	orderDirty = false;
+}
+
+bool Scene::elementLess(const SceneElement *a, const SceneElement *b)
+{
+	return *a < *b;
 }
 
 void Scene::notifyGeometryChange()
@@ -86,19 +120,33 @@ void Scene::notifyGeometryChange()
 	{
 		iter->data->onGeometryChange(geometry);
 	}
+
+	markContentDirty();
 }
 
 void Scene::composite()
 {
+	PROFILE_SCOPE(Composite);
+
+	SpriteBatch &batch = shState->spriteBatch();
 	IntruListLink<SceneElement> *iter;
 
+	sortElements();
+
 	for (iter = elements.begin(); iter != elements.end(); iter = iter->next)
 	{
 		SceneElement *e = iter->data;
 
-		if (e->visible)
-			e->draw();
+		if (!e->visible)
+			continue;
+
+		if (!e->usesSpriteBatch())
+			batch.flush();
+
+		e->draw();
 	}
+
+	batch.flush();
 }
 
 
@@ -158,7 +206,11 @@ void SceneElement::setVisible(bool value)
 {
 	aboutToAccess();
 
+	if (visible == value)
+		return;
+
 	visible = value;
+	markSceneDirty();
 }
 
 bool SceneElement::operator<(const SceneElement &o) const
@@ -199,4 +251,14 @@ void SceneElement::unlink()
 {
 	if (scene)
 		scene->elements.remove(link);
+
+	markSceneDirty();
+}
+
+void SceneElement::markSceneDirty()
+{
+	if (scene)
+		scene->markContentDirty();
+	else
+		Scene::markDirty();
 }
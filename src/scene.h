@@ -28,6 +28,7 @@
 #include "etc-internal.h"
 
 class SceneElement;
+class SceneCapture;
 class Viewport;
 class WindowVX;
 class Window;
@@ -61,6 +62,25 @@ public:
 
 	const Geometry &getGeometry() const { return geometry; }
 
+	/* Screen change tracking: anything that may alter the
+	 * composited image marks the screen dirty. Graphics clears
+	 * the flag once a frame is drawn, and may skip compositing
+	 * frames for as long as it stays clear. The change stamp
+	 * advances with every mark, for anyone else keeping track
+	 * of whether their composition is still current */
+	static void markDirty() { ++changeStamp; ++globalRevision; }
+	static bool isDirty() { return changeStamp != cleanStamp; }
+	static void clearDirty() { cleanStamp = changeStamp; }
+	static unsigned int getChangeStamp() { return changeStamp; }
+
+	/* Like markDirty(), but for changes known to be confined
+	 * to this scene's own elements. Their count is kept in
+	 * 'revision', while changes of unknown origin only advance
+	 * the global revision (and thus concern every scene) */
+	void markContentDirty() { ++changeStamp; ++revision; }
+	unsigned int getRevision() const { return revision; }
+	static unsigned int getGlobalRevision() { return globalRevision; }
+
 protected:
 	void insert(SceneElement &element);
 	void insertAfter(SceneElement &element, SceneElement &after);
@@ -69,13 +89,32 @@ protected:
 	/* Notify all elements that geometry has changed */
 	void notifyGeometryChange();
 
+	/* Restores display priority order of 'elements'
+	 * if any insertion or reordering broke it */
+	void sortElements();
+
+	static bool elementLess(const SceneElement *a, const SceneElement *b);
+
 	IntruList<SceneElement> elements;
 	Geometry geometry;
 
+	/* Elements are not kept sorted on every insert/reinsert
+	 * (moving sprites in RGSS2+ reorder every frame). Instead,
+	 * the list is merely flagged and sorted once before use */
+	bool orderDirty;
+
+	unsigned int revision;
+
+	static unsigned int changeStamp;
+	static unsigned int cleanStamp;
+	static unsigned int globalRevision;
+
 	friend class SceneElement;
+	friend class SceneCapture;
 	friend class Window;
 	friend class WindowVX;
 	friend struct ZLayer;
+	friend struct TilemapPrivate;
 };
 
 class SceneElement
@@ -86,6 +125,10 @@ public:
 
 	void setScene(Scene &scene);
 
+	/* Marks the screen dirty on behalf of the scene
+	 * this element is displayed in */
+	void markSceneDirty();
+
 	DECL_ATTR_VIRT( Z,       int  )
 	DECL_ATTR_VIRT( Visible, bool )
 
@@ -112,9 +155,20 @@ protected:
 	 */
 	virtual void draw() = 0;
 
+	/* Elements which may queue their drawing into the
+	 * shared SpriteBatch return true here; they must flush
+	 * it themselves before any direct rendering. For all
+	 * others, the batch is flushed prior to 'draw()' */
+	virtual bool usesSpriteBatch() const { return false; }
+
 	// FIXME: This should be a signal
 	virtual void onGeometryChange(const Scene::Geometry &) {}
 
+	/* Records this element's state via the matching
+	 * SceneCapture hook; kinds without one are
+	 * left out of scene captures */
+	virtual void capture(SceneCapture &) {}
+
 	/* Compares two elements in terms of their display priority;
 	 * elements with lower priority are drawn earlier */
 	bool operator<(const SceneElement &o) const;
@@ -129,6 +183,7 @@ protected:
 	Scene *scene;
 
 	friend class Scene;
+	friend class SceneCapture;
 	friend class Viewport;
 	friend struct TilemapPrivate;
 
@@ -146,6 +201,19 @@ private:
 	int spriteY;
 };
 
+/* Like DEF_ATTR_SIMPLE, but marks the element's scene
+ * dirty if the value actually changes */
+#define DEF_ATTR_SCENE(klass, name, type, location) \
+	DEF_ATTR_RD_SIMPLE(klass, name, type, location) \
+	void klass :: set##name(type value) \
+	{ \
+		guardDisposed(); \
+		if (location == value) \
+			return; \
+		location = value; \
+		markSceneDirty(); \
+	}
+
 #define ABOUT_TO_ACCESS_NOOP \
 	void aboutToAccess() const {}
 
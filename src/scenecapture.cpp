@@ -0,0 +1,364 @@
+/*
+** scenecapture.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "scenecapture.h"
+
+#include "scene.h"
+#include "sharedstate.h"
+#include "graphics.h"
+#include "viewport.h"
+#include "sprite.h"
+#include "plane.h"
+#include "window.h"
+#include "tilemap.h"
+#include "tilemapvx.h"
+#include "bitmap.h"
+#include "table.h"
+#include "etc.h"
+#include "boost-hash.h"
+#include "debugwriter.h"
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <vector>
+
+const char SceneCapture::magic[8] = { 'M', 'K', 'X', 'P', 'S', 'C', 'N', '1' };
+
+struct SceneCapturePrivate
+{
+	FILE *file;
+
+	/* Index of everything already written, by address */
+	BoostHash<const Bitmap*, int> bitmaps;
+	BoostHash<const Table*, int> tables;
+	BoostHash<const Viewport*, int> viewports;
+	int bitmapCount, tableCount, viewportCount;
+
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> packed;
+	std::vector<char> serial;
+
+	SceneCapturePrivate(FILE *file)
+	    : file(file),
+	      bitmapCount(0),
+	      tableCount(0),
+	      viewportCount(0)
+	{}
+
+	void writeBytes(const void *data, size_t size)
+	{
+		if (size > 0)
+			fwrite(data, 1, size, file);
+	}
+
+	void writeRecord(SceneCapture::Record rec)
+	{
+		uint8_t value = rec;
+		writeBytes(&value, 1);
+	}
+
+	void writeInt(int32_t value)
+	{
+		writeBytes(&value, sizeof(value));
+	}
+
+	void writeFloat(float value)
+	{
+		writeBytes(&value, sizeof(value));
+	}
+
+	void writeBool(bool value)
+	{
+		uint8_t byte = value;
+		writeBytes(&byte, 1);
+	}
+
+	/* Rect, Color, Tone and Table, prefixed with their size */
+	void writeSerial(const Serializable &obj)
+	{
+		serial.resize(obj.serialSize());
+		obj.serialize(&serial[0]);
+
+		writeInt(serial.size());
+		writeBytes(&serial[0], serial.size());
+	}
+
+	int bitmapId(const Bitmap *bitmap)
+	{
+		if (!bitmap || bitmap->isDisposed())
+			return 0;
+
+		if (bitmaps.contains(bitmap))
+			return bitmaps[bitmap];
+
+		const int w = bitmap->width();
+		const int h = bitmap->height();
+
+		/* Mega surfaces can't be read back; they are recorded
+		 * with their size only, and replayed blank */
+		uLongf packedSize = 0;
+
+		if (!bitmap->isMega())
+		{
+			pixels.resize(w * h * 4);
+			bitmap->getPixels(IntRect(0, 0, w, h), &pixels[0]);
+
+			packedSize = compressBound(pixels.size());
+			packed.resize(packedSize);
+
+			if (compress2(&packed[0], &packedSize, &pixels[0],
+			              pixels.size(), Z_BEST_SPEED) != Z_OK)
+				packedSize = 0;
+		}
+
+		writeRecord(SceneCapture::BitmapData);
+		writeInt(w);
+		writeInt(h);
+		writeInt(packedSize);
+
+		if (packedSize > 0)
+			writeBytes(&packed[0], packedSize);
+
+		bitmaps.insert(bitmap, ++bitmapCount);
+
+		return bitmapCount;
+	}
+
+	int tableId(const Table *table)
+	{
+		if (!table)
+			return 0;
+
+		if (tables.contains(table))
+			return tables[table];
+
+		writeRecord(SceneCapture::TableData);
+		writeSerial(*table);
+
+		tables.insert(table, ++tableCount);
+
+		return tableCount;
+	}
+
+	int viewportId(const Viewport *viewport)
+	{
+		if (!viewport)
+			return 0;
+
+		return viewports.value(viewport, 0);
+	}
+
+	void writeElement(SceneElement &elem)
+	{
+		writeInt(elem.getZ());
+		writeBool(elem.getVisible());
+	}
+};
+
+SceneCapture::SceneCapture(SceneCapturePrivate *p)
+    : p(p)
+{}
+
+bool SceneCapture::write(const char *filename)
+{
+	FILE *file = fopen(filename, "wb");
+
+	if (!file)
+		return false;
+
+	SceneCapturePrivate priv(file);
+	SceneCapture capture(&priv);
+
+	Graphics &graphics = shState->graphics();
+
+	priv.writeBytes(magic, sizeof(magic));
+	priv.writeInt(graphics.width());
+	priv.writeInt(graphics.height());
+
+	capture.captureScene(*graphics.getScreen());
+
+	priv.writeRecord(End);
+
+	const bool failed = ferror(file);
+
+	if (fclose(file) != 0 || failed)
+		return false;
+
+	Debug() << "Captured scene:" << filename << "("
+	        << priv.bitmapCount << "bitmaps," << priv.tableCount << "tables)";
+
+	return true;
+}
+
+void SceneCapture::captureScene(Scene &scene)
+{
+	/* In display order, which also keeps same-z
+	 * elements in the order they were created */
+	scene.sortElements();
+
+	IntruListLink<SceneElement> *iter;
+
+	for (iter = scene.elements.begin(); iter != scene.elements.end(); iter = iter->next)
+		iter->data->capture(*this);
+}
+
+void SceneCapture::viewport(Viewport &vp)
+{
+	p->writeRecord(ViewportElem);
+	p->writeElement(vp);
+	p->writeSerial(vp.getRect());
+	p->writeInt(vp.getOX());
+	p->writeInt(vp.getOY());
+	p->writeSerial(vp.getColor());
+	p->writeSerial(vp.getTone());
+	p->writeBool(vp.getCache());
+
+	p->viewports.insert(&vp, ++p->viewportCount);
+
+	captureScene(vp);
+}
+
+void SceneCapture::sprite(Sprite &sprite)
+{
+	/* Referenced data goes ahead of the record */
+	const int bitmap = p->bitmapId(sprite.getBitmap());
+
+	p->writeRecord(SpriteElem);
+	p->writeElement(sprite);
+	p->writeInt(p->viewportId(sprite.getViewport()));
+	p->writeInt(bitmap);
+	p->writeSerial(sprite.getSrcRect());
+	p->writeInt(sprite.getX());
+	p->writeInt(sprite.getY());
+	p->writeInt(sprite.getOX());
+	p->writeInt(sprite.getOY());
+	p->writeFloat(sprite.getZoomX());
+	p->writeFloat(sprite.getZoomY());
+	p->writeFloat(sprite.getAngle());
+	p->writeBool(sprite.getMirror());
+	p->writeInt(sprite.getBushDepth());
+	p->writeInt(sprite.getBushOpacity());
+	p->writeInt(sprite.getOpacity());
+	p->writeInt(sprite.getBlendType());
+	p->writeSerial(sprite.getColor());
+	p->writeSerial(sprite.getTone());
+	p->writeInt(sprite.getWaveAmp());
+	p->writeInt(sprite.getWaveLength());
+	p->writeInt(sprite.getWaveSpeed());
+	p->writeFloat(sprite.getWavePhase());
+}
+
+void SceneCapture::plane(Plane &plane)
+{
+	const int bitmap = p->bitmapId(plane.getBitmap());
+
+	p->writeRecord(PlaneElem);
+	p->writeElement(plane);
+	p->writeInt(p->viewportId(plane.getViewport()));
+	p->writeInt(bitmap);
+	p->writeInt(plane.getOX());
+	p->writeInt(plane.getOY());
+	p->writeFloat(plane.getZoomX());
+	p->writeFloat(plane.getZoomY());
+	p->writeInt(plane.getOpacity());
+	p->writeInt(plane.getBlendType());
+	p->writeSerial(plane.getColor());
+	p->writeSerial(plane.getTone());
+}
+
+void SceneCapture::window(Window &window)
+{
+	const int windowskin = p->bitmapId(window.getWindowskin());
+	const int contents = p->bitmapId(window.getContents());
+
+	p->writeRecord(WindowElem);
+	p->writeElement(window);
+	p->writeInt(p->viewportId(window.getViewport()));
+	p->writeInt(windowskin);
+	p->writeInt(contents);
+	p->writeBool(window.getStretch());
+	p->writeSerial(window.getCursorRect());
+	p->writeBool(window.getActive());
+	p->writeBool(window.getPause());
+	p->writeInt(window.getX());
+	p->writeInt(window.getY());
+	p->writeInt(window.getWidth());
+	p->writeInt(window.getHeight());
+	p->writeInt(window.getOX());
+	p->writeInt(window.getOY());
+	p->writeInt(window.getOpacity());
+	p->writeInt(window.getBackOpacity());
+	p->writeInt(window.getContentsOpacity());
+}
+
+void SceneCapture::tilemap(Tilemap &tilemap)
+{
+	int autotiles[7];
+
+	for (int i = 0; i < 7; ++i)
+		autotiles[i] = p->bitmapId(tilemap.getAutotiles().get(i));
+
+	const int tileset = p->bitmapId(tilemap.getTileset());
+	const int mapData = p->tableId(tilemap.getMapData());
+	const int flashData = p->tableId(tilemap.getFlashData());
+	const int priorities = p->tableId(tilemap.getPriorities());
+
+	p->writeRecord(TilemapElem);
+	p->writeInt(p->viewportId(tilemap.getViewport()));
+	p->writeInt(tileset);
+
+	for (int i = 0; i < 7; ++i)
+		p->writeInt(autotiles[i]);
+
+	p->writeInt(mapData);
+	p->writeInt(flashData);
+	p->writeInt(priorities);
+	p->writeBool(tilemap.getVisible());
+	p->writeInt(tilemap.getOX());
+	p->writeInt(tilemap.getOY());
+}
+
+void SceneCapture::tilemapVX(TilemapVX &tilemap)
+{
+	int bitmaps[9];
+
+	for (int i = 0; i < 9; ++i)
+		bitmaps[i] = p->bitmapId(tilemap.getBitmapArray().get(i));
+
+	const int mapData = p->tableId(tilemap.getMapData());
+	const int flashData = p->tableId(tilemap.getFlashData());
+	const int flags = p->tableId(tilemap.getFlags());
+
+	p->writeRecord(TilemapVXElem);
+	p->writeInt(p->viewportId(tilemap.getViewport()));
+
+	for (int i = 0; i < 9; ++i)
+		p->writeInt(bitmaps[i]);
+
+	p->writeInt(mapData);
+	p->writeInt(flashData);
+	p->writeInt(flags);
+	p->writeBool(tilemap.getVisible());
+	p->writeInt(tilemap.getOX());
+	p->writeInt(tilemap.getOY());
+}
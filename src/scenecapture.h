@@ -0,0 +1,87 @@
+/*
+** scenecapture.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCENECAPTURE_H
+#define SCENECAPTURE_H
+
+#include <stdint.h>
+
+class Scene;
+class Viewport;
+class Sprite;
+class Plane;
+class Window;
+class Tilemap;
+class TilemapVX;
+struct SceneCapturePrivate;
+
+/* Serializes the screen's scene graph along with everything it
+ * references (bitmap contents, tilemap tables, viewports), so a
+ * slow frame can be rendered again outside of the game that
+ * built it (see the null binding's scene replay).
+ *
+ * A capture starts with 'magic' and the screen size (two int32),
+ * followed by records of one Record byte each, terminated by
+ * 'End'. Elements are recorded in their display order; bitmaps
+ * and tables are written once, right before the first record
+ * referencing them, and referred to by 1-based index after
+ * that (0 being none). Viewports are numbered the same way.
+ * Element kinds without a hook (see SceneElement::capture())
+ * are left out */
+class SceneCapture
+{
+public:
+	enum Record
+	{
+		End = 0,
+		BitmapData,
+		TableData,
+		ViewportElem,
+		SpriteElem,
+		PlaneElem,
+		WindowElem,
+		TilemapElem,
+		TilemapVXElem
+	};
+
+	static const char magic[8];
+
+	/* Captures the current screen contents to 'filename' */
+	static bool write(const char *filename);
+
+	/* Hooks for SceneElement::capture() */
+	void viewport(Viewport &vp);
+	void sprite(Sprite &sprite);
+	void plane(Plane &plane);
+	void window(Window &window);
+	void tilemap(Tilemap &tilemap);
+	void tilemapVX(TilemapVX &tilemap);
+
+private:
+	SceneCapture(SceneCapturePrivate *p);
+
+	void captureScene(Scene &scene);
+
+	SceneCapturePrivate *p;
+};
+
+#endif // SCENECAPTURE_H
@@ -0,0 +1,175 @@
+/*
+** scratcharena.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "scratcharena.h"
+
+#include "gl-util.h"
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+
+/* Targets per tier; two are enough for consecutive
+ * requests to differ, without doubling up on VRAM more */
+#define SCRATCH_RING 2
+
+/* Smallest tier edge */
+#define SCRATCH_MIN_SIZE 64
+
+/* Frames a tier is kept around without being used */
+#define SCRATCH_IDLE_FRAMES 300
+
+struct ScratchTarget
+{
+	TEXFBO obj;
+	bool smooth;
+};
+
+struct ScratchTier
+{
+	int width, height;
+
+	/* Allocated on demand, up to SCRATCH_RING */
+	std::vector<ScratchTarget*> ring;
+	size_t next;
+
+	unsigned int lastUse;
+};
+
+struct ScratchArenaPrivate
+{
+	std::vector<ScratchTier> tiers;
+	unsigned int frame;
+
+	ScratchArenaPrivate()
+	    : frame(0)
+	{}
+
+	~ScratchArenaPrivate()
+	{
+		for (size_t i = 0; i < tiers.size(); ++i)
+			freeTier(tiers[i]);
+	}
+
+	static void freeTier(ScratchTier &tier)
+	{
+		for (size_t i = 0; i < tier.ring.size(); ++i)
+		{
+			TEXFBO::fini(tier.ring[i]->obj);
+			delete tier.ring[i];
+		}
+
+		tier.ring.clear();
+	}
+
+	ScratchTier &getTier(int width, int height)
+	{
+		for (size_t i = 0; i < tiers.size(); ++i)
+			if (tiers[i].width == width && tiers[i].height == height)
+				return tiers[i];
+
+		ScratchTier tier;
+		tier.width = width;
+		tier.height = height;
+		tier.next = 0;
+		tier.lastUse = frame;
+		tiers.push_back(tier);
+
+		return tiers.back();
+	}
+
+	ScratchTarget *newTarget(int width, int height)
+	{
+		ScratchTarget *target = new ScratchTarget;
+		target->smooth = false;
+
+		TEXFBO::init(target->obj);
+		TEXFBO::allocEmpty(target->obj, width, height);
+		TEXFBO::linkFBO(target->obj);
+
+		return target;
+	}
+
+	ScratchTarget *take(ScratchTier &tier)
+	{
+		tier.lastUse = frame;
+
+		if (tier.ring.size() < SCRATCH_RING)
+		{
+			tier.ring.push_back(newTarget(tier.width, tier.height));
+			tier.next = 0;
+
+			return tier.ring.back();
+		}
+
+		ScratchTarget *target = tier.ring[tier.next];
+		tier.next = (tier.next + 1) % tier.ring.size();
+
+		return target;
+	}
+};
+
+ScratchArena::ScratchArena()
+{
+	p = new ScratchArenaPrivate;
+}
+
+ScratchArena::~ScratchArena()
+{
+	delete p;
+}
+
+TEXFBO &ScratchArena::request(int minW, int minH, bool smooth)
+{
+	const int width = findNextPow2(std::max(minW, SCRATCH_MIN_SIZE));
+	const int height = findNextPow2(std::max(minH, SCRATCH_MIN_SIZE));
+
+	ScratchTarget *target = p->take(p->getTier(width, height));
+
+	if (target->smooth != smooth)
+	{
+		TEX::bind(target->obj.tex);
+		TEX::setSmooth(smooth);
+		target->smooth = smooth;
+	}
+
+	return target->obj;
+}
+
+void ScratchArena::newFrame()
+{
+	++p->frame;
+
+	for (size_t i = 0; i < p->tiers.size();)
+	{
+		ScratchTier &tier = p->tiers[i];
+
+		if (p->frame - tier.lastUse < SCRATCH_IDLE_FRAMES)
+		{
+			++i;
+			continue;
+		}
+
+		ScratchArenaPrivate::freeTier(tier);
+		p->tiers.erase(p->tiers.begin() + i);
+	}
+}
@@ -0,0 +1,54 @@
+/*
+** scratcharena.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+struct TEXFBO;
+struct ScratchArenaPrivate;
+
+/* Short lived intermediary render targets. Requests are served
+ * from tiers of power of two sizes, each with a small ring of
+ * textures handed out in turn, so that a large request doesn't
+ * reallocate the target the next small one wants, and two
+ * consecutive requests (of any size) never return the same
+ * texture. Targets are only valid until the next frame; those
+ * unused for a while are freed */
+class ScratchArena
+{
+public:
+	ScratchArena();
+	~ScratchArena();
+
+	/* Returns a target of at least 'minW' x 'minH' (its
+	 * 'width' and 'height' being the tier size), with
+	 * linear filtering set up as per 'smooth' */
+	TEXFBO &request(int minW, int minH, bool smooth = false);
+
+	/* Frees the tiers that went unused. Called once per frame */
+	void newFrame();
+
+private:
+	ScratchArenaPrivate *p;
+};
+
+#endif // SCRATCHARENA_H
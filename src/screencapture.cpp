@@ -0,0 +1,459 @@
+/*
+** screencapture.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "screencapture.h"
+
+#include "gl-util.h"
+#include "sharedstate.h"
+#include "workerpool.h"
+#include "exception.h"
+#include "debugwriter.h"
+
+#include <SDL_image.h>
+#include <SDL_surface.h>
+
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/* Reads in flight at once; a frame is dropped from
+ * the recording if all of them are still taken */
+#define CAPTURE_SLOTS 3
+
+struct ScreenshotJob : WorkerJob
+{
+	std::vector<uint8_t> pixels;
+	int width, height;
+	std::string path;
+	bool success;
+
+	void run()
+	{
+		SDL_Surface *surf =
+		        SDL_CreateRGBSurfaceWithFormatFrom(&pixels[0], width, height, 32,
+		                                           width*4, SDL_PIXELFORMAT_ABGR8888);
+
+		success = surf && IMG_SavePNG(surf, path.c_str()) == 0;
+
+		if (surf)
+			SDL_FreeSurface(surf);
+	}
+
+	void complete()
+	{
+		if (success)
+			Debug() << "Saved screenshot to" << path;
+		else
+			Debug() << "Unable to save screenshot to" << path;
+
+		delete this;
+	}
+};
+
+/* Reused for every recorded frame; only one is in
+ * flight at a time, so frames are written in order */
+struct RecordJob : WorkerJob
+{
+	std::vector<uint8_t> pixels;
+	FILE *file;
+	bool submitted;
+	bool failed;
+
+	RecordJob()
+	    : file(0),
+	      submitted(false),
+	      failed(false)
+	{}
+
+	void run()
+	{
+		if (fwrite(&pixels[0], 1, pixels.size(), file) != pixels.size())
+			failed = true;
+	}
+};
+
+struct CaptureSlot
+{
+	PBO::ID pbo;
+	size_t pboSize;
+
+	/* Set while a read into 'pbo' is queued */
+	bool queued;
+
+	int width, height;
+
+	/* Either a screenshot, or a recorded frame */
+	std::string path;
+	bool record;
+
+	/* Order in which the recorded frames were read */
+	unsigned int seq;
+};
+
+struct ScreenCapturePrivate
+{
+	CaptureSlot slots[CAPTURE_SLOTS];
+
+	std::vector<std::string> shotRequests;
+
+	RecordJob recordJob;
+	std::string recordPath;
+	int recordWidth, recordHeight;
+	unsigned int recordedFrames;
+	unsigned int droppedFrames;
+	unsigned int nextSeq;
+
+	ScreenCapturePrivate()
+	    : recordWidth(0),
+	      recordHeight(0),
+	      recordedFrames(0),
+	      droppedFrames(0),
+	      nextSeq(0)
+	{
+		for (size_t i = 0; i < CAPTURE_SLOTS; ++i)
+		{
+			slots[i].pbo = PBO::ID(0);
+			slots[i].pboSize = 0;
+			slots[i].queued = false;
+			slots[i].record = false;
+			slots[i].seq = 0;
+		}
+	}
+
+	~ScreenCapturePrivate()
+	{
+		for (size_t i = 0; i < CAPTURE_SLOTS; ++i)
+			if (slots[i].pbo != PBO::ID(0))
+				PBO::del(slots[i].pbo);
+	}
+
+	CaptureSlot *freeSlot()
+	{
+		for (size_t i = 0; i < CAPTURE_SLOTS; ++i)
+			if (!slots[i].queued)
+				return &slots[i];
+
+		return 0;
+	}
+
+	CaptureSlot *oldestRecordSlot()
+	{
+		CaptureSlot *oldest = 0;
+
+		for (size_t i = 0; i < CAPTURE_SLOTS; ++i)
+			if (slots[i].queued && slots[i].record
+			    && (!oldest || slots[i].seq < oldest->seq))
+				oldest = &slots[i];
+
+		return oldest;
+	}
+
+	void submitShot(CaptureSlot &slot, ScreenshotJob *job)
+	{
+		WorkerPool &pool = shState->workerPool();
+
+		job->width = slot.width;
+		job->height = slot.height;
+		job->path = slot.path;
+
+		if (pool.enabled())
+		{
+			pool.submit(*job, true);
+		}
+		else
+		{
+			job->run();
+			job->complete();
+		}
+	}
+
+	bool recordJobBusy()
+	{
+		return recordJob.submitted && !shState->workerPool().isDone(recordJob);
+	}
+
+	void submitRecord()
+	{
+		WorkerPool &pool = shState->workerPool();
+
+		if (pool.enabled())
+		{
+			pool.submit(recordJob);
+			recordJob.submitted = true;
+		}
+		else
+		{
+			recordJob.run();
+		}
+
+		++recordedFrames;
+	}
+
+	void finishRecordJob()
+	{
+		if (recordJob.submitted)
+			shState->workerPool().wait(recordJob);
+
+		recordJob.submitted = false;
+	}
+
+	/* Reads the bound framebuffer straight into
+	 * the destination (stalling until it's drawn) */
+	void readDirect(int width, int height, std::vector<uint8_t> &out)
+	{
+		out.resize(width * height * 4);
+		gl.ReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &out[0]);
+	}
+
+	void captureDirect(int width, int height, const std::string &path, bool record)
+	{
+		if (record)
+		{
+			readDirect(width, height, recordJob.pixels);
+			submitRecord();
+
+			return;
+		}
+
+		CaptureSlot slot;
+		slot.width = width;
+		slot.height = height;
+		slot.path = path;
+
+		ScreenshotJob *job = new ScreenshotJob;
+		readDirect(width, height, job->pixels);
+		submitShot(slot, job);
+	}
+
+	void queueRead(CaptureSlot &slot, int width, int height)
+	{
+		const size_t size = width * height * 4;
+
+		if (slot.pbo == PBO::ID(0))
+			slot.pbo = PBO::gen();
+
+		PBO::bind(slot.pbo);
+
+		if (size > slot.pboSize)
+		{
+			PBO::allocEmpty(size, GL_STREAM_READ);
+			slot.pboSize = size;
+		}
+
+		gl.ReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+		PBO::unbind();
+
+		slot.width = width;
+		slot.height = height;
+		slot.queued = true;
+	}
+
+	/* Returns false if the mapping failed */
+	bool mapSlot(CaptureSlot &slot, std::vector<uint8_t> &out)
+	{
+		const size_t size = slot.width * slot.height * 4;
+
+		PBO::bind(slot.pbo);
+		const void *data = PBO::mapRead(0, size);
+
+		if (data)
+		{
+			out.resize(size);
+			memcpy(&out[0], data, size);
+			PBO::unmap();
+		}
+
+		PBO::unbind();
+
+		return data != 0;
+	}
+};
+
+ScreenCapture::ScreenCapture()
+{
+	p = new ScreenCapturePrivate;
+}
+
+ScreenCapture::~ScreenCapture()
+{
+	stopRecording();
+
+	delete p;
+}
+
+void ScreenCapture::requestScreenshot(const std::string &path)
+{
+	p->shotRequests.push_back(path);
+}
+
+void ScreenCapture::startRecording(const std::string &path)
+{
+	stopRecording();
+
+	FILE *file = fopen(path.c_str(), "wb");
+
+	if (!file)
+		throw Exception(Exception::MKXPError, "Unable to open '%s' for recording",
+		                path.c_str());
+
+	p->recordJob.file = file;
+	p->recordJob.failed = false;
+	p->recordPath = path;
+	p->recordWidth = p->recordHeight = 0;
+	p->recordedFrames = p->droppedFrames = 0;
+
+	Debug() << "Recording to" << path;
+}
+
+void ScreenCapture::stopRecording()
+{
+	if (!p->recordJob.file)
+		return;
+
+	/* Frames still being read back are let go */
+	for (size_t i = 0; i < CAPTURE_SLOTS; ++i)
+		if (p->slots[i].record)
+			p->slots[i].queued = false;
+
+	p->finishRecordJob();
+
+	fclose(p->recordJob.file);
+	p->recordJob.file = 0;
+
+	if (p->recordJob.failed)
+		Debug() << "Error writing recording" << p->recordPath;
+
+	Debug() << "Recorded" << p->recordedFrames << "frames of"
+	        << p->recordWidth << "x" << p->recordHeight << "to" << p->recordPath
+	        << "(" << p->droppedFrames << "dropped)";
+}
+
+bool ScreenCapture::recording() const
+{
+	return p->recordJob.file != 0;
+}
+
+bool ScreenCapture::pending() const
+{
+	return !p->shotRequests.empty() || recording();
+}
+
+void ScreenCapture::capture(TEXFBO &frame, int width, int height)
+{
+	if (recording())
+	{
+		/* The stream holds frames of one size only */
+		if (p->recordWidth == 0)
+		{
+			p->recordWidth = width;
+			p->recordHeight = height;
+		}
+		else if (width != p->recordWidth || height != p->recordHeight)
+		{
+			Debug() << "Screen resized; stopping recording";
+			stopRecording();
+		}
+	}
+
+	FBO::bind(frame.fbo);
+
+	for (size_t i = 0; i < p->shotRequests.size(); ++i)
+	{
+		CaptureSlot *slot = gl.pixel_pack_buffer ? p->freeSlot() : 0;
+
+		if (!slot)
+		{
+			p->captureDirect(width, height, p->shotRequests[i], false);
+			continue;
+		}
+
+		p->queueRead(*slot, width, height);
+		slot->path = p->shotRequests[i];
+		slot->record = false;
+	}
+
+	p->shotRequests.clear();
+
+	if (recording())
+	{
+		CaptureSlot *slot = gl.pixel_pack_buffer ? p->freeSlot() : 0;
+
+		if (slot)
+		{
+			p->queueRead(*slot, width, height);
+			slot->record = true;
+			slot->seq = p->nextSeq++;
+		}
+		else if (!gl.pixel_pack_buffer && !p->recordJobBusy())
+		{
+			p->captureDirect(width, height, std::string(), true);
+		}
+		else
+		{
+			++p->droppedFrames;
+		}
+	}
+
+	FBO::unbind();
+}
+
+void ScreenCapture::process()
+{
+	for (size_t i = 0; i < CAPTURE_SLOTS; ++i)
+	{
+		CaptureSlot &slot = p->slots[i];
+
+		if (!slot.queued || slot.record)
+			continue;
+
+		ScreenshotJob *job = new ScreenshotJob;
+
+		if (p->mapSlot(slot, job->pixels))
+		{
+			p->submitShot(slot, job);
+		}
+		else
+		{
+			Debug() << "Unable to read back screenshot for" << slot.path;
+			delete job;
+		}
+
+		slot.queued = false;
+	}
+
+	/* The writer takes one frame at a time, in order */
+	CaptureSlot *slot = p->oldestRecordSlot();
+
+	if (!slot || p->recordJobBusy())
+		return;
+
+	p->finishRecordJob();
+
+	if (p->mapSlot(*slot, p->recordJob.pixels))
+		p->submitRecord();
+	else
+		++p->droppedFrames;
+
+	slot->queued = false;
+}
@@ -0,0 +1,67 @@
+/*
+** screencapture.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCREENCAPTURE_H
+#define SCREENCAPTURE_H
+
+#include <string>
+
+struct TEXFBO;
+struct ScreenCapturePrivate;
+
+/* Saves frames of the game screen without stalling on them:
+ * the pixels are read back into pixel pack buffers, which are
+ * only mapped the frame after (once the GPU got to them), and
+ * then written out by a worker. Screenshots go to PNG files;
+ * while recording, every frame is appended to a raw RGBA video
+ * stream (eg. for 'ffmpeg -f rawvideo -pix_fmt rgba') */
+class ScreenCapture
+{
+public:
+	ScreenCapture();
+	~ScreenCapture();
+
+	/* Saves the next drawn frame to 'path' */
+	void requestScreenshot(const std::string &path);
+
+	/* Starts appending every drawn frame to 'path'.
+	 * Throws if the file can't be opened */
+	void startRecording(const std::string &path);
+	void stopRecording();
+	bool recording() const;
+
+	/* Whether the current frame has to be captured */
+	bool pending() const;
+
+	/* Queues the read of the 'width' x 'height' game screen
+	 * held by 'frame' */
+	void capture(TEXFBO &frame, int width, int height);
+
+	/* Hands the reads queued during earlier frames off to
+	 * the workers. Called once per frame */
+	void process();
+
+private:
+	ScreenCapturePrivate *p;
+};
+
+#endif // SCREENCAPTURE_H
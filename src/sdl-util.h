@@ -5,6 +5,9 @@
 #include <SDL_thread.h>
 #include <SDL_rwops.h>
 
+#include "profiler.h"
+#include "threadpolicy.h"
+
 #include <string>
 #include <iostream>
 
@@ -34,17 +37,41 @@ private:
 	mutable SDL_atomic_t atom;
 };
 
+template<class C>
+struct __SDLThreadData
+{
+	C *obj;
+	ThreadPolicy::Role role;
+};
+
 template<class C, void (C::*func)()>
-int __sdlThreadFun(void *obj)
+int __sdlThreadFun(void *data)
 {
-	(static_cast<C*>(obj)->*func)();
+	__SDLThreadData<C> d = *static_cast<__SDLThreadData<C>*>(data);
+	delete static_cast<__SDLThreadData<C>*>(data);
+
+	ThreadPolicy::apply(d.role);
+
+	(d.obj->*func)();
 	return 0;
 }
 
 template<class C, void (C::*func)()>
-SDL_Thread *createSDLThread(C *obj, const std::string &name = std::string())
+SDL_Thread *createSDLThread(C *obj, const std::string &name = std::string(),
+                            ThreadPolicy::Role role = ThreadPolicy::Default)
 {
-	return SDL_CreateThread((__sdlThreadFun<C, func>), name.c_str(), obj);
+	__SDLThreadData<C> *data = new __SDLThreadData<C>;
+	data->obj = obj;
+	data->role = role;
+
+	SDL_Thread *thread = SDL_CreateThread((__sdlThreadFun<C, func>), name.c_str(), data);
+
+	if (thread)
+		Profiler::nameThread(SDL_GetThreadID(thread), name.c_str());
+	else
+		delete data;
+
+	return thread;
 }
 
 /* On Android, SDL_RWFromFile always opens files from inside
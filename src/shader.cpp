@@ -23,10 +23,14 @@
 #include "sharedstate.h"
 #include "glstate.h"
 #include "exception.h"
+#include "shadercache.h"
+#include "startuptimer.h"
 
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 #include <iostream>
+#include <string>
 
 #include "common.h.xxd"
 #include "sprite.frag.xxd"
@@ -35,7 +39,7 @@
 #include "transSimple.frag.xxd"
 #include "bitmapBlit.frag.xxd"
 #include "plane.frag.xxd"
-#include "gray.frag.xxd"
+#include "viewport.frag.xxd"
 #include "flatColor.frag.xxd"
 #include "simple.frag.xxd"
 #include "simpleColor.frag.xxd"
@@ -46,12 +50,25 @@
 #include "simple.vert.xxd"
 #include "simpleColor.vert.xxd"
 #include "sprite.vert.xxd"
+#include "spriteWave.vert.xxd"
+#include "spriteInstanced.vert.xxd"
+#include "spriteInstanced.frag.xxd"
 #include "tilemap.vert.xxd"
+#include "tilemapIndexed.frag.xxd"
+#include "tilemapDepth.vert.xxd"
+#include "alphaTest.frag.xxd"
 #include "blur.frag.xxd"
 #include "simpleMatrix.vert.xxd"
 #include "blurH.vert.xxd"
 #include "blurV.vert.xxd"
 #include "tilemapvx.vert.xxd"
+#include "glyph.frag.xxd"
+#include "particle.frag.xxd"
+#include "textBlit.frag.xxd"
+#include "radialBlur.frag.xxd"
+#include "planeWrap.frag.xxd"
+#include "upscale.frag.xxd"
+#include "yuv.frag.xxd"
 
 
 #define INIT_SHADER(vert, frag, name) \
@@ -60,6 +77,13 @@
 	#vert, #frag, #name); \
 }
 
+/* With preprocessor 'defines' prepended to both stages */
+#define INIT_SHADER_DEFS(vert, frag, name, defines) \
+{ \
+	Shader::init(shader_##vert##_vert, shader_##vert##_vert_len, shader_##frag##_frag, shader_##frag##_frag_len, \
+	#vert, #frag, #name, defines); \
+}
+
 #define GET_U(name) u_##name = gl.GetUniformLocation(program, #name)
 
 static void printShaderLog(GLuint shader)
@@ -85,6 +109,7 @@ static void printProgramLog(GLuint program)
 }
 
 Shader::Shader()
+    : uniformsSet(0)
 {
 	vertShader = gl.CreateShader(GL_VERTEX_SHADER);
 	fragShader = gl.CreateShader(GL_FRAGMENT_SHADER);
@@ -107,18 +132,41 @@ void Shader::bind()
 
 void Shader::unbind()
 {
-	gl.ActiveTexture(GL_TEXTURE0);
 	glState.program.set(0);
 }
 
-static void setupShaderSource(GLuint shader, GLenum type,
-                              const unsigned char *body, int bodySize)
+static const char glesDefine[] = "#define GLSLES\n";
+static const char fragDefine[] = "#define FRAGMENT_SHADER\n";
+
+/* Covers everything setupShaderSource feeds to the compiler */
+static uint64_t programCacheKey(const unsigned char *vert, int vertSize,
+                                const unsigned char *frag, int fragSize,
+                                const char *defines)
 {
-	static const char glesDefine[] = "#define GLSLES\n";
-	static const char fragDefine[] = "#define FRAGMENT_SHADER\n";
+	uint64_t key = SHADER_CACHE_HASH_INIT;
+
+	if (gl.glsles)
+		key = shaderCacheHash(key, glesDefine, sizeof(glesDefine)-1);
+
+	if (defines)
+		key = shaderCacheHash(key, defines, strlen(defines));
+
+	key = shaderCacheHash(key, shader_common_h, shader_common_h_len);
+	key = shaderCacheHash(key, vert, vertSize);
+	key = shaderCacheHash(key, &vertSize, sizeof(vertSize));
+	key = shaderCacheHash(key, fragDefine, sizeof(fragDefine)-1);
+	key = shaderCacheHash(key, frag, fragSize);
+	key = shaderCacheHash(key, &fragSize, sizeof(fragSize));
 
-	const GLchar *shaderSrc[4];
-	GLint shaderSrcSize[4];
+	return key;
+}
+
+static void setupShaderSource(GLuint shader, GLenum type,
+                              const unsigned char *body, int bodySize,
+                              const char *defines)
+{
+	const GLchar *shaderSrc[5];
+	GLint shaderSrcSize[5];
 	size_t i = 0;
 
 	if (gl.glsles)
@@ -128,6 +176,13 @@ static void setupShaderSource(GLuint shader, GLenum type,
 		++i;
 	}
 
+	if (defines)
+	{
+		shaderSrc[i] = defines;
+		shaderSrcSize[i] = strlen(defines);
+		++i;
+	}
+
 	if (type == GL_FRAGMENT_SHADER)
 	{
 		shaderSrc[i] = fragDefine;
@@ -149,12 +204,23 @@ static void setupShaderSource(GLuint shader, GLenum type,
 void Shader::init(const unsigned char *vert, int vertSize,
                   const unsigned char *frag, int fragSize,
                   const char *vertName, const char *fragName,
-                  const char *programName)
+                  const char *programName, const char *defines)
 {
 	GLint success;
 
+	ShaderCache *cache = ShaderCache::active();
+	uint64_t cacheKey = 0;
+
+	if (cache)
+	{
+		cacheKey = programCacheKey(vert, vertSize, frag, fragSize, defines);
+
+		if (cache->load(program, cacheKey))
+			return;
+	}
+
 	/* Compile vertex shader */
-	setupShaderSource(vertShader, GL_VERTEX_SHADER, vert, vertSize);
+	setupShaderSource(vertShader, GL_VERTEX_SHADER, vert, vertSize, defines);
 	gl.CompileShader(vertShader);
 
 	gl.GetShaderiv(vertShader, GL_COMPILE_STATUS, &success);
@@ -168,7 +234,7 @@ void Shader::init(const unsigned char *vert, int vertSize,
 	}
 
 	/* Compile fragment shader */
-	setupShaderSource(fragShader, GL_FRAGMENT_SHADER, frag, fragSize);
+	setupShaderSource(fragShader, GL_FRAGMENT_SHADER, frag, fragSize, defines);
 	gl.CompileShader(fragShader);
 
 	gl.GetShaderiv(fragShader, GL_COMPILE_STATUS, &success);
@@ -188,6 +254,13 @@ void Shader::init(const unsigned char *vert, int vertSize,
 	gl.BindAttribLocation(program, Position, "position");
 	gl.BindAttribLocation(program, TexCoord, "texCoord");
 	gl.BindAttribLocation(program, Color, "color");
+	gl.BindAttribLocation(program, InstAxes, "instAxes");
+	gl.BindAttribLocation(program, InstOrigin, "instOrigin");
+	gl.BindAttribLocation(program, InstTone, "instTone");
+	gl.BindAttribLocation(program, InstBushDepth, "instBushDepth");
+
+	if (cache && gl.ProgramParameteri)
+		gl.ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
 	gl.LinkProgram(program);
 
@@ -200,6 +273,9 @@ void Shader::init(const unsigned char *vert, int vertSize,
 	                    "GLSL: An error occured while linking program '%s' (vertex '%s', fragment '%s')",
 	                    programName, vertName, fragName);
 	}
+
+	if (cache)
+		cache->store(program, cacheKey);
 }
 
 void Shader::initFromFile(const char *_vertFile, const char *_fragFile,
@@ -214,34 +290,80 @@ void Shader::initFromFile(const char *_vertFile, const char *_fragFile,
 	     _vertFile, _fragFile, programName);
 }
 
+bool Shader::uniformChanged(GLint location, const Vec4 &value)
+{
+	/* Not part of this program (eg. compiled out of
+	 * a permutation); GL would ignore the upload */
+	if (location == -1)
+		return false;
+
+	/* Locations outside the cache are always uploaded */
+	if (location < 0 || location >= UniformCacheSize)
+	{
+		++glCallCounts.uniformUploads;
+		return true;
+	}
+
+	const uint32_t bit = 1u << location;
+
+	if ((uniformsSet & bit) && uniformValues[location] == value)
+	{
+		++glCallCounts.skipped;
+		return false;
+	}
+
+	uniformValues[location] = value;
+	uniformsSet |= bit;
+	++glCallCounts.uniformUploads;
+
+	return true;
+}
+
+void Shader::setFloatUniform(GLint location, float value)
+{
+	if (uniformChanged(location, Vec4(value, 0, 0, 0)))
+		gl.Uniform1f(location, value);
+}
+
+void Shader::setVec2Uniform(GLint location, float x, float y)
+{
+	if (uniformChanged(location, Vec4(x, y, 0, 0)))
+		gl.Uniform2f(location, x, y);
+}
+
 void Shader::setVec4Uniform(GLint location, const Vec4 &vec)
 {
-	gl.Uniform4f(location, vec.x, vec.y, vec.z, vec.w);
+	if (uniformChanged(location, vec))
+		gl.Uniform4f(location, vec.x, vec.y, vec.z, vec.w);
 }
 
-void Shader::setTexUniform(GLint location, unsigned unitIndex, TEX::ID texture)
+void Shader::setIntUniform(GLint location, int value)
 {
-	GLenum texUnit = GL_TEXTURE0 + unitIndex;
+	if (uniformChanged(location, Vec4(value, 0, 0, 0)))
+		gl.Uniform1i(location, value);
+}
 
-	gl.ActiveTexture(texUnit);
-	gl.BindTexture(GL_TEXTURE_2D, texture.gl);
-	gl.Uniform1i(location, unitIndex);
-	gl.ActiveTexture(GL_TEXTURE0);
+void Shader::setTexUniform(GLint location, unsigned unitIndex, TEX::ID texture)
+{
+	TEX::bindUnit(unitIndex, texture);
+	setIntUniform(location, unitIndex);
 }
 
 void ShaderBase::GLProjMat::apply(const Vec2i &value)
 {
-	/* glOrtho replacement */
+	/* glOrtho replacement. A negative height
+	 * flips the projection vertically */
 	const float a = 2.f / value.x;
 	const float b = 2.f / value.y;
 	const float c = -2.f;
+	const float d = value.y < 0 ? 1 : -1;
 
 	GLfloat mat[16] =
 	{
 		 a,  0,  0,  0,
 		 0,  b,  0,  0,
 		 0,  0,  c,  0,
-		-1, -1, -1,  1
+		-1,  d, -1,  1
 	};
 
 	gl.UniformMatrix4fv(u_mat, 1, GL_FALSE, mat);
@@ -251,6 +373,9 @@ void ShaderBase::init()
 {
 	GET_U(texSizeInv);
 	GET_U(translation);
+	GET_U(unitQuad);
+	GET_U(unitPosRect);
+	GET_U(unitTexRect);
 
 	projMat.u_mat = gl.GetUniformLocation(program, "projMat");
 }
@@ -258,17 +383,39 @@ void ShaderBase::init()
 void ShaderBase::applyViewportProj()
 {
 	const IntRect &vp = glState.viewport.get();
-	projMat.set(Vec2i(vp.w, vp.h));
+	const ScreenMapping &mapping = glState.scissorBox.getMapping();
+
+	if (mapping.active() && vp == mapping.dst)
+		projMat.set(Vec2i(mapping.res.x, -mapping.res.y));
+	else
+		projMat.set(Vec2i(vp.w, vp.h));
 }
 
 void ShaderBase::setTexSize(const Vec2i &value)
 {
-	gl.Uniform2f(u_texSizeInv, 1.f / value.x, 1.f / value.y);
+	setVec2Uniform(u_texSizeInv, 1.f / value.x, 1.f / value.y);
 }
 
 void ShaderBase::setTranslation(const Vec2i &value)
 {
-	gl.Uniform2f(u_translation, value.x, value.y);
+	setVec2Uniform(u_translation, value.x, value.y);
+}
+
+bool ShaderBase::hasUnitQuad() const
+{
+	return u_unitQuad >= 0;
+}
+
+void ShaderBase::setUnitQuad(const FloatRect &pos, const FloatRect &tex)
+{
+	setVec4Uniform(u_unitPosRect, Vec4(pos.x, pos.y, pos.w, pos.h));
+	setVec4Uniform(u_unitTexRect, Vec4(tex.x, tex.y, tex.w, tex.h));
+	setFloatUniform(u_unitQuad, 1);
+}
+
+void ShaderBase::clearUnitQuad()
+{
+	setFloatUniform(u_unitQuad, 0);
 }
 
 
@@ -298,7 +445,7 @@ SimpleShader::SimpleShader()
 
 void SimpleShader::setTexOffsetX(int value)
 {
-	gl.Uniform1f(u_texOffsetX, value);
+	setFloatUniform(u_texOffsetX, value);
 }
 
 
@@ -315,6 +462,28 @@ SimpleAlphaShader::SimpleAlphaShader()
 	INIT_SHADER(simpleColor, simpleAlpha, SimpleAlphaShader);
 
 	ShaderBase::init();
+
+	GET_U(squash);
+}
+
+void SimpleAlphaShader::setSquash(float amount, float centerY)
+{
+	setVec2Uniform(u_squash, amount, centerY);
+}
+
+
+SimpleAlphaUniShader::SimpleAlphaUniShader()
+{
+	INIT_SHADER(simple, simpleAlphaUni, SimpleAlphaUniShader);
+
+	ShaderBase::init();
+
+	GET_U(alpha);
+}
+
+void SimpleAlphaUniShader::setAlpha(float value)
+{
+	setFloatUniform(u_alpha, value);
 }
 
 
@@ -350,7 +519,7 @@ void AlphaSpriteShader::setSpriteMat(const float value[16])
 
 void AlphaSpriteShader::setAlpha(float value)
 {
-	gl.Uniform1f(u_alpha, value);
+	setFloatUniform(u_alpha, value);
 }
 
 
@@ -363,8 +532,8 @@ TransShader::TransShader()
 	GET_U(currentScene);
 	GET_U(frozenScene);
 	GET_U(transMap);
-	GET_U(prog);
-	GET_U(vague);
+	GET_U(transMapScale);
+	GET_U(ramp);
 }
 
 void TransShader::setCurrentScene(TEX::ID tex)
@@ -377,19 +546,17 @@ void TransShader::setFrozenScene(TEX::ID tex)
 	setTexUniform(u_frozenScene, 2, tex);
 }
 
-void TransShader::setTransMap(TEX::ID tex)
-{
-	setTexUniform(u_transMap, 3, tex);
-}
-
-void TransShader::setProg(float value)
+void TransShader::setTransMap(const TEXFBO &tex, const Vec2 &coverage)
 {
-	gl.Uniform1f(u_prog, value);
+	setTexUniform(u_transMap, 3, tex.tex);
+	setVec2Uniform(u_transMapScale, (float) tex.width / tex.texW / coverage.x,
+	                                (float) tex.height / tex.texH / coverage.y);
 }
 
-void TransShader::setVague(float value)
+void TransShader::setRamp(float prog, float vague)
 {
-	gl.Uniform1f(u_vague, value);
+	/* clamp((v - prog) / vague, 0, 1), as one multiply-add */
+	setVec2Uniform(u_ramp, 1.0f / vague, -prog / vague);
 }
 
 
@@ -416,13 +583,31 @@ void SimpleTransShader::setFrozenScene(TEX::ID tex)
 
 void SimpleTransShader::setProg(float value)
 {
-	gl.Uniform1f(u_prog, value);
+	setFloatUniform(u_prog, value);
 }
 
 
-SpriteShader::SpriteShader()
+/* Preprocessor lines enabling the effects in 'features' */
+static std::string spriteDefines(unsigned features)
+{
+	std::string defines;
+
+	if (features & SpriteTone)
+		defines += "#define SPRITE_TONE\n";
+	if (features & SpriteColor)
+		defines += "#define SPRITE_COLOR\n";
+	if (features & SpriteOpacity)
+		defines += "#define SPRITE_OPACITY\n";
+	if (features & SpriteBush)
+		defines += "#define SPRITE_BUSH\n";
+
+	return defines;
+}
+
+SpriteShader::SpriteShader(unsigned features)
+    : _features(features)
 {
-	INIT_SHADER(sprite, sprite, SpriteShader);
+	INIT_SHADER_DEFS(sprite, sprite, SpriteShader, spriteDefines(features).c_str());
 
 	ShaderBase::init();
 
@@ -451,17 +636,90 @@ void SpriteShader::setColor(const Vec4 &color)
 
 void SpriteShader::setOpacity(float value)
 {
-	gl.Uniform1f(u_opacity, value);
+	setFloatUniform(u_opacity, value);
 }
 
 void SpriteShader::setBushDepth(float value)
 {
-	gl.Uniform1f(u_bushDepth, value);
+	setFloatUniform(u_bushDepth, value);
 }
 
 void SpriteShader::setBushOpacity(float value)
 {
-	gl.Uniform1f(u_bushOpacity, value);
+	setFloatUniform(u_bushOpacity, value);
+}
+
+
+WaveSpriteShader::WaveSpriteShader(unsigned features)
+    : _features(features)
+{
+	INIT_SHADER_DEFS(spriteWave, sprite, WaveSpriteShader, spriteDefines(features).c_str());
+
+	ShaderBase::init();
+
+	GET_U(spriteMat);
+	GET_U(tone);
+	GET_U(color);
+	GET_U(opacity);
+	GET_U(bushDepth);
+	GET_U(bushOpacity);
+	GET_U(wave);
+	GET_U(waveChunks);
+}
+
+void WaveSpriteShader::setSpriteMat(const float value[16])
+{
+	gl.UniformMatrix4fv(u_spriteMat, 1, GL_FALSE, value);
+}
+
+void WaveSpriteShader::setTone(const Vec4 &tone)
+{
+	setVec4Uniform(u_tone, tone);
+}
+
+void WaveSpriteShader::setColor(const Vec4 &color)
+{
+	setVec4Uniform(u_color, color);
+}
+
+void WaveSpriteShader::setOpacity(float value)
+{
+	setFloatUniform(u_opacity, value);
+}
+
+void WaveSpriteShader::setBushDepth(float value)
+{
+	setFloatUniform(u_bushDepth, value);
+}
+
+void WaveSpriteShader::setBushOpacity(float value)
+{
+	setFloatUniform(u_bushOpacity, value);
+}
+
+void WaveSpriteShader::setWave(int amp, int length, float phase, float zoomY)
+{
+	const float pi = 3.141592654f;
+
+	setVec4Uniform(u_wave, Vec4(amp, (pi * 2) / length,
+	                            (phase * pi) / 180.0f, 1.0f / zoomY));
+}
+
+void WaveSpriteShader::setChunks(int firstLength, int visibleLength, int width)
+{
+	/* A partial first chunk is treated as
+	 * the end of one starting above it */
+	float start = firstLength != 0 ? firstLength - 8 : 0;
+
+	setVec4Uniform(u_waveChunks, Vec4(start, visibleLength, width, 0));
+}
+
+
+InstancedSpriteShader::InstancedSpriteShader()
+{
+	INIT_SHADER(spriteInstanced, spriteInstanced, InstancedSpriteShader);
+
+	ShaderBase::init();
 }
 
 
@@ -494,22 +752,87 @@ void PlaneShader::setFlash(const Vec4 &flash)
 
 void PlaneShader::setOpacity(float value)
 {
-	gl.Uniform1f(u_opacity, value);
+	setFloatUniform(u_opacity, value);
+}
+
+
+PlaneWrapShader::PlaneWrapShader()
+{
+	INIT_SHADER(simple, planeWrap, PlaneWrapShader);
+
+	ShaderBase::init();
+
+	GET_U(texSize);
+	GET_U(bitmapSize);
+	GET_U(offset);
+	GET_U(tone);
+	GET_U(color);
+	GET_U(flash);
+	GET_U(opacity);
+}
+
+void PlaneWrapShader::setTexSize(const Vec2i &value)
+{
+	/* The fragment stage works in pixels */
+	ShaderBase::setTexSize(value);
+	setVec2Uniform(u_texSize, value.x, value.y);
+}
+
+void PlaneWrapShader::setBitmapSize(const Vec2i &value)
+{
+	setVec2Uniform(u_bitmapSize, value.x, value.y);
+}
+
+void PlaneWrapShader::setOffset(const Vec2 &value)
+{
+	setVec2Uniform(u_offset, value.x, value.y);
+}
+
+void PlaneWrapShader::setTone(const Vec4 &tone)
+{
+	setVec4Uniform(u_tone, tone);
+}
+
+void PlaneWrapShader::setColor(const Vec4 &color)
+{
+	setVec4Uniform(u_color, color);
+}
+
+void PlaneWrapShader::setFlash(const Vec4 &flash)
+{
+	setVec4Uniform(u_flash, flash);
 }
 
+void PlaneWrapShader::setOpacity(float value)
+{
+	setFloatUniform(u_opacity, value);
+}
 
-GrayShader::GrayShader()
+
+ViewportShader::ViewportShader()
 {
-	INIT_SHADER(simple, gray, GrayShader);
+	INIT_SHADER(simple, viewport, ViewportShader);
 
 	ShaderBase::init();
 
-	GET_U(gray);
+	GET_U(tone);
+	GET_U(color);
+	GET_U(flash);
+}
+
+void ViewportShader::setTone(const Vec4 &tone)
+{
+	setVec4Uniform(u_tone, tone);
+}
+
+void ViewportShader::setColor(const Vec4 &color)
+{
+	setVec4Uniform(u_color, color);
 }
 
-void GrayShader::setGray(float value)
+void ViewportShader::setFlash(const Vec4 &flash)
 {
-	gl.Uniform1f(u_gray, value);
+	setVec4Uniform(u_flash, flash);
 }
 
 
@@ -520,18 +843,110 @@ TilemapShader::TilemapShader()
 	ShaderBase::init();
 
 	GET_U(aniIndex);
+	GET_U(texCoordScale);
 }
 
 void TilemapShader::setAniIndex(int value)
 {
-	gl.Uniform1f(u_aniIndex, value);
+	setFloatUniform(u_aniIndex, value);
+}
+
+void TilemapShader::setTexCoordScale(float value)
+{
+	setFloatUniform(u_texCoordScale, value);
+}
+
+
+UpscaleShader::UpscaleShader()
+{
+	INIT_SHADER(simple, upscale, UpscaleShader);
+
+	ShaderBase::init();
+
+	GET_U(footprint);
+}
+
+void UpscaleShader::setFootprint(const Vec2 &value)
+{
+	setVec2Uniform(u_footprint, value.x, value.y);
+}
+
+
+YUVShader::YUVShader()
+{
+	INIT_SHADER(simple, yuv, YUVShader);
+
+	ShaderBase::init();
+
+	GET_U(texCb);
+	GET_U(texCr);
+}
+
+void YUVShader::setChroma(TEX::ID cb, TEX::ID cr)
+{
+	setTexUniform(u_texCb, 1, cb);
+	setTexUniform(u_texCr, 2, cr);
+}
+
+
+TilemapDepthShader::TilemapDepthShader()
+{
+	INIT_SHADER(tilemapDepth, alphaTest, TilemapDepthShader);
+
+	ShaderBase::init();
+
+	GET_U(aniIndex);
+	GET_U(depthStep);
+}
+
+void TilemapDepthShader::setAniIndex(int value)
+{
+	setFloatUniform(u_aniIndex, value);
+}
+
+void TilemapDepthShader::setDepthStep(float value)
+{
+	setFloatUniform(u_depthStep, value);
+}
+
+
+TilemapIndexedShader::TilemapIndexedShader()
+{
+	INIT_SHADER(simple, tilemapIndexed, TilemapIndexedShader);
+
+	ShaderBase::init();
+
+	GET_U(mapTex);
+	GET_U(mapSize);
+	GET_U(atlasSizeInv);
+	GET_U(aniIndex);
+}
+
+void TilemapIndexedShader::setMapTex(TEX::ID tex)
+{
+	setTexUniform(u_mapTex, 1, tex);
+}
+
+void TilemapIndexedShader::setMapSize(const Vec2i &value)
+{
+	setVec2Uniform(u_mapSize, value.x, value.y);
+}
+
+void TilemapIndexedShader::setAtlasSize(const Vec2i &value)
+{
+	setVec2Uniform(u_atlasSizeInv, 1.f / value.x, 1.f / value.y);
+}
+
+void TilemapIndexedShader::setAniIndex(int value)
+{
+	setFloatUniform(u_aniIndex, value);
 }
 
 
 
 FlashMapShader::FlashMapShader()
 {
-	INIT_SHADER(simpleColor, flashMap, FlashMapShader);
+	INIT_SHADER(simple, flashMap, FlashMapShader);
 
 	ShaderBase::init();
 
@@ -540,7 +955,7 @@ FlashMapShader::FlashMapShader()
 
 void FlashMapShader::setAlpha(float value)
 {
-	gl.Uniform1f(u_alpha, value);
+	setFloatUniform(u_alpha, value);
 }
 
 
@@ -555,7 +970,7 @@ HueShader::HueShader()
 
 void HueShader::setHueAdjust(float value)
 {
-	gl.Uniform1f(u_hueAdjust, value);
+	setFloatUniform(u_hueAdjust, value);
 }
 
 
@@ -574,6 +989,47 @@ void SimpleMatrixShader::setMatrix(const float value[16])
 }
 
 
+RadialBlurShader::RadialBlurShader()
+{
+	INIT_SHADER(simple, radialBlur, RadialBlurShader);
+
+	ShaderBase::init();
+
+	GET_U(texSize);
+	GET_U(bitmapSize);
+	GET_U(baseRot);
+	GET_U(stepRot);
+	GET_U(divisions);
+	GET_U(opacity);
+}
+
+void RadialBlurShader::setTexSize(const Vec2i &value)
+{
+	/* The fragment stage works in pixels */
+	ShaderBase::setTexSize(value);
+	setVec2Uniform(u_texSize, value.x, value.y);
+}
+
+void RadialBlurShader::setBitmapSize(const Vec2i &value)
+{
+	setVec2Uniform(u_bitmapSize, value.x, value.y);
+}
+
+void RadialBlurShader::setRotation(float base, float step)
+{
+	const float toRad = 3.141592654f / 180.0f;
+
+	setVec2Uniform(u_baseRot, cosf(base * toRad), sinf(base * toRad));
+	setVec2Uniform(u_stepRot, cosf(step * toRad), sinf(step * toRad));
+}
+
+void RadialBlurShader::setDivisions(int value)
+{
+	setIntUniform(u_divisions, value);
+	setFloatUniform(u_opacity, 1.0f / value);
+}
+
+
 BlurShader::HPass::HPass()
 {
 	INIT_SHADER(blurH, blur, BlurShader::HPass);
@@ -596,11 +1052,17 @@ TilemapVXShader::TilemapVXShader()
 	ShaderBase::init();
 
 	GET_U(aniOffset);
+	GET_U(texCoordScale);
 }
 
 void TilemapVXShader::setAniOffset(const Vec2 &value)
 {
-	gl.Uniform2f(u_aniOffset, value.x, value.y);
+	setVec2Uniform(u_aniOffset, value.x, value.y);
+}
+
+void TilemapVXShader::setTexCoordScale(float value)
+{
+	setFloatUniform(u_texCoordScale, value);
 }
 
 
@@ -618,7 +1080,7 @@ BltShader::BltShader()
 
 void BltShader::setSource()
 {
-	gl.Uniform1i(u_source, 0);
+	setIntUniform(u_source, 0);
 }
 
 void BltShader::setDestination(const TEX::ID value)
@@ -628,10 +1090,120 @@ void BltShader::setDestination(const TEX::ID value)
 
 void BltShader::setSubRect(const FloatRect &value)
 {
-	gl.Uniform4f(u_subRect, value.x, value.y, value.w, value.h);
+	setVec4Uniform(u_subRect, Vec4(value.x, value.y, value.w, value.h));
 }
 
 void BltShader::setOpacity(float value)
 {
-	gl.Uniform1f(u_opacity, value);
+	setFloatUniform(u_opacity, value);
+}
+
+
+GlyphShader::GlyphShader()
+{
+	INIT_SHADER(simpleColor, glyph, GlyphShader);
+
+	ShaderBase::init();
+}
+
+
+ParticleShader::ParticleShader()
+{
+	INIT_SHADER(simpleColor, particle, ParticleShader);
+
+	ShaderBase::init();
+}
+
+
+TextBltShader::TextBltShader()
+{
+	INIT_SHADER(simple, textBlit, TextBltShader);
+
+	ShaderBase::init();
+
+	GET_U(source);
+	GET_U(destination);
+	GET_U(subRect);
+	GET_U(opacity);
+}
+
+void TextBltShader::setSource()
+{
+	setIntUniform(u_source, 0);
+}
+
+void TextBltShader::setDestination(const TEX::ID value)
+{
+	setTexUniform(u_destination, 1, value);
+}
+
+void TextBltShader::setSubRect(const FloatRect &value)
+{
+	setVec4Uniform(u_subRect, Vec4(value.x, value.y, value.w, value.h));
+}
+
+void TextBltShader::setOpacity(float value)
+{
+	setFloatUniform(u_opacity, value);
+}
+
+
+ShaderSet::ShaderSet(bool lazy)
+{
+#define SHADER(type, name) _##name = 0;
+	SHADER_SET_SHADERS
+#undef SHADER
+
+	for (size_t i = 0; i <= SpriteFeatureAll; ++i)
+	{
+		_sprite[i] = 0;
+		_waveSprite[i] = 0;
+	}
+
+	if (lazy)
+		return;
+
+	StartupPhase phase("Shaders");
+
+#define SHADER(type, name) name();
+	SHADER_SET_SHADERS
+#undef SHADER
+
+	/* Only the complete permutations; the
+	 * others are still built on demand */
+	sprite();
+	waveSprite();
+}
+
+ShaderSet::~ShaderSet()
+{
+#define SHADER(type, name) delete _##name;
+	SHADER_SET_SHADERS
+#undef SHADER
+
+	for (size_t i = 0; i <= SpriteFeatureAll; ++i)
+	{
+		delete _sprite[i];
+		delete _waveSprite[i];
+	}
+}
+
+SpriteShader &ShaderSet::sprite(unsigned features)
+{
+	features &= SpriteFeatureAll;
+
+	if (!_sprite[features])
+		_sprite[features] = new SpriteShader(features);
+
+	return *_sprite[features];
+}
+
+WaveSpriteShader &ShaderSet::waveSprite(unsigned features)
+{
+	features &= SpriteFeatureAll;
+
+	if (!_waveSprite[features])
+		_waveSprite[features] = new WaveSpriteShader(features);
+
+	return *_waveSprite[features];
 }
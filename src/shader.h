@@ -36,25 +36,47 @@ public:
 	{
 		Position = 0,
 		TexCoord = 1,
-		Color = 2
+		Color = 2,
+
+		/* Per instance sprite attributes */
+		InstAxes = 3,
+		InstOrigin = 4,
+		InstTone = 5,
+		InstBushDepth = 6
 	};
 
 protected:
 	Shader();
 	~Shader();
 
+	/* 'defines' (preprocessor lines) are prepended to both stages */
 	void init(const unsigned char *vert, int vertSize,
 	          const unsigned char *frag, int fragSize,
 	          const char *vertName, const char *fragName,
-	          const char *programName);
+	          const char *programName, const char *defines = 0);
 	void initFromFile(const char *vertFile, const char *fragFile,
 	                  const char *programName);
 
-	static void setVec4Uniform(GLint location, const Vec4 &vec);
-	static void setTexUniform(GLint location, unsigned unitIndex, TEX::ID texture);
+	/* Uniforms keep their values across program switches,
+	 * so uploads of unchanged values are skipped */
+	void setFloatUniform(GLint location, float value);
+	void setVec2Uniform(GLint location, float x, float y);
+	void setVec4Uniform(GLint location, const Vec4 &vec);
+	void setIntUniform(GLint location, int value);
+	void setTexUniform(GLint location, unsigned unitIndex, TEX::ID texture);
 
 	GLuint vertShader, fragShader;
 	GLuint program;
+
+private:
+	/* Records 'value' as the one uploaded to 'location'.
+	 * Returns false if that was already the case */
+	bool uniformChanged(GLint location, const Vec4 &value);
+
+	enum { UniformCacheSize = 32 };
+
+	Vec4 uniformValues[UniformCacheSize];
+	uint32_t uniformsSet;
 };
 
 class ShaderBase : public Shader
@@ -75,16 +97,26 @@ public:
 
 	/* Retrieves the current glState.viewport size,
 	 * calculates the corresponding ortho projection matrix
-	 * and loads it into the shaders uniform */
+	 * and loads it into the shaders uniform. If the viewport
+	 * is the target of an active screen mapping, the screen
+	 * resolution is projected (flipped) onto it instead */
 	void applyViewportProj();
 
 	void setTexSize(const Vec2i &value);
 	void setTranslation(const Vec2i &value);
 
+	/* Whether the vertex stage can take the rects of an axis
+	 * aligned quad as uniforms, applied to the unit quad */
+	bool hasUnitQuad() const;
+	void setUnitQuad(const FloatRect &pos, const FloatRect &tex);
+	/* Back to using the vertex positions as is */
+	void clearUnitQuad();
+
 protected:
 	void init();
 
 	GLint u_texSizeInv, u_translation;
+	GLint u_unitQuad, u_unitPosRect, u_unitTexRect;
 };
 
 class FlatColorShader : public ShaderBase
@@ -119,6 +151,26 @@ class SimpleAlphaShader : public ShaderBase
 {
 public:
 	SimpleAlphaShader();
+
+	/* Scales the geometry vertically about the line at 'centerY'
+	 * (before translation) by '1 - amount'. Reset to 0 after use */
+	void setSquash(float amount, float centerY);
+
+private:
+	GLint u_squash;
+};
+
+/* Takes the alpha for the whole draw from a uniform,
+ * so that it can change without touching the vertices */
+class SimpleAlphaUniShader : public ShaderBase
+{
+public:
+	SimpleAlphaUniShader();
+
+	void setAlpha(float value);
+
+private:
+	GLint u_alpha;
 };
 
 class SimpleSpriteShader : public ShaderBase
@@ -151,12 +203,14 @@ public:
 
 	void setCurrentScene(TEX::ID tex);
 	void setFrozenScene(TEX::ID tex);
-	void setTransMap(TEX::ID tex);
-	void setProg(float value);
-	void setVague(float value);
+	/* 'coverage' is the part of the scene textures
+	 * holding the screen, if they are larger */
+	void setTransMap(const TEXFBO &tex, const Vec2 &coverage = Vec2(1, 1));
+	/* 'prog' and 'vague' normalized */
+	void setRamp(float prog, float vague);
 
 private:
-	GLint u_currentScene, u_frozenScene, u_transMap, u_prog, u_vague;
+	GLint u_currentScene, u_frozenScene, u_transMap, u_transMapScale, u_ramp;
 };
 
 class SimpleTransShader : public ShaderBase
@@ -172,10 +226,48 @@ private:
 	GLint u_currentScene, u_frozenScene, u_prog;
 };
 
+/* Effects the sprite shader permutations are specialized for;
+ * each is only computed by the variants compiled with its bit.
+ * Flashes are applied through the color blend */
+enum SpriteFeature
+{
+	SpriteTone    = 1 << 0,
+	SpriteColor   = 1 << 1,
+	SpriteOpacity = 1 << 2,
+	SpriteBush    = 1 << 3,
+
+	SpriteFeatureAll = (1 << 4) - 1
+};
+
+/* Setters of effects missing from 'features' are no-ops */
 class SpriteShader : public ShaderBase
 {
 public:
-	SpriteShader();
+	SpriteShader(unsigned features = SpriteFeatureAll);
+
+	unsigned features() const { return _features; }
+
+	void setSpriteMat(const float value[16]);
+	void setTone(const Vec4 &value);
+	void setColor(const Vec4 &value);
+	void setOpacity(float value);
+	void setBushDepth(float value);
+	void setBushOpacity(float value);
+
+private:
+	GLint u_spriteMat, u_tone, u_opacity, u_color, u_bushDepth, u_bushOpacity;
+	unsigned _features;
+};
+
+/* Sprite shader whose vertex stage applies the wave effect to
+ * a static mesh of 8 pixel chunks, each given only its index.
+ * Comes in the same permutations as SpriteShader */
+class WaveSpriteShader : public ShaderBase
+{
+public:
+	WaveSpriteShader(unsigned features = SpriteFeatureAll);
+
+	unsigned features() const { return _features; }
 
 	void setSpriteMat(const float value[16]);
 	void setTone(const Vec4 &value);
@@ -184,8 +276,23 @@ public:
 	void setBushDepth(float value);
 	void setBushOpacity(float value);
 
+	/* 'phase' in degrees */
+	void setWave(int amp, int length, float phase, float zoomY);
+	void setChunks(int firstLength, int visibleLength, int width);
+
 private:
 	GLint u_spriteMat, u_tone, u_opacity, u_color, u_bushDepth, u_bushOpacity;
+	GLint u_wave, u_waveChunks;
+	unsigned _features;
+};
+
+/* Sprite shader taking transform, source rectangle and
+ * effect parameters as per instance attributes, so that
+ * many sprites can be drawn with one instanced call */
+class InstancedSpriteShader : public ShaderBase
+{
+public:
+	InstancedSpriteShader();
 };
 
 class PlaneShader : public ShaderBase
@@ -202,15 +309,39 @@ private:
 	GLint u_tone, u_color, u_flash, u_opacity;
 };
 
-class GrayShader : public ShaderBase
+/* Plane with the bitmap repeated inside the fragment stage */
+class PlaneWrapShader : public ShaderBase
+{
+public:
+	PlaneWrapShader();
+
+	void setTexSize(const Vec2i &value);
+	void setBitmapSize(const Vec2i &value);
+	void setOffset(const Vec2 &value);
+
+	void setTone(const Vec4 &value);
+	void setColor(const Vec4 &value);
+	void setFlash(const Vec4 &value);
+	void setOpacity(float value);
+
+private:
+	GLint u_texSize, u_bitmapSize, u_offset;
+	GLint u_tone, u_color, u_flash, u_opacity;
+};
+
+/* Applies a viewport's tone, color and flash
+ * to an already composited area in one pass */
+class ViewportShader : public ShaderBase
 {
 public:
-	GrayShader();
+	ViewportShader();
 
-	void setGray(float value);
+	void setTone(const Vec4 &value);
+	void setColor(const Vec4 &value);
+	void setFlash(const Vec4 &value);
 
 private:
-	GLint u_gray;
+	GLint u_tone, u_color, u_flash;
 };
 
 class TilemapShader : public ShaderBase
@@ -219,9 +350,66 @@ public:
 	TilemapShader();
 
 	void setAniIndex(int value);
+	void setTexCoordScale(float value);
+
+private:
+	GLint u_aniIndex, u_texCoordScale;
+};
+
+/* Scales the finished frame to the window. Each screen pixel
+ * blends the source pixels under its footprint (in source
+ * pixels), which has to be sampled with linear filtering */
+class UpscaleShader : public ShaderBase
+{
+public:
+	UpscaleShader();
+
+	void setFootprint(const Vec2 &value);
+
+private:
+	GLint u_footprint;
+};
+
+/* Movie frames, with the chroma planes on units 1 and 2 */
+class YUVShader : public ShaderBase
+{
+public:
+	YUVShader();
+
+	void setChroma(TEX::ID cb, TEX::ID cr);
+
+private:
+	GLint u_texCb, u_texCr;
+};
+
+/* Draws the tiles of all priority layers at once, placing
+ * each layer at its own depth (layer index in color.x) */
+class TilemapDepthShader : public ShaderBase
+{
+public:
+	TilemapDepthShader();
+
+	void setAniIndex(int value);
+	void setDepthStep(float value);
+
+private:
+	GLint u_aniIndex, u_depthStep;
+};
+
+/* Draws a tile layer by looking up each pixel's
+ * tile piece in a map texture */
+class TilemapIndexedShader : public ShaderBase
+{
+public:
+	TilemapIndexedShader();
+
+	void setMapTex(TEX::ID tex);
+	void setMapSize(const Vec2i &value);
+	void setAtlasSize(const Vec2i &value);
+	void setAniIndex(int value);
 
 private:
-	GLint u_aniIndex;
+	GLint u_mapTex, u_mapSize, u_atlasSizeInv, u_aniIndex;
 };
 
 class FlashMapShader : public ShaderBase
@@ -257,6 +445,22 @@ private:
 	GLint u_matrix;
 };
 
+/* Bitmap::radialBlur in one pass */
+class RadialBlurShader : public ShaderBase
+{
+public:
+	RadialBlurShader();
+
+	void setTexSize(const Vec2i &value);
+	void setBitmapSize(const Vec2i &value);
+	/* In degrees */
+	void setRotation(float base, float step);
+	void setDivisions(int value);
+
+private:
+	GLint u_texSize, u_bitmapSize, u_baseRot, u_stepRot, u_divisions, u_opacity;
+};
+
 /* Gaussian blur */
 struct BlurShader
 {
@@ -282,9 +486,10 @@ public:
 	TilemapVXShader();
 
 	void setAniOffset(const Vec2 &value);
+	void setTexCoordScale(float value);
 
 private:
-	GLint u_aniOffset;
+	GLint u_aniOffset, u_texCoordScale;
 };
 
 /* Bitmap blit */
@@ -303,27 +508,100 @@ private:
 	GLint u_source, u_destination, u_subRect, u_opacity;
 };
 
-/* Global object containing all available shaders */
+/* Composes glyphs from the atlas, tinted by vertex color */
+class GlyphShader : public ShaderBase
+{
+public:
+	GlyphShader();
+};
+
+/* Particle bitmap, tinted and faded by vertex color */
+class ParticleShader : public ShaderBase
+{
+public:
+	ParticleShader();
+};
+
+/* Bitmap blit of composed (premultiplied) text */
+class TextBltShader : public ShaderBase
+{
+public:
+	TextBltShader();
+
+	void setSource();
+	void setDestination(const TEX::ID value);
+	void setSubRect(const FloatRect &value);
+	void setOpacity(float value);
+
+private:
+	GLint u_source, u_destination, u_subRect, u_opacity;
+};
+
+#define SHADER_SET_SHADERS \
+	SHADER(FlatColorShader, flatColor) \
+	SHADER(SimpleShader, simple) \
+	SHADER(SimpleColorShader, simpleColor) \
+	SHADER(SimpleAlphaShader, simpleAlpha) \
+	SHADER(SimpleAlphaUniShader, simpleAlphaUni) \
+	SHADER(SimpleSpriteShader, simpleSprite) \
+	SHADER(AlphaSpriteShader, alphaSprite) \
+	SHADER(InstancedSpriteShader, instancedSprite) \
+	SHADER(PlaneShader, plane) \
+	SHADER(PlaneWrapShader, planeWrap) \
+	SHADER(ViewportShader, viewport) \
+	SHADER(TilemapShader, tilemap) \
+	SHADER(TilemapDepthShader, tilemapDepth) \
+	SHADER(TilemapIndexedShader, tilemapIndexed) \
+	SHADER(FlashMapShader, flashMap) \
+	SHADER(TransShader, trans) \
+	SHADER(SimpleTransShader, simpleTrans) \
+	SHADER(HueShader, hue) \
+	SHADER(BltShader, blt) \
+	SHADER(GlyphShader, glyph) \
+	SHADER(ParticleShader, particle) \
+	SHADER(TextBltShader, textBlt) \
+	SHADER(SimpleMatrixShader, simpleMatrix) \
+	SHADER(RadialBlurShader, radialBlur) \
+	SHADER(BlurShader, blur) \
+	SHADER(TilemapVXShader, tilemapVX) \
+	SHADER(UpscaleShader, upscale) \
+	SHADER(YUVShader, yuv)
+
+/* Global object containing all available shaders.
+ * With 'lazy' set, each program is only compiled the
+ * first time it is requested, so that effects a game
+ * never uses don't cost startup time or driver memory */
 struct ShaderSet
 {
-	FlatColorShader flatColor;
-	SimpleShader simple;
-	SimpleColorShader simpleColor;
-	SimpleAlphaShader simpleAlpha;
-	SimpleSpriteShader simpleSprite;
-	AlphaSpriteShader alphaSprite;
-	SpriteShader sprite;
-	PlaneShader plane;
-	GrayShader gray;
-	TilemapShader tilemap;
-	FlashMapShader flashMap;
-	TransShader trans;
-	SimpleTransShader simpleTrans;
-	HueShader hue;
-	BltShader blt;
-	SimpleMatrixShader simpleMatrix;
-	BlurShader blur;
-	TilemapVXShader tilemapVX;
+	ShaderSet(bool lazy);
+	~ShaderSet();
+
+#define SHADER(type, name) \
+	type &name() \
+	{ \
+		if (!_##name) \
+			_##name = new type; \
+		return *_##name; \
+	}
+
+	SHADER_SET_SHADERS
+
+#undef SHADER
+
+	/* The permutation covering exactly 'features' (see
+	 * SpriteFeature); each is compiled on first request */
+	SpriteShader &sprite(unsigned features = SpriteFeatureAll);
+	WaveSpriteShader &waveSprite(unsigned features = SpriteFeatureAll);
+
+private:
+#define SHADER(type, name) type *_##name;
+
+	SHADER_SET_SHADERS
+
+#undef SHADER
+
+	SpriteShader *_sprite[SpriteFeatureAll+1];
+	WaveSpriteShader *_waveSprite[SpriteFeatureAll+1];
 };
 
 #endif // SHADER_H
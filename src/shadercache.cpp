@@ -0,0 +1,242 @@
+/*
+** shadercache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "shadercache.h"
+
+#include "boost-hash.h"
+#include "debugwriter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define SHADER_CACHE_MAGIC "MKXPSC01"
+
+struct CacheEntry
+{
+	GLenum format;
+	std::vector<char> data;
+};
+
+struct ShaderCachePrivate
+{
+	std::string cacheFile;
+	uint64_t driverHash;
+
+	BoostHash<uint64_t, CacheEntry> entries;
+	bool modified;
+
+	ShaderCachePrivate(const std::string &cacheFile)
+	    : cacheFile(cacheFile),
+	      driverHash(SHADER_CACHE_HASH_INIT),
+	      modified(false)
+	{}
+
+	void hashDriverString(GLenum name)
+	{
+		const char *str = (const char*) gl.GetString(name);
+
+		if (str)
+			driverHash = shaderCacheHash(driverHash, str, strlen(str) + 1);
+	}
+
+	bool read(FILE *f, void *dst, size_t size)
+	{
+		return fread(dst, 1, size, f) == size;
+	}
+
+	void readFile()
+	{
+		FILE *f = fopen(cacheFile.c_str(), "rb");
+
+		if (!f)
+			return;
+
+		char magic[sizeof(SHADER_CACHE_MAGIC)-1];
+		uint64_t fileDriverHash;
+		uint32_t count;
+
+		if (!read(f, magic, sizeof(magic)) || memcmp(magic, SHADER_CACHE_MAGIC, sizeof(magic))
+		    || !read(f, &fileDriverHash, sizeof(fileDriverHash)) || fileDriverHash != driverHash
+		    || !read(f, &count, sizeof(count)))
+		{
+			fclose(f);
+			return;
+		}
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint64_t key;
+			uint32_t format, size;
+
+			if (!read(f, &key, sizeof(key)) || !read(f, &format, sizeof(format))
+			    || !read(f, &size, sizeof(size)) || size == 0)
+				break;
+
+			CacheEntry entry;
+			entry.format = format;
+			entry.data.resize(size);
+
+			if (!read(f, &entry.data[0], size))
+				break;
+
+			entries.insert(key, entry);
+		}
+
+		fclose(f);
+	}
+
+	void writeFile()
+	{
+		std::string tmpFile = cacheFile + ".tmp";
+		FILE *f = fopen(tmpFile.c_str(), "wb");
+
+		if (!f)
+		{
+			Debug() << "Failed to write shader cache" << cacheFile;
+			return;
+		}
+
+		uint32_t count = 0;
+		BoostHash<uint64_t, CacheEntry>::const_iterator iter;
+
+		for (iter = entries.cbegin(); iter != entries.cend(); ++iter)
+			++count;
+
+		bool ok = fwrite(SHADER_CACHE_MAGIC, sizeof(SHADER_CACHE_MAGIC)-1, 1, f) == 1
+		       && fwrite(&driverHash, sizeof(driverHash), 1, f) == 1
+		       && fwrite(&count, sizeof(count), 1, f) == 1;
+
+		for (iter = entries.cbegin(); ok && iter != entries.cend(); ++iter)
+		{
+			const CacheEntry &entry = iter->second;
+			uint32_t format = entry.format;
+			uint32_t size = entry.data.size();
+
+			ok = fwrite(&iter->first, sizeof(iter->first), 1, f) == 1
+			  && fwrite(&format, sizeof(format), 1, f) == 1
+			  && fwrite(&size, sizeof(size), 1, f) == 1
+			  && fwrite(&entry.data[0], 1, size, f) == size;
+		}
+
+		fclose(f);
+
+		/* Replace the old file only once the new one is complete,
+		 * so an interrupted write can't leave a truncated cache */
+		if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+		{
+			Debug() << "Failed to write shader cache" << cacheFile;
+			remove(tmpFile.c_str());
+		}
+	}
+};
+
+static ShaderCache *activeCache = 0;
+
+ShaderCache::ShaderCache(const std::string &cacheFile)
+    : p(0)
+{
+	if (cacheFile.empty() || !gl.program_binary)
+		return;
+
+	p = new ShaderCachePrivate(cacheFile);
+
+	p->hashDriverString(GL_VENDOR);
+	p->hashDriverString(GL_RENDERER);
+	p->hashDriverString(GL_VERSION);
+
+	p->readFile();
+
+	activeCache = this;
+}
+
+ShaderCache::~ShaderCache()
+{
+	if (activeCache == this)
+		activeCache = 0;
+
+	save();
+
+	delete p;
+}
+
+ShaderCache *ShaderCache::active()
+{
+	return activeCache;
+}
+
+bool ShaderCache::load(GLuint program, uint64_t key)
+{
+	if (!p || !p->entries.contains(key))
+		return false;
+
+	const CacheEntry &entry = p->entries[key];
+	gl.ProgramBinary(program, entry.format, &entry.data[0], entry.data.size());
+
+	GLint success;
+	gl.GetProgramiv(program, GL_LINK_STATUS, &success);
+
+	if (success)
+		return true;
+
+	/* Rejected (eg. after a driver update that kept
+	 * the version string), replace it with a fresh one */
+	p->entries.remove(key);
+	p->modified = true;
+
+	return false;
+}
+
+void ShaderCache::store(GLuint program, uint64_t key)
+{
+	if (!p)
+		return;
+
+	GLint length = 0;
+	gl.GetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+	if (length <= 0)
+		return;
+
+	CacheEntry entry;
+	entry.data.resize(length);
+
+	GLsizei written = 0;
+	gl.GetProgramBinary(program, length, &written, &entry.format, &entry.data[0]);
+
+	if (written <= 0)
+		return;
+
+	entry.data.resize(written);
+
+	p->entries[key] = entry;
+	p->modified = true;
+}
+
+void ShaderCache::save()
+{
+	if (!p || !p->modified)
+		return;
+
+	p->writeFile();
+	p->modified = false;
+}
@@ -0,0 +1,81 @@
+/*
+** shadercache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include "gl-fun.h"
+
+#include <string>
+#include <stdint.h>
+
+struct ShaderCachePrivate;
+
+/* Persists linked program binaries in a single file, so that
+ * subsequent starts can skip compiling and linking the shaders.
+ * Entries are keyed by a hash of the full shader sources; the
+ * whole file is discarded if the GL driver differs from the
+ * one it was written with */
+class ShaderCache
+{
+public:
+	/* An empty 'cacheFile' disables the cache */
+	ShaderCache(const std::string &cacheFile);
+	~ShaderCache();
+
+	/* The cache consulted by Shader::init, if any */
+	static ShaderCache *active();
+
+	/* Loads the binary stored under 'key' into 'program'.
+	 * Returns false if there is none or the driver rejected it,
+	 * in which case the program has to be linked from source */
+	bool load(GLuint program, uint64_t key);
+
+	/* Retrieves the binary of the freshly linked 'program' */
+	void store(GLuint program, uint64_t key);
+
+	/* Writes the cache file if new binaries were stored
+	 * since the last call. Also done on destruction, to
+	 * keep programs that were compiled lazily */
+	void save();
+
+private:
+	ShaderCachePrivate *p;
+};
+
+/* Incremental FNV-1a, stable across builds and platforms */
+inline uint64_t shaderCacheHash(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+#define SHADER_CACHE_HASH_INIT 14695981039346656037ull
+
+#endif // SHADERCACHE_H
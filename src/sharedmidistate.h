@@ -19,12 +19,19 @@
 ** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #ifndef SHAREDMIDISTATE_H
 #define SHAREDMIDISTATE_H
 
 #include "config.h"
 #include "debugwriter.h"
 #include "fluid-fun.h"
+#include "sdl-util.h"
+#include "memstats.h"
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+#include <SDL_rwops.h>
 
 #include <assert.h>
 #include <vector>
@@ -33,40 +40,91 @@
 #define SYNTH_INIT_COUNT 2
 #define SYNTH_SAMPLERATE 44100
 
+/* Free synths kept ready so that starting
+ * a midi track never has to wait for one */
+#define SYNTH_SPARE_COUNT 1
+
 struct Synth
 {
 	fluid_synth_t *synth;
 	bool inUse;
 };
 
+/* Synths are created by a background thread, which first loads
+ * the soundfont into a synth of its own. All other synths share
+ * that soundfont (and thus its sample data) instead of loading
+ * it again */
 struct SharedMidiState
 {
 	bool inited;
-	std::vector<Synth> synths;
 	const std::string &soundFont;
 	fluid_settings_t *flSettings;
 
+	/* Everything below is guarded by 'mutex' */
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+
+	std::vector<Synth> synths;
+
+	/* Owner of 'sfont', never handed out */
+	fluid_synth_t *sfSynth;
+	fluid_sfont_t *sfont;
+
+	/* Soundfont loading is done (possibly failed) */
+	bool sfLoaded;
+
+	SDL_Thread *thread;
+	bool quit;
+
 	SharedMidiState(const Config &conf)
 	    : inited(false),
-	      soundFont(conf.midi.soundFont)
+	      soundFont(conf.midi.soundFont),
+	      mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      sfSynth(0),
+	      sfont(0),
+	      sfLoaded(false),
+	      thread(0),
+	      quit(false)
 	{}
 
 	~SharedMidiState()
 	{
+		if (thread)
+		{
+			SDL_LockMutex(mutex);
+			quit = true;
+			SDL_CondBroadcast(cond);
+			SDL_UnlockMutex(mutex);
+
+			SDL_WaitThread(thread, 0);
+		}
+
 		/* We might have initialized, but if the consecutive libfluidsynth
 		 * load failed, no resources will have been allocated */
-		if (!inited || !HAVE_FLUID)
-			return;
+		if (inited && HAVE_FLUID)
+		{
+			for (size_t i = 0; i < synths.size(); ++i)
+			{
+				assert(!synths[i].inUse);
+				deleteSynth(synths[i].synth);
+			}
 
-		fluid.delete_settings(flSettings);
+			/* Last, as it owns the shared soundfont */
+			if (sfSynth)
+				fluid.delete_synth(sfSynth);
 
-		for (size_t i = 0; i < synths.size(); ++i)
-		{
-			assert(!synths[i].inUse);
-			fluid.delete_synth(synths[i].synth);
+			MemStats::set(MemStats::SoundFont, 0);
+
+			fluid.delete_settings(flSettings);
 		}
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
 	}
 
+	/* Returns immediately; the soundfont is loaded
+	 * and synths are created in the background */
 	void initIfNeeded(const Config &conf)
 	{
 		if (inited)
@@ -85,37 +143,48 @@ struct SharedMidiState
 		fluid.settings_setstr(flSettings, "synth.chorus.active", conf.midi.chorus ? "yes" : "no");
 		fluid.settings_setstr(flSettings, "synth.reverb.active", conf.midi.reverb ? "yes" : "no");
 
-		for (size_t i = 0; i < SYNTH_INIT_COUNT; ++i)
-			addSynth(false);
+		thread = createSDLThread
+			<SharedMidiState, &SharedMidiState::warmupFun>(this, "midi_warmup");
 	}
 
+	/* Waits for a spare synth if none is free yet
+	 * (ie. only while the soundfont is still loading) */
 	fluid_synth_t *allocateSynth()
 	{
 		assert(HAVE_FLUID);
 		assert(inited);
 
-		size_t i;
+		fluid_synth_t *syn = 0;
 
-		for (i = 0; i < synths.size(); ++i)
-			if (!synths[i].inUse)
-				break;
+		SDL_LockMutex(mutex);
 
-		if (i < synths.size())
+		while (!syn)
 		{
-			fluid_synth_t *syn = synths[i].synth;
-			fluid.synth_system_reset(syn);
-			synths[i].inUse = true;
+			for (size_t i = 0; i < synths.size(); ++i)
+				if (!synths[i].inUse)
+				{
+					syn = synths[i].synth;
+					synths[i].inUse = true;
+					break;
+				}
 
-			return syn;
-		}
-		else
-		{
-			return addSynth(true);
+			if (!syn)
+				SDL_CondWait(cond, mutex);
 		}
+
+		/* Have the spare replaced */
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+
+		fluid.synth_system_reset(syn);
+
+		return syn;
 	}
 
 	void releaseSynth(fluid_synth_t *synth)
 	{
+		SDL_LockMutex(mutex);
+
 		size_t i;
 
 		for (i = 0; i < synths.size(); ++i)
@@ -125,24 +194,119 @@ struct SharedMidiState
 		assert(i < synths.size());
 
 		synths[i].inUse = false;
+
+		SDL_UnlockMutex(mutex);
+	}
+
+	/* Creates a synth outside of the pool, which the caller has
+	 * to delete via deleteSynth(). Safe to call from any thread */
+	fluid_synth_t *newSynth()
+	{
+		assert(HAVE_FLUID);
+		assert(inited);
+
+		fluid_synth_t *syn = fluid.new_synth(flSettings);
+
+		SDL_LockMutex(mutex);
+
+		while (!sfLoaded)
+			SDL_CondWait(cond, mutex);
+
+		SDL_UnlockMutex(mutex);
+
+		if (sfont)
+			fluid.synth_add_sfont(syn, sfont);
+
+		MemStats::add(MemStats::MidiSynths, 1);
+
+		return syn;
+	}
+
+	void deleteSynth(fluid_synth_t *syn)
+	{
+		/* Detach the shared soundfont so it isn't freed with 'syn' */
+		if (sfont)
+			fluid.synth_remove_sfont(syn, sfont);
+
+		fluid.delete_synth(syn);
+
+		MemStats::add(MemStats::MidiSynths, -1);
 	}
 
 private:
-	fluid_synth_t *addSynth(bool usedNow)
+	size_t freeCount()
+	{
+		size_t count = 0;
+
+		for (size_t i = 0; i < synths.size(); ++i)
+			if (!synths[i].inUse)
+				++count;
+
+		return count;
+	}
+
+	void loadSoundFont()
 	{
 		fluid_synth_t *syn = fluid.new_synth(flSettings);
+		fluid_sfont_t *sf = 0;
 
-		if (!soundFont.empty())
-			fluid.synth_sfload(syn, soundFont.c_str(), 1);
-		else
+		if (soundFont.empty())
 			Debug() << "Warning: No soundfont specified, sound might be mute";
+		else if (fluid.synth_sfload(syn, soundFont.c_str(), 1) != -1)
+		{
+			sf = fluid.synth_get_sfont(syn, 0);
 
-		Synth synth;
-		synth.inUse = usedNow;
-		synth.synth = syn;
-		synths.push_back(synth);
+			/* fluidsynth keeps all samples in memory, so
+			 * the file size is a close estimate */
+			SDL_RWops *ops = SDL_RWFromFile(soundFont.c_str(), "rb");
 
-		return syn;
+			if (ops)
+			{
+				MemStats::set(MemStats::SoundFont, SDL_RWsize(ops));
+				SDL_RWclose(ops);
+			}
+		}
+		else
+			Debug() << "Warning: Failed to load soundfont" << soundFont;
+
+		SDL_LockMutex(mutex);
+
+		sfSynth = syn;
+		sfont = sf;
+		sfLoaded = true;
+
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+	}
+
+	void warmupFun()
+	{
+		loadSoundFont();
+
+		SDL_LockMutex(mutex);
+
+		while (true)
+		{
+			while (!quit && synths.size() >= SYNTH_INIT_COUNT
+			       && freeCount() >= SYNTH_SPARE_COUNT)
+				SDL_CondWait(cond, mutex);
+
+			if (quit)
+				break;
+
+			SDL_UnlockMutex(mutex);
+
+			Synth synth;
+			synth.synth = newSynth();
+			synth.inUse = false;
+
+			SDL_LockMutex(mutex);
+
+			synths.push_back(synth);
+			SDL_CondBroadcast(cond);
+		}
+
+		SDL_UnlockMutex(mutex);
 	}
 };
 
@@ -23,29 +23,84 @@
 
 #include "util.h"
 #include "filesystem.h"
+#include "bundle.h"
+#include "preloader.h"
+#include "packeddatacache.h"
+#include "workerpool.h"
+#include "startuptimer.h"
 #include "graphics.h"
 #include "input.h"
 #include "audio.h"
 #include "glstate.h"
 #include "shader.h"
+#include "shadercache.h"
 #include "texpool.h"
+#include "texuploader.h"
+#include "glyphatlas.h"
+#include "textmetrics.h"
+#include "textcache.h"
+#include "bitmapcache.h"
+#include "atlascache.h"
+#include "windowbasecache.h"
+#include "spritebatch.h"
+#include "spriteatlas.h"
+#include "spritesystem.h"
+#include "fillqueue.h"
+#include "scratcharena.h"
+#include "gldeletequeue.h"
+#include "uploadstaging.h"
 #include "font.h"
 #include "eventthread.h"
 #include "gl-util.h"
 #include "global-ibo.h"
 #include "quad.h"
+#include "quadarray.h"
 #include "binding.h"
 #include "exception.h"
 #include "sharedmidistate.h"
+#include "midicache.h"
 
 #include <unistd.h>
 #include <stdio.h>
 #include <string>
 
+#include <boost/functional/hash.hpp>
+
 SharedState *SharedState::instance = 0;
 int SharedState::rgssVersion = 0;
 static GlobalIBO *_globalIBO = 0;
 
+/* The common data path is shared between games,
+ * so the file name is derived from the game's identity */
+static std::string gameCacheFile(const Config &conf, const char *prefix)
+{
+	const std::string &dir = conf.customDataPath.empty() ?
+	        conf.commonDataPath : conf.customDataPath;
+
+	if (dir.empty())
+		return dir;
+
+	size_t gameHash = boost::hash<std::string>()(conf.gameFolder + "/" + conf.execName);
+
+	char name[64];
+	snprintf(name, sizeof(name), "%s-%08x.bin", prefix, (unsigned) gameHash);
+
+	return dir + name;
+}
+
+/* Shader binaries only depend on the engine and
+ * the GL driver, so one file is shared by all games */
+static std::string shaderCacheFile(const Config &conf)
+{
+	const std::string &dir = conf.customDataPath.empty() ?
+	        conf.commonDataPath : conf.customDataPath;
+
+	if (!conf.shaderCache || dir.empty())
+		return std::string();
+
+	return dir + "shadercache.bin";
+}
+
 static const char *gameArchExt()
 {
 	if (rgssVer == 1)
@@ -67,102 +122,170 @@ struct SharedStatePrivate
 
 	FileSystem fileSystem;
 
+	/* Uses fileSystem from its worker thread */
+	Preloader preloader;
+
+	/* Outlives graphics, which disposes
+	 * any bitmaps still decoding */
+	WorkerPool workerPool;
+
+	/* Reads on workerPool, and waits for
+	 * it when destroyed */
+	PackedDataCache packedData;
+
 	EventThread &eThread;
 	RGSSThreadData &rtData;
 	Config &config;
 
 	SharedMidiState midiState;
 
+	/* Renders with synths created from midiState */
+	MidiCache midiCache;
+
 	Graphics graphics;
 	Input input;
 	Audio audio;
 
 	GLState _glState;
 
+	/* Consulted whenever ShaderSet compiles a program */
+	ShaderCache shaderCache;
 	ShaderSet shaders;
 
 	TexPool texPool;
+	TexUploader texUploader;
+
+	GlyphAtlas glyphAtlas;
+	TextMetrics textMetrics;
+
+	/* Declared after texPool, which it returns its textures to */
+	TextCache textCache;
+	BitmapCache bitmapCache;
+	AtlasCache atlasCache;
+	WindowBaseCache windowBaseCache;
+
+	SpriteBatch spriteBatch;
+	SpriteAtlas spriteAtlas;
+	SpriteSystem spriteSystem;
+	FillQueue fillQueue;
 
 	SharedFontState fontState;
 	Font *defaultFont;
 
-	TEX::ID globalTex;
-	int globalTexW, globalTexH;
-	bool globalTexDirty;
+	ScratchArena scratchArena;
 
-	TEXFBO gpTexFBO;
+	/* Picked by the last ensureTexSize() */
+	TEXFBO *globalTex;
 
-	TEXFBO atlasTex;
 
 	Quad gpQuad;
+	UnitQuad unitQuad;
+	QuadArray<SVertex> blitQuads;
 
 	unsigned int stampCounter;
 
 	SharedStatePrivate(RGSSThreadData *threadData)
 	    : bindingData(0),
 	      sdlWindow(threadData->window),
-	      fileSystem(threadData->argv0, threadData->config.allowSymlinks),
+	      fileSystem(threadData->argv0, threadData->config.allowSymlinks,
+	                 threadData->config.archiveReadAhead),
+	      preloader(fileSystem, threadData->config.preloadMemSize),
+	      workerPool(threadData->config.decodeThreads),
+	      packedData(threadData->config.packedDataSize),
 	      eThread(*threadData->ethread),
 	      rtData(*threadData),
 	      config(threadData->config),
 	      midiState(threadData->config),
+	      midiCache(threadData->config, midiState),
 	      graphics(threadData),
 	      input(*threadData),
 	      audio(*threadData),
 	      _glState(threadData->config),
+	      shaderCache(shaderCacheFile(threadData->config)),
+	      shaders(threadData->config.lazyShaders),
+	      texPool(threadData->config.performance.texPoolSize),
+	      texUploader(threadData->window, threadData->config.asyncTextureUpload),
+	      textCache(texPool, threadData->config.textCacheSize),
+	      bitmapCache(texPool, threadData->config.bitmapCacheSize),
+	      atlasCache(texPool, threadData->config.atlasCacheSize),
+	      windowBaseCache(texPool),
+	      spriteAtlas(threadData->config.spriteAtlasPages),
 	      fontState(threadData->config),
 	      stampCounter(0)
 	{
-		/* Shaders have been compiled in ShaderSet's constructor */
-		if (gl.ReleaseShaderCompiler)
-			gl.ReleaseShaderCompiler();
+		/* Unless compiled lazily, shaders have
+		 * been built in ShaderSet's constructor */
+		shaderCache.save();
 
-		std::string archPath = config.execName + gameArchExt();
+		if (!config.lazyShaders && gl.ReleaseShaderCompiler)
+			gl.ReleaseShaderCompiler();
 
-		/* Check if a game archive exists */
-		FILE *tmp = fopen(archPath.c_str(), "rb");
-		if (tmp)
 		{
-			fileSystem.addPath(archPath.c_str());
-			fclose(tmp);
-		}
+			StartupPhase phase("File system");
 
-		fileSystem.addPath(".");
+			/* A bundle packed from the game takes precedence
+			 * over its original archive */
+			std::string bundlePath = config.execName + BUNDLE_EXT;
 
-		for (size_t i = 0; i < config.rtps.size(); ++i)
-			fileSystem.addPath(config.rtps[i].c_str());
+			FILE *tmp = fopen(bundlePath.c_str(), "rb");
+			if (tmp)
+			{
+				fileSystem.addPath(bundlePath.c_str());
+				fclose(tmp);
+			}
 
-		if (config.pathCache)
-			fileSystem.createPathCache();
+			std::string archPath = config.execName + gameArchExt();
 
-		fileSystem.initFontSets(fontState);
+			/* Check if a game archive exists */
+			tmp = fopen(archPath.c_str(), "rb");
+			if (tmp)
+			{
+				fileSystem.addPath(archPath.c_str());
+				fclose(tmp);
+			}
+
+			fileSystem.addPath(".");
+
+			for (size_t i = 0; i < config.rtps.size(); ++i)
+				fileSystem.addPath(config.rtps[i].c_str());
+
+			if (config.pathCache)
+			{
+				std::string cacheFile;
+
+				if (config.persistentPathCache)
+					cacheFile = gameCacheFile(config, "pathcache");
+
+				fileSystem.createPathCache(cacheFile.empty() ? 0 : cacheFile.c_str(),
+				                           &workerPool);
+			}
+
+			packedData.start(workerPool);
+		}
 
-		globalTexW = 128;
-		globalTexH = 64;
+		/* Fonts/ is scanned in the background (or lazily, on
+		 * the first family lookup without worker threads) */
+		if (config.persistentPathCache)
+			fontState.setScanCacheFile(gameCacheFile(config, "fontcache"));
 
-		globalTex = TEX::gen();
-		TEX::bind(globalTex);
-		TEX::setRepeat(false);
-		TEX::setSmooth(false);
-		TEX::allocEmpty(globalTexW, globalTexH);
-		globalTexDirty = false;
+		fontState.prescan(fileSystem, workerPool);
 
-		TEXFBO::init(gpTexFBO);
-		/* Reuse starting values */
-		TEXFBO::allocEmpty(gpTexFBO, globalTexW, globalTexH);
-		TEXFBO::linkFBO(gpTexFBO);
+		globalTex = 0;
 
 		/* RGSS3 games will call setup_midi, so there's
 		 * no need to do it on startup */
 		if (rgssVer <= 2)
 			midiState.initIfNeeded(threadData->config);
+
+		GLDeleteQueue::setBudget(config.performance.deleteBudget);
 	}
 
 	~SharedStatePrivate()
 	{
-		TEX::del(globalTex);
-		TEXFBO::fini(gpTexFBO);
-		TEXFBO::fini(atlasTex);
+		/* Objects destroyed from here on are deleted
+		 * right away; catch up with the queued ones */
+		GLDeleteQueue::setBudget(0);
+		UploadStaging::fini();
 	}
 };
 
@@ -182,6 +305,7 @@ void SharedState::initInstance(RGSSThreadData *threadData)
 
 	try
 	{
+		StartupPhase phase("Shared state");
 		SharedState::instance = new SharedState(threadData);
 		Font::initDefaults(instance->p->fontState);
 		defaultFont = new Font();
@@ -222,6 +346,9 @@ GSATT(void*, bindingData)
 GSATT(SDL_Window*, sdlWindow)
 GSATT(Scene*, screen)
 GSATT(FileSystem&, fileSystem)
+GSATT(Preloader&, preloader)
+GSATT(WorkerPool&, workerPool)
+GSATT(PackedDataCache&, packedData)
 GSATT(EventThread&, eThread)
 GSATT(RGSSThreadData&, rtData)
 GSATT(Config&, config)
@@ -231,9 +358,24 @@ GSATT(Audio&, audio)
 GSATT(GLState&, _glState)
 GSATT(ShaderSet&, shaders)
 GSATT(TexPool&, texPool)
+GSATT(TexUploader&, texUploader)
+GSATT(GlyphAtlas&, glyphAtlas)
+GSATT(TextMetrics&, textMetrics)
+GSATT(TextCache&, textCache)
+GSATT(BitmapCache&, bitmapCache)
+GSATT(AtlasCache&, atlasCache)
+GSATT(WindowBaseCache&, windowBaseCache)
+GSATT(SpriteBatch&, spriteBatch)
+GSATT(SpriteAtlas&, spriteAtlas)
+GSATT(SpriteSystem&, spriteSystem)
+GSATT(FillQueue&, fillQueue)
+GSATT(ScratchArena&, scratchArena)
 GSATT(Quad&, gpQuad)
+GSATT(UnitQuad&, unitQuad)
+GSATT(QuadArray<SVertex>&, blitQuads)
 GSATT(SharedFontState&, fontState)
 GSATT(SharedMidiState&, midiState)
+GSATT(MidiCache&, midiCache)
 
 void SharedState::setBindingData(void *data)
 {
@@ -252,85 +394,28 @@ GlobalIBO &SharedState::globalIBO()
 
 void SharedState::bindTex()
 {
-	TEX::bind(p->globalTex);
+	if (!p->globalTex)
+		p->globalTex = &p->scratchArena.request(1, 1, true);
 
-	if (p->globalTexDirty)
-	{
-		TEX::allocEmpty(p->globalTexW, p->globalTexH);
-		p->globalTexDirty = false;
-	}
+	TEX::bind(p->globalTex->tex);
 }
 
 void SharedState::ensureTexSize(int minW, int minH, Vec2i &currentSizeOut)
 {
-	if (minW > p->globalTexW)
-	{
-		p->globalTexDirty = true;
-		p->globalTexW = findNextPow2(minW);
-	}
-
-	if (minH > p->globalTexH)
-	{
-		p->globalTexDirty = true;
-		p->globalTexH = findNextPow2(minH);
-	}
+	/* Text is uploaded there and drawn filtered */
+	p->globalTex = &p->scratchArena.request(minW, minH, true);
 
-	currentSizeOut = Vec2i(p->globalTexW, p->globalTexH);
+	currentSizeOut = Vec2i(p->globalTex->width, p->globalTex->height);
 }
 
 TEXFBO &SharedState::gpTexFBO(int minW, int minH)
 {
-	bool needResize = false;
-
-	if (minW > p->gpTexFBO.width)
-	{
-		p->gpTexFBO.width = findNextPow2(minW);
-		needResize = true;
-	}
-
-	if (minH > p->gpTexFBO.height)
-	{
-		p->gpTexFBO.height = findNextPow2(minH);
-		needResize = true;
-	}
-
-	if (needResize)
-	{
-		TEX::bind(p->gpTexFBO.tex);
-		TEX::allocEmpty(p->gpTexFBO.width, p->gpTexFBO.height);
-	}
-
-	return p->gpTexFBO;
-}
-
-void SharedState::requestAtlasTex(int w, int h, TEXFBO &out)
-{
-	TEXFBO tex;
-
-	if (w == p->atlasTex.width && h == p->atlasTex.height)
-	{
-		tex = p->atlasTex;
-		p->atlasTex = TEXFBO();
-	}
-	else
-	{
-		TEXFBO::init(tex);
-		TEXFBO::allocEmpty(tex, w, h);
-		TEXFBO::linkFBO(tex);
-	}
-
-	out = tex;
+	return p->scratchArena.request(minW, minH);
 }
 
-void SharedState::releaseAtlasTex(TEXFBO &tex)
+TEXFBO &SharedState::auxTexFBO(int minW, int minH)
 {
-	/* No point in caching an invalid object */
-	if (tex.tex == TEX::ID(0))
-		return;
-
-	TEXFBO::fini(p->atlasTex);
-
-	p->atlasTex = tex;
+	return p->scratchArena.request(minW, minH);
 }
 
 void SharedState::checkShutdown()
@@ -34,6 +34,9 @@ struct GlobalIBO;
 struct SDL_Window;
 struct TEXFBO;
 struct Quad;
+struct UnitQuad;
+struct SVertex;
+template<class VertexType> struct QuadArray;
 struct ShaderSet;
 
 class Scene;
@@ -44,12 +47,28 @@ class Input;
 class Audio;
 class GLState;
 class TexPool;
+class TexUploader;
+class GlyphAtlas;
+class TextMetrics;
+class TextCache;
+class BitmapCache;
+class AtlasCache;
+class WindowBaseCache;
+class Preloader;
+class WorkerPool;
+class PackedDataCache;
+class SpriteBatch;
+class SpriteAtlas;
+class SpriteSystem;
+class FillQueue;
+class ScratchArena;
 class Font;
 class SharedFontState;
 struct GlobalIBO;
 struct Config;
 struct Vec2i;
 struct SharedMidiState;
+class MidiCache;
 
 struct SharedState
 {
@@ -62,6 +81,9 @@ struct SharedState
 	void setScreen(Scene &screen);
 
 	FileSystem &fileSystem() const;
+	Preloader &preloader() const;
+	WorkerPool &workerPool() const;
+	PackedDataCache &packedData() const;
 
 	EventThread &eThread() const;
 	RGSSThreadData &rtData() const;
@@ -76,11 +98,26 @@ struct SharedState
 	ShaderSet &shaders() const;
 
 	TexPool &texPool() const;
+	TexUploader &texUploader() const;
+
+	GlyphAtlas &glyphAtlas() const;
+	TextMetrics &textMetrics() const;
+	TextCache &textCache() const;
+	BitmapCache &bitmapCache() const;
+	AtlasCache &atlasCache() const;
+	WindowBaseCache &windowBaseCache() const;
+
+	SpriteBatch &spriteBatch() const;
+	SpriteAtlas &spriteAtlas() const;
+	SpriteSystem &spriteSystem() const;
+	FillQueue &fillQueue() const;
+	ScratchArena &scratchArena() const;
 
 	SharedFontState &fontState() const;
 	Font &defaultFont() const;
 
 	SharedMidiState &midiState() const;
+	MidiCache &midiCache() const;
 
 	sigc::signal<void> prepareDraw;
 
@@ -91,18 +128,25 @@ struct SharedState
 	void ensureQuadIBO(size_t minSize);
 	GlobalIBO &globalIBO();
 
-	/* Global general purpose texture */
+	/* Global general purpose texture, for uploads;
+	 * rebound to a scratch target by ensureTexSize() */
 	void bindTex();
 	void ensureTexSize(int minW, int minH, Vec2i &currentSizeOut);
 
+	/* Scratch targets (see ScratchArena); only valid until
+	 * their size tier gets requested twice more, and not
+	 * beyond the current frame */
 	TEXFBO &gpTexFBO(int minW, int minH);
 
+	/* Second scratch target, for operations
+	 * that ping-pong between two of them */
+	TEXFBO &auxTexFBO(int minW, int minH);
+
 	Quad &gpQuad() const;
+	UnitQuad &unitQuad() const;
 
-	/* Basically just a simple "TexPool"
-	 * replacement for Tilemap atlas use */
-	void requestAtlasTex(int w, int h, TEXFBO &out);
-	void releaseAtlasTex(TEXFBO &tex);
+	/* Collects emulated blits (see GLMeta::blitRectangle()) */
+	QuadArray<SVertex> &blitQuads() const;
 
 	/* Checks EventThread's shutdown request flag and if set,
 	 * requests the binding to terminate. In this case, this
@@ -0,0 +1,335 @@
+/*
+** softmixer.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "softmixer.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/* Rate and size of the mixed (stereo) output. The queue holds
+ * about 46ms, of which one buffer is refilled per service() */
+#define MIX_RATE 44100
+#define MIX_FRAMES 512
+#define MIX_BUFFERS 4
+
+#define GAIN_SHIFT 10
+
+SoftMixer::SoftMixer(size_t voiceCount)
+    : voices(voiceCount),
+      voiceSeq(0),
+      buffers(MIX_BUFFERS),
+      running(false),
+      accum(MIX_FRAMES * 2),
+      output(MIX_FRAMES * 2)
+{
+	for (size_t i = 0; i < voices.size(); ++i)
+		voices[i].sound = 0;
+
+	src = AL::Source::gen();
+
+	AL::Source::setVolume(src, 1.0f);
+	AL::Source::setPitch(src, 1.0f);
+	AL::Source::detachBuffer(src);
+
+	for (size_t i = 0; i < buffers.size(); ++i)
+		buffers[i] = AL::Buffer::gen();
+}
+
+SoftMixer::~SoftMixer()
+{
+	stop();
+
+	AL::Source::stop(src);
+	AL::Source::clearQueue(src);
+	AL::Source::del(src);
+
+	for (size_t i = 0; i < buffers.size(); ++i)
+		AL::Buffer::del(buffers[i]);
+}
+
+void SoftMixer::play(MixSound *sound, float volume, float pitch, int frame)
+{
+	if (sound->frames == 0)
+		return;
+
+	int index = -1;
+
+	for (size_t i = 0; i < voices.size(); ++i)
+	{
+		Voice &voice = voices[i];
+
+		if (!voice.sound)
+		{
+			if (index < 0)
+				index = i;
+
+			continue;
+		}
+
+		if (voice.sound != sound || voice.frame != frame || voice.pitch != pitch)
+			continue;
+
+		if (volume > voice.volume)
+		{
+			voice.volume = volume;
+			voice.gain = volume * GLOBAL_VOLUME * (1 << GAIN_SHIFT);
+		}
+
+		return;
+	}
+
+	if (index < 0)
+	{
+		/* The quietest voice, and the oldest among equally loud ones */
+		for (size_t i = 0; i < voices.size(); ++i)
+		{
+			if (index < 0)
+			{
+				index = i;
+				continue;
+			}
+
+			const Voice &voice = voices[i];
+			const Voice &best = voices[index];
+
+			if (voice.volume < best.volume ||
+			    (voice.volume == best.volume && voice.seq < best.seq))
+				index = i;
+		}
+
+		if (index < 0)
+			return;
+
+		releaseVoice(voices[index]);
+	}
+
+	Voice &voice = voices[index];
+
+	voice.sound = MixSound::ref(sound);
+	voice.volume = volume;
+	voice.pitch = pitch;
+	voice.frame = frame;
+	voice.seq = ++voiceSeq;
+	voice.pos = 0;
+	voice.step = (double) sound->rate * pitch / MIX_RATE * 65536;
+	voice.gain = volume * GLOBAL_VOLUME * (1 << GAIN_SHIFT);
+
+	voice.step = std::max<uint32_t>(voice.step, 1);
+}
+
+void SoftMixer::stop()
+{
+	for (size_t i = 0; i < voices.size(); ++i)
+		releaseVoice(voices[i]);
+}
+
+void SoftMixer::releaseVoice(Voice &voice)
+{
+	if (!voice.sound)
+		return;
+
+	MixSound::deref(voice.sound);
+	voice.sound = 0;
+}
+
+void SoftMixer::service()
+{
+	if (running)
+	{
+		ALint procBufs = AL::Source::getProcBufferCount(src);
+
+		while (procBufs--)
+		{
+			AL::Buffer::ID buf = AL::Source::unqueueBuffer(src);
+
+			if (buf == AL::Buffer::ID(0))
+				break;
+
+			/* Silence isn't queued; the source runs
+			 * dry after the last voice ended */
+			if (!mix())
+				continue;
+
+			AL::Buffer::uploadData(buf, AL_FORMAT_STEREO16, &output[0],
+			                       output.size() * sizeof(int16_t), MIX_RATE);
+			AL::Source::queueBuffer(src, buf);
+		}
+
+		if (AL::Source::getState(src) == AL_PLAYING)
+			return;
+
+		/* Everything queued has been played by now */
+		running = false;
+	}
+
+	/* Start over with a fresh queue once there's
+	 * something to be heard again */
+	if (!mix())
+		return;
+
+	AL::Source::stop(src);
+	AL::Source::clearQueue(src);
+
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		if (i > 0 && !mix())
+			break;
+
+		AL::Buffer::uploadData(buffers[i], AL_FORMAT_STEREO16, &output[0],
+		                       output.size() * sizeof(int16_t), MIX_RATE);
+		AL::Source::queueBuffer(src, buffers[i]);
+	}
+
+	AL::Source::play(src);
+	running = true;
+}
+
+/* Renders the next MIX_FRAMES frames into 'output'.
+ * Returns false if no voice was playing */
+bool SoftMixer::mix()
+{
+	bool any = false;
+
+	memset(&accum[0], 0, accum.size() * sizeof(int32_t));
+
+	for (size_t i = 0; i < voices.size(); ++i)
+	{
+		if (!voices[i].sound)
+			continue;
+
+		mixVoice(voices[i]);
+		any = true;
+	}
+
+	const int32_t *in = &accum[0];
+	int16_t *out = &output[0];
+	size_t i = 0;
+	const size_t count = accum.size();
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x4_t lo = vqshrn_n_s32(vld1q_s32(in + i), GAIN_SHIFT);
+		int16x4_t hi = vqshrn_n_s32(vld1q_s32(in + i + 4), GAIN_SHIFT);
+		vst1q_s16(out + i, vcombine_s16(lo, hi));
+	}
+#elif defined(__SSE2__)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i lo = _mm_srai_epi32(_mm_loadu_si128((const __m128i*) (in + i)), GAIN_SHIFT);
+		__m128i hi = _mm_srai_epi32(_mm_loadu_si128((const __m128i*) (in + i + 4)), GAIN_SHIFT);
+		_mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+
+	for (; i < count; ++i)
+		out[i] = std::max(-32768, std::min(32767, in[i] >> GAIN_SHIFT));
+
+	return any;
+}
+
+void SoftMixer::mixVoice(Voice &voice)
+{
+	const MixSound &sound = *voice.sound;
+	const int16_t *s = &sound.samples[0];
+	const int32_t gain = voice.gain;
+	int32_t *acc = &accum[0];
+
+	uint32_t frame = voice.pos >> 16;
+	size_t i = 0;
+
+	if (voice.step == 0x10000 && sound.channels == 2)
+	{
+		/* Not resampled; the usual case for stereo effects
+		 * recorded at the output rate and played at 100% */
+		size_t n = std::min<size_t>(MIX_FRAMES, sound.frames - frame) * 2;
+		const int16_t *src = s + frame * 2;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		for (; i + 8 <= n; i += 8)
+		{
+			int16x8_t v = vld1q_s16(src + i);
+			int32x4_t lo = vmlal_n_s16(vld1q_s32(acc + i), vget_low_s16(v), gain);
+			int32x4_t hi = vmlal_n_s16(vld1q_s32(acc + i + 4), vget_high_s16(v), gain);
+			vst1q_s32(acc + i, lo);
+			vst1q_s32(acc + i + 4, hi);
+		}
+#elif defined(__SSE2__)
+		/* 16x16 bit multiplies, widened to the full 32 bit products */
+		const __m128i g = _mm_set1_epi16(gain);
+
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+			__m128i pl = _mm_mullo_epi16(v, g);
+			__m128i ph = _mm_mulhi_epi16(v, g);
+			__m128i lo = _mm_unpacklo_epi16(pl, ph);
+			__m128i hi = _mm_unpackhi_epi16(pl, ph);
+
+			__m128i *a = (__m128i*) (acc + i);
+			_mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), lo));
+			_mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), hi));
+		}
+#endif
+
+		for (; i < n; ++i)
+			acc[i] += src[i] * gain;
+
+		voice.pos += (uint64_t) (n / 2) << 16;
+	}
+	else
+	{
+		const uint32_t last = sound.frames - 1;
+		const int ch = sound.channels;
+
+		for (; i < MIX_FRAMES; ++i)
+		{
+			frame = voice.pos >> 16;
+
+			if (frame >= sound.frames)
+				break;
+
+			const uint32_t next = std::min(frame + 1, last);
+			const int32_t frac = (voice.pos & 0xFFFF) >> 2;
+
+			/* Mono sources have both channels read from the same offset */
+			const int16_t *a = s + frame * ch;
+			const int16_t *b = s + next * ch;
+
+			int32_t l = a[0] + (((b[0] - a[0]) * frac) >> 14);
+			int32_t r = a[ch-1] + (((b[ch-1] - a[ch-1]) * frac) >> 14);
+
+			acc[i*2]   += l * gain;
+			acc[i*2+1] += r * gain;
+
+			voice.pos += voice.step;
+		}
+	}
+
+	if ((voice.pos >> 16) >= sound.frames)
+		releaseVoice(voice);
+}
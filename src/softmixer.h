@@ -0,0 +1,113 @@
+/*
+** softmixer.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOFTMIXER_H
+#define SOFTMIXER_H
+
+#include "al-util.h"
+
+#include <vector>
+#include <stdint.h>
+
+/* Decoded sound a mixer voice plays from */
+struct MixSound
+{
+	/* Interleaved signed 16 bit samples */
+	std::vector<int16_t> samples;
+	int channels;
+	int rate;
+	uint32_t frames;
+
+	MixSound()
+	    : channels(0), rate(0), frames(0), refCount(1)
+	{}
+
+	static MixSound *ref(MixSound *sound)
+	{
+		++sound->refCount;
+
+		return sound;
+	}
+
+	static void deref(MixSound *sound)
+	{
+		if (--sound->refCount == 0)
+			delete sound;
+	}
+
+private:
+	uint32_t refCount;
+};
+
+/* Mixes any number of voices in software into the queue of
+ * a single streaming AL source, for OpenAL implementations
+ * with few (or expensive) sources; see 'SE.softwareMix'.
+ * Voices are resampled for pitch with linear interpolation.
+ * Not thread safe; service() has to be called periodically
+ * (from the audio thread) to keep the queue filled */
+class SoftMixer
+{
+public:
+	SoftMixer(size_t voiceCount);
+	~SoftMixer();
+
+	/* Same semantics as SoundEmitter voices: the same sound
+	 * requested with equal pitch within one graphics frame
+	 * only plays once, as loud as the loudest request, and
+	 * once all voices are busy the quietest one is replaced */
+	void play(MixSound *sound, float volume, float pitch, int frame);
+	void stop();
+
+	void service();
+
+private:
+	struct Voice
+	{
+		MixSound *sound;
+		float volume;
+		float pitch;
+		int frame;
+		unsigned int seq;
+
+		/* 16.16 fixed point, in source frames */
+		uint64_t pos;
+		uint32_t step;
+
+		/* Q10 */
+		int32_t gain;
+	};
+
+	std::vector<Voice> voices;
+	unsigned int voiceSeq;
+
+	AL::Source::ID src;
+	std::vector<AL::Buffer::ID> buffers;
+	bool running;
+
+	std::vector<int32_t> accum;
+	std::vector<int16_t> output;
+
+	bool mix();
+	void mixVoice(Voice &voice);
+	void releaseVoice(Voice &voice);
+};
+
+#endif // SOFTMIXER_H
@@ -27,10 +27,22 @@
 #include "config.h"
 #include "util.h"
 #include "debugwriter.h"
+#include "workerpool.h"
+#include "graphics.h"
+#include "memstats.h"
+#include "softmixer.h"
 
 #include <SDL_sound.h>
+#include <SDL_mutex.h>
+#include <SDL_timer.h>
+#include <SDL_endian.h>
 
-#define SE_CACHE_MEM (10*1024*1024) // 10 MB
+#include <string.h>
+#include <algorithm>
+
+/* Voices beyond 'SE.sourceCount' are released
+ * after being idle for this long */
+#define VOICE_IDLE_MS 5000
 
 struct SoundBuffer
 {
@@ -39,6 +51,10 @@ struct SoundBuffer
 
 	AL::Buffer::ID alBuffer;
 
+	/* Samples handed to the mixer instead of
+	 * 'alBuffer', with 'SE.softwareMix' */
+	MixSound *mixSound;
+
 	/* Link into the buffer cache priority list */
 	IntruListLink<SoundBuffer> link;
 
@@ -48,12 +64,17 @@ struct SoundBuffer
 	/* Reference count */
 	uint8_t refCount;
 
-	SoundBuffer()
-	    : link(this),
+	SoundBuffer(bool mixed)
+	    : mixSound(0),
+	      link(this),
+	      bytes(0),
 	      refCount(1)
 
 	{
-		alBuffer = AL::Buffer::gen();
+		if (mixed)
+			mixSound = new MixSound;
+		else
+			alBuffer = AL::Buffer::gen();
 	}
 
 	static SoundBuffer *ref(SoundBuffer *buffer)
@@ -72,102 +93,506 @@ struct SoundBuffer
 private:
 	~SoundBuffer()
 	{
-		AL::Buffer::del(alBuffer);
+		MemStats::add(MemStats::SoundBuffers, -(int64_t) bytes);
+
+		if (mixSound)
+			MixSound::deref(mixSound);
+		else
+			AL::Buffer::del(alBuffer);
 	}
 };
 
-/* Before: [a][b][c][d], After (index=1): [a][c][d][b] */
-static void
-arrayPushBack(std::vector<size_t> &array, size_t size, size_t index)
+/* The file contents of a decoded sound effect, to decode
+ * it again from (see 'SE.compressedCacheSize') */
+struct EncodedSound
+{
+	std::string key;
+	std::string data;
+	std::string ext;
+
+	/* Link into the encoded cache priority list */
+	IntruListLink<EncodedSound> link;
+
+	EncodedSound()
+	    : link(this)
+	{}
+};
+
+static uint16_t readLE16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLE32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Location and format of the samples in a RIFF/WAVE file
+ * holding plain 8 or 16 bit PCM, mono or stereo */
+struct PCMWave
+{
+	size_t offset;
+	size_t bytes;
+	int channels;
+	int rate;
+	int sampleSize;
+};
+
+/* Returns false for anything that has to go through SDL_sound */
+static bool findPCMWave(const std::string &data, PCMWave &out)
 {
-	size_t v = array[index];
+	const uint8_t *d = (const uint8_t*) data.c_str();
+	const size_t size = data.size();
+
+	if (size < 12 || memcmp(d, "RIFF", 4) || memcmp(d+8, "WAVE", 4))
+		return false;
+
+	bool haveFormat = false;
+	int blockAlign = 0;
+	size_t pos = 12;
+
+	while (pos + 8 <= size)
+	{
+		const uint8_t *chunk = d + pos;
+		const uint32_t chunkSize = readLE32(chunk+4);
+		pos += 8;
+
+		if (!memcmp(chunk, "fmt ", 4))
+		{
+			if (chunkSize < 16 || pos + chunkSize > size)
+				return false;
+
+			const uint8_t *fmt = d + pos;
+			uint16_t tag = readLE16(fmt);
+
+			/* WAVE_FORMAT_EXTENSIBLE; the sub format
+			 * GUID starts with the actual tag */
+			if (tag == 0xFFFE && chunkSize >= 40)
+				tag = readLE16(fmt+24);
+
+			out.channels = readLE16(fmt+2);
+			out.rate = readLE32(fmt+4);
+			blockAlign = readLE16(fmt+12);
+			const int bits = readLE16(fmt+14);
+
+			if (tag != 1 || (out.channels != 1 && out.channels != 2)
+			    || (bits != 8 && bits != 16) || out.rate <= 0)
+				return false;
+
+			out.sampleSize = bits / 8;
+
+			if (blockAlign != out.sampleSize * out.channels)
+				return false;
+
+			haveFormat = true;
+		}
+		else if (!memcmp(chunk, "data", 4))
+		{
+			if (!haveFormat)
+				return false;
 
-	for (size_t t = index; t < size-1; ++t)
-		array[t] = array[t+1];
+			/* Truncated files are played as far as they go */
+			size_t bytes = std::min<size_t>(chunkSize, size - pos);
+			bytes -= bytes % blockAlign;
 
-	array[size-1] = v;
+			out.offset = pos;
+			out.bytes = bytes;
+
+			return true;
+		}
+
+		/* Chunks are padded to even sizes */
+		if (chunkSize > size - pos)
+			return false;
+
+		pos += chunkSize + (chunkSize & 1);
+	}
+
+	return false;
+}
+
+/* Decodes a sound effect read on the game thread into
+ * PCM, which is then uploaded once the job is done */
+struct SoundDecodeJob : WorkerJob
+{
+	std::string filename;
+	std::string data;
+	std::string ext;
+
+	/* Decode to signed 16 bit, for the mixer */
+	bool s16;
+
+	/* Result */
+	std::string pcm;
+	int channels;
+	ALenum alFormat;
+	int rate;
+	bool ok;
+	std::string error;
+
+	SoundDecodeJob(const std::string &filename, FileSystem::ReadAllHandler &file,
+	               bool s16)
+	    : filename(filename),
+	      ext(file.ext),
+	      s16(s16),
+	      channels(0),
+	      alFormat(0),
+	      rate(0),
+	      ok(false)
+	{
+		data.swap(file.data);
+	}
+
+	/* Plain PCM WAV files only need their header parsed;
+	 * the samples are taken over from 'data' right away */
+	bool takePCMWave()
+	{
+		PCMWave wave;
+
+		if (!findPCMWave(data, wave))
+			return false;
+
+#if SDL_BYTEORDER != SDL_LIL_ENDIAN
+		if (wave.sampleSize == 2)
+			return false;
+#endif
+
+		if (s16 && wave.sampleSize == 1)
+		{
+			/* Unsigned 8 bit samples, widened for the mixer */
+			const uint8_t *in = (const uint8_t*) data.c_str() + wave.offset;
+			pcm.resize(wave.bytes * 2);
+
+			for (size_t i = 0; i < wave.bytes; ++i)
+			{
+				int16_t sample = (in[i] - 128) << 8;
+				memcpy(&pcm[i*2], &sample, 2);
+			}
+
+			wave.sampleSize = 2;
+		}
+		else
+		{
+			data.erase(0, wave.offset);
+			data.resize(wave.bytes);
+			pcm.swap(data);
+		}
+
+		/* Nothing worth keeping for the encoded cache */
+		std::string().swap(data);
+
+		channels = wave.channels;
+		alFormat = chooseALFormat(wave.sampleSize, channels);
+		rate = wave.rate;
+		ok = true;
+
+		return true;
+	}
+
+	void run()
+	{
+		if (takePCMWave())
+			return;
+
+		SDL_RWops *ops = SDL_RWFromConstMem(data.c_str(), data.size());
+
+		/* Zero fields keep the native channels and rate */
+		Sound_AudioInfo desired = { AUDIO_S16SYS, 0, 0 };
+
+		Sound_Sample *sample = Sound_NewSample(ops, ext.c_str(),
+		                                       s16 ? &desired : 0,
+		                                       STREAM_BUF_SIZE);
+
+		if (!sample)
+		{
+			SDL_RWclose(ops);
+			error = Sound_GetError();
+			std::string().swap(data);
+
+			return;
+		}
+
+		/* Decoded samples come in the converted format */
+		const Sound_AudioInfo &info = s16 ? sample->desired : sample->actual;
+
+		uint32_t decBytes = Sound_DecodeAll(sample);
+		uint8_t sampleSize = formatSampleSize(info.format);
+		uint32_t sampleCount = decBytes / sampleSize;
+
+		pcm.assign((const char*) sample->buffer, sampleSize * sampleCount);
+		channels = info.channels;
+		alFormat = chooseALFormat(sampleSize, channels);
+		rate = info.rate;
+		ok = true;
+
+		/* 'data' is kept for the encoded cache */
+		Sound_FreeSample(sample);
+	}
+};
+
+/* Holds 'mutex' for the current scope */
+struct EmitterLock
+{
+	SDL_mutex *mutex;
+
+	EmitterLock(SDL_mutex *mutex)
+	    : mutex(mutex)
+	{
+		SDL_LockMutex(mutex);
+	}
+
+	~EmitterLock()
+	{
+		SDL_UnlockMutex(mutex);
+	}
+};
+
+static bool isPlaying(const SoundEmitter::Voice &voice)
+{
+	return AL::Source::getState(voice.src) == AL_PLAYING;
 }
 
 SoundEmitter::SoundEmitter(const Config &conf)
     : bufferBytes(0),
-      srcCount(conf.SE.sourceCount),
-      alSrcs(srcCount),
-      atchBufs(srcCount),
-      srcPrio(srcCount)
+      maxBufferBytes(conf.SE.cacheSize),
+      encodedBytes(0),
+      maxEncodedBytes(conf.SE.compressedCacheSize),
+      minVoices(conf.SE.sourceCount),
+      maxVoices(conf.SE.maxSourceCount),
+      voiceSeq(0),
+      lastTrim(0),
+      strictTiming(conf.SE.strictTiming),
+      mixer(0),
+      mutex(SDL_CreateMutex())
 {
-	for (size_t i = 0; i < srcCount; ++i)
+	if (conf.SE.softwareMix)
 	{
-		alSrcs[i] = AL::Source::gen();
-		atchBufs[i] = 0;
-		srcPrio[i] = i;
+		mixer = new SoftMixer(maxVoices);
+		return;
 	}
+
+	for (size_t i = 0; i < minVoices; ++i)
+		if (!addVoice())
+			break;
 }
 
 SoundEmitter::~SoundEmitter()
 {
-	for (size_t i = 0; i < srcCount; ++i)
+	JobHash::const_iterator job;
+	for (job = decodeJobs.cbegin(); job != decodeJobs.cend(); ++job)
 	{
-		AL::Source::stop(alSrcs[i]);
-		AL::Source::del(alSrcs[i]);
-
-		if (atchBufs[i])
-			SoundBuffer::deref(atchBufs[i]);
+		shState->workerPool().wait(*job->second);
+		delete job->second;
 	}
 
+	while (!voices.empty())
+		releaseVoice(voices.size()-1);
+
+	delete mixer;
+
 	BufferHash::const_iterator iter;
 	for (iter = bufferHash.cbegin(); iter != bufferHash.cend(); ++iter)
 		SoundBuffer::deref(iter->second);
+
+	EncodedHash::const_iterator enc;
+	for (enc = encodedHash.cbegin(); enc != encodedHash.cend(); ++enc)
+		delete enc->second;
+
+	MemStats::set(MemStats::EncodedSounds, 0);
+
+	SDL_DestroyMutex(mutex);
 }
 
 void SoundEmitter::play(const std::string &filename,
                         int volume,
                         int pitch)
 {
+	EmitterLock lock(mutex);
+
 	float _volume = clamp<int>(volume, 0, 100) / 100.0f;
 	float _pitch  = clamp<int>(pitch, 50, 150) / 100.0f;
+	int frame = shState->graphics().getFrameCount();
 
-	SoundBuffer *buffer = allocateBuffer(filename);
+	SoundBuffer *buffer = lookupBuffer(filename);
 
 	if (!buffer)
+	{
+		SoundDecodeJob *job = requestDecode(filename);
+
+		if (!job)
+			return;
+
+		WorkerPool &pool = shState->workerPool();
+
+		if (!strictTiming && pool.enabled())
+		{
+			/* Started by update() once decoded */
+			PendingPlay pending = { filename, _volume, _pitch, frame };
+			pendingPlays.push_back(pending);
+
+			return;
+		}
+
+		pool.wait(*job);
+		buffer = finishDecode(job);
+
+		if (!buffer)
+			return;
+	}
+
+	startSource(buffer, _volume, _pitch, frame);
+}
+
+void SoundEmitter::preload(const std::string &filename)
+{
+	EmitterLock lock(mutex);
+
+	if (bufferHash.contains(filename))
+		return;
+
+	try
+	{
+		SoundDecodeJob *job = requestDecode(filename);
+
+		if (job && !shState->workerPool().enabled())
+			finishDecode(job);
+	}
+	catch (const Exception &e)
+	{
+		Debug() << "Unable to preload sound:" << e.msg;
+	}
+}
+
+void SoundEmitter::update()
+{
+	EmitterLock lock(mutex);
+
+	const uint32_t now = SDL_GetTicks();
+
+	if (mixer)
+		mixer->service();
+
+	if (now - lastTrim >= 1000)
+	{
+		trimVoices(now);
+		lastTrim = now;
+	}
+
+	if (decodeJobs.cbegin() == decodeJobs.cend())
+		return;
+
+	WorkerPool &pool = shState->workerPool();
+	std::vector<SoundDecodeJob*> done;
+
+	JobHash::const_iterator iter;
+	for (iter = decodeJobs.cbegin(); iter != decodeJobs.cend(); ++iter)
+		if (pool.isDone(*iter->second))
+			done.push_back(iter->second);
+
+	if (done.empty())
+		return;
+
+	for (size_t i = 0; i < done.size(); ++i)
+		finishDecode(done[i]);
+
+	/* Start the plays whose sound is now available,
+	 * in the order they were requested */
+	std::vector<PendingPlay> stillPending;
+
+	for (size_t i = 0; i < pendingPlays.size(); ++i)
+	{
+		const PendingPlay &pending = pendingPlays[i];
+
+		if (decodeJobs.contains(pending.filename))
+		{
+			stillPending.push_back(pending);
+			continue;
+		}
+
+		SoundBuffer *buffer = bufferHash.value(pending.filename, 0);
+
+		if (buffer)
+			startSource(buffer, pending.volume, pending.pitch, pending.frame);
+	}
+
+	pendingPlays.swap(stillPending);
+}
+
+void SoundEmitter::startSource(SoundBuffer *buffer, float _volume, float _pitch,
+                               int frame)
+{
+	if (mixer)
+	{
+		mixer->play(buffer->mixSound, _volume, _pitch, frame);
 		return;
+	}
+
+	/* The same effect triggered repeatedly within a frame (eg. by
+	 * several battle animations at once) only plays once, as loud
+	 * as the loudest request */
+	for (size_t i = 0; i < voices.size(); ++i)
+	{
+		Voice &voice = voices[i];
+
+		if (voice.buffer != buffer || voice.frame != frame || voice.pitch != _pitch)
+			continue;
+
+		if (!isPlaying(voice))
+			continue;
+
+		if (_volume > voice.volume)
+		{
+			voice.volume = _volume;
+			AL::Source::setVolume(voice.src, _volume * GLOBAL_VOLUME);
+		}
+
+		return;
+	}
+
+	/* Prefer a free voice that already has 'buffer' attached */
+	int index = -1;
+
+	for (size_t i = 0; i < voices.size(); ++i)
+	{
+		if (isPlaying(voices[i]))
+			continue;
+
+		index = i;
 
-	/* Try to find first free source */
-	size_t i;
-	for (i = 0; i < srcCount; ++i)
-		if (AL::Source::getState(alSrcs[srcPrio[i]]) != AL_PLAYING)
+		if (voices[i].buffer == buffer)
 			break;
+	}
 
-	/* If we didn't find any, try to find the lowest priority source
-	 * with the same buffer to overtake */
-	if (i == srcCount)
-		for (size_t j = 0; j < srcCount; ++j)
-			if (atchBufs[srcPrio[j]] == buffer)
-				i = j;
+	if (index < 0 && addVoice())
+		index = voices.size()-1;
 
-	/* If we didn't find any, overtake the one with lowest priority */
-	if (i == srcCount)
-		i = 0;
+	if (index < 0)
+		index = stealVoice();
 
-	size_t srcIndex = srcPrio[i];
+	if (index < 0)
+		return;
 
-	/* Only detach/reattach if it's actually a different buffer */
-	bool switchBuffer = (atchBufs[srcIndex] != buffer);
+	Voice &voice = voices[index];
 
-	/* Push the used source to the back of the priority list */
-	arrayPushBack(srcPrio, srcCount, i);
+	/* Only detach/reattach if it's actually a different buffer */
+	bool switchBuffer = (voice.buffer != buffer);
 
-	AL::Source::ID src = alSrcs[srcIndex];
+	AL::Source::ID src = voice.src;
 	AL::Source::stop(src);
 
 	if (switchBuffer)
 		AL::Source::detachBuffer(src);
 
-	SoundBuffer *old = atchBufs[srcIndex];
-
-	if (old)
-		SoundBuffer::deref(old);
+	if (voice.buffer)
+		SoundBuffer::deref(voice.buffer);
 
-	atchBufs[srcIndex] = SoundBuffer::ref(buffer);
+	voice.buffer = SoundBuffer::ref(buffer);
+	voice.volume = _volume;
+	voice.pitch = _pitch;
+	voice.frame = frame;
+	voice.seq = ++voiceSeq;
+	voice.idleSince = 0;
 
 	if (switchBuffer)
 		AL::Source::attachBuffer(src, buffer->alBuffer);
@@ -178,101 +603,262 @@ void SoundEmitter::play(const std::string &filename,
 	AL::Source::play(src);
 }
 
-void SoundEmitter::stop()
+bool SoundEmitter::addVoice()
 {
-	for (size_t i = 0; i < srcCount; i++)
-		AL::Source::stop(alSrcs[i]);
+	if (voices.size() >= maxVoices)
+		return false;
+
+	/* Clear previous errors */
+	while (alGetError() != AL_NO_ERROR) {}
+
+	Voice voice;
+	voice.src = AL::Source::gen();
+
+	if (alGetError() != AL_NO_ERROR)
+	{
+		/* Hit the implementation's source limit */
+		maxVoices = voices.size();
+
+		return false;
+	}
+
+	voice.buffer = 0;
+	voice.volume = 0;
+	voice.pitch = 1;
+	voice.frame = -1;
+	voice.seq = 0;
+	voice.idleSince = 0;
+
+	voices.push_back(voice);
+
+	return true;
 }
 
-struct SoundOpenHandler : FileSystem::OpenHandler
+void SoundEmitter::releaseVoice(size_t index)
 {
-	SoundBuffer *buffer;
+	Voice &voice = voices[index];
 
-	SoundOpenHandler()
-	    : buffer(0)
-	{}
+	AL::Source::stop(voice.src);
+	AL::Source::detachBuffer(voice.src);
+	AL::Source::del(voice.src);
 
-	bool tryRead(SDL_RWops &ops, const char *ext)
-	{
-		Sound_Sample *sample = Sound_NewSample(&ops, ext, 0, STREAM_BUF_SIZE);
+	if (voice.buffer)
+		SoundBuffer::deref(voice.buffer);
 
-		if (!sample)
+	voices.erase(voices.begin() + index);
+}
+
+int SoundEmitter::stealVoice()
+{
+	/* The quietest voice, and the oldest among equally loud ones */
+	int index = -1;
+
+	for (size_t i = 0; i < voices.size(); ++i)
+	{
+		if (index < 0)
 		{
-			SDL_RWclose(&ops);
-			return false;
+			index = i;
+			continue;
 		}
 
-		/* Do all of the decoding in the handler so we don't have
-		 * to keep the source ops around */
-		uint32_t decBytes = Sound_DecodeAll(sample);
-		uint8_t sampleSize = formatSampleSize(sample->actual.format);
-		uint32_t sampleCount = decBytes / sampleSize;
+		const Voice &voice = voices[i];
+		const Voice &best = voices[index];
 
-		buffer = new SoundBuffer;
-		buffer->bytes = sampleSize * sampleCount;
+		if (voice.volume < best.volume ||
+		    (voice.volume == best.volume && voice.seq < best.seq))
+			index = i;
+	}
 
-		ALenum alFormat = chooseALFormat(sampleSize, sample->actual.channels);
+	return index;
+}
 
-		AL::Buffer::uploadData(buffer->alBuffer, alFormat, sample->buffer,
-							   buffer->bytes, sample->actual.rate);
+void SoundEmitter::trimVoices(uint32_t now)
+{
+	for (size_t i = voices.size(); i-- > minVoices;)
+	{
+		Voice &voice = voices[i];
 
-		Sound_FreeSample(sample);
+		if (isPlaying(voice))
+		{
+			voice.idleSince = 0;
+			continue;
+		}
 
-		return true;
+		if (voice.idleSince == 0)
+			voice.idleSince = now;
+		else if (now - voice.idleSince >= VOICE_IDLE_MS)
+			releaseVoice(i);
 	}
-};
+}
 
-SoundBuffer *SoundEmitter::allocateBuffer(const std::string &filename)
+void SoundEmitter::stop()
+{
+	EmitterLock lock(mutex);
+
+	/* Sounds still being decoded shouldn't start afterwards */
+	pendingPlays.clear();
+
+	for (size_t i = 0; i < voices.size(); i++)
+		AL::Source::stop(voices[i].src);
+
+	if (mixer)
+		mixer->stop();
+}
+
+SoundBuffer *SoundEmitter::lookupBuffer(const std::string &filename)
 {
 	SoundBuffer *buffer = bufferHash.value(filename, 0);
 
 	if (buffer)
 	{
-		/* Buffer still in cashe.
+		/* Buffer still in cache.
 		 * Move to front of priority list */
 		buffers.remove(buffer->link);
-		buffers.append(buffer->link);
+		buffers.prepend(buffer->link);
+	}
 
-		return buffer;
+	return buffer;
+}
+
+SoundDecodeJob *SoundEmitter::requestDecode(const std::string &filename)
+{
+	SoundDecodeJob *job = decodeJobs.value(filename, 0);
+
+	if (job)
+		return job;
+
+	FileSystem::ReadAllHandler file;
+	EncodedSound *enc = encodedHash.value(filename, 0);
+
+	if (enc)
+	{
+		/* Decode from memory; goes back into the encoded
+		 * cache if it's dropped from the decoded one again */
+		file.data.swap(enc->data);
+		file.ext = enc->ext;
+
+		encodedHash.remove(filename);
+		encodedList.remove(enc->link);
+		encodedBytes -= file.data.size();
+		MemStats::set(MemStats::EncodedSounds, encodedBytes);
+
+		delete enc;
 	}
 	else
 	{
-		/* Buffer not in cache, needs to be loaded */
-		SoundOpenHandler handler;
-		shState->fileSystem().openRead(handler, filename.c_str());
-		buffer = handler.buffer;
+		shState->fileSystem().openRead(file, filename.c_str());
+	}
 
-		if (!buffer)
-		{
-			char buf[512];
-			snprintf(buf, sizeof(buf), "Unable to decode sound: %s: %s",
-			         filename.c_str(), Sound_GetError());
-			Debug() << buf;
+	job = new SoundDecodeJob(filename, file, mixer != 0);
+	decodeJobs.insert(filename, job);
 
-			return 0;
-		}
+	WorkerPool &pool = shState->workerPool();
 
-		buffer->key = filename;
-		uint32_t wouldBeBytes = bufferBytes + buffer->bytes;
+	if (pool.enabled())
+		pool.submit(*job);
 
-		/* If memory limit is reached, delete lowest priority buffer
-		 * until there is room or no buffers left */
-		while (wouldBeBytes > SE_CACHE_MEM && !buffers.isEmpty())
-		{
-			SoundBuffer *last = buffers.tail();
-			bufferHash.remove(last->key);
-			buffers.remove(last->link);
+	return job;
+}
 
-			wouldBeBytes -= last->bytes;
+SoundBuffer *SoundEmitter::finishDecode(SoundDecodeJob *job)
+{
+	/* Runs the job inline if no worker got to it */
+	shState->workerPool().wait(*job);
 
-			SoundBuffer::deref(last);
-		}
+	decodeJobs.remove(job->filename);
 
-		bufferHash.insert(filename, buffer);
-		buffers.prepend(buffer->link);
+	if (!job->ok)
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), "Unable to decode sound: %s: %s",
+		         job->filename.c_str(), job->error.c_str());
+		Debug() << buf;
 
-		bufferBytes = wouldBeBytes;
+		delete job;
 
-		return buffer;
+		return 0;
 	}
+
+	SoundBuffer *buffer = new SoundBuffer(mixer != 0);
+	buffer->key = job->filename;
+	buffer->bytes = job->pcm.size();
+
+	if (mixer)
+	{
+		MixSound &sound = *buffer->mixSound;
+
+		sound.samples.resize(buffer->bytes / sizeof(int16_t));
+		sound.channels = job->channels;
+		sound.rate = job->rate;
+		sound.frames = sound.samples.size() / sound.channels;
+
+		if (!sound.samples.empty())
+			memcpy(&sound.samples[0], job->pcm.c_str(),
+			       sound.samples.size() * sizeof(int16_t));
+	}
+	else
+	{
+		AL::Buffer::uploadData(buffer->alBuffer, job->alFormat, job->pcm.c_str(),
+		                       buffer->bytes, job->rate);
+	}
+
+	MemStats::add(MemStats::SoundBuffers, buffer->bytes);
+
+	/* Only worth keeping if it's actually compressed */
+	if (job->data.size() < job->pcm.size())
+		storeEncoded(job->filename, job->data, job->ext);
+
+	delete job;
+
+	uint32_t wouldBeBytes = bufferBytes + buffer->bytes;
+
+	/* If memory limit is reached, delete lowest priority buffer
+	 * until there is room or no buffers left */
+	while (wouldBeBytes > maxBufferBytes && !buffers.isEmpty())
+	{
+		SoundBuffer *last = buffers.tail();
+		bufferHash.remove(last->key);
+		buffers.remove(last->link);
+
+		wouldBeBytes -= last->bytes;
+
+		SoundBuffer::deref(last);
+	}
+
+	bufferHash.insert(buffer->key, buffer);
+	buffers.prepend(buffer->link);
+
+	bufferBytes = wouldBeBytes;
+
+	return buffer;
+}
+
+void SoundEmitter::storeEncoded(const std::string &filename,
+                                std::string &data, const std::string &ext)
+{
+	if (data.size() > maxEncodedBytes || encodedHash.contains(filename))
+		return;
+
+	/* Make room, dropping the least recently decoded first */
+	while (encodedBytes + data.size() > maxEncodedBytes)
+	{
+		EncodedSound *last = encodedList.tail();
+		encodedHash.remove(last->key);
+		encodedList.remove(last->link);
+
+		encodedBytes -= last->data.size();
+
+		delete last;
+	}
+
+	EncodedSound *enc = new EncodedSound;
+	enc->key = filename;
+	enc->data.swap(data);
+	enc->ext = ext;
+
+	encodedHash.insert(filename, enc);
+	encodedList.prepend(enc->link);
+
+	encodedBytes += enc->data.size();
+	MemStats::set(MemStats::EncodedSounds, encodedBytes);
 }
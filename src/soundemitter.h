@@ -30,24 +30,85 @@
 #include <vector>
 
 struct SoundBuffer;
+struct EncodedSound;
+struct SoundDecodeJob;
 struct Config;
+class SoftMixer;
+struct SDL_mutex;
 
+/* Sound effects not in the buffer cache are decoded on the
+ * WorkerPool and started by update() (called periodically
+ * from the audio thread) once they're ready, unless
+ * 'SE.strictTiming' is set. All members are guarded by 'mutex' */
 struct SoundEmitter
 {
 	typedef BoostHash<std::string, SoundBuffer*> BufferHash;
+	typedef BoostHash<std::string, SoundDecodeJob*> JobHash;
+	typedef BoostHash<std::string, EncodedSound*> EncodedHash;
 
+	/* Most recently played first */
 	IntruList<SoundBuffer> buffers;
 	BufferHash bufferHash;
 
 	/* Byte count sum of all cached / playing buffers */
 	uint32_t bufferBytes;
+	const uint32_t maxBufferBytes;
 
-	const size_t srcCount;
-	std::vector<AL::Source::ID> alSrcs;
-	std::vector<SoundBuffer*> atchBufs;
+	/* Encoded file contents of effects (most recently
+	 * decoded first), see 'SE.compressedCacheSize' */
+	IntruList<EncodedSound> encodedList;
+	EncodedHash encodedHash;
+	uint32_t encodedBytes;
+	const uint32_t maxEncodedBytes;
 
-	/* Indices of sources, sorted by priority (lowest first) */
-	std::vector<size_t> srcPrio;
+	/* An AL source with its attached buffer */
+	struct Voice
+	{
+		AL::Source::ID src;
+		SoundBuffer *buffer;
+		float volume;
+		float pitch;
+
+		/* Graphics frame the current sound was requested in */
+		int frame;
+
+		/* Start order, for stealing the oldest */
+		unsigned int seq;
+
+		/* SDL ticks since which it's not playing, or 0 */
+		uint32_t idleSince;
+	};
+
+	/* Grown on demand from 'SE.sourceCount' up to
+	 * 'SE.maxSourceCount' (or however many sources
+	 * OpenAL provides), shrunk again when idle */
+	std::vector<Voice> voices;
+	const size_t minVoices;
+	size_t maxVoices;
+	unsigned int voiceSeq;
+	uint32_t lastTrim;
+
+	/* Decodes in flight, by filename */
+	JobHash decodeJobs;
+
+	struct PendingPlay
+	{
+		std::string filename;
+		float volume;
+		float pitch;
+		int frame;
+	};
+
+	/* Plays waiting for their decode, oldest first */
+	std::vector<PendingPlay> pendingPlays;
+
+	const bool strictTiming;
+
+	/* With 'SE.softwareMix', all effects are played
+	 * through this instead of 'voices' */
+	SoftMixer *mixer;
+
+	SDL_mutex *mutex;
 
 	SoundEmitter(const Config &conf);
 	~SoundEmitter();
@@ -56,10 +117,26 @@ struct SoundEmitter
 	          int volume,
 	          int pitch);
 
+	/* Decodes 'filename' into the cache without playing it */
+	void preload(const std::string &filename);
+
+	/* Uploads finished decodes and starts the plays
+	 * that were waiting on them */
+	void update();
+
 	void stop();
 
 private:
-	SoundBuffer *allocateBuffer(const std::string &filename);
+	SoundBuffer *lookupBuffer(const std::string &filename);
+	SoundDecodeJob *requestDecode(const std::string &filename);
+	SoundBuffer *finishDecode(SoundDecodeJob *job);
+	void startSource(SoundBuffer *buffer, float volume, float pitch, int frame);
+	bool addVoice();
+	void releaseVoice(size_t index);
+	int stealVoice();
+	void trimVoices(uint32_t now);
+	void storeEncoded(const std::string &filename,
+	                  std::string &data, const std::string &ext);
 };
 
 #endif // SOUNDEMITTER_H
@@ -22,6 +22,7 @@
 #include "sprite.h"
 
 #include "sharedstate.h"
+#include "graphics.h"
 #include "bitmap.h"
 #include "etc.h"
 #include "etc-internal.h"
@@ -33,8 +34,14 @@
 #include "shader.h"
 #include "glstate.h"
 #include "quadarray.h"
+#include "spritebatch.h"
+#include "spritesystem.h"
+#include "profiler.h"
+#include "scenecapture.h"
 
 #include <math.h>
+#include <float.h>
+#include <algorithm>
 #ifndef M_PI
 # define M_PI 3.14159265358979323846
 #endif
@@ -43,7 +50,7 @@
 
 #include <sigc++/connection.h>
 
-struct SpritePrivate
+struct SpritePrivate : public Pooled<SpritePrivate>
 {
 	Bitmap *bitmap;
 
@@ -51,7 +58,6 @@ struct SpritePrivate
 	Transform trans;
 
 	Rect *srcRect;
-	sigc::connection srcRectCon;
 
 	bool mirrored;
 	int bushDepth;
@@ -60,12 +66,12 @@ struct SpritePrivate
 	NormValue opacity;
 	BlendType blendType;
 
+	/* Scene area in screen coordinates */
 	IntRect sceneRect;
-	Vec2i sceneOrig;
 
-	/* Would this sprite be visible on
-	 * the screen if drawn? */
-	bool isVisible;
+	/* Index of the render state mirrored
+	 * into the shared SpriteSystem */
+	size_t renderSlot;
 
 	Color *color;
 	Tone *tone;
@@ -79,9 +85,15 @@ struct SpritePrivate
 
 		/* Wave effect is active (amp != 0) */
 		bool active;
+		/* Displaced by the wave shader (amp > 0) instead
+		 * of drawing the quads built in 'qArray' */
+		bool shaded;
 		/* qArray needs updating */
 		bool dirty;
 		SimpleQuadArray qArray;
+		/* Number of chunks in 'qArray' if it holds the
+		 * static wave shader mesh, otherwise 0 */
+		size_t meshChunks;
 	} wave;
 
 	EtcTemps tmp;
@@ -97,14 +109,11 @@ struct SpritePrivate
 	      bushOpacity(128),
 	      opacity(255),
 	      blendType(BlendNormal),
-	      isVisible(false),
 	      color(&tmp.color),
 	      tone(&tmp.tone)
 
 	{
-		sceneRect.x = sceneRect.y = 0;
-
-		updateSrcRectCon();
+		shState->spriteSystem().add(&renderSlot);
 
 		prepareCon = shState->prepareDraw.connect
 		        (sigc::mem_fun(this, &SpritePrivate::prepare));
@@ -113,13 +122,16 @@ struct SpritePrivate
 		wave.length = 180;
 		wave.speed = 360;
 		wave.phase = 0.0f;
+		wave.active = false;
+		wave.shaded = false;
 		wave.dirty = false;
+		wave.meshChunks = 0;
 	}
 
 	~SpritePrivate()
 	{
-		srcRectCon.disconnect();
 		prepareCon.disconnect();
+		shState->spriteSystem().remove(renderSlot);
 	}
 
 	void recomputeBushDepth()
@@ -156,68 +168,107 @@ struct SpritePrivate
 		wave.dirty = true;
 	}
 
-	void updateSrcRectCon()
+	/* Extends 'box' (x1, y1, x2, y2) by the untransformed vertices */
+	template<class VertexType>
+	static void extendBounds(Vec4 &box, const VertexType *vert, size_t count)
 	{
-		/* Cut old connection */
-		srcRectCon.disconnect();
-		/* Create new one */
-		srcRectCon = srcRect->valueChanged.connect
-				(sigc::mem_fun(this, &SpritePrivate::onSrcRectChange));
+		for (size_t i = 0; i < count; ++i)
+		{
+			const Vec2 &pos = vert[i].pos;
+
+			box.x = std::min(box.x, pos.x);
+			box.y = std::min(box.y, pos.y);
+			box.z = std::max(box.z, pos.x);
+			box.w = std::max(box.w, pos.y);
+		}
 	}
 
-	void updateVisibility()
+	/* Would this sprite be visible on the screen if drawn? */
+	bool computeVisibility()
 	{
-		isVisible = false;
-
 		if (nullOrDisposed(bitmap))
-			return;
+			return false;
 
 		if (!opacity)
-			return;
+			return false;
 
-		if (wave.active)
+		/* Bounds of the geometry that will be drawn, in sprite space */
+		Vec4 box(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		if (wave.shaded)
 		{
-			/* Don't do expensive wave bounding box
-			 * calculations */
-			isVisible = true;
-			return;
+			int firstLength, visibleLength;
+			waveChunks(firstLength, visibleLength);
+
+			/* Every chunk is shifted by at most 'amp' */
+			box = Vec4(-wave.amp, 0, srcRect->width + wave.amp,
+			           visibleLength / trans.getScale().y);
 		}
+		else if (wave.active)
+			extendBounds(box, dataPtr(wave.qArray.vertices), wave.qArray.vertices.size());
+		else
+			extendBounds(box, quad.vert, 4);
+
+		/* Nothing left to draw */
+		if (box.x >= box.z || box.y >= box.w)
+			return false;
+
+		/* Transforming the corners yields a conservative
+		 * bounding box in screen space for any zoom/angle */
+		const float *m = trans.getMatrix();
+		const Vec2 corners[] =
+		{
+			Vec2(box.x, box.y), Vec2(box.z, box.y),
+			Vec2(box.x, box.w), Vec2(box.z, box.w)
+		};
 
-		/* Compare sprite bounding box against the scene */
+		Vec4 screen(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
 
-		/* If sprite is zoomed/rotated, just opt out for now
-		 * for simplicity's sake */
-		const Vec2 &scale = trans.getScale();
-		if (scale.x != 1 || scale.y != 1 || trans.getRotation() != 0)
+		for (size_t i = 0; i < ARRAY_SIZE(corners); ++i)
 		{
-			isVisible = true;
-			return;
+			const Vec2 &c = corners[i];
+			const float x = m[0]*c.x + m[4]*c.y + m[12];
+			const float y = m[1]*c.x + m[5]*c.y + m[13];
+
+			screen.x = std::min(screen.x, x);
+			screen.y = std::min(screen.y, y);
+			screen.z = std::max(screen.z, x);
+			screen.w = std::max(screen.w, y);
 		}
 
 		IntRect self;
-		self.setPos(trans.getPositionI() - (trans.getOriginI() + sceneOrig));
-		self.w = bitmap->width();
-		self.h = bitmap->height();
+		self.x = floorf(screen.x);
+		self.y = floorf(screen.y);
+		self.w = (int) ceilf(screen.z) - self.x;
+		self.h = (int) ceilf(screen.w) - self.y;
 
-		isVisible = SDL_HasIntersection(&self, &sceneRect);
+		return SDL_HasIntersection(&self, &sceneRect);
 	}
 
-	void emitWaveChunk(SVertex *&vert, float phase, int width,
-	                   float zoomY, int chunkY, int chunkLength)
+	/* Layout of the 8 pixel chunks the wave is made of. The
+	 * first chunk is shortened so chunks align to the screen.
+	 * Returns the number of chunks */
+	size_t waveChunks(int &firstLength, int &visibleLength)
 	{
-		float wavePos = phase + (chunkY / (float) wave.length) * (float) (M_PI * 2);
-		float chunkX = sin(wavePos) * wave.amp;
+		/* The length of the sprite as it appears on screen */
+		visibleLength = srcRect->height * trans.getScale().y;
+
+		/* First chunk length (aligned to 8 pixel boundary */
+		firstLength = ((int) trans.getPosition().y) % 8;
+
+		/* Amount of full 8 pixel chunks in the middle */
+		int chunks = (visibleLength - firstLength) / 8;
 
-		FloatRect tex(0, chunkY / zoomY, width, chunkLength / zoomY);
-		FloatRect pos = tex;
-		pos.x = chunkX;
+		/* Final chunk length */
+		int lastLength = (visibleLength - firstLength) % 8;
 
-		Quad::setTexPosRect(vert, tex, pos);
-		vert += 4;
+		return std::max(!!firstLength + chunks + !!lastLength, 0);
 	}
 
 	void updateWave()
 	{
+		wave.shaded = false;
+
 		if (nullOrDisposed(bitmap))
 			return;
 
@@ -229,9 +280,17 @@ struct SpritePrivate
 
 		wave.active = true;
 
+		/* Chunk positions and displacement only depend on
+		 * uniforms, so neither phase nor sprite movement
+		 * touch the mesh */
+		if (wave.amp > 0)
+		{
+			wave.shaded = true;
+			return;
+		}
+
 		int width = srcRect->width;
-		int height = srcRect->height;
-		float zoomY = trans.getScale().y;
+		wave.meshChunks = 0;
 
 		if (wave.amp < -(width / 2))
 		{
@@ -242,59 +301,112 @@ struct SpritePrivate
 		}
 
 		/* RMVX does this, and I have no fucking clue why */
-		if (wave.amp < 0)
-		{
-			wave.qArray.resize(1);
+		wave.qArray.resize(1);
 
-			int x = -wave.amp;
-			int w = width - x * 2;
+		int x = -wave.amp;
+		int w = width - x * 2;
 
-			FloatRect tex(x, srcRect->y, w, srcRect->height);
+		FloatRect tex(x, srcRect->y, w, srcRect->height);
 
-			Quad::setTexPosRect(&wave.qArray.vertices[0], tex, tex);
-			wave.qArray.commit();
+		Quad::setTexPosRect(&wave.qArray.vertices[0], tex, tex);
+		wave.qArray.commit();
+	}
 
-			return;
-		}
+	/* Sets up the wave uniforms and makes sure the mesh has
+	 * enough chunks. Returns the number of chunks to draw */
+	size_t prepareWaveShader(WaveSpriteShader &shader)
+	{
+		int firstLength, visibleLength;
+		size_t chunks = waveChunks(firstLength, visibleLength);
 
-		/* The length of the sprite as it appears on screen */
-		int visibleLength = height * zoomY;
+		shader.setWave(wave.amp, wave.length, wave.phase, trans.getScale().y);
+		shader.setChunks(firstLength, visibleLength, srcRect->width);
 
-		/* First chunk length (aligned to 8 pixel boundary */
-		int firstLength = ((int) trans.getPosition().y) % 8;
+		if (chunks <= wave.meshChunks)
+			return chunks;
 
-		/* Amount of full 8 pixel chunks in the middle */
-		int chunks = (visibleLength - firstLength) / 8;
+		/* Each chunk quad only knows its corners and index */
+		wave.qArray.resize(chunks);
 
-		/* Final chunk length */
-		int lastLength = (visibleLength - firstLength) % 8;
+		for (size_t i = 0; i < chunks; ++i)
+			Quad::setTexPosRect(&wave.qArray.vertices[i*4],
+			                    FloatRect(i, 0, 0, 0), FloatRect(0, 0, 1, 1));
 
-		wave.qArray.resize(!!firstLength + chunks + !!lastLength);
-		SVertex *vert = &wave.qArray.vertices[0];
+		wave.qArray.commit();
+		wave.meshChunks = chunks;
 
-		float phase = (wave.phase * (float) M_PI) / 180.0f;
+		return chunks;
+	}
 
-		if (firstLength > 0)
-			emitWaveChunk(vert, phase, width, zoomY, 0, firstLength);
+	/* Mirrors the state read when batching into the
+	 * sprite system; the scene space quad is only
+	 * computed for visible sprites without a wave */
+	void writeRenderState(bool visible)
+	{
+		SpriteSystem &sys = shState->spriteSystem();
+		const size_t s = renderSlot;
 
-		for (int i = 0; i < chunks; ++i)
-			emitWaveChunk(vert, phase, width, zoomY, firstLength + i * 8, 8);
+		sys.flags[s] = visible ? SpriteSystem::Visible : 0;
 
-		if (lastLength > 0)
-			emitWaveChunk(vert, phase, width, zoomY, firstLength + chunks * 8, lastLength);
+		if (!visible)
+			return;
 
-		wave.qArray.commit();
+		sys.tone[s] = tone->norm;
+		sys.opacity[s] = opacity.norm;
+		sys.bushOpacity[s] = bushOpacity.norm;
+
+		/* Past the bottom of any texture, so that
+		 * no bush is applied without a depth */
+		sys.bushDepth[s] = bushDepth != 0 ? efBushDepth : 2.0f;
+		sys.blendType[s] = blendType;
+
+		if (!wave.active)
+			sys.setGeometry(s, trans.getMatrix(), quad.vert);
+	}
+
+	/* The smaller of both zoom factors */
+	float minZoom()
+	{
+		const Vec2 &scale = trans.getScale();
+
+		return std::min(fabs(scale.x), fabs(scale.y));
+	}
+
+	/* Queues the scene space sprite quad into the shared batch */
+	void queueBatched(bool mipmapped)
+	{
+		const SpriteSystem &sys = shState->spriteSystem();
+		Vertex vert[4];
+
+		sys.fillVertices(renderSlot, vert);
+		shState->spriteBatch().add(*bitmap, (BlendType) sys.blendType[renderSlot],
+		                           vert, mipmapped);
+	}
+
+	/* Queues the sprite quad along with its effect
+	 * parameters as one instance of the shared batch */
+	void queueInstance(const Vec4 &blend, bool mipmapped)
+	{
+		const SpriteSystem &sys = shState->spriteSystem();
+		SpriteInstance inst;
+
+		sys.fillInstance(renderSlot, blend, inst);
+		shState->spriteBatch().addInstance(*bitmap, (BlendType) sys.blendType[renderSlot],
+		                                   inst, mipmapped);
 	}
 
 	void prepare()
 	{
+		if (srcRect->changed.consume())
+			onSrcRectChange();
+
 		if (wave.dirty)
 		{
 			updateWave();
 			wave.dirty = false;
 		}
 
-		updateVisibility();
+		writeRenderState(computeVisibility());
 	}
 };
 
@@ -303,6 +415,8 @@ Sprite::Sprite(Viewport *viewport)
 {
 	p = new SpritePrivate;
 	onGeometryChange(scene->getGeometry());
+
+	shState->graphics().addFlashable(this);
 }
 
 Sprite::~Sprite()
@@ -328,11 +442,11 @@ DEF_ATTR_RD_SIMPLE(Sprite, WaveLength, int,     p->wave.length)
 DEF_ATTR_RD_SIMPLE(Sprite, WaveSpeed,  int,     p->wave.speed)
 DEF_ATTR_RD_SIMPLE(Sprite, WavePhase,  float,   p->wave.phase)
 
-DEF_ATTR_SIMPLE(Sprite, BushOpacity, int,     p->bushOpacity)
-DEF_ATTR_SIMPLE(Sprite, Opacity,     int,     p->opacity)
-DEF_ATTR_SIMPLE(Sprite, SrcRect,     Rect&,  *p->srcRect)
-DEF_ATTR_SIMPLE(Sprite, Color,       Color&, *p->color)
-DEF_ATTR_SIMPLE(Sprite, Tone,        Tone&,  *p->tone)
+DEF_ATTR_SCENE(Sprite, BushOpacity, int,     p->bushOpacity)
+DEF_ATTR_SCENE(Sprite, Opacity,     int,     p->opacity)
+DEF_ATTR_SCENE(Sprite, SrcRect,     Rect&,  *p->srcRect)
+DEF_ATTR_SCENE(Sprite, Color,       Color&, *p->color)
+DEF_ATTR_SCENE(Sprite, Tone,        Tone&,  *p->tone)
 
 void Sprite::setBitmap(Bitmap *bitmap)
 {
@@ -342,6 +456,7 @@ void Sprite::setBitmap(Bitmap *bitmap)
 		return;
 
 	p->bitmap = bitmap;
+	markSceneDirty();
 
 	if (nullOrDisposed(bitmap))
 		return;
@@ -363,6 +478,7 @@ void Sprite::setX(int value)
 		return;
 
 	p->trans.setPosition(Vec2(value, getY()));
+	markSceneDirty();
 }
 
 void Sprite::setY(int value)
@@ -379,6 +495,8 @@ void Sprite::setY(int value)
 		p->wave.dirty = true;
 		setSpriteY(value);
 	}
+
+	markSceneDirty();
 }
 
 void Sprite::setOX(int value)
@@ -389,6 +507,7 @@ void Sprite::setOX(int value)
 		return;
 
 	p->trans.setOrigin(Vec2(value, getOY()));
+	markSceneDirty();
 }
 
 void Sprite::setOY(int value)
@@ -399,6 +518,7 @@ void Sprite::setOY(int value)
 		return;
 
 	p->trans.setOrigin(Vec2(getOX(), value));
+	markSceneDirty();
 }
 
 void Sprite::setZoomX(float value)
@@ -409,6 +529,7 @@ void Sprite::setZoomX(float value)
 		return;
 
 	p->trans.setScale(Vec2(value, getZoomY()));
+	markSceneDirty();
 }
 
 void Sprite::setZoomY(float value)
@@ -423,6 +544,8 @@ void Sprite::setZoomY(float value)
 
 	if (rgssVer >= 2)
 		p->wave.dirty = true;
+
+	markSceneDirty();
 }
 
 void Sprite::setAngle(float value)
@@ -433,6 +556,7 @@ void Sprite::setAngle(float value)
 		return;
 
 	p->trans.setRotation(value);
+	markSceneDirty();
 }
 
 void Sprite::setMirror(bool mirrored)
@@ -444,6 +568,7 @@ void Sprite::setMirror(bool mirrored)
 
 	p->mirrored = mirrored;
 	p->onSrcRectChange();
+	markSceneDirty();
 }
 
 void Sprite::setBushDepth(int value)
@@ -455,11 +580,13 @@ void Sprite::setBushDepth(int value)
 
 	p->bushDepth = value;
 	p->recomputeBushDepth();
+	markSceneDirty();
 }
 
 void Sprite::setBlendType(int type)
 {
 	guardDisposed();
+	markSceneDirty();
 
 	switch (type)
 	{
@@ -484,6 +611,7 @@ void Sprite::setBlendType(int type)
 			return; \
 		p->wave.name = value; \
 		p->wave.dirty = true; \
+		markSceneDirty(); \
 	}
 
 DEF_WAVE_SETTER(Amp,    amp,    int)
@@ -498,8 +626,6 @@ void Sprite::initDynAttribs()
 	p->srcRect = new Rect;
 	p->color = new Color;
 	p->tone = new Tone;
-
-	p->updateSrcRectCon();
 }
 
 /* Flashable */
@@ -507,17 +633,55 @@ void Sprite::update()
 {
 	guardDisposed();
 
+	/* Only flashes and waves animate on their own */
+	if (flashing || p->wave.amp)
+		markSceneDirty();
+
 	Flashable::update();
 
+	/* Only a uniform of the wave shader */
 	p->wave.phase += p->wave.speed / 180;
-	p->wave.dirty = true;
+}
+
+/* Shared by the regular and the wave sprite shader */
+template<class ShaderType>
+static void setEffectUniforms(ShaderType &shader, const SpritePrivate &p,
+                              const Vec4 &blend)
+{
+	shader.setTone(p.tone->norm);
+	shader.setOpacity(p.opacity.norm);
+	shader.setBushDepth(p.efBushDepth);
+	shader.setBushOpacity(p.bushOpacity.norm);
+	shader.setColor(blend);
+}
+
+/* The cheapest shader permutation covering the active effects */
+static unsigned spriteFeatures(const SpritePrivate &p, bool flashing)
+{
+	unsigned features = 0;
+
+	if (p.tone->hasEffect())
+		features |= SpriteTone;
+	if (p.color->hasEffect() || flashing)
+		features |= SpriteColor;
+	if (p.opacity != 255)
+		features |= SpriteOpacity;
+	if (p.bushDepth != 0)
+		features |= SpriteBush;
+
+	return features;
 }
 
 /* SceneElement */
 void Sprite::draw()
 {
-	if (!p->isVisible)
+	PROFILE_SCOPE(Sprites);
+
+	if (!shState->spriteSystem().isVisible(p->renderSlot))
+	{
+		++glCallCounts.culled;
 		return;
+	}
 
 	if (emptyFlashFlag)
 		return;
@@ -529,31 +693,60 @@ void Sprite::draw()
 	                    flashing              ||
 	                    p->bushDepth != 0;
 
-	if (renderEffect)
+	/* When both flashing and effective color are set,
+	 * the one with higher alpha will be blended */
+	const Vec4 *blend = (flashing && flashColor.w > p->color->norm.w) ?
+		                 &flashColor : &p->color->norm;
+
+	const bool mipmapped = p->bitmap->useMipmaps(p->minZoom());
+
+	if (!p->wave.active)
 	{
-		SpriteShader &shader = shState->shaders().sprite;
+		if (glState.caps.instancedSprites)
+		{
+			p->queueInstance(*blend, mipmapped);
+			return;
+		}
+
+		if (!renderEffect)
+		{
+			p->queueBatched(mipmapped);
+			return;
+		}
+	}
+
+	shState->spriteBatch().flush();
+
+	size_t waveChunks = 0;
+
+	if (p->wave.shaded)
+	{
+		WaveSpriteShader &shader =
+		        shState->shaders().waveSprite(spriteFeatures(*p, flashing));
 
 		shader.bind();
 		shader.applyViewportProj();
 		shader.setSpriteMat(p->trans.getMatrix());
+		setEffectUniforms(shader, *p, *blend);
 
-		shader.setTone(p->tone->norm);
-		shader.setOpacity(p->opacity.norm);
-		shader.setBushDepth(p->efBushDepth);
-		shader.setBushOpacity(p->bushOpacity.norm);
+		waveChunks = p->prepareWaveShader(shader);
 
-		/* When both flashing and effective color are set,
-		 * the one with higher alpha will be blended */
-		const Vec4 *blend = (flashing && flashColor.w > p->color->norm.w) ?
-			                 &flashColor : &p->color->norm;
+		base = &shader;
+	}
+	else if (renderEffect)
+	{
+		SpriteShader &shader = shState->shaders().sprite(spriteFeatures(*p, flashing));
 
-		shader.setColor(*blend);
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setSpriteMat(p->trans.getMatrix());
+		setEffectUniforms(shader, *p, *blend);
 
 		base = &shader;
 	}
 	else if (p->opacity != 255)
 	{
-		AlphaSpriteShader &shader = shState->shaders().alphaSprite;
+		AlphaSpriteShader &shader = shState->shaders().alphaSprite();
 		shader.bind();
 
 		shader.setSpriteMat(p->trans.getMatrix());
@@ -563,7 +756,7 @@ void Sprite::draw()
 	}
 	else
 	{
-		SimpleSpriteShader &shader = shState->shaders().simpleSprite;
+		SimpleSpriteShader &shader = shState->shaders().simpleSprite();
 		shader.bind();
 
 		shader.setSpriteMat(p->trans.getMatrix());
@@ -573,13 +766,21 @@ void Sprite::draw()
 
 	glState.blendMode.pushSet(p->blendType);
 
-	p->bitmap->bindTex(*base);
+	if (mipmapped)
+		p->bitmap->bindTexMipmapped(*base);
+	else
+		p->bitmap->bindTex(*base);
 
-	if (p->wave.active)
+	if (p->wave.shaded)
+		p->wave.qArray.draw(0, waveChunks);
+	else if (p->wave.active)
 		p->wave.qArray.draw();
 	else
 		p->quad.draw();
 
+	if (mipmapped)
+		TEX::setMipmapped(false);
+
 	glState.blendMode.pop();
 }
 
@@ -589,12 +790,17 @@ void Sprite::onGeometryChange(const Scene::Geometry &geo)
 	 * relative to screen origin */
 	p->trans.setGlobalOffset(geo.offset());
 
-	p->sceneRect.setSize(geo.rect.size());
-	p->sceneOrig = geo.orig;
+	p->sceneRect = geo.rect;
+}
+
+void Sprite::capture(SceneCapture &c)
+{
+	c.sprite(*this);
 }
 
 void Sprite::releaseResources()
 {
+	shState->graphics().remFlashable(this);
 	unlink();
 
 	delete p;
@@ -27,6 +27,7 @@
 #include "disposable.h"
 #include "viewport.h"
 #include "util.h"
+#include "objectpool.h"
 
 class Bitmap;
 struct Color;
@@ -35,7 +36,8 @@ struct Rect;
 
 struct SpritePrivate;
 
-class Sprite : public ViewportElement, public Flashable, public Disposable
+class Sprite : public ViewportElement, public Flashable, public Disposable,
+               public Pooled<Sprite>
 {
 public:
 	Sprite(Viewport *viewport = 0);
@@ -73,7 +75,9 @@ private:
 	SpritePrivate *p;
 
 	void draw();
+	bool usesSpriteBatch() const { return true; }
 	void onGeometryChange(const Scene::Geometry &);
+	void capture(SceneCapture &c);
 
 	void releaseResources();
 	const char *klassName() const { return "sprite"; }
@@ -0,0 +1,240 @@
+/*
+** spriteatlas.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "spriteatlas.h"
+
+#include "bitmap.h"
+#include "sharedstate.h"
+#include "spritebatch.h"
+#include "gl-meta.h"
+#include "gl-util.h"
+#include "glstate.h"
+#include "boost-hash.h"
+
+#include <vector>
+#include <algorithm>
+
+/* Edge length of the pages, if the GL allows */
+#define PAGE_SIZE 2048
+
+/* Larger bitmaps keep being drawn from their own texture */
+#define MAX_BITMAP_SIZE 256
+
+/* Space left between neighboring bitmaps */
+#define CELL_PADDING 1
+
+struct AtlasEntry
+{
+	size_t page;
+	Vec2i offset;
+};
+
+struct AtlasPage
+{
+	TEXFBO tex;
+
+	/* Shelf packing state */
+	int packX, packY, rowH;
+
+	/* Content stamps of the bitmaps placed here */
+	std::vector<unsigned int> stamps;
+};
+
+struct SpriteAtlasPrivate
+{
+	const size_t pageCount;
+	const int pageSize;
+
+	std::vector<AtlasPage> pages;
+
+	/* Page new bitmaps are placed in */
+	size_t current;
+
+	BoostHash<unsigned int, AtlasEntry> entries;
+
+	SpriteAtlasPrivate(int pageCount)
+	    : pageCount(pageCount),
+	      pageSize(std::min<int>(PAGE_SIZE, glState.caps.maxTexSize)),
+	      current(0)
+	{
+		/* Batches hold on to page pointers */
+		pages.reserve(pageCount);
+	}
+
+	~SpriteAtlasPrivate()
+	{
+		releasePages();
+	}
+
+	void releasePages()
+	{
+		for (size_t i = 0; i < pages.size(); ++i)
+			TEXFBO::fini(pages[i].tex);
+
+		pages.clear();
+		entries.clear();
+		current = 0;
+	}
+
+	void resetPage(AtlasPage &page)
+	{
+		for (size_t i = 0; i < page.stamps.size(); ++i)
+			entries.remove(page.stamps[i]);
+
+		page.stamps.clear();
+		page.packX = page.packY = page.rowH = 0;
+	}
+
+	bool allocCell(AtlasPage &page, int w, int h, Vec2i &out)
+	{
+		if (page.packX + w > pageSize)
+		{
+			page.packX = 0;
+			page.packY += page.rowH + CELL_PADDING;
+			page.rowH = 0;
+		}
+
+		if (page.packY + h > pageSize)
+			return false;
+
+		out = Vec2i(page.packX, page.packY);
+
+		page.packX += w + CELL_PADDING;
+		page.rowH = std::max(page.rowH, h);
+
+		return true;
+	}
+
+	/* Finds space in the current page, moving on to a new (or,
+	 * with all of them in use, the next recycled) one if full */
+	AtlasPage &allocate(int w, int h, Vec2i &out)
+	{
+		if (!pages.empty() && allocCell(pages[current], w, h, out))
+			return pages[current];
+
+		if (pages.size() < pageCount)
+		{
+			pages.push_back(AtlasPage());
+			AtlasPage &page = pages.back();
+
+			TEXFBO::init(page.tex);
+			TEXFBO::allocEmpty(page.tex, pageSize, pageSize);
+			TEXFBO::linkFBO(page.tex);
+
+			current = pages.size() - 1;
+		}
+		else
+		{
+			/* Pending sprites might still sample the old contents */
+			shState->spriteBatch().flush();
+
+			current = (current + 1) % pages.size();
+		}
+
+		AtlasPage &page = pages[current];
+		resetPage(page);
+
+		/* Can't fail on an empty page */
+		allocCell(page, w, h, out);
+
+		return page;
+	}
+
+	void place(Bitmap &bitmap, AtlasEntry &entry)
+	{
+		const int w = bitmap.width(), h = bitmap.height();
+		AtlasPage &page = allocate(w, h, entry.offset);
+		entry.page = current;
+
+		/* Called while a scene is composed; the target and
+		 * its clipping have to survive the copy */
+		GLint fbo;
+		gl.GetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+
+		glState.scissorTest.pushSet(false);
+		glState.blend.pushSet(false);
+
+		GLMeta::blitBegin(page.tex);
+		GLMeta::blitSource(bitmap.getGLTypes());
+		GLMeta::blitRectangle(IntRect(0, 0, w, h), entry.offset);
+		GLMeta::blitEnd();
+
+		glState.blend.pop();
+		glState.scissorTest.pop();
+
+		FBO::bind(FBO::ID(fbo));
+
+		page.stamps.push_back(bitmap.contentStamp());
+	}
+};
+
+SpriteAtlas::SpriteAtlas(int pageCount)
+    : pageCount(pageCount),
+      p(0)
+{}
+
+SpriteAtlas::~SpriteAtlas()
+{
+	delete p;
+}
+
+bool SpriteAtlas::enabled() const
+{
+	return pageCount > 0;
+}
+
+TEXFBO *SpriteAtlas::lookup(Bitmap &bitmap, Vec2i &offset)
+{
+	if (!enabled())
+		return 0;
+
+	if (bitmap.width() > MAX_BITMAP_SIZE || bitmap.height() > MAX_BITMAP_SIZE)
+		return 0;
+
+	if (!bitmap.isUnmodifiedFile())
+		return 0;
+
+	/* Created lazily, as the GL caps are only
+	 * known once SharedState is fully constructed */
+	if (!p)
+		p = new SpriteAtlasPrivate(pageCount);
+
+	const unsigned int stamp = bitmap.contentStamp();
+
+	if (!p->entries.contains(stamp))
+	{
+		AtlasEntry entry;
+		p->place(bitmap, entry);
+		p->entries.insert(stamp, entry);
+	}
+
+	const AtlasEntry &entry = p->entries[stamp];
+	offset = entry.offset;
+
+	return &p->pages[entry.page].tex;
+}
+
+void SpriteAtlas::clear()
+{
+	if (p)
+		p->releasePages();
+}
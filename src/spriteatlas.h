@@ -0,0 +1,59 @@
+/*
+** spriteatlas.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPRITEATLAS_H
+#define SPRITEATLAS_H
+
+#include "etc-internal.h"
+
+class Bitmap;
+struct TEXFBO;
+struct SpriteAtlasPrivate;
+
+/* Copies of small bitmaps still holding the image file they
+ * were loaded from, packed into a few shared textures so that
+ * sprites showing different ones can be batched into one draw.
+ * Entries are keyed by the content stamp, so a modified bitmap
+ * simply stops matching its copy. Once all 'pageCount' pages
+ * are full, the one filled longest ago is emptied for reuse */
+class SpriteAtlas
+{
+public:
+	SpriteAtlas(int pageCount);
+	~SpriteAtlas();
+
+	bool enabled() const;
+
+	/* Returns the page holding a copy of 'bitmap' and its
+	 * position in there ('offset'), placing it on first
+	 * use. Null if the bitmap doesn't qualify */
+	TEXFBO *lookup(Bitmap &bitmap, Vec2i &offset);
+
+	/* Empties and frees all pages */
+	void clear();
+
+private:
+	const int pageCount;
+	SpriteAtlasPrivate *p;
+};
+
+#endif // SPRITEATLAS_H
@@ -0,0 +1,389 @@
+/*
+** spritebatch.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "spritebatch.h"
+
+#include "bitmap.h"
+#include "gl-util.h"
+#include "glstate.h"
+#include "global-ibo.h"
+#include "quadarray.h"
+#include "shader.h"
+#include "sharedstate.h"
+#include "spriteatlas.h"
+#include "profiler.h"
+#include "util.h"
+
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+
+struct InstanceAttribute
+{
+	Shader::Attribute index;
+	GLint size;
+	size_t offset;
+};
+
+static const InstanceAttribute instanceAttr[] =
+{
+	{ Shader::TexCoord,      4, offsetof(SpriteInstance, texRect)   },
+	{ Shader::Color,         4, offsetof(SpriteInstance, color)     },
+	{ Shader::InstAxes,      4, offsetof(SpriteInstance, axes)      },
+	{ Shader::InstOrigin,    4, offsetof(SpriteInstance, origin)    },
+	{ Shader::InstTone,      4, offsetof(SpriteInstance, tone)      },
+	{ Shader::InstBushDepth, 1, offsetof(SpriteInstance, bushDepth) }
+};
+
+static const size_t instanceAttrCount = ARRAY_SIZE(instanceAttr);
+
+/* The SpriteAtlas page to draw 'bitmap' from, if there's a copy
+ * of it there and the sampled area ('x1', 'y1', 'x2', 'y2') stays
+ * inside its bounds (past them lie other bitmaps) */
+static TEXFBO *atlasPage(Bitmap &bitmap, float x1, float y1, float x2, float y2,
+                         Vec2i &offset)
+{
+	SpriteAtlas &atlas = shState->spriteAtlas();
+
+	if (!atlas.enabled())
+		return 0;
+
+	if (std::min(x1, x2) < 0 || std::min(y1, y2) < 0 ||
+	    std::max(x1, x2) > bitmap.width() || std::max(y1, y2) > bitmap.height())
+		return 0;
+
+	return atlas.lookup(bitmap, offset);
+}
+
+struct SpriteBatchPrivate
+{
+	ColorQuadArray quads;
+
+	std::vector<SpriteInstance> instances;
+
+	/* Corners of the quad every instance is drawn from */
+	VBO::ID cornerVBO;
+	/* Streamed anew for every instanced draw */
+	VBO::ID instanceVBO;
+	GLsizeiptr instanceVBOSize;
+	GLuint nativeVAO;
+
+	/* State shared by all pending quads. With 'page' set,
+	 * they're drawn from that SpriteAtlas page instead of
+	 * their bitmaps, which may then differ. Mipmapped
+	 * bitmaps are never drawn from a page */
+	Bitmap *bitmap;
+	TEXFBO *page;
+	BlendType blendType;
+	bool mipmapped;
+
+	SpriteBatchPrivate()
+	    : instanceVBOSize(0),
+	      nativeVAO(0),
+	      bitmap(0),
+	      page(0),
+	      blendType(BlendNormal),
+	      mipmapped(false)
+	{
+		if (!glState.caps.instancedSprites)
+			return;
+
+		static const Vec2 corners[] =
+		{
+			Vec2(0, 0), Vec2(1, 0), Vec2(1, 1), Vec2(0, 1)
+		};
+
+		cornerVBO = VBO::gen();
+		VBO::bind(cornerVBO);
+		VBO::uploadData(sizeof(corners), corners);
+		VBO::unbind();
+
+		instanceVBO = VBO::gen();
+
+		/* Divisors are part of the VAO state, so with native
+		 * VAOs the whole setup only has to happen once */
+		if (gl.GenVertexArrays)
+		{
+			gl.GenVertexArrays(1, &nativeVAO);
+			gl.BindVertexArray(nativeVAO);
+			bindInstanceRes();
+			gl.BindVertexArray(0);
+		}
+	}
+
+	~SpriteBatchPrivate()
+	{
+		if (!glState.caps.instancedSprites)
+			return;
+
+		if (nativeVAO)
+			gl.DeleteVertexArrays(1, &nativeVAO);
+
+		VBO::del(cornerVBO);
+		VBO::del(instanceVBO);
+	}
+
+	void bindInstanceRes()
+	{
+		VBO::bind(cornerVBO);
+
+		gl.EnableVertexAttribArray(Shader::Position);
+		gl.VertexAttribPointer(Shader::Position, 2, GL_FLOAT, GL_FALSE, sizeof(Vec2), 0);
+
+		VBO::bind(instanceVBO);
+
+		for (size_t i = 0; i < instanceAttrCount; ++i)
+		{
+			const InstanceAttribute &ia = instanceAttr[i];
+
+			gl.EnableVertexAttribArray(ia.index);
+			gl.VertexAttribPointer(ia.index, ia.size, GL_FLOAT, GL_FALSE,
+			                       sizeof(SpriteInstance), (const GLvoid*) ia.offset);
+			gl.VertexAttribDivisor(ia.index, 1);
+		}
+
+		IBO::bind(shState->globalIBO().ibo);
+	}
+
+	void bindInstanced()
+	{
+		if (nativeVAO)
+		{
+			gl.BindVertexArray(nativeVAO);
+		}
+		else
+		{
+			GLMeta::vaoInvalidate();
+			bindInstanceRes();
+		}
+	}
+
+	void unbindInstanced()
+	{
+		if (nativeVAO)
+		{
+			gl.BindVertexArray(0);
+			return;
+		}
+
+		/* Without a VAO the divisors are global state
+		 * which the regular draw paths don't expect */
+		for (size_t i = 0; i < instanceAttrCount; ++i)
+		{
+			gl.VertexAttribDivisor(instanceAttr[i].index, 0);
+			gl.DisableVertexAttribArray(instanceAttr[i].index);
+		}
+
+		gl.DisableVertexAttribArray(Shader::Position);
+
+		VBO::unbind();
+		IBO::unbind();
+	}
+
+	void uploadInstances()
+	{
+		GLsizeiptr size = instances.size() * sizeof(SpriteInstance);
+
+		VBO::bind(instanceVBO);
+
+		/* Orphan the previous storage so the upload doesn't
+		 * have to wait for draws still reading from it */
+		if (size > instanceVBOSize)
+			instanceVBOSize = findNextPow2(size);
+
+		VBO::uploadData(instanceVBOSize, 0, GL_STREAM_DRAW);
+		VBO::uploadSubData(0, size, dataPtr(instances));
+
+		VBO::unbind();
+	}
+
+	bool pending() const
+	{
+		return quads.count() > 0 || !instances.empty();
+	}
+
+	bool sameSource(const Bitmap &bitmap, const TEXFBO *page, bool mipmapped) const
+	{
+		if (page)
+			return this->page == page;
+
+		return !this->page && this->bitmap == &bitmap &&
+		       this->mipmapped == mipmapped;
+	}
+
+	void bindSource(ShaderBase &shader)
+	{
+		if (page)
+		{
+			TEX::bind(page->tex);
+			shader.setTexSize(Vec2i(page->texW, page->texH));
+		}
+		else if (mipmapped)
+		{
+			bitmap->bindTexMipmapped(shader);
+		}
+		else
+		{
+			bitmap->bindTex(shader);
+		}
+	}
+
+	void unbindSource()
+	{
+		if (mipmapped)
+			TEX::setMipmapped(false);
+	}
+
+	void flushQuads()
+	{
+		/* Opacity is carried by the vertex colors */
+		SimpleAlphaShader &shader = shState->shaders().simpleAlpha();
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setTranslation(Vec2i());
+
+		bindSource(shader);
+
+		glState.blendMode.pushSet(blendType);
+
+		quads.commit();
+		quads.draw();
+
+		unbindSource();
+
+		glState.blendMode.pop();
+
+		quads.clear();
+	}
+
+	void flushInstances()
+	{
+		InstancedSpriteShader &shader = shState->shaders().instancedSprite();
+		shader.bind();
+		shader.applyViewportProj();
+
+		bindSource(shader);
+
+		glState.blendMode.pushSet(blendType);
+
+		uploadInstances();
+
+		bindInstanced();
+		gl.DrawElementsInstanced(GL_TRIANGLES, 6, _GL_INDEX_TYPE, 0, instances.size());
+		++glCallCounts.draws;
+		glCallCounts.quads += instances.size();
+		unbindInstanced();
+
+		unbindSource();
+
+		glState.blendMode.pop();
+
+		instances.clear();
+	}
+};
+
+SpriteBatch::SpriteBatch()
+    : p(0)
+{}
+
+SpriteBatch::~SpriteBatch()
+{
+	delete p;
+}
+
+void SpriteBatch::add(Bitmap &bitmap, BlendType blendType, const Vertex vert[4],
+                      bool mipmapped)
+{
+	/* Created lazily, as QuadArray requires a fully
+	 * constructed SharedState */
+	if (!p)
+		p = new SpriteBatchPrivate;
+
+	/* Corners 0 and 2 span the sampled rectangle */
+	Vec2i offset;
+	TEXFBO *page = mipmapped ? 0 :
+	        atlasPage(bitmap, vert[0].texPos.x, vert[0].texPos.y,
+	                  vert[2].texPos.x, vert[2].texPos.y, offset);
+
+	if (!p->instances.empty() ||
+	    (p->quads.count() > 0 &&
+	     (!p->sameSource(bitmap, page, mipmapped) || p->blendType != blendType)))
+		flush();
+
+	p->bitmap = &bitmap;
+	p->page = page;
+	p->blendType = blendType;
+	p->mipmapped = mipmapped;
+
+	size_t i = p->quads.count();
+	p->quads.resize(i + 1);
+
+	for (int j = 0; j < 4; ++j)
+	{
+		Vertex &v = p->quads.vertices[i*4+j];
+		v = vert[j];
+		v.texPos.x += offset.x;
+		v.texPos.y += offset.y;
+	}
+}
+
+void SpriteBatch::addInstance(Bitmap &bitmap, BlendType blendType,
+                              const SpriteInstance &inst, bool mipmapped)
+{
+	if (!p)
+		p = new SpriteBatchPrivate;
+
+	const Vec4 &t = inst.texRect;
+	Vec2i offset;
+	TEXFBO *page = mipmapped ? 0 :
+	        atlasPage(bitmap, t.x, t.y, t.x + t.z, t.y + t.w, offset);
+
+	if (p->quads.count() > 0 ||
+	    (!p->instances.empty() &&
+	     (!p->sameSource(bitmap, page, mipmapped) || p->blendType != blendType)))
+		flush();
+
+	p->bitmap = &bitmap;
+	p->page = page;
+	p->blendType = blendType;
+	p->mipmapped = mipmapped;
+
+	p->instances.push_back(inst);
+	p->instances.back().texRect.x += offset.x;
+	p->instances.back().texRect.y += offset.y;
+}
+
+void SpriteBatch::flush()
+{
+	PROFILE_SCOPE(Sprites);
+
+	if (!p || !p->pending())
+		return;
+
+	if (!p->instances.empty())
+		p->flushInstances();
+	else
+		p->flushQuads();
+
+	p->bitmap = 0;
+	p->page = 0;
+}
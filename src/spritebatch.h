@@ -0,0 +1,86 @@
+/*
+** spritebatch.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include "etc.h"
+
+class Bitmap;
+struct Vertex;
+struct SpriteBatchPrivate;
+
+/* One sprite of an instanced batch. The layout
+ * matches the per instance shader attributes */
+struct SpriteInstance
+{
+	/* Source rectangle (x, y, w, h) in pixels;
+	 * a negative width mirrors the sprite */
+	Vec4 texRect;
+	Vec4 color;
+	/* Scene space extent of the quad along the
+	 * sprite's x (xy) and y (zw) axis */
+	Vec4 axes;
+	/* Scene space position of the top left corner */
+	Vec2 origin;
+	float opacity;
+	float bushOpacity;
+	Vec4 tone;
+	/* Normalized, as in the sprite shader */
+	float bushDepth;
+};
+
+/* Collects sprites which are drawn consecutively with the
+ * same bitmap and blend type, so they can be submitted
+ * with one upload and a single draw call.
+ * Without instancing support only plain sprites (no color,
+ * tone, flash, bush or wave effect) can be batched, with
+ * positions expected in scene space already, ie. with the
+ * sprite transformation applied on the CPU. With it, any
+ * sprite without a wave effect is queued as an instance */
+class SpriteBatch
+{
+public:
+	SpriteBatch();
+	~SpriteBatch();
+
+	/* Queues one quad; any pending quads of a different
+	 * bitmap or blend type are flushed first. With 'mipmapped'
+	 * (see Bitmap::useMipmaps()), the bitmap is sampled from
+	 * its mipmaps, which also keeps it out of the sprite atlas */
+	void add(Bitmap &bitmap, BlendType blendType, const Vertex vert[4],
+	         bool mipmapped = false);
+
+	/* Same as 'add()' for instanced batches. Requires
+	 * 'glState.caps.instancedSprites' */
+	void addInstance(Bitmap &bitmap, BlendType blendType,
+	                 const SpriteInstance &inst, bool mipmapped = false);
+
+	/* Draws all pending quads. Must be called before
+	 * anything else is rendered into the current target */
+	void flush();
+
+private:
+	SpriteBatchPrivate *p;
+};
+
+#endif // SPRITEBATCH_H
@@ -0,0 +1,125 @@
+/*
+** spritesystem.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "spritesystem.h"
+
+#include "spritebatch.h"
+#include "vertex.h"
+
+template<typename T>
+static void moveLast(std::vector<T> &vec, size_t to)
+{
+	vec[to] = vec.back();
+	vec.pop_back();
+}
+
+void SpriteSystem::add(size_t *slot)
+{
+	*slot = slotRefs.size();
+	slotRefs.push_back(slot);
+
+	origin.push_back(Vec2());
+	axes.push_back(Vec4());
+	texRect.push_back(Vec4());
+	tone.push_back(Vec4());
+	opacity.push_back(0);
+	bushOpacity.push_back(0);
+	bushDepth.push_back(0);
+	blendType.push_back(0);
+	flags.push_back(0);
+}
+
+void SpriteSystem::remove(size_t slot)
+{
+	/* Fill the hole with the last slot */
+	moveLast(slotRefs, slot);
+	moveLast(origin, slot);
+	moveLast(axes, slot);
+	moveLast(texRect, slot);
+	moveLast(tone, slot);
+	moveLast(opacity, slot);
+	moveLast(bushOpacity, slot);
+	moveLast(bushDepth, slot);
+	moveLast(blendType, slot);
+	moveLast(flags, slot);
+
+	if (slot < slotRefs.size())
+		*slotRefs[slot] = slot;
+}
+
+static Vec2 transformed(const float *m, const Vec2 &pos)
+{
+	return Vec2(m[0]*pos.x + m[4]*pos.y + m[12],
+	            m[1]*pos.x + m[5]*pos.y + m[13]);
+}
+
+void SpriteSystem::setGeometry(size_t slot, const float *matrix,
+                               const Vertex vert[4])
+{
+	/* Corners are top left, top right,
+	 * bottom right, bottom left */
+	const Vec2 o = transformed(matrix, vert[0].pos);
+	const Vec2 right = transformed(matrix, vert[1].pos);
+	const Vec2 down = transformed(matrix, vert[3].pos);
+
+	origin[slot] = o;
+	axes[slot] = Vec4(right.x - o.x, right.y - o.y, down.x - o.x, down.y - o.y);
+
+	const Vec2 &t1 = vert[0].texPos;
+	const Vec2 &t2 = vert[2].texPos;
+	texRect[slot] = Vec4(t1.x, t1.y, t2.x - t1.x, t2.y - t1.y);
+}
+
+void SpriteSystem::fillInstance(size_t slot, const Vec4 &color,
+                                SpriteInstance &inst) const
+{
+	inst.texRect = texRect[slot];
+	inst.color = color;
+	inst.axes = axes[slot];
+	inst.origin = origin[slot];
+	inst.opacity = opacity[slot];
+	inst.bushOpacity = bushOpacity[slot];
+	inst.tone = tone[slot];
+	inst.bushDepth = bushDepth[slot];
+}
+
+void SpriteSystem::fillVertices(size_t slot, Vertex vert[4]) const
+{
+	const Vec2 &o = origin[slot];
+	const Vec4 &a = axes[slot];
+	const Vec4 &t = texRect[slot];
+
+	vert[0].pos = o;
+	vert[1].pos = Vec2(o.x + a.x, o.y + a.y);
+	vert[2].pos = Vec2(o.x + a.x + a.z, o.y + a.y + a.w);
+	vert[3].pos = Vec2(o.x + a.z, o.y + a.w);
+
+	vert[0].texPos = Vec2(t.x, t.y);
+	vert[1].texPos = Vec2(t.x + t.z, t.y);
+	vert[2].texPos = Vec2(t.x + t.z, t.y + t.w);
+	vert[3].texPos = Vec2(t.x, t.y + t.w);
+
+	const Vec4 color(1, 1, 1, opacity[slot]);
+
+	for (int i = 0; i < 4; ++i)
+		vert[i].color = color;
+}
@@ -0,0 +1,97 @@
+/*
+** spritesystem.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPRITESYSTEM_H
+#define SPRITESYSTEM_H
+
+#include "etc-internal.h"
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+struct Vertex;
+struct SpriteInstance;
+
+/* Mirrors the renderable state of all live sprites into
+ * contiguous per attribute arrays, so that queueing them
+ * into the sprite batch reads tightly packed data instead
+ * of chasing each sprite's members across the heap.
+ * Sprites write their state through during the prepare
+ * pass; slots are indexed densely and move when other
+ * sprites are removed (the owner's slot index is updated
+ * through the pointer it registered with) */
+class SpriteSystem
+{
+public:
+	enum Flag
+	{
+		/* Passed culling in the last prepare pass */
+		Visible = 1 << 0
+	};
+
+	/* Allocates a slot and stores its index in '*slot'.
+	 * The pointer must stay valid until 'remove()' */
+	void add(size_t *slot);
+	void remove(size_t slot);
+
+	size_t count() const
+	{
+		return slotRefs.size();
+	}
+
+	bool isVisible(size_t slot) const
+	{
+		return flags[slot] & Visible;
+	}
+
+	/* Transforms the sprite quad 'vert' by 'matrix' into
+	 * scene space and stores the result in 'slot' */
+	void setGeometry(size_t slot, const float *matrix,
+	                 const Vertex vert[4]);
+
+	/* Assemble the batch inputs from the stored state */
+	void fillInstance(size_t slot, const Vec4 &color,
+	                  SpriteInstance &inst) const;
+	void fillVertices(size_t slot, Vertex vert[4]) const;
+
+	/* Scene space position of the top left corner */
+	std::vector<Vec2> origin;
+	/* Scene space extent along the sprite's x (xy) and y (zw) axis */
+	std::vector<Vec4> axes;
+	/* Source rectangle; a negative width mirrors the sprite */
+	std::vector<Vec4> texRect;
+	std::vector<Vec4> tone;
+
+	std::vector<float> opacity;
+	std::vector<float> bushOpacity;
+	/* Normalized, or past the texture bottom without a bush */
+	std::vector<float> bushDepth;
+
+	std::vector<int8_t> blendType;
+	std::vector<uint8_t> flags;
+
+private:
+	std::vector<size_t*> slotRefs;
+};
+
+#endif // SPRITESYSTEM_H
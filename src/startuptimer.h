@@ -0,0 +1,77 @@
+/*
+** startuptimer.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STARTUPTIMER_H
+#define STARTUPTIMER_H
+
+#include "debugwriter.h"
+
+#include <SDL_timer.h>
+
+#include <string>
+
+/* Measures the wall time of one initialization phase, from
+ * construction until destruction, and logs it in debug mode.
+ * Phases may nest; inner ones are indented accordingly */
+class StartupPhase
+{
+public:
+	StartupPhase(const char *name)
+	    : name(name),
+	      start(SDL_GetPerformanceCounter())
+	{
+		++depth();
+	}
+
+	~StartupPhase()
+	{
+		--depth();
+
+		if (!enabled())
+			return;
+
+		double ms = (SDL_GetPerformanceCounter() - start) * 1000.0
+		          / SDL_GetPerformanceFrequency();
+
+		Debug() << std::string(depth()*2, ' ') + "[startup]"
+		        << name << ms << "ms";
+	}
+
+	/* Enabled once the configuration was read */
+	static bool &enabled()
+	{
+		static bool value = false;
+		return value;
+	}
+
+private:
+	static int &depth()
+	{
+		static int value = 0;
+		return value;
+	}
+
+	const char *name;
+	Uint64 start;
+};
+
+#endif // STARTUPTIMER_H
@@ -39,6 +39,11 @@ Table::Table(const Table &other)
       data(other.data)
 {}
 
+Table::Table(int x, int y, int z, const int16_t *values)
+    : xs(x), ys(y), zs(z),
+      data(values, values + x*y*z)
+{}
+
 int16_t Table::get(int x, int y, int z) const
 {
 	return data[xs*ys*z + xs*y + x];
@@ -55,7 +60,7 @@ void Table::set(int16_t value, int x, int y, int z)
 
 	data[xs*ys*z + xs*y + x] = value;
 
-	modified();
+	cellModified(x, y, z);
 }
 
 void Table::resize(int x, int y, int z)
@@ -76,7 +81,7 @@ void Table::resize(int x, int y, int z)
 	ys = y;
 	zs = z;
 
-	return;
+	modified();
 }
 
 void Table::resize(int x, int y)
@@ -89,6 +94,108 @@ void Table::resize(int x)
 	resize(x, ys, zs);
 }
 
+void Table::fill(int16_t value)
+{
+	if (data.empty())
+		return;
+
+	std::fill(data.begin(), data.end(), value);
+
+	modified();
+}
+
+/* Clips the span [pos, pos+len) to [0, size) */
+static bool clipSpan(int &pos, int &len, int size)
+{
+	if (pos < 0)
+	{
+		len += pos;
+		pos = 0;
+	}
+
+	len = std::min(len, size - pos);
+
+	return len > 0;
+}
+
+void Table::fill(int16_t value, int x, int y, int width, int height,
+                 int z, int depth)
+{
+	if (!clipSpan(x, width, xs) || !clipSpan(y, height, ys)
+	||  !clipSpan(z, depth, zs))
+		return;
+
+	for (int k = z; k < z+depth; ++k)
+		for (int j = y; j < y+height; ++j)
+		{
+			int16_t *row = &at(x, j, k);
+			std::fill(row, row + width, value);
+		}
+
+	modified();
+}
+
+void Table::copyRect(const Table &src, int srcX, int srcY,
+                     int width, int height, int dstX, int dstY)
+{
+	/* Clip against the source, then the destination,
+	 * moving the opposite origin along */
+	int x = srcX, y = srcY;
+
+	if (!clipSpan(x, width, src.xs) || !clipSpan(y, height, src.ys))
+		return;
+
+	dstX += x - srcX;
+	dstY += y - srcY;
+	srcX = x;
+	srcY = y;
+
+	x = dstX, y = dstY;
+
+	if (!clipSpan(x, width, xs) || !clipSpan(y, height, ys))
+		return;
+
+	srcX += x - dstX;
+	srcY += y - dstY;
+	dstX = x;
+	dstY = y;
+
+	const int depth = std::min(zs, src.zs);
+
+	if (depth == 0)
+		return;
+
+	/* Walk rows backwards where the regions could
+	 * overlap, and copy each with memmove */
+	const bool reverse = (&src == this && dstY > srcY);
+
+	for (int k = 0; k < depth; ++k)
+		for (int j = 0; j < height; ++j)
+		{
+			const int row = reverse ? height-1 - j : j;
+
+			memmove(&at(dstX, dstY+row, k), &src.at(srcX, srcY+row, k),
+			        sizeof(int16_t)*width);
+		}
+
+	modified();
+}
+
+void Table::replaceData(const int16_t *values)
+{
+	if (data.empty())
+		return;
+
+	memcpy(dataPtr(data), values, sizeof(int16_t)*data.size());
+
+	modified();
+}
+
+const int16_t *Table::rawData() const
+{
+	return dataPtr(data);
+}
+
 /* Serializable */
 int Table::serialSize() const
 {
@@ -136,6 +243,11 @@ Table *Table::deserialize(const char *data, int len)
 	if (len != 20 + x*y*z*2)
 		throw Exception(Exception::RGSSError, "Marshal: Table: bad file format");
 
+	/* Marshal strings are allocated (and the payload follows the
+	 * header) suitably aligned to be read as values in place */
+	if (reinterpret_cast<uintptr_t>(data) % sizeof(int16_t) == 0)
+		return new Table(x, y, z, reinterpret_cast<const int16_t*>(data));
+
 	Table *t = new Table(x, y, z);
 	memcpy(dataPtr(t->data), data, sizeof(int16_t)*size);
 
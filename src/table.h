@@ -47,6 +47,24 @@ public:
 	void resize(int x, int y);
 	void resize(int x);
 
+	/* Bulk operations, clipped to the table bounds.
+	 * Each emits 'modified' once instead of a
+	 * 'cellModified' for every touched value */
+	void fill(int16_t value);
+	void fill(int16_t value, int x, int y, int width, int height,
+	          int z, int depth);
+
+	/* Copies a rectangle of 'src' (which may be this table)
+	 * to ('dstX', 'dstY'), over all layers both have */
+	void copyRect(const Table &src, int srcX, int srcY,
+	              int width, int height, int dstX, int dstY);
+
+	/* Overwrites all values from 'values', which has to hold
+	 * xSize*ySize*zSize of them in the order of 'at()' */
+	void replaceData(const int16_t *values);
+
+	const int16_t *rawData() const;
+
 	int serialSize() const;
 	void serialize(char *buffer) const;
 	static Table *deserialize(const char *data, int len);
@@ -62,9 +80,20 @@ public:
 		return data[xs*ys*z + xs*y + x];
 	}
 
+	/* Emitted when the table changes as a whole
+	 * (resize, bulk operations) */
 	sigc::signal<void> modified;
 
+	/* Emitted when a single value is changed via 'set()',
+	 * with its coordinates, so that observers can update
+	 * just the parts depending on it */
+	sigc::signal<void, int, int, int> cellModified;
+
 private:
+	/* Takes its values from 'values' right away, without
+	 * zero initializing the storage first */
+	Table(int x, int y, int z, const int16_t *values);
+
 	int xs, ys, zs;
 	std::vector<int16_t> data;
 };
@@ -25,19 +25,31 @@
 #include "glstate.h"
 #include "boost-hash.h"
 #include "debugwriter.h"
+#include "memstats.h"
+#include "gldeletequeue.h"
 
 #include <list>
 #include <utility>
+#include <algorithm>
 #include <assert.h>
 #include <string.h>
 
 typedef std::pair<uint16_t, uint16_t> Size;
 
+static const int sizeClassStep = 32;
+
 static uint32_t byteCount(Size &s)
 {
 	return s.first * s.second * 4;
 }
 
+static int sizeClass(int dim)
+{
+	int rounded = (dim + sizeClassStep - 1) & ~(sizeClassStep - 1);
+
+	return std::min(rounded, glState.caps.maxTexSize);
+}
+
 struct CacheNode
 {
 	TEXFBO obj;
@@ -60,7 +72,7 @@ struct TexPoolPrivate
 	std::list<TEXFBO> priorityQueue;
 
 	/* Maximal allowed cache memory */
-	const uint32_t maxMemSize;
+	uint32_t maxMemSize;
 
 	/* Current amound of memory consumed by the cache */
 	uint32_t memSize;
@@ -68,15 +80,55 @@ struct TexPoolPrivate
 	/* Current amount of TexFBOs cached */
 	uint16_t objCount;
 
+	/* Memory of the TexFBOs handed out and not yet released */
+	uint32_t liveSize;
+
 	/* Has this pool been disabled? */
 	bool disabled;
 
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+
 	TexPoolPrivate(uint32_t maxMemSize)
 	    : maxMemSize(maxMemSize),
 	      memSize(0),
 	      objCount(0),
-	      disabled(false)
+	      liveSize(0),
+	      disabled(false),
+	      hits(0),
+	      misses(0),
+	      evictions(0)
 	{}
+
+	void updateStats()
+	{
+		MemStats::set(MemStats::Textures, memSize + liveSize);
+	}
+
+	/* Deletes the least recently released object */
+	void evictLast()
+	{
+		CacheNode last;
+		last.obj = priorityQueue.back();
+		Size removedSize(last.obj.texW, last.obj.texH);
+
+		CNodeList &bucket = poolHash[removedSize];
+
+		std::list<CacheNode>::iterator toRemove =
+		        std::find(bucket.begin(), bucket.end(), last);
+		assert(toRemove != bucket.end());
+		bucket.erase(toRemove);
+
+		priorityQueue.pop_back();
+
+		GLDeleteQueue::texFBO(last.obj);
+
+		memSize -= byteCount(removedSize);
+		--objCount;
+		++evictions;
+		++glCallCounts.poolEvictions;
+	}
 };
 
 TexPool::TexPool(uint32_t maxMemSize)
@@ -86,26 +138,42 @@ TexPool::TexPool(uint32_t maxMemSize)
 
 TexPool::~TexPool()
 {
-	std::list<TEXFBO>::iterator iter;
+	clear();
 
-	for (iter = p->priorityQueue.begin();
-	     iter != p->priorityQueue.end();
-	     ++iter)
-	{
-		TEXFBO obj = *iter;
-		TEXFBO::fini(obj);
-		--p->objCount;
-	}
+	delete p;
+}
 
-	assert(p->objCount == 0);
+/* Sets the logical size of 'obj' and clears it if
+ * that leaves part of the storage unused, so that old
+ * contents can't bleed in at the edges when sampled */
+static void fitLogicalSize(TEXFBO &obj, int width, int height)
+{
+	obj.width = width;
+	obj.height = height;
 
-	delete p;
+	if (width == obj.texW && height == obj.texH)
+		return;
+
+	FBO::bind(obj.fbo);
+	glState.clearColor.pushSet(Vec4());
+	glState.scissorTest.pushSet(false);
+
+	FBO::clear();
+
+	glState.scissorTest.pop();
+	glState.clearColor.pop();
 }
 
 TEXFBO TexPool::request(int width, int height)
 {
+	int maxSize = glState.caps.maxTexSize;
+	if (width > maxSize || height > maxSize)
+		throw Exception(Exception::MKXPError,
+		                "Texture dimensions [%d, %d] exceed hardware capabilities",
+		                width, height);
+
 	CacheNode cnode;
-	Size size(width, height);
+	Size size(sizeClass(width), sizeClass(height));
 
 	/* See if we can statisfy request from cache */
 	CNodeList &bucket = p->poolHash[size];
@@ -120,23 +188,30 @@ TEXFBO TexPool::request(int width, int height)
 
 		p->memSize -= byteCount(size);
 		--p->objCount;
+		++p->hits;
+		++glCallCounts.poolHits;
+		p->liveSize += byteCount(size);
+		p->updateStats();
+
+		fitLogicalSize(cnode.obj, width, height);
 
 //		Debug() << "TexPool: <?+> (" << width << height << ")";
 
 		return cnode.obj;
 	}
 
-	int maxSize = glState.caps.maxTexSize;
-	if (width > maxSize || height > maxSize)
-		throw Exception(Exception::MKXPError,
-		                "Texture dimensions [%d, %d] exceed hardware capabilities",
-		                width, height);
+	++p->misses;
+	++glCallCounts.poolMisses;
+	p->liveSize += byteCount(size);
+	p->updateStats();
 
 	/* Nope, create it instead */
 	TEXFBO::init(cnode.obj);
-	TEXFBO::allocEmpty(cnode.obj, width, height);
+	TEXFBO::allocEmpty(cnode.obj, size.first, size.second);
 	TEXFBO::linkFBO(cnode.obj);
 
+	fitLogicalSize(cnode.obj, width, height);
+
 //	Debug() << "TexPool: <?-> (" << width << height << ")";
 
 	return cnode.obj;
@@ -150,50 +225,28 @@ void TexPool::release(TEXFBO &obj)
 		return;
 	}
 
+	Size size(obj.texW, obj.texH);
+	p->liveSize -= byteCount(size);
+
 	if (p->disabled)
 	{
+		p->updateStats();
+
 		/* If we're disabled, delete without caching */
 //		Debug() << "TexPool: <!#> (" << obj.width << obj.height << ")";
 		TEXFBO::fini(obj);
 		return;
 	}
 
-	Size size(obj.width, obj.height);
-
-	uint32_t newMemSize = p->memSize + byteCount(size);
+	const uint32_t bytes = byteCount(size);
 
 	/* If caching this object would spill over the allowed memory budget,
 	 * delete least used objects until we're good again */
-	while (newMemSize > p->maxMemSize)
-	{
-		if (p->objCount == 0)
-			break;
-
-//		Debug() << "TexPool: <!~> Size:" << p->memSize;
-
-		/* Retrieve object with lowest priority for deletion */
-		CacheNode last;
-		last.obj = p->priorityQueue.back();
-		Size removedSize(last.obj.width, last.obj.height);
-
-		CNodeList &bucket = p->poolHash[removedSize];
-
-		std::list<CacheNode>::iterator toRemove =
-		        std::find(bucket.begin(), bucket.end(), last);
-		assert(toRemove != bucket.end());
-		bucket.erase(toRemove);
-
-		p->priorityQueue.pop_back();
-
-		TEXFBO::fini(last.obj);
+	while (p->objCount > 0 && p->memSize + bytes > p->maxMemSize)
+		p->evictLast();
 
-		newMemSize -= byteCount(removedSize);
-		--p->objCount;
-
-//		Debug() << "TexPool: <!-> (" << last.obj.width << last.obj.height << ")";
-	}
-
-	p->memSize = newMemSize;
+	p->memSize += bytes;
+	p->updateStats();
 
 	/* Retain object */
 	p->priorityQueue.push_front(obj);
@@ -208,9 +261,68 @@ void TexPool::release(TEXFBO &obj)
 //	Debug() << "TexPool: <!+> (" << obj.width << obj.height << ") Current size:" << p->memSize;
 }
 
+uint32_t TexPool::maxMemSize() const
+{
+	return p->maxMemSize;
+}
+
+void TexPool::setMaxMemSize(uint32_t value)
+{
+	p->maxMemSize = value;
+
+	while (p->objCount > 0 && p->memSize > p->maxMemSize)
+		p->evictLast();
+
+	p->updateStats();
+}
+
 void TexPool::disable()
 {
 	p->disabled = true;
 }
 
+void TexPool::clear()
+{
+	std::list<TEXFBO>::iterator iter;
 
+	for (iter = p->priorityQueue.begin();
+	     iter != p->priorityQueue.end();
+	     ++iter)
+	{
+		TEXFBO obj = *iter;
+		TEXFBO::fini(obj);
+		--p->objCount;
+	}
+
+	assert(p->objCount == 0);
+
+	p->priorityQueue.clear();
+	p->poolHash.clear();
+	p->memSize = 0;
+	p->updateStats();
+}
+
+unsigned int TexPool::hits() const
+{
+	return p->hits;
+}
+
+unsigned int TexPool::misses() const
+{
+	return p->misses;
+}
+
+unsigned int TexPool::evictions() const
+{
+	return p->evictions;
+}
+
+uint32_t TexPool::memSize() const
+{
+	return p->memSize;
+}
+
+uint32_t TexPool::liveMemSize() const
+{
+	return p->liveSize;
+}
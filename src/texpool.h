@@ -26,6 +26,15 @@
 
 struct TexPoolPrivate;
 
+/* Textures are allocated in size classes (multiples of 32
+ * in both dimensions), so that a released texture can serve
+ * any later request that rounds up to the same class. The
+ * requested size is kept as the logical 'width' x 'height'
+ * of the returned object, while 'texW' x 'texH' is the size
+ * of the actual storage.
+ * Besides the cached textures, the pool keeps count of the
+ * memory of all textures it handed out that haven't been
+ * released yet, for use by the texture budget */
 class TexPool
 {
 public:
@@ -35,8 +44,26 @@ public:
 	TEXFBO request(int width, int height);
 	void release(TEXFBO &obj);
 
+	/* Lowering the budget evicts cached
+	 * objects until it is met again */
+	uint32_t maxMemSize() const;
+	void setMaxMemSize(uint32_t value);
+
 	void disable();
 
+	/* Deletes all cached textures */
+	void clear();
+
+	unsigned int hits() const;
+	unsigned int misses() const;
+	unsigned int evictions() const;
+
+	/* Memory of the cached textures */
+	uint32_t memSize() const;
+
+	/* Memory of the textures currently handed out */
+	uint32_t liveMemSize() const;
+
 private:
 	TexPoolPrivate *p;
 };
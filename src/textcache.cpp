@@ -0,0 +1,211 @@
+/*
+** textcache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "textcache.h"
+
+#include "texpool.h"
+#include "sharedstate.h"
+#include "glstate.h"
+#include "boost-hash.h"
+
+#include <boost/functional/hash.hpp>
+
+#include <list>
+
+bool TextKey::operator==(const TextKey &o) const
+{
+	return font == o.font && style == o.style
+	    && color == o.color && outColor == o.outColor
+	    && shadow == o.shadow && outline == o.outline
+	    && solid == o.solid && text == o.text;
+}
+
+size_t hash_value(const TextKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.text);
+	boost::hash_combine(seed, key.font);
+	boost::hash_combine(seed, key.style);
+	boost::hash_combine(seed, key.color);
+	boost::hash_combine(seed, key.outColor);
+	boost::hash_combine(seed, key.shadow);
+	boost::hash_combine(seed, key.outline);
+	boost::hash_combine(seed, key.solid);
+
+	return seed;
+}
+
+static uint32_t byteCount(const TEXFBO &tex)
+{
+	return tex.width * tex.height * 4;
+}
+
+struct CacheNode
+{
+	TextKey key;
+	TextCacheEntry entry;
+};
+
+typedef std::list<CacheNode> NodeList;
+
+struct TextCachePrivate
+{
+	TexPool &pool;
+
+	/* Sorted by last use, most recent first */
+	NodeList lru;
+	BoostHash<TextKey, NodeList::iterator> hash;
+
+	uint32_t maxMemSize;
+	uint32_t memSize;
+	int count;
+
+	unsigned int hits;
+	unsigned int misses;
+
+	TextCachePrivate(TexPool &pool, uint32_t maxMemSize)
+	    : pool(pool),
+	      maxMemSize(maxMemSize),
+	      memSize(0),
+	      count(0),
+	      hits(0),
+	      misses(0)
+	{}
+
+	void evictLast()
+	{
+		CacheNode &node = lru.back();
+
+		memSize -= byteCount(node.entry.tex);
+		--count;
+
+		pool.release(node.entry.tex);
+		hash.remove(node.key);
+		lru.pop_back();
+	}
+};
+
+TextCache::TextCache(TexPool &pool, uint32_t maxMemSize)
+{
+	p = new TextCachePrivate(pool, maxMemSize);
+}
+
+TextCache::~TextCache()
+{
+	clear();
+
+	delete p;
+}
+
+bool TextCache::enabled() const
+{
+	return p->maxMemSize > 0;
+}
+
+const TextCacheEntry *TextCache::lookup(const TextKey &key)
+{
+	if (!p->hash.contains(key))
+	{
+		++p->misses;
+		return 0;
+	}
+
+	++p->hits;
+
+	NodeList::iterator iter = p->hash[key];
+	p->lru.splice(p->lru.begin(), p->lru, iter);
+
+	return &iter->entry;
+}
+
+TextCacheEntry *TextCache::insert(const TextKey &key, const Vec2i &size,
+                                  int rawHeight, bool premultiplied)
+{
+	int maxSize = glState.caps.maxTexSize;
+
+	if (size.x > maxSize || size.y > maxSize)
+		return 0;
+
+	const uint32_t bytes = size.x * size.y * 4;
+
+	if (bytes > p->maxMemSize)
+		return 0;
+
+	if (p->hash.contains(key))
+		return 0;
+
+	while (p->memSize + bytes > p->maxMemSize)
+		p->evictLast();
+
+	CacheNode node;
+	node.key = key;
+	node.entry.tex = p->pool.request(size.x, size.y);
+	node.entry.rawHeight = rawHeight;
+	node.entry.premultiplied = premultiplied;
+
+	p->lru.push_front(node);
+	p->hash.insert(key, p->lru.begin());
+
+	p->memSize += bytes;
+	++p->count;
+
+	return &p->lru.front().entry;
+}
+
+void TextCache::clear()
+{
+	while (!p->lru.empty())
+		p->evictLast();
+}
+
+uint32_t TextCache::maxMemSize() const
+{
+	return p->maxMemSize;
+}
+
+void TextCache::setMaxMemSize(uint32_t value)
+{
+	p->maxMemSize = value;
+
+	while (p->memSize > p->maxMemSize)
+		p->evictLast();
+}
+
+unsigned int TextCache::hits() const
+{
+	return p->hits;
+}
+
+unsigned int TextCache::misses() const
+{
+	return p->misses;
+}
+
+uint32_t TextCache::memSize() const
+{
+	return p->memSize;
+}
+
+int TextCache::entryCount() const
+{
+	return p->count;
+}
@@ -0,0 +1,102 @@
+/*
+** textcache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include "gl-util.h"
+#include "etc-internal.h"
+
+#include <string>
+#include <stdint.h>
+
+struct _TTF_Font;
+class TexPool;
+struct TextCachePrivate;
+
+/* Everything that influences the rendered
+ * look of a string, except for its opacity */
+struct TextKey
+{
+	std::string text;
+	_TTF_Font *font;
+	int style;
+	uint32_t color;
+	uint32_t outColor;
+	bool shadow;
+	bool outline;
+	bool solid;
+
+	bool operator==(const TextKey &o) const;
+};
+
+size_t hash_value(const TextKey &key);
+
+struct TextCacheEntry
+{
+	/* Requested from TexPool at the exact text size */
+	TEXFBO tex;
+	int rawHeight;
+
+	/* Whether 'tex' holds premultiplied alpha
+	 * (composed from the glyph atlas) */
+	bool premultiplied;
+};
+
+/* LRU cache of whole rendered strings, so that labels redrawn
+ * every frame with unchanged attributes don't have to be
+ * rendered again. Textures are taken from and returned to the
+ * TexPool; their combined size is kept within 'maxMemSize' */
+class TextCache
+{
+public:
+	TextCache(TexPool &pool, uint32_t maxMemSize);
+	~TextCache();
+
+	bool enabled() const;
+
+	/* Returns the cached rendering of 'key' and marks
+	 * it as most recently used, or null on a miss */
+	const TextCacheEntry *lookup(const TextKey &key);
+
+	/* Allocates a new entry of the given text size which the
+	 * caller then fills in. Returns null if it can't be cached */
+	TextCacheEntry *insert(const TextKey &key, const Vec2i &size,
+	                       int rawHeight, bool premultiplied);
+
+	/* Returns all cached textures to the pool */
+	void clear();
+
+	/* Lowering the budget evicts the least
+	 * recently used entries until it is met */
+	uint32_t maxMemSize() const;
+	void setMaxMemSize(uint32_t value);
+
+	unsigned int hits() const;
+	unsigned int misses() const;
+	uint32_t memSize() const;
+	int entryCount() const;
+
+private:
+	TextCachePrivate *p;
+};
+
+#endif // TEXTCACHE_H
@@ -0,0 +1,380 @@
+/*
+** textcompose.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "textcompose.h"
+
+#include "util.h"
+
+#include <SDL_surface.h>
+#include <SDL_pixels.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/* In SDL_PIXELFORMAT_ABGR8888 */
+#define ALPHA_MASK 0xFF000000
+
+static inline uint32_t *row(SDL_Surface *surf, int y)
+{
+	return (uint32_t*) ((uint8_t*) surf->pixels + y*surf->pitch);
+}
+
+static inline const uint32_t *row(const SDL_Surface *surf, int y)
+{
+	return (const uint32_t*) ((const uint8_t*) surf->pixels + y*surf->pitch);
+}
+
+/* Blends the input pixel over its black shadow using the bitmap
+ * blit equation (see shader/bitmapBlit.frag). As the text is drawn
+ * in a single color, only the alpha of 'src' is looked at */
+static inline uint32_t shadowPixel(uint32_t src, uint32_t shd,
+                                   float fr, float fg, float fb)
+{
+	/* Input and shadow alpha values */
+	uint8_t srcA = src >> 24;
+	uint8_t shdA = shd >> 24;
+
+	if (srcA == 255 || shdA == 0)
+		return src;
+
+	float fSrcA = srcA / 255.0f;
+	float fShdA = shdA / 255.0f;
+
+	/* Because opacity == 1, co1 == fSrcA */
+	float co2 = fShdA * (1.0f - fSrcA);
+	/* Result alpha */
+	float fa = fSrcA + co2;
+	/* Temp value to simplify arithmetic below */
+	float co3 = fSrcA / fa;
+
+	/* Result colors */
+	uint32_t r, g, b, a;
+
+	r = clamp<float>(fr * co3, 0, 1) * 255.0f;
+	g = clamp<float>(fg * co3, 0, 1) * 255.0f;
+	b = clamp<float>(fb * co3, 0, 1) * 255.0f;
+	a = clamp<float>(fa, 0, 1) * 255.0f;
+
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline float32x4_t divide(float32x4_t a, float32x4_t b)
+{
+#ifdef __aarch64__
+	return vdivq_f32(a, b);
+#else
+	/* No vector division on ARMv7; two refinement
+	 * steps get close to full precision */
+	float32x4_t r = vrecpeq_f32(b);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+
+	return vmulq_f32(a, r);
+#endif
+}
+
+static inline uint32x4_t toByte(float32x4_t v)
+{
+	v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0)), vdupq_n_f32(1));
+
+	return vcvtq_u32_f32(vmulq_f32(v, vdupq_n_f32(255.0f)));
+}
+
+/* Four pixels of shadowPixel() */
+static inline uint32x4_t shadowPixel4(uint32x4_t src, uint32x4_t shd,
+                                      float32x4_t fr, float32x4_t fg, float32x4_t fb)
+{
+	uint32x4_t srcA = vshrq_n_u32(src, 24);
+	uint32x4_t shdA = vshrq_n_u32(shd, 24);
+
+	uint32x4_t keep = vorrq_u32(vceqq_u32(srcA, vdupq_n_u32(255)),
+	                            vceqq_u32(shdA, vdupq_n_u32(0)));
+
+	const float32x4_t v255 = vdupq_n_f32(255.0f);
+	float32x4_t fSrcA = divide(vcvtq_f32_u32(srcA), v255);
+	float32x4_t fShdA = divide(vcvtq_f32_u32(shdA), v255);
+
+	float32x4_t co2 = vmulq_f32(fShdA, vsubq_f32(vdupq_n_f32(1), fSrcA));
+	float32x4_t fa = vaddq_f32(fSrcA, co2);
+	float32x4_t co3 = divide(fSrcA, fa);
+
+	uint32x4_t res = toByte(vmulq_f32(fr, co3));
+	res = vorrq_u32(res, vshlq_n_u32(toByte(vmulq_f32(fg, co3)), 8));
+	res = vorrq_u32(res, vshlq_n_u32(toByte(vmulq_f32(fb, co3)), 16));
+	res = vorrq_u32(res, vshlq_n_u32(toByte(fa), 24));
+
+	return vbslq_u32(keep, src, res);
+}
+#elif defined(__SSE2__)
+static inline __m128i toByte(__m128 v)
+{
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1));
+
+	return _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(255.0f)));
+}
+
+/* Four pixels of shadowPixel(), with identical results */
+static inline __m128i shadowPixel4(__m128i src, __m128i shd,
+                                   __m128 fr, __m128 fg, __m128 fb)
+{
+	__m128i srcA = _mm_srli_epi32(src, 24);
+	__m128i shdA = _mm_srli_epi32(shd, 24);
+
+	__m128i keep = _mm_or_si128(_mm_cmpeq_epi32(srcA, _mm_set1_epi32(255)),
+	                            _mm_cmpeq_epi32(shdA, _mm_setzero_si128()));
+
+	if (_mm_movemask_epi8(keep) == 0xFFFF)
+		return src;
+
+	const __m128 v255 = _mm_set1_ps(255.0f);
+	__m128 fSrcA = _mm_div_ps(_mm_cvtepi32_ps(srcA), v255);
+	__m128 fShdA = _mm_div_ps(_mm_cvtepi32_ps(shdA), v255);
+
+	__m128 co2 = _mm_mul_ps(fShdA, _mm_sub_ps(_mm_set1_ps(1), fSrcA));
+	__m128 fa = _mm_add_ps(fSrcA, co2);
+	__m128 co3 = _mm_div_ps(fSrcA, fa);
+
+	__m128i res = toByte(_mm_mul_ps(fr, co3));
+	res = _mm_or_si128(res, _mm_slli_epi32(toByte(_mm_mul_ps(fg, co3)), 8));
+	res = _mm_or_si128(res, _mm_slli_epi32(toByte(_mm_mul_ps(fb, co3)), 16));
+	res = _mm_or_si128(res, _mm_slli_epi32(toByte(fa), 24));
+
+	return _mm_or_si128(_mm_and_si128(keep, src), _mm_andnot_si128(keep, res));
+}
+#endif
+
+/* Interior pixels 1 <= x < w of an output row */
+static void shadowRow(const uint32_t *srcRow, const uint32_t *shdRow,
+                      uint32_t *outRow, int w,
+                      float fr, float fg, float fb)
+{
+	int x = 1;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	const float32x4_t vr = vdupq_n_f32(fr);
+	const float32x4_t vg = vdupq_n_f32(fg);
+	const float32x4_t vb = vdupq_n_f32(fb);
+
+	for (; x + 4 <= w; x += 4)
+	{
+		uint32x4_t src = vld1q_u32(&srcRow[x]);
+		uint32x4_t shd = vld1q_u32(&shdRow[x-1]);
+
+		vst1q_u32(&outRow[x], shadowPixel4(src, shd, vr, vg, vb));
+	}
+#elif defined(__SSE2__)
+	const __m128 vr = _mm_set1_ps(fr);
+	const __m128 vg = _mm_set1_ps(fg);
+	const __m128 vb = _mm_set1_ps(fb);
+
+	for (; x + 4 <= w; x += 4)
+	{
+		__m128i src = _mm_loadu_si128((const __m128i*) &srcRow[x]);
+		__m128i shd = _mm_loadu_si128((const __m128i*) &shdRow[x-1]);
+
+		_mm_storeu_si128((__m128i*) &outRow[x], shadowPixel4(src, shd, vr, vg, vb));
+	}
+#endif
+
+	for (; x < w; ++x)
+		outRow[x] = shadowPixel(srcRow[x], shdRow[x-1], fr, fg, fb);
+}
+
+namespace TextCompose
+{
+
+void shadow(const SDL_Surface *in, SDL_Surface *out, const SDL_Color &c)
+{
+	const int w = in->w;
+	const int h = in->h;
+
+	float fr = c.r / 255.0f;
+	float fg = c.g / 255.0f;
+	float fb = c.b / 255.0f;
+
+	/* The output is one pixel wider and higher than the input. It
+	 * holds a copy of the input with RGB values set to black at
+	 * offset (1,1), with the input blended over it at (0,0) */
+
+	/* Top row: nothing but the input */
+	memcpy(row(out, 0), row(in, 0), w * 4);
+	row(out, 0)[w] = 0;
+
+	for (int y = 1; y < h; ++y)
+	{
+		const uint32_t *srcRow = row(in, y);
+		const uint32_t *shdRow = row(in, y-1);
+		uint32_t *outRow = row(out, y);
+
+		outRow[0] = srcRow[0];
+		shadowRow(srcRow, shdRow, outRow, w, fr, fg, fb);
+		outRow[w] = shdRow[w-1] & ALPHA_MASK;
+	}
+
+	/* Bottom row: nothing but the shadow */
+	const uint32_t *shdRow = row(in, h-1);
+	uint32_t *outRow = row(out, h);
+
+	outRow[0] = 0;
+
+	for (int x = 1; x <= w; ++x)
+		outRow[x] = shdRow[x-1] & ALPHA_MASK;
+}
+
+/* Divides by 255, rounding to nearest */
+static inline uint32_t div255(uint32_t v)
+{
+	v += 128;
+
+	return (v + (v >> 8)) >> 8;
+}
+
+void blendOver(const SDL_Surface *src, SDL_Surface *dst, int x, int y)
+{
+	const int w = std::min(src->w, dst->w - x);
+	const int h = std::min(src->h, dst->h - y);
+
+	for (int j = 0; j < h; ++j)
+	{
+		const uint8_t *s = (const uint8_t*) row(src, j);
+		uint8_t *d = (uint8_t*) (row(dst, y+j) + x);
+		int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		for (; i + 8 <= w; i += 8, s += 32, d += 32)
+		{
+			uint8x8x4_t sv = vld4_u8(s);
+			uint8x8x4_t dv = vld4_u8(d);
+
+			uint8x8_t sa = sv.val[3];
+			uint8x8_t inv = vmvn_u8(sa);
+
+			/* Alpha is blended like a fully set color channel */
+			sv.val[3] = vdup_n_u8(255);
+
+			for (int k = 0; k < 4; ++k)
+			{
+				uint16x8_t v = vmlal_u8(vmull_u8(sv.val[k], sa), dv.val[k], inv);
+				dv.val[k] = vraddhn_u16(v, vrshrq_n_u16(v, 8));
+			}
+
+			vst4_u8(d, dv);
+		}
+#elif defined(__SSE2__)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alphaMask = _mm_set1_epi32(ALPHA_MASK);
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i v128 = _mm_set1_epi16(128);
+
+		for (; i + 4 <= w; i += 4, s += 16, d += 16)
+		{
+			__m128i sv = _mm_loadu_si128((const __m128i*) s);
+			__m128i dv = _mm_loadu_si128((const __m128i*) d);
+
+			/* Alpha is blended like a fully set color channel */
+			__m128i sc = _mm_or_si128(sv, alphaMask);
+
+			__m128i half[2];
+
+			for (int k = 0; k < 2; ++k)
+			{
+				__m128i s16 = k ? _mm_unpackhi_epi8(sc, zero) : _mm_unpacklo_epi8(sc, zero);
+				__m128i d16 = k ? _mm_unpackhi_epi8(dv, zero) : _mm_unpacklo_epi8(dv, zero);
+				__m128i a16 = k ? _mm_unpackhi_epi8(sv, zero) : _mm_unpacklo_epi8(sv, zero);
+
+				/* Broadcast each pixel's alpha */
+				a16 = _mm_shufflelo_epi16(a16, _MM_SHUFFLE(3, 3, 3, 3));
+				a16 = _mm_shufflehi_epi16(a16, _MM_SHUFFLE(3, 3, 3, 3));
+
+				__m128i v = _mm_add_epi16(_mm_mullo_epi16(s16, a16),
+				                          _mm_mullo_epi16(d16, _mm_sub_epi16(v255, a16)));
+
+				v = _mm_add_epi16(v, v128);
+				half[k] = _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+			}
+
+			_mm_storeu_si128((__m128i*) d, _mm_packus_epi16(half[0], half[1]));
+		}
+#endif
+
+		for (; i < w; ++i, s += 4, d += 4)
+		{
+			uint32_t sa = s[3];
+			uint32_t inv = 255 - sa;
+
+			d[0] = div255(s[0] * sa + d[0] * inv);
+			d[1] = div255(s[1] * sa + d[1] * inv);
+			d[2] = div255(s[2] * sa + d[2] * inv);
+			d[3] = div255(255 * sa + d[3] * inv);
+		}
+	}
+}
+
+void argbToAbgr(const SDL_Surface *src, SDL_Surface *dst)
+{
+	for (int y = 0; y < src->h; ++y)
+	{
+		const uint32_t *s = row(src, y);
+		uint32_t *d = row(dst, y);
+		int x = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		for (; x + 8 <= src->w; x += 8)
+		{
+			uint8x8x4_t v = vld4_u8((const uint8_t*) &s[x]);
+			uint8x8_t tmp = v.val[0];
+			v.val[0] = v.val[2];
+			v.val[2] = tmp;
+			vst4_u8((uint8_t*) &d[x], v);
+		}
+#elif defined(__SSE2__)
+		const __m128i keepMask = _mm_set1_epi32(0xFF00FF00);
+		const __m128i lowMask = _mm_set1_epi32(0x000000FF);
+
+		for (; x + 4 <= src->w; x += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*) &s[x]);
+			__m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), lowMask);
+			__m128i b = _mm_slli_epi32(_mm_and_si128(v, lowMask), 16);
+
+			v = _mm_or_si128(_mm_and_si128(v, keepMask), _mm_or_si128(r, b));
+			_mm_storeu_si128((__m128i*) &d[x], v);
+		}
+#endif
+
+		for (; x < src->w; ++x)
+		{
+			uint32_t v = s[x];
+			d[x] = (v & 0xFF00FF00) | ((v >> 16) & 0xFF) | ((v & 0xFF) << 16);
+		}
+	}
+}
+
+}
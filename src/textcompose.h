@@ -0,0 +1,49 @@
+/*
+** textcompose.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TEXTCOMPOSE_H
+#define TEXTCOMPOSE_H
+
+struct SDL_Surface;
+struct SDL_Color;
+
+/* Pixel kernels for composing software rendered text.
+ * All surfaces have to be in SDL_PIXELFORMAT_ABGR8888,
+ * except for the source of 'argbToAbgr'. Several pixels
+ * are processed at once with NEON or SSE2 if available */
+namespace TextCompose
+{
+/* Writes 'in' with a black drop shadow, offset by one
+ * pixel, into 'out', which has to be one pixel wider and
+ * higher. 'c' is the color 'in' was rendered in */
+void shadow(const SDL_Surface *in, SDL_Surface *out, const SDL_Color &c);
+
+/* Blends 'src' over 'dst' at (x, y) >= (0, 0) the same
+ * way SDL_BLENDMODE_BLEND does, clipped to 'dst' */
+void blendOver(const SDL_Surface *src, SDL_Surface *dst, int x, int y);
+
+/* Converts between equally sized surfaces by
+ * swapping the red and blue channels */
+void argbToAbgr(const SDL_Surface *src, SDL_Surface *dst);
+}
+
+#endif // TEXTCOMPOSE_H
@@ -0,0 +1,271 @@
+/*
+** textmetrics.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "textmetrics.h"
+
+#include "boost-hash.h"
+#include "util.h"
+
+#include <boost/functional/hash.hpp>
+
+#include <SDL_ttf.h>
+
+#include <string.h>
+
+/* Matching results after which the cached path is trusted */
+#define TRUST_THRESHOLD 16
+
+struct MetricKey
+{
+	TTF_Font *font;
+	int style;
+	uint16_t ch;
+
+	bool operator==(const MetricKey &o) const
+	{
+		return font == o.font && style == o.style && ch == o.ch;
+	}
+};
+
+static size_t hash_value(const MetricKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.font);
+	boost::hash_combine(seed, key.style);
+	boost::hash_combine(seed, key.ch);
+
+	return seed;
+}
+
+struct GlyphMetrics
+{
+	int minx, maxx;
+	int miny, maxy;
+	int advance;
+};
+
+/* Font handle, style and the two codepoints of a kerning pair */
+struct KernKey
+{
+	TTF_Font *font;
+	int style;
+	uint16_t prev, ch;
+
+	bool operator==(const KernKey &o) const
+	{
+		return font == o.font && style == o.style
+		    && prev == o.prev && ch == o.ch;
+	}
+};
+
+static size_t hash_value(const KernKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, key.font);
+	boost::hash_combine(seed, key.style);
+	boost::hash_combine(seed, key.prev);
+	boost::hash_combine(seed, key.ch);
+
+	return seed;
+}
+
+typedef std::pair<TTF_Font*, int> FontStyle;
+
+struct StyleState
+{
+	int matches;
+	bool mismatched;
+
+	StyleState()
+	    : matches(0),
+	      mismatched(false)
+	{}
+};
+
+struct TextMetricsPrivate
+{
+	BoostHash<MetricKey, GlyphMetrics> glyphs;
+	BoostHash<KernKey, int> kerning;
+	BoostHash<FontStyle, StyleState> styles;
+
+	const GlyphMetrics *getGlyph(const MetricKey &key)
+	{
+		if (glyphs.contains(key))
+			return &glyphs[key];
+
+		GlyphMetrics m;
+
+		if (TTF_GlyphMetrics(key.font, key.ch, &m.minx, &m.maxx,
+		                     &m.miny, &m.maxy, &m.advance) < 0)
+			return 0;
+
+		glyphs.insert(key, m);
+
+		return &glyphs[key];
+	}
+
+	int getKerning(const KernKey &key)
+	{
+		if (kerning.contains(key))
+			return kerning[key];
+
+		int delta = TTF_GetFontKerningSizeGlyphs(key.font, key.prev, key.ch);
+		kerning.insert(key, delta);
+
+		return delta;
+	}
+
+	/* Lays out 'str' the same way TTF_SizeUTF8 does. If given,
+	 * 'prefixes' receives the width after every character.
+	 * Returns false if it can't be computed */
+	bool measure(TTF_Font *font, const char *str, int &w, int &h,
+	             std::vector<int> *prefixes)
+	{
+		MetricKey key;
+		key.font = font;
+		key.style = TTF_GetFontStyle(font);
+
+		KernKey kern;
+		kern.font = font;
+		kern.style = key.style;
+		kern.prev = 0;
+
+		const bool useKerning = TTF_GetFontKerning(font);
+		const int ascent = TTF_FontAscent(font);
+
+		int x = 0;
+		int minx = 0, maxx = 0;
+		int miny = 0, maxy = 0;
+		bool first = true;
+
+		while (*str)
+		{
+			if (!nextUCS2(str, key.ch))
+				return false;
+
+			const GlyphMetrics *glyph = getGlyph(key);
+
+			if (!glyph)
+				return false;
+
+			if (useKerning && !first)
+			{
+				kern.ch = key.ch;
+				x += getKerning(kern);
+			}
+
+			minx = std::min(minx, x + glyph->minx);
+			maxx = std::max(maxx, x + std::max(glyph->advance, glyph->maxx));
+
+			miny = std::min(miny, ascent - glyph->maxy);
+			maxy = std::max(maxy, ascent - glyph->miny);
+
+			x += glyph->advance;
+
+			if (prefixes)
+				prefixes->push_back(maxx - minx);
+
+			kern.prev = key.ch;
+			first = false;
+		}
+
+		w = maxx - minx;
+		h = std::max(maxy - miny, TTF_FontHeight(font));
+
+		return true;
+	}
+};
+
+TextMetrics::TextMetrics()
+{
+	p = new TextMetricsPrivate;
+}
+
+TextMetrics::~TextMetrics()
+{
+	delete p;
+}
+
+void TextMetrics::size(TTF_Font *font, const char *str, int &w, int &h)
+{
+	StyleState &state = p->styles[FontStyle(font, TTF_GetFontStyle(font))];
+
+	if (state.matches >= TRUST_THRESHOLD)
+	{
+		if (p->measure(font, str, w, h, 0))
+			return;
+	}
+	else if (!state.mismatched)
+	{
+		int mw, mh;
+		bool measured = p->measure(font, str, mw, mh, 0);
+
+		TTF_SizeUTF8(font, str, &w, &h);
+
+		if (measured)
+		{
+			if (mw == w && mh == h)
+				++state.matches;
+			else
+				state.mismatched = true;
+		}
+
+		return;
+	}
+
+	TTF_SizeUTF8(font, str, &w, &h);
+}
+
+void TextMetrics::prefixWidths(TTF_Font *font, const char *str, std::vector<int> &out)
+{
+	out.clear();
+
+	const StyleState &state = p->styles[FontStyle(font, TTF_GetFontStyle(font))];
+	int w, h;
+
+	if (state.matches >= TRUST_THRESHOLD && p->measure(font, str, w, h, &out))
+		return;
+
+	out.clear();
+
+	/* Measure every prefix on its own, which
+	 * also builds up trust in the cached path */
+	std::string prefix;
+	const char *s = str;
+
+	while (*s)
+	{
+		const char *chStart = s;
+		uint16_t ch;
+
+		/* Still step over undecodable bytes one at a time */
+		if (!nextUCS2(s, ch))
+			s = chStart + 1;
+
+		prefix.append(chStart, s - chStart);
+
+		size(font, prefix.c_str(), w, h);
+		out.push_back(w);
+	}
+}
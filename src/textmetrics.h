@@ -0,0 +1,54 @@
+/*
+** textmetrics.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TEXTMETRICS_H
+#define TEXTMETRICS_H
+
+#include <vector>
+
+struct _TTF_Font;
+struct TextMetricsPrivate;
+
+/* Measures strings out of cached glyph metrics and kerning pairs
+ * instead of having SDL_ttf load every glyph again. As not all of
+ * SDL_ttf's layout is exposed (eg. bold overhang), the cached path
+ * is only trusted for a font handle and style once it produced the
+ * same results as TTF_SizeUTF8 a number of times; on any mismatch,
+ * that combination keeps using TTF_SizeUTF8 */
+class TextMetrics
+{
+public:
+	TextMetrics();
+	~TextMetrics();
+
+	/* Same as TTF_SizeUTF8 with the font's current style */
+	void size(_TTF_Font *font, const char *str, int &w, int &h);
+
+	/* Receives the width of every prefix of 'str' that ends
+	 * after a complete character, as 'size' reports them */
+	void prefixWidths(_TTF_Font *font, const char *str, std::vector<int> &out);
+
+private:
+	TextMetricsPrivate *p;
+};
+
+#endif // TEXTMETRICS_H
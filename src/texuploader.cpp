@@ -0,0 +1,274 @@
+/*
+** texuploader.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "texuploader.h"
+
+#include "sdl-util.h"
+#include "debugwriter.h"
+#include "profiler.h"
+
+#include <SDL_video.h>
+#include <SDL_surface.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include <deque>
+
+struct TexUpload
+{
+	TEX::ID tex;
+	SDL_Surface *surf;
+
+	/* Passed after the texture was allocated
+	 * on the main context */
+	_GLsync allocated;
+	/* Passed after the upload */
+	_GLsync uploaded;
+
+	bool issued;
+};
+
+struct TexUploaderPrivate
+{
+	SDL_Window *window;
+	SDL_GLContext ctx;
+	SDL_Thread *thread;
+
+	/* Guards everything below */
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+
+	std::deque<TexUpload*> queue;
+
+	enum State
+	{
+		Starting,
+		Running,
+		Failed
+	};
+
+	State state;
+	bool quit;
+
+	TexUploaderPrivate(SDL_Window *window)
+	    : window(window),
+	      ctx(0),
+	      thread(0),
+	      mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      state(Starting),
+	      quit(false)
+	{}
+
+	~TexUploaderPrivate()
+	{
+		if (thread)
+		{
+			SDL_LockMutex(mutex);
+			quit = true;
+			SDL_CondBroadcast(cond);
+			SDL_UnlockMutex(mutex);
+
+			SDL_WaitThread(thread, 0);
+		}
+
+		if (ctx)
+			SDL_GL_DeleteContext(ctx);
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
+	}
+
+	bool start()
+	{
+		SDL_GLContext mainCtx = SDL_GL_GetCurrentContext();
+
+		SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+		ctx = SDL_GL_CreateContext(window);
+		SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+
+		/* Creating the context made it current */
+		SDL_GL_MakeCurrent(window, mainCtx);
+
+		if (!ctx)
+			return false;
+
+		thread = createSDLThread
+		        <TexUploaderPrivate, &TexUploaderPrivate::worker>(this, "texuploader");
+
+		if (!thread)
+			return false;
+
+		SDL_LockMutex(mutex);
+
+		while (state == Starting)
+			SDL_CondWait(cond, mutex);
+
+		bool running = state == Running;
+
+		SDL_UnlockMutex(mutex);
+
+		return running;
+	}
+
+	void uploadOne(TexUpload &up)
+	{
+		TRACE_SCOPE("TexUploader::upload");
+
+		gl.WaitSync(up.allocated, 0, GL_TIMEOUT_IGNORED);
+		gl.DeleteSync(up.allocated);
+
+		/* Without going through TEX::bind, which
+		 * caches the main context's bindings */
+		gl.BindTexture(GL_TEXTURE_2D, up.tex.gl);
+		gl.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, up.surf->w, up.surf->h,
+		                 GL_RGBA, GL_UNSIGNED_BYTE, up.surf->pixels);
+		gl.BindTexture(GL_TEXTURE_2D, 0);
+
+		up.uploaded = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl.Flush();
+
+		SDL_FreeSurface(up.surf);
+		up.surf = 0;
+	}
+
+	void worker()
+	{
+		/* Some platforms won't let a second thread
+		 * bind a context to the same window */
+		bool current = SDL_GL_MakeCurrent(window, ctx) == 0;
+
+		SDL_LockMutex(mutex);
+
+		state = current ? Running : Failed;
+		SDL_CondBroadcast(cond);
+
+		if (!current)
+		{
+			SDL_UnlockMutex(mutex);
+			return;
+		}
+
+		while (true)
+		{
+			while (queue.empty() && !quit)
+				SDL_CondWait(cond, mutex);
+
+			if (quit)
+				break;
+
+			TexUpload *up = queue.front();
+			queue.pop_front();
+
+			SDL_UnlockMutex(mutex);
+			uploadOne(*up);
+			SDL_LockMutex(mutex);
+
+			up->issued = true;
+			SDL_CondBroadcast(cond);
+		}
+
+		SDL_UnlockMutex(mutex);
+
+		SDL_GL_MakeCurrent(window, 0);
+	}
+};
+
+TexUploader::TexUploader(SDL_Window *window, bool enable)
+    : p(0)
+{
+	if (!enable)
+		return;
+
+	if (!gl.sync)
+	{
+		Debug() << "Asynchronous texture uploads unavailable (no sync objects)";
+		return;
+	}
+
+	p = new TexUploaderPrivate(window);
+
+	if (!p->start())
+	{
+		Debug() << "Asynchronous texture uploads unavailable:" << SDL_GetError();
+
+		delete p;
+		p = 0;
+	}
+}
+
+TexUploader::~TexUploader()
+{
+	delete p;
+}
+
+bool TexUploader::enabled() const
+{
+	return p != 0;
+}
+
+TexUpload *TexUploader::upload(TEX::ID tex, SDL_Surface *surf)
+{
+	TexUpload *up = new TexUpload;
+	up->tex = tex;
+	up->surf = surf;
+	up->uploaded = 0;
+	up->issued = false;
+
+	/* Has to reach the GPU before the other
+	 * context can wait on it */
+	up->allocated = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	gl.Flush();
+
+	SDL_LockMutex(p->mutex);
+	p->queue.push_back(up);
+	SDL_CondBroadcast(p->cond);
+	SDL_UnlockMutex(p->mutex);
+
+	return up;
+}
+
+bool TexUploader::isIssued(TexUpload &upload)
+{
+	SDL_LockMutex(p->mutex);
+	bool issued = upload.issued;
+	SDL_UnlockMutex(p->mutex);
+
+	return issued;
+}
+
+void TexUploader::finish(TexUpload *upload)
+{
+	TRACE_SCOPE("TexUploader::finish");
+
+	SDL_LockMutex(p->mutex);
+
+	while (!upload->issued)
+		SDL_CondWait(p->cond, p->mutex);
+
+	SDL_UnlockMutex(p->mutex);
+
+	gl.WaitSync(upload->uploaded, 0, GL_TIMEOUT_IGNORED);
+	gl.DeleteSync(upload->uploaded);
+
+	delete upload;
+}
@@ -0,0 +1,67 @@
+/*
+** texuploader.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TEXUPLOADER_H
+#define TEXUPLOADER_H
+
+#include "gl-util.h"
+
+struct SDL_Window;
+struct SDL_Surface;
+struct TexUpload;
+struct TexUploaderPrivate;
+
+/* Uploads image data into textures from a second GL context
+ * that shares objects with the main one, on its own thread.
+ * Fences order the upload after the texture's allocation on
+ * the main context, and the main context's later use of the
+ * texture after the upload.
+ * Stays disabled if the platform can't provide such a
+ * context or the GL lacks sync objects */
+class TexUploader
+{
+public:
+	/* Must be constructed with the main context current */
+	TexUploader(SDL_Window *window, bool enable);
+	~TexUploader();
+
+	bool enabled() const;
+
+	/* Queues the upload of 'surf' (ABGR8888, matching the
+	 * size of 'tex', which must be allocated already).
+	 * Takes ownership of 'surf' */
+	TexUpload *upload(TEX::ID tex, SDL_Surface *surf);
+
+	/* Whether the upload has been issued, ie. 'finish()'
+	 * won't block */
+	bool isIssued(TexUpload &upload);
+
+	/* Waits until 'upload' was issued, and makes all GL
+	 * commands of the main context submitted afterwards
+	 * wait for its completion on the GPU. Frees 'upload' */
+	void finish(TexUpload *upload);
+
+private:
+	TexUploaderPrivate *p;
+};
+
+#endif // TEXUPLOADER_H
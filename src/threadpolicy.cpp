@@ -0,0 +1,104 @@
+/*
+** threadpolicy.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "threadpolicy.h"
+
+#include "config.h"
+#include "debugwriter.h"
+
+#include <SDL_thread.h>
+
+#ifdef __vita__
+#include <psp2/kernel/threadmgr.h>
+#endif
+
+struct RoleSettings
+{
+	int priority;
+	int core;
+};
+
+static RoleSettings roles[ThreadPolicy::RoleCount];
+static bool initialized = false;
+
+static const char *roleNames[ThreadPolicy::RoleCount] =
+{
+	"default",
+	"rgss",
+	"event",
+	"audio",
+	"worker"
+};
+
+void ThreadPolicy::init(const Config &conf)
+{
+	roles[Default].priority = 0;
+	roles[Default].core = -1;
+
+	roles[RGSS].priority = conf.threads.rgssPriority;
+	roles[RGSS].core = conf.threads.rgssCore;
+
+	roles[Event].priority = conf.threads.eventPriority;
+	roles[Event].core = conf.threads.eventCore;
+
+	roles[Audio].priority = conf.threads.audioPriority;
+	roles[Audio].core = conf.threads.audioCore;
+
+	/* Workers spread over the cores themselves */
+	roles[Worker].priority = conf.threads.workerPriority;
+	roles[Worker].core = -1;
+
+	initialized = true;
+}
+
+static SDL_ThreadPriority sdlPriority(int priority)
+{
+	switch (priority)
+	{
+	case -1 :
+		return SDL_THREAD_PRIORITY_LOW;
+	case 1 :
+		return SDL_THREAD_PRIORITY_HIGH;
+	case 2 :
+		return SDL_THREAD_PRIORITY_TIME_CRITICAL;
+	default :
+		return SDL_THREAD_PRIORITY_NORMAL;
+	}
+}
+
+void ThreadPolicy::apply(Role role)
+{
+	if (!initialized)
+		return;
+
+	const RoleSettings &set = roles[role];
+
+	if (set.priority != 0 && SDL_SetThreadPriority(sdlPriority(set.priority)) < 0)
+		Debug() << "Unable to set priority of" << roleNames[role]
+		        << "thread:" << SDL_GetError();
+
+#ifdef __vita__
+	if (set.core >= 0)
+		sceKernelChangeThreadCpuAffinityMask(sceKernelGetThreadId(),
+		                                     SCE_KERNEL_CPU_MASK_USER_0 << set.core);
+#endif
+}
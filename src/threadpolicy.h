@@ -0,0 +1,53 @@
+/*
+** threadpolicy.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef THREADPOLICY_H
+#define THREADPOLICY_H
+
+struct Config;
+
+/* Scheduling priority and core affinity of the engine's
+ * threads, by role ('threads.*' options). Threads without
+ * a role are left at their defaults. Cores are only
+ * assigned on the Vita */
+class ThreadPolicy
+{
+public:
+	enum Role
+	{
+		Default,
+		RGSS,
+		Event,
+		Audio,
+		Worker,
+
+		RoleCount
+	};
+
+	/* Has to be called before any engine thread is created */
+	static void init(const Config &conf);
+
+	/* Applies the settings of 'role' to the calling thread */
+	static void apply(Role role);
+};
+
+#endif // THREADPOLICY_H
@@ -66,18 +66,6 @@ static elementsN(autotileVXRectsC);
 namespace TileAtlasVX
 {
 
-static int16_t
-tableGetSafe(const Table *t, int x)
-{
-	if (!t)
-		return 0;
-
-	if (x < 0 || x >= t->xSize())
-		return 0;
-
-	return t->at(x);
-}
-
 /* All below constants are in tiles (= 32 pixels) */
 
 struct Size
@@ -408,9 +396,45 @@ readAutotileC(Reader &reader, int patternID,
 	reader.onQuads(tex, pos, 2, false);
 }
 
-static void
-onTileA1(Reader &reader, int16_t tileID,
-         const int x, const int y)
+enum TileKind
+{
+	TileNone = 0,
+	/* A5 and B ~ E */
+	TileSingle,
+	TileAutotileA,
+	/* Regular or table pattern, depending on the flags */
+	TileAutotileA2,
+	TileAutotileB,
+	TileAutotileC
+};
+
+/* Everything about a tile ID that doesn't depend on the map */
+struct TileInfo
+{
+	uint8_t kind;
+	uint8_t patternID;
+
+	/* Atlas origin of the (auto)tile in tiles */
+	uint8_t origX, origY;
+};
+
+/* Tile IDs past the A4 autotiles are never drawn */
+static const int tileIDMax = 0x2000;
+
+static TileInfo
+makeInfo(TileKind kind, int patternID, const Vec2i &orig)
+{
+	TileInfo info;
+	info.kind = kind;
+	info.patternID = patternID;
+	info.origX = orig.x;
+	info.origY = orig.y;
+
+	return info;
+}
+
+static TileInfo
+classifyA1(int tileID)
 {
 	tileID -= 0x0800;
 
@@ -443,19 +467,19 @@ onTileA1(Reader &reader, int16_t tileID,
 
 	if (orig.x == -1)
 	{
+		if (patternID > 0x3)
+			return makeInfo(TileNone, 0, Vec2i());
+
 		int cID = (autotileID - 5) / 2;
-		const Vec2i orig = AEPartsDst[cID];
 
-		readAutotileC(reader, patternID, orig, x, y);
-		return;
+		return makeInfo(TileAutotileC, patternID, AEPartsDst[cID]);
 	}
 
-	readAutotileA(reader, patternID, orig, x, y);
+	return makeInfo(TileAutotileA, patternID, orig);
 }
 
-static void
-onTileA2(Reader &reader, int16_t tileID,
-         int x, int y, bool isTable)
+static TileInfo
+classifyA2(int tileID)
 {
 	Vec2i orig = blitsA2[0].dst;
 	tileID -= 0x0B00;
@@ -466,20 +490,11 @@ onTileA2(Reader &reader, int16_t tileID,
 	orig.x += (autotileID % 8) * 2;
 	orig.y += (autotileID / 8) * 3;
 
-	/* The table autotile handling isn't 100% accurate;
-	 * for that, we'd need to prerender layer 1 into a separate
-	 * temp texture with blending turned off and render that
-	 * to the screen. But in 99% of cases it shouldn't matter */
-
-	if (isTable)
-		readAutotileA2(reader, patternID, orig, x, y);
-	else
-		readAutotileA(reader, patternID, orig, x, y);
+	return makeInfo(TileAutotileA2, patternID, orig);
 }
 
-static void
-onTileA3(Reader &reader, int16_t tileID,
-         int x, int y)
+static TileInfo
+classifyA3(int tileID)
 {
 	Vec2i orig = blitsA3[0].dst;
 	tileID -= 0x1100;
@@ -490,12 +505,14 @@ onTileA3(Reader &reader, int16_t tileID,
 	orig.x += (autotileID % 8) * 2;
 	orig.y += (autotileID / 8) * 2;
 
-	readAutotileB(reader, patternID, orig, x, y);
+	if (patternID >= 0x10)
+		return makeInfo(TileNone, 0, Vec2i());
+
+	return makeInfo(TileAutotileB, patternID, orig);
 }
 
-static void
-onTileA4(Reader &reader, int16_t tileID,
-         int x, int y)
+static TileInfo
+classifyA4(int tileID)
 {
 	Vec2i orig = blitsA4[0].dst;
 	tileID -= 0x1700;
@@ -510,30 +527,26 @@ onTileA4(Reader &reader, int16_t tileID,
 	orig.y += offY[offYI];
 
 	if ((offYI % 2) == 0)
-		readAutotileA(reader, patternID, orig, x, y);
-	else
-		readAutotileB(reader, patternID, orig, x, y);
+		return makeInfo(TileAutotileA, patternID, orig);
+
+	if (patternID >= 0x10)
+		return makeInfo(TileNone, 0, Vec2i());
+
+	return makeInfo(TileAutotileB, patternID, orig);
 }
 
-static void
-onTileA5(Reader &reader, int16_t tileID,
-         int x, int y, bool overPlayer)
+static TileInfo
+classifyA5(int tileID)
 {
 	const Vec2i orig = blitsA5[0].dst;
 	tileID -= 0x0600;
 
-	int ox = tileID % 0x8;
-	int oy = tileID / 0x8;
-
-	FloatRect tex((orig.x+ox)*32+0.5, (orig.y+oy)*32+0.5, 31, 31);
-	FloatRect pos(x*32, y*32, 32, 32);
-
-	reader.onQuads(&tex, &pos, 1, overPlayer);
+	return makeInfo(TileSingle, 0, Vec2i(orig.x + tileID % 0x8,
+	                                     orig.y + tileID / 0x8));
 }
 
-static void
-onTileBCDE(Reader &reader, int16_t tileID,
-           int x, int y, bool overPlayer)
+static TileInfo
+classifyBCDE(int tileID)
 {
 	int ox = tileID % 0x8;
 	int oy = (tileID / 0x8) % 0x10;
@@ -542,86 +555,167 @@ onTileBCDE(Reader &reader, int16_t tileID,
 	ox += (ob % 2) * 0x8;
 	oy += (ob / 2) * 0x10;
 
-	FloatRect tex((CDEArea.x+ox)*32+0.5, (CDEArea.y+oy)*32+0.5, 31, 31);
-	FloatRect pos(x*32, y*32, 32, 32);
-
-	reader.onQuads(&tex, &pos, 1, overPlayer);
+	return makeInfo(TileSingle, 0, Vec2i(CDEArea.x+ox, CDEArea.y+oy));
 }
 
-static void
-onTile(Reader &reader, int16_t tileID,
-       int x, int y, const Table *flags)
+static TileInfo
+classify(int tileID)
 {
-	int16_t flag = tableGetSafe(flags, tileID);
-	bool overPlayer = flag & OVER_PLAYER_FLAG;
-	bool isTable;
-
-	if (rgssVer >= 3)
-		isTable = flag & TABLE_FLAG;
-	else
-		isTable = (tileID - 0x0B00) % (8 * 0x30) >= (7 * 0x30);
+	if (tileID <= 0)
+		return makeInfo(TileNone, 0, Vec2i());
 
 	/* B ~ E */
 	if (tileID < 0x0400)
-	{
-		onTileBCDE(reader, tileID, x, y, overPlayer);
-		return;
-	}
+		return classifyBCDE(tileID);
 
 	/* A5 */
 	if (tileID >= 0x0600 && tileID < 0x0680)
-	{
-		onTileA5(reader, tileID, x, y, overPlayer);
-		return;
-	}
+		return classifyA5(tileID);
 
+	/* A1 */
 	if (tileID >= 0x0800 && tileID < 0x0B00)
-	{
-		onTileA1(reader, tileID, x, y);
-		return;
-	}
+		return classifyA1(tileID);
 
 	/* A2 */
 	if (tileID >= 0x0B00 && tileID < 0x1100)
-	{
-		onTileA2(reader, tileID, x, y, isTable);
-		return;
-	}
+		return classifyA2(tileID);
 
 	/* A3 */
-	if (tileID < 0x1700)
+	if (tileID >= 0x1100 && tileID < 0x1700)
+		return classifyA3(tileID);
+
+	/* A4 */
+	if (tileID >= 0x1700 && tileID < tileIDMax)
+		return classifyA4(tileID);
+
+	return makeInfo(TileNone, 0, Vec2i());
+}
+
+/* Precomputed for every tile ID, so that reading a cell comes
+ * down to one lookup and a switch on its kind. Defined after
+ * (and thus constructed after) the blit tables it depends on */
+struct TileInfoTable
+{
+	TileInfo info[tileIDMax];
+
+	TileInfoTable()
 	{
-		onTileA3(reader, tileID, x, y);
-		return;
+		for (int i = 0; i < tileIDMax; ++i)
+			info[i] = classify(i);
 	}
+};
 
-	/* A4 */
-	if (tileID < 0x2000)
+static const TileInfoTable tileInfo;
+
+static void
+onSingleTile(Reader &reader, const Vec2i &orig,
+             int x, int y, bool overPlayer)
+{
+	FloatRect tex(orig.x*32+0.5, orig.y*32+0.5, 31, 31);
+	FloatRect pos(x*32, y*32, 32, 32);
+
+	reader.onQuads(&tex, &pos, 1, overPlayer);
+}
+
+static void
+onTile(Reader &reader, int16_t tileID, const TileInfo &info,
+       int x, int y, int16_t flag)
+{
+	const Vec2i orig(info.origX, info.origY);
+	bool isTable;
+
+	switch (info.kind)
 	{
-		onTileA4(reader, tileID, x, y);
+	case TileSingle :
+		onSingleTile(reader, orig, x, y, flag & OVER_PLAYER_FLAG);
+		return;
+
+	case TileAutotileA :
+		readAutotileA(reader, info.patternID, orig, x, y);
+		return;
+
+	case TileAutotileA2 :
+		/* The table autotile handling isn't 100% accurate;
+		 * for that, we'd need to prerender layer 1 into a separate
+		 * temp texture with blending turned off and render that
+		 * to the screen. But in 99% of cases it shouldn't matter */
+		if (rgssVer >= 3)
+			isTable = flag & TABLE_FLAG;
+		else
+			isTable = (tileID - 0x0B00) % (8 * 0x30) >= (7 * 0x30);
+
+		if (isTable)
+			readAutotileA2(reader, info.patternID, orig, x, y);
+		else
+			readAutotileA(reader, info.patternID, orig, x, y);
+		return;
+
+	case TileAutotileB :
+		readAutotileB(reader, info.patternID, orig, x, y);
+		return;
+
+	case TileAutotileC :
+		readAutotileC(reader, info.patternID, orig, x, y);
 		return;
 	}
 }
 
+/* Returns the 'w' values of layer 'z' in map row 'y' starting
+ * at column 'x', wrapped around the map edges. Spans inside the
+ * map are read in place; only those crossing its left or right
+ * edge are gathered into 'buf' with per cell wrapping */
+static const int16_t *
+tableRow(const Table &t, int x, int y, int z, int w,
+         std::vector<int16_t> &buf)
+{
+	y = wrap(y, t.ySize());
+
+	if (x >= 0 && x + w <= t.xSize())
+		return &t.at(x, y, z);
+
+	buf.resize(w);
+
+	for (int i = 0; i < w; ++i)
+		buf[i] = t.at(wrap(x+i, t.xSize()), y, z);
+
+	return dataPtr(buf);
+}
+
 static void
 readLayer(Reader &reader, const Table &data,
           const Table *flags, int ox, int oy, int w, int h, int z)
 {
+	const int16_t *flagData = flags ? flags->rawData() : 0;
+	const int flagsN = flags ? flags->xSize() : 0;
+
+	std::vector<int16_t> rowBuf;
+
 	/* The table autotile pattern (A2) has two quads (table
 	 * legs, etc.) which extend over the tile below. We process
 	 * the tiles in rows from bottom to top so the table extents
 	 * are added after the tile below and drawn over it. */
 
 	for (int y = h-1; y >= 0; --y)
+	{
+		const int16_t *row = tableRow(data, ox, y+oy, z, w, rowBuf);
+
 		for (int x = 0; x < w; ++x)
 		{
-			int16_t tileID = tableGetWrapped(data, x+ox, y+oy, z);
+			const int16_t tileID = row[x];
 
-			if (tileID <= 0)
+			if (tileID <= 0 || tileID >= tileIDMax)
 				continue;
 
-			onTile(reader, tileID, x, y, flags);
+			const TileInfo &info = tileInfo.info[tileID];
+
+			if (info.kind == TileNone)
+				continue;
+
+			const int16_t flag = tileID < flagsN ? flagData[tileID] : 0;
+
+			onTile(reader, tileID, info, x, y, flag);
 		}
+	}
 }
 
 static void
@@ -631,36 +725,49 @@ onShadowTile(Reader &reader, int8_t value,
 	if (value == 0)
 		return;
 
-	int oy = value;
-
-	FloatRect tex((shadowArea.x)*32+0.5, (shadowArea.y+oy)*32+0.5, 31, 31);
-	FloatRect pos(x*32, y*32, 32, 32);
-
-	reader.onQuads(&tex, &pos, 1, false);
+	onSingleTile(reader, Vec2i(shadowArea.x, shadowArea.y+value), x, y, false);
 }
 
 static void
 readShadowLayer(Reader &reader, const Table &data,
                 int ox, int oy, int w, int h)
 {
+	std::vector<int16_t> rowBuf;
+
 	for (int y = 0; y < h; ++y)
+	{
+		const int16_t *row = tableRow(data, ox, y+oy, 3, w, rowBuf);
+
 		for (int x = 0; x < w; ++x)
-		{
-			int16_t value = tableGetWrapped(data, x+ox, y+oy, 3);
-			onShadowTile(reader, value & 0xF, x, y);
-		}
+			onShadowTile(reader, row[x] & 0xF, x, y);
+	}
 }
 
 void readTiles(Reader &reader, const Table &data,
                const Table *flags, int ox, int oy, int w, int h)
 {
-	for (int i = 0; i < 2; ++i)
-		readLayer(reader, data, flags, ox, oy, w, h, i);
-
-	if (rgssVer >= 3)
-		readShadowLayer(reader, data, ox, oy, w, h);
+	for (int i = 0; i < passCount; ++i)
+		readPass(reader, data, flags, ox, oy, w, h, i);
+}
 
-	readLayer(reader, data, flags, ox, oy, w, h, 2);
+void readPass(Reader &reader, const Table &data,
+              const Table *flags, int ox, int oy, int w, int h,
+              int pass)
+{
+	switch (pass)
+	{
+	case 0:
+	case 1:
+		readLayer(reader, data, flags, ox, oy, w, h, pass);
+		return;
+	case 2:
+		if (rgssVer >= 3)
+			readShadowLayer(reader, data, ox, oy, w, h);
+		return;
+	case 3:
+		readLayer(reader, data, flags, ox, oy, w, h, 2);
+		return;
+	}
 }
 
 }
@@ -60,6 +60,16 @@ void build(TEXFBO &tf, Bitmap *bitmaps[BM_COUNT]);
 
 void readTiles(Reader &reader, const Table &data,
                const Table *flags, int ox, int oy, int w, int h);
+
+/* readTiles() makes this many passes over the map area,
+ * and all quads of one pass belong over those of the
+ * previous ones, regardless of their position */
+static const int passCount = 4;
+
+/* Reads only the tiles of pass 'pass' */
+void readPass(Reader &reader, const Table &data,
+              const Table *flags, int ox, int oy, int w, int h,
+              int pass);
 }
 
 #endif // TILEATLASVX_H
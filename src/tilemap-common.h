@@ -31,11 +31,14 @@
 #include "shader.h"
 #include "vertex.h"
 #include "quad.h"
+#include "quadarray.h"
+#include "scene.h"
 #include "etc-internal.h"
 
 #include <stdint.h>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
 
 #include <sigc++/connection.h>
 
@@ -110,25 +113,139 @@ atSelectSubPos(FloatRect &pos, int i)
 	}
 }
 
+/* Toroidal cache of the vertices generated for each map
+ * tile inside the map viewport. Cells are addressed by map
+ * position modulo the ring size, so when the viewport
+ * scrolls, only the newly exposed row/column of tiles has to
+ * be generated again; all other cells are reused as is.
+ * Vertex positions are kept relative to their cell, and
+ * every cell sorts its quads into 'binCount' bins (eg. one
+ * per zlayer priority), each keeping the generation order */
+template<size_t binCount>
+struct TileRing
+{
+	struct Cell
+	{
+		Vec2i pos;
+		bool valid;
+		std::vector<SVertex> bins[binCount];
+	};
+
+	TileRing()
+	    : w(0), h(0)
+	{}
+
+	void resize(int width, int height)
+	{
+		if (width == w && height == h)
+			return;
+
+		w = width;
+		h = height;
+		cells.clear();
+		cells.resize(w * h);
+
+		invalidate();
+	}
+
+	/* Forces all cells to be generated again */
+	void invalidate()
+	{
+		for (size_t i = 0; i < cells.size(); ++i)
+			cells[i].valid = false;
+	}
+
+	/* Forces the cells showing map tile 'pos' to be generated
+	 * again. As the map wraps around, a small map's tile may
+	 * be visible multiple times */
+	void invalidateTile(const Vec2i &pos, const Vec2i &mapSize)
+	{
+		for (size_t i = 0; i < cells.size(); ++i)
+		{
+			Cell &cell = cells[i];
+
+			if (wrap(cell.pos.x, mapSize.x) == pos.x &&
+			    wrap(cell.pos.y, mapSize.y) == pos.y)
+				cell.valid = false;
+		}
+	}
+
+	/* Whether get() would hand out the cell
+	 * for 'pos' as 'fresh' */
+	bool isStale(const Vec2i &pos) const
+	{
+		const Cell &cell = cells[wrap(pos.y, h) * w + wrap(pos.x, w)];
+
+		return !cell.valid || cell.pos != pos;
+	}
+
+	/* Returns the cell holding map tile 'pos'. If it doesn't
+	 * hold up to date vertices for it, it's emptied and 'fresh'
+	 * is set, and the caller has to fill in the bins */
+	Cell &get(const Vec2i &pos, bool &fresh)
+	{
+		Cell &cell = cells[wrap(pos.y, h) * w + wrap(pos.x, w)];
+		fresh = !cell.valid || cell.pos != pos;
+
+		if (fresh)
+		{
+			for (size_t i = 0; i < binCount; ++i)
+				cell.bins[i].clear();
+
+			cell.pos = pos;
+			cell.valid = true;
+		}
+
+		return cell;
+	}
+
+	/* Appends the vertices of 'bin' to 'out', moved by 'offset' */
+	static void append(std::vector<SVertex> &out,
+	                   const std::vector<SVertex> &bin,
+	                   const Vec2 &offset)
+	{
+		if (bin.empty())
+			return;
+
+		size_t base = out.size();
+		out.resize(base + bin.size());
+
+		for (size_t i = 0; i < bin.size(); ++i)
+		{
+			out[base+i] = bin[i];
+			out[base+i].pos.x += offset.x;
+			out[base+i].pos.y += offset.y;
+		}
+	}
+
+private:
+	int w, h;
+	std::vector<Cell> cells;
+};
+
+/* Flash colors are kept in a texture holding one texel
+ * per map tile, which is drawn over the viewport with a
+ * handful of quads (one per repetition of the wrapped map).
+ * Changing a single tile only updates its texel */
 struct FlashMap
 {
 	FlashMap()
-		: dirty(false),
+		: dataDirty(false),
+	      geomDirty(false),
 	      data(0),
-	      allocQuads(0)
+	      flashCount(0)
 	{
-		vao.vbo = VBO::gen();
-		vao.ibo = shState->globalIBO().ibo;
-		GLMeta::vaoFillInVertexData<CVertex>(vao);
-
-		GLMeta::vaoInit(vao);
+		tex = TEX::gen();
+		TEX::bind(tex);
+		TEX::setRepeat(false);
+		TEX::setSmooth(false);
 	}
 
 	~FlashMap()
 	{
-		GLMeta::vaoFini(vao);
-		VBO::del(vao.vbo);
+		TEX::del(tex);
 		dataCon.disconnect();
+		dataCellCon.disconnect();
 	}
 
 	Table *getData() const
@@ -143,136 +260,212 @@ struct FlashMap
 
 		data = value;
 		dataCon.disconnect();
-		dirty = true;
+		dataCellCon.disconnect();
+		dataDirty = true;
+		Scene::markDirty();
 
 		if (!data)
 			return;
 
 		dataCon = data->modified.connect
 			(sigc::mem_fun(this, &FlashMap::setDirty));
+		dataCellCon = data->cellModified.connect
+			(sigc::mem_fun(this, &FlashMap::onCellModified));
 	}
 
 	void setViewport(const IntRect &value)
 	{
 		viewp = value;
-		dirty = true;
+		geomDirty = true;
+	}
+
+	/* Whether any tiles may be flashing */
+	bool active() const
+	{
+		return dataDirty || flashCount > 0;
 	}
 
 	void prepare()
 	{
-		if (!dirty)
-			return;
+		if (dataDirty)
+		{
+			uploadTexture();
+			dataDirty = false;
+		}
 
-		rebuildBuffer();
-		dirty = false;
+		if (geomDirty)
+		{
+			rebuildQuads();
+			geomDirty = false;
+		}
 	}
 
 	void draw(float alpha, const Vec2i &trans)
 	{
-		const size_t count = quadCount();
-
-		if (count == 0)
+		if (flashCount == 0 || quads.count() == 0)
 			return;
 
-		GLMeta::vaoBind(vao);
 		glState.blendMode.pushSet(BlendAddition);
 
-		FlashMapShader &shader = shState->shaders().flashMap;
+		FlashMapShader &shader = shState->shaders().flashMap();
 		shader.bind();
 		shader.applyViewportProj();
 		shader.setAlpha(alpha);
 		shader.setTranslation(trans);
+		shader.setTexSize(texSize);
 
-		gl.DrawElements(GL_TRIANGLES, count * 6, _GL_INDEX_TYPE, 0);
+		TEX::bind(tex);
 
-		glState.blendMode.pop();
+		quads.draw();
 
-		GLMeta::vaoUnbind(vao);
+		glState.blendMode.pop();
 	}
 
 private:
 	void setDirty()
 	{
-		dirty = true;
+		dataDirty = true;
+		Scene::markDirty();
 	}
 
-	size_t quadCount() const
+	/* Only the texel of the modified tile is uploaded */
+	void onCellModified(int x, int y, int)
 	{
-		return vertices.size() / 4;
-	}
+		Scene::markDirty();
 
-	bool sampleFlashColor(Vec4 &out, int x, int y) const
-	{
-		int16_t packed = tableGetWrapped(*data, x, y);
+		if (dataDirty)
+			return;
 
-		if (packed == 0)
-			return false;
+		if (x >= texSize.x || y >= texSize.y)
+		{
+			dataDirty = true;
+			return;
+		}
 
-		const float max = 0xF;
+		uint8_t *texel = &texels[(y*texSize.x + x)*4];
+		flashCount -= (texel[3] != 0);
+		sampleTexel(texel, x, y);
+		flashCount += (texel[3] != 0);
 
-		float b = ((packed & 0x000F) >> 0) / max;
-		float g = ((packed & 0x00F0) >> 4) / max;
-		float r = ((packed & 0x0F00) >> 8) / max;
+		TEX::bind(tex);
+		TEX::uploadSubImage(x, y, 1, 1, texel, GL_RGBA);
+	}
 
-		out = Vec4(r, g, b, 1);
+	/* Black for tiles that don't flash, which the additive
+	 * blending leaves unchanged; alpha marks flashing tiles */
+	void sampleTexel(uint8_t *texel, int x, int y) const
+	{
+		int16_t packed = data->get(x, y);
 
-		return true;
+		/* Expand 4 bit channels to 8 bit */
+		texel[0] = ((packed & 0x0F00) >> 8) * 0x11;
+		texel[1] = ((packed & 0x00F0) >> 4) * 0x11;
+		texel[2] = ((packed & 0x000F) >> 0) * 0x11;
+		texel[3] = packed != 0 ? 0xFF : 0;
 	}
 
-	void rebuildBuffer()
+	void uploadTexture()
 	{
-		vertices.clear();
+		flashCount = 0;
 
-		if (!data)
+		Vec2i size;
+
+		if (data)
+			size = Vec2i(data->xSize(), data->ySize());
+
+		/* Texture coordinates depend on the map size */
+		if (size != texSize)
+			geomDirty = true;
+
+		texSize = size;
+		texels.resize(size.x * size.y * 4);
+
+		if (texels.empty())
 			return;
 
-		for (int x = 0; x < viewp.w; ++x)
-			for (int y = 0; y < viewp.h; ++y)
+		for (int y = 0; y < size.y; ++y)
+			for (int x = 0; x < size.x; ++x)
 			{
-				Vec4 color;
+				uint8_t *texel = &texels[(y*size.x + x)*4];
+				sampleTexel(texel, x, y);
+				flashCount += (texel[3] != 0);
+			}
 
-				if (!sampleFlashColor(color, x+viewp.x, y+viewp.y))
-					continue;
+		TEX::bind(tex);
+		TEX::uploadImage(size.x, size.y, dataPtr(texels), GL_RGBA);
+	}
 
-				FloatRect posRect(x*32, y*32, 32, 32);
+	/* Splits 'len' cells starting at the (unwrapped) map
+	 * coordinate 'start' into runs that don't wrap around */
+	static void splitWrapped(int start, int len, int range,
+	                         std::vector<Vec2i> &runs)
+	{
+		runs.clear();
+		int src = wrap(start, range);
 
-				CVertex v[4];
-				Quad::setPosRect(v, posRect);
-				Quad::setColor(v, color);
+		while (len > 0)
+		{
+			int run = std::min(len, range - src);
+			runs.push_back(Vec2i(src, run));
 
-				for (size_t i = 0; i < 4; ++i)
-					vertices.push_back(v[i]);
-			}
+			len -= run;
+			src = 0;
+		}
+	}
 
-		if (vertices.size() == 0)
+	void rebuildQuads()
+	{
+		quads.clear();
+
+		if (texSize.x == 0 || texSize.y == 0)
 			return;
 
-		VBO::bind(vao.vbo);
+		std::vector<Vec2i> runsX, runsY;
+		splitWrapped(viewp.x, viewp.w, texSize.x, runsX);
+		splitWrapped(viewp.y, viewp.h, texSize.y, runsY);
+
+		quads.resize(runsX.size() * runsY.size());
+
+		size_t i = 0;
+		int posY = 0;
 
-		if (quadCount() > allocQuads)
+		for (size_t y = 0; y < runsY.size(); ++y)
 		{
-			allocQuads = quadCount();
-			VBO::allocEmpty(sizeof(CVertex) * vertices.size());
-		}
+			int posX = 0;
+
+			for (size_t x = 0; x < runsX.size(); ++x)
+			{
+				/* Texture coordinates are in tiles */
+				FloatRect texRect(runsX[x].x, runsY[y].x, runsX[x].y, runsY[y].y);
+				FloatRect posRect(posX*32, posY*32, runsX[x].y*32, runsY[y].y*32);
 
-		VBO::uploadSubData(0, sizeof(CVertex) * vertices.size(), dataPtr(vertices));
+				Quad::setTexPosRect(&quads.vertices[i++*4], texRect, posRect);
+				posX += runsX[x].y;
+			}
 
-		VBO::unbind();
+			posY += runsY[y].y;
+		}
 
-		/* Ensure global IBO size */
-		shState->ensureQuadIBO(quadCount());
+		quads.commit();
 	}
 
-	bool dirty;
+	bool dataDirty;
+	bool geomDirty;
 
 	Table *data;
 	sigc::connection dataCon;
+	sigc::connection dataCellCon;
 
 	IntRect viewp;
 
-	GLMeta::VAO vao;
-	size_t allocQuads;
-	std::vector<CVertex> vertices;
+	TEX::ID tex;
+	Vec2i texSize;
+
+	/* Shadow copy of the texture contents */
+	std::vector<uint8_t> texels;
+	int flashCount;
+
+	SimpleQuadArray quads;
 };
 
 #endif // TILEMAPCOMMON_H
@@ -36,8 +36,13 @@
 #include "texpool.h"
 #include "quad.h"
 #include "vertex.h"
+#include "tilevbo.h"
 #include "tileatlas.h"
+#include "atlascache.h"
 #include "tilemap-common.h"
+#include "profiler.h"
+#include "workerpool.h"
+#include "scenecapture.h"
 
 #include <sigc++/connection.h>
 
@@ -63,12 +68,52 @@ static const int atAreaH = autotileH * autotileCount;
 
 static const int tsLaneW = tilesetW / 2;
 
+/* Vertices of the four pieces of each of the 48 autotile
+ * patterns, positioned relative to the tile and textured
+ * from the first autotile in the atlas. Generated once from
+ * 'autotileRects', so building an autotile cell comes down
+ * to a copy plus the vertical atlas offset of its autotile */
+struct AutotileTemplates
+{
+	SVertex vert[48][16];
+
+	AutotileTemplates()
+	{
+		for (int sub = 0; sub < 48; ++sub)
+			for (int i = 0; i < 4; ++i)
+			{
+				FloatRect posRect(0, 0, 16, 16);
+				atSelectSubPos(posRect, i);
+
+				FloatRect texRect = autotileRects[sub*4+i];
+				Quad::setTexPosRect(&vert[sub][i*4], texRect, posRect);
+			}
+	}
+};
+
+static const AutotileTemplates autotileTemplates;
+
 /* Map viewport size */
 static const int viewpW = 21;
 static const int viewpH = 16;
 
 static const size_t zlayersMax = viewpH + 5;
 
+/* Highest tile priority */
+static const int prioritiesMax = 5;
+
+/* Single tile changes to a baked map that are patched
+ * in place, before rebaking it as a whole is cheaper */
+static const size_t maxDirtyTiles = 256;
+
+typedef TileRing<prioritiesMax+1> TileCells;
+
+/* Viewport rows are generated in this many bands, spread
+ * over the worker pool, once at least 'tileBandMinFresh'
+ * cells need to be generated from scratch */
+static const int tileBands = 4;
+static const int tileBandMinFresh = viewpW * 4;
+
 /* Vocabulary:
  *
  * Atlas: A texture containing both the tileset and all
@@ -149,9 +194,16 @@ static const size_t zlayersMax = viewpH + 5;
  *   This rectangle describes the subregion of the map that is
  *   actually translated to vertices and stored on the GPU ready
  *   for rendering. Whenever, ox/oy are modified, its position is
- *   adjusted if necessary and the data is regenerated. Its size
+ *   adjusted if necessary and the data is regenerated. Only the
+ *   tiles newly entering it are translated again, the rest is
+ *   reused from a ring of per-tile vertex cells. Its size
  *   is fixed. This is NOT related to the RGSS Viewport class!
  *
+ * Baked map:
+ *   Maps small enough are translated in their entirety once
+ *   instead, and the map viewport then merely selects which
+ *   ranges of the buffer are drawn.
+ *
  */
 
 /* Autotile animation */
@@ -191,14 +243,30 @@ struct GroundLayer : public ViewportElement
 	void drawInt();
 
 	void onGeometryChange(const Scene::Geometry &geo);
+	void capture(SceneCapture &c);
 
 	ABOUT_TO_ACCESS_NOOP
 };
 
+/* Works on the viewport rows ['y1', 'y2') during a
+ * banded quad array rebuild (see 'buildQuadArray()') */
+struct TileBandJob : public WorkerJob
+{
+	TilemapPrivate *p;
+	int y1, y2;
+
+	/* Generates fresh cells first, and then
+	 * copies the cell vertices to their place */
+	bool emit;
+
+	void run();
+};
+
 struct ZLayer : public ViewportElement
 {
 	size_t index;
-	GLintptr vboOffset;
+	/* In quads; the counts are in indices */
+	size_t vboOffset;
 	GLsizei vboCount;
 	TilemapPrivate *p;
 
@@ -210,6 +278,10 @@ struct ZLayer : public ViewportElement
 	 * holds the element count of the entire batch */
 	GLsizei vboBatchCount;
 
+	/* Position in the list of active layers,
+	 * which is also their display order */
+	size_t slot;
+
 	ZLayer(TilemapPrivate *p, Viewport *viewport);
 
 	void setIndex(int value);
@@ -227,6 +299,7 @@ struct ZLayer : public ViewportElement
 
 struct TilemapPrivate
 {
+	Tilemap *self;
 	Viewport *viewport;
 
 	Bitmap *autotiles[autotileCount];
@@ -256,6 +329,9 @@ struct TilemapPrivate
 
 		/* Indices of animated autotiles */
 		std::vector<uint8_t> animatedATs;
+
+		/* What 'gl' was built from */
+		AtlasKey key;
 	} atlas;
 
 	/* Map viewport position */
@@ -271,11 +347,64 @@ struct TilemapPrivate
 	 * in the shared buffer */
 	size_t zlayerBases[zlayersMax+1];
 
+	/* Vertices of every tile in the map viewport,
+	 * binned by priority (bin 0 is the ground layer) */
+	TileCells tileCells;
+
+	/* Banded rebuild state: the cell at each viewport tile
+	 * [y*viewpW+x], and where its bins go in 'groundVert'
+	 * (bin 0) and the zlayers (bin n, zlayer y+n) */
+	struct
+	{
+		TileCells::Cell *cell;
+		size_t base[prioritiesMax+1];
+	} bandCells[viewpW*viewpH];
+
+	TileBandJob bandJobs[tileBands];
+
+	/* Whole map geometry, generated once instead of per map
+	 * viewport position (see 'bakeMap()'). Quads are stored
+	 * first per ground row, then per zlayer of the map, each
+	 * sorted by column so that any visible column span is a
+	 * contiguous index range */
+	struct
+	{
+		/* Geometry is valid and in use */
+		bool active;
+
+		/* Map size the geometry was generated for */
+		int w, h;
+
+		/* Quad index of the first tile in column x of ground
+		 * row (or zlayer) y at [y*(w+1)+x]; the extra column
+		 * holds the end of the row */
+		std::vector<size_t> groundCols;
+		std::vector<size_t> zlayerCols;
+
+		/* Quad count of each bin of every tile, at
+		 * [(y*w+x)*(prioritiesMax+1)+bin] */
+		std::vector<size_t> binQuads;
+	} baked;
+
+	/* Ground layer drawn straight from textures holding the
+	 * atlas location of every tile piece (see 'buildIndexedMap()'),
+	 * instead of from vertices */
+	struct
+	{
+		bool active;
+
+		/* One map texture per map layer (z) */
+		std::vector<TEX::ID> tex;
+
+		/* Covers the map viewport */
+		Quad quad;
+	} indexed;
+
 	/* Shared buffers for all tiles */
 	struct
 	{
-		GLMeta::VAO vao;
-		VBO::ID vbo;
+		TileVBO buffer;
+		size_t allocQuads;
 		bool animated;
 
 		/* Animation state */
@@ -283,6 +412,20 @@ struct TilemapPrivate
 		uint8_t aniIdx;
 	} tiles;
 
+	/* With depth merging, all zlayer tiles tagged with their
+	 * layer's slot, drawn at once when the first layer comes
+	 * up; everything composited until the last layer is then
+	 * depth tested against them */
+	struct
+	{
+		bool enabled;
+		GLMeta::VAO vao;
+		VBO::ID vbo;
+		size_t allocQuads;
+		size_t quadCount;
+		std::vector<Vertex> vert;
+	} depthTiles;
+
 	FlashMap flashMap;
 	uint8_t flashAlphaIdx;
 
@@ -302,6 +445,10 @@ struct TilemapPrivate
 	bool atlasDirty;
 	/* Affected by: mapData(.changed), priorities(.changed) */
 	bool buffersDirty;
+	/* Affected by: mapData(.changed), priorities(.changed), allocateAtlas */
+	bool bakeDirty;
+	/* Changed single tiles of the baked map. Affected by: mapData(.cellChanged) */
+	std::vector<Vec2i> dirtyTiles;
 	/* Affected by: ox, oy */
 	bool mapViewportDirty;
 	/* Affected by: oy */
@@ -314,7 +461,9 @@ struct TilemapPrivate
 	sigc::connection tilesetCon;
 	sigc::connection autotilesCon[autotileCount];
 	sigc::connection mapDataCon;
+	sigc::connection mapDataCellCon;
 	sigc::connection prioritiesCon;
+	sigc::connection prioritiesCellCon;
 
 	/* Dispose watches */
 	sigc::connection autotilesDispCon[autotileCount];
@@ -322,8 +471,9 @@ struct TilemapPrivate
 	/* Draw prepare call */
 	sigc::connection prepareCon;
 
-	TilemapPrivate(Viewport *viewport)
-	    : viewport(viewport),
+	TilemapPrivate(Tilemap *self, Viewport *viewport)
+	    : self(self),
+	      viewport(viewport),
 	      tileset(0),
 	      mapData(0),
 	      priorities(0),
@@ -332,32 +482,51 @@ struct TilemapPrivate
 	      atlasSizeDirty(false),
 	      atlasDirty(false),
 	      buffersDirty(false),
+	      bakeDirty(false),
 	      mapViewportDirty(false),
 	      zOrderDirty(false),
 	      tilemapReady(false)
 	{
 		memset(autotiles, 0, sizeof(autotiles));
+		memset(zlayerBases, 0, sizeof(zlayerBases));
 
 		atlas.animatedATs.reserve(autotileCount);
 		atlas.efTilesetH = 0;
 
+		tiles.allocQuads = 0;
 		tiles.animated = false;
+
+		baked.active = false;
+		baked.w = baked.h = 0;
+
+		indexed.active = false;
 		tiles.frameIdx = 0;
 		tiles.aniIdx = 0;
 
-		/* Init tile buffers */
-		tiles.vbo = VBO::gen();
+		depthTiles.enabled = shState->config().tilemapDepthMerge;
+		depthTiles.allocQuads = 0;
+		depthTiles.quadCount = 0;
+
+		if (depthTiles.enabled)
+		{
+			depthTiles.vbo = VBO::gen();
 
-		GLMeta::vaoFillInVertexData<SVertex>(tiles.vao);
-		tiles.vao.vbo = tiles.vbo;
-		tiles.vao.ibo = shState->globalIBO().ibo;
+			GLMeta::vaoFillInVertexData<Vertex>(depthTiles.vao);
+			depthTiles.vao.vbo = depthTiles.vbo;
+			depthTiles.vao.ibo = shState->globalIBO().ibo;
 
-		GLMeta::vaoInit(tiles.vao);
+			GLMeta::vaoInit(depthTiles.vao);
+		}
+
+		tileCells.resize(viewpW, viewpH);
 
 		elem.ground = new GroundLayer(this, viewport);
 
 		for (size_t i = 0; i < zlayersMax; ++i)
+		{
 			elem.zlayers[i] = new ZLayer(this, viewport);
+			elem.zlayers[i]->slot = i;
+		}
 
 		prepareCon = shState->prepareDraw.connect
 		        (sigc::mem_fun(this, &TilemapPrivate::prepare));
@@ -372,11 +541,15 @@ struct TilemapPrivate
 		for (size_t i = 0; i < zlayersMax; ++i)
 			delete elem.zlayers[i];
 
-		shState->releaseAtlasTex(atlas.gl);
+		shState->atlasCache().release(atlas.gl, atlas.key);
+		releaseIndexedMap();
 
 		/* Destroy tile buffers */
-		GLMeta::vaoFini(tiles.vao);
-		VBO::del(tiles.vbo);
+		if (depthTiles.enabled)
+		{
+			GLMeta::vaoFini(depthTiles.vao);
+			VBO::del(depthTiles.vbo);
+		}
 
 		/* Disconnect signal handlers */
 		tilesetCon.disconnect();
@@ -386,7 +559,9 @@ struct TilemapPrivate
 			autotilesDispCon[i].disconnect();
 		}
 		mapDataCon.disconnect();
+		mapDataCellCon.disconnect();
 		prioritiesCon.disconnect();
+		prioritiesCellCon.disconnect();
 
 		prepareCon.disconnect();
 	}
@@ -427,7 +602,7 @@ struct TilemapPrivate
 			if (nullOrDisposed(autotiles[i]))
 				continue;
 
-			if (autotiles[i]->megaSurface())
+			if (autotiles[i]->isMega())
 				continue;
 
 			usableATs.push_back(i);
@@ -445,18 +620,61 @@ struct TilemapPrivate
 		mapViewportDirty = true;
 	}
 
+	/* All layers share the tilemap's viewport */
+	void markSceneDirty()
+	{
+		elem.ground->markSceneDirty();
+	}
+
 	void invalidateAtlasSize()
 	{
 		atlasSizeDirty = true;
+		markSceneDirty();
 	}
 
 	void invalidateAtlasContents()
 	{
 		atlasDirty = true;
+		markSceneDirty();
 	}
 
 	void invalidateBuffers()
 	{
+		tileCells.invalidate();
+		buffersDirty = true;
+		bakeDirty = true;
+		dirtyTiles.clear();
+		markSceneDirty();
+	}
+
+	/* A single priority can affect any number of tiles */
+	void invalidatePriority(int, int, int)
+	{
+		invalidateBuffers();
+	}
+
+	void invalidateTile(int x, int y, int)
+	{
+		const Vec2i pos(x, y);
+
+		markSceneDirty();
+
+		tileCells.invalidateTile(pos, Vec2i(mapData->xSize(), mapData->ySize()));
+
+		if (indexed.active && !bakeDirty)
+			updateIndexedTile(pos);
+
+		/* The baked geometry is patched in place if possible */
+		if (baked.active && !bakeDirty)
+		{
+			if (dirtyTiles.size() < maxDirtyTiles)
+				dirtyTiles.push_back(pos);
+			else
+				invalidateBuffers();
+
+			return;
+		}
+
 		buffersDirty = true;
 	}
 
@@ -472,23 +690,43 @@ struct TilemapPrivate
 		return true;
 	}
 
-	/* Allocates correctly sized TexFBO for atlas */
+	/* Determines the atlas layout for the current tileset */
 	void allocateAtlas()
 	{
 		updateAtlasInfo();
 
-		/* Aquire atlas tex */
-		shState->releaseAtlasTex(atlas.gl);
-		shState->requestAtlasTex(atlas.size.x, atlas.size.y, atlas.gl);
-
 		atlasDirty = true;
+
+		/* Tile texcoords depend on the atlas layout */
+		invalidateBuffers();
 	}
 
-	/* Assembles atlas from tileset and autotile bitmaps */
-	void buildAtlas()
+	/* Takes an atlas matching the current tileset and autotiles
+	 * from the atlas cache, or assembles a new one */
+	void acquireAtlas()
 	{
 		updateAutotileInfo();
 
+		AtlasKey key;
+		key.layout = AtlasKey::TilemapLayout;
+		key.width = atlas.size.x;
+		key.height = atlas.size.y;
+
+		key.addBitmap(tileset);
+		for (int i = 0; i < autotileCount; ++i)
+			key.addBitmap(autotiles[i]);
+
+		AtlasCache &cache = shState->atlasCache();
+		cache.release(atlas.gl, atlas.key);
+		atlas.key = key;
+
+		if (!cache.request(key, atlas.gl))
+			buildAtlas();
+	}
+
+	/* Assembles atlas from tileset and autotile bitmaps */
+	void buildAtlas()
+	{
 		TileAtlas::BlitVec blits = TileAtlas::calcBlits(atlas.efTilesetH, atlas.size);
 
 		/* Clear atlas */
@@ -532,67 +770,22 @@ struct TilemapPrivate
 		GLMeta::blitEnd();
 
 		/* Blit tileset */
-		if (tileset->megaSurface())
+		GLMeta::blitBegin(atlas.gl);
+
+		if (tileset->isMega())
 		{
 			/* Mega surface tileset */
-			SDL_Surface *tsSurf = tileset->megaSurface();
-
-			if (shState->config().subImageFix)
-			{
-				/* Implementation for broken GL drivers */
-				FBO::bind(atlas.gl.fbo);
-				glState.blend.pushSet(false);
-				glState.viewport.pushSet(IntRect(0, 0, atlas.size.x, atlas.size.y));
-
-				SimpleShader &shader = shState->shaders().simple;
-				shader.bind();
-				shader.applyViewportProj();
-				shader.setTranslation(Vec2i());
-
-				Quad &quad = shState->gpQuad();
-
-				for (size_t i = 0; i < blits.size(); ++i)
-				{
-					const TileAtlas::Blit &blitOp = blits[i];
-
-					Vec2i texSize;
-					shState->ensureTexSize(tsLaneW, blitOp.h, texSize);
-					shState->bindTex();
-					GLMeta::subRectImageUpload(tsSurf->w, blitOp.src.x, blitOp.src.y,
-					                           0, 0, tsLaneW, blitOp.h, tsSurf, GL_RGBA);
-
-					shader.setTexSize(texSize);
-					quad.setTexRect(FloatRect(0, 0, tsLaneW, blitOp.h));
-					quad.setPosRect(FloatRect(blitOp.dst.x, blitOp.dst.y, tsLaneW, blitOp.h));
-
-					quad.draw();
-				}
-
-				GLMeta::subRectImageEnd();
-				glState.viewport.pop();
-				glState.blend.pop();
-			}
-			else
+			for (size_t i = 0; i < blits.size(); ++i)
 			{
-				/* Clean implementation */
-				TEX::bind(atlas.gl.tex);
-
-				for (size_t i = 0; i < blits.size(); ++i)
-				{
-					const TileAtlas::Blit &blitOp = blits[i];
-
-					GLMeta::subRectImageUpload(tsSurf->w, blitOp.src.x, blitOp.src.y,
-					                           blitOp.dst.x, blitOp.dst.y, tsLaneW, blitOp.h, tsSurf, GL_RGBA);
-				}
+				const TileAtlas::Blit &blitOp = blits[i];
 
-				GLMeta::subRectImageEnd();
+				tileset->blitMega(IntRect(blitOp.src.x, blitOp.src.y, tsLaneW, blitOp.h),
+				                  IntRect(blitOp.dst.x, blitOp.dst.y, tsLaneW, blitOp.h));
 			}
-
 		}
 		else
 		{
 			/* Regular tileset */
-			GLMeta::blitBegin(atlas.gl);
 			GLMeta::blitSource(tileset->getGLTypes());
 
 			for (size_t i = 0; i < blits.size(); ++i)
@@ -602,9 +795,9 @@ struct TilemapPrivate
 				GLMeta::blitRectangle(IntRect(blitOp.src.x, blitOp.src.y, tsLaneW, blitOp.h),
 				                      blitOp.dst);
 			}
-
-			GLMeta::blitEnd();
 		}
+
+		GLMeta::blitEnd();
 	}
 
 	int samplePriority(int tileInd)
@@ -617,45 +810,40 @@ struct TilemapPrivate
 
 		int value = priorities->at(tileInd);
 
-		if (value > 5)
+		if (value > prioritiesMax)
 			return -1;
 
 		return value;
 	}
 
-	void handleAutotile(int x, int y, int tileInd, SVVector *array)
+	void handleAutotile(int tileInd, SVVector *array)
 	{
 		/* Which autotile [0-7] */
 		int atInd = tileInd / 48 - 1;
 		/* Which tile pattern of the autotile [0-47] */
 		int subInd = tileInd % 48;
 
-		const StaticRect *pieceRect = &autotileRects[subInd*4];
+		const SVertex *tmpl = autotileTemplates.vert[subInd];
 
-		/* Iterate over the 4 tile pieces */
-		for (int i = 0; i < 4; ++i)
-		{
-			FloatRect posRect(x*32, y*32, 16, 16);
-			atSelectSubPos(posRect, i);
+		size_t base = array->size();
+		array->resize(base + 16);
 
-			FloatRect texRect = pieceRect[i];
+		SVertex *v = &(*array)[base];
+		memcpy(v, tmpl, sizeof(autotileTemplates.vert[0]));
 
-			/* Adjust to atlas coordinates */
-			texRect.y += atInd * autotileH;
+		/* Adjust to atlas coordinates */
+		const float offsetY = atInd * autotileH;
 
-			SVertex v[4];
-			Quad::setTexPosRect(v, texRect, posRect);
-
-			/* Iterate over 4 vertices */
-			for (size_t i = 0; i < 4; ++i)
-				array->push_back(v[i]);
-		}
+		for (size_t i = 0; i < 16; ++i)
+			v[i].texPos.y += offsetY;
 	}
 
-	void handleTile(int x, int y, int z)
+	/* Generates the quads of one tile layer of the
+	 * map tile held by 'cell', relative to the cell */
+	void handleTile(TileCells::Cell &cell, int z)
 	{
 		int tileInd =
-			tableGetWrapped(*mapData, x + viewpPos.x, y + viewpPos.y, z);
+			tableGetWrapped(*mapData, cell.pos.x, cell.pos.y, z);
 
 		/* Check for empty space */
 		if (tileInd < 48)
@@ -667,23 +855,16 @@ struct TilemapPrivate
 		if (prio == -1)
 			return;
 
-		SVVector *targetArray;
+		/* Ground tiles are in the map textures */
+		if (prio == 0 && indexed.active)
+			return;
 
-		/* Prio 0 tiles are all part of the same ground layer */
-		if (prio == 0)
-		{
-			targetArray = &groundVert;
-		}
-		else
-		{
-			int layerInd = y + prio;
-			targetArray = &zlayerVert[layerInd];
-		}
+		SVVector *targetArray = &cell.bins[prio];
 
 		/* Check for autotile */
 		if (tileInd < 48*8)
 		{
-			handleAutotile(x, y, tileInd, targetArray);
+			handleAutotile(tileInd, targetArray);
 			return;
 		}
 
@@ -693,7 +874,7 @@ struct TilemapPrivate
 
 		Vec2i texPos = TileAtlas::tileToAtlasCoor(tileX, tileY, atlas.efTilesetH, atlas.size.y);
 		FloatRect texRect((float) texPos.x+0.5f, (float) texPos.y+0.5f, 31, 31);
-		FloatRect posRect(x*32, y*32, 32, 32);
+		FloatRect posRect(0, 0, 32, 32);
 
 		SVertex v[4];
 		Quad::setTexPosRect(v, texRect, posRect);
@@ -714,15 +895,147 @@ struct TilemapPrivate
 	{
 		clearQuadArrays();
 
+		if (shState->workerPool().enabled() && countStaleCells() >= tileBandMinFresh)
+		{
+			buildQuadArrayBanded();
+			return;
+		}
+
 		for (int x = 0; x < viewpW; ++x)
 			for (int y = 0; y < viewpH; ++y)
-				for (int z = 0; z < mapData->zSize(); ++z)
-					handleTile(x, y, z);
+			{
+				bool fresh;
+				TileCells::Cell &cell = tileCells.get(viewpPos + Vec2i(x, y), fresh);
+
+				if (fresh)
+					for (int z = 0; z < mapData->zSize(); ++z)
+						handleTile(cell, z);
+
+				const Vec2 offset(x*32, y*32);
+
+				/* Prio 0 tiles are all part of the same ground layer */
+				TileCells::append(groundVert, cell.bins[0], offset);
+
+				for (int prio = 1; prio <= prioritiesMax; ++prio)
+					TileCells::append(zlayerVert[y + prio], cell.bins[prio], offset);
+			}
+	}
+
+	int countStaleCells() const
+	{
+		int count = 0;
+
+		for (int y = 0; y < viewpH; ++y)
+			for (int x = 0; x < viewpW; ++x)
+				count += tileCells.isStale(viewpPos + Vec2i(x, y));
+
+		return count;
+	}
+
+	void runBands(bool emit)
+	{
+		WorkerPool &pool = shState->workerPool();
+
+		for (int i = 0; i < tileBands; ++i)
+		{
+			TileBandJob &job = bandJobs[i];
+			job.p = this;
+			job.y1 = viewpH * i / tileBands;
+			job.y2 = viewpH * (i+1) / tileBands;
+			job.emit = emit;
+		}
+
+		for (int i = 1; i < tileBands; ++i)
+			pool.submit(bandJobs[i]);
+
+		bandJobs[0].run();
+
+		for (int i = 1; i < tileBands; ++i)
+			pool.wait(bandJobs[i]);
+	}
+
+	/* Worker side of 'buildQuadArrayBanded()'. Bands cover
+	 * disjoint cells and vertex ranges, and only read the
+	 * map, priorities and atlas layout otherwise */
+	void runBand(int y1, int y2, bool emit)
+	{
+		for (int y = y1; y < y2; ++y)
+			for (int x = 0; x < viewpW; ++x)
+			{
+				if (!emit)
+				{
+					bool fresh;
+					TileCells::Cell &cell = tileCells.get(viewpPos + Vec2i(x, y), fresh);
+
+					if (fresh)
+						for (int z = 0; z < mapData->zSize(); ++z)
+							handleTile(cell, z);
+
+					bandCells[y*viewpW+x].cell = &cell;
+					continue;
+				}
+
+				const TileCells::Cell &cell = *bandCells[y*viewpW+x].cell;
+				const size_t *base = bandCells[y*viewpW+x].base;
+				const Vec2 offset(x*32, y*32);
+
+				copyBin(groundVert, base[0], cell.bins[0], offset);
+
+				for (int prio = 1; prio <= prioritiesMax; ++prio)
+					copyBin(zlayerVert[y + prio], base[prio], cell.bins[prio], offset);
+			}
+	}
+
+	static void copyBin(SVVector &out, size_t base,
+	                    const SVVector &bin, const Vec2 &offset)
+	{
+		for (size_t i = 0; i < bin.size(); ++i)
+		{
+			SVertex &v = out[base+i];
+			v = bin[i];
+			v.pos.x += offset.x;
+			v.pos.y += offset.y;
+		}
+	}
+
+	/* Same result as the serial path in 'buildQuadArray()':
+	 * cells are generated by row bands on the worker pool,
+	 * then laid out in the serial append order, so that each
+	 * band can copy its vertices into preallocated ranges */
+	void buildQuadArrayBanded()
+	{
+		runBands(false);
+
+		size_t groundSize = 0;
+		size_t zlayerSizes[zlayersMax] = { 0 };
+
+		for (int x = 0; x < viewpW; ++x)
+			for (int y = 0; y < viewpH; ++y)
+			{
+				const TileCells::Cell &cell = *bandCells[y*viewpW+x].cell;
+				size_t *base = bandCells[y*viewpW+x].base;
+
+				base[0] = groundSize;
+				groundSize += cell.bins[0].size();
+
+				for (int prio = 1; prio <= prioritiesMax; ++prio)
+				{
+					base[prio] = zlayerSizes[y + prio];
+					zlayerSizes[y + prio] += cell.bins[prio].size();
+				}
+			}
+
+		groundVert.resize(groundSize);
+
+		for (size_t i = 0; i < zlayersMax; ++i)
+			zlayerVert[i].resize(zlayerSizes[i]);
+
+		runBands(true);
 	}
 
-	static size_t quadDataSize(size_t quadCount)
+	size_t quadDataSize(size_t quadCount) const
 	{
-		return quadCount * sizeof(SVertex) * 4;
+		return tiles.buffer.quadBytes(quadCount);
 	}
 
 	size_t zlayerSize(size_t index)
@@ -744,38 +1057,542 @@ struct TilemapPrivate
 
 		zlayerBases[zlayersMax] = quadCount;
 
-		VBO::bind(tiles.vbo);
-		VBO::allocEmpty(quadDataSize(quadCount));
+		bool packable = tiles.buffer.canPack(groundVert);
+
+		for (size_t i = 0; i < zlayersMax && packable; ++i)
+			packable = tiles.buffer.canPack(zlayerVert[i]);
+
+		tiles.buffer.setPacked(packable);
+
+		VBO::bind(tiles.buffer.vbo());
+
+		tiles.allocQuads = std::max(tiles.allocQuads, quadCount);
+
+		{
+			VBO::Stream stream(quadDataSize(tiles.allocQuads), quadDataSize(quadCount));
+
+			stream.write(0, quadDataSize(groundQuadCount), tiles.buffer.data(groundVert));
+
+			for (size_t i = 0; i < zlayersMax; ++i)
+			{
+				if (zlayerVert[i].empty())
+					continue;
+
+				stream.write(quadDataSize(zlayerBases[i]),
+				             quadDataSize(zlayerSize(i)), tiles.buffer.data(zlayerVert[i]));
+			}
+		}
+
+		VBO::unbind();
+
+		if (depthTiles.enabled)
+			uploadDepthTiles();
+
+		/* Ensure global IBO size */
+		shState->ensureQuadIBO(quadCount);
+	}
+
+	void uploadDepthTiles()
+	{
+		depthTiles.vert.clear();
 
-		VBO::uploadSubData(0, quadDataSize(groundQuadCount), dataPtr(groundVert));
+		/* Slots are handed out to non-empty zlayers
+		 * in order (see updateSceneElements()) */
+		float slot = 0;
 
 		for (size_t i = 0; i < zlayersMax; ++i)
 		{
 			if (zlayerVert[i].empty())
 				continue;
 
-			VBO::uploadSubData(quadDataSize(zlayerBases[i]),
-			                   quadDataSize(zlayerSize(i)), dataPtr(zlayerVert[i]));
+			for (size_t j = 0; j < zlayerVert[i].size(); ++j)
+			{
+				Vertex v;
+				v.pos = zlayerVert[i][j].pos;
+				v.texPos = zlayerVert[i][j].texPos;
+				v.color = Vec4(slot, 0, 0, 0);
+
+				depthTiles.vert.push_back(v);
+			}
+
+			++slot;
 		}
 
+		depthTiles.quadCount = depthTiles.vert.size() / 4;
+		depthTiles.allocQuads = std::max(depthTiles.allocQuads, depthTiles.quadCount);
+
+		const size_t quadSize = sizeof(Vertex) * 4;
+
+		VBO::bind(depthTiles.vbo);
+		VBO::uploadStreamed(quadSize * depthTiles.allocQuads,
+		                    quadSize * depthTiles.quadCount, dataPtr(depthTiles.vert));
+		VBO::unbind();
+	}
+
+	/* Whether the zlayers are drawn through the depth
+	 * buffer in the current composition */
+	bool depthMergeActive() const
+	{
+		return depthTiles.enabled && glState.depthBuffer && !baked.active;
+	}
+
+	/* Drawn in place of zlayer 'slot'. Layer n sits at depth
+	 * 1 - (n+1)*step, and elements composited between layers n
+	 * and n+1 are flattened to the depth halfway between them */
+	void drawDepthZLayer(size_t slot)
+	{
+		const size_t count = elem.activeLayers;
+		const float step = 1.0f / (count + 1);
+
+		if (slot == 0)
+		{
+			TilemapDepthShader &shader = shState->shaders().tilemapDepth();
+			shader.bind();
+			shader.applyViewportProj();
+			shader.setAniIndex(tiles.animated ? tiles.frameIdx : 0);
+			shader.setDepthStep(step);
+			shader.setTranslation(dispPos);
+			bindAtlas(shader);
+
+			/* Only clears inside the viewport's scissor box */
+			glState.depthTest.set(true);
+			glState.depthRange.set(Vec2(0, 1));
+			gl.DepthMask(GL_TRUE);
+			gl.Clear(GL_DEPTH_BUFFER_BIT);
+
+			GLMeta::vaoBind(depthTiles.vao);
+			GLMeta::vaoDrawQuads(depthTiles.vao, 0, depthTiles.quadCount);
+			GLMeta::vaoUnbind(depthTiles.vao);
+
+			/* Elements in between only test */
+			gl.DepthMask(GL_FALSE);
+		}
+
+		if (slot + 1 < count)
+		{
+			const float depth = 1.0f - (slot + 1.5f) * step;
+			glState.depthRange.set(Vec2(depth, depth));
+		}
+		else
+		{
+			glState.depthTest.set(false);
+			glState.depthRange.set(Vec2(0, 1));
+			gl.DepthMask(GL_TRUE);
+		}
+	}
+
+	/* Appends bin 'bin' of the pregenerated tile at ('x', 'row')
+	 * to 'vert', laid out at row 'posY' of the baked geometry */
+	void appendBakedTile(SVVector &vert, const SVVector &cellVert,
+	                     const std::vector<size_t> &cellBins,
+	                     int x, int row, int bin, int posY)
+	{
+		const size_t *b = &cellBins[(row*baked.w + x) * (prioritiesMax+2) + bin];
+
+		for (size_t i = b[0]; i < b[1]; ++i)
+		{
+			SVertex v = cellVert[i];
+			v.pos.x += x*32;
+			v.pos.y += posY*32;
+			vert.push_back(v);
+		}
+	}
+
+	/* For maps small enough, the tiles of the entire map are
+	 * translated and uploaded once; scrolling then only selects
+	 * different index ranges to draw. Zlayer 'y' is composed of
+	 * the tiles in rows y-1 to y-5 (wrapping around at the map
+	 * top), so it still matches the zlayer at the same map row
+	 * the viewport mode would create. Returns false if the map
+	 * is too big, in which case the viewport mode is used */
+	bool bakeMap()
+	{
+		const int maxTiles = shState->config().staticTilemapSize;
+
+		baked.w = mapData->xSize();
+		baked.h = mapData->ySize();
+
+		if (baked.w * baked.h > maxTiles || baked.w == 0 || baked.h == 0)
+			return false;
+
+		/* Generate every tile once, storing the start of each
+		 * of its bins (plus the end of the last) in 'cellBins' */
+		SVVector cellVert;
+		std::vector<size_t> cellBins(baked.w * baked.h * (prioritiesMax+2));
+
+		TileCells::Cell cell;
+
+		for (int y = 0; y < baked.h; ++y)
+			for (int x = 0; x < baked.w; ++x)
+			{
+				for (int i = 0; i <= prioritiesMax; ++i)
+					cell.bins[i].clear();
+
+				cell.pos = Vec2i(x, y);
+
+				for (int z = 0; z < mapData->zSize(); ++z)
+					handleTile(cell, z);
+
+				size_t *b = &cellBins[(y*baked.w + x) * (prioritiesMax+2)];
+
+				for (int i = 0; i <= prioritiesMax; ++i)
+				{
+					b[i] = cellVert.size();
+					cellVert.insert(cellVert.end(), cell.bins[i].begin(), cell.bins[i].end());
+				}
+
+				b[prioritiesMax+1] = cellVert.size();
+			}
+
+		baked.binQuads.resize(baked.w * baked.h * (prioritiesMax+1));
+
+		for (int t = 0; t < baked.w * baked.h; ++t)
+			for (int i = 0; i <= prioritiesMax; ++i)
+			{
+				const size_t *b = &cellBins[t * (prioritiesMax+2) + i];
+				baked.binQuads[t * (prioritiesMax+1) + i] = (b[1] - b[0]) / 4;
+			}
+
+		const size_t colCount = baked.w + 1;
+		SVVector vert;
+
+		baked.groundCols.resize(baked.h * colCount);
+		baked.zlayerCols.resize(baked.h * colCount);
+
+		for (int y = 0; y < baked.h; ++y)
+		{
+			size_t *cols = &baked.groundCols[y*colCount];
+
+			for (int x = 0; x < baked.w; ++x)
+			{
+				cols[x] = vert.size() / 4;
+				appendBakedTile(vert, cellVert, cellBins, x, y, 0, y);
+			}
+
+			cols[baked.w] = vert.size() / 4;
+		}
+
+		for (int y = 0; y < baked.h; ++y)
+		{
+			size_t *cols = &baked.zlayerCols[y*colCount];
+
+			for (int x = 0; x < baked.w; ++x)
+			{
+				cols[x] = vert.size() / 4;
+
+				for (int prio = 1; prio <= prioritiesMax; ++prio)
+					appendBakedTile(vert, cellVert, cellBins,
+					                x, wrap(y - prio, baked.h), prio, y - prio);
+			}
+
+			cols[baked.w] = vert.size() / 4;
+		}
+
+		const size_t quadCount = vert.size() / 4;
+
+		tiles.buffer.setPacked(tiles.buffer.canPack(vert));
+
+		VBO::bind(tiles.buffer.vbo());
+
+		tiles.allocQuads = std::max(tiles.allocQuads, quadCount);
+		VBO::uploadStreamed(quadDataSize(tiles.allocQuads),
+		                    quadDataSize(quadCount), tiles.buffer.data(vert));
+
 		VBO::unbind();
 
-		/* Ensure global IBO size */
 		shState->ensureQuadIBO(quadCount);
+
+		return true;
+	}
+
+	/* Uploads 'bin' to quad index 'base' of the tile buffer,
+	 * laid out at tile position ('x', 'posY'). Returns false
+	 * if it doesn't fit the packed vertex format in use */
+	bool uploadBakedBin(const SVVector &bin, size_t base, int x, int posY)
+	{
+		if (bin.empty())
+			return true;
+
+		SVVector vert;
+		TileCells::append(vert, bin, Vec2(x*32, posY*32));
+
+		if (tiles.buffer.isPacked() && !tiles.buffer.canPack(vert))
+			return false;
+
+		VBO::uploadSubData(quadDataSize(base), quadDataSize(vert.size() / 4),
+		                   tiles.buffer.data(vert));
+
+		return true;
+	}
+
+	/* Regenerates the quads of a changed tile in the baked
+	 * geometry. Only possible as long as the number of quads
+	 * in each of its bins stays the same; returns false
+	 * otherwise, and the map has to be baked again */
+	bool patchBakedTile(const Vec2i &pos)
+	{
+		TileCells::Cell cell;
+		cell.pos = pos;
+
+		for (int z = 0; z < mapData->zSize(); ++z)
+			handleTile(cell, z);
+
+		const size_t *quads = &baked.binQuads[(pos.y*baked.w + pos.x) * (prioritiesMax+1)];
+
+		for (int i = 0; i <= prioritiesMax; ++i)
+			if (cell.bins[i].size() / 4 != quads[i])
+				return false;
+
+		const size_t colCount = baked.w + 1;
+
+		if (!uploadBakedBin(cell.bins[0], baked.groundCols[pos.y*colCount + pos.x], pos.x, pos.y))
+			return false;
+
+		for (int prio = 1; prio <= prioritiesMax; ++prio)
+		{
+			if (quads[prio] == 0)
+				continue;
+
+			/* Within its zlayer column, the tile comes
+			 * after those of the lower priorities */
+			const int layer = wrap(pos.y + prio, baked.h);
+			size_t base = baked.zlayerCols[layer*colCount + pos.x];
+
+			for (int lower = 1; lower < prio; ++lower)
+			{
+				const int row = wrap(layer - lower, baked.h);
+				base += baked.binQuads[(row*baked.w + pos.x) * (prioritiesMax+1) + lower];
+			}
+
+			if (!uploadBakedBin(cell.bins[prio], base, pos.x, layer - prio))
+				return false;
+		}
+
+		return true;
+	}
+
+	void patchBakedTiles()
+	{
+		VBO::bind(tiles.buffer.vbo());
+
+		for (size_t i = 0; i < dirtyTiles.size(); ++i)
+			if (!patchBakedTile(dirtyTiles[i]))
+			{
+				invalidateBuffers();
+				break;
+			}
+
+		VBO::unbind();
+
+		dirtyTiles.clear();
+	}
+
+	/* Draws the columns of the map viewport out of 'cols', the
+	 * column bases of a ground row or zlayer. 'ky' is the vertical
+	 * offset (in tiles) of the map copy the row sits in */
+	void drawBakedRow(ShaderBase &shader, const size_t *cols, int ky)
+	{
+		int x = viewpPos.x;
+		const int end = viewpPos.x + viewpW;
+
+		/* Split the span at the horizontal map wrap points */
+		while (x < end)
+		{
+			const int col = wrap(x, baked.w);
+			const int n = std::min(baked.w - col, end - x);
+
+			const size_t base = cols[col];
+			const size_t count = cols[col+n] - base;
+
+			if (count > 0)
+			{
+				shader.setTranslation(dispPos + (Vec2i(x - col, ky) - viewpPos) * 32);
+				GLMeta::vaoDrawQuads(tiles.buffer.vao(), base, count);
+			}
+
+			x += n;
+		}
+	}
+
+	void drawBakedGround(ShaderBase &shader)
+	{
+		for (int i = 0; i < viewpH; ++i)
+		{
+			const int y = viewpPos.y + i;
+			const int row = wrap(y, baked.h);
+
+			drawBakedRow(shader, &baked.groundCols[row*(baked.w+1)], y - row);
+		}
+	}
+
+	void drawBakedZLayer(ShaderBase &shader, size_t index)
+	{
+		const int y = viewpPos.y + index;
+		const int layer = wrap(y, baked.h);
+
+		drawBakedRow(shader, &baked.zlayerCols[layer*(baked.w+1)], y - layer);
+	}
+
+	bool zlayerEmpty(size_t index)
+	{
+		if (!baked.active)
+			return zlayerVert[index].empty();
+
+		const int layer = wrap(viewpPos.y + (int) index, baked.h);
+		const size_t *cols = &baked.zlayerCols[layer*(baked.w+1)];
+
+		return cols[0] == cols[baked.w];
+	}
+
+	void releaseIndexedMap()
+	{
+		for (size_t i = 0; i < indexed.tex.size(); ++i)
+			TEX::del(indexed.tex[i]);
+
+		indexed.tex.clear();
+	}
+
+	/* Writes the map texture texels of the four pieces of
+	 * ground tile ('x', 'y', 'z'), with a row stride of 'pitch'
+	 * bytes. Tiles not on the ground layer are left empty */
+	void encodeIndexedTile(uint8_t *out, size_t pitch, int x, int y, int z)
+	{
+		Vec2i pieces[4];
+		uint8_t kind = 0;
+
+		int tileInd = mapData->at(x, y, z);
+
+		if (tileInd >= 48 && samplePriority(tileInd) == 0)
+		{
+			if (tileInd < 48*8)
+			{
+				/* Autotile, in pieces of its pattern */
+				int atInd = tileInd / 48 - 1;
+				const StaticRect *pieceRect = &autotileRects[(tileInd % 48)*4];
+
+				for (int i = 0; i < 4; ++i)
+					pieces[i] = Vec2i(pieceRect[i].x, pieceRect[i].y + atInd * autotileH) / 16;
+
+				kind = 2;
+			}
+			else
+			{
+				int tsInd = tileInd - 48*8;
+				Vec2i texPos = TileAtlas::tileToAtlasCoor(tsInd % 8, tsInd / 8,
+				                                          atlas.efTilesetH, atlas.size.y) / 16;
+
+				for (int i = 0; i < 4; ++i)
+					pieces[i] = texPos + Vec2i(i % 2, i / 2);
+
+				kind = 1;
+			}
+		}
+
+		/* Piece order matches 'atSelectSubPos()' */
+		for (int i = 0; i < 4; ++i)
+		{
+			uint8_t *texel = out + (i / 2) * pitch + (i % 2) * 4;
+			const Vec2i &pc = pieces[i];
+
+			texel[0] = pc.x & 0xFF;
+			texel[1] = pc.y & 0xFF;
+			texel[2] = ((pc.x >> 8) & 0xF) | ((pc.y >> 8) << 4);
+			texel[3] = kind;
+		}
+	}
+
+	/* As an alternative to generating vertices for the ground layer,
+	 * it can be drawn by a single quad per map layer, looking up each
+	 * pixel's tile piece in a map texture (two by two texels per tile).
+	 * This keeps vertex data of big maps to their few prioritized tiles.
+	 * Returns false if disabled or the map texture would be too big */
+	bool buildIndexedMap()
+	{
+		releaseIndexedMap();
+
+		if (!shState->config().indexedTilemap)
+			return false;
+
+		const int w = mapData->xSize();
+		const int h = mapData->ySize();
+		const int maxSize = glState.caps.maxTexSize;
+
+		if (w == 0 || h == 0 || w*2 > maxSize || h*2 > maxSize)
+			return false;
+
+		const size_t pitch = w*2 * 4;
+		std::vector<uint8_t> texels(pitch * h*2);
+
+		for (int z = 0; z < mapData->zSize(); ++z)
+		{
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+					encodeIndexedTile(&texels[y*2*pitch + x*2*4], pitch, x, y, z);
+
+			TEX::ID tex = TEX::gen();
+			TEX::bind(tex);
+			TEX::setRepeat(false);
+			TEX::setSmooth(false);
+			TEX::uploadImage(w*2, h*2, dataPtr(texels), GL_RGBA);
+
+			indexed.tex.push_back(tex);
+		}
+
+		return true;
+	}
+
+	void updateIndexedTile(const Vec2i &pos)
+	{
+		for (int z = 0; z < (int) indexed.tex.size(); ++z)
+		{
+			uint8_t texels[2*2*4];
+			encodeIndexedTile(texels, 2*4, pos.x, pos.y, z);
+
+			TEX::bind(indexed.tex[z]);
+			TEX::uploadSubImage(pos.x*2, pos.y*2, 2, 2, texels, GL_RGBA);
+		}
+	}
+
+	void drawIndexedGround()
+	{
+		TilemapIndexedShader &shader = shState->shaders().tilemapIndexed();
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setTranslation(dispPos);
+
+		/* Tex coords are map positions in pixels */
+		shader.setTexSize(Vec2i(1, 1));
+		shader.setMapSize(Vec2i(mapData->xSize(), mapData->ySize()) * 32);
+		shader.setAtlasSize(Vec2i(atlas.gl.texW, atlas.gl.texH));
+		shader.setAniIndex(tiles.animated ? tiles.frameIdx : 0);
+
+		indexed.quad.setTexPosRect(FloatRect(viewpPos.x*32, viewpPos.y*32, viewpW*32, viewpH*32),
+		                           FloatRect(0, 0, viewpW*32, viewpH*32));
+
+		TEX::bind(atlas.gl.tex);
+
+		for (size_t i = 0; i < indexed.tex.size(); ++i)
+		{
+			shader.setMapTex(indexed.tex[i]);
+			indexed.quad.draw();
+		}
 	}
 
 	void bindShader(ShaderBase *&shaderVar)
 	{
-		if (tiles.animated)
+		/* Packed tex coordinates are scaled back in the tilemap
+		 * shader, which draws static tiles just as well */
+		if (tiles.animated || tiles.buffer.isPacked())
 		{
-			TilemapShader &tilemapShader = shState->shaders().tilemap;
+			TilemapShader &tilemapShader = shState->shaders().tilemap();
 			tilemapShader.bind();
-			tilemapShader.setAniIndex(tiles.frameIdx);
+			tilemapShader.setAniIndex(tiles.animated ? tiles.frameIdx : 0);
+			tilemapShader.setTexCoordScale(tiles.buffer.texCoordScale());
 			shaderVar = &tilemapShader;
 		}
 		else
 		{
-			shaderVar = &shState->shaders().simple;
+			shaderVar = &shState->shaders().simple();
 			shaderVar->bind();
 		}
 
@@ -785,7 +1602,7 @@ struct TilemapPrivate
 	void bindAtlas(ShaderBase &shader)
 	{
 		TEX::bind(atlas.gl.tex);
-		shader.setTexSize(atlas.size);
+		shader.setTexSize(Vec2i(atlas.gl.texW, atlas.gl.texH));
 	}
 
 	void updateActiveElements(std::vector<int> &zlayerInd)
@@ -814,7 +1631,7 @@ struct TilemapPrivate
 		std::vector<int> zlayerInd;
 
 		for (size_t i = 0; i < zlayersMax; ++i)
-			if (zlayerVert[i].size() > 0)
+			if (!zlayerEmpty(i))
 				zlayerInd.push_back(i);
 
 		updateActiveElements(zlayerInd);
@@ -862,6 +1679,20 @@ struct TilemapPrivate
 	{
 		ZLayer *const *zlayers = elem.zlayers;
 
+		/* Baked zlayers are drawn span by span and can't
+		 * be merged into one draw call */
+		if (baked.active)
+		{
+			for (size_t i = 0; i < elem.activeLayers; ++i)
+				zlayers[i]->batchedFlag = false;
+
+			return;
+		}
+
+		/* Adjacency is only meaningful in display order */
+		if (elem.activeLayers > 0)
+			zlayers[0]->scene->sortElements();
+
 		for (size_t i = 0; i < elem.activeLayers; ++i)
 		{
 			ZLayer *batchHead = zlayers[i];
@@ -907,6 +1738,8 @@ struct TilemapPrivate
 
 	void prepare()
 	{
+		PROFILE_SCOPE(TilemapPrepare);
+
 		if (!verifyResources())
 		{
 			if (tilemapReady)
@@ -924,7 +1757,7 @@ struct TilemapPrivate
 
 		if (atlasDirty)
 		{
-			buildAtlas();
+			acquireAtlas();
 			atlasDirty = false;
 		}
 
@@ -934,10 +1767,24 @@ struct TilemapPrivate
 			mapViewportDirty = false;
 		}
 
+		if (!dirtyTiles.empty())
+			patchBakedTiles();
+
 		if (buffersDirty)
 		{
-			buildQuadArray();
-			uploadBuffers();
+			if (bakeDirty)
+			{
+				indexed.active = buildIndexedMap();
+				baked.active = bakeMap();
+				bakeDirty = false;
+			}
+
+			if (!baked.active)
+			{
+				buildQuadArray();
+				uploadBuffers();
+			}
+
 			updateSceneElements();
 			buffersDirty = false;
 		}
@@ -956,6 +1803,11 @@ struct TilemapPrivate
 	}
 };
 
+void TileBandJob::run()
+{
+	p->runBand(y1, y2, emit);
+}
+
 GroundLayer::GroundLayer(TilemapPrivate *p, Viewport *viewport)
     : ViewportElement(viewport, 0),
       vboCount(0),
@@ -971,27 +1823,43 @@ void GroundLayer::updateVboCount()
 
 void GroundLayer::draw()
 {
-	if (p->groundVert.size() == 0)
-		return;
+	PROFILE_SCOPE(Tilemaps);
 
-	ShaderBase *shader;
+	if (p->indexed.active)
+	{
+		p->drawIndexedGround();
+	}
+	else
+	{
+		if (!p->baked.active && p->groundVert.size() == 0)
+			return;
 
-	p->bindShader(shader);
-	p->bindAtlas(*shader);
+		ShaderBase *shader;
+
+		p->bindShader(shader);
+		p->bindAtlas(*shader);
 
-	GLMeta::vaoBind(p->tiles.vao);
+		GLMeta::vaoBind(p->tiles.buffer.vao());
 
-	shader->setTranslation(p->dispPos);
-	drawInt();
+		if (p->baked.active)
+		{
+			p->drawBakedGround(*shader);
+		}
+		else
+		{
+			shader->setTranslation(p->dispPos);
+			drawInt();
+		}
 
-	GLMeta::vaoUnbind(p->tiles.vao);
+		GLMeta::vaoUnbind(p->tiles.buffer.vao());
+	}
 
 	p->flashMap.draw(flashAlpha[p->flashAlphaIdx] / 255.f, p->dispPos);
 }
 
 void GroundLayer::drawInt()
 {
-	gl.DrawElements(GL_TRIANGLES, vboCount, _GL_INDEX_TYPE, (GLvoid*) 0);
+	GLMeta::vaoDrawQuads(p->tiles.buffer.vao(), 0, vboCount / 6);
 }
 
 void GroundLayer::onGeometryChange(const Scene::Geometry &geo)
@@ -999,13 +1867,20 @@ void GroundLayer::onGeometryChange(const Scene::Geometry &geo)
 	p->updateSceneGeometry(geo);
 }
 
+/* The ground layer stands in for the whole tilemap */
+void GroundLayer::capture(SceneCapture &c)
+{
+	c.tilemap(*p->self);
+}
+
 ZLayer::ZLayer(TilemapPrivate *p, Viewport *viewport)
     : ViewportElement(viewport, 0),
       index(0),
       vboOffset(0),
       vboCount(0),
       p(p),
-      vboBatchCount(0)
+      vboBatchCount(0),
+      slot(0)
 {}
 
 void ZLayer::setIndex(int value)
@@ -1015,12 +1890,20 @@ void ZLayer::setIndex(int value)
 	z = calculateZ(p, index);
 	scene->reinsert(*this);
 
-	vboOffset = p->zlayerBases[index] * sizeof(index_t) * 6;
+	vboOffset = p->zlayerBases[index];
 	vboCount = p->zlayerSize(index) * 6;
 }
 
 void ZLayer::draw()
 {
+	PROFILE_SCOPE(Tilemaps);
+
+	if (p->depthMergeActive())
+	{
+		p->drawDepthZLayer(slot);
+		return;
+	}
+
 	if (batchedFlag)
 		return;
 
@@ -1029,17 +1912,24 @@ void ZLayer::draw()
 	p->bindShader(shader);
 	p->bindAtlas(*shader);
 
-	GLMeta::vaoBind(p->tiles.vao);
+	GLMeta::vaoBind(p->tiles.buffer.vao());
 
-	shader->setTranslation(p->dispPos);
-	drawInt();
+	if (p->baked.active)
+	{
+		p->drawBakedZLayer(*shader, index);
+	}
+	else
+	{
+		shader->setTranslation(p->dispPos);
+		drawInt();
+	}
 
-	GLMeta::vaoUnbind(p->tiles.vao);
+	GLMeta::vaoUnbind(p->tiles.buffer.vao());
 }
 
 void ZLayer::drawInt()
 {
-	gl.DrawElements(GL_TRIANGLES, vboBatchCount, _GL_INDEX_TYPE, (GLvoid*) vboOffset);
+	GLMeta::vaoDrawQuads(p->tiles.buffer.vao(), vboOffset, vboBatchCount / 6);
 }
 
 int ZLayer::calculateZ(TilemapPrivate *p, int index)
@@ -1101,7 +1991,7 @@ Bitmap *Tilemap::Autotiles::get(int i) const
 
 Tilemap::Tilemap(Viewport *viewport)
 {
-	p = new TilemapPrivate(viewport);
+	p = new TilemapPrivate(this, viewport);
 	atProxy.p = p;
 }
 
@@ -1121,10 +2011,16 @@ void Tilemap::update()
 	if (++p->flashAlphaIdx >= flashAlphaN)
 		p->flashAlphaIdx = 0;
 
+	if (p->flashMap.active())
+		p->markSceneDirty();
+
 	/* Animate autotiles */
 	if (!p->tiles.animated)
 		return;
 
+	if (p->tiles.frameIdx != atAnimation[p->tiles.aniIdx])
+		p->markSceneDirty();
+
 	p->tiles.frameIdx = atAnimation[p->tiles.aniIdx];
 
 	if (++p->tiles.aniIdx >= atAnimationN)
@@ -1155,6 +2051,7 @@ void Tilemap::setTileset(Bitmap *value)
 		return;
 
 	p->tileset = value;
+	p->markSceneDirty();
 
 	if (!value)
 		return;
@@ -1175,14 +2072,18 @@ void Tilemap::setMapData(Table *value)
 		return;
 
 	p->mapData = value;
+	p->markSceneDirty();
+	p->mapDataCon.disconnect();
+	p->mapDataCellCon.disconnect();
 
 	if (!value)
 		return;
 
 	p->invalidateBuffers();
-	p->mapDataCon.disconnect();
 	p->mapDataCon = value->modified.connect
 	        (sigc::mem_fun(p, &TilemapPrivate::invalidateBuffers));
+	p->mapDataCellCon = value->cellModified.connect
+	        (sigc::mem_fun(p, &TilemapPrivate::invalidateTile));
 }
 
 void Tilemap::setFlashData(Table *value)
@@ -1200,6 +2101,7 @@ void Tilemap::setPriorities(Table *value)
 		return;
 
 	p->priorities = value;
+	p->markSceneDirty();
 
 	if (!value)
 		return;
@@ -1208,6 +2110,10 @@ void Tilemap::setPriorities(Table *value)
 	p->prioritiesCon.disconnect();
 	p->prioritiesCon = value->modified.connect
 	        (sigc::mem_fun(p, &TilemapPrivate::invalidateBuffers));
+
+	p->prioritiesCellCon.disconnect();
+	p->prioritiesCellCon = value->cellModified.connect
+	        (sigc::mem_fun(p, &TilemapPrivate::invalidatePriority));
 }
 
 void Tilemap::setVisible(bool value)
@@ -1218,6 +2124,7 @@ void Tilemap::setVisible(bool value)
 		return;
 
 	p->visible = value;
+	p->markSceneDirty();
 
 	if (!p->tilemapReady)
 		return;
@@ -1236,6 +2143,7 @@ void Tilemap::setOX(int value)
 
 	p->origin.x = value;
 	p->mapViewportDirty = true;
+	p->markSceneDirty();
 }
 
 void Tilemap::setOY(int value)
@@ -1248,6 +2156,7 @@ void Tilemap::setOY(int value)
 	p->origin.y = value;
 	p->zOrderDirty = true;
 	p->mapViewportDirty = true;
+	p->markSceneDirty();
 }
 
 void Tilemap::releaseResources()
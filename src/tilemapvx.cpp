@@ -22,6 +22,7 @@
 #include "tilemapvx.h"
 
 #include "tileatlasvx.h"
+#include "atlascache.h"
 #include "etc-internal.h"
 #include "bitmap.h"
 #include "table.h"
@@ -30,10 +31,13 @@
 #include "sharedstate.h"
 #include "glstate.h"
 #include "vertex.h"
+#include "tilevbo.h"
 #include "quad.h"
 #include "quadarray.h"
 #include "shader.h"
 #include "tilemap-common.h"
+#include "profiler.h"
+#include "scenecapture.h"
 
 #include <vector>
 #include <sigc++/connection.h>
@@ -51,8 +55,13 @@ static const uint8_t flashAlpha[] =
 
 static elementsN(flashAlpha);
 
+/* Every read pass has a ground and an above-player bin */
+typedef TileRing<TileAtlasVX::passCount*2> TileCells;
+
 struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 {
+	TilemapVX *self;
+
 	Bitmap *bitmaps[BM_COUNT];
 
 	Table *mapData;
@@ -68,9 +77,18 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 	std::vector<SVertex> groundVert;
 	std::vector<SVertex> aboveVert;
 
+	/* Vertices of every tile in the map viewport */
+	TileCells tileCells;
+	std::vector<TileCells::Cell*> viewpCells;
+
+	/* Target of onQuads() while reading a cell */
+	TileCells::Cell *readCell;
+	int readPass;
+
 	TEXFBO atlas;
-	VBO::ID vbo;
-	GLMeta::VAO vao;
+	/* What 'atlas' was built from */
+	AtlasKey atlasKey;
+	TileVBO buffer;
 
 	size_t allocQuads;
 
@@ -88,7 +106,9 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 	bool mapViewportDirty;
 
 	sigc::connection mapDataCon;
+	sigc::connection mapDataCellCon;
 	sigc::connection flagsCon;
+	sigc::connection flagsCellCon;
 
 	sigc::connection prepareCon;
 	sigc::connection bmChangedCons[BM_COUNT];
@@ -105,6 +125,8 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 
 		void draw()
 		{
+			PROFILE_SCOPE(Tilemaps);
+
 			p->drawAbove();
 			p->drawFlashLayer();
 		}
@@ -114,10 +136,13 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 
 	AboveLayer above;
 
-	TilemapVXPrivate(Viewport *viewport)
+	TilemapVXPrivate(TilemapVX *self, Viewport *viewport)
 	    : ViewportElement(viewport),
+	      self(self),
 	      mapData(0),
 	      flags(0),
+	      readCell(0),
+	      readPass(0),
 	      allocQuads(0),
 	      groundQuads(0),
 	      aboveQuads(0),
@@ -130,15 +155,6 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 	{
 		memset(bitmaps, 0, sizeof(bitmaps));
 
-		shState->requestAtlasTex(ATLASVX_W, ATLASVX_H, atlas);
-
-		vbo = VBO::gen();
-
-		GLMeta::vaoFillInVertexData<SVertex>(vao);
-		vao.vbo = vbo;
-		vao.ibo = shState->globalIBO().ibo;
-		GLMeta::vaoInit(vao);
-
 		onGeometryChange(scene->getGeometry());
 
 		prepareCon = shState->prepareDraw.connect
@@ -147,15 +163,14 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 
 	virtual ~TilemapVXPrivate()
 	{
-		GLMeta::vaoFini(vao);
-		VBO::del(vbo);
-
-		shState->releaseAtlasTex(atlas);
+		shState->atlasCache().release(atlas, atlasKey);
 
 		prepareCon.disconnect();
 
 		mapDataCon.disconnect();
+		mapDataCellCon.disconnect();
 		flagsCon.disconnect();
+		flagsCellCon.disconnect();
 
 		for (size_t i = 0; i < BM_COUNT; ++i)
 		{
@@ -167,16 +182,47 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 	void invalidateAtlas()
 	{
 		atlasDirty = true;
+		markSceneDirty();
 	}
 
 	void invalidateBuffers()
 	{
+		tileCells.invalidate();
+		buffersDirty = true;
+		markSceneDirty();
+	}
+
+	void invalidateTile(int x, int y, int)
+	{
+		tileCells.invalidateTile(Vec2i(x, y), Vec2i(mapData->xSize(), mapData->ySize()));
 		buffersDirty = true;
+		markSceneDirty();
+	}
+
+	/* A single flag can affect any number of tiles */
+	void invalidateFlag(int, int, int)
+	{
+		invalidateBuffers();
 	}
 
+	/* Takes an atlas matching the current bitmaps from
+	 * the atlas cache, or assembles a new one */
 	void rebuildAtlas()
 	{
-		TileAtlasVX::build(atlas, bitmaps);
+		AtlasKey key;
+		key.layout = AtlasKey::TilemapVXLayout;
+		key.width = ATLASVX_W;
+		key.height = ATLASVX_H;
+
+		for (size_t i = 0; i < BM_COUNT; ++i)
+			key.addBitmap(bitmaps[i]);
+
+		AtlasCache &cache = shState->atlasCache();
+		cache.release(atlas, atlasKey);
+		atlasKey = key;
+
+		if (!cache.request(key, atlas))
+			TileAtlasVX::build(atlas, bitmaps);
 	}
 
 	void updateMapViewport()
@@ -206,9 +252,9 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 		dispPos = sceneGeo.rect.pos() - wrap(combOrigin, 32) - Vec2i(0, 32);
 	}
 
-	static size_t quadBytes(size_t quads)
+	size_t quadBytes(size_t quads) const
 	{
-		return quads * 4 * sizeof(SVertex);
+		return buffer.quadBytes(quads);
 	}
 
 	void rebuildBuffers()
@@ -219,31 +265,77 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 		groundVert.clear();
 		aboveVert.clear();
 
-		TileAtlasVX::readTiles(*this, *mapData, flags,
-		                       mapViewp.x, mapViewp.y, mapViewp.w, mapViewp.h);
+		readNewCells();
+
+		/* Reproduce the order readTiles() would have emitted
+		 * the quads in: pass by pass, and rows bottom to top
+		 * so that table legs are drawn over the tile below */
+		for (int pass = 0; pass < TileAtlasVX::passCount; ++pass)
+			for (int y = mapViewp.h-1; y >= 0; --y)
+				for (int x = 0; x < mapViewp.w; ++x)
+				{
+					const TileCells::Cell &cell = *viewpCells[y*mapViewp.w + x];
+					const Vec2 offset(x*32, y*32);
+
+					TileCells::append(groundVert, cell.bins[pass*2], offset);
+					TileCells::append(aboveVert, cell.bins[pass*2+1], offset);
+				}
 
 		groundQuads = groundVert.size() / 4;
 		aboveQuads = aboveVert.size() / 4;
 		size_t totalQuads = groundQuads + aboveQuads;
 
-		VBO::bind(vbo);
+		buffer.setPacked(buffer.canPack(groundVert) && buffer.canPack(aboveVert));
+
+		VBO::bind(buffer.vbo());
+
+		allocQuads = std::max(allocQuads, totalQuads);
 
-		if (totalQuads > allocQuads)
 		{
-			VBO::allocEmpty(quadBytes(totalQuads), GL_DYNAMIC_DRAW);
-			allocQuads = totalQuads;
-		}
+			VBO::Stream stream(quadBytes(allocQuads), quadBytes(totalQuads));
 
-		VBO::uploadSubData(0, quadBytes(groundQuads), dataPtr(groundVert));
-		VBO::uploadSubData(quadBytes(groundQuads), quadBytes(aboveQuads), dataPtr(aboveVert));
+			stream.write(0, quadBytes(groundQuads), buffer.data(groundVert));
+			stream.write(quadBytes(groundQuads), quadBytes(aboveQuads), buffer.data(aboveVert));
+		}
 
 		VBO::unbind();
 
 		shState->ensureQuadIBO(totalQuads);
 	}
 
+	/* Looks up the cells of the map viewport, reading
+	 * the tiles of those not generated yet */
+	void readNewCells()
+	{
+		tileCells.resize(mapViewp.w, mapViewp.h);
+		viewpCells.resize(mapViewp.w * mapViewp.h);
+
+		for (int y = 0; y < mapViewp.h; ++y)
+			for (int x = 0; x < mapViewp.w; ++x)
+			{
+				bool fresh;
+				const Vec2i pos(mapViewp.x + x, mapViewp.y + y);
+				TileCells::Cell &cell = tileCells.get(pos, fresh);
+
+				viewpCells[y*mapViewp.w + x] = &cell;
+
+				if (!fresh)
+					continue;
+
+				readCell = &cell;
+
+				for (readPass = 0; readPass < TileAtlasVX::passCount; ++readPass)
+					TileAtlasVX::readPass(*this, *mapData, flags,
+					                      pos.x, pos.y, 1, 1, readPass);
+			}
+
+		readCell = 0;
+	}
+
 	void prepare()
 	{
+		PROFILE_SCOPE(TilemapPrepare);
+
 		if (!mapData)
 			return;
 
@@ -279,43 +371,49 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 	/* SceneElement */
 	void draw()
 	{
+		PROFILE_SCOPE(Tilemaps);
+
 		drawGround();
 		drawFlashLayer();
 	}
 
-	void drawGround()
+	/* Packed tex coordinates are scaled back in the tilemap
+	 * shader, which draws static tiles just as well */
+	ShaderBase &bindShader(bool animated)
 	{
-		if (groundQuads == 0)
-			return;
-
-		ShaderBase *shader;
-
-		if (!nullOrDisposed(bitmaps[BM_A1]))
+		if (!animated && !buffer.isPacked())
 		{
-			/* Animated tileset */
-			TilemapVXShader &tmShader = shState->shaders().tilemapVX;
-			tmShader.bind();
-			tmShader.setAniOffset(aniOffset);
+			SimpleShader &shader = shState->shaders().simple();
+			shader.bind();
 
-			shader = &tmShader;
-		}
-		else
-		{
-			/* Static tileset */
-			shader = &shState->shaders().simple;
-			shader->bind();
+			return shader;
 		}
 
-		shader->setTexSize(Vec2i(atlas.width, atlas.height));
-		shader->applyViewportProj();
-		shader->setTranslation(dispPos);
+		TilemapVXShader &shader = shState->shaders().tilemapVX();
+		shader.bind();
+		shader.setAniOffset(animated ? aniOffset : Vec2());
+		shader.setTexCoordScale(buffer.texCoordScale());
+
+		return shader;
+	}
+
+	void drawGround()
+	{
+		if (groundQuads == 0)
+			return;
+
+		/* Animated tileset if A1 is present */
+		ShaderBase &shader = bindShader(!nullOrDisposed(bitmaps[BM_A1]));
+		shader.setTexSize(Vec2i(atlas.texW, atlas.texH));
+		shader.applyViewportProj();
+		shader.setTranslation(dispPos);
 
 		TEX::bind(atlas.tex);
-		GLMeta::vaoBind(vao);
+		GLMeta::vaoBind(buffer.vao());
 
-		gl.DrawElements(GL_TRIANGLES, groundQuads*6, _GL_INDEX_TYPE, 0);
+		GLMeta::vaoDrawQuads(buffer.vao(), 0, groundQuads);
 
-		GLMeta::vaoUnbind(vao);
+		GLMeta::vaoUnbind(buffer.vao());
 	}
 
 	void drawAbove()
@@ -323,19 +421,17 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 		if (aboveQuads == 0)
 			return;
 
-		SimpleShader &shader = shState->shaders().simple;
-		shader.bind();
-		shader.setTexSize(Vec2i(atlas.width, atlas.height));
+		ShaderBase &shader = bindShader(false);
+		shader.setTexSize(Vec2i(atlas.texW, atlas.texH));
 		shader.applyViewportProj();
 		shader.setTranslation(dispPos);
 
 		TEX::bind(atlas.tex);
-		GLMeta::vaoBind(vao);
+		GLMeta::vaoBind(buffer.vao());
 
-		gl.DrawElements(GL_TRIANGLES, aboveQuads*6, _GL_INDEX_TYPE,
-		                (GLvoid*) (groundQuads*6*sizeof(index_t)));
+		GLMeta::vaoDrawQuads(buffer.vao(), groundQuads, aboveQuads);
 
-		GLMeta::vaoUnbind(vao);
+		GLMeta::vaoUnbind(buffer.vao());
 	}
 
 	void drawFlashLayer()
@@ -354,13 +450,18 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 		mapViewportDirty = true;
 	}
 
+	void capture(SceneCapture &c)
+	{
+		c.tilemapVX(*self);
+	}
+
 	ABOUT_TO_ACCESS_NOOP
 
 	/* TileAtlasVX::Reader */
 	void onQuads(const FloatRect *t, const FloatRect *p,
 	             size_t n, bool overPlayer)
 	{
-		SVertex *vert = allocVert(overPlayer ? aboveVert : groundVert, n*4);
+		SVertex *vert = allocVert(readCell->bins[readPass*2 + overPlayer], n*4);
 
 		for (size_t i = 0; i < n; ++i)
 			Quad::setTexPosRect(&vert[i*4], t[i], p[i]);
@@ -403,7 +504,7 @@ Bitmap *TilemapVX::BitmapArray::get(int i) const
 
 TilemapVX::TilemapVX(Viewport *viewport)
 {
-	p = new TilemapVXPrivate(viewport);
+	p = new TilemapVXPrivate(this, viewport);
 	bmProxy.p = p;
 }
 
@@ -428,11 +529,19 @@ void TilemapVX::update()
 	uint8_t aniIdxA = aniIndicesA[p->frameIdx / 30];
 	uint8_t aniIdxC = aniIndicesC[p->frameIdx / 30];
 
-	p->aniOffset = Vec2(aniIdxA * 2 * 32, aniIdxC * 32);
+	const Vec2 aniOffset(aniIdxA * 2 * 32, aniIdxC * 32);
+
+	if (!(p->aniOffset == aniOffset))
+		p->markSceneDirty();
+
+	p->aniOffset = aniOffset;
 
 	/* Animate flash */
 	if (++p->flashAlphaIdx >= flashAlphaN)
 		p->flashAlphaIdx = 0;
+
+	if (p->flashMap.active())
+		p->markSceneDirty();
 }
 
 TilemapVX::BitmapArray &TilemapVX::getBitmapArray()
@@ -478,11 +587,14 @@ void TilemapVX::setMapData(Table *value)
 		return;
 
 	p->mapData = value;
-	p->buffersDirty = true;
+	p->invalidateBuffers();
 
 	p->mapDataCon.disconnect();
 	p->mapDataCon = value->modified.connect
 		(sigc::mem_fun(p, &TilemapVXPrivate::invalidateBuffers));
+	p->mapDataCellCon.disconnect();
+	p->mapDataCellCon = value->cellModified.connect
+		(sigc::mem_fun(p, &TilemapVXPrivate::invalidateTile));
 }
 
 void TilemapVX::setFlashData(Table *value)
@@ -500,11 +612,14 @@ void TilemapVX::setFlags(Table *value)
 		return;
 
 	p->flags = value;
-	p->buffersDirty = true;
+	p->invalidateBuffers();
 
 	p->flagsCon.disconnect();
 	p->flagsCon = value->modified.connect
 		(sigc::mem_fun(p, &TilemapVXPrivate::invalidateBuffers));
+	p->flagsCellCon.disconnect();
+	p->flagsCellCon = value->cellModified.connect
+		(sigc::mem_fun(p, &TilemapVXPrivate::invalidateFlag));
 }
 
 void TilemapVX::setVisible(bool value)
@@ -524,6 +639,7 @@ void TilemapVX::setOX(int value)
 
 	p->origin.x = value;
 	p->mapViewportDirty = true;
+	p->markSceneDirty();
 }
 
 void TilemapVX::setOY(int value)
@@ -535,6 +651,7 @@ void TilemapVX::setOY(int value)
 
 	p->origin.y = value;
 	p->mapViewportDirty = true;
+	p->markSceneDirty();
 }
 
 void TilemapVX::releaseResources()
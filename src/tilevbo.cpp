@@ -0,0 +1,110 @@
+/*
+** tilevbo.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tilevbo.h"
+
+#include "sharedstate.h"
+#include "config.h"
+#include "global-ibo.h"
+#include "util.h"
+
+
+static void initVao(GLMeta::VAO &vao)
+{
+	vao.ibo = shState->globalIBO().ibo;
+	GLMeta::vaoInit(vao);
+}
+
+TileVBO::TileVBO()
+    : enabled(shState->config().packedTileVertices),
+      packed(false)
+{
+	buffer = VBO::gen();
+
+	GLMeta::vaoFillInVertexData<SVertex>(floatVao);
+	floatVao.vbo = buffer;
+	initVao(floatVao);
+
+	if (!enabled)
+		return;
+
+	GLMeta::vaoFillInVertexData<PVertex>(packedVao);
+	packedVao.vbo = buffer;
+	initVao(packedVao);
+}
+
+TileVBO::~TileVBO()
+{
+	GLMeta::vaoFini(floatVao);
+
+	if (enabled)
+		GLMeta::vaoFini(packedVao);
+
+	VBO::del(buffer);
+}
+
+static bool fitsInt(float value, float min, float max)
+{
+	return value >= min && value <= max && value == (float) (int32_t) value;
+}
+
+bool TileVBO::canPack(const std::vector<SVertex> &vert) const
+{
+	if (!enabled)
+		return false;
+
+	for (size_t i = 0; i < vert.size(); ++i)
+	{
+		const SVertex &v = vert[i];
+
+		if (!fitsInt(v.pos.x, -32768, 32767) ||
+		    !fitsInt(v.pos.y, -32768, 32767) ||
+		    !fitsInt(v.texPos.x*2, 0, 65535) ||
+		    !fitsInt(v.texPos.y*2, 0, 65535))
+			return false;
+	}
+
+	return true;
+}
+
+size_t TileVBO::quadBytes(size_t quads) const
+{
+	return quads * 4 * (packed ? sizeof(PVertex) : sizeof(SVertex));
+}
+
+const void *TileVBO::data(const std::vector<SVertex> &vert)
+{
+	if (!packed)
+		return dataPtr(vert);
+
+	scratch.resize(vert.size());
+
+	for (size_t i = 0; i < vert.size(); ++i)
+	{
+		scratch[i].pos[0] = vert[i].pos.x;
+		scratch[i].pos[1] = vert[i].pos.y;
+		scratch[i].texPos[0] = vert[i].texPos.x*2;
+		scratch[i].texPos[1] = vert[i].texPos.y*2;
+	}
+
+	return dataPtr(scratch);
+}
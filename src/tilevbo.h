@@ -0,0 +1,77 @@
+/*
+** tilevbo.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TILEVBO_H
+#define TILEVBO_H
+
+#include "gl-util.h"
+#include "gl-meta.h"
+#include "vertex.h"
+
+#include <vector>
+
+/* Vertex buffer holding the tile geometry of a tilemap.
+ * With 'packedTileVertices' enabled, uploads whose data is
+ * all representable are converted to 8 byte PVertex, halving
+ * buffer size and vertex fetch bandwidth. Tile positions are
+ * whole pixels, while tex coordinates may sit on half pixels,
+ * so those are stored doubled; packed geometry has to be drawn
+ * with one of the tilemap shaders, scaling them back down.
+ * The vertex format only ever changes on full uploads */
+class TileVBO
+{
+public:
+	TileVBO();
+	~TileVBO();
+
+	VBO::ID vbo() const { return buffer; }
+	GLMeta::VAO &vao() { return packed ? packedVao : floatVao; }
+
+	/* Whether 'vert' can be stored in the packed format.
+	 * Always false with the option disabled */
+	bool canPack(const std::vector<SVertex> &vert) const;
+
+	/* Selects the vertex format for the upload that follows */
+	void setPacked(bool value) { packed = value; }
+	bool isPacked() const { return packed; }
+
+	size_t quadBytes(size_t quads) const;
+
+	/* Returns 'vert' in the selected vertex format, ready for
+	 * upload. Valid until the next call */
+	const void *data(const std::vector<SVertex> &vert);
+
+	/* For the tilemap shaders' 'setTexCoordScale()' */
+	float texCoordScale() const { return packed ? 0.5f : 1.0f; }
+
+private:
+	VBO::ID buffer;
+	GLMeta::VAO floatVao;
+	GLMeta::VAO packedVao;
+
+	bool enabled;
+	bool packed;
+
+	std::vector<PVertex> scratch;
+};
+
+#endif // TILEVBO_H
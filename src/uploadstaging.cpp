@@ -0,0 +1,159 @@
+/*
+** uploadstaging.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "uploadstaging.h"
+
+#include "gl-fun.h"
+
+#include <string.h>
+#include <vector>
+
+/* Size of the unpack buffer ring. Uploads larger than
+ * this go through (temporary) client memory */
+#define RING_SIZE (4 * 1024 * 1024)
+
+/* Of the start of each upload inside the ring */
+#define RING_ALIGN 64
+
+static UnpackBO::ID ring;
+static size_t ringHead = 0;
+
+/* Upload currently being written, if mapped into the ring */
+static size_t mapOffset = 0;
+static bool mappedRing = false;
+
+/* Client memory fallback
+ * (word aligned for the unpack alignment) */
+static std::vector<uint32_t> client;
+
+static void *mapRing(size_t size)
+{
+	if (!gl.pixel_pack_buffer || size > RING_SIZE)
+		return 0;
+
+	if (ring == UnpackBO::ID(0))
+	{
+		ring = UnpackBO::gen();
+		UnpackBO::bind(ring);
+		UnpackBO::allocEmpty(RING_SIZE, GL_STREAM_DRAW);
+	}
+	else
+	{
+		UnpackBO::bind(ring);
+	}
+
+	if (ringHead + size > RING_SIZE)
+	{
+		/* Orphaned; storage still read from is
+		 * released once the GPU is done with it */
+		UnpackBO::allocEmpty(RING_SIZE, GL_STREAM_DRAW);
+		ringHead = 0;
+	}
+
+	void *mem = gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, ringHead, size,
+	                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+	                              GL_MAP_UNSYNCHRONIZED_BIT);
+
+	if (!mem)
+	{
+		UnpackBO::unbind();
+		return 0;
+	}
+
+	mapOffset = ringHead;
+	ringHead += (size + RING_ALIGN - 1) & ~(RING_ALIGN - 1);
+
+	return mem;
+}
+
+void *UploadStaging::map(size_t size)
+{
+	void *mem = mapRing(size);
+	mappedRing = mem != 0;
+
+	if (mem)
+		return mem;
+
+	const size_t words = (size + 3) / 4;
+
+	if (client.size() < words)
+		client.resize(words);
+
+	return &client[0];
+}
+
+void UploadStaging::upload(GLint x, GLint y, GLsizei width, GLsizei height,
+                           GLenum format)
+{
+	if (!mappedRing)
+	{
+		TEX::uploadSubImage(x, y, width, height, &client[0], format);
+
+		/* Not worth holding on to for one-off large uploads */
+		if (client.size() * 4 > RING_SIZE)
+			std::vector<uint32_t>().swap(client);
+
+		return;
+	}
+
+	mappedRing = false;
+
+	/* A failed unmap (storage lost, eg. on mode switches)
+	 * leaves the uploaded contents undefined */
+	UnpackBO::unmap();
+
+	TEX::uploadSubImage(x, y, width, height,
+	                    reinterpret_cast<const void*>(mapOffset), format);
+
+	/* Client memory pointers are interpreted
+	 * as offsets while the buffer is bound */
+	UnpackBO::unbind();
+}
+
+void UploadStaging::uploadSubImage(GLint x, GLint y, GLsizei width, GLsizei height,
+                                   const void *data, GLenum format)
+{
+	const size_t size = width * height * 4;
+
+	/* Nothing to gain from another copy in client memory */
+	if (!gl.pixel_pack_buffer || size > RING_SIZE)
+	{
+		TEX::uploadSubImage(x, y, width, height, data, format);
+		return;
+	}
+
+	void *mem = map(size);
+	memcpy(mem, data, size);
+	upload(x, y, width, height, format);
+}
+
+void UploadStaging::fini()
+{
+	if (ring != UnpackBO::ID(0))
+	{
+		UnpackBO::del(ring);
+		ring = UnpackBO::ID(0);
+	}
+
+	ringHead = 0;
+	std::vector<uint32_t>().swap(client);
+}
@@ -0,0 +1,58 @@
+/*
+** uploadstaging.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UPLOADSTAGING_H
+#define UPLOADSTAGING_H
+
+#include "gl-util.h"
+
+#include <stddef.h>
+
+/* Memory that pixel data is written to on its way into textures,
+ * kept around instead of being allocated for every upload. With
+ * mappable pixel buffers, it's a ring inside one unpack buffer:
+ * uploads from it are copied by the GPU asynchronously, and the
+ * buffer is orphaned each time the ring wraps around, so that
+ * writes never wait for uploads still in flight. Otherwise it's
+ * a reusable client memory buffer that the driver copies from.
+ * Uploads go into the currently bound texture. RGSS thread only */
+class UploadStaging
+{
+public:
+	/* Returns 'size' bytes to write the pixels of a single,
+	 * tightly packed upload to, valid until upload() */
+	static void *map(size_t size);
+
+	/* Uploads what was written to the memory returned by map() */
+	static void upload(GLint x, GLint y, GLsizei width, GLsizei height,
+	                   GLenum format);
+
+	/* Like TEX::uploadSubImage(); 'data' is copied into the ring
+	 * if there is one, and handed to the driver directly if not */
+	static void uploadSubImage(GLint x, GLint y, GLsizei width, GLsizei height,
+	                           const void *data, GLenum format);
+
+	/* Frees the staging memory, before the context goes away */
+	static void fini();
+};
+
+#endif // UPLOADSTAGING_H
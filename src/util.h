@@ -23,9 +23,11 @@
 #define UTIL_H
 
 #include <stdio.h>
+#include <ctype.h>
 #include <string>
 #include <algorithm>
 #include <vector>
+#include <stdint.h>
 
 static inline int
 wrapRange(int value, int min, int max)
@@ -61,6 +63,50 @@ findNextPow2(int start)
 	return i;
 }
 
+/* Decodes the UCS-2 codepoint at 'str' and advances it past the
+ * consumed bytes. Returns false for characters outside the BMP
+ * (which TTF_GlyphMetrics can't handle) and malformed input */
+static inline bool nextUCS2(const char *&str, uint16_t &out)
+{
+	const unsigned char *in =
+	        reinterpret_cast<const unsigned char*>(str);
+
+	if (in[0] < 0x80)
+	{
+		out = in[0];
+		str += 1;
+
+		return true;
+	}
+
+	if ((in[0] & 0xF0) == 0xE0)
+	{
+		if (in[1] == 0 || in[2] == 0)
+			return false;
+
+		out = (in[0] & 0x0F)<<12 |
+		      (in[1] & 0x3F)<<6  |
+		      (in[2] & 0x3F);
+		str += 3;
+
+		return true;
+	}
+
+	if ((in[0] & 0xE0) == 0xC0)
+	{
+		if (in[1] == 0)
+			return false;
+
+		out = (in[0] & 0x1F)<<6 |
+		      (in[1] & 0x3F);
+		str += 2;
+
+		return true;
+	}
+
+	return false;
+}
+
 /* Reads the contents of the file at 'path' and
  * appends them to 'out'. Returns false on failure */
 inline bool readFile(const char *path,
@@ -95,6 +141,23 @@ inline void strReplace(std::string &str,
 			str[i] = after;
 }
 
+/* Lowercases 'path' and turns backslashes into slashes,
+ * matching how the path cache compares file names */
+inline std::string normalizedPath(const char *path)
+{
+	std::string str(path);
+
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		if (str[i] == '\\')
+			str[i] = '/';
+		else
+			str[i] = tolower(str[i]);
+	}
+
+	return str;
+}
+
 /* Check if [C]ontainer contains [V]alue */
 template<typename C, typename V>
 inline bool contains(const C &c, const V &v)
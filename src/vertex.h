@@ -26,6 +26,8 @@
 #include "gl-fun.h"
 #include "shader.h"
 
+#include <stdint.h>
+
 /* Simple Vertex */
 struct SVertex
 {
@@ -33,6 +35,14 @@ struct SVertex
 	Vec2 texPos;
 };
 
+/* Packed Simple Vertex: positions in pixels, tex
+ * coordinates in half pixels (see TileVBO) */
+struct PVertex
+{
+	int16_t pos[2];
+	uint16_t texPos[2];
+};
+
 /* Color Vertex */
 struct CVertex
 {
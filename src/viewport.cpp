@@ -27,6 +27,9 @@
 #include "quad.h"
 #include "glstate.h"
 #include "graphics.h"
+#include "shader.h"
+#include "texpool.h"
+#include "scenecapture.h"
 
 #include <SDL_rect.h>
 
@@ -38,7 +41,6 @@ struct ViewportPrivate
 	Viewport *self;
 
 	Rect *rect;
-	sigc::connection rectCon;
 
 	Color *color;
 	Tone *tone;
@@ -46,22 +48,46 @@ struct ViewportPrivate
 	IntRect screenRect;
 	int isOnScreen;
 
+	/* With 'cache' enabled, the children are composited into
+	 * 'cacheTex' (vertically flipped), which is then drawn
+	 * in their stead for as long as neither this viewport's
+	 * revision nor the global one changes */
+	bool cache;
+	TEXFBO cacheTex;
+	Quad cacheQuad;
+	IntRect cacheArea;
+	unsigned int cacheRevision;
+	unsigned int cacheGlobalRevision;
+	bool cacheValid;
+
 	EtcTemps tmp;
 
+	sigc::connection prepareCon;
+
 	ViewportPrivate(int x, int y, int width, int height, Viewport *self)
 	    : self(self),
 	      rect(&tmp.rect),
 	      color(&tmp.color),
 	      tone(&tmp.tone),
-	      isOnScreen(false)
+	      isOnScreen(false),
+	      cache(false),
+	      cacheRevision(0),
+	      cacheGlobalRevision(0),
+	      cacheValid(false)
 	{
 		rect->set(x, y, width, height);
-		updateRectCon();
+
+		/* Viewports are created before the elements they hold,
+		 * so geometry changes reach those ahead of their own
+		 * prepare pass */
+		prepareCon = shState->prepareDraw.connect
+		        (sigc::mem_fun(this, &ViewportPrivate::prepare));
 	}
 
 	~ViewportPrivate()
 	{
-		rectCon.disconnect();
+		prepareCon.disconnect();
+		releaseCache();
 	}
 
 	void onRectChange()
@@ -71,11 +97,10 @@ struct ViewportPrivate
 		recomputeOnScreen();
 	}
 
-	void updateRectCon()
+	void prepare()
 	{
-		rectCon.disconnect();
-		rectCon = rect->valueChanged.connect
-		        (sigc::mem_fun(this, &ViewportPrivate::onRectChange));
+		if (rect->changed.consume())
+			onRectChange();
 	}
 
 	void recomputeOnScreen()
@@ -97,6 +122,132 @@ struct ViewportPrivate
 
 		return (rectEffective && colorToneEffective && isOnScreen);
 	}
+
+	void releaseCache()
+	{
+		cacheValid = false;
+
+		if (cacheTex.tex == TEX::ID(0))
+			return;
+
+		shState->texPool().release(cacheTex);
+		TEXFBO::clear(cacheTex);
+	}
+
+	/* The part of the viewport that ends up on screen */
+	IntRect visibleArea() const
+	{
+		SDL_Rect r1 = { screenRect.x, screenRect.y,
+		                screenRect.w, screenRect.h };
+
+		SDL_Rect r2 = { rect->x,     rect->y,
+		                rect->width, rect->height };
+
+		SDL_Rect result;
+		if (!SDL_IntersectRect(&r1, &r2, &result))
+			return IntRect();
+
+		return IntRect(result.x, result.y, result.w, result.h);
+	}
+
+	bool cacheUpToDate(const IntRect &area) const
+	{
+		return cacheValid && area == cacheArea
+		    && cacheRevision == self->getRevision()
+		    && cacheGlobalRevision == Scene::getGlobalRevision();
+	}
+
+	void renderCache(const IntRect &area)
+	{
+		GLint prevFBO;
+		gl.GetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+
+		if (cacheTex.width != area.w || cacheTex.height != area.h)
+		{
+			releaseCache();
+			cacheTex = shState->texPool().request(area.w, area.h);
+		}
+
+		/* Record the revisions up front, so that anything
+		 * marked dirty while drawing forces a redraw */
+		cacheRevision = self->getRevision();
+		cacheGlobalRevision = Scene::getGlobalRevision();
+		cacheArea = area;
+		cacheValid = true;
+
+		/* Map the screen so that 'area' exactly covers the
+		 * texture; children keep drawing in screen coordinates,
+		 * and their scissor boxes are mapped along */
+		const Vec2i res = self->scene->getGeometry().rect.size();
+
+		ScreenMapping mapping;
+		mapping.res = res;
+		mapping.dst = IntRect(-area.x, area.y + area.h - res.y, res.x, res.y);
+
+		const ScreenMapping prevMapping = glState.scissorBox.getMapping();
+
+		FBO::bind(cacheTex.fbo);
+		glState.viewport.pushSet(mapping.dst);
+		glState.scissorBox.setMapping(mapping);
+
+		glState.scissorTest.pushSet(false);
+		glState.clearColor.pushSet(Vec4());
+		FBO::clear();
+		glState.clearColor.pop();
+		glState.scissorTest.pop();
+
+		/* The cache has no depth attachment, so tilemaps
+		 * inside fall back to separate layer draws */
+		const bool prevDepthBuffer = glState.depthBuffer;
+		glState.depthBuffer = false;
+		glState.depthTest.pushSet(false);
+
+		self->Scene::composite();
+
+		glState.depthTest.pop();
+		glState.depthBuffer = prevDepthBuffer;
+
+		glState.viewport.pop();
+		glState.scissorBox.setMapping(prevMapping);
+		FBO::bind(FBO::ID(prevFBO));
+
+		cacheQuad.setTexPosRect(IntRect(0, area.h, area.w, -area.h), area);
+	}
+
+	void drawCache()
+	{
+		SimpleShader &shader = shState->shaders().simple();
+		shader.bind();
+		shader.applyViewportProj();
+		shader.setTranslation(Vec2i());
+		shader.setTexOffsetX(0);
+		shader.setTexSize(Vec2i(cacheTex.texW, cacheTex.texH));
+
+		TEX::bind(cacheTex.tex);
+
+		/* Regular blending into the cleared texture left
+		 * it holding premultiplied color */
+		glState.blend.pushSet(true);
+		glState.blendMode.pushSet(BlendPremultiplied);
+
+		cacheQuad.draw();
+
+		glState.blendMode.pop();
+		glState.blend.pop();
+	}
+
+	void compositeCached()
+	{
+		const IntRect area = visibleArea();
+
+		if (area.w <= 0 || area.h <= 0)
+			return;
+
+		if (!cacheUpToDate(area))
+			renderCache(area);
+
+		drawCache();
+	}
 };
 
 Viewport::Viewport(int x, int y, int width, int height)
@@ -124,6 +275,7 @@ Viewport::Viewport()
 void Viewport::initViewport(int x, int y, int width, int height)
 {
 	p = new ViewportPrivate(x, y, width, height, this);
+	shState->graphics().addFlashable(this);
 
 	/* Set our own geometry */
 	geometry.rect = IntRect(x, y, width, height);
@@ -141,15 +293,36 @@ void Viewport::update()
 {
 	guardDisposed();
 
+	/* The flash is applied on top of the children */
+	if (flashing)
+		markSceneDirty();
+
 	Flashable::update();
 }
 
 DEF_ATTR_RD_SIMPLE(Viewport, OX,   int,   geometry.orig.x)
 DEF_ATTR_RD_SIMPLE(Viewport, OY,   int,   geometry.orig.y)
 
-DEF_ATTR_SIMPLE(Viewport, Rect,  Rect&,  *p->rect)
-DEF_ATTR_SIMPLE(Viewport, Color, Color&, *p->color)
-DEF_ATTR_SIMPLE(Viewport, Tone,  Tone&,  *p->tone)
+DEF_ATTR_SCENE(Viewport, Rect,  Rect&,  *p->rect)
+DEF_ATTR_SCENE(Viewport, Color, Color&, *p->color)
+DEF_ATTR_SCENE(Viewport, Tone,  Tone&,  *p->tone)
+
+DEF_ATTR_RD_SIMPLE(Viewport, Cache, bool, p->cache)
+
+void Viewport::setCache(bool value)
+{
+	guardDisposed();
+
+	if (p->cache == value)
+		return;
+
+	p->cache = value;
+
+	if (!value)
+		p->releaseCache();
+
+	markSceneDirty();
+}
 
 void Viewport::setOX(int value)
 {
@@ -178,8 +351,6 @@ void Viewport::initDynAttribs()
 	p->rect = new Rect(*p->rect);
 	p->color = new Color;
 	p->tone = new Tone;
-
-	p->updateRectCon();
 }
 
 /* Scene */
@@ -188,6 +359,13 @@ void Viewport::composite()
 	if (emptyFlashFlag)
 		return;
 
+	/* Neither children nor effects can be seen */
+	if (!p->isOnScreen)
+	{
+		++glCallCounts.culled;
+		return;
+	}
+
 	bool renderEffect = p->needsEffectRender(flashing);
 
 	if (elements.getSize() == 0 && !renderEffect)
@@ -197,7 +375,10 @@ void Viewport::composite()
 	glState.scissorTest.pushSet(true);
 	glState.scissorBox.pushSet(p->rect->toIntRect());
 
-	Scene::composite();
+	if (p->cache)
+		p->compositeCached();
+	else
+		Scene::composite();
 
 	/* If any effects are visible, request parent Scene to
 	 * render them. */
@@ -221,8 +402,14 @@ void Viewport::onGeometryChange(const Geometry &geo)
 	p->recomputeOnScreen();
 }
 
+void Viewport::capture(SceneCapture &c)
+{
+	c.viewport(*this);
+}
+
 void Viewport::releaseResources()
 {
+	shState->graphics().remFlashable(this);
 	unlink();
 
 	delete p;
@@ -45,6 +45,10 @@ public:
 	DECL_ATTR( Color, Color& )
 	DECL_ATTR( Tone,  Tone&  )
 
+	/* Composite the children into a texture that is reused
+	 * until one of them changes, instead of every frame */
+	DECL_ATTR( Cache, bool   )
+
 	void initDynAttribs();
 
 private:
@@ -54,6 +58,7 @@ private:
 	void composite();
 	void draw();
 	void onGeometryChange(const Geometry &);
+	void capture(SceneCapture &c);
 	bool isEffectiveViewport(Rect *&, Color *&, Tone *&) const;
 
 	void releaseResources();
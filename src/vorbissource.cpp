@@ -25,7 +25,15 @@
 #define OV_EXCLUDE_STATIC_CALLBACKS
 #include <vorbis/vorbisfile.h>
 #include <vector>
+#include <string.h>
 #include <algorithm>
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 static size_t vfRead(void *ptr, size_t size, size_t nmemb, void *ops)
 {
@@ -50,6 +58,83 @@ static ov_callbacks OvCallbacks =
     vfTell
 };
 
+static inline int16_t floatToS16(float value)
+{
+	float scaled = floorf(value * 32768.0f + 0.5f);
+
+	return (int16_t) std::max(-32768.0f, std::min(scaled, 32767.0f));
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+/* Rounds half away from zero, saturates on narrowing */
+static inline int16x4_t convert4(const float *src)
+{
+	float32x4_t v = vmulq_f32(vld1q_f32(src), vdupq_n_f32(32768.0f));
+
+	uint32x4_t bias = vandq_u32(vreinterpretq_u32_f32(v), vdupq_n_u32(0x80000000));
+	bias = vorrq_u32(bias, vreinterpretq_u32_f32(vdupq_n_f32(0.5f)));
+	v = vaddq_f32(v, vreinterpretq_f32_u32(bias));
+
+	return vqmovn_s32(vcvtq_s32_f32(v));
+}
+#endif
+
+/* Interleaves and converts the planar float output of
+ * ov_read_float(), the same way ov_read() would, but
+ * without the intermediate copy and several samples at once */
+static void convertFrames(float **pcm, int channels, long frames, int16_t *out)
+{
+	long i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	if (channels == 2)
+	{
+		for (; i + 4 <= frames; i += 4)
+		{
+			int16x4x2_t lr;
+			lr.val[0] = convert4(&pcm[0][i]);
+			lr.val[1] = convert4(&pcm[1][i]);
+			vst2_s16(&out[i*2], lr);
+		}
+	}
+	else
+	{
+		for (; i + 4 <= frames; i += 4)
+			vst1_s16(&out[i], convert4(&pcm[0][i]));
+	}
+#elif defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(32768.0f);
+
+	/* Rounds to nearest, saturates on packing */
+	if (channels == 2)
+	{
+		for (; i + 4 <= frames; i += 4)
+		{
+			__m128i l = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&pcm[0][i]), scale));
+			__m128i r = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&pcm[1][i]), scale));
+
+			/* Only the low halves are interleaved */
+			l = _mm_packs_epi32(l, l);
+			r = _mm_packs_epi32(r, r);
+
+			_mm_storeu_si128((__m128i*) &out[i*2], _mm_unpacklo_epi16(l, r));
+		}
+	}
+	else
+	{
+		for (; i + 4 <= frames; i += 4)
+		{
+			__m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&pcm[0][i]), scale));
+			_mm_storel_epi64((__m128i*) &out[i], _mm_packs_epi32(v, v));
+		}
+	}
+#endif
+
+	for (; i < frames; ++i)
+		for (int c = 0; c < channels; ++c)
+			out[i*channels+c] = floatToS16(pcm[c][i]);
+}
+
 
 struct VorbisSource : ALDataSource
 {
@@ -66,6 +151,10 @@ struct VorbisSource : ALDataSource
 		uint32_t end;
 		bool valid;
 		bool requested;
+
+		/* Position right after the buffer that
+		 * most recently wrapped around */
+		uint32_t resume;
 	} loop;
 
 	struct
@@ -78,10 +167,21 @@ struct VorbisSource : ALDataSource
 
 	std::vector<int16_t> sampleBuf;
 
+	/* The complete decoded file when it was small enough
+	 * to be kept in memory, in which case 'vf' and 'src'
+	 * are already closed and buffers are served from here */
+	std::vector<int16_t> pcm;
+	bool inMemory;
+	uint32_t totalFrames;
+
 	VorbisSource(SDL_RWops &ops,
-	             bool looped)
+	             bool looped,
+	             uint32_t bufSize,
+	             uint32_t memLimit)
 	    : src(ops),
-	      currentFrame(0)
+	      currentFrame(0),
+	      inMemory(false),
+	      totalFrames(0)
 	{
 		int error = ov_open_callbacks(&src, &vf, 0, 0, OvCallbacks);
 
@@ -107,11 +207,12 @@ struct VorbisSource : ALDataSource
 		info.alFormat = chooseALFormat(sizeof(int16_t), info.channels);
 		info.frameSize = sizeof(int16_t) * info.channels;
 
-		sampleBuf.resize(STREAM_BUF_SIZE);
+		sampleBuf.resize(bufSize);
 
 		loop.requested = looped;
 		loop.valid = false;
 		loop.start = loop.length = 0;
+		loop.resume = 0;
 
 		if (!loop.requested)
 			return;
@@ -143,14 +244,64 @@ struct VorbisSource : ALDataSource
 
 		loop.end = loop.start + loop.length;
 		loop.valid = (loop.start && loop.length);
+
+		ogg_int64_t total = ov_pcm_total(&vf, -1);
+
+		if (total > 0 && total * info.frameSize <= memLimit)
+			readIntoMemory(total);
 	}
 
 	~VorbisSource()
 	{
+		if (inMemory)
+			return;
+
 		ov_clear(&vf);
 		SDL_RWclose(&src);
 	}
 
+	void readIntoMemory(uint32_t frames)
+	{
+		pcm.resize(frames * info.channels);
+
+		size_t used = 0;
+
+		while (used < frames)
+		{
+			float **channels;
+			long res = ov_read_float(&vf, &channels, frames - used, 0);
+
+			if (res < 0)
+			{
+				/* Keep streaming instead */
+				std::vector<int16_t>().swap(pcm);
+				ov_raw_seek(&vf, 0);
+
+				return;
+			}
+
+			if (res == 0)
+				break;
+
+			convertFrames(channels, info.channels, res, &pcm[used * info.channels]);
+			used += res;
+		}
+
+		totalFrames = used;
+		pcm.resize(totalFrames * info.channels);
+
+		if (loop.valid && loop.start >= totalFrames)
+			loop.valid = false;
+
+		if (loop.valid && loop.end > totalFrames)
+			loop.end = totalFrames;
+
+		ov_clear(&vf);
+		SDL_RWclose(&src);
+
+		inMemory = true;
+	}
+
 	int sampleRate()
 	{
 		return info.rate;
@@ -158,6 +309,19 @@ struct VorbisSource : ALDataSource
 
 	void seekToOffset(float seconds)
 	{
+		if (inMemory)
+		{
+			currentFrame = std::max(seconds, 0.0f) * info.rate;
+
+			if (loop.valid && currentFrame >= loop.end)
+				currentFrame = loop.start;
+
+			if (currentFrame >= totalFrames)
+				currentFrame = 0;
+
+			return;
+		}
+
 		if (seconds <= 0)
 		{
 			ov_raw_seek(&vf, 0);
@@ -174,10 +338,67 @@ struct VorbisSource : ALDataSource
 			ov_raw_seek(&vf, 0);
 	}
 
+	/* Sample accurate, and without any file I/O */
+	Status fillFromMemory(AL::Buffer::ID alBuffer)
+	{
+		uint32_t startFrame = loop.valid ? loop.start : 0;
+		uint32_t endFrame = loop.valid ? loop.end : totalFrames;
+		uint32_t bufFrames = sampleBuf.size() / info.channels;
+		uint32_t frames = std::min(bufFrames, endFrame - currentFrame);
+
+		if (frames < bufFrames && loop.requested)
+		{
+			/* The loop end falls into this buffer; continue it
+			 * with the loop start right away instead of leaving
+			 * a short buffer the queue might run dry on */
+			uint32_t filled = 0;
+
+			while (filled < bufFrames)
+			{
+				frames = std::min(bufFrames - filled, endFrame - currentFrame);
+
+				memcpy(&sampleBuf[filled * info.channels],
+				       &pcm[currentFrame * info.channels],
+				       frames * info.frameSize);
+
+				filled += frames;
+				currentFrame += frames;
+
+				if (currentFrame == endFrame)
+					currentFrame = startFrame;
+			}
+
+			AL::Buffer::uploadData(alBuffer, info.alFormat, sampleBuf.data(),
+			                       bufFrames * info.frameSize, info.rate);
+
+			loop.resume = currentFrame;
+
+			return ALDataSource::WrapAround;
+		}
+
+		AL::Buffer::uploadData(alBuffer, info.alFormat,
+		                       &pcm[currentFrame * info.channels],
+		                       frames * info.frameSize, info.rate);
+
+		currentFrame += frames;
+
+		if (currentFrame < endFrame)
+			return ALDataSource::NoError;
+
+		if (!loop.requested)
+			return ALDataSource::EndOfStream;
+
+		currentFrame = loop.resume = startFrame;
+
+		return ALDataSource::WrapAround;
+	}
+
 	Status fillBuffer(AL::Buffer::ID alBuffer)
 	{
-		void *bufPtr = sampleBuf.data();
-		int availBuf = sampleBuf.size();
+		if (inMemory)
+			return fillFromMemory(alBuffer);
+
+		int availBuf = sampleBuf.size() * sizeof(int16_t);
 		int bufUsed  = 0;
 
 		int canRead = availBuf;
@@ -186,17 +407,24 @@ struct VorbisSource : ALDataSource
 
 		bool readAgain = false;
 
-		if (loop.valid)
+		if (loop.valid && currentFrame < loop.end)
 		{
-			int tilLoopEnd = loop.end * info.frameSize;
+			int tilLoopEnd = (loop.end - currentFrame) * info.frameSize;
 
 			canRead = std::min(availBuf, tilLoopEnd);
 		}
 
 		while (canRead > 16)
 		{
-			long res = ov_read(&vf, static_cast<char*>(bufPtr),
-			                   canRead, 0, sizeof(int16_t), 1, 0);
+			float **channels;
+			long frames = ov_read_float(&vf, &channels, canRead / info.frameSize, 0);
+			long res = frames;
+
+			if (frames > 0)
+			{
+				convertFrames(channels, info.channels, frames, &sampleBuf[bufUsed]);
+				res = frames * info.frameSize;
+			}
 
 			if (res < 0)
 			{
@@ -211,21 +439,23 @@ struct VorbisSource : ALDataSource
 				/* EOF */
 				if (loop.requested)
 				{
+					/* Wrapped around buffers are filled up
+					 * from the start (see below) */
 					retStatus = ALDataSource::WrapAround;
 					seekToOffset(0);
 				}
 				else
 				{
 					retStatus = ALDataSource::EndOfStream;
+
+					if (bufUsed > 0)
+						break;
 				}
 
 				/* If we sought right to the end of the file,
 				 * we might be EOF without actually having read
 				 * any data at all yet (which mustn't happen),
 				 * so we try to continue reading some data. */
-				if (bufUsed > 0)
-					break;
-
 				if (readAgain)
 				{
 					/* We're still not getting data though.
@@ -235,11 +465,15 @@ struct VorbisSource : ALDataSource
 				}
 
 				readAgain = true;
+
+				continue;
 			}
 
+			readAgain = false;
+
 			bufUsed += (res / sizeof(int16_t));
-			bufPtr = &sampleBuf[bufUsed];
 			currentFrame += (res / info.frameSize);
+			canRead -= res;
 
 			if (loop.valid && currentFrame >= loop.end)
 			{
@@ -253,14 +487,23 @@ struct VorbisSource : ALDataSource
 				/* Seek to loop start */
 				currentFrame = loop.start;
 				if (ov_pcm_seek(&vf, currentFrame) != 0)
+				{
 					retStatus = ALDataSource::Error;
+					break;
+				}
 
-				break;
+				/* Decode ahead past the loop start into the rest
+				 * of this buffer, so the transition is seamless
+				 * and the queue isn't left with a short buffer */
+				int tilLoopEnd = (loop.end - loop.start) * info.frameSize;
+				canRead = std::min<int>(availBuf - bufUsed * sizeof(int16_t),
+				                        tilLoopEnd);
 			}
-
-			canRead -= res;
 		}
 
+		if (retStatus == ALDataSource::WrapAround)
+			loop.resume = currentFrame;
+
 		if (retStatus != ALDataSource::Error)
 			AL::Buffer::uploadData(alBuffer, info.alFormat, sampleBuf.data(),
 			                       bufUsed*sizeof(int16_t), info.rate);
@@ -270,10 +513,7 @@ struct VorbisSource : ALDataSource
 
 	uint32_t loopStartFrames()
 	{
-		if (loop.valid)
-			return loop.start;
-		else
-			return 0;
+		return loop.resume;
 	}
 
 	bool setPitch(float)
@@ -283,7 +523,9 @@ struct VorbisSource : ALDataSource
 };
 
 ALDataSource *createVorbisSource(SDL_RWops &ops,
-                                 bool looped)
+                                 bool looped,
+                                 uint32_t bufSize,
+                                 uint32_t memLimit)
 {
-	return new VorbisSource(ops, looped);
+	return new VorbisSource(ops, looped, bufSize, memLimit);
 }
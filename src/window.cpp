@@ -31,8 +31,10 @@
 #include "gl-util.h"
 #include "quad.h"
 #include "quadarray.h"
-#include "texpool.h"
+#include "windowbasecache.h"
 #include "glstate.h"
+#include "profiler.h"
+#include "scenecapture.h"
 
 #include <sigc++/connection.h>
 
@@ -60,6 +62,8 @@ static const IntRect pauseAniSrc[] =
 	IntRect(176, 80, 16, 16)
 };
 
+static elementsN(pauseAniSrc);
+
 static const Sides<IntRect> bordersSrc =
 {
 	IntRect(128, 16, 16, 32),
@@ -177,8 +181,6 @@ struct WindowPrivate
 	bool active;
 	bool pause;
 
-	sigc::connection cursorRectCon;
-
 	Vec2i sceneOffset;
 
 	Vec2i position;
@@ -191,12 +193,14 @@ struct WindowPrivate
 
 	bool baseVertDirty;
 	bool opacityDirty;
-	bool baseTexDirty;
 
 	ColorQuadArray baseQuadArray;
 
-	/* Used when opacity < 255 */
+	/* Used when opacity < 255, shared through
+	 * the WindowBaseCache under 'baseKey' */
 	TEXFBO baseTex;
+	WindowBaseKey baseKey;
+	bool baseTexHeld;
 	bool useBaseTex;
 
 	QuadChunk backgroundVert;
@@ -230,13 +234,18 @@ struct WindowPrivate
 
 	WindowControls controlsElement;
 
+	/* Cursor quads, then scroll arrows, then one pause
+	 * quad per animation frame. The animations only
+	 * change uniforms and which pause quad is drawn */
 	ColorQuadArray controlsQuadArray;
-	int controlsQuadCount;
+	int cursorQuadCount;
+	int arrowQuadCount;
 
 	Quad contentsQuad;
 
-	QuadChunk pauseAniVert;
-	QuadChunk cursorVert;
+	float cursorAlpha;
+	float pauseAlpha;
+	uint8_t pauseFrame;
 
 	uint8_t cursorAniAlphaIdx;
 	uint8_t pauseAniAlphaIdx;
@@ -260,18 +269,19 @@ struct WindowPrivate
 	      contentsOpacity(255),
 	      baseVertDirty(true),
 	      opacityDirty(true),
-	      baseTexDirty(true),
+	      baseTexHeld(false),
 	      controlsElement(this, viewport),
+	      cursorQuadCount(0),
+	      arrowQuadCount(0),
+	      cursorAlpha(1),
+	      pauseAlpha(0),
+	      pauseFrame(0),
 	      cursorAniAlphaIdx(0),
 	      pauseAniAlphaIdx(0),
 	      pauseAniQuadIdx(0),
 	      controlsVertDirty(true)
 	{
-		refreshCursorRectCon();
-
-		controlsQuadArray.resize(14);
-		cursorVert.count = 9;
-		pauseAniVert.count = 1;
+		controlsQuadArray.resize(9 + 4 + pauseAniSrcN);
 
 		prepareCon = shState->prepareDraw.connect
 		        (sigc::mem_fun(this, &WindowPrivate::prepare));
@@ -279,8 +289,7 @@ struct WindowPrivate
 
 	~WindowPrivate()
 	{
-		shState->texPool().release(baseTex);
-		cursorRectCon.disconnect();
+		releaseBaseTex();
 		prepareCon.disconnect();
 	}
 
@@ -289,13 +298,6 @@ struct WindowPrivate
 		controlsVertDirty = true;
 	}
 
-	void refreshCursorRectCon()
-	{
-		cursorRectCon.disconnect();
-		cursorRectCon = cursorRect->valueChanged.connect
-		        (sigc::mem_fun(this, &WindowPrivate::markControlVertDirty));
-	}
-
 	void buildBaseVert()
 	{
 		int w = size.x;
@@ -373,7 +375,6 @@ struct WindowPrivate
 		baseTexQuad.setTexPosRect(texRect, texRect);
 
 		opacityDirty = true;
-		baseTexDirty = true;
 	}
 
 	void updateBaseAlpha()
@@ -382,49 +383,54 @@ struct WindowPrivate
 		backgroundVert.setAlpha(backOpacity.norm);
 
 		baseTexQuad.setColor(Vec4(1, 1, 1, opacity.norm));
-
-		baseTexDirty = true;
 	}
 
-	void ensureBaseTexReady()
+	/* Switches to the shared base texture matching the
+	 * current look, drawing it if no other window has */
+	void updateBaseTex()
 	{
-		/* Make sure texture is big enough */
-		int newW = baseTex.width;
-		int newH = baseTex.height;
-		bool resizeNeeded = false;
+		WindowBaseKey key;
+		key.layout = WindowBaseKey::XP;
+		key.skinStamp = windowskin->contentStamp();
+		key.size = size;
+		key.stretch = bgStretch;
+		key.backOpacity = backOpacity;
+		key.tone = Vec4();
+
+		if (baseTexHeld && key == baseKey)
+			return;
 
-		if (size.x > baseTex.width)
-		{
-			newW = findNextPow2(size.x);
-			resizeNeeded = true;
-		}
-		if (size.y > baseTex.height)
-		{
-			newH = findNextPow2(size.y);
-			resizeNeeded = true;
-		}
+		bool cached = shState->windowBaseCache().acquire(key, baseTex);
 
-		if (!resizeNeeded)
-			return;
+		releaseBaseTex();
+		baseKey = key;
+		baseTexHeld = true;
+
+		if (!cached)
+			redrawBaseTex();
+	}
 
-		shState->texPool().release(baseTex);
-		baseTex = shState->texPool().request(newW, newH);
+	void releaseBaseTex()
+	{
+		if (!baseTexHeld)
+			return;
 
-		baseTexDirty = true;
+		shState->windowBaseCache().release(baseKey);
+		baseTexHeld = false;
 	}
 
 	void redrawBaseTex()
 	{
 		/* Discard old buffer */
 		TEX::bind(baseTex.tex);
-		TEX::allocEmpty(baseTex.width, baseTex.height);
+		TEX::allocEmpty(baseTex.texW, baseTex.texH);
 		TEX::unbind();
 
 		FBO::bind(baseTex.fbo);
 		glState.viewport.pushSet(IntRect(0, 0, baseTex.width, baseTex.height));
 		glState.clearColor.pushSet(Vec4());
 
-		SimpleAlphaShader &shader = shState->shaders().simpleAlpha;
+		SimpleAlphaShader &shader = shState->shaders().simpleAlpha();
 		shader.bind();
 		shader.applyViewportProj();
 		shader.setTranslation(Vec2i());
@@ -466,11 +472,12 @@ struct WindowPrivate
 			/* Effective cursor rect has 16 xy offset to window */
 			IntRect effectRect(cursorRect->x+16, cursorRect->y+16,
 			                   cursorRect->width, cursorRect->height);
-			cursorVert.vert = &vert[i*4];
-			TileQuads::buildFrameSource(cursorSrc, cursorVert.vert);
-			i += TileQuads::buildFrame(effectRect, cursorVert.vert);
+			TileQuads::buildFrameSource(cursorSrc, &vert[i*4]);
+			i += TileQuads::buildFrame(effectRect, &vert[i*4]);
 		}
 
+		cursorQuadCount = i;
+
 		/* Scroll arrow position: Top Bottom X, Left Right Y */
 		const Vec2i scroll = (size - Vec2i(16)) / 2;
 
@@ -496,20 +503,29 @@ struct WindowPrivate
 				i += Quad::setTexPosRect(&vert[i*4], scrollArrowSrc.b, scrollArrows.b);
 		}
 
-		/* Pause animation */
+		arrowQuadCount = i - cursorQuadCount;
+
+		/* Pause animation, all frames */
 		if (pause)
 		{
-			pauseAniVert.vert = &vert[i*4];
-			i += Quad::setTexPosRect(&vert[i*4], pauseAniSrc[pauseAniQuad[pauseAniQuadIdx]],
-			                         FloatRect((size.x - 16) / 2, size.y - 16, 16, 16));
+			const FloatRect pausePos((size.x - 16) / 2, size.y - 16, 16, 16);
+
+			for (size_t j = 0; j < pauseAniSrcN; ++j)
+				i += Quad::setTexPosRect(&vert[i*4], pauseAniSrc[j], pausePos);
 		}
 
+		/* Clipped to the window here rather than
+		 * through the scissor box while drawing */
+		Quad::clipQuads(vert, i, FloatRect(0, 0, size.x, size.y));
+
 		controlsQuadArray.commit();
-		controlsQuadCount = i;
 	}
 
 	void prepare()
 	{
+		if (cursorRect->changed.consume())
+			markControlVertDirty();
+
 		if (size.x <= 0 || size.y <= 0)
 			return;
 
@@ -536,16 +552,8 @@ struct WindowPrivate
 		 * and then draw this texture instead of the quad array */
 		useBaseTex = opacity < 255;
 
-		if (useBaseTex)
-		{
-			ensureBaseTexReady();
-
-			if (baseTexDirty)
-			{
-				redrawBaseTex();
-				baseTexDirty = false;
-			}
-		}
+		if (useBaseTex && !nullOrDisposed(windowskin))
+			updateBaseTex();
 	}
 
 	void drawBase()
@@ -556,14 +564,14 @@ struct WindowPrivate
 		if (size == Vec2i(0, 0))
 			return;
 
-		SimpleAlphaShader &shader = shState->shaders().simpleAlpha;
+		SimpleAlphaShader &shader = shState->shaders().simpleAlpha();
 		shader.bind();
 		shader.applyViewportProj();
 		shader.setTranslation(position + sceneOffset);
 
 		if (useBaseTex)
 		{
-			shader.setTexSize(Vec2i(baseTex.width, baseTex.height));
+			shader.setTexSize(Vec2i(baseTex.texW, baseTex.texH));
 
 			TEX::bind(baseTex.tex);
 			baseTexQuad.draw();
@@ -597,71 +605,92 @@ struct WindowPrivate
 		/* Effective on screen coordinates */
 		const Vec2i efPos = position + sceneOffset;
 
-		const IntRect windowRect(efPos, size);
-		const IntRect contentsRect(efPos + Vec2i(16), size - Vec2i(32));
-
-		glState.scissorTest.pushSet(true);
-		glState.scissorBox.push();
-		glState.scissorBox.setIntersect(windowRect);
-
-		SimpleAlphaShader &shader = shState->shaders().simpleAlpha;
-		shader.bind();
-		shader.applyViewportProj();
-
 		if (!nullOrDisposed(windowskin))
 		{
+			SimpleAlphaUniShader &shader = shState->shaders().simpleAlphaUni();
+			shader.bind();
+			shader.applyViewportProj();
 			shader.setTranslation(efPos);
 
 			/* Draw arrows / cursors */
 			windowskin->bindTex(shader);
 			TEX::setSmooth(true);
 
-			controlsQuadArray.draw(0, controlsQuadCount);
+			drawControlQuads(shader, 0, cursorQuadCount, cursorAlpha);
+			drawControlQuads(shader, cursorQuadCount, arrowQuadCount, 1);
+
+			if (pause)
+				drawControlQuads(shader, cursorQuadCount + arrowQuadCount + pauseFrame,
+				                 1, pauseAlpha);
 
 			TEX::setSmooth(false);
 		}
 
-		if (!nullOrDisposed(contents))
+		if (!nullOrDisposed(contents) && updateContentsQuad())
 		{
-			/* Draw contents bitmap */
-			glState.scissorBox.setIntersect(contentsRect);
+			SimpleAlphaShader &shader = shState->shaders().simpleAlpha();
+			shader.bind();
+			shader.applyViewportProj();
 
-			shader.setTranslation(efPos + (Vec2i(16) - contentsOffset));
+			/* Draw contents bitmap */
+			shader.setTranslation(efPos);
 
 			contents->bindTex(shader);
 			contentsQuad.draw();
 		}
+	}
+
+	/* Sets up 'contentsQuad' with the part of the contents
+	 * visible inside the window (in its local coordinates).
+	 * Returns false if there is none */
+	bool updateContentsQuad()
+	{
+		FloatRect clip(16, 16, size.x - 32, size.y - 32);
+		FloatRect tex(0, 0, contents->width(), contents->height());
+		FloatRect pos(16 - contentsOffset.x, 16 - contentsOffset.y,
+		              tex.w, tex.h);
+
+		if (!Quad::clipTexPosRect(tex, pos, clip))
+			return false;
 
-		glState.scissorBox.pop();
-		glState.scissorTest.pop();
+		if (pos != contentsQuad.posRect || tex != contentsQuad.texRect)
+			contentsQuad.setTexPosRect(tex, pos);
+
+		return true;
 	}
 
-	void updateControls()
+	void drawControlQuads(SimpleAlphaUniShader &shader,
+	                      int offset, int count, float alpha)
 	{
-		bool updateArray = false;
+		if (count == 0)
+			return;
 
-		if (active && cursorVert.vert)
-		{
-			float alpha = cursorAniAlpha[cursorAniAlphaIdx] / 255.0f;
+		shader.setAlpha(alpha);
 
-			cursorVert.setAlpha(alpha);
+		controlsQuadArray.draw(offset, count);
+	}
 
-			updateArray = true;
-		}
+	void updateControls()
+	{
+		bool changed = false;
 
-		if (pause && pauseAniVert.vert)
+		if (active && cursorQuadCount > 0)
 		{
-			float alpha = pauseAniAlpha[pauseAniAlphaIdx] / 255.0f;
-			FloatRect frameRect = pauseAniSrc[pauseAniQuad[pauseAniQuadIdx]];
-
-			pauseAniVert.setAlpha(alpha);
-			Quad::setTexRect(pauseAniVert.vert, frameRect);
+			cursorAlpha = cursorAniAlpha[cursorAniAlphaIdx] / 255.0f;
+			changed = true;
+		}
 
-			updateArray = true;
+		if (pause)
+		{
+			pauseAlpha = pauseAniAlpha[pauseAniAlphaIdx] / 255.0f;
+			pauseFrame = pauseAniQuad[pauseAniQuadIdx];
+			changed = true;
 		}
 
-		if (updateArray)
-			controlsQuadArray.commit();
+		/* Cursor and pause animations are stepped by every
+		 * update, so a window showing them is never idle */
+		if (changed)
+			controlsElement.markSceneDirty();
 	}
 
 	void stepAnimations()
@@ -697,9 +726,9 @@ void Window::update()
 	p->stepAnimations();
 }
 
-DEF_ATTR_SIMPLE(Window, X,          int,     p->position.x)
-DEF_ATTR_SIMPLE(Window, Y,          int,     p->position.y)
-DEF_ATTR_SIMPLE(Window, CursorRect, Rect&,  *p->cursorRect)
+DEF_ATTR_SCENE(Window, X,          int,     p->position.x)
+DEF_ATTR_SCENE(Window, Y,          int,     p->position.y)
+DEF_ATTR_SCENE(Window, CursorRect, Rect&,  *p->cursorRect)
 
 DEF_ATTR_RD_SIMPLE(Window, Windowskin,      Bitmap*, p->windowskin)
 DEF_ATTR_RD_SIMPLE(Window, Contents,        Bitmap*, p->contents)
@@ -719,6 +748,7 @@ void Window::setWindowskin(Bitmap *value)
 	guardDisposed();
 
 	p->windowskin = value;
+	markSceneDirty();
 
 	if (nullOrDisposed(value))
 		return;
@@ -735,12 +765,12 @@ void Window::setContents(Bitmap *value)
 
 	p->contents = value;
 	p->controlsVertDirty = true;
+	markSceneDirty();
 
 	if (nullOrDisposed(value))
 		return;
 
 	value->ensureNonMega();
-	p->contentsQuad.setTexPosRect(value->rect(), value->rect());
 }
 
 void Window::setStretch(bool value)
@@ -752,6 +782,7 @@ void Window::setStretch(bool value)
 
 	p->bgStretch = value;
 	p->baseVertDirty = true;
+	markSceneDirty();
 }
 
 void Window::setActive(bool value)
@@ -763,6 +794,7 @@ void Window::setActive(bool value)
 
 	p->active = value;
 	p->cursorAniAlphaIdx = 0;
+	markSceneDirty();
 }
 
 void Window::setPause(bool value)
@@ -776,6 +808,7 @@ void Window::setPause(bool value)
 	p->pauseAniAlphaIdx = 0;
 	p->pauseAniQuadIdx = 0;
 	p->controlsVertDirty = true;
+	markSceneDirty();
 }
 
 void Window::setWidth(int value)
@@ -787,6 +820,7 @@ void Window::setWidth(int value)
 
 	p->size.x = value;
 	p->baseVertDirty = true;
+	markSceneDirty();
 }
 
 void Window::setHeight(int value)
@@ -798,6 +832,7 @@ void Window::setHeight(int value)
 
 	p->size.y = value;
 	p->baseVertDirty = true;
+	markSceneDirty();
 }
 
 void Window::setOX(int value)
@@ -809,6 +844,7 @@ void Window::setOX(int value)
 
 	p->contentsOffset.x = value;
 	p->controlsVertDirty = true;
+	markSceneDirty();
 }
 
 void Window::setOY(int value)
@@ -820,6 +856,7 @@ void Window::setOY(int value)
 
 	p->contentsOffset.y = value;
 	p->controlsVertDirty = true;
+	markSceneDirty();
 }
 
 void Window::setOpacity(int value)
@@ -831,6 +868,7 @@ void Window::setOpacity(int value)
 
 	p->opacity = value;
 	p->opacityDirty = true;
+	markSceneDirty();
 }
 
 void Window::setBackOpacity(int value)
@@ -842,6 +880,7 @@ void Window::setBackOpacity(int value)
 
 	p->backOpacity = value;
 	p->opacityDirty = true;
+	markSceneDirty();
 }
 
 void Window::setContentsOpacity(int value)
@@ -853,17 +892,18 @@ void Window::setContentsOpacity(int value)
 
 	p->contentsOpacity = value;
 	p->contentsQuad.setColor(Vec4(1, 1, 1, p->contentsOpacity.norm));
+	markSceneDirty();
 }
 
 void Window::initDynAttribs()
 {
 	p->cursorRect = new Rect;
-
-	p->refreshCursorRectCon();
 }
 
 void Window::draw()
 {
+	PROFILE_SCOPE(Windows);
+
 	p->drawBase();
 }
 
@@ -872,6 +912,11 @@ void Window::onGeometryChange(const Scene::Geometry &geo)
 	p->sceneOffset = geo.offset();
 }
 
+void Window::capture(SceneCapture &c)
+{
+	c.window(*this);
+}
+
 void Window::setZ(int value)
 {
 	ViewportElement::setZ(value);
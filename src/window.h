@@ -63,6 +63,7 @@ private:
 
 	void draw();
 	void onGeometryChange(const Scene::Geometry &);
+	void capture(SceneCapture &c);
 	void setZ(int value);
 	void setVisible(bool value);
 
@@ -0,0 +1,134 @@
+/*
+** windowbasecache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "windowbasecache.h"
+
+#include "texpool.h"
+#include "boost-hash.h"
+
+#include <boost/functional/hash.hpp>
+
+bool WindowBaseKey::operator==(const WindowBaseKey &o) const
+{
+	return layout == o.layout && skinStamp == o.skinStamp
+	    && size == o.size && stretch == o.stretch
+	    && backOpacity == o.backOpacity && tone == o.tone;
+}
+
+size_t hash_value(const WindowBaseKey &key)
+{
+	size_t seed = 0;
+
+	boost::hash_combine(seed, (int) key.layout);
+	boost::hash_combine(seed, key.skinStamp);
+	boost::hash_combine(seed, key.size.x);
+	boost::hash_combine(seed, key.size.y);
+	boost::hash_combine(seed, key.stretch);
+	boost::hash_combine(seed, key.backOpacity);
+	boost::hash_combine(seed, key.tone.x);
+	boost::hash_combine(seed, key.tone.y);
+	boost::hash_combine(seed, key.tone.z);
+	boost::hash_combine(seed, key.tone.w);
+
+	return seed;
+}
+
+struct BaseEntry
+{
+	TEXFBO tex;
+	int refCount;
+};
+
+struct WindowBaseCachePrivate
+{
+	TexPool &pool;
+
+	BoostHash<WindowBaseKey, BaseEntry> hash;
+
+	int count;
+
+	WindowBaseCachePrivate(TexPool &pool)
+	    : pool(pool),
+	      count(0)
+	{}
+
+	void drop(const WindowBaseKey &key)
+	{
+		BaseEntry &entry = hash[key];
+
+		/* Windows may have turned on filtering */
+		TEX::bind(entry.tex.tex);
+		TEX::setSmooth(false);
+
+		pool.release(entry.tex);
+		hash.remove(key);
+		--count;
+	}
+};
+
+WindowBaseCache::WindowBaseCache(TexPool &pool)
+{
+	p = new WindowBaseCachePrivate(pool);
+}
+
+WindowBaseCache::~WindowBaseCache()
+{
+	delete p;
+}
+
+bool WindowBaseCache::acquire(const WindowBaseKey &key, TEXFBO &tex)
+{
+	if (p->hash.contains(key))
+	{
+		BaseEntry &entry = p->hash[key];
+		++entry.refCount;
+		tex = entry.tex;
+
+		return true;
+	}
+
+	BaseEntry entry;
+	entry.tex = p->pool.request(key.size.x, key.size.y);
+	entry.refCount = 1;
+
+	p->hash.insert(key, entry);
+	++p->count;
+
+	tex = entry.tex;
+
+	return false;
+}
+
+void WindowBaseCache::release(const WindowBaseKey &key)
+{
+	BaseEntry &entry = p->hash[key];
+
+	if (--entry.refCount > 0)
+		return;
+
+	p->drop(key);
+}
+
+int WindowBaseCache::entryCount() const
+{
+	return p->count;
+}
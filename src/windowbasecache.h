@@ -0,0 +1,83 @@
+/*
+** windowbasecache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WINDOWBASECACHE_H
+#define WINDOWBASECACHE_H
+
+#include "gl-util.h"
+#include "etc-internal.h"
+
+class TexPool;
+struct WindowBaseCachePrivate;
+
+/* Everything a window's base (background and frame)
+ * texture is drawn from */
+struct WindowBaseKey
+{
+	enum Layout
+	{
+		XP,
+		VX
+	};
+
+	Layout layout;
+
+	/* Bitmap::contentStamp() of the windowskin */
+	unsigned int skinStamp;
+
+	Vec2i size;
+	bool stretch;
+	int backOpacity;
+	Vec4 tone;
+
+	bool operator==(const WindowBaseKey &o) const;
+};
+
+size_t hash_value(const WindowBaseKey &key);
+
+/* Shares base textures between windows that look the same,
+ * which scripts commonly create several of at once. Since the
+ * windowskin's content stamp is part of the key, modifying the
+ * windowskin moves windows on to a new entry. Entries are
+ * refcounted and their texture goes back to the TexPool as
+ * soon as the last window lets go of it */
+class WindowBaseCache
+{
+public:
+	WindowBaseCache(TexPool &pool);
+	~WindowBaseCache();
+
+	/* Takes a reference on the texture for 'key' and returns
+	 * true if it already holds the base. Otherwise a new entry
+	 * of 'key.size' is created, which the caller has to draw */
+	bool acquire(const WindowBaseKey &key, TEXFBO &tex);
+
+	/* Drops a reference */
+	void release(const WindowBaseKey &key);
+
+	int entryCount() const;
+
+private:
+	WindowBaseCachePrivate *p;
+};
+
+#endif // WINDOWBASECACHE_H
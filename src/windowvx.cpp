@@ -27,10 +27,11 @@
 #include "quad.h"
 #include "quadarray.h"
 #include "sharedstate.h"
-#include "texpool.h"
+#include "windowbasecache.h"
 #include "tilequad.h"
 #include "glstate.h"
 #include "shader.h"
+#include "profiler.h"
 
 #include <limits>
 #include <algorithm>
@@ -178,24 +179,23 @@ struct WindowVXPrivate
 
 	NormValue openness;
 	Tone *tone;
-
-	sigc::connection cursorRectCon;
-	sigc::connection toneCon;
 	sigc::connection prepareCon;
 
 	EtcTemps tmp;
 
 	struct
 	{
+		/* Shared through the WindowBaseCache under 'key' */
 		TEXFBO tex;
+		WindowBaseKey key;
+		bool texHeld;
+
 		ColorQuadArray vert;
 		size_t bgTileQuads;
 		size_t borderQuads;
 		Quad quad;
 
 		bool vertDirty;
-		bool texSizeDirty;
-		bool texDirty;
 	} base;
 
 	ColorQuadArray ctrlVert;
@@ -208,6 +208,11 @@ struct WindowVXPrivate
 	IntRect clipRect;
 
 	ColorQuadArray cursorVert;
+	/* What 'cursorVert' was clipped to (in cursor coordinates) */
+	FloatRect cursorClip;
+
+	/* Whether any part of the contents is inside 'clipRect' */
+	bool contentsVisible;
 
 	bool ctrlVertDirty;
 	bool ctrlVertArrayDirty;
@@ -238,6 +243,7 @@ struct WindowVXPrivate
 	      contentsOpacity(255),
 	      openness(255),
 	      tone(&tmp.tone),
+	      contentsVisible(false),
 	      ctrlVertDirty(false),
 	      ctrlVertArrayDirty(false),
 	      clipRectDirty(false),
@@ -251,14 +257,12 @@ struct WindowVXPrivate
 		ctrlVert.resize(4 + 1);
 		pauseVert = &ctrlVert.vertices[4*4];
 
+		base.texHeld = false;
 		base.vertDirty = false;
-		base.texSizeDirty = false;
-		base.texDirty = false;
 
 		if (w > 0 || h > 0)
 		{
 			base.vertDirty = true;
-			base.texSizeDirty = true;
 			clipRectDirty = true;
 			ctrlVertDirty = true;
 		}
@@ -266,17 +270,13 @@ struct WindowVXPrivate
 		prepareCon = shState->prepareDraw.connect
 			(sigc::mem_fun(this, &WindowVXPrivate::prepare));
 
-		refreshCursorRectCon();
-		refreshToneCon();
 		updateBaseQuad();
 	}
 
 	~WindowVXPrivate()
 	{
-		shState->texPool().release(base.tex);
+		releaseBaseTex();
 
-		cursorRectCon.disconnect();
-		toneCon.disconnect();
 		prepareCon.disconnect();
 	}
 
@@ -285,45 +285,50 @@ struct WindowVXPrivate
 		cursorVertDirty = true;
 	}
 
-	void invalidateBaseTex()
+	/* Switches to the shared base texture matching the
+	 * current look, drawing it if no other window has */
+	void updateBaseTex()
 	{
-		base.texDirty = true;
-	}
+		if (nullOrDisposed(windowskin) || geo.w == 0 || geo.h == 0)
+		{
+			releaseBaseTex();
+			return;
+		}
 
-	void refreshCursorRectCon()
-	{
-		cursorRectCon.disconnect();
-		cursorRectCon = cursorRect->valueChanged.connect
-		        (sigc::mem_fun(this, &WindowVXPrivate::invalidateCursorVert));
-	}
+		WindowBaseKey key;
+		key.layout = WindowBaseKey::VX;
+		key.skinStamp = windowskin->contentStamp();
+		key.size = Vec2i(geo.w, geo.h);
+		key.stretch = true;
+		key.backOpacity = backOpacity;
+		key.tone = tone->norm;
 
-	void refreshToneCon()
-	{
-		toneCon.disconnect();
-		toneCon = tone->valueChanged.connect
-			(sigc::mem_fun(this, &WindowVXPrivate::invalidateBaseTex));
-	}
-
-	void updateBaseTexSize()
-	{
-		if (base.tex.width >= geo.w && base.tex.height >= geo.h)
+		if (base.texHeld && key == base.key)
 			return;
 
-		if (base.tex.tex != TEX::ID(0))
-		{
-			TEX::bind(base.tex.tex);
-			TEX::setSmooth(false); // XXX make pool set this up at alloc time
-		}
+		WindowBaseCache &cache = shState->windowBaseCache();
+		bool cached = cache.acquire(key, base.tex);
 
-		shState->texPool().release(base.tex);
-		TEXFBO::clear(base.tex);
+		releaseBaseTex();
+		base.key = key;
+		base.texHeld = true;
 
-		if (geo.w == 0 || geo.h == 0)
+		if (cached)
 			return;
 
-		base.tex = shState->texPool().request(geo.w, geo.h);
 		TEX::bind(base.tex.tex);
 		TEX::setSmooth(true);
+
+		redrawBaseTex();
+	}
+
+	void releaseBaseTex()
+	{
+		if (!base.texHeld)
+			return;
+
+		shState->windowBaseCache().release(base.key);
+		base.texHeld = false;
 	}
 
 	void rebuildBaseVert()
@@ -407,12 +412,6 @@ struct WindowVXPrivate
 
 	void redrawBaseTex()
 	{
-		if (nullOrDisposed(windowskin))
-			return;
-
-		if (base.tex.tex == TEX::ID(0))
-			return;
-
 		FBO::bind(base.tex.fbo);
 
 		/* Clear texture */
@@ -427,7 +426,7 @@ struct WindowVXPrivate
 
 		if (backOpacity < 255 || tone->hasEffect())
 		{
-			PlaneShader &planeShader = shState->shaders().plane;
+			PlaneShader &planeShader = shState->shaders().plane();
 			planeShader.bind();
 
 			planeShader.setColor(Vec4());
@@ -439,7 +438,7 @@ struct WindowVXPrivate
 		}
 		else
 		{
-			shader = &shState->shaders().simple;
+			shader = &shState->shaders().simple();
 			shader->bind();
 		}
 
@@ -461,9 +460,9 @@ struct WindowVXPrivate
 		glState.blendMode.set(BlendNormal);
 
 		/* If we used plane shader before, switch to simple */
-		if (shader != &shState->shaders().simple)
+		if (shader != &shState->shaders().simple())
 		{
-			shader = &shState->shaders().simple;
+			shader = &shState->shaders().simple();
 			shader->bind();
 			shader->setTranslation(Vec2i());
 			shader->applyViewportProj();
@@ -479,13 +478,13 @@ struct WindowVXPrivate
 		glState.viewport.pop();
 	}
 
+	/* Openness isn't baked in; the quad is squashed
+	 * by the shader while drawing instead */
 	void updateBaseQuad()
 	{
-		const FloatRect tex(0, 0, geo.w, geo.h);
-		const FloatRect pos(0, (geo.h / 2.0f) * (1.0f - openness.norm),
-		                    geo.w, geo.h * openness.norm);
+		const FloatRect rect(0, 0, geo.w, geo.h);
 
-		base.quad.setTexPosRect(tex, pos);
+		base.quad.setTexPosRect(rect, rect);
 	}
 
 	void updateClipRect()
@@ -548,12 +547,34 @@ struct WindowVXPrivate
 		ctrlVertArrayDirty = true;
 	}
 
+	/* Window local origin of the cursor */
+	Vec2i cursorOrigin() const
+	{
+		Vec2i origin = padRect.pos() + Vec2i(cursorRect->x, cursorRect->y);
+
+		if (rgssVer >= 3)
+			origin -= contentsOff;
+
+		return origin;
+	}
+
+	/* The cursor is clipped to the padded area
+	 * in RGSS3, otherwise to the whole window */
+	FloatRect currentCursorClip() const
+	{
+		IntRect clip = (rgssVer >= 3) ? clipRect : IntRect(Vec2i(), geo.size());
+		clip.setPos(clip.pos() - cursorOrigin());
+
+		return clip;
+	}
+
 	void rebuildCursorVert()
 	{
 		const IntRect rect = cursorRect->toIntRect();
 		const CursorSrc &src = cursorSrc;
 
 		cursorVertArrayDirty = true;
+		cursorClip = currentCursorClip();
 
 		if (rect.w <= 0 || rect.h <= 0)
 		{
@@ -622,6 +643,30 @@ struct WindowVXPrivate
 
 		if (drawBg)
 			Quad::setTexPosRect(&vert[i*4], src.bg, bgPos);
+
+		/* Clipped here rather than through
+		 * the scissor box while drawing */
+		Quad::clipQuads(vert, quads, cursorClip);
+	}
+
+	void updateContentsQuad()
+	{
+		contentsVisible = false;
+
+		if (nullOrDisposed(contents))
+			return;
+
+		FloatRect tex(0, 0, contents->width(), contents->height());
+		FloatRect pos(padRect.x - contentsOff.x, padRect.y - contentsOff.y,
+		              tex.w, tex.h);
+
+		if (!Quad::clipTexPosRect(tex, pos, clipRect))
+			return;
+
+		if (pos != contentsQuad.posRect || tex != contentsQuad.texRect)
+			contentsQuad.setTexPosRect(tex, pos);
+
+		contentsVisible = true;
 	}
 
 	void updatePauseQuad()
@@ -669,25 +714,16 @@ struct WindowVXPrivate
 
 	void prepare()
 	{
+		if (cursorRect->changed.consume())
+			invalidateCursorVert();
+
 		if (base.vertDirty)
 		{
 			rebuildBaseVert();
 			base.vertDirty = false;
-			base.texDirty = true;
 		}
 
-		if (base.texSizeDirty)
-		{
-			updateBaseTexSize();
-			base.texSizeDirty = false;
-			base.texDirty = true;
-		}
-
-		if (base.texDirty)
-		{
-			redrawBaseTex();
-			base.texDirty = false;
-		}
+		updateBaseTex();
 
 		if (clipRectDirty)
 		{
@@ -708,6 +744,11 @@ struct WindowVXPrivate
 			ctrlVertArrayDirty = false;
 		}
 
+		/* Scrolling or resizing moves the clip
+		 * rect relative to the cursor */
+		if (currentCursorClip() != cursorClip)
+			cursorVertDirty = true;
+
 		if (cursorVertDirty)
 		{
 			rebuildCursorVert();
@@ -720,11 +761,13 @@ struct WindowVXPrivate
 			cursorVert.commit();
 			cursorVertArrayDirty = false;
 		}
+
+		updateContentsQuad();
 	}
 
 	void draw()
 	{
-		if (base.tex.tex == TEX::ID(0))
+		if (geo.w == 0 || geo.h == 0)
 			return;
 
 		bool windowskinValid = !nullOrDisposed(windowskin);
@@ -732,20 +775,27 @@ struct WindowVXPrivate
 
 		Vec2i trans = geo.pos() + sceneOffset;
 
-		SimpleAlphaShader &shader = shState->shaders().simpleAlpha;
+		SimpleAlphaShader &shader = shState->shaders().simpleAlpha();
 		shader.bind();
 		shader.applyViewportProj();
 
 		if (windowskinValid)
 		{
 			shader.setTranslation(trans);
-			shader.setTexSize(Vec2i(base.tex.width, base.tex.height));
+			shader.setTexSize(Vec2i(base.tex.texW, base.tex.texH));
 
 			TEX::bind(base.tex.tex);
-			base.quad.draw();
 
 			if (openness < 255)
+			{
+				shader.setSquash(1.0f - openness.norm, geo.h / 2.0f);
+				base.quad.draw();
+				shader.setSquash(0, 0);
+
 				return;
+			}
+
+			base.quad.draw();
 
 			windowskin->bindTex(shader);
 
@@ -757,57 +807,22 @@ struct WindowVXPrivate
 		if (openness < 255)
 			return;
 
-		bool drawCursor = cursorVert.count() > 0 && windowskinValid;
-
-		if (drawCursor || contentsValid)
+		if (cursorVert.count() > 0 && windowskinValid)
 		{
-			/* Translate cliprect from local into screen space */
-			IntRect clip = clipRect;
-			clip.setPos(clip.pos() + trans);
+			shader.setTranslation(trans + cursorOrigin());
 
-			glState.scissorBox.push();
-			glState.scissorTest.pushSet(true);
-
-			if (rgssVer >= 3)
-				glState.scissorBox.setIntersect(clip);
-			else
-				glState.scissorBox.setIntersect(IntRect(trans, geo.size()));
-
-			IntRect pad = padRect;
-			pad.setPos(pad.pos() + trans);
-
-			if (drawCursor)
-			{
-				Vec2i contTrans = pad.pos();
-				contTrans.x += cursorRect->x;
-				contTrans.y += cursorRect->y;
-
-				if (rgssVer >= 3)
-					contTrans -= contentsOff;
-
-				shader.setTranslation(contTrans);
-
-				TEX::setSmooth(true);
-				cursorVert.draw();
-				TEX::setSmooth(false);
-			}
-
-			if (contentsValid)
-			{
-				if (rgssVer <= 2)
-					glState.scissorBox.setIntersect(clip);
-
-				Vec2i contTrans = pad.pos();
-				contTrans -= contentsOff;
-				shader.setTranslation(contTrans);
+			TEX::setSmooth(true);
+			cursorVert.draw();
+			TEX::setSmooth(false);
+		}
 
-				TEX::setSmooth(false); // XXX
-				contents->bindTex(shader);
-				contentsQuad.draw();
-			}
+		if (contentsValid && contentsVisible)
+		{
+			shader.setTranslation(trans);
 
-			glState.scissorBox.pop();
-			glState.scissorTest.pop();
+			TEX::setSmooth(false); // XXX
+			contents->bindTex(shader);
+			contentsQuad.draw();
 		}
 
 		TEX::setSmooth(false); // XXX FIND out a way to eliminate
@@ -837,6 +852,11 @@ void WindowVX::update()
 {
 	guardDisposed();
 
+	/* Cursor and pause animations are stepped by every
+	 * update, so a window showing them is never idle */
+	if (p->active || p->pause)
+		markSceneDirty();
+
 	p->stepAnimations();
 
 	p->updatePauseQuad();
@@ -855,13 +875,13 @@ void WindowVX::move(int x, int y, int width, int height)
 	if (p->geo.size() != size)
 	{
 		p->base.vertDirty = true;
-		p->base.texSizeDirty = true;
 		p->clipRectDirty = true;
 		p->ctrlVertDirty = true;
 	}
 
 	p->geo = IntRect(Vec2i(x, y), size);
 	p->updateBaseQuad();
+	markSceneDirty();
 }
 
 bool WindowVX::isOpen() const
@@ -878,10 +898,10 @@ bool WindowVX::isClosed() const
 	return p->openness == 0;
 }
 
-DEF_ATTR_SIMPLE(WindowVX, X,          int,     p->geo.x)
-DEF_ATTR_SIMPLE(WindowVX, Y,          int,     p->geo.y)
-DEF_ATTR_SIMPLE(WindowVX, CursorRect, Rect&,  *p->cursorRect)
-DEF_ATTR_SIMPLE(WindowVX, Tone,       Tone&,  *p->tone)
+DEF_ATTR_SCENE(WindowVX, X,          int,     p->geo.x)
+DEF_ATTR_SCENE(WindowVX, Y,          int,     p->geo.y)
+DEF_ATTR_SCENE(WindowVX, CursorRect, Rect&,  *p->cursorRect)
+DEF_ATTR_SCENE(WindowVX, Tone,       Tone&,  *p->tone)
 
 DEF_ATTR_RD_SIMPLE(WindowVX, Windowskin,      Bitmap*, p->windowskin)
 DEF_ATTR_RD_SIMPLE(WindowVX, Contents,        Bitmap*, p->contents)
@@ -907,7 +927,7 @@ void WindowVX::setWindowskin(Bitmap *value)
 		return;
 
 	p->windowskin = value;
-	p->base.texDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setContents(Bitmap *value)
@@ -918,12 +938,11 @@ void WindowVX::setContents(Bitmap *value)
 		return;
 
 	p->contents = value;
+	markSceneDirty();
 
 	if (nullOrDisposed(value))
 		return;
 
-	FloatRect rect = p->contents->rect();
-	p->contentsQuad.setTexPosRect(rect, rect);
 	p->ctrlVertDirty = true;
 }
 
@@ -937,6 +956,7 @@ void WindowVX::setActive(bool value)
 	p->active = value;
 	p->cursorAlphaIdx = cursorAlphaResetIdx;
 	p->updateCursorAlpha();
+	markSceneDirty();
 }
 
 void WindowVX::setArrowsVisible(bool value)
@@ -948,6 +968,7 @@ void WindowVX::setArrowsVisible(bool value)
 
 	p->arrowsVisible = value;
 	p->ctrlVertDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setPause(bool value)
@@ -961,6 +982,7 @@ void WindowVX::setPause(bool value)
 	p->pauseAlphaIdx = 0;
 	p->pauseQuadIdx = 0;
 	p->ctrlVertDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setWidth(int value)
@@ -973,10 +995,10 @@ void WindowVX::setWidth(int value)
 	p->width = value;
 	p->geo.w = std::max(0, value);
 	p->base.vertDirty = true;
-	p->base.texSizeDirty = true;
 	p->clipRectDirty = true;
 	p->ctrlVertDirty = true;
 	p->updateBaseQuad();
+	markSceneDirty();
 }
 
 void WindowVX::setHeight(int value)
@@ -989,10 +1011,10 @@ void WindowVX::setHeight(int value)
 	p->height = value;
 	p->geo.h = std::max(0, value);
 	p->base.vertDirty = true;
-	p->base.texSizeDirty = true;
 	p->clipRectDirty = true;
 	p->ctrlVertDirty = true;
 	p->updateBaseQuad();
+	markSceneDirty();
 }
 
 void WindowVX::setOX(int value)
@@ -1004,6 +1026,7 @@ void WindowVX::setOX(int value)
 
 	p->contentsOff.x = value;
 	p->ctrlVertDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setOY(int value)
@@ -1015,6 +1038,7 @@ void WindowVX::setOY(int value)
 
 	p->contentsOff.y = value;
 	p->ctrlVertDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setPadding(int value)
@@ -1027,6 +1051,7 @@ void WindowVX::setPadding(int value)
 	p->padding = value;
 	p->paddingBottom = value;
 	p->clipRectDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setPaddingBottom(int value)
@@ -1038,6 +1063,7 @@ void WindowVX::setPaddingBottom(int value)
 
 	p->paddingBottom = value;
 	p->clipRectDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setOpacity(int value)
@@ -1049,6 +1075,7 @@ void WindowVX::setOpacity(int value)
 
 	p->opacity = value;
 	p->base.quad.setColor(Vec4(1, 1, 1, p->opacity.norm));
+	markSceneDirty();
 }
 
 void WindowVX::setBackOpacity(int value)
@@ -1059,7 +1086,7 @@ void WindowVX::setBackOpacity(int value)
 		return;
 
 	p->backOpacity = value;
-	p->base.texDirty = true;
+	markSceneDirty();
 }
 
 void WindowVX::setContentsOpacity(int value)
@@ -1071,6 +1098,7 @@ void WindowVX::setContentsOpacity(int value)
 
 	p->contentsOpacity = value;
 	p->contentsQuad.setColor(Vec4(1, 1, 1, p->contentsOpacity.norm));
+	markSceneDirty();
 }
 
 void WindowVX::setOpenness(int value)
@@ -1081,23 +1109,23 @@ void WindowVX::setOpenness(int value)
 		return;
 
 	p->openness = value;
-	p->updateBaseQuad();
+	markSceneDirty();
 }
 
 void WindowVX::initDynAttribs()
 {
 	p->cursorRect = new Rect;
-	p->refreshCursorRectCon();
 
 	if (rgssVer >= 3)
 	{
 		p->tone = new Tone;
-		p->refreshToneCon();
 	}
 }
 
 void WindowVX::draw()
 {
+	PROFILE_SCOPE(Windows);
+
 	p->draw();
 }
 
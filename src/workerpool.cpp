@@ -0,0 +1,318 @@
+/*
+** workerpool.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "workerpool.h"
+
+#include "sdl-util.h"
+#include "profiler.h"
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#ifdef __vita__
+#include <psp2/kernel/threadmgr.h>
+#endif
+
+struct WorkerThread
+{
+	WorkerPoolPrivate *pool;
+	size_t index;
+	SDL_Thread *thread;
+	SDL_threadID id;
+
+	void run();
+};
+
+typedef std::deque<WorkerJob*> JobQueue;
+
+struct WorkerPoolPrivate
+{
+	const int threadCount;
+	std::vector<WorkerThread> threads;
+
+	/* Guards everything below, and all job states */
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+
+	/* One per thread */
+	std::vector<JobQueue> queues;
+	size_t nextQueue;
+
+	/* Done, with their continuation not run yet */
+	std::vector<WorkerJob*> finished;
+
+	bool quit;
+
+	WorkerPoolPrivate(int threadCount)
+	    : threadCount(threadCount),
+	      mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      queues(std::max(threadCount, 1)),
+	      nextQueue(0),
+	      quit(false)
+	{}
+
+	~WorkerPoolPrivate()
+	{
+		SDL_LockMutex(mutex);
+		quit = true;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+
+		for (size_t i = 0; i < threads.size(); ++i)
+			SDL_WaitThread(threads[i].thread, 0);
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
+	}
+
+	/* Mutex must be held */
+	void spawnThreads()
+	{
+		/* Workers keep pointers into 'threads' */
+		threads.resize(threadCount);
+
+		for (int i = 0; i < threadCount; ++i)
+		{
+			WorkerThread &t = threads[i];
+			t.pool = this;
+			t.index = i;
+			t.id = 0;
+			t.thread = createSDLThread<WorkerThread, &WorkerThread::run>
+			        (&t, "worker", ThreadPolicy::Worker);
+		}
+	}
+
+	/* Mutex must be held. Index of the worker
+	 * running on the calling thread, or -1 */
+	int currentWorker() const
+	{
+		const SDL_threadID self = SDL_ThreadID();
+
+		for (size_t i = 0; i < threads.size(); ++i)
+			if (threads[i].id == self)
+				return i;
+
+		return -1;
+	}
+
+	/* Mutex must be held. Pops from the back of
+	 * the own deque, or steals from the front of
+	 * another one. Returns null if all are empty */
+	WorkerJob *take(size_t self)
+	{
+		JobQueue &own = queues[self];
+
+		if (!own.empty())
+		{
+			WorkerJob *job = own.back();
+			own.pop_back();
+
+			return job;
+		}
+
+		for (size_t i = 1; i < queues.size(); ++i)
+		{
+			JobQueue &victim = queues[(self + i) % queues.size()];
+
+			if (victim.empty())
+				continue;
+
+			WorkerJob *job = victim.front();
+			victim.pop_front();
+
+			return job;
+		}
+
+		return 0;
+	}
+
+	/* Mutex must be held; returns with it held */
+	void execute(WorkerJob &job)
+	{
+		job.state = WorkerJob::Running;
+
+		SDL_UnlockMutex(mutex);
+		{
+			TRACE_SCOPE("WorkerJob::run");
+			job.run();
+		}
+		SDL_LockMutex(mutex);
+
+		job.state = WorkerJob::Done;
+
+		if (job.hasContinuation)
+			finished.push_back(&job);
+
+		SDL_CondBroadcast(cond);
+	}
+
+	static void pinToCore(size_t index)
+	{
+#ifdef __vita__
+		/* Of the three user cores, leave the first one
+		 * to the RGSS thread and spread over the others */
+		const int core = 1 + index % 2;
+
+		sceKernelChangeThreadCpuAffinityMask(sceKernelGetThreadId(),
+		                                     SCE_KERNEL_CPU_MASK_USER_0 << core);
+#else
+		(void) index;
+#endif
+	}
+
+	void worker(WorkerThread &self)
+	{
+		pinToCore(self.index);
+
+		SDL_LockMutex(mutex);
+
+		self.id = SDL_ThreadID();
+
+		while (true)
+		{
+			/* Jobs left behind at shutdown are run
+			 * by whoever waits on them */
+			if (quit)
+				break;
+
+			WorkerJob *job = take(self.index);
+
+			if (!job)
+			{
+				SDL_CondWait(cond, mutex);
+				continue;
+			}
+
+			execute(*job);
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+};
+
+void WorkerThread::run()
+{
+	pool->worker(*this);
+}
+
+WorkerPool::WorkerPool(int threadCount)
+{
+	p = new WorkerPoolPrivate(threadCount);
+}
+
+WorkerPool::~WorkerPool()
+{
+	delete p;
+}
+
+bool WorkerPool::enabled() const
+{
+	return p->threadCount > 0;
+}
+
+void WorkerPool::submit(WorkerJob &job, bool continuation)
+{
+	SDL_LockMutex(p->mutex);
+
+	if (p->threads.empty())
+		p->spawnThreads();
+
+	int self = p->currentWorker();
+
+	if (self >= 0)
+		job.queueIdx = self;
+	else
+		job.queueIdx = p->nextQueue++ % p->queues.size();
+
+	job.state = WorkerJob::Queued;
+	job.hasContinuation = continuation;
+	p->queues[job.queueIdx].push_back(&job);
+
+	/* Any worker may take it, the owner of the deque or a thief */
+	SDL_CondBroadcast(p->cond);
+	SDL_UnlockMutex(p->mutex);
+}
+
+bool WorkerPool::isDone(WorkerJob &job)
+{
+	SDL_LockMutex(p->mutex);
+	bool done = job.state == WorkerJob::Done;
+	SDL_UnlockMutex(p->mutex);
+
+	return done;
+}
+
+void WorkerPool::wait(WorkerJob &job)
+{
+	TRACE_SCOPE("WorkerPool::wait");
+
+	SDL_LockMutex(p->mutex);
+
+	if (job.state == WorkerJob::Queued)
+	{
+		/* Take it over rather than waiting behind other jobs */
+		JobQueue &queue = p->queues[job.queueIdx];
+		queue.erase(std::find(queue.begin(), queue.end(), &job));
+
+		p->execute(job);
+	}
+
+	while (job.state == WorkerJob::Running)
+		SDL_CondWait(p->cond, p->mutex);
+
+	bool continuation = false;
+
+	if (job.hasContinuation)
+	{
+		std::vector<WorkerJob*>::iterator iter =
+		        std::find(p->finished.begin(), p->finished.end(), &job);
+
+		if (iter != p->finished.end())
+		{
+			p->finished.erase(iter);
+			continuation = true;
+		}
+	}
+
+	SDL_UnlockMutex(p->mutex);
+
+	if (continuation)
+		job.complete();
+}
+
+void WorkerPool::runContinuations()
+{
+	std::vector<WorkerJob*> jobs;
+
+	SDL_LockMutex(p->mutex);
+	jobs.swap(p->finished);
+	SDL_UnlockMutex(p->mutex);
+
+	/* Jobs may free themselves in their continuation */
+	for (size_t i = 0; i < jobs.size(); ++i)
+		jobs[i]->complete();
+}
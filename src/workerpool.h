@@ -0,0 +1,106 @@
+/*
+** workerpool.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2013 - 2021 Amaryllis Kulla <ancurio@mapleshrine.eu>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stddef.h>
+
+struct WorkerPoolPrivate;
+
+/* A unit of work to be executed by a WorkerPool.
+ * Jobs are owned by whoever submits them and must
+ * not be deleted before they are done (or, if they
+ * have a continuation, before it has run) */
+struct WorkerJob
+{
+	WorkerJob()
+	    : state(Idle),
+	      queueIdx(0),
+	      hasContinuation(false)
+	{}
+
+	virtual ~WorkerJob() {}
+
+	/* Called on a worker thread (or the waiting one) */
+	virtual void run() = 0;
+
+	/* Continuation, called on the RGSS thread once 'run()'
+	 * finished, either at the next Graphics.update or from
+	 * 'WorkerPool::wait()', whichever comes first. Only for
+	 * jobs submitted with 'continuation' set */
+	virtual void complete() {}
+
+private:
+	enum State
+	{
+		Idle,
+		Queued,
+		Running,
+		Done
+	};
+
+	State state;
+	/* Deque the job was queued on */
+	size_t queueIdx;
+	bool hasContinuation;
+
+	friend class WorkerPool;
+	friend struct WorkerPoolPrivate;
+};
+
+/* Central job system shared by the engine subsystems. Each of
+ * the (fixed number of) threads owns a deque of jobs: jobs
+ * submitted from a worker go to its own deque and are picked
+ * from its back (most recent first, while their data is still
+ * in cache); others are distributed round robin. Idle workers
+ * steal from the front of the other deques. On the Vita, the
+ * workers are pinned to the cores the RGSS thread doesn't
+ * occupy. The threads are only spawned once the first job
+ * arrives */
+class WorkerPool
+{
+public:
+	WorkerPool(int threadCount);
+	~WorkerPool();
+
+	/* With zero threads, callers should do their work inline */
+	bool enabled() const;
+
+	void submit(WorkerJob &job, bool continuation = false);
+
+	bool isDone(WorkerJob &job);
+
+	/* Blocks until 'job' is done. If no worker picked it
+	 * up yet, it is executed on the calling thread instead.
+	 * Runs the job's continuation if it's still pending */
+	void wait(WorkerJob &job);
+
+	/* Runs the continuations of all jobs finished since
+	 * the last call. Called by Graphics::update */
+	void runContinuations();
+
+private:
+	WorkerPoolPrivate *p;
+};
+
+#endif // WORKERPOOL_H